@@ -47,6 +47,75 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     | WMatchAsn _ -> true
     | _ -> false
   
+  (* Region: parallel exploration of branches *)
+
+  (* Number of forked processes that are exploring right branches, see [start_branch_worker], and depth of
+     the branch being explored. *)
+  let branch_workers = ref 0
+  let branch_depth = ref 0
+
+  (** [start_branch_worker cont] forks a process that explores the right branch [cont] of a branch at depth
+      at least [options.option_branch_depth], if fewer than [options.option_branch_jobs - 1] such processes
+      are running. The process starts from a copy of this one, prover included, and reports the statements
+      it executed if the branch succeeds. It does not fork processes itself. Like the workers of
+      [option_jobs], it is not used with should-fail directives, focus, breakpoints, or manifests, which
+      need every path to be explored in one process. *)
+  let start_branch_worker cont =
+    if options.option_branch_jobs > 1 && Sys.os_type = "Unix" && !branch_depth >= options.option_branch_depth &&
+       !branch_workers < options.option_branch_jobs - 1 && focus = None && breakpoint = None && !targetPath = None &&
+       !shouldFailLocs = [] && not options.option_emit_manifest then begin
+      let (fd_in, fd_out) = Unix.pipe ~cloexec:true () in
+      flush_all ();
+      match Unix.fork () with
+        0 ->
+        Unix.close fd_in;
+        let devnull = Unix.openfile "/dev/null" [Unix.O_WRONLY] 0 in
+        Unix.dup2 devnull Unix.stdout;
+        branch_workers := options.option_branch_jobs;
+        let stmts_executed = ref [] in
+        reportStmtExec0 := (fun l -> stmts_executed := l::!stmts_executed);
+        let stmt_locs0 = Hashtbl.create 100 in
+        !stats#getStmtExecLocs |> List.iter (fun l -> Hashtbl.replace stmt_locs0 l ());
+        let succeeded =
+          try push_context (Branching RightBranch); execute_branch cont; true with _ -> false
+        in
+        if succeeded then begin
+          let stmt_locs = !stats#getStmtExecLocs |> List.filter (fun l -> not (Hashtbl.mem stmt_locs0 l)) in
+          let ch = Unix.out_channel_of_descr fd_out in
+          output_value ch (List.rev !stmts_executed, stmt_locs);
+          close_out ch
+        end;
+        Unix._exit 0
+      | pid ->
+        Unix.close fd_out;
+        incr branch_workers;
+        Some (pid, fd_in)
+    end else
+      None
+
+  (** [join_branch_worker (pid, fd_in)] waits for the process started by [start_branch_worker] and returns
+      whether its branch succeeded, after reporting the statements it executed. *)
+  let join_branch_worker (pid, fd_in) =
+    let ch = Unix.in_channel_of_descr fd_in in
+    let result = try Some (input_value ch: loc0 list * loc list) with End_of_file | Failure _ -> None in
+    close_in ch;
+    ignore (Unix.waitpid [] pid);
+    decr branch_workers;
+    match result with
+      Some (stmts_executed, stmt_locs) ->
+      stmts_executed |> List.iter !reportStmtExec0;
+      stmt_locs |> List.iter (fun l -> !stats#stmtExec l);
+      true
+    | None -> false
+
+  (** [abandon_branch_worker (pid, fd_in)] stops the process started by [start_branch_worker], whose result is
+      not needed since the left branch failed. *)
+  let abandon_branch_worker (pid, fd_in) =
+    (try Unix.kill pid Sys.sigkill with Unix.Unix_error _ -> ());
+    Unix.close fd_in;
+    ignore (Unix.waitpid [] pid);
+    decr branch_workers
+
   let rec assert_expr env e h env l msg url = 
     let t = eval None env e in
     if query_term t then
@@ -61,15 +130,26 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     let leftForest = ref [] in
     let rightForest = ref [] in
     oldForest := Node (BranchNode, rightForest)::Node (BranchNode, leftForest)::!oldForest;
+    (* The right branch is explored by a forked process meanwhile, if any. If it fails, it is explored again
+       here, so errors are reported as if it was not forked. *)
+    let right_worker = start_branch_worker cont2 in
     currentForest := leftForest;
     push_context (Branching LeftBranch);
-    execute_branch cont1;
+    incr branch_depth;
+    begin try execute_branch cont1 with e -> decr branch_depth; Option.iter abandon_branch_worker right_worker; raise e end;
+    decr branch_depth;
     pop_context ();
     if !leftForest = [] then leftForest := [Node (SuccessNode, ref [])];
     currentForest := rightForest;
-    push_context (Branching RightBranch);
-    execute_branch cont2;
-    pop_context ();
+    begin match right_worker with
+      Some worker when join_branch_worker worker -> ()
+    | _ ->
+      push_context (Branching RightBranch);
+      incr branch_depth;
+      begin try execute_branch cont2 with e -> decr branch_depth; raise e end;
+      decr branch_depth;
+      pop_context ()
+    end;
     if !rightForest = [] then rightForest := [Node (SuccessNode, ref [])];
     currentForest := oldForest;
     SymExecSuccess
@@ -278,12 +358,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         | Chunk (g_symb', targs', coef', ts', size') as chunk::htodo ->
           if predname_eq g_symb g_symb' && List.for_all2 unify targs targs' && for_all_take2 definitely_equal n ts ts' then
             let assume_all_eq ts ts' cont =
-              let rec iter ts ts' =
-                match (ts, ts') with
-                  (t::ts, t'::ts') -> assume (ctxt#mk_eq t t') (fun () -> iter ts ts')
-                | ([], []) -> cont ()
-              in
-              iter ts ts'
+              assume_all (List.map2 (fun t t' -> ctxt#mk_eq t t') ts ts') cont
             in
             assume_all_eq (drop n ts) (drop n ts') $. fun () ->
             let h = if List.length hdone < List.length htodo then hdone @ htodo else htodo @ hdone in
@@ -773,14 +848,23 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     cont (match_coef ghostenv env $. fun chunk ghostenv env coef0 newChunks -> Some (chunk, coef0, ts0, size0, ghostenv, env, env', newChunks))
   
   let lookup_points_to_chunk_core h0 f_symb targs t =
-    let rec iter h =
+    (* A chunk whose address is the very term [t] is found without querying the prover, which matters when
+       the heap holds many chunks of the same field, e.g. of the elements of an array of objects. It is
+       found even if a chunk before it has an address that is only provably equal to [t]; see
+       tests/same_term_chunk_order.c. *)
+    let rec iter_same_term h =
+      match h with
+        [] -> iter h0
+      | Chunk ((g, true), targs', coef, [t0; v], _)::_ when g == f_symb && t0 == t && List.for_all2 unify targs targs' -> Some v
+      | _::h -> iter_same_term h
+    and iter h =
       match h with
         [] -> None
       | Chunk ((g, true), targs', coef, [t0; v], _)::_ when g == f_symb && List.for_all2 unify targs targs' && definitely_equal t0 t -> Some v
       | Chunk ((g, false), targs', coef, [t0; v], _):: _ when definitely_equal g f_symb && List.for_all2 unify targs targs' && definitely_equal t0 t -> Some v
       | _::h -> iter h
     in
-    iter h0
+    iter_same_term h0
 
   let lookup_integer__chunk_core h0 addr k signedness =
     let integer__symb = integer__symb () in
@@ -1102,18 +1186,41 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let consume_chunk_core rules h typeid_env ghostenv env env' l g targs coef coefpat inputParamCount pats tps0 tps cont =
     if !verbosity >= 4 then printff "%10.6fs: Consuming chunk %s\n" (Perf.time ()) (string_of_chunk_asn env g targs coef coefpat pats);
     let old_depth = !consume_chunk_recursion_depth in
+    (* Whether the first argument of a chunk of [g] is the very term of the first input pattern, e.g. the
+       address of a field. Such chunks are tried first, as matching that argument needs no prover query, and
+       are not tried again by the scan of the other chunks. So if several chunks match, such a chunk is
+       consumed even if another one comes before it in the heap; see tests/same_term_chunk_order.c. Keeping
+       the heap order instead would take the prover queries for the chunks before it that this avoids. *)
+    let has_same_first_input =
+      match g, pats, inputParamCount with
+        ((symb, true), TermPat t::_, Some n) when n > 0 ->
+        begin function Chunk ((g', true), _, _, t0::_, _) -> g' == symb && t0 == t | _ -> false end
+      | _ -> fun _ -> false
+    in
     let rec consume_chunk_core_core h =
       begin fun cont ->
       let rec iter hprefix h =
         match h with
           [] -> cont []
+        | chunk::h when has_same_first_input chunk -> iter (chunk::hprefix) h
         | chunk::h ->
           match_chunk ghostenv h env env' l g targs coef coefpat inputParamCount pats tps0 tps chunk $. fun result ->
           match result with
             None -> iter (chunk::hprefix) h
           | Some (chunk, coef, ts, size, ghostenv, env, env', newChunks) -> cont [(chunk, newChunks @ hprefix @ h, coef, ts, size, ghostenv, env, env')]
       in
-      iter [] h
+      let rec iter_same_first_input hprefix h' =
+        match h' with
+          [] -> iter [] h
+        | chunk::h' when has_same_first_input chunk ->
+          match_chunk ghostenv h' env env' l g targs coef coefpat inputParamCount pats tps0 tps chunk $. fun result ->
+          begin match result with
+            None -> iter_same_first_input (chunk::hprefix) h'
+          | Some (chunk, coef, ts, size, ghostenv, env, env', newChunks) -> cont [(chunk, newChunks @ hprefix @ h', coef, ts, size, ghostenv, env, env')]
+          end
+        | chunk::h' -> iter_same_first_input (chunk::hprefix) h'
+      in
+      iter_same_first_input [] h
       end $. fun matching_chunks ->
       match matching_chunks with
         [] ->
@@ -37,8 +37,22 @@ type combination_strategy =
                                    useful for comparing the provers *)
   | Sequence                    (* Run the second prover only if the
                                    first answers Unknown *)
+  | Race                        (* Send the term to the second prover
+                                   first, so that a prover that runs in
+                                   another process works on it while
+                                   the first one does; the answer of
+                                   the second prover is only awaited if
+                                   the first one answers Unknown *)
+  | Adaptive                    (* Ask the prover that
+                                   Proverapi.prover_preference prefers,
+                                   and the other one only if the
+                                   preferred one does not find the
+                                   answer; the other one is told the
+                                   assumptions without checking them.
+                                   Without a preference, ask both and
+                                   time them, as for Sync. The first
+                                   prover is preferred by default *)
 (* other strategies of interest:
-     - run the provers in parallel (if one answers unsat, stop the other one)
      - run the provers in sequence but the first is stopped after a timeout *)
 
 (* In Ocaml, we cannot directly pass a polymorphic function as
@@ -52,6 +66,19 @@ type poly_map3 = {f : 'a 'b 'c. ('a, 'b, 'c) context -> 'c -> 'c -> 'c -> 'c}
    ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context *)
 class ['a, 'b, 'c, 'd, 'e, 'f] combined_context (p1 : ('a, 'b, 'c) context)
         (p2: ('d, 'e, 'f) context) (combination_strategy : combination_strategy) =
+  let () = if combination_strategy = Adaptive then adaptive_selection := true in
+  let timed1 f =
+    let t0 = Perf.time () in
+    let r = f () in
+    let (t1, t2) = !prover_times in prover_times := (t1 +. (Perf.time () -. t0), t2);
+    r
+  in
+  let timed2 f =
+    let t0 = Perf.time () in
+    let r = f () in
+    let (t1, t2) = !prover_times in prover_times := (t1, t2 +. (Perf.time () -. t0));
+    r
+  in
   let map (r : poly_map) = function
     | Left x -> Left (r.f p1 x)
     | Right y -> Right (r.f p2 y)
@@ -74,7 +101,7 @@ class ['a, 'b, 'c, 'd, 'e, 'f] combined_context (p1 : ('a, 'b, 'c) context)
        Right (r.f p2 a b c)
     | _ -> failwith "map3"
   in
-object
+object (self)
   (* All methods but "set_fpclauses" are trivial. The
      combination_strategy is used in methods "query" and "assume". *)
   method set_verbosity v =
@@ -160,6 +187,14 @@ object
   method pprint_sort (s1, s2) = Printf.sprintf "<%s;%s>" (p1#pprint_sort s1) (p2#pprint_sort s2)
   method push = p1#push; p2#push
   method pop = p1#pop; p2#pop
+  val mutable snapshots: (int * (int * int)) list = []
+  method snapshot =
+    let handle = List.length snapshots in
+    snapshots <- (handle, (p1#snapshot, p2#snapshot))::snapshots;
+    handle
+  method restore handle =
+    let (s1, s2) = List.assoc handle snapshots in
+    p1#restore s1; p2#restore s2
   method assume = function
     | Both (t1, t2) -> begin
         match combination_strategy with
@@ -172,6 +207,21 @@ object
            | Unsat ->
               p2#assert_term t2; Unsat
            end
+        | Race ->
+           let answer2 = p2#assume_async t2 in
+           begin match p1#assume t1 with
+           | Unknown -> answer2 ()
+           | Unsat -> Unsat
+           end
+        | Adaptive ->
+           begin match !prover_preference with
+           | PreferFirst -> let r = p1#assume t1 in p2#assert_term t2; r
+           | PreferSecond -> let r = p2#assume t2 in p1#assert_term t1; r
+           | PreferNone ->
+              let r1 = timed1 (fun () -> p1#assume t1) in
+              let r2 = timed2 (fun () -> p2#assume t2) in
+              combine_assume_result (r1, r2)
+           end
       end
     | Left _ | Right _ -> failwith "Combineprovers.assume"
   method query = function
@@ -184,8 +234,45 @@ object
         | Sequence ->
            (* Remark: the "||" operator is lazy *)
            p1#query t1 || p2#query t2
+        | Race ->
+           let answer2 = p2#query_async t2 in
+           p1#query t1 || answer2 ()
+        | Adaptive ->
+           begin match !prover_preference with
+           | PreferFirst -> p1#query t1 || p2#query t2
+           | PreferSecond -> p2#query t2 || p1#query t1
+           | PreferNone ->
+              let r1 = timed1 (fun () -> p1#query t1) in
+              let r2 = timed2 (fun () -> p2#query t2) in
+              r1 || r2
+           end
       end
     | Left _ | Right _ -> failwith "Combineprovers.query"
+  method assume_all ts =
+    let ts1 = Array.map my_fst ts in
+    let ts2 = Array.map my_snd ts in
+    match combination_strategy with
+    | Sync ->
+       combine_assume_result (p1#assume_all ts1, p2#assume_all ts2)
+    | Sequence ->
+       begin match p1#assume_all ts1 with
+       | Unknown ->
+          p2#assume_all ts2
+       | Unsat ->
+          Array.iter p2#assert_term ts2; Unsat
+       end
+    | Race ->
+       (* There is no asynchronous variant, so both provers answer in turn. *)
+       let answer2 = p2#assume_all ts2 in
+       begin match p1#assume_all ts1 with
+       | Unknown -> answer2
+       | Unsat -> Unsat
+       end
+    | Adaptive ->
+       let rec iter i = if i = Array.length ts then Unknown else match self#assume ts.(i) with Unsat -> Unsat | Unknown -> iter (i + 1) in
+       iter 0
+  method assume_async t = let result = self#assume t in fun () -> result
+  method query_async t = let result = self#query t in fun () -> result
   method assert_term = function
     | Both (t1, t2) -> begin
         p1#assert_term t1;
@@ -5,7 +5,26 @@ exception CxxAnnParseException of Ast.loc * string
 let error (loc : Ast.loc) (msg : string) =
   raise @@ CxxAnnParseException (loc, msg)
 
-type raw_annotation = Ast.loc0 * string
+(** Kind of a token the exporter ships with [-annotation_tokens], see AnnotationTokenizer.h. *)
+type token_kind =
+  | Word_token
+  | Operator_token
+  | Punctuation_token
+  | Int_token
+  | Ghost_start_token
+  | Ghost_end_token
+
+(**
+  A shipped token: its kind, the offsets of its first character and past its last character in the
+  text of the annotation, and its spelling.
+*)
+type shipped_token = token_kind * int * int * string
+
+(**
+  Location and text of an annotation, and the tokens the exporter shipped for it.
+  The tokens are empty if the text must be lexed.
+*)
+type raw_annotation = Ast.loc0 * string * shipped_token array
 
 module type Parser = sig
   val parse_func_contract :
@@ -37,6 +56,16 @@ module type Parser = sig
     string list ref ->
     string list ref ->
     Sig.header_type list * string list
+
+  val prefetch_include_directives :
+    string ->
+    raw_annotation ->
+    raw_annotation Seq.t ->
+    string list ref ->
+    string list ->
+    unit
+
+  val cancel_prefetched_include_directives : unit -> unit
 end
 
 module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Parser = struct
@@ -52,29 +81,164 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Parser = struct
   *)
   let ghost_macros = Hashtbl.create 10
 
-  let make_lexer_token_stream_core (((start_loc, _), text) : raw_annotation) =
+  let make_lexer_token_stream_core ?(report_range = Args.report_range)
+      ?(report_should_fail = Args.report_should_fail)
+      (((start_loc, _), text, _) : raw_annotation) =
     let loc, ignore_eol, token_stream, _, _ =
       Lexer.make_lexer_core
         (Parser.common_keywords @ Parser.c_keywords)
         Parser.ghost_keywords start_loc
         (text ^ "\n") (* append a newline to be able to parse //@ annotations *)
-        Args.report_range false false true Args.report_should_fail
+        report_range false false true report_should_fail
         Lexer.default_file_options.annot_char
     in
     (loc, ignore_eol, token_stream)
 
-  let make_lexer_token_stream (ann : raw_annotation) =
-    let loc, _, token_stream = make_lexer_token_stream_core ann in
-    (loc, token_stream)
+  (* Keywords inside ghost ranges, as in the lexer. Built once for all shipped tokens. *)
+  let ghost_keyword_table =
+    lazy
+      (let table = Hashtbl.create 512 in
+       List.iter
+         (fun kwd -> Hashtbl.replace table kwd ())
+         (Parser.common_keywords @ Parser.c_keywords @ Parser.ghost_keywords);
+       table)
+
+  exception Not_shipped
+
+  (**
+    [make_shipped_token_stream ann] builds the token stream of [ann] from the tokens the exporter
+    shipped for it. It yields the same tokens and locations as lexing the text of [ann] and reports the
+    same ranges and statistics. Raises [Not_shipped] if the lexer would not accept the tokens, e.g. for
+    a symbol that is not a keyword, in which case the text has to be lexed to report the error.
+  *)
+  let make_shipped_token_stream
+      ((((path, line, col), _), text, tokens) : raw_annotation) =
+    let keywords = Lazy.force ghost_keyword_table in
+    let length = String.length text in
+    let single_line = text.[1] = '/' in
+    (* The lexer appends a newline to the text. *)
+    let char_at i = if i < length then text.[i] else '\n' in
+    let line = ref line in
+    let line_pos = ref (1 - col) in
+    let scanned = ref 0 in
+    (* Positions are requested in increasing order of their offsets. *)
+    let srcpos offset =
+      while !scanned < offset do
+        let c = char_at !scanned in
+        if c = '\n' || (c = '\r' && char_at (!scanned + 1) <> '\n') then (
+          incr line;
+          line_pos := !scanned + 1);
+        incr scanned
+      done;
+      (path, !line, offset - !line_pos + 1)
+    in
+    let ghost_start = ref None in
+    let end_ghost_range end_pos =
+      Option.iter
+        (fun start_pos -> Args.report_range GhostRange (start_pos, end_pos))
+        !ghost_start;
+      ghost_start := None
+    in
+    let ghost_line_count = ref 0 in
+    let last_ghost_line = ref 0 in
+    let count_line (_, l, _) =
+      if !last_ghost_line < l then (
+        last_ghost_line := l;
+        incr ghost_line_count)
+    in
+    let nb_tokens = Array.length tokens in
+    (* Each token comes with the ranges it reports when the parser takes it. *)
+    let token i (kind, b, e, spelling) =
+      let start_pos = srcpos b in
+      let loc = (start_pos, srcpos e) in
+      let is_keyword = Hashtbl.mem keywords spelling in
+      match kind with
+      | Ghost_start_token when i = 0 ->
+          ( loc,
+            Kwd "/*@",
+            fun () ->
+              ghost_start := Some (fst loc);
+              Args.report_range GhostRangeDelimiter loc )
+      | Ghost_end_token when i = nb_tokens - 1 && not single_line ->
+          ( loc,
+            Kwd "@*/",
+            fun () ->
+              end_ghost_range (snd loc);
+              Args.report_range GhostRangeDelimiter loc )
+      | Word_token when i > 0 ->
+          ( loc,
+            (if is_keyword then Kwd spelling else Ident spelling),
+            fun () ->
+              count_line (snd loc);
+              if is_keyword then Args.report_range GhostKeywordRange loc )
+      | Operator_token when i > 0 ->
+          ( loc,
+            (if is_keyword then Kwd spelling else Ident spelling),
+            fun () -> count_line (snd loc) )
+      | Punctuation_token when i > 0 && is_keyword -> (loc, Kwd spelling, ignore)
+      | Int_token when i > 0 ->
+          let value, is_decimal =
+            if spelling.[0] = '0' then (big_int_of_octal_string spelling, false)
+            else (Big_int.big_int_of_string spelling, true)
+          in
+          (loc, Int (value, is_decimal, false, Ast.NoLSuffix, spelling), ignore)
+      | _ -> raise Not_shipped
+    in
+    let tokens = Array.mapi token tokens |> Array.to_list in
+    let tokens =
+      if single_line then
+        (* The newline ends the ghost range, before the newline itself. *)
+        let newline_pos = srcpos length in
+        tokens
+        @ [
+            ( (newline_pos, srcpos (length + 1)),
+              Kwd "@*/",
+              fun () -> end_ghost_range newline_pos );
+          ]
+      else tokens
+    in
+    let eof_pos = srcpos (length + 1) in
+    let eof =
+      ( (eof_pos, eof_pos),
+        Eof,
+        fun () ->
+          end_ghost_range eof_pos;
+          !Stats.stats#overhead ~path ~nonGhostLineCount:0
+            ~ghostLineCount:!ghost_line_count ~mixedLineCount:0 )
+    in
+    let pending = ref (tokens @ [ eof ]) in
+    let current_loc = ref (fst eof) in
+    let next _ =
+      match !pending with
+      | [] -> None
+      | (loc, tok, report) :: rest ->
+          pending := rest;
+          current_loc := loc;
+          report ();
+          Some (loc, tok)
+    in
+    ((fun () -> !current_loc), Lexer.Stream.from next)
+
+  let make_lexer_token_stream ((_, _, tokens) as ann : raw_annotation) =
+    let lex () =
+      let loc, _, token_stream = make_lexer_token_stream_core ann in
+      (loc, token_stream)
+    in
+    if Array.length tokens = 0 then lex ()
+    else try make_shipped_token_stream ann with Not_shipped -> lex ()
 
   let try_parse_no_pp ann_parser (current_loc, token_stream) =
-    try ann_parser @@ Parser.noop_preprocessor token_stream with
-    | Stream.Error msg ->
-        error
-          (Ast.Lexed (current_loc ()))
-          ("Stream error during parsing: " ^ msg)
-    | Stream.Failure ->
-        error (Ast.Lexed (current_loc ())) "Parse error in ghost code."
+    Stopwatch.start Stats.cxx_annotation_stopwatch;
+    Util.do_finally
+      (fun () ->
+        try ann_parser @@ Parser.noop_preprocessor token_stream with
+        | Stream.Error msg ->
+            error
+              (Ast.Lexed (current_loc ()))
+              ("Stream error during parsing: " ^ msg)
+        | Stream.Failure ->
+            error (Ast.Lexed (current_loc ())) "Parse error in ghost code.")
+      (fun () -> Stopwatch.stop Stats.cxx_annotation_stopwatch)
 
   let try_parse_ghost_no_pp (ann : raw_annotation) ann_parser =
     make_lexer_token_stream ann |> try_parse_no_pp ann_parser
@@ -282,23 +446,47 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Parser = struct
     try_parse_ghost_no_pp ann ann_parser
 
   (*
-    parse_include_directives
+    Options the preprocessing of ghost includes depends on, which are part of the keys of their entries in
+    [Ghost_header_cache].
+  *)
+  let ghost_include_options =
+    String.concat "\000"
+      ([
+         (match Args.data_model_opt with
+         | Some { Ast.int_width; long_width; ptr_width } ->
+             Printf.sprintf "%d,%d,%d" int_width long_width ptr_width
+         | None -> "");
+         string_of_bool Args.enforce_annotations;
+       ]
+      @ Args.include_paths @ ("" :: Args.define_macros))
+
+  (*
+    parse_include_directives_uncached
     [path]            path of the file that contains the annotation
     [ann]             annotation
     [active_headers]  used to check include cycles
     [included_files]  used to detect secondary includes
+    [report]          receives the ranges, should-fail directives and macro calls to report
   *)
-  let parse_include_directives (path : string) (ann : raw_annotation)
-      (active_headers : string list ref) (included_files : string list ref) =
+  let parse_include_directives_uncached (path : string) (ann : raw_annotation)
+      (active_headers : string list ref) (included_files : string list ref)
+      (report : Header_cache.report -> unit) =
+    let report_range kind loc = report (Header_cache.Range (kind, loc)) in
+    let report_should_fail directive loc =
+      report (Header_cache.Should_fail (directive, loc))
+    in
+    let report_macro_call call def = report (Header_cache.Macro_call (call, def)) in
     (* create a lexer for the annotation that is given *)
-    let make_virtual_file_lexer ann = make_lexer_token_stream_core ann in
+    let make_virtual_file_lexer ann =
+      make_lexer_token_stream_core ~report_range ~report_should_fail ann
+    in
     (* create a lexer for an #include directive *)
     let make_real_file_lexer path include_paths ~inGhostRange =
       let text = Lexer.readFile path in
       Lexer.make_lexer
         (Parser.common_keywords @ Parser.c_keywords)
-        Parser.ghost_keywords path text Args.report_range ~inGhostRange
-        Args.report_should_fail
+        Parser.ghost_keywords path text report_range ~inGhostRange
+        report_should_fail
     in
     let make_lexer p include_paths ~inGhostRange =
       if p = path then
@@ -310,7 +498,7 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Parser = struct
     in
     let result =
       let loc, token_stream =
-        make_sound_preprocessor_core Args.report_macro_call make_lexer path
+        make_sound_preprocessor_core report_macro_call make_lexer path
           Args.verbose Args.include_paths Args.data_model_opt Args.define_macros
           ghost_macros included_files
       in
@@ -340,4 +528,297 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Parser = struct
           error (loc ()) "Parse error during parsing of include directives."
     in
     result
+
+  (* Key of the entry in [Ghost_header_cache] for the annotation [ann] in [path], reached in the given state. *)
+  let ghost_include_key (path : string) (ann : raw_annotation)
+      (active_headers : string list) (included_files : string list) : string =
+    let ann_loc, ann_text, _ = ann in
+    Marshal.to_string
+      ( ghost_include_options,
+        path,
+        ann_loc,
+        ann_text,
+        active_headers,
+        included_files )
+      []
+
+  let report_now = function
+    | Header_cache.Range (kind, loc) -> Args.report_range kind loc
+    | Should_fail (directive, loc) -> Args.report_should_fail directive loc
+    | Macro_call (call, def) -> Args.report_macro_call call def
+
+  (*
+    Makes the reports of [entry] again and applies its changes to [ghost_macros]. Its effect on the
+    included files is up to the caller.
+  *)
+  let replay (entry : Ghost_header_cache.entry) =
+    List.iter report_now entry.Ghost_header_cache.reports;
+    entry.Ghost_header_cache.macros
+    |> List.iter (function
+         | name, Some macro -> Hashtbl.replace ghost_macros name macro
+         | name, None -> Hashtbl.remove ghost_macros name)
+
+  (*
+    Parses [ann] as [parse_include_directives_uncached] does, and returns the result as an entry of
+    [Ghost_header_cache] without digests.
+  *)
+  let parse_entry (path : string) (ann : raw_annotation)
+      (active_headers : string list ref) (included_files : string list ref) :
+      Ghost_header_cache.entry =
+    let macros_before = Hashtbl.copy ghost_macros in
+    let reports = ref [] in
+    let report r =
+      reports := r :: !reports;
+      report_now r
+    in
+    let headers, header_names =
+      parse_include_directives_uncached path ann active_headers included_files
+        report
+    in
+    let changed =
+      Hashtbl.fold
+        (fun name macro changed ->
+          match Hashtbl.find_opt macros_before name with
+          | Some before when before == macro -> changed
+          | _ -> (name, Some macro) :: changed)
+        ghost_macros []
+    in
+    let removed =
+      Hashtbl.fold
+        (fun name _ removed ->
+          if Hashtbl.mem ghost_macros name then removed
+          else (name, None) :: removed)
+        macros_before []
+    in
+    {
+      Ghost_header_cache.digests = [];
+      headers;
+      header_names;
+      included_files = !included_files;
+      macros = removed @ changed;
+      reports = List.rev !reports;
+    }
+
+  let add_entry (key : string) (entry : Ghost_header_cache.entry) =
+    try
+      let digests =
+        entry.Ghost_header_cache.headers
+        |> List.map (fun (_, (_, _, header_path), _, _) ->
+               (header_path, Digest.file header_path))
+      in
+      Ghost_header_cache.add key { entry with Ghost_header_cache.digests }
+    with Sys_error _ -> ()
+
+  (*
+    VF_CXX_GHOST_INCLUDE_JOBS=<n>   Parse up to <n> - 1 ghost include annotations that follow the current one
+                                    in forked processes, see [prefetch_include_directives]. Unix only.
+  *)
+  let ghost_include_jobs =
+    match
+      Option.bind (Sys.getenv_opt "VF_CXX_GHOST_INCLUDE_JOBS") int_of_string_opt
+    with
+    | Some n when Sys.os_type = "Unix" -> n
+    | _ -> 1
+
+  (* A ghost include annotation that is parsed by a forked process, in the state it was forked in. *)
+  type prefetched = {
+    pid : int;
+    chan : in_channel;  (** carries the entry, or [None] if the parse failed *)
+    active_headers_before : string list;
+    included_files_before : string list;
+    macros_before : (string, Ghost_header_cache.macro) Hashtbl.t;
+  }
+
+  let prefetched : (Ast.loc0, prefetched) Hashtbl.t = Hashtbl.create 8
+
+  (*
+    prefetch_include_directives
+    [path]            path of the file that contains the annotations
+    [ann]             ghost include annotation that is parsed next
+    [siblings]        ghost include annotations that immediately follow [ann]
+    [active_headers]  the active headers before [ann]
+    [included_files]  the included files before [ann]
+
+    Unless [ann] is found in [Ghost_header_cache], forks a process for each of the first
+    [ghost_include_jobs] - 1 siblings that is not being parsed yet, which parses it as if it came
+    right after the annotations before [ann]. [parse_include_directives] uses such a parse if what the annotations before it changed
+    cannot have affected it, and parses the annotation itself otherwise.
+  *)
+  let prefetch_include_directives (path : string) (ann : raw_annotation)
+      (siblings : raw_annotation Seq.t) (active_headers : string list ref)
+      (included_files : string list) =
+    let fork_parse ann =
+      let ann_loc, _, _ = ann in
+      if not (Hashtbl.mem prefetched ann_loc) then begin
+        let fd_in, fd_out = Unix.pipe ~cloexec:true () in
+        let macros_before = Hashtbl.copy ghost_macros in
+        flush_all ();
+        match Unix.fork () with
+        | 0 ->
+            Unix.close fd_in;
+            let devnull = Unix.openfile "/dev/null" [ Unix.O_WRONLY ] 0 in
+            Unix.dup2 devnull Unix.stdout;
+            Unix.close devnull;
+            let entry =
+              try
+                Some
+                  (parse_entry path ann (ref !active_headers)
+                     (ref included_files))
+              with _ -> None
+            in
+            let oc = Unix.out_channel_of_descr fd_out in
+            (try
+               Marshal.to_channel oc (entry : Ghost_header_cache.entry option) [];
+               close_out oc
+             with Sys_error _ -> ());
+            Unix._exit 0
+        | pid ->
+            Unix.close fd_out;
+            Hashtbl.replace prefetched ann_loc
+              {
+                pid;
+                chan = Unix.in_channel_of_descr fd_in;
+                active_headers_before = !active_headers;
+                included_files_before = included_files;
+                macros_before;
+              }
+      end
+    in
+    let rec iter n siblings =
+      if n > 0 then
+        match siblings () with
+        | Seq.Cons (sibling, siblings) ->
+            fork_parse sibling;
+            iter (n - 1) siblings
+        | Seq.Nil -> ()
+    in
+    if
+      ghost_include_jobs > 1
+      && Option.is_none
+           (Ghost_header_cache.find
+              (ghost_include_key path ann !active_headers included_files))
+    then iter (ghost_include_jobs - 1) siblings
+
+  let receive_prefetched (ann_loc : Ast.loc0) :
+      (prefetched * Ghost_header_cache.entry) option =
+    match Hashtbl.find_opt prefetched ann_loc with
+    | None -> None
+    | Some p ->
+        Hashtbl.remove prefetched ann_loc;
+        let entry =
+          try (Marshal.from_channel p.chan : Ghost_header_cache.entry option)
+          with End_of_file | Failure _ | Sys_error _ -> None
+        in
+        close_in_noerr p.chan;
+        (try ignore (Unix.waitpid [] p.pid) with Unix.Unix_error _ -> ());
+        Option.map (fun entry -> (p, entry)) entry
+
+  let cancel_prefetched_include_directives () =
+    prefetched
+    |> Hashtbl.iter (fun _ p ->
+           (try Unix.kill p.pid Sys.sigkill with Unix.Unix_error _ -> ());
+           close_in_noerr p.chan;
+           try ignore (Unix.waitpid [] p.pid) with Unix.Unix_error _ -> ());
+    Hashtbl.reset prefetched
+
+  (* [split_added after before] returns [Some added] if [after] is [added @ before]. *)
+  let split_added (after : string list) (before : string list) :
+      string list option =
+    let n = List.length after - List.length before in
+    if n < 0 then None
+    else
+      let added = List.filteri (fun i _ -> i < n) after in
+      if List.filteri (fun i _ -> i >= n) after = before then Some added
+      else None
+
+  (*
+    Returns the files that the prefetched parse [entry] adds to [included_files], if the annotations
+    parsed since [p] was forked cannot have affected it: they included none of these files, and none
+    of the ghost macros they defined or undefined is named in the annotation or its ghost headers.
+  *)
+  let prefetched_files_added (p : prefetched) (ann : raw_annotation)
+      (entry : Ghost_header_cache.entry) (active_headers : string list)
+      (included_files : string list) : string list option =
+    let _, ann_text, _ = ann in
+    let mentions text name =
+      let n = String.length name in
+      let rec matches i j = j = n || (text.[i + j] = name.[j] && matches i (j + 1)) in
+      let rec iter i = i + n <= String.length text && (matches i 0 || iter (i + 1)) in
+      iter 0
+    in
+    match
+      ( split_added included_files p.included_files_before,
+        split_added entry.Ghost_header_cache.included_files p.included_files_before )
+    with
+    | Some added_before, Some added
+      when active_headers = p.active_headers_before
+           && not (List.exists (fun file -> List.mem file added_before) added)
+      -> (
+        let changed_macros =
+          Hashtbl.fold
+            (fun name macro changed ->
+              match Hashtbl.find_opt p.macros_before name with
+              | Some before when before == macro -> changed
+              | _ -> name :: changed)
+            ghost_macros []
+          @ Hashtbl.fold
+              (fun name _ removed ->
+                if Hashtbl.mem ghost_macros name then removed
+                else name :: removed)
+              p.macros_before []
+        in
+        try
+          let texts =
+            ann_text
+            :: List.map
+                 (fun (_, (_, _, header_path), _, _) -> Lexer.readFile header_path)
+                 entry.Ghost_header_cache.headers
+          in
+          if
+            List.exists
+              (fun name -> List.exists (fun text -> mentions text name) texts)
+              changed_macros
+          then None
+          else Some added
+        with Sys_error _ -> None)
+    | _ -> None
+
+  (*
+    parse_include_directives
+    Same as [parse_include_directives_uncached], but reuses the result of an earlier parse of the same
+    annotation in the same state from [Ghost_header_cache], as long as none of its ghost headers changed,
+    or a parse by [prefetch_include_directives] that the annotations before it cannot have affected.
+    Its reports are made again and its effects on [ghost_macros] and [included_files] are replayed.
+  *)
+  let parse_include_directives (path : string) (ann : raw_annotation)
+      (active_headers : string list ref) (included_files : string list ref) =
+    let ann_loc, _, _ = ann in
+    let key = ghost_include_key path ann !active_headers !included_files in
+    let prefetched_entry () =
+      match receive_prefetched ann_loc with
+      | Some (p, entry) -> (
+          match
+            prefetched_files_added p ann entry !active_headers !included_files
+          with
+          | Some added -> Some (entry, added)
+          | None -> None)
+      | None -> None
+    in
+    match Ghost_header_cache.find key with
+    | Some entry ->
+        replay entry;
+        included_files := entry.Ghost_header_cache.included_files;
+        (entry.Ghost_header_cache.headers, entry.Ghost_header_cache.header_names)
+    | None -> (
+        match prefetched_entry () with
+        | Some (entry, added) ->
+            replay entry;
+            included_files := added @ !included_files;
+            add_entry key
+              { entry with Ghost_header_cache.included_files = !included_files };
+            (entry.Ghost_header_cache.headers, entry.Ghost_header_cache.header_names)
+        | None ->
+            let entry = parse_entry path ann active_headers included_files in
+            add_entry key entry;
+            (entry.Ghost_header_cache.headers, entry.Ghost_header_cache.header_names))
 end
@@ -1,8 +1,11 @@
 #include "ASTSerializer.h"
+#include "AnnotationTokenizer.h"
+#include "Census.h"
 #include "DeclSerializer.h"
 #include "ExprSerializer.h"
 #include "LocationSerializer.h"
 #include "StmtSerializer.h"
+#include "Timings.h"
 #include "TypeSerializer.h"
 
 namespace {
@@ -17,39 +20,107 @@ namespace vf {
 
 void ASTSerializer::serialize(DeclNodeBuilder builder,
                               const clang::Decl *decl) const {
-  DeclSerializer serializer(*this);
-  serializer.serialize(decl, builder);
+  Timings::Scope timing(Timings::Decls);
+  // The serializers are final, so their overloads are called directly.
+  DeclSerializer(*this).serialize(decl, builder.initLoc(), builder.initDesc());
 }
 
 void ASTSerializer::serialize(StmtNodeBuilder builder,
                               const clang::Stmt *stmt) const {
-  StmtSerializer serializer(*this);
-  serializer.serialize(stmt, builder);
+  Timings::Scope timing(Timings::Stmts);
+  StmtSerializer(*this).serialize(stmt, builder.initLoc(), builder.initDesc());
 }
 
 void ASTSerializer::serialize(ExprNodeBuilder builder,
                               const clang::Expr *expr) const {
-  ExprSerializer serializer(*this);
-  serializer.serialize(expr, builder);
+  Timings::Scope timing(Timings::Exprs);
+  ExprSerializer(*this).serialize(expr, builder);
 }
 
 void ASTSerializer::serialize(TypeNodeBuilder builder,
                               clang::TypeLoc typeLoc) const {
-  TypeLocSerializer serializer(*this);
-  serializer.serialize(typeLoc, builder);
+  Timings::Scope timing(Timings::Types);
+  TypeLocSerializer(*this).serialize(typeLoc, builder.initLoc(),
+                                     builder.initDesc());
 }
 
 void ASTSerializer::serialize(stubs::Type::Builder builder,
                               clang::QualType type) const {
-  TypeSerializer serializer(*this);
-  serializer.serialize(type.getTypePtr(), builder);
+  Timings::Scope timing(Timings::Types);
+  if (m_typeTable) {
+    // Qualifiers are not serialized, so types are interned without them.
+    const clang::Type *typePtr = type.getTypePtr();
+    builder.setRef(m_typeTable->intern(
+        typePtr, [this, typePtr](stubs::Type::Builder entryBuilder) {
+          // Entries are orphans, so they do not add to the enclosing node.
+          Census::Detached detached;
+          TypeSerializer(*this).serialize(typePtr, entryBuilder);
+        }));
+    return;
+  }
+  TypeSerializer(*this).serialize(type.getTypePtr(), builder);
 }
 
 void ASTSerializer::serialize(LocBuilder locBuilder,
                               clang::SourceRange range) const {
+  Timings::Scope timing(Timings::Locations);
+  if (m_locationTable) {
+    locBuilder.setRef(m_locationTable->intern(range));
+    return;
+  }
   m_locationSerializer.serialize(range, locBuilder);
 }
 
+void ASTSerializer::serializeLocationTable(
+    ListBuilder<stubs::Loc> builder) const {
+  if (!m_locationTable) {
+    return;
+  }
+  Timings::Scope timing(Timings::Locations);
+  m_locationTable->serialize(m_locationSerializer, builder);
+  m_locationTable->clear();
+}
+
+uint32_t ASTSerializer::getLocationRef(clang::SourceRange range) const {
+  assert(m_locationTable && "No location table is used");
+  Timings::Scope timing(Timings::Locations);
+  return m_locationTable->intern(range);
+}
+
+uint32_t ASTSerializer::getNameRef(kj::StringPtr name) const {
+  assert(m_nameTable && "No name table is used");
+  return m_nameTable->intern(name);
+}
+
+void ASTSerializer::serializeName(stubs::RecordRef::Builder builder,
+                                  kj::StringPtr name) const {
+  if (m_nameTable) {
+    builder.setNameRef(m_nameTable->intern(name));
+    return;
+  }
+  builder.setName(name);
+}
+
+void ASTSerializer::serializeNameTable(
+    capnp::List<capnp::Text>::Builder builder) const {
+  if (!m_nameTable) {
+    return;
+  }
+  m_nameTable->serialize(builder);
+  m_nameTable->clear();
+  m_declRefNameRefs.clear();
+  m_memberNameRefs.clear();
+}
+
+void ASTSerializer::serializeTypeTable(ListBuilder<stubs::Type> builder) const {
+  if (!m_typeTable) {
+    return;
+  }
+  Timings::Scope timing(Timings::Types);
+  m_typeTable->serialize(builder);
+  m_typeTable->clear();
+}
+
 void ASTSerializer::serialize(
     ListBuilder<stubs::Param> builder,
     llvm::ArrayRef<clang::ParmVarDecl *> params) const {
@@ -80,7 +151,74 @@ void ASTSerializer::serialize(
 void ASTSerializer::serialize(stubs::Clause::Builder builder,
                               const Text &text) const {
   serialize(builder.initLoc(), text.getRange());
-  builder.setText(text.getText().data());
+  serializeText(
+      text.getText(), text.getRange().getBegin(),
+      [&](unsigned size) { return builder.initText(size); },
+      [&]() { return builder.initSlice(); });
+  serializeTokens(text.getText(),
+                  [&](unsigned size) { return builder.initTokens(size); });
+}
+
+void ASTSerializer::serialize(stubs::Clause::Builder builder,
+                              const Annotation &annotation) const {
+  serialize(builder, static_cast<const Text &>(annotation));
+  builder.setKind(static_cast<stubs::AnnotationKind>(annotation.getKind()));
+  builder.setKeyword(
+      static_cast<stubs::AnnotationKeyword>(annotation.getKeyword()));
+}
+
+void ASTSerializer::serializeTokens(
+    std::string_view text,
+    llvm::function_ref<ListBuilder<stubs::Token>(unsigned)> initTokens) const {
+  if (!m_annotationTokens) {
+    return;
+  }
+  assert(m_nameTable && "Annotation tokens require a name table");
+  llvm::SmallVector<AnnotationToken, 64> tokens;
+  if (!tokenizeAnnotation(text, tokens)) {
+    return;
+  }
+
+  ListBuilder<stubs::Token> tokensBuilder = initTokens(tokens.size());
+  size_t i(0);
+  for (const AnnotationToken &token : tokens) {
+    stubs::Token::Builder tokenBuilder = tokensBuilder[i++];
+    tokenBuilder.setKind(static_cast<stubs::Token::Kind>(token.kind));
+    tokenBuilder.setBegin(token.begin);
+    tokenBuilder.setEnd(token.end);
+    if (token.kind != AnnotationToken::Int) {
+      llvm::StringRef spelling(text.data() + token.begin,
+                               token.end - token.begin);
+      std::optional<uint32_t> index = m_nameTable->find(spelling);
+      tokenBuilder.setName(index ? *index
+                                 : m_nameTable->intern(internName(spelling)));
+    }
+  }
+}
+
+void ASTSerializer::serializeText(
+    std::string_view text, clang::SourceLocation loc,
+    llvm::function_ref<capnp::Text::Builder(unsigned)> initText,
+    llvm::function_ref<stubs::TextSlice::Builder()> initSlice) const {
+  if (m_annotationSlices && loc.isValid()) {
+    const clang::SourceManager &SM = m_ASTContext->getSourceManager();
+    clang::FileID fileID = SM.getFileID(SM.getFileLoc(loc));
+    const clang::FileEntry *entry = SM.getFileEntryForID(fileID);
+    bool invalid = false;
+    llvm::StringRef buffer = SM.getBufferData(fileID, &invalid);
+    // The text of a comment refers to the buffer it was lexed from; text
+    // that was assembled elsewhere, e.g. by a snapshot, is copied.
+    if (entry && !invalid && text.data() >= buffer.begin() &&
+        text.data() + text.size() <= buffer.end()) {
+      initText(0);
+      stubs::TextSlice::Builder slice = initSlice();
+      slice.setFd(m_locationSerializer.getFileIds().fd(*entry));
+      slice.setOffset(text.data() - buffer.begin());
+      slice.setLength(text.size());
+      return;
+    }
+  }
+  copyText(initText(text.size()), text);
 }
 
 namespace {
@@ -110,11 +248,17 @@ void ASTSerializer::serialize(ListBuilder<stubs::Clause> builder,
   serializeTextArray(builder, annotations, this);
 }
 
-std::string
-ASTSerializer::getQualifiedName(const clang::NamedDecl *decl) const {
-  auto it = m_nameCache.find(decl->getID());
+kj::StringPtr ASTSerializer::internName(llvm::StringRef name) const {
+  char *copy = m_nameAllocator.Allocate<char>(name.size() + 1);
+  std::copy(name.begin(), name.end(), copy);
+  copy[name.size()] = '\0';
+  return kj::StringPtr(copy, name.size());
+}
 
-  if (it != m_nameCache.end()) {
+kj::StringPtr
+ASTSerializer::getQualifiedName(const clang::NamedDecl *decl) const {
+  auto [it, inserted] = m_qualifiedNames.try_emplace(decl);
+  if (!inserted) {
     return it->getSecond();
   }
 
@@ -123,16 +267,14 @@ ASTSerializer::getQualifiedName(const clang::NamedDecl *decl) const {
   printQualifiedName(decl, os, m_ASTContext->getPrintingPolicy());
   os.flush();
 
-  m_nameCache.insert({decl->getID(), s});
-
-  return s;
+  // Interning does not insert into the map, so the iterator stays valid.
+  return it->getSecond() = internName(s);
 }
 
-std::string
+kj::StringPtr
 ASTSerializer::getQualifiedFuncName(const clang::FunctionDecl *decl) const {
-  auto it = m_nameCache.find(decl->getID());
-
-  if (it != m_nameCache.end()) {
+  auto [it, inserted] = m_qualifiedFuncNames.try_emplace(decl);
+  if (!inserted) {
     return it->getSecond();
   }
 
@@ -151,9 +293,42 @@ ASTSerializer::getQualifiedFuncName(const clang::FunctionDecl *decl) const {
   os << ")";
   os.flush();
 
-  m_nameCache.insert({decl->getID(), s});
+  return it->getSecond() = internName(s);
+}
+
+kj::StringPtr ASTSerializer::getDeclRefName(const clang::NamedDecl *decl) const {
+  if (const auto *func = llvm::dyn_cast<clang::FunctionDecl>(decl)) {
+    return getQualifiedFuncName(func);
+  }
+  return getQualifiedName(decl);
+}
+
+kj::StringPtr ASTSerializer::getMemberName(const clang::ValueDecl *decl) const {
+  if (const auto *meth = llvm::dyn_cast<clang::CXXMethodDecl>(decl)) {
+    return getQualifiedFuncName(meth);
+  }
+  auto [it, inserted] = m_memberNames.try_emplace(decl);
+  if (inserted) {
+    // Interning does not insert into the map, so the iterator stays valid.
+    it->getSecond() = internName(decl->getName());
+  }
+  return it->getSecond();
+}
+
+uint32_t ASTSerializer::getDeclRefNameRef(const clang::NamedDecl *decl) const {
+  auto [it, inserted] = m_declRefNameRefs.try_emplace(decl);
+  if (inserted) {
+    it->getSecond() = getNameRef(getDeclRefName(decl));
+  }
+  return it->getSecond();
+}
 
-  return s;
+uint32_t ASTSerializer::getMemberNameRef(const clang::ValueDecl *decl) const {
+  auto [it, inserted] = m_memberNameRefs.try_emplace(decl);
+  if (inserted) {
+    it->getSecond() = getNameRef(getMemberName(decl));
+  }
+  return it->getSecond();
 }
 
-} // namespace vf
\ No newline at end of file
+} // namespace vf
@@ -1,7 +1,13 @@
 #pragma once
 
 #include "AnnotationManager.h"
+#include "BuiltinTypes.h"
+#include "Focus.h"
 #include "LocationSerializer.h"
+#include "LocationTable.h"
+#include "NameTable.h"
+#include "OverrideSummaries.h"
+#include "TypeTable.h"
 #include "stubs_ast.capnp.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
@@ -10,12 +16,17 @@
 #include "clang/AST/Type.h"
 #include "clang/AST/TypeLoc.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/Support/Allocator.h"
+#include <optional>
 
 namespace vf {
 
 /**
  * @brief Serializer for various nodes in the AST of a translation unit.
- *
+ * Its caches are updated by const methods, so an instance belongs to the
+ * export of one translation unit and is never shared between threads.
  */
 class ASTSerializer {
 public:
@@ -27,6 +38,10 @@ public:
 
   void serialize(TypeNodeBuilder builder, clang::TypeLoc typeLoc) const;
 
+  /**
+   * @brief Serialize a type without a source location. If a type table is
+   * used, the type is interned in it and the builder refers to its entry.
+   */
   void serialize(stubs::Type::Builder builder, clang::QualType type) const;
 
   void serialize(ListBuilder<stubs::Param> builder,
@@ -34,36 +49,279 @@ public:
 
   void serialize(stubs::Clause::Builder builder, const Text &text) const;
 
+  /**
+   * @brief Serialize an annotation as a clause that also carries its kind and
+   * leading keyword.
+   */
+  void serialize(stubs::Clause::Builder builder,
+                 const Annotation &annotation) const;
+
   void serialize(ListBuilder<stubs::Clause> builder,
                  llvm::ArrayRef<Text> textArray) const;
 
   void serialize(ListBuilder<stubs::Clause> builder,
                  llvm::ArrayRef<Annotation> annotations) const;
 
+  /**
+   * @brief Serialize the tokens of an annotation with `-annotation_tokens`, if
+   * it only holds tokens that `tokenizeAnnotation` handles. Their spellings
+   * are interned in the name table.
+   *
+   * @param initTokens Initializes the token list of the target builder with
+   * the given number of tokens.
+   */
+  void serializeTokens(
+      std::string_view text,
+      llvm::function_ref<ListBuilder<stubs::Token>(unsigned)> initTokens) const;
+
+  /**
+   * @brief Serialize the text of an annotation or comment that starts at
+   * `loc`. With `-annotation_slices`, text that lies in the buffer of a source
+   * file is serialized as a slice of that file and the text field is set to
+   * the empty text; otherwise the text is copied.
+   *
+   * @param initText Initializes the text field of the target builder with the
+   * given size.
+   * @param initSlice Initializes the slice field of the target builder.
+   */
+  void serializeText(
+      std::string_view text, clang::SourceLocation loc,
+      llvm::function_ref<capnp::Text::Builder(unsigned)> initText,
+      llvm::function_ref<stubs::TextSlice::Builder()> initSlice) const;
+
+  /**
+   * @brief Serialize a range to a location builder. If a location table is
+   * used, the range is interned in it and the location refers to its entry.
+   */
   void serialize(stubs::Loc::Builder locBuilder,
                  clang::SourceRange range) const;
 
-  std::string getQualifiedName(const clang::NamedDecl *decl) const;
+  bool usesLocationTable() const { return m_locationTable.has_value(); }
+
+  /**
+   * @brief Index of a range in the location table, which must be used. The
+   * range is interned in the table if needed.
+   */
+  uint32_t getLocationRef(clang::SourceRange range) const;
+
+  /**
+   * @brief Number of ranges interned since the location table was last
+   * serialized.
+   */
+  size_t nbInternedLocations() const {
+    return m_locationTable ? m_locationTable->size() : 0;
+  }
+
+  /**
+   * @brief Serialize the ranges interned since the location table was last
+   * serialized and start a new, empty table. Locations serialized afterwards
+   * refer to the new table.
+   *
+   * @param builder Target list builder with `nbInternedLocations()` elements
+   */
+  void serializeLocationTable(ListBuilder<stubs::Loc> builder) const;
+
+  bool usesNameTable() const { return m_nameTable.has_value(); }
+
+  /**
+   * @brief Index of a name in the name table, which must be used. The name is
+   * interned in the table if needed.
+   */
+  uint32_t getNameRef(kj::StringPtr name) const;
+
+  /**
+   * @brief Serialize the name of a record reference. If a name table is used,
+   * the reference refers to the entry of the name in that table.
+   */
+  void serializeName(stubs::RecordRef::Builder builder,
+                     kj::StringPtr name) const;
+
+  /**
+   * @brief Number of names interned since the name table was last serialized.
+   */
+  size_t nbInternedNames() const {
+    return m_nameTable ? m_nameTable->size() : 0;
+  }
+
+  /**
+   * @brief Serialize the names interned since the name table was last
+   * serialized and start a new, empty table, like `serializeLocationTable`.
+   *
+   * @param builder Target list builder with `nbInternedNames()` elements
+   */
+  void serializeNameTable(capnp::List<capnp::Text>::Builder builder) const;
+
+  bool usesTypeTable() const { return m_typeTable.has_value(); }
+
+  /**
+   * @brief Number of types interned since the type table was last serialized.
+   */
+  size_t nbInternedTypes() const {
+    return m_typeTable ? m_typeTable->size() : 0;
+  }
+
+  /**
+   * @brief Serialize the types interned since the type table was last
+   * serialized and start a new, empty table, like `serializeLocationTable`.
+   *
+   * @param builder Target list builder with `nbInternedTypes()` elements
+   */
+  void serializeTypeTable(ListBuilder<stubs::Type> builder) const;
+
+  /**
+   * @brief Qualified name of a declaration. Every name is printed once; the
+   * returned string lives as long as this serializer.
+   */
+  kj::StringPtr getQualifiedName(const clang::NamedDecl *decl) const;
+
+  /**
+   * @brief Qualified name of a function followed by its parameter types. Every
+   * name is printed once; the returned string lives as long as this
+   * serializer.
+   */
+  kj::StringPtr getQualifiedFuncName(const clang::FunctionDecl *decl) const;
+
+  /**
+   * @brief Name a declaration reference refers to: the qualified name of a
+   * function followed by its parameter types, or else the qualified name of
+   * the declaration.
+   */
+  kj::StringPtr getDeclRefName(const clang::NamedDecl *decl) const;
+
+  /**
+   * @brief Name a member expression refers to: the qualified name of a method
+   * followed by its parameter types, or else the name of the field. Field
+   * names are copied once; the returned string lives as long as this
+   * serializer.
+   */
+  kj::StringPtr getMemberName(const clang::ValueDecl *decl) const;
 
-  std::string getQualifiedFuncName(const clang::FunctionDecl *decl) const;
+  /**
+   * @brief Index of `getDeclRefName(decl)` in the name table, which must be
+   * used. The index is kept per declaration until the table is serialized, so
+   * further references to the declaration do not hash its name again.
+   */
+  uint32_t getDeclRefNameRef(const clang::NamedDecl *decl) const;
+
+  /**
+   * @brief Index of `getMemberName(decl)` in the name table, which must be
+   * used, kept like the one of `getDeclRefNameRef`.
+   */
+  uint32_t getMemberNameRef(const clang::ValueDecl *decl) const;
+
+  /**
+   * @brief Virtual methods of a record definition and its bases whose final
+   * overrider is not declared by the record. The summaries of the bases are
+   * shared by all records that are serialized.
+   */
+  void getNonOverriddenMethods(
+      const clang::CXXRecordDecl *decl,
+      llvm::SmallVectorImpl<const clang::CXXMethodDecl *> &methods) const {
+    m_overrideSummaries.getNonOverriddenMethods(decl, methods);
+  }
 
   const clang::ASTContext &getASTContext() const { return *m_ASTContext; }
 
+  const BuiltinTypes &getBuiltinTypes() const { return m_builtinTypes; }
+
   const AnnotationManager &getAnnotationManager() const {
     return *m_annotationManager;
   }
 
   bool skipImplicitDecls() const { return m_skipImplicitDecls; }
 
+  /**
+   * @brief Whether a declaration is left out of the output because it is
+   * implicit and implicit declarations are skipped. Skipped declarations are
+   * filtered before any builder is initialized for them, so neither they nor
+   * their members are visited.
+   */
+  bool isSkipped(const clang::Decl *decl) const {
+    return m_skipImplicitDecls && decl->isImplicit();
+  }
+
+  /**
+   * @brief Whether long initializer lists of integer literals are serialized
+   * as a single `IntArrayLit`.
+   */
+  bool compactIntArrays() const { return m_compactIntArrays; }
+
+  /**
+   * @brief Whether expression trees of the kinds a `FlatExpr` supports are
+   * serialized as one.
+   */
+  bool flatExprs() const { return m_flatExprs; }
+
+  /**
+   * @brief Whether nodes that the translator looks through are left out:
+   * cleanups and temporary bindings are not serialized, and lvalue-to-rvalue
+   * conversions have no location of their own.
+   */
+  bool compactExprs() const { return m_compactExprs; }
+
+  /**
+   * @brief Whether an expression is known to contain a node that a
+   * `FlatExpr` does not support, so its tree is not walked again.
+   */
+  bool isKnownNonFlat(const clang::Expr *expr) const {
+    return m_nonFlatExprs.contains(expr);
+  }
+
+  void markNonFlat(const clang::Expr *expr) const {
+    m_nonFlatExprs.insert(expr);
+  }
+
+  /**
+   * @brief Whether a specialization of a function template whose body is
+   * identical to that of an earlier specialization refers to it instead.
+   */
+  bool dedupTemplateBodies() const { return m_dedupTemplateBodies; }
+
+  /**
+   * @brief Numbering of the files in the serialized output.
+   */
+  const FileIds &getFileIds() const {
+    return m_locationSerializer.getFileIds();
+  }
+
+  /**
+   * @brief Whether the body of a function definition is serialized, which is
+   * the case for all definitions unless a focus is given.
+   */
+  bool isFocused(const clang::FunctionDecl *decl) const {
+    return !m_focus ||
+           m_focus->contains(decl, m_ASTContext->getSourceManager());
+  }
+
   KJ_DISALLOW_COPY(ASTSerializer);
 
   ASTSerializer(const clang::ASTContext &ASTContext,
                 const AnnotationManager &annotationManager,
-                bool skipImplicitDecls)
+                bool skipImplicitDecls, bool useLocationTable,
+                bool useNameTable, bool useTypeTable, bool compactIntArrays,
+                bool dedupTemplateBodies, bool annotationTokens,
+                bool annotationSlices, bool flatExprs, bool compactExprs,
+                std::optional<Focus> focus)
       : m_ASTContext(&ASTContext), m_annotationManager(&annotationManager),
+        m_builtinTypes(ASTContext),
         m_locationSerializer(ASTContext.getSourceManager(),
                              ASTContext.getLangOpts()),
-        m_skipImplicitDecls(skipImplicitDecls) {}
+        m_skipImplicitDecls(skipImplicitDecls),
+        m_compactIntArrays(compactIntArrays),
+        m_dedupTemplateBodies(dedupTemplateBodies),
+        m_annotationTokens(annotationTokens),
+        m_annotationSlices(annotationSlices), m_flatExprs(flatExprs),
+        m_compactExprs(compactExprs), m_focus(std::move(focus)) {
+    if (useLocationTable) {
+      m_locationTable.emplace();
+    }
+    if (useNameTable) {
+      m_nameTable.emplace();
+    }
+    if (useTypeTable) {
+      m_typeTable.emplace();
+    }
+  }
 
   ASTSerializer(ASTSerializer &&) = default;
   ASTSerializer &operator=(ASTSerializer &&) = default;
@@ -71,9 +329,38 @@ public:
 private:
   const clang::ASTContext *m_ASTContext;
   const AnnotationManager *m_annotationManager;
+  BuiltinTypes m_builtinTypes;
   LocationSerializer m_locationSerializer;
   bool m_skipImplicitDecls;
-  mutable llvm::DenseMap<int64_t, std::string> m_nameCache;
+  bool m_compactIntArrays;
+  bool m_dedupTemplateBodies;
+  bool m_annotationTokens; ///< Serialize the tokens of annotations.
+  bool m_annotationSlices; ///< Refer to the text of annotations in their file.
+  bool m_flatExprs;
+  bool m_compactExprs;
+  std::optional<Focus> m_focus;
+  mutable std::optional<LocationTable> m_locationTable;
+  mutable std::optional<NameTable> m_nameTable;
+  mutable std::optional<TypeTable> m_typeTable;
+  /**
+   * @brief Copy a name to the name allocator.
+   *
+   * @return NUL-terminated copy of the name.
+   */
+  kj::StringPtr internName(llvm::StringRef name) const;
+
+  mutable OverrideSummaries m_overrideSummaries;
+  mutable llvm::BumpPtrAllocator m_nameAllocator;
+  mutable llvm::DenseMap<const clang::NamedDecl *, kj::StringPtr>
+      m_qualifiedNames;
+  mutable llvm::DenseMap<const clang::FunctionDecl *, kj::StringPtr>
+      m_qualifiedFuncNames;
+  mutable llvm::DenseMap<const clang::ValueDecl *, kj::StringPtr> m_memberNames;
+  ///< Name table indices of the names of referenced declarations, valid until
+  ///< the table is serialized.
+  mutable llvm::DenseMap<const clang::NamedDecl *, uint32_t> m_declRefNameRefs;
+  mutable llvm::DenseMap<const clang::ValueDecl *, uint32_t> m_memberNameRefs;
+  mutable llvm::DenseSet<const clang::Expr *> m_nonFlatExprs;
 };
 
 } // namespace vf
\ No newline at end of file
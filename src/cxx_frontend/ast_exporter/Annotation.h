@@ -15,8 +15,42 @@ public:
     Ann_Other,
   };
 
+  /**
+   * @brief Keyword an annotation starts with, in the order of
+   * `stubs::AnnotationKeyword`.
+   */
+  enum Keyword {
+    Kwd_None,
+    Kwd_Requires,
+    Kwd_Ensures,
+    Kwd_Terminates,
+    Kwd_NonGhostCallersOnly,
+    Kwd_Invariant,
+    Kwd_Decreases,
+    Kwd_Predicate,
+    Kwd_PredicateFamily,
+    Kwd_PredicateFamilyInstance,
+    Kwd_PredicateCtor,
+    Kwd_Lemma,
+    Kwd_LemmaAuto,
+    Kwd_Fixpoint,
+    Kwd_Inductive,
+    Kwd_Open,
+    Kwd_Close,
+    Kwd_Assert,
+    Kwd_Leak,
+    Kwd_Include,
+    Kwd_Truncating,
+  };
+
   Kind getKind() const { return m_kind; }
 
+  /**
+   * @brief Get the keyword the annotation starts with. It is derived from the
+   * text, which is only inspected up to the end of the first word.
+   */
+  Keyword getKeyword() const;
+
   clang::SourceLocation getNextTokenLoc() const { return m_nextTokenLoc; }
 
   bool is(Kind kind) const { return m_kind == kind; }
@@ -31,7 +65,8 @@ public:
              clang::SourceLocation nextTokenLoc)
       : Text(range, text), m_kind(kind), m_nextTokenLoc(nextTokenLoc) {}
 
-  Annotation(const Annotation &) = default;
+  Annotation(Annotation &&) = default;
+  Annotation &operator=(Annotation &&) = default;
 
 private:
   Kind m_kind;
@@ -1,28 +1,82 @@
 #include "AnnotationManager.h"
 #include "Location.h"
+#include "clang/Basic/CharInfo.h"
 #include "clang/Lex/Lexer.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include <algorithm>
 
 namespace vf {
 
 void AnnotationManager::addAnnotation(Annotation &&annotation) {
   const clang::FileEntry *fileEntry =
-      fileEntryOfLoc(annotation.getRange().getBegin(), *m_sourceManager);
+      m_fileEntryCache.fileEntryOfLoc(annotation.getRange().getBegin());
   unsigned fileId = fileEntry->getUID();
 
-  llvm::SmallVector<Annotation> &annotations =
-      annotation.is(Annotation::Ann_Include) ? m_directivesMap[fileId]
-                                             : m_annotationMap[fileId];
-
-  if (!annotations.empty()) {
-    assert(annotation.getRange().getBegin() >
-               annotations.back().getRange().getEnd() &&
+  if (annotation.is(Annotation::Ann_Include)) {
+    llvm::SmallVector<Annotation> &directives = m_directivesMap[fileId];
+    assert((directives.empty() || annotation.getRange().getBegin() >
+                                      directives.back().getRange().getEnd()) &&
            "Annotation in wrong order");
+    directives.push_back(std::move(annotation));
+    return;
+  }
+
+  if (fileId >= m_annotatedFiles.size()) {
+    m_annotatedFiles.resize(fileId + 1);
   }
-  annotations.emplace_back(annotation);
+  m_annotatedFiles.set(fileId);
+  if (!m_annotations.empty() &&
+      annotation.getRange().getBegin() <
+          m_annotations.back().getRange().getEnd()) {
+    m_sorted = false;
+  }
+  m_indexed = false;
+  m_annotations.push_back(std::move(annotation));
+  m_contracts.clear();
+  m_functionAnnotations.clear();
+}
+
+void AnnotationManager::index() const {
+  if (m_indexed) {
+    return;
+  }
+
+  if (!m_sorted) {
+    llvm::stable_sort(m_annotations, [](const Annotation &lhs,
+                                        const Annotation &rhs) {
+      return lhs.getRange().getBegin() < rhs.getRange().getBegin();
+    });
+    m_sorted = true;
+  }
+
+  m_ends.clear();
+  m_ends.reserve(m_annotations.size());
+  m_fileSlices.clear();
+  m_truncatingMap.clear();
+  for (size_t i = 0; i < m_annotations.size(); ++i) {
+    const Annotation &annotation = m_annotations[i];
+    assert((i == 0 || m_annotations[i - 1].getRange().getEnd() <
+                          annotation.getRange().getBegin()) &&
+           "Annotations overlap");
+    m_ends.push_back(annotation.getRange().getEnd().getRawEncoding());
+    unsigned fileId =
+        m_fileEntryCache.fileEntryOfLoc(annotation.getRange().getBegin())
+            ->getUID();
+    auto [it, inserted] = m_fileSlices.try_emplace(fileId, i, i);
+    // Only the first run of annotations of a file is its slice.
+    if (it->second.second == i) {
+      it->second.second = i + 1;
+    }
+    if (annotation.is(Annotation::Ann_Truncating)) {
+      m_truncatingMap[annotation.getNextTokenLoc()] = i;
+    }
+  }
+  m_indexed = true;
 }
 
 void AnnotationManager::addFailDirective(Text &&failDirective) {
-  m_failDirectives.emplace_back(failDirective);
+  m_failDirectives.push_back(std::move(failDirective));
 }
 
 AnnotationsRef
@@ -31,13 +85,15 @@ AnnotationManager::getAll(const clang::FileEntry *fileEntry) const {
     return {};
   }
 
-  auto it = m_annotationMap.find(fileEntry->getUID());
+  index();
+  auto it = m_fileSlices.find(fileEntry->getUID());
 
-  if (it == m_annotationMap.end()) {
+  if (it == m_fileSlices.end()) {
     return {};
   }
 
-  return it->getSecond();
+  auto [begin, end] = it->getSecond();
+  return AnnotationsRef(m_annotations).slice(begin, end - begin);
 }
 
 llvm::ArrayRef<Text> AnnotationManager::getFailDirectives() const {
@@ -46,20 +102,28 @@ llvm::ArrayRef<Text> AnnotationManager::getFailDirectives() const {
 
 const Annotation *
 AnnotationManager::getTruncating(const clang::Expr *expr) const {
-  AnnotationsRef leadingAnnotations = getInRange({}, expr->getBeginLoc());
+  clang::SourceLocation beginLoc = expr->getBeginLoc();
+  if (beginLoc.isInvalid()) {
+    return {};
+  }
 
-  if (leadingAnnotations.empty()) {
+  index();
+  auto it = m_truncatingMap.find(beginLoc);
+
+  if (it == m_truncatingMap.end()) {
     return {};
   }
 
-  const Annotation &back = leadingAnnotations.back();
+  size_t index = it->getSecond();
 
-  if (back.is(Annotation::Kind::Ann_Truncating) &&
-      back.getNextTokenLoc() == expr->getBeginLoc()) {
-    return &back;
+  // The annotation only applies if no other annotation appears between it and
+  // the expression.
+  if (index + 1 < m_annotations.size() &&
+      m_annotations[index + 1].getRange().getEnd() <= beginLoc) {
+    return {};
   }
 
-  return {};
+  return &m_annotations[index];
 }
 
 AnnotationsRef AnnotationManager::getInRange(clang::SourceLocation begin,
@@ -68,24 +132,38 @@ AnnotationsRef AnnotationManager::getInRange(clang::SourceLocation begin,
     return {};
   }
 
-  clang::SourceLocation loc = begin.isValid() ? begin : end;
-  const clang::FileEntry *entry = fileEntryOfLoc(loc, *m_sourceManager);
+  // Indexing looks up files as well, so it comes before the lookup of the
+  // file of the range.
+  index();
 
-  AnnotationsRef annotations = getAll(entry);
+  clang::SourceLocation loc = begin.isValid() ? begin : end;
+  const clang::FileEntry *entry = m_fileEntryCache.fileEntryOfLoc(loc);
+  if (!entry || entry->getUID() >= m_annotatedFiles.size() ||
+      !m_annotatedFiles.test(entry->getUID())) {
+    return {};
+  }
 
+  // The range is clamped to the locations of the file, which are contiguous.
+  // Annotations never overlap, so the ends of their ranges are sorted and both
+  // bounds can be binary searched in the ends of the annotations of all
+  // files.
+  unsigned lower = m_fileEntryCache.fileBegin();
+  unsigned upper = m_fileEntryCache.fileEnd();
   if (begin.isValid()) {
-    annotations = annotations.drop_while([begin](const Annotation &annotation) {
-      return annotation.getRange().getEnd() < begin;
-    });
+    lower = std::max(lower, begin.getRawEncoding());
   }
-
   if (end.isValid()) {
-    annotations = annotations.take_while([end](const Annotation &annotation) {
-      return annotation.getRange().getEnd() <= end;
-    });
+    upper = std::min(upper, end.getRawEncoding());
   }
 
-  return annotations;
+  if (lower > upper) {
+    return {};
+  }
+  size_t first = std::lower_bound(m_ends.begin(), m_ends.end(), lower) -
+                 m_ends.begin();
+  size_t last = std::upper_bound(m_ends.begin() + first, m_ends.end(), upper) -
+                m_ends.begin();
+  return AnnotationsRef(m_annotations).slice(first, last - first);
 }
 
 AnnotationsRef
@@ -108,7 +186,7 @@ AnnotationManager::getSequenceAfterLoc(clang::SourceLocation beginLoc) const {
     return {};
   }
 
-  clang::Token nextToken(getNextToken(beginLoc, *m_sourceManager, *m_langOpts));
+  clang::Token nextToken(m_tokenIndex.getNextToken(beginLoc));
 
   return getInRange(beginLoc, nextToken.getLocation());
 }
@@ -119,7 +197,7 @@ AnnotationManager::getContract(clang::SourceLocation startLoc) const {
     return {};
   }
 
-  clang::Token nextToken(getNextToken(startLoc, *m_sourceManager, *m_langOpts));
+  clang::Token nextToken(m_tokenIndex.getNextToken(startLoc));
   clang::SourceLocation endLoc = nextToken.getLocation();
 
   AnnotationsRef annotations = getInRange(startLoc, endLoc);
@@ -129,6 +207,16 @@ AnnotationManager::getContract(clang::SourceLocation startLoc) const {
 
 AnnotationsRef
 AnnotationManager::getContract(const clang::FunctionDecl *decl) const {
+  auto [it, inserted] = m_contracts.try_emplace(decl);
+  if (inserted) {
+    // Looking up the contract does not touch the map, so `it` stays valid.
+    it->second = findContract(decl);
+  }
+  return it->second;
+}
+
+AnnotationsRef
+AnnotationManager::findContract(const clang::FunctionDecl *decl) const {
   if (decl->isImplicit()) {
     return {};
   }
@@ -136,23 +224,93 @@ AnnotationManager::getContract(const clang::FunctionDecl *decl) const {
     return getInRange(decl->getTypeSpecEndLoc(),
                       decl->getBody()->getBeginLoc());
   }
+  // The declaration of a skipped body ends with its declarator, so the
+  // contract precedes the token after it, which starts the body.
+  if (decl->hasSkippedBody()) {
+    clang::Token nextToken(m_tokenIndex.getNextToken(decl->getEndLoc()));
+    return getInRange(decl->getTypeSpecEndLoc(), nextToken.getLocation());
+  }
 
-  clang::Token nextToken(expectNextToken(decl->getEndLoc(), *m_sourceManager,
-                                         *m_langOpts, clang::tok::semi));
+  clang::Token nextToken(
+      m_tokenIndex.expectNextToken(decl->getEndLoc(), clang::tok::semi));
   return getContract(nextToken.getLocation());
 }
 
-AnnotationsRef
-AnnotationManager::getContract(clang::FunctionProtoTypeLoc protoType) const {
+FunctionAnnotations AnnotationManager::getFunctionAnnotations(
+    clang::FunctionProtoTypeLoc protoType) const {
   if (protoType.isNull()) {
     return {};
   }
 
   clang::SourceLocation rParenLoc = protoType.getRParenLoc();
-  clang::Token nextToken(expectNextToken(rParenLoc, *m_sourceManager,
-                                         *m_langOpts, clang::tok::semi));
+  auto [it, inserted] = m_functionAnnotations.try_emplace(rParenLoc);
+  if (!inserted) {
+    return it->second;
+  }
 
-  return getContract(nextToken.getLocation());
+  FunctionAnnotations &annotations = it->second;
+  annotations.ghostParams = getInRange(
+      protoType.getReturnLoc().getEndLoc(), protoType.getLParenLoc());
+  clang::Token nextToken(
+      m_tokenIndex.expectNextToken(rParenLoc, clang::tok::semi));
+  annotations.contract = getContract(nextToken.getLocation());
+  return annotations;
+}
+
+AnnotationsRef AnnotationCursor::getInRange(clang::SourceLocation begin,
+                                            clang::SourceLocation end) {
+  if (begin.isInvalid()) {
+    return m_annotationManager->getInRange(begin, end);
+  }
+
+  const clang::SourceManager &sourceManager =
+      m_annotationManager->getSourceManager();
+  clang::FileID fileID =
+      sourceManager.getFileID(sourceManager.getExpansionLoc(begin));
+  if (fileID != m_fileID || begin < m_begin) {
+    m_fileID = fileID;
+    m_annotations = m_annotationManager->getInRange(begin, {});
+  } else {
+    // The annotations that end before the previous begin are already
+    // dropped. Find a bound on the ones that end before this begin by doubling
+    // it, then search below it.
+    auto endsBeforeBegin = [begin](const Annotation &annotation) {
+      return annotation.getRange().getEnd() < begin;
+    };
+    size_t bound = 1;
+    while (bound < m_annotations.size() &&
+           endsBeforeBegin(m_annotations[bound - 1])) {
+      bound *= 2;
+    }
+    AnnotationsRef candidates =
+        m_annotations.take_front(std::min(bound, m_annotations.size()));
+    m_annotations = m_annotations.drop_front(
+        llvm::partition_point(candidates, endsBeforeBegin) -
+        candidates.begin());
+  }
+  m_begin = begin;
+
+  if (end.isInvalid()) {
+    return m_annotations;
+  }
+
+  size_t count = 0;
+  while (count < m_annotations.size() &&
+         m_annotations[count].getRange().getEnd() <= end) {
+    ++count;
+  }
+  return m_annotations.take_front(count);
+}
+
+AnnotationsRef
+AnnotationCursor::getSequenceAfterLoc(clang::SourceLocation beginLoc) {
+  if (beginLoc.isInvalid()) {
+    return {};
+  }
+
+  clang::Token nextToken(
+      m_annotationManager->getTokenIndex().getNextToken(beginLoc));
+  return getInRange(beginLoc, nextToken.getLocation());
 }
 
 namespace {
@@ -166,102 +324,97 @@ bool isAnnotationLike(std::string_view text) {
          (*(begin + 1) == '/' || *(end - 3) == '@');
 }
 
-class GhostCodeAnalyzer {
-public:
-  explicit GhostCodeAnalyzer(std::string_view text)
-      : m_text(text), m_pos(text.begin()),
-        m_kind(Annotation::Kind::Ann_Unknown) {}
-
-  Annotation::Kind getKind() {
-    if (kindIsNotUnknown())
-      return m_kind;
-    if (isTruncating() || isContractClauseLike() || isInclude())
-      return m_kind;
-
-    m_kind = Annotation::Kind::Ann_Other;
-    return m_kind;
+// Skips the whitespace at the beginning of `text`.
+std::string_view skipWhitespace(std::string_view text) {
+  const char *it = text.data();
+  const char *end = it + text.size();
+  while (it != end && clang::isWhitespace(*it)) {
+    ++it;
   }
+  return text.substr(it - text.data());
+}
 
-private:
-  void skipWhitespace() {
-    for (; m_pos != m_text.end() && std::isspace(*m_pos); ++m_pos)
-      ;
-  }
-
-  bool startsWith(std::string_view prefix) {
-    std::string_view::iterator pos = prefix.begin();
-    for (; m_pos != m_text.end() && pos != prefix.end() && *m_pos == *pos;
-         ++m_pos, ++pos)
-      ;
-    return pos == prefix.end();
-  }
-
-  bool kindIsNotUnknown() { return m_kind != Annotation::Kind::Ann_Unknown; }
-
-  bool isContractClauseLike() {
-    if (kindIsNotUnknown())
-      return m_kind == Annotation::Kind::Ann_ContractClause;
-
-    for (std::string_view prefix : m_checks) {
-      m_pos = m_text.begin() + 3;
-      skipWhitespace();
-      if (startsWith(prefix)) {
-        m_kind = Annotation::Kind::Ann_ContractClause;
-        return true;
-      }
-    }
-    return false;
+// Classifies ghost code in a single pass: it only looks at the keyword that
+// follows the `/*@` or `//@` prefix of `text`.
+Annotation::Kind classifyGhostCode(std::string_view text) {
+  std::string_view body = skipWhitespace(text.substr(3));
+  if (body.empty()) {
+    return Annotation::Kind::Ann_Other;
   }
 
-  bool isTruncating() {
-    if (kindIsNotUnknown())
-      return m_kind == Annotation::Kind::Ann_Truncating;
-
-    m_pos = m_text.begin() + 3;
-
-    skipWhitespace();
-    if (!startsWith("truncating")) {
-      return false;
+  switch (body.front()) {
+  case ':':
+    return Annotation::Kind::Ann_ContractClause;
+  case '#':
+    return body.starts_with("#include") ? Annotation::Kind::Ann_Include
+                                        : Annotation::Kind::Ann_Other;
+  case 'e':
+    return body.starts_with("ensures") ? Annotation::Kind::Ann_ContractClause
+                                       : Annotation::Kind::Ann_Other;
+  case 'n':
+    return body.starts_with("non_ghost_callers_only")
+               ? Annotation::Kind::Ann_ContractClause
+               : Annotation::Kind::Ann_Other;
+  case 'r':
+    return body.starts_with("requires") ? Annotation::Kind::Ann_ContractClause
+                                        : Annotation::Kind::Ann_Other;
+  case 't': {
+    if (body.starts_with("terminates")) {
+      return Annotation::Kind::Ann_ContractClause;
     }
-
-    skipWhitespace();
-    if (m_pos == m_text.end()) {
-      m_kind = Annotation::Kind::Ann_Truncating;
-      return true;
+    if (!body.starts_with("truncating")) {
+      return Annotation::Kind::Ann_Other;
     }
-
-    if (startsWith("@*/")) {
-      m_kind = Annotation::Kind::Ann_Truncating;
-      return true;
-    }
-
-    return false;
+    // `truncating` must be the only word of the annotation.
+    std::string_view rest = skipWhitespace(body.substr(10));
+    return rest.empty() || rest.starts_with("@*/")
+               ? Annotation::Kind::Ann_Truncating
+               : Annotation::Kind::Ann_Other;
   }
-
-  bool isInclude() {
-    if (kindIsNotUnknown())
-      return m_kind == Annotation::Kind::Ann_Include;
-
-    m_pos = m_text.begin() + 3;
-
-    skipWhitespace();
-    if (startsWith("#include")) {
-      m_kind = Annotation::Kind::Ann_Include;
-      return true;
-    }
-
-    return false;
+  default:
+    return Annotation::Kind::Ann_Other;
   }
-
-  std::string_view m_text;
-  std::string_view::iterator m_pos;
-  Annotation::Kind m_kind;
-
-  std::string_view static constexpr m_checks[] = {
-      "requires", "ensures", "terminates", ":", "non_ghost_callers_only"};
-};
+}
 } // namespace
 
+Annotation::Keyword Annotation::getKeyword() const {
+  std::string_view body = skipWhitespace(getText().substr(3));
+  bool directive = body.starts_with("#");
+  if (directive) {
+    body.remove_prefix(1);
+  }
+  llvm::StringRef word(body.data(),
+                       std::find_if_not(body.begin(), body.end(),
+                                        [](char c) {
+                                          return clang::isAsciiIdentifierContinue(c);
+                                        }) -
+                           body.begin());
+  if (directive) {
+    return word == "include" ? Kwd_Include : Kwd_None;
+  }
+  return llvm::StringSwitch<Keyword>(word)
+      .Case("requires", Kwd_Requires)
+      .Case("ensures", Kwd_Ensures)
+      .Case("terminates", Kwd_Terminates)
+      .Case("non_ghost_callers_only", Kwd_NonGhostCallersOnly)
+      .Case("invariant", Kwd_Invariant)
+      .Case("decreases", Kwd_Decreases)
+      .Case("predicate", Kwd_Predicate)
+      .Case("predicate_family", Kwd_PredicateFamily)
+      .Case("predicate_family_instance", Kwd_PredicateFamilyInstance)
+      .Case("predicate_ctor", Kwd_PredicateCtor)
+      .Case("lemma", Kwd_Lemma)
+      .Case("lemma_auto", Kwd_LemmaAuto)
+      .Case("fixpoint", Kwd_Fixpoint)
+      .Case("inductive", Kwd_Inductive)
+      .Case("open", Kwd_Open)
+      .Case("close", Kwd_Close)
+      .Case("assert", Kwd_Assert)
+      .Case("leak", Kwd_Leak)
+      .Case("truncating", Kwd_Truncating)
+      .Default(Kwd_None);
+}
+
 std::optional<Annotation>
 AnnotationManager::analyzeText(clang::SourceRange range,
                                std::string_view text) {
@@ -269,11 +422,9 @@ AnnotationManager::analyzeText(clang::SourceRange range,
     return {};
   }
 
-  GhostCodeAnalyzer gca(text);
-  Annotation::Kind kind = gca.getKind();
+  Annotation::Kind kind = classifyGhostCode(text);
 
-  clang::Token nextToken(
-      getNextToken(range.getBegin(), *m_sourceManager, *m_langOpts));
+  clang::Token nextToken(m_tokenIndex.getNextToken(range.getBegin()));
   clang::SourceLocation nextTokenLoc = nextToken.getLocation();
 
   return std::make_optional<Annotation>(kind, range, text, nextTokenLoc);
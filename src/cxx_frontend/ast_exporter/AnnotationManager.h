@@ -1,10 +1,13 @@
 #pragma once
 #include "Annotation.h"
 #include "Text.h"
+#include "Location.h"
+#include "TokenIndex.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/Expr.h"
 #include "clang/AST/TypeLoc.h"
 #include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 
@@ -13,6 +16,14 @@ namespace vf {
 /// @brief  Alias for a reference to an array of annotations.
 using AnnotationsRef = llvm::ArrayRef<Annotation>;
 
+/**
+ * @brief Annotations attached to a function declarator.
+ */
+struct FunctionAnnotations {
+  AnnotationsRef ghostParams; ///< Between the return type and the parameters.
+  AnnotationsRef contract;    ///< After the declarator.
+};
+
 /**
  * @brief Manages storage and retrieval of annotations and fail directives.
  *
@@ -48,7 +59,8 @@ public:
 
   /**
    * @brief Retrieves the contract annotations for the given function
-   * declaration.
+   * declaration. The contract is looked up on the first call for a
+   * declaration and attached to it, so later calls only find it.
    *
    * @param decl The function declaration whose contract annotations are to be
    * retrieved.
@@ -64,7 +76,21 @@ public:
    * annotations are to be retrieved.
    * @return A reference to an array of annotations.
    */
-  AnnotationsRef getContract(clang::FunctionProtoTypeLoc protoType) const;
+  AnnotationsRef getContract(clang::FunctionProtoTypeLoc protoType) const {
+    return getFunctionAnnotations(protoType).contract;
+  }
+
+  /**
+   * @brief Retrieves the ghost parameters and contract of the given function
+   * prototype type location. They are looked up together on the first call
+   * for a declarator and attached to it, so later calls only find them.
+   *
+   * @param protoType The function prototype type location whose annotations
+   * are to be retrieved.
+   * @return The annotations of the declarator.
+   */
+  FunctionAnnotations
+  getFunctionAnnotations(clang::FunctionProtoTypeLoc protoType) const;
 
   /**
    * @brief Retrieves the annotation associated with a truncating expression.
@@ -120,6 +146,17 @@ public:
    */
   AnnotationsRef getSequenceAfterLoc(clang::SourceLocation beginLoc) const;
 
+  /**
+   * @brief Retrieves the index used to find the token after a location.
+   *
+   * @return A reference to the token index of the translation unit.
+   */
+  const TokenIndex &getTokenIndex() const { return m_tokenIndex; }
+
+  const clang::SourceManager &getSourceManager() const {
+    return *m_sourceManager;
+  }
+
   /**
    * @brief Constructs an AnnotationManager.
    *
@@ -128,7 +165,9 @@ public:
    */
   AnnotationManager(const clang::SourceManager &sourceManager,
                     const clang::LangOptions &langOpts)
-      : m_sourceManager(&sourceManager), m_langOpts(&langOpts) {}
+      : m_sourceManager(&sourceManager), m_langOpts(&langOpts),
+        m_tokenIndex(sourceManager, langOpts),
+        m_fileEntryCache(sourceManager) {}
 
 private:
   /**
@@ -140,14 +179,99 @@ private:
    */
   AnnotationsRef getContract(clang::SourceLocation startLoc) const;
 
-  ///< Map of annotations indexed by file.
-  llvm::SmallDenseMap<unsigned, llvm::SmallVector<Annotation>> m_annotationMap;
-  ///< Map of fail directives indexed by file.
+  /**
+   * @brief Looks up the contract of a function declaration, like
+   * `getContract`, without attaching it.
+   */
+  AnnotationsRef findContract(const clang::FunctionDecl *decl) const;
+
+  /**
+   * @brief Sort the annotations by location and index them, if annotations
+   * were added since they were last indexed.
+   */
+  void index() const;
+
+  ///< Annotations of all files, sorted by the raw encoding of their location
+  ///< once they are indexed. The locations of a file are contiguous, so the
+  ///< annotations of a file are too, and a range query is a binary search
+  ///< over the whole array.
+  mutable llvm::SmallVector<Annotation> m_annotations;
+  ///< Whether `m_annotations` is sorted. Annotations are added in source
+  ///< order, but the annotations of an included file come before the rest of
+  ///< its includer.
+  mutable bool m_sorted = true;
+  ///< Raw encodings of the ends of the annotations in `m_annotations`, which
+  ///< range queries binary search. They are kept apart, so a search touches
+  ///< one cache line for sixteen annotations instead of two.
+  mutable llvm::SmallVector<uint32_t> m_ends;
+  ///< Whether `m_ends`, `m_fileSlices` and `m_truncatingMap` are up to date.
+  mutable bool m_indexed = true;
+  ///< Indices of the first and past the last annotation of a file in
+  ///< `m_annotations`, by file UID. For a file that is entered more than once,
+  ///< these are the annotations of its first entry that has any.
+  mutable llvm::DenseMap<unsigned, std::pair<size_t, size_t>> m_fileSlices;
+  ///< Whether a file has annotations, by file UID. Most files have none, so
+  ///< range queries on them stop here.
+  llvm::BitVector m_annotatedFiles;
+  ///< Truncating annotations indexed by the location of their next token,
+  ///< as their index in `m_annotations`.
+  mutable llvm::DenseMap<clang::SourceLocation, size_t> m_truncatingMap;
+  ///< Map of ghost include directives indexed by file.
   llvm::SmallDenseMap<unsigned, llvm::SmallVector<Annotation>> m_directivesMap;
+  ///< Contracts attached to function declarations. Cleared when an
+  ///< annotation is added, since that may move the annotations they refer to.
+  mutable llvm::DenseMap<const clang::FunctionDecl *, AnnotationsRef>
+      m_contracts;
+  ///< Annotations attached to function declarators, indexed by the location of
+  ///< their right parenthesis. Cleared like `m_contracts`.
+  mutable llvm::DenseMap<clang::SourceLocation, FunctionAnnotations>
+      m_functionAnnotations;
   ///< List of all fail directives.
   llvm::SmallVector<Text> m_failDirectives;
   const clang::SourceManager *m_sourceManager;
   const clang::LangOptions *m_langOpts;
+  TokenIndex m_tokenIndex;
+  ///< Files of the locations of range queries, which mostly refer to the
+  ///< same file one after the other.
+  mutable FileEntryCache m_fileEntryCache;
+};
+
+/**
+ * @brief Cursor over the annotations of a file, for the range queries of a
+ * sequence of sibling nodes in source order, like the children of a compound
+ * statement.
+ *
+ * The results are those of the same queries on the annotation manager, but a
+ * query whose range begins in the same file as the previous one, and not
+ * before it, walks on from the previous result instead of searching all
+ * annotations of the file again. The children of a node are visited in source
+ * order, so merging their ranges with the sorted annotations of the file this
+ * way costs time linear in the number of queries and annotations, up to the
+ * annotations within the children, which are skipped with an exponential
+ * search.
+ */
+class AnnotationCursor {
+public:
+  /**
+   * @brief Same as `AnnotationManager::getInRange`.
+   */
+  AnnotationsRef getInRange(clang::SourceLocation begin,
+                            clang::SourceLocation end);
+
+  /**
+   * @brief Same as `AnnotationManager::getSequenceAfterLoc`.
+   */
+  AnnotationsRef getSequenceAfterLoc(clang::SourceLocation beginLoc);
+
+  explicit AnnotationCursor(const AnnotationManager &annotationManager)
+      : m_annotationManager(&annotationManager) {}
+
+private:
+  const AnnotationManager *m_annotationManager;
+  clang::FileID m_fileID; ///< File of the begin of the previous query.
+  clang::SourceLocation m_begin; ///< Begin of the previous query.
+  AnnotationsRef m_annotations;  ///< Annotations of `m_fileID` that do not end
+                                 ///< before `m_begin`.
 };
 
 } // namespace vf
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "AnnotationSnapshot.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <vector>
+
+namespace vf {
+
+using namespace llvm::support::endian;
+
+namespace {
+
+constexpr llvm::StringLiteral magic("VFSNAP01");
+constexpr size_t headerSize = 16;
+// hash, data offset, number of annotations, fail directives and includes
+constexpr size_t fileRecordSize = 24;
+constexpr size_t annotationRecordSize = 16;
+constexpr size_t failDirectiveRecordSize = 8;
+constexpr size_t includeRecordSize = 24;
+
+size_t dataSize(const FileSnapshot &snapshot) {
+  return snapshot.annotations.size() * annotationRecordSize +
+         snapshot.failDirectives.size() * failDirectiveRecordSize +
+         snapshot.includes.size() * includeRecordSize;
+}
+
+} // namespace
+
+uint64_t AnnotationSnapshot::hashContent(llvm::StringRef content) {
+  return llvm::xxh3_64bits(llvm::arrayRefFromStringRef(content));
+}
+
+AnnotationSnapshot::AnnotationSnapshot(llvm::StringRef path)
+    : m_path(path.str()) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return;
+  }
+
+  llvm::StringRef data = (*buffer)->getBuffer();
+  if (data.size() < headerSize || !data.startswith(magic)) {
+    return;
+  }
+
+  uint32_t nbFiles = read32le(data.data() + magic.size());
+  if (data.size() < headerSize + size_t(nbFiles) * fileRecordSize) {
+    return;
+  }
+
+  m_nbFiles = nbFiles;
+  m_buffer = std::move(*buffer);
+}
+
+const char *AnnotationSnapshot::findRecord(uint64_t hash) const {
+  if (!m_buffer) {
+    return nullptr;
+  }
+
+  const char *table = m_buffer->getBufferStart() + headerSize;
+  uint32_t low = 0;
+  uint32_t high = m_nbFiles;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    const char *record = table + size_t(mid) * fileRecordSize;
+    uint64_t recordHash = read64le(record);
+    if (recordHash == hash) {
+      return record;
+    }
+    if (recordHash < hash) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return nullptr;
+}
+
+bool AnnotationSnapshot::decode(const char *record,
+                                FileSnapshot &snapshot) const {
+  uint32_t offset = read32le(record + 8);
+  uint32_t nbAnnotations = read32le(record + 12);
+  uint32_t nbFailDirectives = read32le(record + 16);
+  uint32_t nbIncludes = read32le(record + 20);
+
+  size_t size = size_t(nbAnnotations) * annotationRecordSize +
+                size_t(nbFailDirectives) * failDirectiveRecordSize +
+                size_t(nbIncludes) * includeRecordSize;
+  if (size_t(offset) + size > m_buffer->getBufferSize()) {
+    return false;
+  }
+
+  const char *data = m_buffer->getBufferStart() + offset;
+  snapshot = FileSnapshot();
+
+  for (uint32_t i = 0; i < nbAnnotations; ++i, data += annotationRecordSize) {
+    snapshot.annotations.push_back({read32le(data), read32le(data + 4),
+                                    read32le(data + 8), read32le(data + 12)});
+  }
+  for (uint32_t i = 0; i < nbFailDirectives;
+       ++i, data += failDirectiveRecordSize) {
+    snapshot.failDirectives.push_back({read32le(data), read32le(data + 4)});
+  }
+  for (uint32_t i = 0; i < nbIncludes; ++i, data += includeRecordSize) {
+    snapshot.includes.push_back({read64le(data), read32le(data + 8),
+                                 read32le(data + 12), read32le(data + 16)});
+  }
+  return true;
+}
+
+bool AnnotationSnapshot::lookup(uint64_t hash, FileSnapshot &snapshot) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_added.find(hash);
+  if (it != m_added.end()) {
+    snapshot = it->second;
+    return true;
+  }
+
+  const char *record = findRecord(hash);
+  return record && decode(record, snapshot);
+}
+
+void AnnotationSnapshot::add(uint64_t hash, FileSnapshot snapshot) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_added.insert_or_assign(hash, std::move(snapshot));
+}
+
+bool AnnotationSnapshot::save() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_path.empty() || m_added.empty()) {
+    return true;
+  }
+
+  // Merge the snapshots of the mapped file with the added ones.
+  std::map<uint64_t, FileSnapshot> snapshots(m_added);
+  if (m_buffer) {
+    const char *table = m_buffer->getBufferStart() + headerSize;
+    for (uint32_t i = 0; i < m_nbFiles; ++i) {
+      const char *record = table + size_t(i) * fileRecordSize;
+      uint64_t hash = read64le(record);
+      FileSnapshot snapshot;
+      if (!snapshots.count(hash) && decode(record, snapshot)) {
+        snapshots.emplace(hash, std::move(snapshot));
+      }
+    }
+  }
+
+  size_t size = headerSize + snapshots.size() * fileRecordSize;
+  for (const auto &[hash, snapshot] : snapshots) {
+    size += dataSize(snapshot);
+  }
+
+  std::vector<char> data(size, '\0');
+  std::copy(magic.begin(), magic.end(), data.begin());
+  write32le(data.data() + magic.size(), uint32_t(snapshots.size()));
+
+  char *record = data.data() + headerSize;
+  size_t offset = headerSize + snapshots.size() * fileRecordSize;
+  for (const auto &[hash, snapshot] : snapshots) {
+    write64le(record, hash);
+    write32le(record + 8, uint32_t(offset));
+    write32le(record + 12, uint32_t(snapshot.annotations.size()));
+    write32le(record + 16, uint32_t(snapshot.failDirectives.size()));
+    write32le(record + 20, uint32_t(snapshot.includes.size()));
+    record += fileRecordSize;
+
+    char *out = data.data() + offset;
+    for (const FileSnapshot::AnnotationRecord &annotation :
+         snapshot.annotations) {
+      write32le(out, annotation.kind);
+      write32le(out + 4, annotation.begin);
+      write32le(out + 8, annotation.end);
+      write32le(out + 12, annotation.nextToken);
+      out += annotationRecordSize;
+    }
+    for (const FileSnapshot::FailDirectiveRecord &failDirective :
+         snapshot.failDirectives) {
+      write32le(out, failDirective.begin);
+      write32le(out + 4, failDirective.end);
+      out += failDirectiveRecordSize;
+    }
+    for (const FileSnapshot::IncludeRecord &include : snapshot.includes) {
+      write64le(out, include.targetHash);
+      write32le(out + 8, include.begin);
+      write32le(out + 12, include.end);
+      write32le(out + 16, include.isAngled);
+      out += includeRecordSize;
+    }
+    offset += dataSize(snapshot);
+  }
+
+  int fd;
+  llvm::SmallString<128> tempPath;
+  if (llvm::sys::fs::createUniqueFile(m_path + ".tmp%%%%%%", fd, tempPath)) {
+    return false;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os.write(data.data(), data.size());
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempPath);
+      return false;
+    }
+  }
+  return !llvm::sys::fs::rename(tempPath, m_path);
+}
+
+} // namespace vf
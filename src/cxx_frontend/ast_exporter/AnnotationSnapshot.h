@@ -0,0 +1,124 @@
+#pragma once
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace vf {
+
+/**
+ * @brief Annotations, fail directives and include directives of one file.
+ * Locations are stored as offsets in the file, so a snapshot stays valid as
+ * long as the content of the file does not change.
+ *
+ */
+struct FileSnapshot {
+  struct AnnotationRecord {
+    uint32_t kind;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t nextToken;
+  };
+
+  struct FailDirectiveRecord {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  struct IncludeRecord {
+    uint64_t targetHash; ///< Content hash of the included file.
+    uint32_t begin;      ///< Offset of the opening delimiter of the file name.
+    uint32_t end;        ///< Offset past the closing delimiter.
+    uint32_t isAngled;
+  };
+
+  llvm::SmallVector<AnnotationRecord> annotations;
+  llvm::SmallVector<FailDirectiveRecord> failDirectives;
+  llvm::SmallVector<IncludeRecord> includes;
+};
+
+/**
+ * @brief Cache of file snapshots, keyed by the content hash of the files. It
+ * is used next to a precompiled header, so the state of the precompiled files
+ * can be restored without lexing them again. One cache is shared by all
+ * exports of a process, so a file that one translation unit restored is not
+ * lexed again by the next; it is only kept on disk if it has a path. The cache
+ * can be shared by several threads.
+ *
+ * The file consists of a header, a table of file records sorted by hash and
+ * the fixed-size records of each file. All integers are little endian, so the
+ * file can be mapped in memory and searched without parsing it first.
+ */
+class AnnotationSnapshot {
+public:
+  /**
+   * @brief Hash the content of a file. The hash is the key of the file's
+   * snapshot.
+   *
+   * @param content Content of the file.
+   * @return Hash of the content.
+   */
+  static uint64_t hashContent(llvm::StringRef content);
+
+  /**
+   * @brief Open the snapshot file at the given path. A missing or malformed
+   * file results in an empty snapshot.
+   *
+   * @param path Path of the snapshot file.
+   */
+  explicit AnnotationSnapshot(llvm::StringRef path);
+
+  /**
+   * @brief Create an empty snapshot that is only kept in memory.
+   */
+  AnnotationSnapshot() = default;
+
+  /**
+   * @brief Look up the snapshot of a file.
+   *
+   * @param hash Content hash of the file.
+   * @param snapshot Receives the snapshot if it was found.
+   * @return True if a snapshot exists for the given hash.
+   */
+  bool lookup(uint64_t hash, FileSnapshot &snapshot) const;
+
+  /**
+   * @brief Add the snapshot of a file. It is only written to disk by
+   * #save().
+   *
+   * @param hash Content hash of the file.
+   * @param snapshot Snapshot of the file.
+   */
+  void add(uint64_t hash, FileSnapshot snapshot);
+
+  /**
+   * @brief Write the snapshot file if snapshots were added since it was
+   * opened. The file is replaced atomically, so concurrent exports never see
+   * a partially written file. Does nothing for a snapshot without a file.
+   *
+   * @return False if the file could not be written.
+   */
+  bool save() const;
+
+private:
+  /**
+   * @brief Find the file record of the given hash in the mapped file.
+   *
+   * @return Pointer to the record, or nullptr if it does not exist.
+   */
+  const char *findRecord(uint64_t hash) const;
+
+  bool decode(const char *record, FileSnapshot &snapshot) const;
+
+  std::string m_path;
+  std::unique_ptr<llvm::MemoryBuffer> m_buffer;
+  uint32_t m_nbFiles = 0;
+  ///< Snapshots that were added since the file was opened.
+  std::map<uint64_t, FileSnapshot> m_added;
+  mutable std::mutex m_mutex;
+};
+
+} // namespace vf
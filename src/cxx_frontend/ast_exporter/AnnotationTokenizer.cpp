@@ -0,0 +1,156 @@
+#include "AnnotationTokenizer.h"
+#include "llvm/ADT/StringExtras.h"
+
+namespace vf {
+
+namespace {
+
+bool isIdentChar(char c) {
+  return llvm::isAlnum(c) || c == '_' || c == '\'' || c == '$';
+}
+
+/**
+ * @brief Characters that VeriFast's lexer combines into a single operator
+ * token, as in its `ident2` rule.
+ */
+bool isOperatorChar(char c) {
+  return std::string_view("!%&$#+-/:<=>?@\\~^|*").find(c) !=
+         std::string_view::npos;
+}
+
+} // namespace
+
+bool tokenizeAnnotation(std::string_view text,
+                        llvm::SmallVectorImpl<AnnotationToken> &tokens) {
+  tokens.clear();
+  if (!text.starts_with("/*@") && !text.starts_with("//@")) {
+    return false;
+  }
+  // Line continuations are skipped anywhere by the lexer, preprocessor
+  // directives need end-of-line tokens and non-ASCII characters are part of
+  // identifiers whose encoding is left to the lexer. A single-line annotation
+  // never holds a line break, since the lexer ends its ghost range there.
+  bool singleLine = text[1] == '/';
+  for (char c : text) {
+    if (c == '\\' || c == '#' || c == '\0' ||
+        static_cast<unsigned char>(c) >= 0x80 ||
+        (singleLine && (c == '\n' || c == '\r'))) {
+      return false;
+    }
+  }
+
+  size_t size = text.size();
+  auto peek = [&](size_t pos) { return pos < size ? text[pos] : '\0'; };
+  auto add = [&](AnnotationToken::Kind kind, size_t begin, size_t end) {
+    tokens.push_back({kind, static_cast<uint32_t>(begin),
+                      static_cast<uint32_t>(end)});
+  };
+
+  add(AnnotationToken::GhostStart, 0, 3);
+  size_t pos = 3;
+  while (pos < size) {
+    size_t begin = pos;
+    char c = text[pos];
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case '\f':
+    case '\032':
+      ++pos;
+      continue;
+    case '"':
+    case '`':
+      return false;
+    case '(':
+      add(AnnotationToken::Operator, begin, ++pos);
+      continue;
+    case '!':
+      pos += peek(pos + 1) == '=' ? 2 : 1;
+      add(AnnotationToken::Operator, begin, pos);
+      continue;
+    case '<':
+    case '>': {
+      // <, <=, <<, <<=, >, >=, >> and >>=; >>> is an operator.
+      ++pos;
+      if (peek(pos) == '=') {
+        ++pos;
+      } else if (peek(pos) == c) {
+        ++pos;
+        if (peek(pos) == '=') {
+          ++pos;
+        } else if (c == '>' && peek(pos) == '>') {
+          add(AnnotationToken::Operator, begin, ++pos);
+          continue;
+        }
+      }
+      add(AnnotationToken::Punctuation, begin, pos);
+      continue;
+    }
+    case '.':
+      pos += peek(pos + 1) != '.' ? 1 : peek(pos + 2) == '.' ? 3 : 2;
+      add(AnnotationToken::Punctuation, begin, pos);
+      continue;
+    case ':':
+      pos += peek(pos + 1) == ':' ? 2 : 1;
+      add(AnnotationToken::Punctuation, begin, pos);
+      continue;
+    case '/':
+      if (peek(pos + 1) == '/' || peek(pos + 1) == '*') {
+        return false;
+      }
+      [[fallthrough]];
+    case '*':
+      pos += peek(pos + 1) == '=' ? 2 : 1;
+      add(AnnotationToken::Punctuation, begin, pos);
+      continue;
+    case '\'':
+      // character literal
+      return false;
+    default:
+      break;
+    }
+
+    if (llvm::isAlpha(c) || c == '_') {
+      while (pos < size) {
+        if (isIdentChar(text[pos])) {
+          ++pos;
+        } else if (text[pos] == ':' && peek(pos + 1) == ':') {
+          pos += 2;
+        } else {
+          break;
+        }
+      }
+      // `include` switches the lexer to include directive mode.
+      if (text.substr(begin, pos - begin) == "include") {
+        return false;
+      }
+      add(AnnotationToken::Word, begin, pos);
+    } else if (llvm::isDigit(c)) {
+      while (llvm::isDigit(peek(pos))) {
+        ++pos;
+      }
+      char next = peek(pos);
+      if ((next == '.' && llvm::isDigit(peek(pos + 1))) ||
+          std::string_view("xeErRuUlL").find(next) != std::string_view::npos) {
+        // hexadecimal, real and suffixed literals
+        return false;
+      }
+      add(AnnotationToken::Int, begin, pos);
+    } else if (isOperatorChar(c)) {
+      while (isOperatorChar(peek(pos))) {
+        ++pos;
+      }
+      add(text.substr(begin, pos - begin) == "@*/"
+              ? AnnotationToken::GhostEnd
+              : AnnotationToken::Operator,
+          begin, pos);
+    } else {
+      add(AnnotationToken::Punctuation, begin, ++pos);
+    }
+  }
+  return true;
+}
+
+} // namespace vf
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "llvm/ADT/SmallVector.h"
+#include <cstdint>
+#include <string_view>
+
+namespace vf {
+
+/**
+ * @brief Token of a ghost annotation. The kinds follow the paths of VeriFast's
+ * lexer, so the frontend can build the same tokens without lexing the
+ * annotation again.
+ *
+ */
+struct AnnotationToken {
+  enum Kind : uint8_t {
+    Word,        ///< Identifier or keyword.
+    Operator,    ///< Operator that is an identifier unless it is a keyword.
+    Punctuation, ///< Symbol that is an error unless it is a keyword.
+    Int,         ///< Decimal integer literal without suffix.
+    GhostStart,  ///< `/*@` or `//@`.
+    GhostEnd,    ///< `@*/`.
+  };
+
+  Kind kind;
+  uint32_t begin; ///< Offset of the first character in the annotation.
+  uint32_t end;   ///< Offset past the last character in the annotation.
+};
+
+/**
+ * @brief Split the text of an annotation into tokens, the way VeriFast's lexer
+ * does.
+ *
+ * @param text Text of the annotation, including its delimiters.
+ * @param tokens Receives the tokens of the annotation.
+ * @return False if the annotation contains anything but identifiers, symbols
+ * and decimal integer literals, e.g. string and character literals, nested
+ * comments, preprocessor directives, line continuations or non-ASCII
+ * characters. The frontend lexes those annotations itself.
+ */
+bool tokenizeAnnotation(std::string_view text,
+                        llvm::SmallVectorImpl<AnnotationToken> &tokens);
+
+} // namespace vf
@@ -0,0 +1,82 @@
+#include "BuiltinTypes.h"
+#include <string>
+
+namespace vf {
+
+BuiltinTypes::BuiltinTypes(const clang::ASTContext &ASTContext) {
+  using Kind = stubs::Type::BuiltinKind;
+  using FixedWidthKind = stubs::Type::FixedWidth::FixedWidthKind;
+
+  // Plain char is either Char_S or Char_U, depending on the target.
+  add(ASTContext.CharTy, Kind::CHAR);
+  add(ASTContext.SignedCharTy, Kind::CHAR);
+  add(ASTContext.UnsignedCharTy, Kind::U_CHAR);
+  add(ASTContext.VoidTy, Kind::VOID);
+  add(ASTContext.IntTy, Kind::INT);
+  add(ASTContext.UnsignedIntTy, Kind::U_INT);
+  add(ASTContext.ShortTy, Kind::SHORT);
+  add(ASTContext.UnsignedShortTy, Kind::U_SHORT);
+  add(ASTContext.LongTy, Kind::LONG);
+  add(ASTContext.LongLongTy, Kind::LONG_LONG);
+  add(ASTContext.UnsignedLongTy, Kind::U_LONG);
+  add(ASTContext.UnsignedLongLongTy, Kind::U_LONG_LONG);
+  add(ASTContext.BoolTy, Kind::BOOL);
+  add(ASTContext.Int128Ty, FixedWidthKind::INT, 128);
+  add(ASTContext.UnsignedInt128Ty, FixedWidthKind::U_INT, 128);
+
+  // Identifiers are unique in a translation unit, so typedefs are matched by
+  // their identifier instead of comparing their names. Looking up an
+  // identifier adds it to the table if no declaration uses it yet, which does
+  // no harm.
+  for (unsigned bits : {8, 16, 32, 64}) {
+    for (bool isSigned : {true, false}) {
+      std::string name =
+          (isSigned ? "int" : "uint") + std::to_string(bits) + "_t";
+      m_fixedWidthNames.try_emplace(&ASTContext.Idents.get(name), bits,
+                                    isSigned);
+    }
+  }
+}
+
+void BuiltinTypes::add(clang::QualType type, stubs::Type::BuiltinKind kind) {
+  m_encodings.try_emplace(type.getTypePtr(),
+                          Encoding{0, kind, /*fixedWidth=*/{}});
+}
+
+void BuiltinTypes::add(clang::QualType type,
+                       stubs::Type::FixedWidth::FixedWidthKind kind,
+                       unsigned bits) {
+  m_encodings.try_emplace(type.getTypePtr(),
+                          Encoding{bits, /*builtin=*/{}, kind});
+}
+
+bool BuiltinTypes::serialize(const clang::Type *type,
+                             stubs::Type::Builder builder) const {
+  auto it = m_encodings.find(type);
+  if (it == m_encodings.end()) {
+    return false;
+  }
+
+  const Encoding &encoding = it->second;
+  if (encoding.bits == 0) {
+    builder.setBuiltin(encoding.builtin);
+    return true;
+  }
+
+  stubs::Type::FixedWidth::Builder fixedWidthBuilder =
+      builder.initFixedWidth();
+  fixedWidthBuilder.setKind(encoding.fixedWidth);
+  fixedWidthBuilder.setBits(encoding.bits);
+  return true;
+}
+
+std::optional<FixedWidthInt>
+BuiltinTypes::getFixedWidth(const clang::TypedefNameDecl *decl) const {
+  auto it = m_fixedWidthNames.find(decl->getIdentifier());
+  if (it == m_fixedWidthNames.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+} // namespace vf
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "FixedWidthInt.h"
+#include "stubs_ast.capnp.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Type.h"
+#include "llvm/ADT/DenseMap.h"
+#include <optional>
+
+namespace vf {
+
+/**
+ * @brief Encodings of the builtin types and names of the fixed-width integer
+ * typedefs of a translation unit, computed once when the serializer is
+ * created. Builtin types are by far the most common types, so they are looked
+ * up here before any visitor dispatches on a type.
+ *
+ */
+class BuiltinTypes {
+public:
+  /**
+   * @brief Serialize a builtin type that VeriFast supports.
+   *
+   * @return Whether the type is such a builtin type. Nothing is serialized if
+   * it is not.
+   */
+  bool serialize(const clang::Type *type, stubs::Type::Builder builder) const;
+
+  /**
+   * @brief Fixed-width integer type named by a typedef, like `int32_t`.
+   *
+   * @return The width and signedness of the type, or nothing if the typedef
+   * does not have the name of a fixed-width integer type.
+   */
+  std::optional<FixedWidthInt>
+  getFixedWidth(const clang::TypedefNameDecl *decl) const;
+
+  explicit BuiltinTypes(const clang::ASTContext &ASTContext);
+
+private:
+  struct Encoding {
+    unsigned bits; ///< Width of a fixed-width integer, or 0 for a builtin kind.
+    stubs::Type::BuiltinKind builtin;
+    stubs::Type::FixedWidth::FixedWidthKind fixedWidth;
+  };
+
+  void add(clang::QualType type, stubs::Type::BuiltinKind kind);
+  void add(clang::QualType type, stubs::Type::FixedWidth::FixedWidthKind kind,
+           unsigned bits);
+
+  llvm::DenseMap<const clang::Type *, Encoding> m_encodings;
+  llvm::DenseMap<const clang::IdentifierInfo *, FixedWidthInt>
+      m_fixedWidthNames;
+};
+
+} // namespace vf
@@ -0,0 +1,353 @@
+#include "BundleWriter.h"
+#include "Census.h"
+#include "CountingMessageBuilder.h"
+#include "Serializer.h"
+#include "Timings.h"
+#include "capnp/serialize.h"
+#include "kj/io.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include <cstring>
+#include <optional>
+
+namespace vf {
+
+namespace {
+
+using DeclNode = stubs::Node<stubs::Decl>;
+
+/**
+ * @brief Check whether declarations hold a function template, whose
+ * specializations depend on the translation unit that includes them.
+ */
+bool dependsOnIncluder(capnp::List<DeclNode>::Reader decls) {
+  for (DeclNode::Reader node : decls) {
+    stubs::Decl::Reader decl = node.getDesc();
+    switch (decl.which()) {
+    case stubs::Decl::FUNCTION_TEMPLATE:
+      return true;
+    case stubs::Decl::NAMESPACE:
+      if (dependsOnIncluder(decl.getNamespace().getDecls())) {
+        return true;
+      }
+      break;
+    case stubs::Decl::RECORD:
+      if (decl.getRecord().hasBody() &&
+          dependsOnIncluder(decl.getRecord().getBody().getDecls())) {
+        return true;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Digests of the files of a translation unit: the MD5 of the contents
+ * of a file, of the macros of the context it used and of the digests of the
+ * files it includes, like the header cache of VeriFast's C++ frontend computes
+ * them.
+ */
+class HeaderDigests {
+public:
+  explicit HeaderDigests(stubs::TU::Reader tu) {
+    for (stubs::File::Reader file : tu.getFiles()) {
+      m_paths[file.getFd()] = file.getPath();
+    }
+    for (stubs::Inclusion::Reader inclusion : tu.getInclusions()) {
+      m_inclusions[inclusion.getFd()] = inclusion;
+    }
+  }
+
+  /**
+   * @return The digest, or nothing if a file cannot be read or is part of an
+   * include cycle.
+   */
+  std::optional<std::string> digest(unsigned fd) {
+    // A file that is reached again while its digest is computed is part of a
+    // cycle, and keeps no digest.
+    auto [it, inserted] = m_digests.try_emplace(fd);
+    if (!inserted) {
+      return it->second;
+    }
+    std::optional<std::string> result = compute(fd);
+    m_digests[fd] = result;
+    return result;
+  }
+
+private:
+  std::optional<std::string> compute(unsigned fd) {
+    auto path = m_paths.find(fd);
+    if (path == m_paths.end()) {
+      return {};
+    }
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+        llvm::MemoryBuffer::getFile(path->second.cStr(), /*IsText=*/false,
+                                    /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+      return {};
+    }
+    llvm::MD5 hash;
+    hash.update((*buffer)->getBuffer());
+    auto inclusion = m_inclusions.find(fd);
+    if (inclusion != m_inclusions.end()) {
+      capnp::Data::Reader context = inclusion->second.getContext();
+      hash.update(llvm::ArrayRef<uint8_t>(context.begin(), context.size()));
+      for (stubs::Include::Reader include :
+           inclusion->second.getIncludes()) {
+        if (!include.isRealInclude()) {
+          continue;
+        }
+        std::optional<std::string> included =
+            digest(include.getRealInclude().getFd());
+        if (!included) {
+          return {};
+        }
+        hash.update(*included);
+      }
+    }
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    return std::string(reinterpret_cast<const char *>(result.data()),
+                       result.size());
+  }
+
+  llvm::DenseMap<unsigned, capnp::Text::Reader> m_paths;
+  llvm::DenseMap<unsigned, stubs::Inclusion::Reader> m_inclusions;
+  llvm::DenseMap<unsigned, std::optional<std::string>> m_digests;
+};
+
+/**
+ * @brief Key of a shared header. The real path is used, since a header unit
+ * is named on the command line and its includers may reach it through
+ * another path.
+ */
+std::string headerKey(llvm::StringRef path, llvm::StringRef digest) {
+  llvm::SmallString<256> realPath;
+  if (llvm::sys::fs::real_path(path, realPath)) {
+    realPath = path;
+  }
+  return std::string(realPath) + '\0' + digest.str();
+}
+
+} // namespace
+
+std::unique_ptr<BundleWriter> BundleWriter::open(llvm::StringRef path,
+                                                 std::string &error) {
+  int fd;
+  if (std::error_code ec = llvm::sys::fs::openFileForWrite(path, fd)) {
+    error = "Cannot open '" + path.str() + "': " + ec.message();
+    return nullptr;
+  }
+  return std::unique_ptr<BundleWriter>(new BundleWriter(fd));
+}
+
+uint64_t BundleWriter::append(kj::ArrayPtr<const capnp::word> words) {
+  kj::FdOutputStream(m_fd).write(words.begin(),
+                                 words.size() * sizeof(capnp::word));
+  uint64_t offset = m_words;
+  m_words += words.size();
+  return offset;
+}
+
+uint32_t BundleWriter::shareHeader(stubs::TU::Reader tu,
+                                   stubs::File::Reader file,
+                                   llvm::StringRef digest) {
+  std::string key = headerKey(file.getPath().cStr(), digest);
+  auto [it, inserted] = m_headerRefs.try_emplace(key, 0);
+  if (!inserted) {
+    return it->second;
+  }
+
+  // The declarations refer to the tables of their translation unit, so the
+  // shared header holds a copy of them, like the messages of the streaming
+  // protocol do.
+  CountingMessageBuilder builder;
+  stubs::BundleHeader::Builder header = builder.initRoot<stubs::BundleHeader>();
+  header.setPath(file.getPath());
+  header.setDigest(capnp::Data::Reader(
+      reinterpret_cast<const kj::byte *>(digest.data()), digest.size()));
+  ListBuilder<stubs::File> files = header.initFiles(tu.getFiles().size());
+  for (unsigned i = 0; i < tu.getFiles().size(); ++i) {
+    files[i].setFd(tu.getFiles()[i].getFd());
+    files[i].setPath(tu.getFiles()[i].getPath());
+  }
+  if (file.getFd() == tu.getMainFd()) {
+    header.setIncludes(tu.getIncludes());
+  } else {
+    for (stubs::Inclusion::Reader inclusion : tu.getInclusions()) {
+      if (inclusion.getFd() == file.getFd()) {
+        header.setIncludes(inclusion.getIncludes());
+        break;
+      }
+    }
+  }
+  stubs::FileDecls::Builder decls = header.initDecls();
+  decls.setFd(file.getFd());
+  decls.setDecls(file.getDecls());
+  decls.setLocs(tu.getLocs());
+  decls.setNames(tu.getNames());
+  decls.setTypes(tu.getTypes());
+
+  Census::countMessage(builder);
+  kj::Array<capnp::word> words = capnp::messageToFlatArray(builder);
+  uint64_t offset = append(words.asPtr());
+  m_headers.push_back({file.getPath().cStr(), offset, words.size()});
+  it->second = m_headers.size();
+  return it->second;
+}
+
+bool BundleWriter::link(llvm::StringRef path, std::string &error) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    error = "Cannot read '" + path.str() + "': " + buffer.getError().message();
+    return false;
+  }
+  llvm::StringRef data = (*buffer)->getBuffer();
+  if (data.size() < sizeof(capnp::word) ||
+      data.size() % sizeof(capnp::word) != 0) {
+    error = "'" + path.str() + "' is not a bundle";
+    return false;
+  }
+
+  // The words are copied to respect their alignment.
+  kj::Array<capnp::word> words =
+      kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  std::memcpy(words.begin(), data.data(), data.size());
+  uint64_t indexOffset = llvm::support::endian::read64le(&words.back());
+  if (indexOffset >= words.size() - 1) {
+    error = "'" + path.str() + "' is not a bundle";
+    return false;
+  }
+
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+  capnp::FlatArrayMessageReader indexReader(
+      words.slice(indexOffset, words.size() - 1), options);
+  stubs::BundleIndex::Reader index = indexReader.getRoot<stubs::BundleIndex>();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (stubs::BundleEntry::Reader entry : index.getHeaders()) {
+    if (entry.getOffset() + entry.getSize() > indexOffset) {
+      error = "'" + path.str() + "' has a truncated header";
+      return false;
+    }
+    kj::ArrayPtr<const capnp::word> message =
+        words.slice(entry.getOffset(), entry.getOffset() + entry.getSize());
+    capnp::FlatArrayMessageReader reader(message, options);
+    stubs::BundleHeader::Reader header = reader.getRoot<stubs::BundleHeader>();
+    capnp::Data::Reader digest = header.getDigest();
+    std::string key = headerKey(
+        header.getPath().cStr(),
+        llvm::StringRef(reinterpret_cast<const char *>(digest.begin()),
+                        digest.size()));
+    auto [it, inserted] = m_headerRefs.try_emplace(key, 0);
+    if (!inserted) {
+      continue;
+    }
+    m_headers.push_back({header.getPath().cStr(), append(message),
+                         message.size()});
+    it->second = m_headers.size();
+  }
+  return true;
+}
+
+void BundleWriter::write(capnp::MessageBuilder &message) {
+  Census::countMessage(message);
+  write(capnp::messageToFlatArray(message).asPtr());
+}
+
+void BundleWriter::write(kj::ArrayPtr<const capnp::word> words) {
+  Timings::Scope timing(Timings::Output);
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+  capnp::FlatArrayMessageReader reader(words, options);
+  stubs::SerResult::Reader result = reader.getRoot<stubs::SerResult>();
+  stubs::TU::Reader tu = result.getTu();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  HeaderDigests digests(tu);
+  std::vector<uint32_t> refs(tu.getFiles().size(), 0);
+  bool shared = false;
+  for (unsigned i = 0; i < tu.getFiles().size(); ++i) {
+    stubs::File::Reader file = tu.getFiles()[i];
+    if (file.getDecls().size() == 0 ||
+        (file.getFd() == tu.getMainFd() && !m_shareMainFiles) ||
+        dependsOnIncluder(file.getDecls())) {
+      continue;
+    }
+    if (std::optional<std::string> digest = digests.digest(file.getFd())) {
+      refs[i] = shareHeader(tu, file, *digest);
+      shared = true;
+    }
+  }
+
+  if (!shared) {
+    m_tus.push_back(
+        {result.getSourcePath().cStr(), append(words), words.size()});
+    return;
+  }
+
+  // The result is copied without the declarations of the shared headers.
+  CountingMessageBuilder builder(words.size());
+  stubs::SerResult::Builder copy = builder.initRoot<stubs::SerResult>();
+  copy.setErrors(result.getErrors());
+  copy.setSourcePath(result.getSourcePath());
+  stubs::TU::Builder copyTu = copy.initTu();
+  copyTu.setMainFd(tu.getMainFd());
+  copyTu.setIncludes(tu.getIncludes());
+  copyTu.setFailDirectives(tu.getFailDirectives());
+  copyTu.setLocs(tu.getLocs());
+  copyTu.setInclusions(tu.getInclusions());
+  copyTu.setNames(tu.getNames());
+  copyTu.setTypes(tu.getTypes());
+  ListBuilder<stubs::File> files = copyTu.initFiles(tu.getFiles().size());
+  for (unsigned i = 0; i < tu.getFiles().size(); ++i) {
+    stubs::File::Reader file = tu.getFiles()[i];
+    files[i].setFd(file.getFd());
+    files[i].setPath(file.getPath());
+    if (refs[i] != 0) {
+      files[i].setBundleHeader(refs[i]);
+    } else {
+      files[i].setDecls(file.getDecls());
+    }
+  }
+
+  kj::Array<capnp::word> copyWords = capnp::messageToFlatArray(builder);
+  m_tus.push_back({result.getSourcePath().cStr(), append(copyWords.asPtr()),
+                   copyWords.size()});
+}
+
+void BundleWriter::finish() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CountingMessageBuilder builder;
+  stubs::BundleIndex::Builder index = builder.initRoot<stubs::BundleIndex>();
+  auto writeEntries = [](capnp::List<stubs::BundleEntry>::Builder builder,
+                         const std::vector<Entry> &entries) {
+    for (unsigned i = 0; i < entries.size(); ++i) {
+      builder[i].setPath(entries[i].path);
+      builder[i].setOffset(entries[i].offset);
+      builder[i].setSize(entries[i].size);
+    }
+  };
+  writeEntries(index.initTus(m_tus.size()), m_tus);
+  writeEntries(index.initHeaders(m_headers.size()), m_headers);
+  uint64_t indexOffset =
+      append(capnp::messageToFlatArray(builder).asPtr());
+
+  capnp::word trailer;
+  llvm::support::endian::write64le(&trailer, indexOffset);
+  append(kj::arrayPtr(&trailer, 1));
+  llvm::sys::Process::SafelyCloseFileDescriptor(m_fd);
+}
+
+} // namespace vf
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "MessageWriter.h"
+#include "stubs_ast.capnp.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vf {
+
+/**
+ * @brief Writes `SerResult` messages into a bundle, see `BundleIndex` in the
+ * schema. The declarations of a header are moved into a shared
+ * `BundleHeader` the first time it is written, and later translation units
+ * whose copy of the header has the same digest refer to it instead. Headers
+ * with function templates are not shared, since their specializations depend
+ * on the translation unit. The writer can be shared by several threads.
+ *
+ * A bundle can also hold header units: headers exported on their own, whose
+ * main file is shared like any other header. The shared headers of existing
+ * bundles can be linked into a new one, so that its translation units refer
+ * to them instead of adding their own copies.
+ */
+class BundleWriter : public MessageWriter {
+public:
+  /**
+   * @brief Create the bundle file at the given path.
+   *
+   * @param error Set to a description of the failure if null is returned.
+   */
+  static std::unique_ptr<BundleWriter> open(llvm::StringRef path,
+                                            std::string &error);
+
+  /**
+   * @brief Share the main file of the translation units that are written, as
+   * the header units of `-header_unit` need.
+   */
+  void setShareMainFiles(bool shareMainFiles) {
+    m_shareMainFiles = shareMainFiles;
+  }
+
+  /**
+   * @brief Copy the shared headers of an existing bundle into this one, where
+   * later translation units with the same headers refer to them.
+   *
+   * @param error Set to a description of the failure if false is returned.
+   */
+  bool link(llvm::StringRef path, std::string &error);
+
+  void write(capnp::MessageBuilder &message) override;
+
+  void write(kj::ArrayPtr<const capnp::word> words) override;
+
+  /**
+   * @brief Write the index and close the bundle. No messages can be written
+   * afterwards.
+   */
+  void finish();
+
+private:
+  struct Entry {
+    std::string path;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  explicit BundleWriter(int fd) : m_fd(fd) {}
+
+  /**
+   * @brief Append a message to the bundle.
+   *
+   * @return Its offset in words.
+   */
+  uint64_t append(kj::ArrayPtr<const capnp::word> words);
+
+  /**
+   * @brief Return 1 + the index of the shared header that holds the
+   * declarations of a file, adding it if needed, or 0 if the file is not
+   * shared.
+   */
+  uint32_t shareHeader(stubs::TU::Reader tu, stubs::File::Reader file,
+                       llvm::StringRef digest);
+
+  int m_fd;
+  bool m_shareMainFiles = false;
+  uint64_t m_words = 0; ///< Size of the bundle so far.
+  std::vector<Entry> m_tus;
+  std::vector<Entry> m_headers;
+  llvm::StringMap<uint32_t> m_headerRefs; ///< By real path and digest.
+  std::mutex m_mutex;
+};
+
+} // namespace vf
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace vf {
+
+/**
+ * @brief Cancellation of the requests of the server mode, shared between the
+ * thread that reads requests and the thread that exports them.
+ *
+ * Requests are numbered in the order in which they are read. A cancellation
+ * request cancels every request read before it, whether it is being exported
+ * or still waiting. The export of a request polls `isRequested` at safe
+ * points, i.e. between top-level declarations, and gives up once it returns
+ * true.
+ */
+class Cancellation {
+public:
+  /**
+   * @brief Number the next request, starting at 1. Called by the reading
+   * thread.
+   */
+  uint64_t number() { return ++m_lastRead; }
+
+  /**
+   * @brief Cancel every request numbered so far. Called by the reading thread.
+   */
+  void cancel() { m_cancelledUpTo = m_lastRead.load(); }
+
+  /**
+   * @brief Check whether the given request has been cancelled.
+   */
+  bool isCancelled(uint64_t request) const {
+    return request <= m_cancelledUpTo;
+  }
+
+  /**
+   * @brief Mark the given request as the one being exported.
+   */
+  void start(uint64_t request) { m_current = request; }
+
+  /**
+   * @brief Check whether the request being exported has been cancelled.
+   */
+  bool isRequested() const {
+    uint64_t current = m_current;
+    return current != 0 && isCancelled(current);
+  }
+
+private:
+  std::atomic<uint64_t> m_lastRead = 0;
+  std::atomic<uint64_t> m_cancelledUpTo = 0;
+  std::atomic<uint64_t> m_current = 0;
+};
+
+} // namespace vf
@@ -0,0 +1,161 @@
+#include "Census.h"
+#include "capnp/any.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include <array>
+#include <memory>
+
+namespace vf {
+
+namespace {
+
+constexpr std::array<const char *, Census::NbCategories> categoryNames = {
+    "decl", "stmt", "expr", "type"};
+
+struct Counts {
+  uint64_t nodes = 0;
+  uint64_t words = 0;
+  uint64_t locWords = 0;
+};
+
+struct CensusState {
+  std::array<llvm::StringMap<Counts>, Census::NbCategories> counts;
+  ///< Words of the nodes counted within every active node, innermost last.
+  llvm::SmallVector<uint64_t, 32> nestedWords;
+  uint64_t truncating = 0;
+  uint64_t segments = 0;
+  uint64_t segmentWords = 0;
+  uint64_t messages = 0;
+  uint64_t messageWords = 0;
+  uint64_t abandonedWords = 0;
+};
+
+std::unique_ptr<CensusState> state;
+
+} // namespace
+
+Census::Node::Node(Category category, llvm::StringRef kind)
+    : m_active(state != nullptr), m_category(category), m_kind(kind) {
+  if (m_active) {
+    state->nestedWords.push_back(0);
+  }
+}
+
+Census::Node::~Node() {
+  if (m_active) {
+    state->nestedWords.pop_back();
+  }
+}
+
+void Census::Node::record(uint64_t nodeWords, uint64_t locWords) {
+  uint64_t nested = state->nestedWords.back();
+  Counts &counts = state->counts[m_category][m_kind];
+  ++counts.nodes;
+  counts.words += nodeWords > nested ? nodeWords - nested : 0;
+  counts.locWords += locWords;
+  // The enclosing node is never at the bottom of the stack since this node is
+  // on top of it.
+  if (state->nestedWords.size() > 1) {
+    state->nestedWords.end()[-2] += nodeWords + locWords;
+  }
+}
+
+Census::Detached::Detached() : m_active(state != nullptr) {
+  if (m_active) {
+    state->nestedWords.push_back(0);
+  }
+}
+
+Census::Detached::~Detached() {
+  if (m_active) {
+    state->nestedWords.pop_back();
+  }
+}
+
+void Census::countTruncating() {
+  if (state) {
+    ++state->truncating;
+  }
+}
+
+void Census::countSegment(size_t words) {
+  if (state) {
+    ++state->segments;
+    state->segmentWords += words;
+  }
+}
+
+void Census::countMessage(capnp::MessageBuilder &message) {
+  if (!state) {
+    return;
+  }
+  uint64_t used = 0;
+  for (kj::ArrayPtr<const capnp::word> segment :
+       message.getSegmentsForOutput()) {
+    used += segment.size();
+  }
+  // The root pointer itself is not part of the size of its target.
+  uint64_t reachable =
+      message.getRoot<capnp::AnyPointer>().asReader().targetSize().wordCount +
+      1;
+  ++state->messages;
+  state->messageWords += used;
+  state->abandonedWords += used > reachable ? used - reachable : 0;
+}
+
+void Census::enable() {
+  if (!state) {
+    state = std::make_unique<CensusState>();
+  }
+}
+
+bool Census::isEnabled() { return state != nullptr; }
+
+void Census::print(llvm::raw_ostream &os) {
+  if (!state) {
+    return;
+  }
+  struct Row {
+    const char *category;
+    llvm::StringRef kind;
+    Counts counts;
+  };
+  llvm::SmallVector<Row, 128> rows;
+  Counts total;
+  for (unsigned i = 0; i < NbCategories; ++i) {
+    for (const auto &entry : state->counts[i]) {
+      rows.push_back({categoryNames[i], entry.getKey(), entry.getValue()});
+      total.nodes += entry.getValue().nodes;
+      total.words += entry.getValue().words;
+      total.locWords += entry.getValue().locWords;
+    }
+  }
+  llvm::stable_sort(rows, [](const Row &lhs, const Row &rhs) {
+    return lhs.counts.words + lhs.counts.locWords >
+           rhs.counts.words + rhs.counts.locWords;
+  });
+
+  auto printRow = [&os](llvm::StringRef category, llvm::StringRef kind,
+                        const Counts &counts) {
+    os << llvm::format("%-6s %-32s %10llu %12llu %12llu\n",
+                       category.str().c_str(), kind.str().c_str(),
+                       static_cast<unsigned long long>(counts.nodes),
+                       static_cast<unsigned long long>(counts.words),
+                       static_cast<unsigned long long>(counts.locWords));
+  };
+  os << llvm::format("%-6s %-32s %10s %12s %12s\n", "", "kind", "nodes",
+                     "words", "loc words");
+  for (const Row &row : rows) {
+    printRow(row.category, row.kind, row.counts);
+  }
+  printRow("", "total", total);
+  os << "truncating expressions: " << state->truncating << '\n';
+  os << "segments allocated: " << state->segments << " ("
+     << state->segmentWords << " words)\n";
+  os << "messages written: " << state->messages << " (" << state->messageWords
+     << " words used, " << state->abandonedWords << " words abandoned)\n";
+}
+
+} // namespace vf
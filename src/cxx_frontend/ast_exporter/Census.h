@@ -0,0 +1,108 @@
+#pragma once
+#include "capnp/message.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace vf {
+
+/**
+ * @brief Number of nodes of every kind that the exporter serialized, and the
+ * words they take in the output, as reported by `-stats`.
+ *
+ * A node is counted by a `Node` that records the size of its builders once it
+ * is serialized. The words of a node exclude those of the nodes serialized
+ * within it, so the words of all nodes add up to the size of the output.
+ * Nothing is recorded unless the census is enabled, and it must only be
+ * enabled when a single thread exports.
+ */
+class Census {
+public:
+  enum Category : unsigned { Decls, Stmts, Exprs, Types, NbCategories };
+
+  /**
+   * @brief Counts a node of a given kind.
+   */
+  class Node {
+  public:
+    Node(Category category, llvm::StringRef kind);
+    ~Node();
+
+    Node(const Node &) = delete;
+    Node &operator=(const Node &) = delete;
+
+    /**
+     * @brief Record the size of the serialized node.
+     *
+     * @param nodeBuilder Builder of the node, including the nodes within it.
+     * @param locBuilder Builder of the location of the node, if it has one.
+     */
+    template <class NodeBuilder, class LocBuilder>
+    void record(NodeBuilder nodeBuilder, LocBuilder locBuilder) {
+      if (m_active) {
+        record(nodeBuilder.asReader().totalSize().wordCount,
+               locBuilder.asReader().totalSize().wordCount);
+      }
+    }
+
+    template <class NodeBuilder> void record(NodeBuilder nodeBuilder) {
+      if (m_active) {
+        record(nodeBuilder.asReader().totalSize().wordCount, 0);
+      }
+    }
+
+  private:
+    void record(uint64_t nodeWords, uint64_t locWords);
+
+    bool m_active;
+    Category m_category;
+    llvm::StringRef m_kind;
+  };
+
+  /**
+   * @brief Nodes counted while it is alive are not part of the node that
+   * encloses it, like the entries of the type table.
+   */
+  class Detached {
+  public:
+    Detached();
+    ~Detached();
+
+    Detached(const Detached &) = delete;
+    Detached &operator=(const Detached &) = delete;
+
+  private:
+    bool m_active;
+  };
+
+  /**
+   * @brief Count an expression that is wrapped in a truncating annotation.
+   */
+  static void countTruncating();
+
+  /**
+   * @brief Count a segment allocated by a message builder.
+   */
+  static void countSegment(size_t words);
+
+  /**
+   * @brief Count a message that is written, with the words its segments use
+   * and those of them that are not reachable from its root, like orphans that
+   * were never adopted and lists or structs that were initialized twice.
+   */
+  static void countMessage(capnp::MessageBuilder &message);
+
+  static void enable();
+
+  static bool isEnabled();
+
+  /**
+   * @brief Print a table with the number of nodes, words and location words of
+   * every kind that was serialized, in decreasing number of words, followed
+   * by the counters of the message builders.
+   */
+  static void print(llvm::raw_ostream &os);
+};
+
+} // namespace vf
@@ -1,10 +1,27 @@
 #include "CommentProcessor.h"
+#include "Timings.h"
 
 namespace vf {
 
+bool CommentProcessor::skipFileOf(const clang::SourceManager &sourceManager,
+                                  clang::SourceLocation loc) {
+  clang::FileID fileID = sourceManager.getFileID(loc);
+  if (fileID != m_fileID) {
+    m_fileID = fileID;
+    m_skipFile = clang::SrcMgr::isSystem(
+        sourceManager.getFileCharacteristic(loc));
+  }
+  return m_skipFile;
+}
+
 bool CommentProcessor::HandleComment(clang::Preprocessor &preprocessor,
                                      clang::SourceRange comment) {
+  Timings::Scope timing(Timings::Comments);
   const clang::SourceManager &sourceManager = preprocessor.getSourceManager();
+  if (m_skipSystemComments && skipFileOf(sourceManager, comment.getBegin())) {
+    return false;
+  }
+
   const char *begin = sourceManager.getCharacterData(comment.getBegin());
   const char *end = sourceManager.getCharacterData(comment.getEnd());
 
@@ -15,11 +15,28 @@ public:
   bool HandleComment(clang::Preprocessor &preprocessor,
                      clang::SourceRange comment) override;
 
-  explicit CommentProcessor(AnnotationManager &annotationManager)
-      : m_annotationManager(annotationManager) {}
+  /**
+   * @param skipSystemComments Whether comments in system headers are ignored
+   * without looking at their text.
+   */
+  explicit CommentProcessor(AnnotationManager &annotationManager,
+                            bool skipSystemComments = false)
+      : m_annotationManager(annotationManager),
+        m_skipSystemComments(skipSystemComments) {}
 
 private:
+  /**
+   * @brief Whether the comments of the file of a location are ignored. The
+   * verdict for the file of the previous comment is kept, since the comments
+   * of a file are mostly handled one after the other.
+   */
+  bool skipFileOf(const clang::SourceManager &sourceManager,
+                  clang::SourceLocation loc);
+
   AnnotationManager &m_annotationManager;
+  bool m_skipSystemComments;
+  clang::FileID m_fileID; ///< File of the previous comment.
+  bool m_skipFile = false; ///< Whether the comments of `m_fileID` are ignored.
 };
 
 } // namespace vf
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include "ContextFreePPCallbacks.h"
+#include "FileCosts.h"
+#include "MacroStats.h"
+#include "Timings.h"
+#include <chrono>
 
 namespace vf {
 
 void ContextFreePPCallbacks::MacroUndefined(
     const clang::Token &macroNameTok, const clang::MacroDefinition &MD,
     const clang::MacroDirective *undef) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   // C++ allows to undef a macro that has not been defined, so we could
   // allow it, but it may be better to raise an error to be more compliant with
   // the context-free awareness.
@@ -13,30 +18,34 @@ void ContextFreePPCallbacks::MacroUndefined(
   // It is not allowed to undef a macro that is globally defined, but not in the
   // current context. We still allow to undef macro's that haven't been defined
   // at all.
-  auto name = getMacroName(macroNameTok);
-  if (macroAllowed(name))
+  if (skipChecks() || macroAllowed(macroNameTok)) {
+    recordContextUse(macroNameTok, MD);
     return;
-  if (undef && !m_context->currentInclusion().hasMacroDefinition(
-                   MD, m_preprocessor->getSourceManager())) {
-    reportUndefIsolatedMacro(macroNameTok, name, undef->getLocation());
+  }
+  if (undef && !isDefinedInCurrentInclusion(macroNameTok, MD)) {
+    reportUndefIsolatedMacro(macroNameTok, getMacroName(macroNameTok),
+                             undef->getLocation());
   }
 }
 
 void ContextFreePPCallbacks::Defined(const clang::Token &macroNameTok,
                                      const clang::MacroDefinition &MD,
                                      clang::SourceRange range) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   checkDivergence(macroNameTok, MD);
 }
 
 void ContextFreePPCallbacks::Ifdef(clang::SourceLocation loc,
                                    const clang::Token &macroNameTok,
                                    const clang::MacroDefinition &MD) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   checkDivergence(macroNameTok, MD);
 }
 
 void ContextFreePPCallbacks::Ifndef(clang::SourceLocation loc,
                                     const clang::Token &macroNameTok,
                                     const clang::MacroDefinition &MD) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   checkDivergence(macroNameTok, MD);
 }
 
@@ -44,22 +53,32 @@ void ContextFreePPCallbacks::MacroExpands(const clang::Token &macroNameTok,
                                           const clang::MacroDefinition &MD,
                                           clang::SourceRange range,
                                           const clang::MacroArgs *args) {
-  std::string name(getMacroName(macroNameTok));
-  if (macroAllowed(name))
+  Timings::Scope timing(Timings::ContextFreeChecks);
+  if (MacroStats::isEnabled()) {
+    MacroStats::countExpansion(getMacroName(macroNameTok),
+                               macroAllowed(macroNameTok));
+  }
+  if (skipChecks() || macroAllowed(macroNameTok)) {
+    recordContextUse(macroNameTok, MD);
     return;
-  bool macroDefined = m_context->currentInclusion().hasMacroDefinition(
-      MD, m_preprocessor->getSourceManager());
-  if (!macroDefined) {
-    reportCtxSensitiveMacroExpansion(macroNameTok, name, range.getBegin());
+  }
+  if (!isDefinedInCurrentInclusion(macroNameTok, MD)) {
+    reportCtxSensitiveMacroExpansion(macroNameTok, getMacroName(macroNameTok),
+                                     range.getBegin());
   }
 }
 
 void ContextFreePPCallbacks::FileChanged(
     clang::SourceLocation loc, FileChangeReason reason,
     clang::SrcMgr::CharacteristicKind fileType, clang::FileID prevFID) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   switch (reason) {
   case EnterFile: {
     auto fileID = m_preprocessor->getSourceManager().getFileID(loc);
+    FileCosts::enterFile(
+        m_preprocessor->getSourceManager().getFileEntryForID(fileID));
+    MacroStats::countEnteredFile(
+        m_preprocessor->getSourceManager().getFileEntryForID(fileID));
     auto includeLoc = m_preprocessor->getSourceManager().getIncludeLoc(fileID);
     // check if we entered an included file
     if (includeLoc.isValid()) {
@@ -71,6 +90,7 @@ void ContextFreePPCallbacks::FileChanged(
     break;
   }
   case ExitFile: {
+    FileCosts::exitFile();
     if (m_context->hasInclusions()) {
       const clang::FileEntry *exitedFileEntry =
           m_preprocessor->getSourceManager().getFileEntryForID(prevFID);
@@ -85,12 +105,18 @@ void ContextFreePPCallbacks::FileChanged(
   default:
     return;
   }
+
+  m_inTrustedFile = m_context->hasInclusions() &&
+                    m_trustedDirs.contains(
+                        m_context->currentInclusion().getFileEntry());
 }
 
 void ContextFreePPCallbacks::FileSkipped(
     const clang::FileEntryRef &skippedFile, const clang::Token &filenameTok,
     clang::SrcMgr::CharacteristicKind fileType) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   const clang::FileEntry &fileEntry = skippedFile.getFileEntry();
+  MacroStats::countSkippedFile(&fileEntry);
   m_context->startInclusionForFile(&fileEntry);
   m_context->endCurrentInclusion();
 }
@@ -101,9 +127,14 @@ void ContextFreePPCallbacks::InclusionDirective(
     clang::CharSourceRange filenameRange, clang::OptionalFileEntryRef file,
     clang::StringRef searchPath, clang::StringRef relativePath,
     const clang::Module *imported, clang::SrcMgr::CharacteristicKind fileType) {
+  Timings::Scope timing(Timings::ContextFreeChecks);
   if (file.has_value()) {
     m_context->currentInclusion().addIncludeDirective(
         {filenameRange.getAsRange(), fileName, file->getUID(), isAngled});
+    // The header was not entered, its module was imported instead.
+    if (imported && m_loader) {
+      m_loader->loadImport(&file->getFileEntry());
+    }
   }
 }
 
@@ -135,26 +166,78 @@ void ContextFreePPCallbacks::reportUndefIsolatedMacro(
 
 void ContextFreePPCallbacks::checkDivergence(const clang::Token &macroNameToken,
                                              const clang::MacroDefinition &MD) {
-  std::string name(getMacroName(macroNameToken));
-  if (macroAllowed(name))
+  if (skipChecks() || macroAllowed(macroNameToken)) {
+    recordContextUse(macroNameToken, MD);
     return;
-  bool hasLocalDef = m_context->currentInclusion().hasMacroDefinition(
-      MD, m_preprocessor->getSourceManager());
+  }
+  bool hasLocalDef = isDefinedInCurrentInclusion(macroNameToken, MD);
   bool hasGlobalDef = MD.getMacroInfo();
   if (hasLocalDef ^ hasGlobalDef) {
-    reportMacroDivergence(macroNameToken, name);
+    reportMacroDivergence(macroNameToken, getMacroName(macroNameToken));
   }
 }
 
-std::string
+bool ContextFreePPCallbacks::isDefinedInCurrentInclusion(
+    const clang::Token &macroNameToken, const clang::MacroDefinition &MD) {
+  const clang::MacroInfo *macroInfo = MD.getMacroInfo();
+  if (!macroInfo) {
+    return false;
+  }
+
+  const Inclusion &inclusion = m_context->currentInclusion();
+  std::pair<const Inclusion *, const clang::MacroInfo *> key(&inclusion,
+                                                             macroInfo);
+  if (m_visibleDefinitions.contains(key)) {
+    return true;
+  }
+
+  bool timed = MacroStats::isEnabled();
+  auto start = timed ? std::chrono::steady_clock::now()
+                     : std::chrono::steady_clock::time_point();
+  bool defined =
+      inclusion.hasMacroDefinition(MD, m_preprocessor->getSourceManager());
+  if (timed) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    MacroStats::countCheck(getMacroName(macroNameToken), elapsed.count());
+  }
+  if (defined) {
+    m_visibleDefinitions.insert(key);
+  }
+  return defined;
+}
+
+void ContextFreePPCallbacks::recordContextUse(
+    const clang::Token &macroNameToken, const clang::MacroDefinition &MD) {
+  if (!isDefinedInCurrentInclusion(macroNameToken, MD)) {
+    m_context->currentInclusion().addContextMacro(
+        macroNameToken.getIdentifierInfo(), MD.getMacroInfo());
+  }
+}
+
+llvm::StringRef
 ContextFreePPCallbacks::getMacroName(const clang::Token &macroNameToken) const {
-  return m_preprocessor->getSpelling(macroNameToken);
+  // Macro names are identifiers, so their spelling does not have to be copied.
+  if (const clang::IdentifierInfo *info = macroNameToken.getIdentifierInfo()) {
+    return info->getName();
+  }
+  return {};
 }
 
-bool ContextFreePPCallbacks::macroAllowed(std::string_view macroName) const {
-  clang::StringRef n(macroName);
-  return n.startswith("__VF_CXX_CLANG_FRONTEND__") ||
-         m_macroWhiteList.contains(macroName);
+bool ContextFreePPCallbacks::macroAllowed(
+    const clang::Token &macroNameToken) const {
+  const clang::IdentifierInfo *info = macroNameToken.getIdentifierInfo();
+  if (!info) {
+    return false;
+  }
+
+  // Whitelisted macros are in the map from the start, so only the prefix has
+  // to be checked, once for every other macro name.
+  auto [it, inserted] = m_allowedMacros.try_emplace(info, false);
+  if (inserted) {
+    it->second = info->getName().startswith(frontendMacroPrefix);
+  }
+  return it->second;
 }
 
 } // namespace vf
\ No newline at end of file
@@ -1,7 +1,12 @@
 #pragma once
 #include "InclusionContext.h"
+#include "PrecompiledHeaderLoader.h"
+#include "TrustedDirs.h"
 #include "clang/Lex/PPCallbacks.h"
-#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+#include <utility>
 
 namespace vf {
 
@@ -50,12 +55,28 @@ public:
                           const clang::Module *imported,
                           clang::SrcMgr::CharacteristicKind fileType) override;
 
+  /**
+   * @brief Construct the callbacks and start the inclusion of the main file.
+   *
+   * @param context Inclusion context to record the inclusions in
+   * @param preprocessor Preprocessor the callbacks are added to
+   * @param whiteList Macros that may expand regardless of their context
+   * @param trustedDirs Directories of headers that are not checked for
+   * context-free macro use. Their inclusions are still recorded.
+   * @param loader Loader of the files of imported modules, if modules are
+   * enabled.
+   */
   ContextFreePPCallbacks(InclusionContext &context,
                          const clang::Preprocessor &preprocessor,
-                         llvm::ArrayRef<std::string> whiteList)
-      : m_context(&context), m_preprocessor(&preprocessor) {
-    for (auto s : whiteList) {
-      m_macroWhiteList.insert(s);
+                         llvm::ArrayRef<std::string> whiteList,
+                         llvm::ArrayRef<std::string> trustedDirs,
+                         PrecompiledHeaderLoader *loader = nullptr)
+      : m_context(&context), m_preprocessor(&preprocessor),
+        m_trustedDirs(trustedDirs), m_loader(loader) {
+    // Resolve the whitelist once, so that checks compare identifiers instead
+    // of spelled names.
+    for (const std::string &macro : whiteList) {
+      m_allowedMacros[m_preprocessor->getIdentifierInfo(macro)] = true;
     }
     auto mainEntry = m_preprocessor->getSourceManager().getFileEntryForID(
         m_preprocessor->getSourceManager().getMainFileID());
@@ -77,13 +98,53 @@ private:
   void checkDivergence(const clang::Token &macroNameToken,
                        const clang::MacroDefinition &MD);
 
-  std::string getMacroName(const clang::Token &macroNameToken) const;
-
-  bool macroAllowed(std::string_view macroName) const;
+  /**
+   * @brief Check whether a macro definition is visible from the current
+   * inclusion. Files only get more inclusions while preprocessing, so once a
+   * definition is visible from an inclusion it stays visible and the verdict is
+   * cached.
+   */
+  bool isDefinedInCurrentInclusion(const clang::Token &macroNameToken,
+                                   const clang::MacroDefinition &MD);
+
+  /**
+   * @brief Record a macro that is used without being checked, because it is
+   * allowed or the current file is trusted, in the macros of the context of the
+   * current inclusion if its definition is not visible from that inclusion. The
+   * header cache of the frontend keys a header by these macros, since the
+   * header may preprocess to different code in another context.
+   */
+  void recordContextUse(const clang::Token &macroNameToken,
+                        const clang::MacroDefinition &MD);
+
+  llvm::StringRef getMacroName(const clang::Token &macroNameToken) const;
+
+  /**
+   * @brief Whether the checks have to be skipped in the current inclusion,
+   * because its file is trusted.
+   */
+  bool skipChecks() const { return m_inTrustedFile; }
+
+  /**
+   * @brief Check whether a macro may expand regardless of its context, i.e.
+   * whether it is whitelisted or starts with the prefix of the frontend macros.
+   */
+  bool macroAllowed(const clang::Token &macroNameToken) const;
+
+  static constexpr llvm::StringLiteral frontendMacroPrefix =
+      "__VF_CXX_CLANG_FRONTEND__";
 
   const clang::Preprocessor *m_preprocessor;
-  llvm::StringSet<> m_macroWhiteList;
   InclusionContext *m_context;
+  TrustedDirs m_trustedDirs;
+  PrecompiledHeaderLoader *m_loader;
+  ///< Whether the file of the current inclusion is trusted.
+  bool m_inTrustedFile = false;
+  ///< Verdicts of `macroAllowed` by macro name.
+  mutable llvm::DenseMap<const clang::IdentifierInfo *, bool> m_allowedMacros;
+  ///< Pairs of inclusions and macro definitions visible from those inclusions.
+  llvm::DenseSet<std::pair<const Inclusion *, const clang::MacroInfo *>>
+      m_visibleDefinitions;
 };
 
 } // namespace vf
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+#include "Census.h"
+#include "capnp/message.h"
+
+namespace vf {
+
+/**
+ * @brief Message builder that counts the segments it allocates, and the words
+ * they hold, in the census reported by `-stats`. It also keeps the number of
+ * words it allocated, which `-report_memory` reports as the arena size.
+ */
+class CountingMessageBuilder : public capnp::MallocMessageBuilder {
+public:
+  using capnp::MallocMessageBuilder::MallocMessageBuilder;
+
+  kj::ArrayPtr<capnp::word> allocateSegment(uint minimumSize) override {
+    kj::ArrayPtr<capnp::word> segment =
+        capnp::MallocMessageBuilder::allocateSegment(minimumSize);
+    Census::countSegment(segment.size());
+    m_allocatedWords += segment.size();
+    return segment;
+  }
+
+  /**
+   * @brief Number of words in the segments allocated so far.
+   */
+  size_t allocatedWords() const { return m_allocatedWords; }
+
+private:
+  size_t m_allocatedWords = 0;
+};
+
+} // namespace vf
@@ -0,0 +1,265 @@
+#include "Daemon.h"
+#include "Exporter.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace vf {
+
+namespace {
+
+/**
+ * @brief Split the payload of a request into the working directory and the
+ * command line of the run.
+ *
+ * @return False if the payload lacks the working directory or the path of
+ * the exporter.
+ */
+bool parseRequest(llvm::StringRef payload, std::vector<std::string> &args) {
+  args.clear();
+  llvm::SmallVector<llvm::StringRef> parts;
+  payload.split(parts, '\0', -1, false);
+  for (llvm::StringRef part : parts) {
+    args.push_back(part.str());
+  }
+  return args.size() >= 2;
+}
+
+/**
+ * @brief Run the exporter with the command line of a request, after changing
+ * to its working directory.
+ *
+ * @return The exit status of the run.
+ */
+int runRequest(const std::vector<std::string> &args) {
+  if (std::error_code error = llvm::sys::fs::set_current_path(args[0])) {
+    llvm::errs() << "Cannot change to directory '" << args[0]
+                 << "': " << error.message() << "\n";
+    return 1;
+  }
+
+  std::vector<const char *> argv;
+  for (size_t i = 1; i < args.size(); ++i) {
+    argv.push_back(args[i].c_str());
+  }
+  argv.push_back(nullptr);
+  int status = runExporter(int(argv.size() - 1), argv.data(), nullptr);
+  llvm::outs().flush();
+  llvm::errs().flush();
+  return status;
+}
+
+} // namespace
+
+int runStandby() {
+  llvm::sys::ChangeStdinToBinary();
+  char header[4];
+  if (std::fread(header, 1, sizeof(header), stdin) != sizeof(header)) {
+    // The client did not need this process after all.
+    return 0;
+  }
+  uint32_t length =
+      llvm::support::endian::read32le(reinterpret_cast<uint8_t *>(header));
+  std::string payload(length, '\0');
+  std::vector<std::string> args;
+  if (std::fread(payload.data(), 1, length, stdin) != length ||
+      !parseRequest(payload, args)) {
+    llvm::errs() << "-standby received a malformed request\n";
+    return 1;
+  }
+  return runRequest(args);
+}
+
+#ifdef _WIN32
+
+int runDaemon(llvm::StringRef socketPath) {
+  llvm::errs() << "-listen is not available on Windows\n";
+  return 1;
+}
+
+#else
+
+namespace {
+
+/// Number of file descriptors a client passes: its stdin, stdout and stderr.
+constexpr int nbClientFds = 3;
+
+/**
+ * @brief Close the given file descriptors, skipping the ones that are -1.
+ */
+void closeFds(llvm::ArrayRef<int> fds) {
+  for (int fd : fds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+/**
+ * @brief Read exactly `size` bytes from a connection.
+ *
+ * @return False if the connection was closed or failed first.
+ */
+bool readFully(int fd, char *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buffer, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Receive the request of a client: its file descriptors and the
+ * arguments of the run.
+ *
+ * @param fds Receives the file descriptors of the client, which the caller
+ * must close. Entries that were not received are -1.
+ * @return False if the request is malformed.
+ */
+bool receiveRequest(int connection, int (&fds)[nbClientFds],
+                    std::vector<std::string> &args) {
+  std::fill(std::begin(fds), std::end(fds), -1);
+
+  char header[4];
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+  iovec iov{header, sizeof(header)};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n;
+  do {
+    n = recvmsg(connection, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return false;
+  }
+
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+      std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+  }
+  if (fds[nbClientFds - 1] < 0 ||
+      !readFully(connection, header + n, sizeof(header) - n)) {
+    return false;
+  }
+
+  uint32_t length =
+      llvm::support::endian::read32le(reinterpret_cast<uint8_t *>(header));
+  std::string payload(length, '\0');
+  if (!readFully(connection, payload.data(), length)) {
+    return false;
+  }
+
+  return parseRequest(payload, args);
+}
+
+/**
+ * @brief Run the exporter for a request in a forked child, which never
+ * returns.
+ */
+[[noreturn]] void serveRequest(int (&fds)[nbClientFds],
+                               const std::vector<std::string> &args) {
+  std::signal(SIGCHLD, SIG_DFL);
+  for (int i = 0; i < nbClientFds; ++i) {
+    dup2(fds[i], i);
+  }
+  closeFds(fds);
+  std::exit(runRequest(args));
+}
+
+} // namespace
+
+int runDaemon(llvm::StringRef socketPath) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    llvm::errs() << "The socket path '" << socketPath << "' is too long\n";
+    return 1;
+  }
+  std::memcpy(address.sun_path, socketPath.data(), socketPath.size());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    llvm::errs() << "Cannot create a socket: " << std::strerror(errno) << "\n";
+    return 1;
+  }
+  fcntl(listener, F_SETFD, FD_CLOEXEC);
+  // A socket left behind by a daemon that was killed is replaced.
+  unlink(address.sun_path);
+  if (bind(listener, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    llvm::errs() << "Cannot listen on '" << socketPath
+                 << "': " << std::strerror(errno) << "\n";
+    close(listener);
+    return 1;
+  }
+
+  // Children are reaped automatically; clients only see their output.
+  std::signal(SIGCHLD, SIG_IGN);
+
+  std::vector<std::string> args;
+  while (true) {
+    int connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      llvm::errs() << "Cannot accept a connection: " << std::strerror(errno)
+                   << "\n";
+      close(listener);
+      return 1;
+    }
+
+    int fds[nbClientFds];
+    bool valid = receiveRequest(connection, fds, args);
+    close(connection);
+    if (valid) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(listener);
+        serveRequest(fds, args);
+      }
+      if (pid < 0) {
+        llvm::errs() << "Cannot fork: " << std::strerror(errno) << "\n";
+      }
+    }
+    // The client sees the end of its pipes once the child is done with them.
+    closeFds(fds);
+  }
+}
+
+#endif
+
+} // namespace vf
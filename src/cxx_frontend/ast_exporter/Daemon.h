@@ -0,0 +1,40 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+namespace vf {
+
+/**
+ * @brief Serve exporter runs to the clients of a Unix socket until the
+ * process is terminated. Not available on Windows.
+ *
+ * A client sends one request per connection: a 32-bit little-endian length,
+ * which carries the client's stdin, stdout and stderr as `SCM_RIGHTS`
+ * ancillary data, followed by that many bytes of NUL-separated arguments: the
+ * working directory of the run, followed by its command line, starting with
+ * the path of the exporter. The daemon forks a child per request, which runs
+ * the exporter with that command line on the received file descriptors, as if
+ * the client had started the exporter itself. The children start from the
+ * initialized daemon, so they do not pay for loading and initializing LLVM and
+ * Clang.
+ *
+ * @return Non-zero if the socket cannot be created.
+ */
+int runDaemon(llvm::StringRef socketPath);
+
+/**
+ * @brief Wait on stdin for the command line of one exporter run, then run
+ * the exporter with it on the standard streams of this process.
+ *
+ * The request has the payload format of `runDaemon`, without file
+ * descriptors: a 32-bit little-endian length followed by the working
+ * directory and the command line. Clients keep such processes started ahead
+ * of time, so a run does not wait for the exporter to be loaded and
+ * initialized. Whatever follows the request on stdin is read by the run.
+ *
+ * @return The exit status of the run, or 0 if stdin is closed before a
+ * request arrives.
+ */
+int runStandby();
+
+} // namespace vf
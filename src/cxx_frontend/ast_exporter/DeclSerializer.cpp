@@ -1,12 +1,18 @@
 #include "DeclSerializer.h"
+#include "Census.h"
+#include "ExprSerializer.h"
 #include "FixedWidthInt.h"
 #include "Location.h"
 #include "NodeListSerializer.h"
-#include "clang/AST/CXXInheritance.h"
+#include "TemplateStats.h"
+#include "Trace.h"
+#include "capnp/message.h"
 #include "clang/AST/DeclVisitor.h"
 #include "clang/AST/ExprCXX.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Lex/Lexer.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringMap.h"
 
 namespace vf {
 
@@ -48,16 +54,18 @@ struct DeclSerializerImpl
   void serializeFunctionDecl(stubs::Decl::Function::Builder functionBuilder,
                              const clang::FunctionDecl *decl,
                              bool serializeContract) {
-    std::string name = m_ASTSerializer->getQualifiedFuncName(decl);
+    kj::StringPtr name = m_ASTSerializer->getQualifiedFuncName(decl);
     clang::FunctionTypeLoc returnTypeLoc = decl->getFunctionTypeLoc();
     bool isImplicit = decl->isImplicit();
-    bool isDef = decl->isThisDeclarationADefinition();
+    // A body skipped by `-skip_trusted_bodies` still makes a definition.
+    bool isDef =
+        decl->isThisDeclarationADefinition() && !decl->hasSkippedBody();
 
     TypeNodeBuilder resultBuilder = functionBuilder.initResult();
     ListBuilder<stubs::Param> paramBuilder =
         functionBuilder.initParams(decl->param_size());
 
-    functionBuilder.setName(name.data());
+    functionBuilder.setName(name);
     functionBuilder.setIsMain(decl->isMain());
 
     if (!returnTypeLoc.isNull()) {
@@ -88,13 +96,35 @@ struct DeclSerializerImpl
       assert(decl->doesThisDeclarationHaveABody());
 
       StmtNodeBuilder bodyBuilder = functionBuilder.initBody();
-      m_ASTSerializer->serialize(bodyBuilder, decl->getBody());
+      const auto *compound =
+          llvm::dyn_cast<clang::CompoundStmt>(decl->getBody());
+      if (compound && !m_ASTSerializer->isFocused(decl)) {
+        serializeEmptyBody(bodyBuilder, compound);
+      } else {
+        m_ASTSerializer->serialize(bodyBuilder, decl->getBody());
+      }
     }
   }
 
+  /**
+   * @brief Serialize a function body without its statements. VeriFast does not
+   * verify a function outside its focus, but still uses the braces of its body
+   * to decide that.
+   */
+  void serializeEmptyBody(StmtNodeBuilder builder,
+                          const clang::CompoundStmt *body) {
+    m_ASTSerializer->serialize(builder.initLoc(), body->getSourceRange());
+    stubs::Stmt::Compound::Builder compoundBuilder =
+        builder.initDesc().initCompound();
+    compoundBuilder.initStmts(0);
+    m_ASTSerializer->serialize(compoundBuilder.initRBrace(),
+                               body->getRBracLoc());
+  }
+
   void serializeRecordRef(stubs::RecordRef::Builder builder,
                           const clang::CXXRecordDecl *record) {
-    builder.setName(record->getQualifiedNameAsString());
+    m_ASTSerializer->serializeName(builder,
+                                   m_ASTSerializer->getQualifiedName(record));
     builder.setKind(record->isStruct()  ? stubs::RecordKind::STRUC
                     : record->isClass() ? stubs::RecordKind::CLASS
                                         : stubs::RecordKind::UNIO);
@@ -112,7 +142,7 @@ struct DeclSerializerImpl
           builder[i].initDesc();
 
       m_ASTSerializer->serialize(locBuilder, base.getBaseTypeLoc());
-      descBuilder.setName(baseDecl->getQualifiedNameAsString());
+      descBuilder.setName(m_ASTSerializer->getQualifiedName(baseDecl));
       descBuilder.setVirtual(base.isVirtual());
 
       ++i;
@@ -188,7 +218,7 @@ struct DeclSerializerImpl
     stubs::Decl::Var::Builder varBuilder = m_builder.initVar();
     TypeNodeBuilder typeBuilder = varBuilder.initType();
 
-    varBuilder.setName(decl->getQualifiedNameAsString());
+    varBuilder.setName(m_ASTSerializer->getQualifiedName(decl));
     m_ASTSerializer->serialize(typeBuilder,
                                decl->getTypeSourceInfo()->getTypeLoc());
 
@@ -227,87 +257,97 @@ struct DeclSerializerImpl
     return true;
   }
 
-  void serializeContext(const clang::DeclContext *context,
-                        clang::SourceRange range,
-                        DeclListSerializer &serializer) {
+  /**
+   * @brief Serialize the declarations of a context, and the annotations
+   * between them within a range, in source order. The annotations are looked
+   * up first, so the declarations are serialized in place.
+   *
+   * @param initDecls Initializes the target list with the given number of
+   * elements.
+   */
+  void serializeContext(
+      const clang::DeclContext *context, clang::SourceRange range,
+      llvm::function_ref<ListBuilder<stubs::Node<stubs::Decl>>(unsigned)>
+          initDecls) {
+    AnnotationCursor annotationCursor(m_ASTSerializer->getAnnotationManager());
+    auto getAnnotations = [&](clang::SourceLocation begin,
+                              clang::SourceLocation end) {
+      return annotationCursor.getInRange(begin, end).drop_while(
+          Annotation::Predicate<Annotation::Ann_ContractClause>());
+    };
+
+    llvm::SmallVector<std::pair<AnnotationsRef, const clang::Decl *>, 16>
+        nodes;
+    unsigned nbNodes = 0;
     clang::SourceLocation beginLoc = range.getBegin();
     for (const clang::Decl *decl : context->decls()) {
-      if (decl->isImplicit() && m_ASTSerializer->skipImplicitDecls()) {
+      if (m_ASTSerializer->isSkipped(decl)) {
         continue;
       }
 
       AnnotationsRef annotations =
-          m_ASTSerializer->getAnnotationManager()
-              .getInRange(beginLoc, decl->getBeginLoc())
-              .drop_while(
-                  Annotation::Predicate<Annotation::Ann_ContractClause>());
-      serializer << annotations << decl;
+          getAnnotations(beginLoc, decl->getBeginLoc());
+      nodes.emplace_back(annotations, decl);
+      nbNodes += annotations.size() + 1;
       beginLoc = decl->getEndLoc();
     }
 
-    AnnotationsRef annotations =
-        m_ASTSerializer->getAnnotationManager()
-            .getInRange(beginLoc, range.getEnd())
-            .drop_while(
-                Annotation::Predicate<Annotation::Ann_ContractClause>());
-    serializer << annotations;
+    AnnotationsRef annotations = getAnnotations(beginLoc, range.getEnd());
+    nbNodes += annotations.size();
+
+    DeclListWriter declWriter(initDecls(nbNodes),
+                              DeclSerializer(*m_ASTSerializer));
+    for (auto [declAnnotations, decl] : nodes) {
+      declWriter << declAnnotations << decl;
+    }
+    declWriter << annotations;
+    assert(declWriter.isComplete() && "Not every declaration is serialized");
   }
 
   bool VisitCXXRecordDecl(const clang::CXXRecordDecl *decl) {
     stubs::Decl::Record::Builder recordBuilder = m_builder.initRecord();
 
-    recordBuilder.setName(decl->getQualifiedNameAsString());
+    recordBuilder.setName(m_ASTSerializer->getQualifiedName(decl));
 
     stubs::RecordKind kind = decl->isUnion()   ? stubs::RecordKind::UNIO
                              : decl->isClass() ? stubs::RecordKind::CLASS
                                                : stubs::RecordKind::STRUC;
     recordBuilder.setKind(kind);
     if (decl->isThisDeclarationADefinition()) {
-      capnp::Orphanage orphanage =
-          capnp::Orphanage::getForMessageContaining(m_builder);
-
-      DeclListSerializer declListSerializer(orphanage,
-                                            DeclSerializer(*m_ASTSerializer));
-      serializeContext(decl, decl->getBraceRange(), declListSerializer);
-
       stubs::Decl::Record::Body::Builder bodyBuilder = recordBuilder.initBody();
+      serializeContext(decl, decl->getBraceRange(), [&](unsigned size) {
+        return bodyBuilder.initDecls(size);
+      });
+
       bodyBuilder.setPolymorphic(decl->isPolymorphic());
       ListBuilder<stubs::Node<stubs::Decl::Record::BaseSpec>> basesBuilder =
           bodyBuilder.initBases(decl->getNumBases());
       serializeBases(basesBuilder, decl->bases());
 
-      clang::CXXFinalOverriderMap finalOverrides;
-      decl->getFinalOverriders(finalOverrides);
       bodyBuilder.setIsAbstract(decl->isAbstract());
 
-      finalOverrides.remove_if(
-          [decl](
-              std::pair<const clang::CXXMethodDecl *, clang::OverridingMethods>
-                  p) {
-            clang::OverridingMethods overridingMeths = p.second;
-            for (auto it = overridingMeths.begin(); it < overridingMeths.end();
-                 ++it) {
-              llvm::ArrayRef<clang::UniqueVirtualMethod> overrides = it->second;
-              for (const clang::UniqueVirtualMethod &override : overrides) {
-                if (override.Method->getParent() != decl)
-                  return false;
-              }
-            }
-            return true;
-          });
-
-      capnp::List<capnp::Text, capnp::Kind::BLOB>::Builder
-          nonOverriddenMethsBuilder =
-              bodyBuilder.initNonOverriddenMethods(finalOverrides.size());
-      size_t i(0);
-      for (auto finalOverride : finalOverrides) {
-        nonOverriddenMethsBuilder.set(
-            i++, m_ASTSerializer->getQualifiedFuncName(finalOverride.first));
+      llvm::SmallVector<const clang::CXXMethodDecl *, 16> nonOverriddenMeths;
+      m_ASTSerializer->getNonOverriddenMethods(decl, nonOverriddenMeths);
+
+      if (m_ASTSerializer->usesNameTable()) {
+        capnp::List<uint32_t>::Builder nonOverriddenMethsBuilder =
+            bodyBuilder.initNonOverriddenMethodRefs(nonOverriddenMeths.size());
+        size_t i(0);
+        for (const clang::CXXMethodDecl *method : nonOverriddenMeths) {
+          nonOverriddenMethsBuilder.set(
+              i++, m_ASTSerializer->getNameRef(
+                       m_ASTSerializer->getQualifiedFuncName(method)));
+        }
+      } else {
+        capnp::List<capnp::Text, capnp::Kind::BLOB>::Builder
+            nonOverriddenMethsBuilder =
+                bodyBuilder.initNonOverriddenMethods(nonOverriddenMeths.size());
+        size_t i(0);
+        for (const clang::CXXMethodDecl *method : nonOverriddenMeths) {
+          nonOverriddenMethsBuilder.set(
+              i++, m_ASTSerializer->getQualifiedFuncName(method));
+        }
       }
-
-      ListBuilder<stubs::Node<stubs::Decl>> declsBuilder =
-          bodyBuilder.initDecls(declListSerializer.size());
-      declListSerializer.adoptToListBuilder(declsBuilder);
     }
     return true;
   }
@@ -378,7 +418,7 @@ struct DeclSerializerImpl
 
   bool VisitTypedefNameDecl(const clang::TypedefNameDecl *decl) {
     stubs::Decl::Typedef::Builder typedefBuilder = m_builder.initTypedef();
-    typedefBuilder.setName(decl->getQualifiedNameAsString());
+    typedefBuilder.setName(m_ASTSerializer->getQualifiedName(decl));
 
     TypeNodeBuilder typeBuilder = typedefBuilder.initType();
     clang::TypeLoc typeLoc = decl->getTypeSourceInfo()->getTypeLoc();
@@ -393,7 +433,7 @@ struct DeclSerializerImpl
     }
 
     if (std::optional<FixedWidthInt> fwi =
-            getFixedWidthFromString(decl->getName())) {
+            m_ASTSerializer->getBuiltinTypes().getFixedWidth(decl)) {
       LocBuilder locBuilder = typeBuilder.initLoc();
       stubs::Type::Builder descBuilder = typeBuilder.initDesc();
 
@@ -413,7 +453,7 @@ struct DeclSerializerImpl
 
   bool VisitEnumDecl(const clang::EnumDecl *decl) {
     stubs::Decl::Enum::Builder enumDeclBuilder = m_builder.initEnumDecl();
-    enumDeclBuilder.setName(decl->getQualifiedNameAsString());
+    enumDeclBuilder.setName(m_ASTSerializer->getQualifiedName(decl));
 
     auto nbFields =
         std::distance(decl->enumerator_begin(), decl->enumerator_end());
@@ -429,6 +469,8 @@ struct DeclSerializerImpl
         ExprNodeBuilder fieldExpr = enumFieldBuilder.initExpr();
         m_ASTSerializer->serialize(fieldExpr, init);
       }
+      serializeConstValue(field->getInitVal(),
+                          [&] { return enumFieldBuilder.initValue(); });
     }
 
     return true;
@@ -439,10 +481,6 @@ struct DeclSerializerImpl
         m_builder.initNamespace();
     namespaceBuilder.setName(decl->getNameAsString());
 
-    DeclListSerializer declListSerializer(
-        capnp::Orphanage::getForMessageContaining(m_builder),
-        DeclSerializer(*m_ASTSerializer));
-
     clang::SourceLocation namespaceNameLoc = decl->getLocation();
     std::optional<clang::Token> lBrace = clang::Lexer::findNextToken(
         namespaceNameLoc, m_ASTSerializer->getASTContext().getSourceManager(),
@@ -450,10 +488,9 @@ struct DeclSerializerImpl
     assert(lBrace && "No next token");
 
     serializeContext(decl, {lBrace->getLocation(), decl->getRBraceLoc()},
-                     declListSerializer);
-    ListBuilder<stubs::Node<stubs::Decl>> declsBuilder =
-        namespaceBuilder.initDecls(declListSerializer.size());
-    declListSerializer.adoptToListBuilder(declsBuilder);
+                     [&](unsigned size) {
+                       return namespaceBuilder.initDecls(size);
+                     });
 
     return true;
   }
@@ -478,6 +515,7 @@ struct DeclSerializerImpl
     size_t i(0);
     ListBuilder<stubs::Node<stubs::Decl::Function>> specsBuilder =
         functionTemplateBuilder.initSpecs(nbSpecs);
+    llvm::StringMap<uint32_t> specBodies;
     for (const clang::FunctionDecl *spec : decl->specializations()) {
       const clang::FunctionTemplateSpecializationInfo *info =
           spec->getTemplateSpecializationInfo();
@@ -494,11 +532,46 @@ struct DeclSerializerImpl
       stubs::Decl::Function::Builder descBuilder = specBuilder.initDesc();
       m_ASTSerializer->serialize(locBuilder, spec->getSourceRange());
       serializeFunctionDecl(descBuilder, spec, false);
+      if (m_ASTSerializer->dedupTemplateBodies() && descBuilder.hasBody()) {
+        shareSpecBody(descBuilder, i - 1, specBodies);
+      }
+    }
+
+    if (TemplateStats::isEnabled()) {
+      TemplateStats::countSpecializations(
+          decl, nbSpecs, specsBuilder.asReader().totalSize().wordCount);
     }
 
     return true;
   }
 
+  /**
+   * @brief Replace the body of a specialization by a reference to an earlier
+   * specialization of the same template with an identical serialized body, if
+   * there is one.
+   *
+   * @param specBuilder Builder of the specialization, with its body.
+   * @param specIndex Index of the specialization in its template.
+   * @param specBodies Index of the first specialization with each body, by the
+   * canonical encoding of that body.
+   */
+  void shareSpecBody(stubs::Decl::Function::Builder specBuilder,
+                     uint32_t specIndex,
+                     llvm::StringMap<uint32_t> &specBodies) {
+    kj::Array<capnp::word> body =
+        capnp::canonicalize(specBuilder.getBody().asReader());
+    kj::ArrayPtr<const kj::byte> bytes = body.asBytes();
+    auto [it, inserted] = specBodies.try_emplace(
+        llvm::StringRef(reinterpret_cast<const char *>(bytes.begin()),
+                        bytes.size()),
+        specIndex);
+    if (!inserted) {
+      // Dropping the orphan zeroes the body, which packs to almost nothing.
+      specBuilder.disownBody();
+      specBuilder.setBodySpec(it->second + 1);
+    }
+  }
+
   bool serialize(const clang::Decl *decl) {
     if (Visit(decl)) {
       return true;
@@ -527,10 +600,13 @@ void DeclSerializer::serialize(const clang::Decl *decl, LocBuilder locBuilder,
                                stubs::Decl::Builder declBuilder) const {
   assert(decl && "Decl should not be null");
 
+  Census::Node census(Census::Decls, decl->getDeclKindName());
+  VF_TRACE_SCOPE("SerializeDecl", decl->getDeclKindName());
   clang::SourceRange range = getRange(decl);
   DeclSerializerImpl serializer(*m_ASTSerializer, declBuilder);
   serializer.serialize(decl);
   m_ASTSerializer->serialize(locBuilder, range);
+  census.record(declBuilder, locBuilder);
 }
 
 void DeclSerializer::serialize(const Annotation &annotation,
@@ -538,7 +614,15 @@ void DeclSerializer::serialize(const Annotation &annotation,
                                stubs::Decl::Builder declBuilder) const {
   clang::SourceRange range = annotation.getRange();
   m_ASTSerializer->serialize(locBuilder, range);
-  declBuilder.setAnn(annotation.getText().data());
+  m_ASTSerializer->serializeText(
+      annotation.getText(), range.getBegin(),
+      [&](unsigned size) { return declBuilder.initAnn(size); },
+      [&]() { return declBuilder.initAnnSlice(); });
+  m_ASTSerializer->serializeTokens(annotation.getText(), [&](unsigned size) {
+    return declBuilder.initAnnTokens(size);
+  });
+  declBuilder.setAnnKeyword(
+      static_cast<stubs::AnnotationKeyword>(annotation.getKeyword()));
 }
 
 } // namespace vf
\ No newline at end of file
@@ -10,8 +10,9 @@ namespace vf {
  * @brief Specialized serializer for declarations.
  * 
  */
-class DeclSerializer : public NodeSerializer<stubs::Decl, const clang::Decl *>,
-                       public NodeSerializer<stubs::Decl, const Annotation &> {
+class DeclSerializer final
+    : public NodeSerializer<stubs::Decl, const clang::Decl *>,
+      public NodeSerializer<stubs::Decl, const Annotation &> {
 public:
   void serialize(const clang::Decl *decl, LocBuilder locBuilder,
                  stubs::Decl::Builder declBuilder) const override;
@@ -0,0 +1,152 @@
+#include "DepFile.h"
+#include "clang/Basic/FileEntry.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace vf {
+
+namespace {
+
+/**
+ * @brief Write a path escaped as Make and Ninja expect it: spaces and `#` are
+ * escaped with a backslash and `$` is doubled.
+ */
+void writePath(llvm::raw_ostream &out, llvm::StringRef path) {
+  for (char c : path) {
+    if (c == ' ' || c == '#') {
+      out << '\\';
+    } else if (c == '$') {
+      out << '$';
+    }
+    out << c;
+  }
+}
+
+/**
+ * @brief Get the file named by a quoted ghost include annotation, e.g.
+ * `//@ #include "list.gh"`, relative to the file that contains it.
+ *
+ * @return The path of the file, or empty if the annotation uses angle brackets
+ * or the file does not exist.
+ */
+std::string resolveGhostInclude(const Annotation &annotation,
+                                llvm::StringRef includerPath) {
+  llvm::StringRef text(annotation.getText().data(),
+                       annotation.getText().size());
+  size_t directive = text.find("#include");
+  if (directive == llvm::StringRef::npos) {
+    return {};
+  }
+  llvm::StringRef rest = text.drop_front(directive);
+  rest.consume_front("#include");
+  rest = rest.ltrim();
+  if (!rest.consume_front("\"")) {
+    return {};
+  }
+  llvm::StringRef name = rest.take_until([](char c) { return c == '"'; });
+  if (name.size() == rest.size()) {
+    return {};
+  }
+
+  llvm::SmallString<256> path(llvm::sys::path::parent_path(includerPath));
+  llvm::sys::path::append(path, name);
+  if (!llvm::sys::fs::exists(path)) {
+    return {};
+  }
+  return std::string(path);
+}
+
+} // namespace
+
+void DepFile::addTranslationUnit(llvm::StringRef sourcePath,
+                                 const clang::SourceManager &sourceManager,
+                                 const InclusionContext &inclusionContext,
+                                 const AnnotationManager &annotationManager) {
+  const clang::FileEntry *mainEntry =
+      sourceManager.getFileEntryForID(sourceManager.getMainFileID());
+  if (!mainEntry) {
+    return;
+  }
+
+  Rule rule{m_target.empty() ? sourcePath.str() : m_target, {}};
+  rule.dependencies.push_back(sourcePath.str());
+
+  // Breadth-first over the include directives, as the inclusion table is
+  // built, so the files are listed in the order in which they are included.
+  llvm::SmallVector<const Inclusion *> work{
+      &inclusionContext.getInclusionOfFileUID(mainEntry->getUID())};
+  llvm::DenseSet<unsigned> visited{mainEntry->getUID()};
+  llvm::StringSet<> listed;
+  for (size_t i = 0; i < work.size(); ++i) {
+    const Inclusion &inclusion = *work[i];
+    llvm::StringRef includerPath = inclusion.getFileEntry()->getName();
+    if (i > 0 && listed.insert(includerPath).second) {
+      rule.dependencies.push_back(includerPath.str());
+    }
+    for (const Annotation &annotation :
+         annotationManager.getLeadingIncludes(inclusion.getFileEntry())) {
+      std::string ghostPath = resolveGhostInclude(annotation, includerPath);
+      if (!ghostPath.empty() && listed.insert(ghostPath).second) {
+        rule.dependencies.push_back(std::move(ghostPath));
+      }
+    }
+    for (const IncludeDirective &directive :
+         inclusion.getIncludeDirectives()) {
+      if (visited.insert(directive.fileUID).second) {
+        work.push_back(
+            &inclusionContext.getInclusionOfFileUID(directive.fileUID));
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_rules.push_back(std::move(rule));
+}
+
+bool DepFile::save() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::error_code error;
+  llvm::raw_fd_ostream out(m_path, error);
+  if (error) {
+    return false;
+  }
+
+  // Parallel exports add their rules in any order.
+  llvm::stable_sort(m_rules, [](const Rule &a, const Rule &b) {
+    return a.dependencies.front() < b.dependencies.front();
+  });
+
+  llvm::StringSet<> headers;
+  for (const Rule &rule : m_rules) {
+    writePath(out, rule.target);
+    out << ':';
+    for (const std::string &dependency : rule.dependencies) {
+      out << " \\\n  ";
+      writePath(out, dependency);
+    }
+    out << '\n';
+    for (size_t i = 1; i < rule.dependencies.size(); ++i) {
+      headers.insert(rule.dependencies[i]);
+    }
+  }
+
+  // The iteration order of a StringSet is not deterministic.
+  std::vector<llvm::StringRef> sortedHeaders;
+  for (const auto &header : headers) {
+    sortedHeaders.push_back(header.getKey());
+  }
+  llvm::sort(sortedHeaders);
+  for (llvm::StringRef header : sortedHeaders) {
+    out << '\n';
+    writePath(out, header);
+    out << ":\n";
+  }
+  return !out.has_error();
+}
+
+} // namespace vf
@@ -0,0 +1,64 @@
+#pragma once
+#include "AnnotationManager.h"
+#include "InclusionContext.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vf {
+
+/**
+ * @brief Dependency file in Makefile syntax, like the one `-MD` makes a
+ * compiler write, that lists the files every exported translation unit read.
+ *
+ * A translation unit depends on its main file, the files it transitively
+ * includes, and the ghost headers named by quoted `//@ #include` annotations
+ * of those files that exist next to the file that includes them. Ghost headers
+ * named with angle brackets are looked up by VeriFast in its own library
+ * directory and are not listed. Every header additionally gets an empty rule,
+ * so that deleting it does not break the build. The rules can be added by
+ * several threads.
+ */
+class DepFile {
+public:
+  /**
+   * @param path File to write the rules to.
+   * @param target Target of the rules, or empty to use the path of each
+   * translation unit's source file.
+   */
+  DepFile(std::string path, std::string target)
+      : m_path(std::move(path)), m_target(std::move(target)) {}
+
+  /**
+   * @brief Add the rule of a translation unit that has been parsed.
+   *
+   * @param sourcePath Source file of the translation unit.
+   */
+  void addTranslationUnit(llvm::StringRef sourcePath,
+                          const clang::SourceManager &sourceManager,
+                          const InclusionContext &inclusionContext,
+                          const AnnotationManager &annotationManager);
+
+  /**
+   * @brief Write the rules added so far to the file.
+   *
+   * @return False if the file cannot be written.
+   */
+  bool save();
+
+private:
+  struct Rule {
+    std::string target;
+    std::vector<std::string> dependencies; ///< Starting with the source file.
+  };
+
+  std::string m_path;
+  std::string m_target;
+  std::mutex m_mutex;
+  std::vector<Rule> m_rules;
+};
+
+} // namespace vf
@@ -1,18 +1,148 @@
 #include "DiagnosticSerializer.h"
 #include "LocationSerializer.h"
+#include "capnp/serialize.h"
 #include "clang/Basic/LangOptions.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/raw_ostream.h"
 
 namespace vf {
 
 void DiagnosticSerializer::HandleDiagnostic(
     clang::DiagnosticsEngine::Level level, const clang::Diagnostic &info) {
   clang::DiagnosticConsumer::HandleDiagnostic(level, info);
-  if (level >= m_minLevel && info.hasSourceManager()) {
-    llvm::SmallString<64> reason;
-    info.FormatDiagnostic(reason);
-    m_diags.emplace_back(info.getLocation(), reason.str(),
-                         info.getSourceManager(), m_langOpts);
+  if (level < m_minLevel || !info.hasSourceManager()) {
+    return;
+  }
+
+  llvm::SmallString<64> key;
+  llvm::raw_svector_ostream(key) << info.getID();
+  if (info.getNumArgs() > 0) {
+    if (info.getArgKind(0) == clang::DiagnosticsEngine::ak_std_string) {
+      key += '\0';
+      key += info.getArgStdStr(0);
+    } else if (info.getArgKind(0) ==
+                   clang::DiagnosticsEngine::ak_identifierinfo &&
+               info.getArgIdentifier(0)) {
+      key += '\0';
+      key += info.getArgIdentifier(0)->getName();
+    }
+  }
+  auto it = m_diagIndices.find(key);
+  if (it != m_diagIndices.end()) {
+    Diag &diag = m_diags[it->getValue()];
+    if (canReport(diag)) {
+      report(diag, 1);
+    }
+    return;
+  }
+  if (m_nbDiagsSinceMark >= m_maxDiags) {
+    return;
+  }
+
+  llvm::SmallString<64> reason;
+  info.FormatDiagnostic(reason);
+  if (Diag *diag =
+          store(key, info.getLocation(), reason, info.getSourceManager())) {
+    report(*diag, 1);
+  }
+}
+
+DiagnosticSerializer::Diag *
+DiagnosticSerializer::store(llvm::StringRef key, clang::SourceLocation loc,
+                            llvm::StringRef reason,
+                            const clang::SourceManager &sourceManager) {
+  auto it = m_diagIndices.find(key);
+  if (it != m_diagIndices.end()) {
+    Diag &diag = m_diags[it->getValue()];
+    return canReport(diag) ? &diag : nullptr;
+  }
+  if (m_nbDiagsSinceMark >= m_maxDiags) {
+    return nullptr;
+  }
+  it = m_diagIndices.try_emplace(key, m_diags.size()).first;
+  Diag &diag = m_diags.emplace_back(loc, reason, sourceManager, m_langOpts);
+  diag.count = 0;
+  diag.key = it->getKey();
+  return &diag;
+}
+
+void DiagnosticSerializer::report(Diag &diag, unsigned count) {
+  if (count > 0 && diag.count == diag.markedCount) {
+    ++m_nbDiagsSinceMark;
+  }
+  diag.count += count;
+}
+
+void DiagnosticSerializer::mark() {
+  for (Diag &diag : m_diags) {
+    diag.markedCount = diag.count;
+  }
+  m_nbDiagsSinceMark = 0;
+}
+
+llvm::SmallVector<unsigned> DiagnosticSerializer::getCounts() const {
+  llvm::SmallVector<unsigned> counts;
+  for (const Diag &diag : m_diags) {
+    counts.push_back(diag.count);
+  }
+  return counts;
+}
+
+// A saved diagnostic is a 32-bit little-endian number of new reports, its raw
+// location and the length of its key, followed by the key and the reason.
+void DiagnosticSerializer::saveReportedSince(
+    llvm::ArrayRef<unsigned> counts, capnp::MessageBuilder &message) const {
+  auto reportedSince = [counts](size_t index, const Diag &diag) {
+    return diag.count - (index < counts.size() ? counts[index] : 0);
+  };
+  unsigned nbSaved = 0;
+  for (size_t i = 0; i < m_diags.size(); ++i) {
+    nbSaved += reportedSince(i, m_diags[i]) > 0;
+  }
+
+  capnp::List<capnp::Data>::Builder builder =
+      message.getRoot<capnp::AnyPointer>().initAs<capnp::List<capnp::Data>>(
+          nbSaved);
+  unsigned saved = 0;
+  for (size_t i = 0; i < m_diags.size(); ++i) {
+    const Diag &diag = m_diags[i];
+    unsigned count = reportedSince(i, diag);
+    if (count == 0) {
+      continue;
+    }
+    std::string record;
+    llvm::raw_string_ostream out(record);
+    llvm::support::endian::Writer writer(out, llvm::support::little);
+    writer.write<uint32_t>(count);
+    writer.write<uint32_t>(diag.loc.getRawEncoding());
+    writer.write<uint32_t>(diag.key.size());
+    out << diag.key << diag.reason;
+    out.flush();
+    builder.set(saved++, kj::arrayPtr(
+                             reinterpret_cast<const kj::byte *>(record.data()),
+                             record.size()));
+  }
+}
+
+void DiagnosticSerializer::restoreReported(
+    kj::ArrayPtr<const capnp::word> words,
+    const clang::SourceManager &sourceManager) {
+  capnp::FlatArrayMessageReader reader(words);
+  for (capnp::Data::Reader record :
+       reader.getRoot<capnp::AnyPointer>().getAs<capnp::List<capnp::Data>>()) {
+    const char *data = reinterpret_cast<const char *>(record.begin());
+    using llvm::support::endian::read32le;
+    unsigned count = read32le(data);
+    clang::SourceLocation loc =
+        clang::SourceLocation::getFromRawEncoding(read32le(data + 4));
+    uint32_t keySize = read32le(data + 8);
+    llvm::StringRef key(data + 12, keySize);
+    llvm::StringRef reason(data + 12 + keySize,
+                           record.size() - 12 - keySize);
+    if (Diag *diag = store(key, loc, reason, sourceManager)) {
+      report(*diag, count);
+    }
   }
 }
 
@@ -30,17 +160,54 @@ void DiagnosticSerializer::serialize(ListBuilder<stubs::Error> builder) const {
   size_t i(0);
   for (const Diag &diag : m_diags) {
     stubs::Error::Builder errorBuilder = builder[i++];
-    diag.serialize(errorBuilder);
+    diag.serialize(errorBuilder,
+                   getLocationSerializer(*diag.sourceManager, diag.langOpts),
+                   diag.count);
   }
 }
 
+void DiagnosticSerializer::serializeSinceMark(
+    ListBuilder<stubs::Error> builder) const {
+  assert(nbDiagsSinceMark() == builder.size() &&
+         "Target builder has wrong size");
+
+  size_t i(0);
+  for (const Diag &diag : m_diags) {
+    if (diag.count == diag.markedCount) {
+      continue;
+    }
+    stubs::Error::Builder errorBuilder = builder[i++];
+    diag.serialize(errorBuilder,
+                   getLocationSerializer(*diag.sourceManager, diag.langOpts),
+                   diag.count - diag.markedCount);
+  }
+}
+
+const LocationSerializer &DiagnosticSerializer::getLocationSerializer(
+    const clang::SourceManager &sourceManager,
+    const clang::LangOptions *langOpts) const {
+  if (!m_locSerializer || m_locSourceManager != &sourceManager ||
+      m_locLangOpts != langOpts) {
+    // Diagnostics reported outside of a source file have no language options.
+    static const clang::LangOptions defaultLangOpts;
+    m_locSerializer.emplace(sourceManager,
+                            langOpts ? *langOpts : defaultLangOpts);
+    m_locSourceManager = &sourceManager;
+    m_locLangOpts = langOpts;
+  }
+  return *m_locSerializer;
+}
+
 void DiagnosticSerializer::Diag::serialize(
-    stubs::Error::Builder builder) const {
-  const clang::LangOptions &langOpts =
-      this->langOpts ? *this->langOpts : clang::LangOptions();
-  LocationSerializer locSerializer(*sourceManager, langOpts);
+    stubs::Error::Builder builder, const LocationSerializer &locSerializer,
+    unsigned nbReports) const {
   locSerializer.serialize(loc, builder.initLoc());
-  builder.setReason(reason);
+  if (nbReports == 1) {
+    builder.setReason(reason);
+  } else {
+    builder.setReason(reason + " (reported " + std::to_string(nbReports) +
+                      " times)");
+  }
 }
 
 } // namespace vf
\ No newline at end of file
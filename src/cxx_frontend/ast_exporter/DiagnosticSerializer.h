@@ -1,9 +1,12 @@
 #pragma once
 
+#include "LocationSerializer.h"
 #include "Serializer.h"
 #include "stubs_ast.capnp.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Basic/SourceLocation.h"
+#include "llvm/ADT/StringMap.h"
+#include <optional>
 #include <string>
 
 namespace vf {
@@ -12,6 +15,14 @@ namespace vf {
  * @brief Serializer and consumer of diagnostics. Saves all diagnostics that
  * were emitted while traversing the AST during serialization.
  *
+ * Diagnostics with the same ID and the same first string or identifier
+ * argument, e.g. the name of a context sensitive macro, are only stored once,
+ * together with the number of times they were reported. At most `maxDiags`
+ * distinct diagnostics are reported since the last `mark`, or in total if
+ * the instance is never marked; consumers only report the first ones.
+ * Diagnostics are only formatted when they are stored, so a flood of
+ * diagnostics beyond that limit only costs a lookup each.
+ *
  */
 class DiagnosticSerializer : public Serializer<ListBuilder<stubs::Error>>,
                              public clang::DiagnosticConsumer {
@@ -37,8 +48,61 @@ public:
    */
   void serialize(ListBuilder<stubs::Error> builder) const override;
 
-  DiagnosticSerializer(clang::DiagnosticsEngine::Level minLevel)
-      : m_minLevel(minLevel) {}
+  /**
+   * @brief Number of distinct diagnostics that were reported since the last
+   * `mark`, including diagnostics that were already reported before it.
+   */
+  size_t nbDiagsSinceMark() const { return m_nbDiagsSinceMark; }
+
+  /**
+   * @brief Serialize the diagnostics that were reported since the last
+   * `mark`, with the number of times they were reported since then.
+   *
+   * @param builder Target builder with `nbDiagsSinceMark()` elements.
+   */
+  void serializeSinceMark(ListBuilder<stubs::Error> builder) const;
+
+  /**
+   * @brief Start counting the diagnostics that are reported from now on
+   * separately, e.g. for the next response of the on-demand protocol, which
+   * has to report a diagnostic again even if an earlier response reported it.
+   */
+  void mark();
+
+  /**
+   * @brief Number of times each stored diagnostic was reported so far.
+   */
+  llvm::SmallVector<unsigned> getCounts() const;
+
+  /**
+   * @brief Save the diagnostics that were reported since the stored ones had
+   * the given counts, so that `restoreReported` can store them in the
+   * instance of the process this one was forked from.
+   *
+   * @param counts Result of `getCounts` before the process was forked.
+   * @param message Target message.
+   */
+  void saveReportedSince(llvm::ArrayRef<unsigned> counts,
+                         capnp::MessageBuilder &message) const;
+
+  /**
+   * @brief Store the diagnostics saved by `saveReportedSince` in a forked
+   * process as if they were reported here, in the same order.
+   *
+   * @param words Flat array of the message they were saved to.
+   * @param sourceManager Source manager of their locations, which the forked
+   * process inherited.
+   */
+  void restoreReported(kj::ArrayPtr<const capnp::word> words,
+                       const clang::SourceManager &sourceManager);
+
+  /**
+   * @param minLevel Level from which diagnostics are stored.
+   * @param maxDiags Maximum number of distinct diagnostics that are stored.
+   */
+  DiagnosticSerializer(clang::DiagnosticsEngine::Level minLevel,
+                       size_t maxDiags)
+      : m_minLevel(minLevel), m_maxDiags(maxDiags) {}
 
 private:
   /**
@@ -50,8 +114,16 @@ private:
     std::string reason;
     const clang::SourceManager *sourceManager;
     const clang::LangOptions *langOpts;
+    unsigned count = 1; ///< Number of times the diagnostic was reported.
+    unsigned markedCount = 0; ///< `count` at the last `mark`.
+    llvm::StringRef key; ///< Key of the diagnostic in `m_diagIndices`.
 
-    void serialize(stubs::Error::Builder builder) const;
+    /**
+     * @param nbReports Number of reports to mention in the reason.
+     */
+    void serialize(stubs::Error::Builder builder,
+                   const LocationSerializer &locSerializer,
+                   unsigned nbReports) const;
 
     Diag(clang::SourceLocation loc, std::string_view reason,
          const clang::SourceManager &sourceManager,
@@ -60,9 +132,50 @@ private:
           langOpts(langOpts) {}
   };
 
+  /**
+   * @brief Store a diagnostic unless one with the same key is stored already.
+   *
+   * @return The stored diagnostic with the key, or null if it cannot be
+   * reported because the maximum is reached.
+   */
+  Diag *store(llvm::StringRef key, clang::SourceLocation loc,
+              llvm::StringRef reason,
+              const clang::SourceManager &sourceManager);
+
+  /**
+   * @brief Whether a stored diagnostic can be reported again without
+   * exceeding the maximum since the last mark.
+   */
+  bool canReport(const Diag &diag) const {
+    return diag.count > diag.markedCount || m_nbDiagsSinceMark < m_maxDiags;
+  }
+
+  /**
+   * @brief Count @p count new reports of a stored diagnostic, which must be
+   * reportable.
+   */
+  void report(Diag &diag, unsigned count);
+
+  /**
+   * @brief Get the location serializer for diagnostics of the given source
+   * manager and language options. It is created once and reused by the
+   * diagnostics that follow, so their locations share its caches.
+   */
+  const LocationSerializer &
+  getLocationSerializer(const clang::SourceManager &sourceManager,
+                        const clang::LangOptions *langOpts) const;
+
   clang::DiagnosticsEngine::Level m_minLevel;
+  size_t m_maxDiags;
   const clang::LangOptions *m_langOpts;
   llvm::SmallVector<Diag> m_diags;
+  size_t m_nbDiagsSinceMark = 0;
+  ///< Index in `m_diags` of the diagnostics by ID and first string argument.
+  llvm::StringMap<size_t> m_diagIndices;
+  mutable std::optional<LocationSerializer> m_locSerializer;
+  ///< Source manager and language options of `m_locSerializer`.
+  mutable const clang::SourceManager *m_locSourceManager = nullptr;
+  mutable const clang::LangOptions *m_locLangOpts = nullptr;
 };
 
 } // namespace vf
\ No newline at end of file
@@ -0,0 +1,28 @@
+# Writes OUTPUT, the table of the headers in HEADERS_DIR and its
+# subdirectories that EmbeddedHeaders.cpp includes:
+# cmake -DHEADERS_DIR=<dir> -DOUTPUT=<file> -P EmbedHeaders.cmake
+
+file(GLOB_RECURSE headers RELATIVE "${HEADERS_DIR}" "${HEADERS_DIR}/*.h")
+list(SORT headers)
+
+set(arrays "")
+set(entries "")
+set(index 0)
+foreach(header IN LISTS headers)
+  file(READ "${HEADERS_DIR}/${header}" hex HEX)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+  string(APPEND arrays "const unsigned char embeddedHeader${index}[] = {${bytes}0x00};\n")
+  string(APPEND entries "    {\"${header}\", embeddedHeader${index}, sizeof(embeddedHeader${index}) - 1},\n")
+  math(EXPR index "${index} + 1")
+endforeach()
+
+file(WRITE "${OUTPUT}.tmp"
+  "// Generated by EmbedHeaders.cmake from the headers in ${HEADERS_DIR}.\n\n"
+  "${arrays}\n"
+  "const EmbeddedHeader embeddedHeaders[] = {\n"
+  "${entries}"
+  "};\n")
+# Only touches the output if a header changed, so the exporter is not compiled
+# again when a header is merely saved.
+configure_file("${OUTPUT}.tmp" "${OUTPUT}" COPYONLY)
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,112 @@
+#include "EmbeddedHeaders.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include <string>
+
+namespace vf {
+
+namespace {
+
+struct EmbeddedHeader {
+  ///< Path relative to the directory the headers are shipped in.
+  const char *path;
+  ///< Contents, followed by a null character that is not part of them.
+  const unsigned char *contents;
+  size_t size;
+};
+
+// Defines `embeddedHeaders`, an array of `EmbeddedHeader`. The file is
+// generated by EmbedHeaders.cmake, and again whenever one of the headers
+// changes.
+#include "EmbeddedHeaders.inc"
+
+/**
+ * @brief File system that answers lookups of the paths in a directory from
+ * the embedded headers, and every other lookup from the file system below it.
+ */
+class EmbeddedHeaderFileSystem : public llvm::vfs::ProxyFileSystem {
+public:
+  EmbeddedHeaderFileSystem(
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem,
+      llvm::StringRef dir)
+      : ProxyFileSystem(std::move(fileSystem)),
+        m_headers(llvm::makeIntrusiveRefCnt<llvm::vfs::InMemoryFileSystem>()) {
+    normalize(dir, m_dir);
+    for (const EmbeddedHeader &header : embeddedHeaders) {
+      llvm::SmallString<256> path(m_dir);
+      llvm::sys::path::append(path, header.path);
+      llvm::sys::path::native(path);
+      llvm::StringRef contents(reinterpret_cast<const char *>(header.contents),
+                               header.size);
+      m_headers->addFile(path, 0,
+                         llvm::MemoryBuffer::getMemBuffer(contents, path));
+    }
+  }
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &path) override {
+    llvm::SmallString<256> normalized;
+    if (embedded(path, normalized)) {
+      return m_headers->status(normalized);
+    }
+    return ProxyFileSystem::status(path);
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+  openFileForRead(const llvm::Twine &path) override {
+    llvm::SmallString<256> normalized;
+    if (embedded(path, normalized)) {
+      return m_headers->openFileForRead(normalized);
+    }
+    return ProxyFileSystem::openFileForRead(path);
+  }
+
+  llvm::vfs::directory_iterator dir_begin(const llvm::Twine &dir,
+                                          std::error_code &error) override {
+    llvm::SmallString<256> normalized;
+    if (embedded(dir, normalized)) {
+      return m_headers->dir_begin(normalized, error);
+    }
+    return ProxyFileSystem::dir_begin(dir, error);
+  }
+
+private:
+  /**
+   * @brief Make a path absolute against the working directory of the file
+   * system below, and remove its `.` and `..` components.
+   */
+  void normalize(const llvm::Twine &path, llvm::SmallVectorImpl<char> &output) {
+    path.toVector(output);
+    getUnderlyingFS().makeAbsolute(output);
+    llvm::sys::path::remove_dots(output, /*remove_dot_dot=*/true);
+  }
+
+  /**
+   * @brief Check whether a path lies below the directory of the embedded
+   * headers.
+   *
+   * @param normalized Set to the normalized path.
+   */
+  bool embedded(const llvm::Twine &path,
+                llvm::SmallVectorImpl<char> &normalized) {
+    normalize(path, normalized);
+    llvm::StringRef pathRef(normalized.data(), normalized.size());
+    return pathRef.size() > m_dir.size() && pathRef.starts_with(m_dir) &&
+           llvm::sys::path::is_separator(pathRef[m_dir.size()]);
+  }
+
+  ///< Normalized path of the directory the headers are shipped in.
+  llvm::SmallString<256> m_dir;
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> m_headers;
+};
+
+} // namespace
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+withEmbeddedHeaders(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base,
+                    llvm::StringRef dir) {
+  return llvm::makeIntrusiveRefCnt<EmbeddedHeaderFileSystem>(std::move(base),
+                                                             dir);
+}
+
+} // namespace vf
@@ -0,0 +1,25 @@
+#pragma once
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+namespace vf {
+
+/**
+ * @brief Put the headers that VeriFast ships in its `bin` directory, e.g.
+ * `prelude_cxx.h`, on top of a file system, with the contents they had when
+ * the exporter was built.
+ *
+ * Every path in the given directory or one of its subdirectories is looked up
+ * among the embedded headers only, so header search neither probes the
+ * directory for the headers it does not hold nor reads the ones it does. The
+ * directory itself is still looked up in the given file system.
+ *
+ * @param dir Directory the headers are shipped in, relative to the working
+ * directory of the given file system if it is not absolute.
+ */
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+withEmbeddedHeaders(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base,
+                    llvm::StringRef dir);
+
+} // namespace vf
@@ -0,0 +1,93 @@
+#include "vf_export.h"
+#include "Census.h"
+#include "Exporter.h"
+#include "Timings.h"
+#include "capnp/serialize.h"
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace vf {
+
+namespace {
+
+/**
+ * @brief Message writer that concatenates the flat arrays of all messages.
+ */
+class ConcatenatingMessageWriter : public MessageWriter {
+public:
+  void write(capnp::MessageBuilder &message) override {
+    Census::countMessage(message);
+    Timings::Scope timing(Timings::Output);
+    kj::Array<capnp::word> words = capnp::messageToFlatArray(message);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_words.insert(m_words.end(), words.begin(), words.end());
+  }
+
+  void write(kj::ArrayPtr<const capnp::word> words) override {
+    Timings::Scope timing(Timings::Output);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_words.insert(m_words.end(), words.begin(), words.end());
+  }
+
+  const std::vector<capnp::word> &words() const { return m_words; }
+
+private:
+  std::vector<capnp::word> m_words;
+  std::mutex m_mutex;
+};
+
+std::mutex exportMutex;
+
+} // namespace
+
+} // namespace vf
+
+extern "C" int vf_export(const char *path, const char **args, void **out_buf,
+                         size_t *out_len) {
+  *out_buf = nullptr;
+  *out_len = 0;
+
+  // The source file goes before the compiler arguments.
+  std::vector<const char *> argv{"vf-cxx-ast-exporter"};
+  bool pathAdded = false;
+  for (const char **arg = args; arg && *arg; ++arg) {
+    if (!pathAdded && std::strcmp(*arg, "--") == 0) {
+      argv.push_back(path);
+      pathAdded = true;
+    }
+    argv.push_back(*arg);
+  }
+  if (!pathAdded) {
+    argv.push_back(path);
+  }
+
+  vf::ConcatenatingMessageWriter writer;
+  int status;
+  {
+    std::lock_guard<std::mutex> lock(vf::exportMutex);
+    status = vf::runExporter(argv.size(), argv.data(), &writer);
+  }
+
+  const std::vector<capnp::word> &words = writer.words();
+  if (words.empty()) {
+    return status;
+  }
+  size_t size = words.size() * sizeof(capnp::word);
+  void *buf = std::malloc(size);
+  if (!buf) {
+    return 1;
+  }
+  std::memcpy(buf, words.data(), size);
+  *out_buf = buf;
+  *out_len = size;
+  return status;
+}
+
+extern "C" void vf_export_free(void *buf) { std::free(buf); }
+
+extern "C" int vf_export_main(int argc, const char **argv) {
+  std::lock_guard<std::mutex> lock(vf::exportMutex);
+  return vf::runExporter(argc, argv, nullptr);
+}
@@ -0,0 +1,445 @@
+#include "ExportCache.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <chrono>
+#include <cstring>
+
+namespace vf {
+
+using namespace llvm::support::endian;
+
+namespace {
+
+constexpr llvm::StringLiteral magic("VFEXC002");
+
+uint64_t hashContent(llvm::StringRef content) {
+  return llvm::xxh3_64bits(llvm::arrayRefFromStringRef(content));
+}
+
+/**
+ * @brief Modification time of a file in nanoseconds, so that a file that is
+ * changed within the same second as the previous export is hashed again.
+ */
+uint64_t modificationTime(const llvm::sys::fs::file_status &status) {
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      status.getLastModificationTime().time_since_epoch())
+                      .count());
+}
+
+/**
+ * @brief Identity of the running exporter on this machine: the path, size and
+ * modification time of its executable. Entries written by another build of
+ * the exporter, e.g. one with another schema or serializer, are not reused.
+ */
+std::string localExporterIdentity() {
+  std::string executable = llvm::sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void *>(&localExporterIdentity));
+  llvm::sys::fs::file_status status;
+  if (executable.empty() || llvm::sys::fs::status(executable, status)) {
+    return {};
+  }
+  return executable + '\0' + std::to_string(status.getSize()) + '\0' +
+         std::to_string(modificationTime(status));
+}
+
+std::optional<uint64_t> hashFile(llvm::StringRef path) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return {};
+  }
+  return hashContent((*buffer)->getBuffer());
+}
+
+/**
+ * @brief Sequential reader of the little endian fields of a cache entry.
+ */
+class EntryReader {
+public:
+  explicit EntryReader(llvm::StringRef data) : m_data(data) {}
+
+  bool read(uint64_t &value) {
+    if (m_data.size() < 8) {
+      return false;
+    }
+    value = read64le(m_data.data());
+    m_data = m_data.drop_front(8);
+    return true;
+  }
+
+  bool read(llvm::StringRef &value, uint64_t size) {
+    if (m_data.size() < size) {
+      return false;
+    }
+    value = m_data.take_front(size);
+    m_data = m_data.drop_front(size);
+    return true;
+  }
+
+private:
+  llvm::StringRef m_data;
+};
+
+void append(std::string &data, uint64_t value) {
+  char bytes[8];
+  write64le(bytes, value);
+  data.append(bytes, sizeof(bytes));
+}
+
+void appendDependency(std::string &data, llvm::StringRef path, uint64_t size,
+                      uint64_t modificationTime, uint64_t hash) {
+  append(data, path.size());
+  data.append(path.data(), path.size());
+  append(data, size);
+  append(data, modificationTime);
+  append(data, hash);
+}
+
+void appendMessage(std::string &data, llvm::StringRef message) {
+  append(data, message.size() / sizeof(capnp::word));
+  data.append(message.data(), message.size());
+}
+
+struct Dependency {
+  llvm::StringRef path;
+  uint64_t size;
+  uint64_t modificationTime;
+  uint64_t hash;
+};
+
+/**
+ * @brief Cache entry whose fields refer to the data it was parsed from.
+ */
+struct Entry {
+  llvm::SmallVector<Dependency> dependencies;
+  llvm::StringRef message;
+};
+
+std::optional<Entry> parseEntry(llvm::StringRef data) {
+  if (!data.startswith(magic)) {
+    return {};
+  }
+
+  EntryReader reader(data.drop_front(magic.size()));
+  uint64_t nbFiles;
+  if (!reader.read(nbFiles)) {
+    return {};
+  }
+
+  Entry entry;
+  for (uint64_t i = 0; i < nbFiles; ++i) {
+    Dependency dependency;
+    uint64_t pathSize;
+    if (!reader.read(pathSize) || !reader.read(dependency.path, pathSize) ||
+        !reader.read(dependency.size) ||
+        !reader.read(dependency.modificationTime) ||
+        !reader.read(dependency.hash)) {
+      return {};
+    }
+    entry.dependencies.push_back(dependency);
+  }
+
+  uint64_t nbWords;
+  if (!reader.read(nbWords) ||
+      !reader.read(entry.message, nbWords * sizeof(capnp::word))) {
+    return {};
+  }
+  return entry;
+}
+
+/**
+ * @brief Check whether none of the dependencies of an entry changed.
+ *
+ * @param local False if the entry was written on another machine, in which
+ * case modification times are meaningless and every dependency is hashed.
+ */
+bool isValid(const Entry &entry, bool local) {
+  for (const Dependency &dependency : entry.dependencies) {
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(dependency.path, status)) {
+      return false;
+    }
+    if (local && status.getSize() == dependency.size &&
+        modificationTime(status) == dependency.modificationTime) {
+      continue;
+    }
+    if (status.getSize() != dependency.size ||
+        hashFile(dependency.path) != dependency.hash) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Atomically replace the file at the given path.
+ */
+void writeFile(const std::string &path, llvm::StringRef data) {
+  int fd;
+  llvm::SmallString<256> tempPath;
+  if (llvm::sys::fs::createUniqueFile(path + ".tmp%%%%%%", fd, tempPath)) {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempPath);
+      return;
+    }
+  }
+  llvm::sys::fs::rename(tempPath, path);
+}
+
+/**
+ * @brief Identity of the running exporter that is the same on every machine:
+ * a hash of the contents of its executable. The executable is hashed once per
+ * build; the hash is remembered in the cache directory under the local
+ * identity.
+ *
+ * @return The identity, or none if the executable cannot be read.
+ */
+std::optional<std::string>
+sharedExporterIdentity(llvm::StringRef directory,
+                       llvm::StringRef localIdentity) {
+  if (localIdentity.empty()) {
+    return {};
+  }
+  llvm::SmallString<256> stampPath(directory);
+  llvm::sys::path::append(stampPath, "exporter-" +
+                                         llvm::utohexstr(hashContent(
+                                             localIdentity)) +
+                                         ".id");
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> stamp =
+      llvm::MemoryBuffer::getFile(stampPath, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (stamp && (*stamp)->getBufferSize() == 64) {
+    return (*stamp)->getBuffer().str();
+  }
+
+  llvm::StringRef executable = localIdentity.take_until(
+      [](char c) { return c == '\0'; });
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(executable, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return {};
+  }
+  std::string identity = llvm::toHex(
+      llvm::SHA256::hash(llvm::arrayRefFromStringRef((*buffer)->getBuffer())),
+      /*LowerCase=*/true);
+  writeFile(std::string(stampPath), identity);
+  return identity;
+}
+
+} // namespace
+
+ExportCache::ExportCache(llvm::StringRef directory, std::string optionsKey,
+                         RemoteCache *remote)
+    : m_directory(directory.str()), m_optionsKey(std::move(optionsKey)),
+      m_localIdentity(localExporterIdentity()), m_remote(remote) {
+  llvm::sys::fs::create_directories(m_directory);
+  if (m_remote) {
+    // Without an identity, entries of other builds could be replayed.
+    std::optional<std::string> identity =
+        sharedExporterIdentity(m_directory, m_localIdentity);
+    if (identity) {
+      m_sharedIdentity = std::move(*identity);
+    } else {
+      m_remote = nullptr;
+    }
+  }
+}
+
+std::string ExportCache::entryPath(llvm::StringRef key) const {
+  llvm::SmallString<256> path(m_directory);
+  llvm::sys::path::append(path, key + ".vfcache");
+  return std::string(path);
+}
+
+std::vector<std::string>
+ExportCache::replay(const clang::tooling::CompilationDatabase &compilations,
+                    llvm::ArrayRef<std::string> sourcePaths,
+                    llvm::ArrayRef<std::string> extraArgs,
+                    MessageWriter &writer) {
+  std::vector<std::string> misses;
+
+  for (const std::string &path : sourcePaths) {
+    std::string absolutePath = clang::tooling::getAbsolutePath(path);
+
+    std::string keyData = m_optionsKey;
+    keyData += '\0';
+    keyData += absolutePath;
+    for (const clang::tooling::CompileCommand &command :
+         compilations.getCompileCommands(absolutePath)) {
+      keyData += '\0';
+      keyData += command.Directory;
+      for (const std::string &arg : command.CommandLine) {
+        keyData += '\0';
+        keyData += arg;
+      }
+    }
+    for (const std::string &arg : extraArgs) {
+      keyData += '\0';
+      keyData += arg;
+    }
+    std::string key =
+        llvm::utohexstr(hashContent(m_localIdentity + '\0' + keyData));
+    // Remote caches with the layout of the Bazel remote cache expect SHA-256
+    // keys.
+    std::string remoteKey;
+    if (m_remote) {
+      remoteKey = llvm::toHex(llvm::SHA256::hash(llvm::arrayRefFromStringRef(
+                                  m_sharedIdentity + '\0' + keyData)),
+                              /*LowerCase=*/true);
+    }
+
+    size_t sizeHint = 0;
+    std::vector<std::string> closure;
+    if (replayEntry(key, remoteKey, writer, sizeHint, closure)) {
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pendingEntries.insert_or_assign(
+          absolutePath, PendingEntry{key, std::move(remoteKey), sizeHint,
+                                     std::move(closure)});
+    }
+    misses.push_back(path);
+  }
+
+  return misses;
+}
+
+bool ExportCache::replayEntry(llvm::StringRef key, llvm::StringRef remoteKey,
+                              MessageWriter &writer, size_t &sizeHint,
+                              std::vector<std::string> &closure) const {
+  std::optional<Entry> entry;
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(entryPath(key), /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (buffer) {
+    entry = parseEntry((*buffer)->getBuffer());
+    if (entry) {
+      sizeHint = entry->message.size() / sizeof(capnp::word);
+      if (!isValid(*entry, /*local=*/true)) {
+        for (const Dependency &dependency : entry->dependencies) {
+          closure.push_back(dependency.path.str());
+        }
+        entry.reset();
+      }
+    }
+  }
+
+  std::optional<std::string> remoteData;
+  if (!entry && m_remote) {
+    remoteData = m_remote->get("ac", remoteKey);
+    if (remoteData) {
+      entry = parseEntry(*remoteData);
+      if (entry && !isValid(*entry, /*local=*/false)) {
+        entry.reset();
+      }
+    }
+  }
+  if (entry && remoteData) {
+    // The entry is stored locally with the local modification times, so the
+    // next lookup does not hash the dependencies again.
+    std::string data = magic.str();
+    append(data, entry->dependencies.size());
+    for (const Dependency &dependency : entry->dependencies) {
+      llvm::sys::fs::file_status status;
+      llvm::sys::fs::status(dependency.path, status);
+      appendDependency(data, dependency.path, dependency.size,
+                       modificationTime(status), dependency.hash);
+    }
+    appendMessage(data, entry->message);
+    writeFile(entryPath(key), data);
+  }
+  if (!entry) {
+    return false;
+  }
+
+  // The message is copied to respect the alignment of words.
+  size_t nbWords = entry->message.size() / sizeof(capnp::word);
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(nbWords);
+  std::memcpy(words.begin(), entry->message.data(), entry->message.size());
+  writer.write(words.asPtr());
+  return true;
+}
+
+size_t ExportCache::sizeHint(llvm::StringRef sourcePath) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_pendingEntries.find(sourcePath);
+  return it == m_pendingEntries.end() ? 0 : it->second.sizeHint;
+}
+
+std::vector<std::string>
+ExportCache::includeClosure(llvm::StringRef sourcePath) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_pendingEntries.find(sourcePath);
+  return it == m_pendingEntries.end() ? std::vector<std::string>()
+                                      : it->second.closure;
+}
+
+void ExportCache::store(llvm::StringRef sourcePath,
+                        clang::FileManager &fileManager,
+                        kj::ArrayPtr<const capnp::word> message) {
+  std::string key;
+  std::string remoteKey;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_pendingEntries.find(sourcePath);
+    if (it == m_pendingEntries.end()) {
+      return;
+    }
+    key = std::move(it->second.key);
+    remoteKey = std::move(it->second.remoteKey);
+    m_pendingEntries.erase(it);
+  }
+
+  llvm::SmallVector<const clang::FileEntry *> fileEntries;
+  fileManager.GetUniqueIDMapping(fileEntries);
+  llvm::erase_value(fileEntries, nullptr);
+
+  std::string data = magic.str();
+  append(data, fileEntries.size());
+  for (const clang::FileEntry *entry : fileEntries) {
+    llvm::StringRef name = entry->getName();
+    // A file that changed since it was parsed would be recorded with the
+    // hash of contents the message was not exported from.
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(name, status) ||
+        status.getSize() != uint64_t(entry->getSize()) ||
+        llvm::sys::toTimeT(status.getLastModificationTime()) !=
+            entry->getModificationTime()) {
+      return;
+    }
+    std::optional<uint64_t> hash = hashFile(name);
+    if (!hash) {
+      return;
+    }
+    appendDependency(data, name, entry->getSize(), modificationTime(status),
+                     *hash);
+  }
+  appendMessage(data,
+                llvm::StringRef(reinterpret_cast<const char *>(message.begin()),
+                                message.size() * sizeof(capnp::word)));
+
+  writeFile(entryPath(key), data);
+  if (m_remote) {
+    m_remote->put("ac", remoteKey, data);
+  }
+}
+
+} // namespace vf
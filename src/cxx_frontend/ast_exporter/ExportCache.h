@@ -0,0 +1,134 @@
+#pragma once
+#include "MessageWriter.h"
+#include "RemoteCache.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vf {
+
+/**
+ * @brief Cache of exported translation units in a directory.
+ *
+ * An entry is keyed by a hash of the exporter executable's path, size and
+ * modification time, the source file's path, its compile command and the
+ * exporter options that affect the output, so entries of another build of
+ * the exporter are not reused. It records every file the translation unit
+ * depended on, with its size, modification time in nanoseconds and content
+ * hash, followed by the exported message. An entry is only reused if none of
+ * the recorded files changed; a file whose size or modification time differs
+ * is hashed again, so touching a file does not invalidate the entry.
+ *
+ * The cache can be shared between threads and processes: entries are written
+ * to a temporary file that is renamed into place. It can also be backed by a
+ * remote cache that machines share: a missing or stale entry is looked up
+ * under `ac/<sha256 of the key>` on the server, and stored entries are
+ * uploaded there. The remote key holds a hash of the contents of the exporter
+ * executable instead of its path and modification time, so machines share
+ * entries as long as they run the same build. Dependencies are recorded by
+ * absolute path, so entries are only shared between machines that check out
+ * the sources at the same path.
+ */
+class ExportCache {
+public:
+  /**
+   * @brief Write the cached results of the given source files to the writer.
+   *
+   * @param sourcePaths Source files to look up.
+   * @param extraArgs Compiler arguments that are appended to the compile
+   * commands of the source files.
+   * @return Source files that have no valid entry and must be exported.
+   */
+  std::vector<std::string>
+  replay(const clang::tooling::CompilationDatabase &compilations,
+         llvm::ArrayRef<std::string> sourcePaths,
+         llvm::ArrayRef<std::string> extraArgs, MessageWriter &writer);
+
+  /**
+   * @brief Store the result of a source file that was looked up by #replay()
+   * but had no valid entry.
+   *
+   * @param sourcePath Absolute path of the source file.
+   * @param fileManager File manager that was used to export the file. All its
+   * files are recorded as dependencies.
+   * @param message Exported message.
+   */
+  void store(llvm::StringRef sourcePath, clang::FileManager &fileManager,
+             kj::ArrayPtr<const capnp::word> message);
+
+  /**
+   * @brief Retrieve the size of the message that was cached for a source file
+   * whose entry turned out to be stale during #replay().
+   *
+   * @param sourcePath Absolute path of the source file.
+   * @return Size of the stale message in words, or 0 if it is unknown.
+   */
+  size_t sizeHint(llvm::StringRef sourcePath);
+
+  /**
+   * @brief Retrieve the files that a source file depended on when its entry,
+   * which turned out to be stale during #replay(), was stored: its include
+   * closure as of the previous export, in the order the preprocessor first
+   * read them.
+   *
+   * @param sourcePath Absolute path of the source file.
+   * @return Absolute paths of the files, or none if the closure is unknown.
+   */
+  std::vector<std::string> includeClosure(llvm::StringRef sourcePath);
+
+  /**
+   * @brief Construct a cache in the given directory, which is created if it
+   * does not exist.
+   *
+   * @param directory Cache directory.
+   * @param optionsKey Exporter options that affect the exported messages.
+   * @param remote Remote cache to fall back to, or nullptr.
+   */
+  ExportCache(llvm::StringRef directory, std::string optionsKey,
+              RemoteCache *remote = nullptr);
+
+private:
+  std::string entryPath(llvm::StringRef key) const;
+
+  /**
+   * @brief Write the message of the entry with the given key if the local
+   * entry, or else the remote one, is valid. A valid remote entry is stored
+   * locally.
+   *
+   * @param sizeHint Receives the size of the message in words if the entry
+   * exists, even if it is stale.
+   * @param closure Receives the dependencies of the local entry if it exists,
+   * even if it is stale.
+   * @return True if the message was written.
+   */
+  bool replayEntry(llvm::StringRef key, llvm::StringRef remoteKey,
+                   MessageWriter &writer, size_t &sizeHint,
+                   std::vector<std::string> &closure) const;
+
+  /**
+   * @brief Source file that was looked up but has not been stored yet.
+   */
+  struct PendingEntry {
+    std::string key;
+    std::string remoteKey; ///< Key of the entry on the remote cache.
+    size_t sizeHint;
+    std::vector<std::string> closure; ///< Dependencies of the stale entry.
+  };
+
+  std::string m_directory;
+  std::string m_optionsKey;
+  std::string m_localIdentity; ///< See `localExporterIdentity`.
+  std::string m_sharedIdentity; ///< See `sharedExporterIdentity`.
+  RemoteCache *m_remote;
+
+  std::mutex m_mutex;
+  ///< Source files that have been looked up but not stored yet, indexed by
+  /// absolute path.
+  llvm::StringMap<PendingEntry> m_pendingEntries;
+};
+
+} // namespace vf
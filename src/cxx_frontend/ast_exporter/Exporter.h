@@ -0,0 +1,17 @@
+#pragma once
+
+#include "MessageWriter.h"
+
+namespace vf {
+
+/**
+ * @brief Run the exporter with the given command line.
+ *
+ * @param writer Writer of the result messages, or null to write them to
+ * stdout or to the `-output` or `-shm` target. Options that read requests
+ * from stdin or pick another target are rejected when a writer is given.
+ * @return The exit status of the exporter.
+ */
+int runExporter(int argc, const char **argv, MessageWriter *writer);
+
+} // namespace vf
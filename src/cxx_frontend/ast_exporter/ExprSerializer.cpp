@@ -1,6 +1,9 @@
 #include "ExprSerializer.h"
+#include "Census.h"
 #include "Location.h"
+#include "Trace.h"
 #include "clang/AST/StmtVisitor.h"
+#include "clang/Basic/CharInfo.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Lex/Lexer.h"
 
@@ -8,16 +11,185 @@ namespace vf {
 
 namespace {
 
-bool checkSuffixIgnoreCase(const clang::StringRef str, const char suffix,
-                           size_t &offset) {
-  auto strSize = str.size() - offset;
-  if (strSize < 1)
-    return false;
-  if (tolower(*(str.end() - 1 - offset)) == tolower(suffix)) {
-    ++offset;
-    return true;
+/**
+ * @brief Suffix and base of an integer literal, as spelled in the source.
+ */
+struct IntLitSpelling {
+  bool uSuffix = false;
+  unsigned lCount = 0;
+  stubs::NbBase base = stubs::NbBase::DECIMAL;
+
+  bool operator==(const IntLitSpelling &) const = default;
+};
+
+/**
+ * @brief Classify the spelling of an integer literal. Its suffix is found by a
+ * single backward scan, which stops at the first character that is not part of
+ * a `u`, `l` or `ll` suffix.
+ */
+IntLitSpelling classifyIntLitSpelling(llvm::StringRef spelling) {
+  IntLitSpelling result;
+  size_t end = spelling.size();
+  for (; end > 0; --end) {
+    char c = clang::toLowercase(spelling[end - 1]);
+    if (c == 'u' && !result.uSuffix) {
+      result.uSuffix = true;
+    } else if (c == 'l' && result.lCount < 2) {
+      ++result.lCount;
+    } else {
+      break;
+    }
+  }
+
+  if (spelling.size() >= 2 && spelling[0] == '0' &&
+      clang::toLowercase(spelling[1]) == 'x') {
+    result.base = stubs::NbBase::HEX;
+  } else if (!spelling.empty() && spelling[0] == '0') {
+    result.base = stubs::NbBase::OCTAL;
+  }
+  return result;
+}
+
+/**
+ * @brief Spelling of the integer literal token that starts at a spelling
+ * location. The spelling is a view of the source buffer; only a token that has
+ * to be cleaned, because it contains an escaped newline or a trigraph, is
+ * re-lexed to the given buffer.
+ */
+llvm::StringRef getIntLitSpelling(clang::SourceLocation loc,
+                                  const clang::SourceManager &SM,
+                                  const clang::LangOptions &langOpts,
+                                  llvm::SmallVectorImpl<char> &buffer) {
+  bool invalid = false;
+  const char *begin = SM.getCharacterData(loc, &invalid);
+  assert(!invalid);
+
+  // An integer literal only consists of identifier characters and digit
+  // separators.
+  const char *end = begin;
+  while (clang::isAsciiIdentifierContinue(*end) || *end == '\'') {
+    ++end;
+  }
+  if (*end != '\\' && *end != '?') {
+    return llvm::StringRef(begin, end - begin);
+  }
+
+  llvm::StringRef spelling =
+      clang::Lexer::getSpelling(loc, buffer, SM, langOpts, &invalid);
+  assert(!invalid);
+  return spelling;
+}
+
+IntLitSpelling classifyIntegerLiteral(const clang::IntegerLiteral *lit,
+                                      const clang::ASTContext &context) {
+  const clang::SourceManager &SM = context.getSourceManager();
+  llvm::SmallString<16> buffer;
+  return classifyIntLitSpelling(
+      getIntLitSpelling(SM.getSpellingLoc(lit->getBeginLoc()), SM,
+                        context.getLangOpts(), buffer));
+}
+
+stubs::SufKind getLSuffix(const IntLitSpelling &spelling) {
+  return spelling.lCount == 1   ? stubs::SufKind::L_SUF
+         : spelling.lCount == 2 ? stubs::SufKind::L_L_SUF
+                                : stubs::SufKind::NO_SUF;
+}
+
+void serializeIntLitSpelling(const IntLitSpelling &spelling,
+                             stubs::Expr::IntLit::Builder builder) {
+  builder.setUSuffix(spelling.uSuffix);
+  builder.setLSuffix(getLSuffix(spelling));
+  builder.setBase(spelling.base);
+}
+
+/**
+ * @brief Integer literal that is an element of an initializer list, looking
+ * through the implicit integral casts that are not serialized.
+ *
+ * @return The literal, or null if the element is not an integer literal.
+ */
+const clang::IntegerLiteral *getIntLitElement(const clang::Expr *init) {
+  while (const auto *cast = llvm::dyn_cast<clang::ImplicitCastExpr>(init)) {
+    if (cast->getCastKind() != clang::CastKind::CK_IntegralCast &&
+        cast->getCastKind() != clang::CastKind::CK_NoOp) {
+      return nullptr;
+    }
+    init = cast->getSubExpr();
+  }
+  return llvm::dyn_cast<clang::IntegerLiteral>(init);
+}
+
+/**
+ * @brief Minimum number of elements of an initializer list serialized as an
+ * `IntArrayLit`. Shorter lists keep the locations of their elements.
+ */
+constexpr unsigned minIntArrayLitSize = 8;
+
+std::optional<stubs::UnaryOpKind>
+getUnaryOpKind(clang::UnaryOperatorKind opcode) {
+#define CASE_OP(CLANG_OP, STUBS_OP)                                            \
+  case clang::UnaryOperatorKind::UO_##CLANG_OP:                                \
+    return stubs::UnaryOpKind::STUBS_OP;
+
+  switch (opcode) {
+    CASE_OP(Minus, MINUS)
+    CASE_OP(Plus, PLUS)
+    CASE_OP(Not, NOT)
+    CASE_OP(LNot, L_NOT)
+    CASE_OP(AddrOf, ADDR_OF)
+    CASE_OP(Deref, DEREF)
+    CASE_OP(PreInc, PRE_INC)
+    CASE_OP(PreDec, PRE_DEC)
+    CASE_OP(PostInc, POST_INC)
+    CASE_OP(PostDec, POST_DEC)
+  default:
+    return std::nullopt;
+  }
+
+#undef CASE_OP
+}
+
+std::optional<stubs::BinaryOpKind>
+getBinaryOpKind(clang::BinaryOperatorKind opcode) {
+#define CASE_OP(CLANG_OP, STUBS_OP)                                            \
+  case clang::BinaryOperatorKind::BO_##CLANG_OP:                               \
+    return stubs::BinaryOpKind::STUBS_OP;
+
+  switch (opcode) {
+    CASE_OP(Assign, ASSIGN)
+    CASE_OP(Add, ADD)
+    CASE_OP(Sub, SUB)
+    CASE_OP(Mul, MUL)
+    CASE_OP(Div, DIV)
+    CASE_OP(Rem, REM)
+    CASE_OP(Shl, SHL)
+    CASE_OP(Shr, SHR)
+    CASE_OP(LT, LT)
+    CASE_OP(GT, GT)
+    CASE_OP(LE, LE)
+    CASE_OP(GE, GE)
+    CASE_OP(EQ, EQ)
+    CASE_OP(NE, NE)
+    CASE_OP(And, AND)
+    CASE_OP(Or, OR)
+    CASE_OP(Xor, XOR)
+    CASE_OP(LAnd, L_AND)
+    CASE_OP(LOr, L_OR)
+    CASE_OP(MulAssign, MUL_ASSIGN)
+    CASE_OP(DivAssign, DIV_ASSIGN)
+    CASE_OP(RemAssign, REM_ASSIGN)
+    CASE_OP(AddAssign, ADD_ASSIGN)
+    CASE_OP(SubAssign, SUB_ASSIGN)
+    CASE_OP(ShlAssign, SHL_ASSIGN)
+    CASE_OP(ShrAssign, SHR_ASSIGN)
+    CASE_OP(AndAssign, AND_ASSIGN)
+    CASE_OP(XorAssign, XOR_ASSIGN)
+    CASE_OP(OrAssign, OR_ASSIGN)
+  default:
+    return std::nullopt;
   }
-  return false;
+
+#undef CASE_OP
 }
 
 struct ExprSerializerImpl
@@ -79,6 +251,10 @@ struct ExprSerializerImpl
   }
 
   bool VisitInitListExpr(const clang::InitListExpr *expr) {
+    if (m_ASTSerializer->compactIntArrays() && serializeIntArrayLit(expr)) {
+      return true;
+    }
+
     // Initialize Cap'n Proto elements
     ListBuilder<stubs::Node<stubs::Expr>> listBuilder = m_builder.initInitList(expr->getNumInits());
 
@@ -92,30 +268,52 @@ struct ExprSerializerImpl
     return true;
   }
 
-  bool VisitUnaryOperator(const clang::UnaryOperator *uo) {
-    stubs::Expr::UnaryOp::Builder builder = m_builder.initUnaryOp();
-
-#define CASE_OP(CLANG_OP, STUBS_OP)                                            \
-  case clang::UnaryOperatorKind::UO_##CLANG_OP:                                \
-    builder.setKind(stubs::UnaryOpKind::STUBS_OP);                             \
-    break;
-
-    switch (uo->getOpcode()) {
-      CASE_OP(Minus, MINUS)
-      CASE_OP(Plus, PLUS)
-      CASE_OP(Not, NOT)
-      CASE_OP(LNot, L_NOT)
-      CASE_OP(AddrOf, ADDR_OF)
-      CASE_OP(Deref, DEREF)
-      CASE_OP(PreInc, PRE_INC)
-      CASE_OP(PreDec, PRE_DEC)
-      CASE_OP(PostInc, POST_INC)
-      CASE_OP(PostDec, POST_DEC)
-    default:
+  /**
+   * @brief Serialize an initializer list whose elements are integer literals
+   * with the same suffixes and base as an `IntArrayLit`. Literals that are
+   * spelled by a macro expansion or do not fit in 64 bits are serialized as
+   * part of a regular list instead.
+   *
+   * @return False, without serializing anything, if the list does not qualify.
+   */
+  bool serializeIntArrayLit(const clang::InitListExpr *expr) {
+    if (expr->getNumInits() < minIntArrayLitSize) {
       return false;
     }
 
-#undef CASE_OP
+    std::optional<IntLitSpelling> spelling;
+    for (const clang::Expr *init : expr->inits()) {
+      const clang::IntegerLiteral *lit = getIntLitElement(init);
+      if (!lit || lit->getBeginLoc().isMacroID() ||
+          lit->getValue().getActiveBits() > 64) {
+        return false;
+      }
+      IntLitSpelling litSpelling = classifyIntLit(lit);
+      if (spelling && *spelling != litSpelling) {
+        return false;
+      }
+      spelling = litSpelling;
+    }
+
+    stubs::Expr::IntArrayLit::Builder arrayBuilder =
+        m_builder.initIntArrayLit();
+    serializeIntLitSpelling(*spelling, arrayBuilder.initLit());
+    capnp::List<uint64_t>::Builder valuesBuilder =
+        arrayBuilder.initValues(expr->getNumInits());
+    for (unsigned i = 0; i < expr->getNumInits(); ++i) {
+      valuesBuilder.set(
+          i, getIntLitElement(expr->getInit(i))->getValue().getZExtValue());
+    }
+    return true;
+  }
+
+  bool VisitUnaryOperator(const clang::UnaryOperator *uo) {
+    std::optional<stubs::UnaryOpKind> kind = getUnaryOpKind(uo->getOpcode());
+    if (!kind) {
+      return false;
+    }
+    stubs::Expr::UnaryOp::Builder builder = m_builder.initUnaryOp();
+    builder.setKind(*kind);
 
     ExprNodeBuilder operandBuilder = builder.initOperand();
     m_ASTSerializer->serialize(operandBuilder, uo->getSubExpr());
@@ -123,54 +321,41 @@ struct ExprSerializerImpl
   }
 
   bool VisitBinaryOperator(const clang::BinaryOperator *bo) {
-    stubs::Expr::BinaryOp::Builder builder = m_builder.initBinaryOp();
-
-#define CASE_OP(CLANG_OP, STUBS_OP)                                            \
-  case clang::BinaryOperatorKind::BO_##CLANG_OP:                               \
-    builder.setKind(stubs::BinaryOpKind::STUBS_OP);                            \
-    break;
-
-    switch (bo->getOpcode()) {
-      CASE_OP(Assign, ASSIGN)
-      CASE_OP(Add, ADD)
-      CASE_OP(Sub, SUB)
-      CASE_OP(Mul, MUL)
-      CASE_OP(Div, DIV)
-      CASE_OP(Rem, REM)
-      CASE_OP(Shl, SHL)
-      CASE_OP(Shr, SHR)
-      CASE_OP(LT, LT)
-      CASE_OP(GT, GT)
-      CASE_OP(LE, LE)
-      CASE_OP(GE, GE)
-      CASE_OP(EQ, EQ)
-      CASE_OP(NE, NE)
-      CASE_OP(And, AND)
-      CASE_OP(Or, OR)
-      CASE_OP(Xor, XOR)
-      CASE_OP(LAnd, L_AND)
-      CASE_OP(LOr, L_OR)
-      CASE_OP(MulAssign, MUL_ASSIGN)
-      CASE_OP(DivAssign, DIV_ASSIGN)
-      CASE_OP(RemAssign, REM_ASSIGN)
-      CASE_OP(AddAssign, ADD_ASSIGN)
-      CASE_OP(SubAssign, SUB_ASSIGN)
-      CASE_OP(ShlAssign, SHL_ASSIGN)
-      CASE_OP(ShrAssign, SHR_ASSIGN)
-      CASE_OP(AndAssign, AND_ASSIGN)
-      CASE_OP(XorAssign, XOR_ASSIGN)
-      CASE_OP(OrAssign, OR_ASSIGN)
-    default:
+    std::optional<stubs::BinaryOpKind> kind = getBinaryOpKind(bo->getOpcode());
+    if (!kind) {
       return false;
     }
 
-#undef CASE_OP
+    // Left-nested chains such as `a + b + c + ...` are walked down their left
+    // spine in a loop, so the native stack does not grow with the length of
+    // the chain. The right operands are serialized afterwards, innermost
+    // first, which keeps the source order of the operands.
+    using SpineEntry = std::pair<const clang::BinaryOperator *,
+                                 stubs::Expr::BinaryOp::Builder>;
+    llvm::SmallVector<SpineEntry, 8> spine;
+    stubs::Expr::Builder builder = m_builder;
+    while (true) {
+      stubs::Expr::BinaryOp::Builder opBuilder = builder.initBinaryOp();
+      opBuilder.setKind(*kind);
+      spine.emplace_back(bo, opBuilder);
+
+      const auto *lhs = llvm::dyn_cast<clang::BinaryOperator>(bo->getLHS());
+      kind = lhs ? getBinaryOpKind(lhs->getOpcode()) : std::nullopt;
+      if (!kind ||
+          m_ASTSerializer->getAnnotationManager().getTruncating(lhs)) {
+        m_ASTSerializer->serialize(opBuilder.initLhs(), bo->getLHS());
+        break;
+      }
 
-    ExprNodeBuilder lhsBuilder = builder.initLhs();
-    ExprNodeBuilder rhsBuilder = builder.initRhs();
+      ExprNodeBuilder lhsBuilder = opBuilder.initLhs();
+      m_ASTSerializer->serialize(lhsBuilder.initLoc(), getRange(lhs));
+      builder = lhsBuilder.initDesc();
+      bo = lhs;
+    }
 
-    m_ASTSerializer->serialize(lhsBuilder, bo->getLHS());
-    m_ASTSerializer->serialize(rhsBuilder, bo->getRHS());
+    for (auto &[op, opBuilder] : llvm::reverse(spine)) {
+      m_ASTSerializer->serialize(opBuilder.initRhs(), op->getRHS());
+    }
     return true;
   }
 
@@ -223,43 +408,13 @@ struct ExprSerializerImpl
     return true;
   }
 
-  bool VisitIntegerLiteral(const clang::IntegerLiteral *lit) {
-    llvm::SmallString<16> buffer;
-    bool invalid(false);
-    auto spelling = clang::Lexer::getSpelling(
-        m_ASTSerializer->getASTContext().getSourceManager().getSpellingLoc(
-            lit->getBeginLoc()),
-        buffer, m_ASTSerializer->getASTContext().getSourceManager(),
-        m_ASTSerializer->getASTContext().getLangOpts(), &invalid);
-    assert(!invalid);
-
-    size_t offset(0);
-    bool uSuf(checkSuffixIgnoreCase(spelling, 'u', offset));
-
-    unsigned lCount(0);
-    for (unsigned i(0); i < 2; ++i) {
-      if (checkSuffixIgnoreCase(spelling, 'l', offset))
-        ++lCount;
-    }
-
-    if (!uSuf && lCount > 0) {
-      uSuf = checkSuffixIgnoreCase(spelling, 'u', offset);
-    }
+  IntLitSpelling classifyIntLit(const clang::IntegerLiteral *lit) const {
+    return classifyIntegerLiteral(lit, m_ASTSerializer->getASTContext());
+  }
 
+  bool VisitIntegerLiteral(const clang::IntegerLiteral *lit) {
     stubs::Expr::IntLit::Builder intLitBuilder = m_builder.initIntLit();
-
-    intLitBuilder.setUSuffix(uSuf);
-
-    stubs::SufKind lSuf = lCount == 1   ? stubs::SufKind::L_SUF
-                          : lCount == 2 ? stubs::SufKind::L_L_SUF
-                                        : stubs::SufKind::NO_SUF;
-    intLitBuilder.setLSuffix(lSuf);
-
-    stubs::NbBase base =
-        spelling.startswith_insensitive("0x")  ? stubs::NbBase::HEX
-        : spelling.startswith_insensitive("0") ? stubs::NbBase::OCTAL
-                                               : stubs::NbBase::DECIMAL;
-    intLitBuilder.setBase(base);
+    serializeIntLitSpelling(classifyIntLit(lit), intLitBuilder);
 
     llvm::APInt const val = lit->getValue();
 
@@ -311,12 +466,13 @@ struct ExprSerializerImpl
 
   bool VisitDeclRefExpr(const clang::DeclRefExpr *expr) {
     const clang::NamedDecl *decl = expr->getDecl();
-    if (const clang::FunctionDecl *func =
-            llvm::dyn_cast<clang::FunctionDecl>(decl)) {
-      m_builder.setDeclRef(m_ASTSerializer->getQualifiedFuncName(func));
+    // The same variables are referred to over and over, so their names are
+    // decoded once from the name table.
+    if (m_ASTSerializer->usesNameTable()) {
+      m_builder.setDeclRefName(m_ASTSerializer->getDeclRefNameRef(decl));
       return true;
     }
-    m_builder.setDeclRef(m_ASTSerializer->getQualifiedName(decl));
+    m_builder.setDeclRef(m_ASTSerializer->getDeclRefName(decl));
     return true;
   }
 
@@ -332,12 +488,11 @@ struct ExprSerializerImpl
 
     const clang::ValueDecl *decl = expr->getMemberDecl();
     memberBuilder.setArrow(expr->isArrow());
-    if (const clang::CXXMethodDecl *meth =
-            llvm::dyn_cast<clang::CXXMethodDecl>(decl)) {
-      memberBuilder.setName(m_ASTSerializer->getQualifiedFuncName(meth));
+    if (m_ASTSerializer->usesNameTable()) {
+      memberBuilder.setNameRef(m_ASTSerializer->getMemberNameRef(decl) + 1);
       return true;
     }
-    memberBuilder.setName(decl->getNameAsString());
+    memberBuilder.setName(m_ASTSerializer->getMemberName(decl));
     return true;
   }
 
@@ -414,6 +569,18 @@ struct ExprSerializerImpl
   }
 
   bool VisitConstantExpr(const clang::ConstantExpr *expr) {
+    // Only integer values are kept; other constants are serialized as their
+    // subexpression, as if the ConstantExpr was not there.
+    if (expr->hasAPValueResult()) {
+      clang::APValue value = expr->getAPValueResult();
+      if (value.isInt() && serializeConstValue(value.getInt(), [&] {
+            return m_builder.initConstant().initValue();
+          })) {
+        m_ASTSerializer->serialize(m_builder.getConstant().initExpr(),
+                                   expr->getSubExpr());
+        return true;
+      }
+    }
     serialize(expr->getSubExpr());
     return true;
   }
@@ -434,12 +601,21 @@ struct ExprSerializerImpl
   }
 
   bool VisitExprWithCleanups(const clang::ExprWithCleanups *expr) {
+    // The translation of these nodes is that of their operand.
+    if (m_ASTSerializer->compactExprs()) {
+      serialize(expr->getSubExpr());
+      return true;
+    }
     ExprNodeBuilder cleanupsBuilder = m_builder.initCleanups();
     m_ASTSerializer->serialize(cleanupsBuilder, expr->getSubExpr());
     return true;
   }
 
   bool VisitCXXBindTemporaryExpr(const clang::CXXBindTemporaryExpr *expr) {
+    if (m_ASTSerializer->compactExprs()) {
+      serialize(expr->getSubExpr());
+      return true;
+    }
     ExprNodeBuilder tempBuilder = m_builder.initBindTemporary();
     m_ASTSerializer->serialize(tempBuilder, expr->getSubExpr());
     return true;
@@ -449,6 +625,7 @@ struct ExprSerializerImpl
     const Annotation *truncatingOpt =
         m_ASTSerializer->getAnnotationManager().getTruncating(expr);
     if (truncatingOpt) {
+      Census::countTruncating();
       ExprNodeBuilder exprBuilder = m_builder.initTruncating();
       m_ASTSerializer->serialize(exprBuilder.initLoc(),
                                  truncatingOpt->getRange());
@@ -475,6 +652,266 @@ struct ExprSerializerImpl
   const ASTSerializer *m_ASTSerializer;
 };
 
+/**
+ * @brief Minimum number of entries of an expression tree serialized as a
+ * `FlatExpr`. Smaller trees gain nothing from it, and translators that
+ * inspect a node, like the callee of a call, keep seeing the regular one.
+ */
+constexpr size_t minFlatExprEntries = 4;
+
+/**
+ * @brief Collects an expression tree as the entries of a `FlatExpr`, in
+ * pre-order. Every entry starts at the expression its parent refers to and
+ * looks through the same nodes as `ExprSerializerImpl`, so the tree
+ * translates to the same VeriFast expression as the regular one.
+ */
+class FlatExprCollector {
+public:
+  struct Entry {
+    stubs::FlatExpr::Kind kind;
+    uint32_t loc;
+    stubs::UnaryOpKind unaryOp = stubs::UnaryOpKind::MINUS;
+    stubs::BinaryOpKind binaryOp = stubs::BinaryOpKind::ADD;
+    IntLitSpelling spelling;
+    bool flag = false;
+    uint64_t value = 0;
+    uint32_t name = 0;
+  };
+
+  /**
+   * @brief Collect the tree of an expression. The tree is walked with an
+   * explicit stack, so long chains do not grow the native one.
+   *
+   * @return False if the tree holds a node that a `FlatExpr` does not
+   * support. The expressions that contain that node are then marked, so they
+   * are not walked again when they are serialized on their own.
+   */
+  bool collect(const clang::Expr *root) {
+    m_entries.clear();
+    // Pending expressions, each with the index of the entry of its parent.
+    llvm::SmallVector<std::pair<const clang::Expr *, size_t>, 16> pending;
+    llvm::SmallVector<size_t, 64> parents;
+    llvm::SmallVector<const clang::Expr *, 64> starts;
+    pending.emplace_back(root, SIZE_MAX);
+    while (!pending.empty()) {
+      auto [start, parent] = pending.pop_back_val();
+      size_t index = m_entries.size();
+      parents.push_back(parent);
+      starts.push_back(start);
+      llvm::SmallVector<const clang::Expr *, 3> operands;
+      if (m_serializer->isKnownNonFlat(start) || !add(start, operands)) {
+        for (size_t i = index; i != SIZE_MAX; i = parents[i]) {
+          m_serializer->markNonFlat(starts[i]);
+        }
+        return false;
+      }
+      // Operands are popped in source order.
+      for (const clang::Expr *operand : llvm::reverse(operands)) {
+        pending.emplace_back(operand, index);
+      }
+    }
+    return true;
+  }
+
+  llvm::ArrayRef<Entry> entries() const { return m_entries; }
+
+  explicit FlatExprCollector(const ASTSerializer &serializer)
+      : m_serializer(&serializer) {}
+
+private:
+  /**
+   * @brief Add the entry of an expression that starts at `start`.
+   *
+   * @param operands Receives the operands of the entry, in source order.
+   */
+  bool add(const clang::Expr *start,
+           llvm::SmallVectorImpl<const clang::Expr *> &operands) {
+    Entry entry;
+    // Expression whose range is the location of the entry.
+    const clang::Expr *locExpr = start;
+    const clang::Expr *expr = start;
+    while (true) {
+      if (m_serializer->getAnnotationManager().getTruncating(expr)) {
+        return false;
+      }
+      if (const auto *cast = llvm::dyn_cast<clang::ImplicitCastExpr>(expr)) {
+        switch (cast->getCastKind()) {
+        case clang::CastKind::CK_LValueToRValue:
+          entry.kind = stubs::FlatExpr::Kind::L_VALUE_TO_R_VALUE;
+          operands.push_back(cast->getSubExpr());
+          return push(entry, locExpr);
+        case clang::CastKind::CK_UncheckedDerivedToBase:
+        case clang::CastKind::CK_DerivedToBase:
+        case clang::CastKind::CK_BaseToDerived:
+        case clang::CastKind::CK_PointerToIntegral:
+          return false;
+        default:
+          expr = cast->getSubExpr();
+          continue;
+        }
+      }
+      if (const auto *paren = llvm::dyn_cast<clang::ParenExpr>(expr)) {
+        expr = paren->getSubExpr();
+        continue;
+      }
+      if (const auto *arg = llvm::dyn_cast<clang::CXXDefaultArgExpr>(expr)) {
+        expr = arg->getExpr();
+        continue;
+      }
+      if (const auto *init = llvm::dyn_cast<clang::CXXDefaultInitExpr>(expr)) {
+        expr = init->getExpr();
+        continue;
+      }
+      if (const auto *constant = llvm::dyn_cast<clang::ConstantExpr>(expr)) {
+        // The value of a `Constant` is not translated, only its operand, which
+        // has a location of its own.
+        if (hasConstValue(constant)) {
+          locExpr = constant->getSubExpr();
+        }
+        expr = constant->getSubExpr();
+        continue;
+      }
+      // The translation of these nodes is that of their operand, with its own
+      // location.
+      if (const auto *cleanups =
+              llvm::dyn_cast<clang::ExprWithCleanups>(expr)) {
+        locExpr = expr = cleanups->getSubExpr();
+        continue;
+      }
+      if (const auto *temp =
+              llvm::dyn_cast<clang::CXXBindTemporaryExpr>(expr)) {
+        locExpr = expr = temp->getSubExpr();
+        continue;
+      }
+      break;
+    }
+
+    if (const auto *uo = llvm::dyn_cast<clang::UnaryOperator>(expr)) {
+      std::optional<stubs::UnaryOpKind> kind = getUnaryOpKind(uo->getOpcode());
+      if (!kind) {
+        return false;
+      }
+      entry.kind = stubs::FlatExpr::Kind::UNARY_OP;
+      entry.unaryOp = *kind;
+      operands.push_back(uo->getSubExpr());
+      return push(entry, locExpr);
+    }
+    if (const auto *bo = llvm::dyn_cast<clang::BinaryOperator>(expr)) {
+      std::optional<stubs::BinaryOpKind> kind =
+          getBinaryOpKind(bo->getOpcode());
+      if (!kind) {
+        return false;
+      }
+      entry.kind = stubs::FlatExpr::Kind::BINARY_OP;
+      entry.binaryOp = *kind;
+      operands.append({bo->getLHS(), bo->getRHS()});
+      return push(entry, locExpr);
+    }
+    if (const auto *co = llvm::dyn_cast<clang::ConditionalOperator>(expr)) {
+      entry.kind = stubs::FlatExpr::Kind::CONDITIONAL_OP;
+      operands.append({co->getCond(), co->getTrueExpr(), co->getFalseExpr()});
+      return push(entry, locExpr);
+    }
+    if (const auto *as = llvm::dyn_cast<clang::ArraySubscriptExpr>(expr)) {
+      entry.kind = stubs::FlatExpr::Kind::ARRAY_SUBSCRIPT;
+      operands.append({as->getLHS(), as->getRHS()});
+      return push(entry, locExpr);
+    }
+    if (const auto *lit = llvm::dyn_cast<clang::IntegerLiteral>(expr)) {
+      if (lit->getValue().getActiveBits() > 64) {
+        return false;
+      }
+      entry.kind = stubs::FlatExpr::Kind::INT_LIT;
+      entry.spelling =
+          classifyIntegerLiteral(lit, m_serializer->getASTContext());
+      entry.flag = entry.spelling.uSuffix;
+      entry.value = lit->getValue().getZExtValue();
+      return push(entry, locExpr);
+    }
+    if (const auto *lit = llvm::dyn_cast<clang::CharacterLiteral>(expr)) {
+      using CharKind = clang::CharacterLiteral::CharacterKind;
+      entry.kind = stubs::FlatExpr::Kind::INT_LIT;
+      entry.spelling.base = stubs::NbBase::CHARACTER;
+      entry.flag = lit->getKind() == CharKind::UTF16 ||
+                   lit->getKind() == CharKind::UTF32;
+      entry.value = lit->getValue();
+      return push(entry, locExpr);
+    }
+    if (const auto *lit = llvm::dyn_cast<clang::CXXBoolLiteralExpr>(expr)) {
+      entry.kind = stubs::FlatExpr::Kind::BOOL_LIT;
+      entry.flag = lit->getValue();
+      return push(entry, locExpr);
+    }
+    if (const auto *ref = llvm::dyn_cast<clang::DeclRefExpr>(expr)) {
+      entry.kind = stubs::FlatExpr::Kind::DECL_REF;
+      entry.name = m_serializer->getDeclRefNameRef(ref->getDecl());
+      return push(entry, locExpr);
+    }
+    if (llvm::isa<clang::CXXThisExpr>(expr)) {
+      entry.kind = stubs::FlatExpr::Kind::THIS;
+      return push(entry, locExpr);
+    }
+    if (llvm::isa<clang::CXXNullPtrLiteralExpr>(expr)) {
+      entry.kind = stubs::FlatExpr::Kind::NULL_PTR_LIT;
+      return push(entry, locExpr);
+    }
+    return false;
+  }
+
+  bool push(Entry &entry, const clang::Expr *locExpr) {
+    entry.loc = m_serializer->getLocationRef(getRange(locExpr));
+    m_entries.push_back(entry);
+    return true;
+  }
+
+  /**
+   * @brief Whether a constant expression is serialized as a `Constant`, see
+   * `ExprSerializerImpl::VisitConstantExpr`.
+   */
+  static bool hasConstValue(const clang::ConstantExpr *expr) {
+    if (!expr->hasAPValueResult()) {
+      return false;
+    }
+    clang::APValue value = expr->getAPValueResult();
+    return value.isInt() && fitsConstValue(value.getInt());
+  }
+
+  const ASTSerializer *m_serializer;
+  llvm::SmallVector<Entry, 64> m_entries;
+};
+
+/**
+ * @brief Serialize the tree of an expression as a `FlatExpr` if all its nodes
+ * are supported and it has at least `minFlatExprEntries` entries.
+ *
+ * @return False, without serializing anything, otherwise.
+ */
+bool serializeFlatExpr(const ASTSerializer &serializer, const clang::Expr *expr,
+                       stubs::Expr::Builder builder) {
+  FlatExprCollector collector(serializer);
+  if (!collector.collect(expr) ||
+      collector.entries().size() < minFlatExprEntries) {
+    return false;
+  }
+
+  ListBuilder<stubs::FlatExpr::Entry> entriesBuilder =
+      builder.initFlat().initEntries(collector.entries().size());
+  for (size_t i = 0; i < collector.entries().size(); ++i) {
+    const FlatExprCollector::Entry &entry = collector.entries()[i];
+    stubs::FlatExpr::Entry::Builder entryBuilder = entriesBuilder[i];
+    entryBuilder.setKind(entry.kind);
+    entryBuilder.setLoc(entry.loc);
+    entryBuilder.setUnaryOp(entry.unaryOp);
+    entryBuilder.setBinaryOp(entry.binaryOp);
+    entryBuilder.setLSuffix(getLSuffix(entry.spelling));
+    entryBuilder.setBase(entry.spelling.base);
+    entryBuilder.setFlag(entry.flag);
+    entryBuilder.setValue(entry.value);
+    entryBuilder.setName(entry.name);
+  }
+  return true;
+}
+
 } // namespace
 
 void ExprSerializer::serialize(const clang::Expr *expr,
@@ -482,10 +919,38 @@ void ExprSerializer::serialize(const clang::Expr *expr,
                                stubs::Expr::Builder exprBuilder) const {
   assert(expr && "Expression should not be null");
 
+  Census::Node census(Census::Exprs, expr->getStmtClassName());
+  VF_TRACE_SCOPE("SerializeExpr", expr->getStmtClassName());
   clang::SourceRange range = getRange(expr);
-  ExprSerializerImpl serializer(*m_ASTSerializer, exprBuilder);
-  serializer.serialize(expr);
+  serializeDesc(expr, exprBuilder);
   m_ASTSerializer->serialize(locBuilder, range);
+  census.record(exprBuilder, locBuilder);
+}
+
+void ExprSerializer::serialize(const clang::Expr *expr,
+                               ExprNodeBuilder builder) const {
+  const auto *cast = llvm::dyn_cast<clang::ImplicitCastExpr>(expr);
+  if (!m_ASTSerializer->compactExprs() || !cast ||
+      cast->getCastKind() != clang::CastKind::CK_LValueToRValue ||
+      m_ASTSerializer->getAnnotationManager().getTruncating(expr)) {
+    NodeSerializer::serialize(expr, builder);
+    return;
+  }
+
+  Census::Node census(Census::Exprs, expr->getStmtClassName());
+  VF_TRACE_SCOPE("SerializeExpr", expr->getStmtClassName());
+  stubs::Expr::Builder exprBuilder = builder.initDesc();
+  serializeDesc(expr, exprBuilder);
+  census.record(exprBuilder);
+}
+
+void ExprSerializer::serializeDesc(const clang::Expr *expr,
+                                   stubs::Expr::Builder exprBuilder) const {
+  if (!m_ASTSerializer->flatExprs() ||
+      !serializeFlatExpr(*m_ASTSerializer, expr, exprBuilder)) {
+    ExprSerializerImpl serializer(*m_ASTSerializer, exprBuilder);
+    serializer.serialize(expr);
+  }
 }
 
 } // namespace vf
\ No newline at end of file
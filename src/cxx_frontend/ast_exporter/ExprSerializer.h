@@ -4,20 +4,59 @@
 #include "Serializer.h"
 #include "stubs_ast.capnp.h"
 #include "clang/AST/Expr.h"
+#include "llvm/ADT/APSInt.h"
 
 namespace vf {
 
-class ExprSerializer : public NodeSerializer<stubs::Expr, const clang::Expr *> {
+/**
+ * @brief Whether an integer constant fits in the 64 bits of a `ConstValue`.
+ */
+inline bool fitsConstValue(const llvm::APSInt &value) {
+  return value.isSigned() ? value.getSignificantBits() <= 64
+                          : value.getActiveBits() <= 64;
+}
+
+/**
+ * @brief Serialize an integer constant if it fits in the 64 bits of a
+ * `ConstValue`.
+ *
+ * @param init Initializes the target builder; only called if the value fits.
+ * @return Whether the value was serialized.
+ */
+template <typename InitBuilder>
+bool serializeConstValue(const llvm::APSInt &value, InitBuilder init) {
+  if (!fitsConstValue(value)) {
+    return false;
+  }
+  stubs::ConstValue::Builder builder = init();
+  builder.setBits(value.isSigned() ? uint64_t(value.getSExtValue())
+                                   : value.getZExtValue());
+  builder.setIsSigned(value.isSigned());
+  return true;
+}
+
+class ExprSerializer final
+    : public NodeSerializer<stubs::Expr, const clang::Expr *> {
 public:
   void serialize(const clang::Expr *expr, stubs::Loc::Builder locBuilder,
                  stubs::Expr::Builder exprBuilder) const override;
 
-  using NodeSerializer::serialize;
+  /**
+   * @brief Serialize an expression to the builder of a target node, which has
+   * no location if the expression is an lvalue-to-rvalue conversion and
+   * expressions are compact. Such a conversion has the range of its operand,
+   * which readers use instead.
+   */
+  void serialize(const clang::Expr *expr,
+                 ExprNodeBuilder builder) const override;
 
   explicit ExprSerializer(const ASTSerializer &serializer)
       : m_ASTSerializer(&serializer) {}
 
 private:
+  void serializeDesc(const clang::Expr *expr,
+                     stubs::Expr::Builder exprBuilder) const;
+
   const ASTSerializer *m_ASTSerializer;
 };
 
@@ -0,0 +1,133 @@
+#include "FileCosts.h"
+#include "AnnotationManager.h"
+#include "clang/Basic/FileManager.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+#include <memory>
+
+namespace vf {
+
+namespace {
+
+struct Costs {
+  double seconds = 0;
+  uint64_t annotations = 0;
+  uint64_t decls = 0;
+  uint64_t words = 0;
+};
+
+struct FileCostsState {
+  llvm::StringMap<Costs> costs;
+  ///< Files the preprocessor is in, innermost last.
+  llvm::SmallVector<Costs *, 16> stack;
+  ///< Time at which the innermost file was entered or resumed.
+  double start = 0;
+
+  static double now() {
+    return llvm::TimeRecord::getCurrentTime(true).getWallTime();
+  }
+
+  void stopInnermost() {
+    if (!stack.empty()) {
+      stack.back()->seconds += now() - start;
+    }
+  }
+
+  Costs &of(const clang::FileEntry *entry) {
+    return costs[entry ? entry->getName() : "<built-in>"];
+  }
+};
+
+std::unique_ptr<FileCostsState> state;
+
+} // namespace
+
+void FileCosts::enterFile(const clang::FileEntry *entry) {
+  if (!state) {
+    return;
+  }
+  state->stopInnermost();
+  state->stack.push_back(&state->of(entry));
+  state->start = FileCostsState::now();
+}
+
+void FileCosts::exitFile() {
+  if (!state || state->stack.empty()) {
+    return;
+  }
+  state->stopInnermost();
+  state->stack.pop_back();
+  state->start = FileCostsState::now();
+}
+
+void FileCosts::endParse() {
+  if (!state) {
+    return;
+  }
+  state->stopInnermost();
+  state->stack.clear();
+}
+
+void FileCosts::countAnnotations(const clang::SourceManager &sourceManager,
+                                 const AnnotationManager &annotationManager) {
+  if (!state) {
+    return;
+  }
+  llvm::SmallVector<const clang::FileEntry *> fileEntries;
+  sourceManager.getFileManager().GetUniqueIDMapping(fileEntries);
+  for (const clang::FileEntry *entry : fileEntries) {
+    if (entry) {
+      state->of(entry).annotations += annotationManager.getAll(entry).size();
+    }
+  }
+}
+
+void FileCosts::countDecls(const clang::FileEntry *entry, uint64_t decls,
+                           uint64_t words) {
+  if (!state) {
+    return;
+  }
+  Costs &costs = state->of(entry);
+  costs.decls += decls;
+  costs.words += words;
+}
+
+void FileCosts::enable() {
+  if (!state) {
+    state = std::make_unique<FileCostsState>();
+  }
+}
+
+bool FileCosts::isEnabled() { return state != nullptr; }
+
+void FileCosts::print(llvm::raw_ostream &os, unsigned nbFiles) {
+  if (!state) {
+    return;
+  }
+  llvm::SmallVector<const llvm::StringMapEntry<Costs> *, 64> files;
+  for (const llvm::StringMapEntry<Costs> &entry : state->costs) {
+    files.push_back(&entry);
+  }
+  llvm::stable_sort(files, [](const auto *lhs, const auto *rhs) {
+    return lhs->getValue().seconds > rhs->getValue().seconds;
+  });
+  if (files.size() > nbFiles) {
+    files.resize(nbFiles);
+  }
+
+  os << llvm::format("%10s %12s %10s %12s  %s\n", "seconds", "annotations",
+                     "decls", "words", "file");
+  for (const llvm::StringMapEntry<Costs> *file : files) {
+    const Costs &costs = file->getValue();
+    os << llvm::format("%10.6f %12llu %10llu %12llu  ", costs.seconds,
+                       static_cast<unsigned long long>(costs.annotations),
+                       static_cast<unsigned long long>(costs.decls),
+                       static_cast<unsigned long long>(costs.words))
+       << file->getKey() << '\n';
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,68 @@
+#pragma once
+#include "clang/Basic/FileEntry.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+namespace vf {
+
+class AnnotationManager;
+
+/**
+ * @brief Cost of every file of the exported translation units, as reported by
+ * `-cost_by_file`: the time the preprocessor spent in it, its annotations, and
+ * its top-level declarations with the words they take in the output.
+ *
+ * Files are identified by their path, so the costs of a header add up over all
+ * translation units that include it. Nothing is recorded unless the report is
+ * enabled, and it must only be enabled when a single thread exports.
+ */
+class FileCosts {
+public:
+  /**
+   * @brief Attribute the time until the next file change to the given file,
+   * which is entered by the preprocessor.
+   *
+   * @param entry Entered file, or null for a file without entry, such as the
+   * predefines buffer.
+   */
+  static void enterFile(const clang::FileEntry *entry);
+
+  /**
+   * @brief Attribute the time until the next file change to the file that
+   * included the one that is exited.
+   */
+  static void exitFile();
+
+  /**
+   * @brief Stop attributing time, at the end of parsing a translation unit.
+   */
+  static void endParse();
+
+  /**
+   * @brief Count the annotations of every file of a translation unit.
+   */
+  static void countAnnotations(const clang::SourceManager &sourceManager,
+                               const AnnotationManager &annotationManager);
+
+  /**
+   * @brief Count the serialized top-level declarations of a file.
+   *
+   * @param decls Number of declarations, without annotations.
+   * @param words Words of the declarations and annotations in the output.
+   */
+  static void countDecls(const clang::FileEntry *entry, uint64_t decls,
+                         uint64_t words);
+
+  static void enable();
+
+  static bool isEnabled();
+
+  /**
+   * @brief Print the costs of the given number of files that took the most
+   * time, most expensive first.
+   */
+  static void print(llvm::raw_ostream &os, unsigned nbFiles);
+};
+
+} // namespace vf
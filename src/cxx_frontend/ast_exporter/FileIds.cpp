@@ -0,0 +1,51 @@
+#include "FileIds.h"
+#include "clang/Basic/FileManager.h"
+#include "llvm/ADT/STLExtras.h"
+
+namespace vf {
+
+FileIds::FileIds(const clang::SourceManager &sourceManager)
+    : m_sourceManager(&sourceManager) {
+  auto add = [this](const clang::FileEntry *entry) {
+    if (entry && m_fds.try_emplace(entry->getUID(), m_entries.size()).second) {
+      m_entries.push_back(entry);
+    }
+  };
+
+  // Local entries are in the order in which the preprocessor entered them.
+  // Entries loaded from a precompiled header are not walked, since that would
+  // deserialize them.
+  for (unsigned i = 0, n = sourceManager.local_sloc_entry_size(); i < n; ++i) {
+    const clang::SrcMgr::SLocEntry &slocEntry =
+        sourceManager.getLocalSLocEntry(i);
+    if (slocEntry.isFile()) {
+      if (auto entry = slocEntry.getFile().getContentCache().OrigEntry) {
+        add(&entry->getFileEntry());
+      }
+    }
+  }
+
+  llvm::SmallVector<const clang::FileEntry *> others;
+  sourceManager.getFileManager().GetUniqueIDMapping(others);
+  llvm::erase_if(others, [this](const clang::FileEntry *entry) {
+    return !entry || m_fds.contains(entry->getUID());
+  });
+  llvm::sort(others, [](const clang::FileEntry *a, const clang::FileEntry *b) {
+    return a->getName() < b->getName();
+  });
+  for (const clang::FileEntry *entry : others) {
+    add(entry);
+  }
+}
+
+unsigned FileIds::fd(unsigned uid) const {
+  auto [it, inserted] = m_fds.try_emplace(uid, m_entries.size());
+  if (inserted) {
+    llvm::SmallVector<const clang::FileEntry *> entries;
+    m_sourceManager->getFileManager().GetUniqueIDMapping(entries);
+    m_entries.push_back(uid < entries.size() ? entries[uid] : nullptr);
+  }
+  return it->second;
+}
+
+} // namespace vf
@@ -0,0 +1,58 @@
+#pragma once
+#include "clang/Basic/FileEntry.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace vf {
+
+/**
+ * @brief Stable numbering of the files of a translation unit, which the
+ * serialized output uses as `fd` instead of the unique identifiers of the
+ * file manager.
+ *
+ * Unique identifiers depend on the order in which the file manager looked up
+ * files, including failed header searches and the files of earlier
+ * translation units that share the file manager. Files are numbered instead
+ * in the order in which the translation unit first entered them, starting
+ * with its main file, followed by the other files of the file manager sorted
+ * by path. The same inputs therefore always produce the same identifiers.
+ */
+class FileIds {
+public:
+  /**
+   * @return the identifier of the given file in the output.
+   */
+  unsigned fd(const clang::FileEntry &entry) const { return fd(entry.getUID()); }
+
+  /**
+   * @return the identifier in the output of the file with the given unique
+   * identifier of the file manager. A file the file manager created after
+   * this numbering is numbered on first use.
+   */
+  unsigned fd(unsigned uid) const;
+
+  /**
+   * @return the file with the given identifier in the output, or null.
+   */
+  const clang::FileEntry *entry(unsigned fd) const {
+    return fd < m_entries.size() ? m_entries[fd] : nullptr;
+  }
+
+  /**
+   * @return all numbered files, indexed by their identifier in the output.
+   */
+  llvm::ArrayRef<const clang::FileEntry *> entries() const {
+    return m_entries;
+  }
+
+  explicit FileIds(const clang::SourceManager &sourceManager);
+
+private:
+  const clang::SourceManager *m_sourceManager;
+  mutable llvm::SmallVector<const clang::FileEntry *> m_entries;
+  mutable llvm::DenseMap<unsigned, unsigned> m_fds; ///< Indexed by unique id.
+};
+
+} // namespace vf
@@ -1,6 +1,4 @@
 #pragma once
-#include <optional>
-#include <string_view>
 
 namespace vf {
 
@@ -14,6 +12,4 @@ struct FixedWidthInt {
       : bits(bits), isSigned(isSigned) {}
 };
 
-std::optional<FixedWidthInt> getFixedWidthFromString(std::string_view name);
-
 }; // namespace vf
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "Focus.h"
+#include "clang/Basic/FileManager.h"
+
+namespace vf {
+
+std::optional<Focus> Focus::parse(llvm::StringRef focus) {
+  auto [path, line] = focus.rsplit(':');
+  unsigned lineNumber;
+  if (path.empty() || line.getAsInteger(10, lineNumber)) {
+    return std::nullopt;
+  }
+  Focus result;
+  result.path = path.str();
+  result.line = lineNumber;
+  return result;
+}
+
+bool Focus::isFocusedFile(clang::FileID fileID,
+                          const clang::SourceManager &SM) const {
+  if (fileID != m_lastFileID) {
+    const clang::FileEntry *entry = SM.getFileEntryForID(fileID);
+    m_lastFileID = fileID;
+    m_lastFileFocused = entry && entry->getName() == path;
+  }
+  return m_lastFileFocused;
+}
+
+bool Focus::contains(const clang::FunctionDecl *decl,
+                     const clang::SourceManager &SM) const {
+  clang::SourceLocation begin = SM.getExpansionLoc(decl->getBeginLoc());
+  clang::SourceLocation end = SM.getExpansionLoc(decl->getEndLoc());
+  clang::FileID fileID = SM.getFileID(begin);
+  if (!isFocusedFile(fileID, SM)) {
+    return false;
+  }
+
+  // A definition that ends in another file spans the rest of its first file.
+  return SM.getExpansionLineNumber(begin) <= line &&
+         (SM.getFileID(end) != fileID ||
+          line <= SM.getExpansionLineNumber(end));
+}
+
+} // namespace vf
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/StringRef.h"
+#include <optional>
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief Source line of the only function that is verified, as selected by
+ * VeriFast's `-focus` option.
+ *
+ */
+struct Focus {
+  std::string path; ///< Path of the file, as passed to the exporter.
+  unsigned line;    ///< Line in that file.
+
+  /**
+   * @brief Parse a focus of the form `<path>:<line>`.
+   *
+   * @return The focus, or nothing if it is malformed.
+   */
+  static std::optional<Focus> parse(llvm::StringRef focus);
+
+  /**
+   * @brief Check whether a function definition spans the focused line, from
+   * the start of its declaration to its closing brace. Like VeriFast, macro
+   * expansions are attributed to the location they are expanded at.
+   */
+  bool contains(const clang::FunctionDecl *decl,
+                const clang::SourceManager &SM) const;
+
+private:
+  /**
+   * @brief Check whether a file is the focused file. The verdict for the
+   * previous file is kept, since the definitions of a file are mostly checked
+   * one after the other.
+   */
+  bool isFocusedFile(clang::FileID fileID,
+                     const clang::SourceManager &SM) const;
+
+  mutable clang::FileID m_lastFileID; ///< File of the previous check.
+  mutable bool m_lastFileFocused = false; ///< Whether `m_lastFileID` is
+                                          ///< the focused file.
+};
+
+} // namespace vf
@@ -0,0 +1,144 @@
+#include "ForkedPartitions.h"
+#include "capnp/serialize.h"
+#include "kj/array.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace vf {
+
+#ifdef _WIN32
+
+bool runForked(
+    unsigned nbPartitions,
+    llvm::function_ref<bool(unsigned, MessageWriter &)> runPartition,
+    llvm::function_ref<void(unsigned, kj::ArrayPtr<const capnp::word>)>
+        onMessage) {
+  return false;
+}
+
+#else
+
+namespace {
+
+/**
+ * @brief Read the messages a child wrote to a file.
+ *
+ * @param file File the child wrote its messages to.
+ * @param words Receives the flat arrays of the messages, one after the other.
+ * @return False if the file cannot be read or does not hold whole words.
+ */
+bool readMessages(std::FILE *file, kj::Array<capnp::word> &words) {
+  int fd = fileno(file);
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size % sizeof(capnp::word) != 0) {
+    return false;
+  }
+  words = kj::heapArray<capnp::word>(status.st_size / sizeof(capnp::word));
+  char *buffer = reinterpret_cast<char *>(words.begin());
+  size_t size = words.size() * sizeof(capnp::word);
+  for (size_t offset = 0; offset < size;) {
+    ssize_t n = pread(fd, buffer + offset, size - offset, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    offset += n;
+  }
+  return true;
+}
+
+} // namespace
+
+bool runForked(
+    unsigned nbPartitions,
+    llvm::function_ref<bool(unsigned, MessageWriter &)> runPartition,
+    llvm::function_ref<void(unsigned, kj::ArrayPtr<const capnp::word>)>
+        onMessage) {
+  // Buffered output would otherwise be written by every child as well.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  std::fflush(nullptr);
+
+  std::vector<std::FILE *> files;
+  auto closeFiles = llvm::make_scope_exit([&files] {
+    for (std::FILE *file : files) {
+      std::fclose(file);
+    }
+  });
+
+  std::vector<pid_t> children;
+  bool started = true;
+  for (unsigned partition = 0; partition < nbPartitions; ++partition) {
+    std::FILE *file = std::tmpfile();
+    if (!file) {
+      started = false;
+      break;
+    }
+    files.push_back(file);
+    pid_t pid = fork();
+    if (pid < 0) {
+      started = false;
+      break;
+    }
+    if (pid == 0) {
+      bool usable;
+      {
+        FdMessageWriter writer(fileno(file), /*packed=*/false);
+        usable = runPartition(partition, writer);
+      }
+      llvm::errs().flush();
+      _exit(usable ? 0 : 1);
+    }
+    children.push_back(pid);
+  }
+
+  bool succeeded = started;
+  for (pid_t pid : children) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        status = -1;
+        break;
+      }
+    }
+    succeeded &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  if (!succeeded) {
+    return false;
+  }
+
+  std::vector<kj::Array<capnp::word>> messages;
+  for (std::FILE *file : files) {
+    kj::Array<capnp::word> words;
+    if (!readMessages(file, words)) {
+      return false;
+    }
+    messages.push_back(std::move(words));
+  }
+
+  for (unsigned partition = 0; partition < nbPartitions; ++partition) {
+    kj::ArrayPtr<const capnp::word> rest = messages[partition];
+    while (rest.size() > 0) {
+      capnp::FlatArrayMessageReader reader(rest);
+      size_t size = reader.getEnd() - rest.begin();
+      onMessage(partition, rest.slice(0, size));
+      rest = rest.slice(size, rest.size());
+    }
+  }
+  return true;
+}
+
+#endif
+
+} // namespace vf
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "MessageWriter.h"
+#include "capnp/message.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+namespace vf {
+
+/**
+ * @brief Run the partitions of a job in forked children, and hand the
+ * messages they write to the parent in partition order. Not available on
+ * Windows.
+ *
+ * Every child starts from a copy of the parent, so the partitions can read
+ * the Clang AST, the source manager and the caches of the serializers, none
+ * of which are thread-safe, without sharing them. A child writes its messages
+ * to a temporary file and exits without running destructors. The parent
+ * waits for all children before it hands out any message, so nothing has been
+ * handed out if a child fails.
+ *
+ * @param nbPartitions Number of partitions, and of children.
+ * @param runPartition Called in a child with the index of its partition and
+ * the writer of its messages. Returns false if the messages of the partition
+ * cannot be used, which fails the child.
+ * @param onMessage Called in the parent with the partition and the flat
+ * array of every message its child wrote, in order.
+ * @return False if a child could not be started or failed, in which case the
+ * caller has to do the work itself.
+ */
+bool runForked(
+    unsigned nbPartitions,
+    llvm::function_ref<bool(unsigned, MessageWriter &)> runPartition,
+    llvm::function_ref<void(unsigned, kj::ArrayPtr<const capnp::word>)>
+        onMessage);
+
+} // namespace vf
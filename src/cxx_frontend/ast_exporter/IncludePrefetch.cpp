@@ -0,0 +1,65 @@
+#include "IncludePrefetch.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Threading.h"
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+namespace vf {
+
+namespace {
+
+// Files are read in chunks of this many bytes, which are thrown away.
+constexpr size_t chunkSize = size_t(1) << 16;
+
+} // namespace
+
+IncludePrefetch::IncludePrefetch(std::vector<std::string> paths,
+                                 unsigned nbThreads)
+    : m_paths(std::move(paths)),
+      m_pool(llvm::hardware_concurrency(
+          std::max<unsigned>(1, std::min<size_t>(nbThreads, m_paths.size())))) {
+  for (const std::string &path : m_paths) {
+    m_pool.async([this, &path] {
+      if (!m_stopped) {
+        read(path);
+      }
+    });
+  }
+}
+
+IncludePrefetch::~IncludePrefetch() {
+  m_stopped = true;
+  m_pool.wait();
+}
+
+void IncludePrefetch::read(const std::string &path) const {
+  llvm::Expected<llvm::sys::fs::file_t> file =
+      llvm::sys::fs::openNativeFileForRead(path);
+  if (!file) {
+    llvm::consumeError(file.takeError());
+    return;
+  }
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+  posix_fadvise(*file, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  llvm::SmallVector<char, 0> buffer;
+  buffer.resize_for_overwrite(chunkSize);
+  while (!m_stopped) {
+    llvm::Expected<size_t> read =
+        llvm::sys::fs::readNativeFile(*file, buffer);
+    if (!read) {
+      llvm::consumeError(read.takeError());
+      break;
+    }
+    if (*read == 0) {
+      break;
+    }
+  }
+  llvm::sys::fs::closeFile(*file);
+}
+
+} // namespace vf
@@ -0,0 +1,48 @@
+#pragma once
+#include "llvm/Support/ThreadPool.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace vf {
+
+/**
+ * @brief Reads the files a translation unit included the last time it was
+ * exported on a pool of threads, while the preprocessor works through the
+ * same files one include directive at a time.
+ *
+ * Clang's file manager cannot be filled ahead of the preprocessor, so the
+ * files are read to bring them into the page cache of the operating system:
+ * when the preprocessor opens them, they are read from memory instead of the
+ * disk, which matters for cold runs on network or slow file systems. A file
+ * that no longer exists or cannot be read is skipped. Files not yet read when
+ * the prefetch is destroyed are skipped as well.
+ */
+class IncludePrefetch {
+public:
+  /**
+   * @brief Start reading the given files.
+   *
+   * @param paths Absolute paths of the files, in the order the preprocessor
+   * is expected to read them.
+   * @param nbThreads Number of threads that read the files.
+   */
+  IncludePrefetch(std::vector<std::string> paths, unsigned nbThreads);
+
+  IncludePrefetch(const IncludePrefetch &) = delete;
+  IncludePrefetch &operator=(const IncludePrefetch &) = delete;
+
+  /**
+   * @brief Stop reading files and wait for the files being read.
+   */
+  ~IncludePrefetch();
+
+private:
+  void read(const std::string &path) const;
+
+  std::vector<std::string> m_paths;
+  std::atomic<bool> m_stopped = false;
+  llvm::ThreadPool m_pool;
+};
+
+} // namespace vf
@@ -10,9 +10,27 @@ void Inclusion::addIncludeDirective(IncludeDirective includeDirective) {
   m_includeDirectives.push_back(includeDirective);
 }
 
-void Inclusion::addInclusion(const Inclusion *inclusion) {
+void Inclusion::addInclusion(Inclusion *inclusion) {
   assert(this != inclusion && "Inclusion cycle");
-  m_inclusions.push_back(inclusion);
+  inclusion->m_includers.push_back(this);
+  addReachable(inclusion->m_reachable);
+}
+
+void Inclusion::addReachable(const llvm::BitVector &reachable) {
+  if (reachable.subsetOf(m_reachable)) {
+    return;
+  }
+  m_reachable |= reachable;
+  for (Inclusion *includer : m_includers) {
+    includer->addReachable(m_reachable);
+  }
+}
+
+void Inclusion::addContextMacro(const clang::IdentifierInfo *name,
+                                const clang::MacroInfo *info) {
+  if (m_contextMacroSet.insert({name, info}).second) {
+    m_contextMacros.emplace_back(name, info);
+  }
 }
 
 bool Inclusion::hasMacroDefinition(
@@ -31,15 +49,8 @@ bool Inclusion::hasMacroDefinition(
 }
 
 bool Inclusion::includesFile(const clang::FileEntry *fileEntry) const {
-  if (m_fileEntry->getUID() == fileEntry->getUID()) {
-    return true;
-  }
-  for (const Inclusion *inclusion : m_inclusions) {
-    if (inclusion->includesFile(fileEntry)) {
-      return true;
-    }
-  }
-  return false;
+  unsigned uid = fileEntry->getUID();
+  return uid < m_reachable.size() && m_reachable.test(uid);
 }
 
 llvm::ArrayRef<IncludeDirective> Inclusion::getIncludeDirectives() const {
@@ -3,6 +3,8 @@
 #include "stubs_ast.capnp.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
 
 namespace vf {
@@ -25,13 +27,43 @@ struct IncludeDirective {
 
 class Inclusion {
 public:
+  using ContextMacro =
+      std::pair<const clang::IdentifierInfo *, const clang::MacroInfo *>;
+
   void addIncludeDirective(IncludeDirective directive);
 
-  void addInclusion(const Inclusion *inclusion);
+  /**
+   * @brief Add an inclusion of another file to this inclusion. The files
+   * reachable from that inclusion become reachable from this inclusion and
+   * from all inclusions that include it.
+   *
+   * @param inclusion Inclusion of the included file.
+   */
+  void addInclusion(Inclusion *inclusion);
 
   bool hasMacroDefinition(const clang::MacroDefinition &definition,
                           const clang::SourceManager &sourceManager) const;
 
+  /**
+   * @brief Record that the file of this inclusion used a macro whose
+   * definition is not reachable from this inclusion, or that is not defined.
+   * Such a use makes the file depend on the context it is included in; it is
+   * only allowed for macros that may expand regardless of their context and in
+   * trusted files.
+   *
+   * @param info Definition in effect, or null if the macro is not defined.
+   */
+  void addContextMacro(const clang::IdentifierInfo *name,
+                       const clang::MacroInfo *info);
+
+  /**
+   * @return The macros of the context that the file used, in the order of
+   * their first use.
+   */
+  llvm::ArrayRef<ContextMacro> getContextMacros() const {
+    return m_contextMacros;
+  }
+
   const clang::FileEntry *getFileEntry() const { return m_fileEntry; }
 
   llvm::ArrayRef<IncludeDirective> getIncludeDirectives() const;
@@ -39,13 +71,27 @@ public:
   size_t nbIncludeDirectives() const;
 
   explicit Inclusion(const clang::FileEntry &fileEntry)
-      : m_fileEntry(&fileEntry) {}
+      : m_reachable(fileEntry.getUID() + 1), m_fileEntry(&fileEntry) {
+    m_reachable.set(fileEntry.getUID());
+  }
 
 private:
   bool includesFile(const clang::FileEntry *fileEntry) const;
 
-  llvm::SmallVector<const Inclusion *> m_inclusions;
+  /**
+   * @brief Make the given files reachable from this inclusion and propagate
+   * the newly reachable files to the inclusions that include this one.
+   */
+  void addReachable(const llvm::BitVector &reachable);
+
+  ///< Unique identifiers of the files that are transitively included, including
+  ///< the file of this inclusion itself.
+  llvm::BitVector m_reachable;
+  ///< Inclusions that directly include this inclusion.
+  llvm::SmallVector<Inclusion *> m_includers;
   llvm::SmallVector<IncludeDirective> m_includeDirectives;
+  llvm::SmallVector<ContextMacro> m_contextMacros;
+  llvm::DenseSet<ContextMacro> m_contextMacroSet;
 
   const clang::FileEntry *m_fileEntry;
 };
@@ -1,91 +1,161 @@
 #include "InclusionSerializer.h"
+#include "Trace.h"
+#include "clang/Basic/FileEntry.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/MacroInfo.h"
 
 namespace vf {
 
 namespace {
 
-struct Directive {
-  virtual ~Directive() = default;
-
-  virtual clang::SourceRange getRange() const = 0;
-
-  virtual void
-  serialize(stubs::Include::Builder builder,
-            const InclusionSerializer &inclusionSerializer) const = 0;
+/**
+ * @brief Refers to a real or ghost include directive of a file by its index
+ * in the include directives of the inclusion or in the leading includes of the
+ * annotation manager.
+ */
+struct DirectiveRef {
+  enum class Kind : uint8_t { Real, Ghost };
+
+  clang::SourceLocation begin;
+  Kind kind;
+  unsigned index;
 };
 
-struct RealDirective : public Directive, public IncludeDirective {
-  clang::SourceRange getRange() const override { return range; }
-
-  void
-  serialize(stubs::Include::Builder builder,
-            const InclusionSerializer &inclusionSerializer) const override {
-    stubs::Include::RealInclude::Builder includeBuilder =
-        builder.initRealInclude();
-
-    includeBuilder.setFd(fileUID);
-    includeBuilder.setFileName(fileName);
-    includeBuilder.setIsAngled(isAngled);
-    inclusionSerializer.getASTSerializer().serialize(includeBuilder.initLoc(),
-                                                     range);
-
-    const Inclusion &inclusionOfDirective =
-        inclusionSerializer.getInclusionContext().getInclusionOfFileUID(
-            fileUID);
-
-    ListBuilder<stubs::Include> includesBuilder = includeBuilder.initIncludes(
-        inclusionOfDirective.nbIncludeDirectives() +
-        inclusionSerializer.getASTSerializer()
-            .getAnnotationManager()
-            .getLeadingIncludes(inclusionOfDirective.getFileEntry())
-            .size());
-
-    inclusionSerializer.serialize(inclusionOfDirective, includesBuilder);
+/**
+ * @brief Merges the real and ghost include directives of a file in
+ * source order. Both inputs are already sorted by their begin location.
+ */
+void getDirectives(llvm::ArrayRef<IncludeDirective> realDirectives,
+                   AnnotationsRef ghostDirectives,
+                   llvm::SmallVectorImpl<DirectiveRef> &directives) {
+  directives.clear();
+  directives.reserve(realDirectives.size() + ghostDirectives.size());
+
+  unsigned r(0), g(0);
+  while (r < realDirectives.size() || g < ghostDirectives.size()) {
+    if (g == ghostDirectives.size() ||
+        (r < realDirectives.size() &&
+         realDirectives[r].range.getBegin() <
+             ghostDirectives[g].getRange().getBegin())) {
+      directives.push_back({realDirectives[r].range.getBegin(),
+                            DirectiveRef::Kind::Real, r});
+      ++r;
+    } else {
+      directives.push_back({ghostDirectives[g].getRange().getBegin(),
+                            DirectiveRef::Kind::Ghost, g});
+      ++g;
+    }
   }
+}
 
-  RealDirective(const IncludeDirective &directive)
-      : IncludeDirective(directive) {}
-};
+void serializeRealDirective(const IncludeDirective &directive,
+                            stubs::Include::Builder builder,
+                            const InclusionSerializer &inclusionSerializer) {
+  stubs::Include::RealInclude::Builder includeBuilder =
+      builder.initRealInclude();
+
+  includeBuilder.setFd(
+      inclusionSerializer.getASTSerializer().getFileIds().fd(
+          directive.fileUID));
+  includeBuilder.setFileName(directive.fileName);
+  includeBuilder.setIsAngled(directive.isAngled);
+  inclusionSerializer.getASTSerializer().serialize(includeBuilder.initLoc(),
+                                                   directive.range);
+
+  includeBuilder.setInclusion(
+      inclusionSerializer.getInclusionIndex(directive.fileUID));
+}
 
-struct GhostDirective : public Directive, public Annotation {
-  clang::SourceRange getRange() const override {
-    return Annotation::getRange();
-  }
+} // namespace
 
-  void
-  serialize(stubs::Include::Builder builder,
-            const InclusionSerializer &inclusionSerializer) const override {
-    inclusionSerializer.getASTSerializer().serialize(builder.initGhostInclude(),
-                                                     *this);
+void InclusionSerializer::indexInclusions(const Inclusion &root) {
+  // The table itself is the work list: directives of entries that are not
+  // visited yet may still add new entries.
+  size_t first = m_indexedInclusions.size();
+  auto visit = [this](const Inclusion &inclusion) {
+    for (const IncludeDirective &directive :
+         inclusion.getIncludeDirectives()) {
+      auto [it, inserted] = m_inclusionIndices.try_emplace(
+          directive.fileUID, m_indexedInclusions.size());
+      if (inserted) {
+        m_indexedInclusions.push_back(
+            &m_context->getInclusionOfFileUID(directive.fileUID));
+      }
+    }
+  };
+  visit(root);
+  for (size_t i = first; i < m_indexedInclusions.size(); ++i) {
+    visit(*m_indexedInclusions[i]);
   }
+}
 
-  GhostDirective(const Annotation &directive) : Annotation(directive) {}
-};
-
-void getDirectives(
-    const Inclusion &inclusion, const AnnotationManager &annotationManager,
-    llvm::SmallVectorImpl<std::unique_ptr<Directive>> &directives) {
-  llvm::ArrayRef<IncludeDirective> realDirectives =
-      inclusion.getIncludeDirectives();
-  AnnotationsRef ghostDirectives =
-      annotationManager.getLeadingIncludes(inclusion.getFileEntry());
+void InclusionSerializer::serializeIndexedInclusions(
+    ListBuilder<stubs::Inclusion> builder) const {
+  assert(builder.size() == m_indexedInclusions.size() &&
+         "Target builder has wrong size");
+  size_t i(0);
+  for (const Inclusion *inclusion : m_indexedInclusions) {
+    stubs::Inclusion::Builder inclusionBuilder = builder[i++];
+    inclusionBuilder.setFd(
+        m_serializer->getFileIds().fd(*inclusion->getFileEntry()));
+    serialize(*inclusion,
+              inclusionBuilder.initIncludes(nbDirectives(*inclusion)));
+    if (std::optional<llvm::MD5::MD5Result> context =
+            contextDigest(*inclusion)) {
+      inclusionBuilder.setContext(
+          kj::arrayPtr(context->data(), context->size()));
+    }
+  }
+}
 
-  directives.clear();
-  directives.reserve(realDirectives.size() + ghostDirectives.size());
-  for (const IncludeDirective &directive : realDirectives) {
-    directives.emplace_back(std::make_unique<RealDirective>(directive));
+std::optional<llvm::MD5::MD5Result>
+InclusionSerializer::contextDigest(const Inclusion &inclusion) const {
+  llvm::ArrayRef<Inclusion::ContextMacro> macros =
+      inclusion.getContextMacros();
+  if (macros.empty()) {
+    return {};
   }
-  for (const Annotation &directive : ghostDirectives) {
-    directives.emplace_back(std::make_unique<GhostDirective>(directive));
+  const clang::ASTContext &astContext = m_serializer->getASTContext();
+  llvm::MD5 hash;
+  for (auto [name, info] : macros) {
+    hash.update(name->getName());
+    if (!info) {
+      hash.update(llvm::StringRef("\0undefined", 10));
+      continue;
+    }
+    hash.update(llvm::StringRef("\0", 1));
+    if (info->isFunctionLike()) {
+      hash.update("(");
+      for (const clang::IdentifierInfo *param : info->params()) {
+        hash.update(param->getName());
+        hash.update(",");
+      }
+      hash.update(info->isVariadic() ? "...)" : ")");
+    }
+    for (const clang::Token &token : info->tokens()) {
+      hash.update(" ");
+      hash.update(clang::Lexer::getSpelling(token, astContext.getSourceManager(),
+                                            astContext.getLangOpts()));
+    }
+    hash.update(llvm::StringRef("\0", 1));
   }
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  return result;
+}
 
-  llvm::sort(directives, [](const std::unique_ptr<Directive> &d1,
-                            const std::unique_ptr<Directive> &d2) {
-    return d1->getRange().getBegin() < d2->getRange().getBegin();
-  });
+uint32_t InclusionSerializer::getInclusionIndex(unsigned fileUID) const {
+  auto it = m_inclusionIndices.find(fileUID);
+  assert(it != m_inclusionIndices.end() && "Inclusion was not indexed");
+  return it->getSecond();
 }
 
-} // namespace
+size_t InclusionSerializer::nbDirectives(const Inclusion &inclusion) const {
+  return inclusion.nbIncludeDirectives() +
+         m_serializer->getAnnotationManager()
+             .getLeadingIncludes(inclusion.getFileEntry())
+             .size();
+}
 
 clang::SourceLocation InclusionSerializer::getFirstDeclLocInFile(
     const clang::FileEntry *fileEntry) const {
@@ -98,15 +168,21 @@ clang::SourceLocation InclusionSerializer::getFirstDeclLocInFile(
 
 void InclusionSerializer::serialize(const Inclusion &inclusion,
                                     ListBuilder<stubs::Include> builder) const {
-  llvm::SmallVector<std::unique_ptr<Directive>> directives;
-  getDirectives(inclusion, m_serializer->getAnnotationManager(), directives);
+  VF_TRACE_SCOPE("SerializeInclusion", inclusion.getFileEntry()->getName());
+  llvm::ArrayRef<IncludeDirective> realDirectives =
+      inclusion.getIncludeDirectives();
+  AnnotationsRef ghostDirectives =
+      m_serializer->getAnnotationManager().getLeadingIncludes(
+          inclusion.getFileEntry());
+  llvm::SmallVector<DirectiveRef> directives;
+  getDirectives(realDirectives, ghostDirectives, directives);
 
   assert(directives.size() == builder.size() &&
          "Target builder has wrong size");
 
   std::optional<clang::SourceLocation> lastDirectiveLoc =
       directives.empty() ? clang::SourceLocation()
-                         : directives.back()->getRange().getBegin();
+                         : directives.back().begin;
   std::optional<clang::SourceLocation> firstDeclLoc =
       getFirstDeclLocInFile(inclusion.getFileEntry());
 
@@ -122,8 +198,14 @@ void InclusionSerializer::serialize(const Inclusion &inclusion,
   }
 
   size_t i(0);
-  for (const std::unique_ptr<Directive> &directive : directives) {
-    directive->serialize(builder[i++], *this);
+  for (const DirectiveRef &directive : directives) {
+    if (directive.kind == DirectiveRef::Kind::Real) {
+      serializeRealDirective(realDirectives[directive.index], builder[i++],
+                             *this);
+    } else {
+      m_serializer->serialize(builder[i++].initGhostInclude(),
+                              ghostDirectives[directive.index]);
+    }
   }
 }
 
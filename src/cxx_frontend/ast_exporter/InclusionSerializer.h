@@ -2,12 +2,17 @@
 #include "ASTSerializer.h"
 #include "InclusionContext.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/MD5.h"
+#include <optional>
 
 namespace vf {
 
 /**
  * @brief Specialized serializer for inclusions.
- * 
+ *
+ * Every included file is serialized once into the inclusion table of the
+ * translation unit; include directives refer to it by index. Call
+ * @ref indexInclusions before serializing any directive.
  */
 class InclusionSerializer
     : public Serializer<const Inclusion &, ListBuilder<stubs::Include>> {
@@ -22,17 +27,50 @@ public:
       : m_serializer(&serializer), m_context(&context),
         m_firstDeclLocMap(&firstDeclLocMap) {}
 
+  /**
+   * @brief Assigns a table index to every file that is transitively included
+   * by @p root.
+   */
+  void indexInclusions(const Inclusion &root);
+
+  size_t nbIndexedInclusions() const { return m_indexedInclusions.size(); }
+
+  /**
+   * @brief Serializes the directives of every indexed file, in index order.
+   */
+  void serializeIndexedInclusions(ListBuilder<stubs::Inclusion> builder) const;
+
+  /**
+   * @return the index of the file with unique id @p fileUID in the inclusion
+   * table.
+   */
+  uint32_t getInclusionIndex(unsigned fileUID) const;
+
+  /**
+   * @return the number of real and ghost include directives in @p inclusion.
+   */
+  size_t nbDirectives(const Inclusion &inclusion) const;
+
   const ASTSerializer &getASTSerializer() const { return *m_serializer; }
 
   const InclusionContext &getInclusionContext() const { return *m_context; }
 
 private:
+  /**
+   * @brief Digest of the macros of the context that the file of @p inclusion
+   * used, see Inclusion::addContextMacro, or nothing if it used none.
+   */
+  std::optional<llvm::MD5::MD5Result>
+  contextDigest(const Inclusion &inclusion) const;
+
   clang::SourceLocation
   getFirstDeclLocInFile(const clang::FileEntry *fileEntry) const;
 
   const ASTSerializer *m_serializer;
   const InclusionContext *m_context;
   const llvm::SmallDenseMap<unsigned, clang::SourceLocation> *m_firstDeclLocMap;
+  llvm::DenseMap<unsigned, uint32_t> m_inclusionIndices;
+  llvm::SmallVector<const Inclusion *> m_indexedInclusions;
 };
 
 } // namespace vf
\ No newline at end of file
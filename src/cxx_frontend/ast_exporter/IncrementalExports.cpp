@@ -0,0 +1,54 @@
+#include "IncrementalExports.h"
+#include "capnp/message.h"
+#include "llvm/Support/xxhash.h"
+
+namespace vf {
+
+namespace {
+
+uint64_t hashNode(stubs::Node<stubs::Decl>::Reader node) {
+  kj::Array<capnp::word> words = capnp::canonicalize(node);
+  kj::ArrayPtr<const kj::byte> bytes = words.asBytes();
+  return llvm::xxh3_64bits(
+      llvm::ArrayRef<uint8_t>(bytes.begin(), bytes.size()));
+}
+
+} // namespace
+
+size_t IncrementalExports::reuse(llvm::StringRef sourcePath,
+                                 stubs::TU::Builder tu) {
+  llvm::StringMap<FileNodes> &previousFiles = m_results[sourcePath];
+  llvm::StringMap<FileNodes> files;
+  size_t nbReused = 0;
+
+  for (stubs::File::Builder file : tu.getFiles()) {
+    llvm::StringRef path(file.getPath().cStr());
+    auto previousIt = previousFiles.find(path);
+    const FileNodes *previous =
+        previousIt != previousFiles.end() ? &previousIt->second : nullptr;
+    FileNodes &current = files[path];
+
+    uint32_t i = 0;
+    for (stubs::Node<stubs::Decl>::Builder node : file.getDecls()) {
+      uint64_t hash = hashNode(node.asReader());
+      // Identical nodes of one file are all replaced by the first of them.
+      current.try_emplace(hash, i);
+      if (previous) {
+        auto it = previous->find(hash);
+        if (it != previous->end()) {
+          // Dropping the orphan zeroes the node, which packs to almost
+          // nothing.
+          node.disownDesc();
+          node.initDesc().setReused(it->second);
+          ++nbReused;
+        }
+      }
+      ++i;
+    }
+  }
+
+  previousFiles = std::move(files);
+  return nbReused;
+}
+
+} // namespace vf
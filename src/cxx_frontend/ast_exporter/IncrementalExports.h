@@ -0,0 +1,44 @@
+#pragma once
+#include "stubs_ast.capnp.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace vf {
+
+/**
+ * @brief Top-level declaration nodes of the results that were written for
+ * every source file in server mode, so a later result for the same source
+ * file only has to carry the nodes that changed.
+ *
+ * Nodes are identified by a hash of their canonical encoding, which includes
+ * their locations, types and names. A node is therefore only reused if it
+ * would be exported exactly the same, regardless of what changed elsewhere in
+ * the translation unit.
+ */
+class IncrementalExports {
+public:
+  /**
+   * @brief Replace every top-level node of a translation unit that is
+   * identical to a node of the same file in the previous result for the same
+   * source file by a `Decl.reused` reference to that node, and remember the
+   * nodes of this result for the next one.
+   *
+   * The translation unit must not use location, name or type tables, since
+   * the entries they refer to differ between results.
+   *
+   * @param sourcePath Main file of the translation unit.
+   * @param tu Serialized translation unit.
+   * @return Number of nodes that were replaced.
+   */
+  size_t reuse(llvm::StringRef sourcePath, stubs::TU::Builder tu);
+
+private:
+  ///< Index of every node hash in the declarations of a file.
+  using FileNodes = llvm::DenseMap<uint64_t, uint32_t>;
+
+  ///< Nodes of the previous result of every source file, by file path.
+  llvm::StringMap<llvm::StringMap<FileNodes>> m_results;
+};
+
+} // namespace vf
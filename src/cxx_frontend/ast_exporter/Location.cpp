@@ -3,10 +3,19 @@
 #include "clang/AST/StmtVisitor.h"
 #include "clang/AST/TypeLocVisitor.h"
 #include "clang/Lex/Lexer.h"
+#include <algorithm>
+#include <cassert>
 
 namespace vf {
 
 void Location::serialize(stubs::Loc::SrcPos::Builder builder) const {
+  assert(isCompact() && "Location does not fit in a SrcPos");
+  builder.setL(line);
+  builder.setC(column);
+  builder.setFd(uid);
+}
+
+void Location::serialize(stubs::Loc::SrcPos32::Builder builder) const {
   builder.setL(line);
   builder.setC(column);
   builder.setFd(uid);
@@ -35,6 +44,85 @@ ofSourceLocation(clang::SourceLocation loc,
   return std::make_optional<Location>(line, col, uid);
 }
 
+namespace {
+
+// Forward distance up to which scanning the buffer is preferred over a binary
+// search in the line table.
+constexpr unsigned maxForwardScan = 16 * 1024;
+
+} // namespace
+
+std::pair<unsigned, unsigned> LineResolver::resolve(clang::FileID fileID,
+                                                    unsigned offset) {
+  Cursor &cursor = m_cursors.try_emplace(fileID, Cursor{0, 1, 0}).first->second;
+
+  if (offset < cursor.lineStart ||
+      (offset > cursor.offset && offset - cursor.offset > maxForwardScan)) {
+    return resolveSlow(fileID, offset, cursor);
+  }
+
+  if (offset > cursor.offset) {
+    bool invalid = false;
+    llvm::StringRef buffer = m_sourceManager->getBufferData(fileID, &invalid);
+    if (invalid || offset > buffer.size()) {
+      return resolveSlow(fileID, offset, cursor);
+    }
+
+    // Line endings are counted the same way as the line table of the source
+    // manager does: '\n', '\r' and "\r\n" each end one line.
+    const char *data = buffer.data();
+    for (unsigned i = cursor.offset; i < offset; ++i) {
+      char c = data[i];
+      if (c != '\n' && c != '\r') {
+        continue;
+      }
+      if (c == '\r' && i + 1 < buffer.size() && data[i + 1] == '\n') {
+        if (i + 1 == offset) {
+          // The offset points at the '\n' of a "\r\n" pair, which the line
+          // table attributes to the current line.
+          break;
+        }
+        ++i;
+      }
+      ++cursor.line;
+      cursor.lineStart = i + 1;
+    }
+  }
+
+  cursor.offset = std::max(cursor.offset, offset);
+  return {cursor.line, offset - cursor.lineStart + 1};
+}
+
+std::pair<unsigned, unsigned>
+LineResolver::resolveSlow(clang::FileID fileID, unsigned offset,
+                          Cursor &cursor) {
+  unsigned line = m_sourceManager->getLineNumber(fileID, offset);
+  unsigned col = m_sourceManager->getColumnNumber(fileID, offset);
+  cursor = Cursor{offset, line, offset - (col - 1)};
+  return {line, col};
+}
+
+std::optional<Location>
+ofSourceLocation(clang::SourceLocation loc,
+                 const clang::SourceManager &sourceManager,
+                 LineResolver &lineResolver) {
+  if (loc.isInvalid()) {
+    return {};
+  }
+
+  std::pair<clang::FileID, unsigned> locPair =
+      sourceManager.getDecomposedLoc(sourceManager.getSpellingLoc(loc));
+  const clang::FileEntry *fileEntry =
+      sourceManager.getFileEntryForID(locPair.first);
+
+  if (!fileEntry) {
+    return {};
+  }
+
+  auto [line, col] = lineResolver.resolve(locPair.first, locPair.second);
+  return std::make_optional<Location>(line, col, fileEntry->getUID());
+}
+
 std::optional<Range> ofSourceRange(clang::SourceRange range,
                                    const clang::SourceManager &sourceManager) {
   if (range.isInvalid()) {
@@ -105,14 +193,11 @@ struct ExprRangeVisitor
 struct TypeLocRangeVisitor
     : public clang::TypeLocVisitor<TypeLocRangeVisitor, clang::SourceRange> {};
 
-DeclRangeVisitor declRangeVisitor;
-StmtRangeVisitor stmtRangeVisitor;
-ExprRangeVisitor exprRangeVisitor;
-TypeLocRangeVisitor typeLocRangeVisitor;
-
-template <typename Node, typename Visitor>
-clang::SourceRange getRange(const Node *node, Visitor &visitor) {
-  clang::SourceRange range = visitor.Visit(node);
+// The visitors are stateless, so every call uses its own instance and
+// concurrent exports do not share any.
+template <typename Visitor, typename Node>
+clang::SourceRange getRange(const Node *node) {
+  clang::SourceRange range = Visitor().Visit(node);
   if (range.isInvalid()) {
     return node->getSourceRange();
   }
@@ -125,25 +210,25 @@ clang::SourceRange getRange(const clang::Decl *decl) {
   if (!decl || decl->isImplicit()) {
     return {};
   }
-  return getRange(decl, declRangeVisitor);
+  return getRange<DeclRangeVisitor>(decl);
 }
 
 clang::SourceRange getRange(const clang::Stmt *stmt) {
   if (!stmt) {
     return {};
   }
-  return getRange(stmt, stmtRangeVisitor);
+  return getRange<StmtRangeVisitor>(stmt);
 }
 
 clang::SourceRange getRange(const clang::Expr *expr) {
   if (!expr) {
     return {};
   }
-  return getRange(expr, exprRangeVisitor);
+  return getRange<ExprRangeVisitor>(expr);
 }
 
 clang::SourceRange getRange(clang::TypeLoc typeLoc) {
-  clang::SourceRange range = typeLocRangeVisitor.Visit(typeLoc);
+  clang::SourceRange range = TypeLocRangeVisitor().Visit(typeLoc);
   if (range.isInvalid()) {
     return typeLoc.getSourceRange();
   }
@@ -159,6 +244,23 @@ fileEntryOfLoc(clang::SourceLocation loc,
   return sourceManager.getFileEntryForID(id);
 }
 
+const clang::FileEntry *
+FileEntryCache::fileEntryOfLoc(clang::SourceLocation loc) {
+  clang::SourceLocation expansionLoc =
+      loc.isFileID() ? loc : m_sourceManager->getExpansionLoc(loc);
+  unsigned rawLoc = expansionLoc.getRawEncoding();
+  if (m_begin <= rawLoc && rawLoc <= m_end) {
+    return m_entry;
+  }
+
+  clang::FileID id = m_sourceManager->getFileID(expansionLoc);
+  m_entry = m_sourceManager->getFileEntryForID(id);
+  // The end of file location is part of the file as well.
+  m_begin = m_sourceManager->getLocForStartOfFile(id).getRawEncoding();
+  m_end = m_begin + m_sourceManager->getFileIDSize(id);
+  return m_entry;
+}
+
 clang::Token getNextToken(clang::SourceLocation loc,
                           const clang::SourceManager &sourceManager,
                           const clang::LangOptions &langOpts) {
@@ -7,13 +7,18 @@
 #include "clang/AST/TypeLoc.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include <cstdint>
 #include <optional>
+#include <utility>
 
 namespace vf {
 
 /**
  * @brief Location consisting of a line, column and unique identifier. The
- * unique identifier refers to the file the location is originating from.
+ * unique identifier refers to the file the location is originating from. The
+ * `LocationSerializer` replaces it with the file's identifier in the output,
+ * see `FileIds`.
  *
  */
 struct Location {
@@ -21,8 +26,18 @@ struct Location {
   unsigned column;
   unsigned uid;
 
+  /**
+   * @brief Whether the line, column and unique identifier all fit in the
+   * 16-bit fields of a `SrcPos`.
+   */
+  bool isCompact() const {
+    return line <= UINT16_MAX && column <= UINT16_MAX && uid <= UINT16_MAX;
+  }
+
   void serialize(stubs::Loc::SrcPos::Builder builder) const;
 
+  void serialize(stubs::Loc::SrcPos32::Builder builder) const;
+
   Location(unsigned line, unsigned column, unsigned uid)
       : line(line), column(column), uid(uid) {}
 };
@@ -34,10 +49,59 @@ struct Range {
   Range(Location begin, Location end) : begin(begin), end(end) {}
 };
 
+/**
+ * @brief Resolves file offsets to line and column numbers. Remembers the last
+ * resolved position of every file, so that offsets at or after it are found
+ * by scanning forward from there instead of by a binary search over the line
+ * table of the file. Declarations and statements are mostly visited in source
+ * order, which makes the common case amortized constant time.
+ *
+ */
+class LineResolver {
+public:
+  explicit LineResolver(const clang::SourceManager &sourceManager)
+      : m_sourceManager(&sourceManager) {}
+
+  /**
+   * @brief Resolves an offset in a file to its line and column number.
+   *
+   * @param fileID File the offset refers to
+   * @param offset Offset in the file
+   * @return Pair of the 1-based line and column number
+   */
+  std::pair<unsigned, unsigned> resolve(clang::FileID fileID, unsigned offset);
+
+private:
+  struct Cursor {
+    unsigned offset;    ///< Last resolved offset.
+    unsigned line;      ///< Line of the last resolved offset.
+    unsigned lineStart; ///< Offset of the first character of that line.
+  };
+
+  /**
+   * @brief Resolves an offset through the line table of the source manager
+   * and resets the cursor of the file to it.
+   */
+  std::pair<unsigned, unsigned> resolveSlow(clang::FileID fileID,
+                                            unsigned offset, Cursor &cursor);
+
+  const clang::SourceManager *m_sourceManager;
+  llvm::DenseMap<clang::FileID, Cursor> m_cursors;
+};
+
 std::optional<Location>
 ofSourceLocation(clang::SourceLocation loc,
                  const clang::SourceManager &sourceManager);
 
+/**
+ * @brief Same as ofSourceLocation, but resolves line and column numbers
+ * through the given resolver.
+ */
+std::optional<Location>
+ofSourceLocation(clang::SourceLocation loc,
+                 const clang::SourceManager &sourceManager,
+                 LineResolver &lineResolver);
+
 std::optional<Range> ofSourceRange(clang::SourceRange range,
                                    const clang::SourceManager &sourceManager);
 
@@ -53,6 +117,41 @@ const clang::FileEntry *
 fileEntryOfLoc(clang::SourceLocation loc,
                const clang::SourceManager &sourceManager);
 
+/**
+ * @brief Cache for `fileEntryOfLoc`. It remembers the range of locations of
+ * the file of the previous lookup, so a location in that file is looked up
+ * with two comparisons instead of searching the files of the source manager.
+ *
+ */
+class FileEntryCache {
+public:
+  explicit FileEntryCache(const clang::SourceManager &sourceManager)
+      : m_sourceManager(&sourceManager) {}
+
+  /**
+   * @brief Same as `fileEntryOfLoc`.
+   */
+  const clang::FileEntry *fileEntryOfLoc(clang::SourceLocation loc);
+
+  /**
+   * @brief Raw encoding of the first location of the file of the previous
+   * lookup.
+   */
+  unsigned fileBegin() const { return m_begin; }
+
+  /**
+   * @brief Raw encoding of the end of file location of the file of the
+   * previous lookup.
+   */
+  unsigned fileEnd() const { return m_end; }
+
+private:
+  const clang::SourceManager *m_sourceManager;
+  unsigned m_begin = 1; ///< Raw encoding of the start of the cached file.
+  unsigned m_end = 0;   ///< Raw encoding of the end of the cached file.
+  const clang::FileEntry *m_entry = nullptr; ///< Entry of the cached file.
+};
+
 clang::Token getNextToken(clang::SourceLocation loc,
                           const clang::SourceManager &sourceManager,
                           const clang::LangOptions &langOpts);
@@ -1,13 +1,23 @@
 #include "LocationSerializer.h"
-#include "Location.h"
 #include "clang/Lex/Lexer.h"
 
 namespace vf {
 
-void serializeSourcePos(stubs::Loc::SrcPos::Builder builder, Location loc) {
-  loc.serialize(builder);
+namespace {
+
+template <typename LexedBuilder>
+void serializeLexed(LexedBuilder builder, const std::optional<Location> &begin,
+                    const std::optional<Location> &end) {
+  if (begin) {
+    begin->serialize(builder.initStart());
+  }
+  if (end) {
+    end->serialize(builder.initEnd());
+  }
 }
 
+} // namespace
+
 void LocationSerializer::serialize(clang::SourceRange range,
                                    stubs::Loc::Builder builder) const {
   auto begin = range.getBegin();
@@ -16,8 +26,6 @@ void LocationSerializer::serialize(clang::SourceRange range,
   // Range comes from macro expansion of one token
   if (begin == end && begin.isMacroID()) {
     stubs::Loc::MacroExp::Builder expBuilder = builder.initMacroExp();
-    stubs::Loc::Builder callSiteBuilder = expBuilder.initCallSite();
-    stubs::Loc::Builder bodyTokenBuilder = expBuilder.initBodyToken();
 
     // Argument expansion from function-like macro
     if (m_sourceManager->isMacroArgExpansion(begin)) {
@@ -25,7 +33,8 @@ void LocationSerializer::serialize(clang::SourceRange range,
           m_sourceManager->getImmediateExpansionRange(begin).getBegin();
 
       serializeMacroArgCallStack(
-          m_sourceManager->getImmediateExpansionRange(begin), callSiteBuilder);
+          m_sourceManager->getImmediateExpansionRange(begin), expBuilder);
+      stubs::Loc::Builder bodyTokenBuilder = expBuilder.initBodyToken();
 
       stubs::Loc::MacroParamExp::Builder paramExpBuilder =
           bodyTokenBuilder.initMacroParamExp();
@@ -41,34 +50,50 @@ void LocationSerializer::serialize(clang::SourceRange range,
 
     // Simple expansion
     serialize(m_sourceManager->getImmediateMacroCallerLoc(begin),
-              callSiteBuilder);
-    serialize(m_sourceManager->getSpellingLoc(begin), bodyTokenBuilder);
+              expBuilder.initCallSite());
+    serialize(m_sourceManager->getSpellingLoc(begin),
+              expBuilder.initBodyToken());
     return;
   }
 
   // Range represents one token not coming from a macro expansion, multiple
   // tokens or concatenation of macro tokens
-  serializeLexedSourceRange(range, builder.initLexed());
+  serializeLexedSourceRange(range, builder);
 }
 
 void LocationSerializer::serializeLexedSourceRange(
-    clang::SourceRange range, stubs::Loc::Lexed::Builder builder) const {
-  clang::CharSourceRange charRange =
-      clang::Lexer::getAsCharRange(range, *m_sourceManager, *m_langOpts);
-  std::optional<Location> beginOpt =
-      ofSourceLocation(charRange.getBegin(), *m_sourceManager);
-  std::optional<Location> endOpt =
-      ofSourceLocation(charRange.getEnd(), *m_sourceManager);
-
-  if (beginOpt) {
-    serializeSourcePos(builder.initStart(), *beginOpt);
-  }
-  if (endOpt) {
-    serializeSourcePos(builder.initEnd(), *endOpt);
+    clang::SourceRange range, stubs::Loc::Builder builder) const {
+  clang::CharSourceRange charRange = getCharRange(range);
+  std::optional<Location> beginOpt = resolve(charRange.getBegin());
+  std::optional<Location> endOpt = resolve(charRange.getEnd());
+
+  // Only positions that do not fit in 16-bit fields pay for the wide form.
+  if ((!beginOpt || beginOpt->isCompact()) &&
+      (!endOpt || endOpt->isCompact())) {
+    serializeLexed(builder.initLexed(), beginOpt, endOpt);
+  } else {
+    serializeLexed(builder.initLexed32(), beginOpt, endOpt);
   }
 }
 
 void LocationSerializer::serializeMacroArgCallStack(
+    clang::CharSourceRange range,
+    stubs::Loc::MacroExp::Builder expBuilder) const {
+  clang::SourceLocation::UIntTy key = range.getBegin().getRawEncoding();
+  auto it = m_callStackCache.find(key);
+  if (it == m_callStackCache.end()) {
+    if (!m_callStackArena) {
+      m_callStackArena = std::make_unique<CountingMessageBuilder>();
+    }
+    capnp::Orphan<stubs::Loc> callStack =
+        m_callStackArena->getOrphanage().newOrphan<stubs::Loc>();
+    serializeMacroArgCallStackTo(range, callStack.get());
+    it = m_callStackCache.try_emplace(key, kj::mv(callStack)).first;
+  }
+  expBuilder.setCallSite(it->second.getReader());
+}
+
+void LocationSerializer::serializeMacroArgCallStackTo(
     clang::CharSourceRange range, stubs::Loc::Builder builder) const {
   clang::SourceLocation begin = range.getBegin();
   clang::CharSourceRange expRange =
@@ -80,15 +105,39 @@ void LocationSerializer::serializeMacroArgCallStack(
   // Traverse stack of macro calls recursively
   if (expRange.getBegin().isMacroID()) {
     stubs::Loc::MacroExp::Builder expBuilder = builder.initMacroExp();
-    stubs::Loc::Builder callSiteBuilder = expBuilder.initCallSite();
-    stubs::Loc::Builder bodyTokenBuilder = expBuilder.initBodyToken();
 
-    serializeMacroArgCallStack(expRange, callSiteBuilder);
+    serializeMacroArgCallStack(expRange, expBuilder);
     serializeLexedSourceRange(immediateMacroCallerLoc,
-                              bodyTokenBuilder.initLexed());
+                              expBuilder.initBodyToken());
     return;
   }
 
-  serializeLexedSourceRange(immediateMacroCallerLoc, builder.initLexed());
+  serializeLexedSourceRange(immediateMacroCallerLoc, builder);
+}
+
+std::optional<Location>
+LocationSerializer::resolve(clang::SourceLocation loc) const {
+  auto [it, inserted] = m_locationCache.try_emplace(loc.getRawEncoding());
+  if (inserted) {
+    it->second = ofSourceLocation(loc, *m_sourceManager, m_lineResolver);
+    if (it->second) {
+      it->second->uid = m_fileIds.fd(it->second->uid);
+    }
+  }
+  return it->second;
+}
+
+clang::CharSourceRange
+LocationSerializer::getCharRange(clang::SourceRange range) const {
+  RawRange key(range.getBegin().getRawEncoding(),
+               range.getEnd().getRawEncoding());
+  auto it = m_charRangeCache.find(key);
+  if (it != m_charRangeCache.end()) {
+    return it->second;
+  }
+  clang::CharSourceRange charRange =
+      clang::Lexer::getAsCharRange(range, *m_sourceManager, *m_langOpts);
+  m_charRangeCache.try_emplace(key, charRange);
+  return charRange;
 }
 } // namespace vf
\ No newline at end of file
@@ -1,9 +1,17 @@
 #pragma once
 
+#include "CountingMessageBuilder.h"
+#include "FileIds.h"
+#include "Location.h"
 #include "Serializer.h"
 #include "stubs_ast.capnp.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/SourceManager.h"
+#include "capnp/orphan.h"
+#include "llvm/ADT/DenseMap.h"
+#include <memory>
+#include <optional>
+#include <utility>
 
 namespace vf {
 
@@ -27,32 +35,90 @@ public:
 
   LocationSerializer(const clang::SourceManager &sourceManager,
                      const clang::LangOptions &langOpts)
-      : m_sourceManager(&sourceManager), m_langOpts(&langOpts) {}
+      : m_sourceManager(&sourceManager), m_langOpts(&langOpts),
+        m_fileIds(sourceManager), m_lineResolver(sourceManager) {}
+
+  /**
+   * @brief Numbering of the files that serialized locations refer to.
+   */
+  const FileIds &getFileIds() const { return m_fileIds; }
 
 private:
   /**
    * @brief Serialize a lexed source range. This does not check for macro
    * expansions. Token ranges are converted to source ranges that refer to the
-   * beginning and end of the corresponding token.
+   * beginning and end of the corresponding token. The range is serialized as
+   * `lexed32` instead of `lexed` if one of its positions does not fit in a
+   * `SrcPos`.
    *
    * @param range Source range to serialize
-   * @param builder Target lexed location builder to serialize to
+   * @param builder Target location builder to serialize to
    */
   void serializeLexedSourceRange(clang::SourceRange range,
-                                 stubs::Loc::Lexed::Builder builder) const;
+                                 stubs::Loc::Builder builder) const;
 
   /**
    * @brief Serialize the stack of locations through which a macro argument was
-   * called.
+   * called to the call site of a macro expansion. The stack only depends on
+   * the beginning of the range, so it is serialized once per expansion and
+   * copied for every later token of that expansion.
+   *
+   * @param range Token range of the macro argument
+   * @param expBuilder Target macro expansion builder of which the call site is
+   * set
+   */
+  void
+  serializeMacroArgCallStack(clang::CharSourceRange range,
+                             stubs::Loc::MacroExp::Builder expBuilder) const;
+
+  /**
+   * @brief Walk the stack of locations through which a macro argument was
+   * called and serialize it.
    *
    * @param range Token range of the macro argument
    * @param builder Target location builder to serialize to
    */
-  void serializeMacroArgCallStack(clang::CharSourceRange range,
-                                  stubs::Loc::Builder builder) const;
+  void serializeMacroArgCallStackTo(clang::CharSourceRange range,
+                                    stubs::Loc::Builder builder) const;
+
+  /**
+   * @brief Resolves a location to its line, column and file identifier in the
+   * output. The
+   * result is memoized per raw location encoding, because many nodes share
+   * their begin or end location with a parent or child node.
+   *
+   * @param loc Location to resolve
+   * @return Resolved location, or none if the location has no file entry
+   */
+  std::optional<Location> resolve(clang::SourceLocation loc) const;
+
+  /**
+   * @brief Converts a token range to a character range. The result is
+   * memoized per pair of raw begin and end encodings.
+   *
+   * @param range Token range to convert
+   * @return Character range spanning from the beginning of the first token to
+   * the end of the last token
+   */
+  clang::CharSourceRange getCharRange(clang::SourceRange range) const;
+
+  using RawRange =
+      std::pair<clang::SourceLocation::UIntTy, clang::SourceLocation::UIntTy>;
 
   const clang::SourceManager *m_sourceManager;
   const clang::LangOptions *m_langOpts;
+  FileIds m_fileIds;
+  mutable LineResolver m_lineResolver;
+  mutable llvm::DenseMap<clang::SourceLocation::UIntTy,
+                         std::optional<Location>>
+      m_locationCache; ///< Resolved locations by raw encoding.
+  mutable llvm::DenseMap<RawRange, clang::CharSourceRange>
+      m_charRangeCache; ///< Lexed character ranges by raw token range.
+  ///< Arena of the cached macro argument call stacks, allocated on first use.
+  mutable std::unique_ptr<CountingMessageBuilder> m_callStackArena;
+  mutable llvm::DenseMap<clang::SourceLocation::UIntTy,
+                         capnp::Orphan<stubs::Loc>>
+      m_callStackCache; ///< Macro argument call stacks by raw expansion begin.
 };
 
 } // namespace vf
\ No newline at end of file
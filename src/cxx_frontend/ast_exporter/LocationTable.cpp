@@ -0,0 +1,31 @@
+#include "LocationTable.h"
+#include <cassert>
+
+namespace vf {
+
+uint32_t LocationTable::intern(clang::SourceRange range) {
+  RawRange key(range.getBegin().getRawEncoding(),
+               range.getEnd().getRawEncoding());
+  auto [it, inserted] =
+      m_indices.try_emplace(key, static_cast<uint32_t>(m_ranges.size()));
+  if (inserted) {
+    m_ranges.push_back(range);
+  }
+  return it->second;
+}
+
+void LocationTable::serialize(const LocationSerializer &locationSerializer,
+                              ListBuilder<stubs::Loc> builder) const {
+  assert(builder.size() == m_ranges.size() && "Target builder has wrong size");
+
+  for (size_t i = 0; i < m_ranges.size(); ++i) {
+    locationSerializer.serialize(m_ranges[i], builder[i]);
+  }
+}
+
+void LocationTable::clear() {
+  m_indices.clear();
+  m_ranges.clear();
+}
+
+} // namespace vf
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "LocationSerializer.h"
+#include "Serializer.h"
+#include "stubs_ast.capnp.h"
+#include "clang/Basic/SourceLocation.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include <cstdint>
+#include <utility>
+
+namespace vf {
+
+/**
+ * @brief Table of the distinct source ranges of a message. Nodes refer to a
+ * range by its index in the table instead of embedding its full location, so
+ * that every range is serialized and translated only once, however many nodes
+ * share it.
+ *
+ */
+class LocationTable {
+public:
+  /**
+   * @brief Get the index of a range in the table, adding it if it is not in
+   * the table yet.
+   *
+   * @param range Range to intern
+   * @return Index of the range in the table
+   */
+  uint32_t intern(clang::SourceRange range);
+
+  /**
+   * @brief Serialize all ranges in the table, in the order of their indices.
+   *
+   * @param locationSerializer Serializer of the locations of the ranges
+   * @param builder Target list builder, with one element for every range
+   */
+  void serialize(const LocationSerializer &locationSerializer,
+                 ListBuilder<stubs::Loc> builder) const;
+
+  size_t size() const { return m_ranges.size(); }
+
+  void clear();
+
+private:
+  using RawRange =
+      std::pair<clang::SourceLocation::UIntTy, clang::SourceLocation::UIntTy>;
+
+  llvm::DenseMap<RawRange, uint32_t> m_indices; ///< Index of every range.
+  llvm::SmallVector<clang::SourceRange> m_ranges; ///< Ranges by index.
+};
+
+} // namespace vf
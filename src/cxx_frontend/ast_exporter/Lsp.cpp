@@ -0,0 +1,229 @@
+#include "Lsp.h"
+#include "capnp/serialize.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace vf {
+
+namespace {
+
+/**
+ * @brief Read one header line of the base protocol, without its line break.
+ *
+ * @return False if the input was closed.
+ */
+bool readHeaderLine(std::FILE *in, std::string &line) {
+  line.clear();
+  for (int c = std::getc(in); c != EOF; c = std::getc(in)) {
+    if (c == '\n') {
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      return true;
+    }
+    line.push_back(char(c));
+  }
+  return false;
+}
+
+/**
+ * @brief Range of a position of the exporter, whose lines and columns start
+ * at 1 and whose end is exclusive.
+ */
+struct SourceRange {
+  unsigned fd;
+  unsigned line, column;
+  unsigned endLine, endColumn;
+};
+
+template <class Lexed>
+std::optional<SourceRange> resolveLexed(Lexed lexed) {
+  if (!lexed.hasStart()) {
+    return {};
+  }
+  auto start = lexed.getStart();
+  SourceRange range{start.getFd(), start.getL(), start.getC(), start.getL(),
+                    start.getC()};
+  if (lexed.hasEnd() && lexed.getEnd().getFd() == start.getFd()) {
+    range.endLine = lexed.getEnd().getL();
+    range.endColumn = lexed.getEnd().getC();
+  }
+  return range;
+}
+
+/**
+ * @brief Range of a location in the file it was written in: macro expansions
+ * are reported at their call site, macro arguments at their argument token.
+ * Location table references do not occur in diagnostics.
+ */
+std::optional<SourceRange> resolve(stubs::Loc::Reader loc) {
+  switch (loc.which()) {
+  case stubs::Loc::LEXED:
+    return resolveLexed(loc.getLexed());
+  case stubs::Loc::LEXED32:
+    return resolveLexed(loc.getLexed32());
+  case stubs::Loc::MACRO_EXP:
+    return resolve(loc.getMacroExp().getCallSite());
+  case stubs::Loc::MACRO_PARAM_EXP:
+    return resolve(loc.getMacroParamExp().getArgToken());
+  default:
+    return {};
+  }
+}
+
+llvm::json::Object position(unsigned line, unsigned column) {
+  return llvm::json::Object{{"line", line > 0 ? line - 1 : 0},
+                            {"character", column > 0 ? column - 1 : 0}};
+}
+
+} // namespace
+
+std::optional<llvm::json::Object> LspConnection::read() {
+  std::string line;
+  size_t length = 0;
+  bool hasLength = false;
+  do {
+    if (!readHeaderLine(m_in, line)) {
+      return {};
+    }
+    llvm::StringRef header(line);
+    if (header.consume_front_insensitive("Content-Length:")) {
+      hasLength = !header.trim().getAsInteger(10, length);
+    }
+  } while (!line.empty());
+
+  if (!hasLength) {
+    return {};
+  }
+  std::string content(length, '\0');
+  if (std::fread(content.data(), 1, length, m_in) != length) {
+    return {};
+  }
+
+  llvm::Expected<llvm::json::Value> value = llvm::json::parse(content);
+  if (!value) {
+    llvm::errs() << "Malformed LSP message: "
+                 << llvm::toString(value.takeError()) << '\n';
+    return llvm::json::Object{};
+  }
+  if (llvm::json::Object *object = value->getAsObject()) {
+    return std::move(*object);
+  }
+  return llvm::json::Object{};
+}
+
+void LspConnection::reply(const llvm::json::Value &id,
+                          llvm::json::Value result) {
+  send(llvm::json::Object{{"id", id}, {"result", std::move(result)}});
+}
+
+void LspConnection::replyError(const llvm::json::Value &id, int code,
+                               llvm::StringRef message) {
+  send(llvm::json::Object{
+      {"id", id},
+      {"error", llvm::json::Object{{"code", code}, {"message", message}}}});
+}
+
+void LspConnection::notify(llvm::StringRef method, llvm::json::Value params) {
+  send(llvm::json::Object{{"method", method}, {"params", std::move(params)}});
+}
+
+void LspConnection::send(llvm::json::Object message) {
+  message["jsonrpc"] = "2.0";
+  std::string content;
+  llvm::raw_string_ostream(content) << llvm::json::Value(std::move(message));
+  std::fprintf(m_out, "Content-Length: %zu\r\n\r\n", content.size());
+  std::fwrite(content.data(), 1, content.size(), m_out);
+  std::fflush(m_out);
+}
+
+std::string uriToPath(llvm::StringRef uri) {
+  if (!uri.consume_front("file://")) {
+    return {};
+  }
+  std::string path;
+  for (size_t i = 0; i < uri.size(); ++i) {
+    unsigned byte;
+    if (uri[i] == '%' && i + 2 < uri.size() &&
+        !uri.substr(i + 1, 2).getAsInteger(16, byte)) {
+      path.push_back(char(byte));
+      i += 2;
+    } else {
+      path.push_back(uri[i]);
+    }
+  }
+#ifdef _WIN32
+  // file:///C:/dir
+  if (path.size() > 2 && path[0] == '/' && path[2] == ':') {
+    path.erase(0, 1);
+  }
+#endif
+  return path;
+}
+
+std::string pathToUri(llvm::StringRef path) {
+  std::string uri = "file://";
+#ifdef _WIN32
+  uri.push_back('/');
+#endif
+  for (char c : path) {
+    if (llvm::isAlnum(c) || llvm::StringRef("/-_.~:").contains(c)) {
+      uri.push_back(c);
+    } else if (c == '\\') {
+      uri.push_back('/');
+    } else {
+      uri += "%" + llvm::utohexstr(uint8_t(c), false, 2);
+    }
+  }
+  return uri;
+}
+
+llvm::json::Array diagnosticsOf(stubs::SerResult::Reader result,
+                                llvm::StringRef path) {
+  llvm::DenseMap<unsigned, llvm::StringRef> paths;
+  if (result.hasTu()) {
+    for (stubs::File::Reader file : result.getTu().getFiles()) {
+      paths[file.getFd()] = file.getPath().asString();
+    }
+  }
+
+  llvm::json::Array diagnostics;
+  for (stubs::Error::Reader error : result.getErrors()) {
+    std::string message = error.getReason();
+    std::optional<SourceRange> range;
+    if (error.hasLoc()) {
+      range = resolve(error.getLoc());
+    }
+
+    llvm::json::Object start = position(1, 1);
+    llvm::json::Object end = position(1, 1);
+    if (range && paths.lookup(range->fd) == path) {
+      start = position(range->line, range->column);
+      end = position(range->endLine, range->endColumn);
+    } else if (range) {
+      message = (paths.lookup(range->fd) + ":" + llvm::Twine(range->line) +
+                 ":" + llvm::Twine(range->column) + ": " + message)
+                    .str();
+    }
+
+    diagnostics.push_back(llvm::json::Object{
+        {"range", llvm::json::Object{{"start", std::move(start)},
+                                     {"end", std::move(end)}}},
+        {"severity", 1},
+        {"source", "vf-cxx-ast-exporter"},
+        {"message", std::move(message)}});
+  }
+  return diagnostics;
+}
+
+void ResultCapture::write(capnp::MessageBuilder &message) {
+  m_words = capnp::messageToFlatArray(message);
+}
+
+void ResultCapture::write(kj::ArrayPtr<const capnp::word> words) {
+  m_words = kj::heapArray(words);
+}
+
+} // namespace vf
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "MessageWriter.h"
+#include "stubs_ast.capnp.h"
+#include "kj/array.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include <cstdio>
+#include <optional>
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief Connection of the exporter's language server to its client, over
+ * the base protocol of the Language Server Protocol: every JSON-RPC message is
+ * preceded by a `Content-Length` header and an empty line.
+ *
+ */
+class LspConnection {
+public:
+  /**
+   * @brief Read the next message from the client.
+   *
+   * @return The message, or nothing if the input was closed or a message
+   * could not be read.
+   */
+  std::optional<llvm::json::Object> read();
+
+  /**
+   * @brief Send the result of the request with the given id.
+   */
+  void reply(const llvm::json::Value &id, llvm::json::Value result);
+
+  /**
+   * @brief Send an error response to the request with the given id.
+   */
+  void replyError(const llvm::json::Value &id, int code,
+                  llvm::StringRef message);
+
+  /**
+   * @brief Send a notification, i.e. a message that is not answered.
+   */
+  void notify(llvm::StringRef method, llvm::json::Value params);
+
+  LspConnection(std::FILE *in, std::FILE *out) : m_in(in), m_out(out) {}
+
+private:
+  void send(llvm::json::Object message);
+
+  std::FILE *m_in;
+  std::FILE *m_out;
+};
+
+/**
+ * @brief Path of a `file://` URI, or the empty string if it is not one.
+ */
+std::string uriToPath(llvm::StringRef uri);
+
+/**
+ * @brief `file://` URI of an absolute path.
+ */
+std::string pathToUri(llvm::StringRef path);
+
+/**
+ * @brief The LSP diagnostics of the errors of an export result. Errors in
+ * other files than the document, e.g. in included headers, and errors
+ * without a location are reported at the start of the document, prefixed by
+ * their file and position.
+ *
+ * @param result Result of exporting the document.
+ * @param path Absolute path of the document.
+ */
+llvm::json::Array diagnosticsOf(stubs::SerResult::Reader result,
+                                llvm::StringRef path);
+
+/**
+ * @brief Keeps the last message written to it, so the language server can
+ * read the result of an export.
+ *
+ */
+class ResultCapture : public MessageWriter {
+public:
+  void write(capnp::MessageBuilder &message) override;
+
+  void write(kj::ArrayPtr<const capnp::word> words) override;
+
+  /**
+   * @brief Flat array of the last message, empty if none was written.
+   */
+  kj::ArrayPtr<const capnp::word> words() const { return m_words.asPtr(); }
+
+private:
+  kj::Array<capnp::word> m_words;
+};
+
+} // namespace vf
@@ -0,0 +1,130 @@
+#include "MacroStats.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include <memory>
+#include <utility>
+
+namespace vf {
+
+namespace {
+
+struct MacroCounts {
+  uint64_t expansions = 0;
+  uint64_t allowed = 0;
+  uint64_t checks = 0;
+  double seconds = 0;
+};
+
+struct FileCounts {
+  uint64_t entered = 0;
+  uint64_t skipped = 0;
+};
+
+struct MacroStatsState {
+  llvm::StringMap<MacroCounts> macros;
+  llvm::StringMap<FileCounts> files;
+
+  FileCounts &of(const clang::FileEntry *entry) {
+    return files[entry ? entry->getName() : "<built-in>"];
+  }
+};
+
+std::unique_ptr<MacroStatsState> state;
+
+template <typename Counts, typename Less>
+llvm::SmallVector<const llvm::StringMapEntry<Counts> *, 64>
+topRows(const llvm::StringMap<Counts> &map, unsigned nbRows, Less less) {
+  llvm::SmallVector<const llvm::StringMapEntry<Counts> *, 64> rows;
+  for (const llvm::StringMapEntry<Counts> &entry : map) {
+    rows.push_back(&entry);
+  }
+  llvm::stable_sort(rows, [&](const auto *lhs, const auto *rhs) {
+    return less(rhs->getValue(), lhs->getValue());
+  });
+  if (rows.size() > nbRows) {
+    rows.resize(nbRows);
+  }
+  return rows;
+}
+
+} // namespace
+
+void MacroStats::countExpansion(llvm::StringRef macro, bool allowed) {
+  if (!state) {
+    return;
+  }
+  MacroCounts &counts = state->macros[macro];
+  ++counts.expansions;
+  if (allowed) {
+    ++counts.allowed;
+  }
+}
+
+void MacroStats::countCheck(llvm::StringRef macro, double seconds) {
+  if (!state) {
+    return;
+  }
+  MacroCounts &counts = state->macros[macro];
+  ++counts.checks;
+  counts.seconds += seconds;
+}
+
+void MacroStats::countEnteredFile(const clang::FileEntry *entry) {
+  if (state) {
+    ++state->of(entry).entered;
+  }
+}
+
+void MacroStats::countSkippedFile(const clang::FileEntry *entry) {
+  if (state) {
+    ++state->of(entry).skipped;
+  }
+}
+
+void MacroStats::enable() {
+  if (!state) {
+    state = std::make_unique<MacroStatsState>();
+  }
+}
+
+bool MacroStats::isEnabled() { return state != nullptr; }
+
+void MacroStats::print(llvm::raw_ostream &os, unsigned nbRows) {
+  if (!state) {
+    return;
+  }
+
+  auto macros = topRows(state->macros, nbRows,
+                        [](const MacroCounts &lhs, const MacroCounts &rhs) {
+                          return std::make_pair(lhs.seconds, lhs.expansions) <
+                                 std::make_pair(rhs.seconds, rhs.expansions);
+                        });
+  os << llvm::format("%10s %12s %10s %10s  %s\n", "seconds", "expansions",
+                     "allowed", "checks", "macro");
+  for (const llvm::StringMapEntry<MacroCounts> *macro : macros) {
+    const MacroCounts &counts = macro->getValue();
+    os << llvm::format("%10.6f %12llu %10llu %10llu  ", counts.seconds,
+                       static_cast<unsigned long long>(counts.expansions),
+                       static_cast<unsigned long long>(counts.allowed),
+                       static_cast<unsigned long long>(counts.checks))
+       << macro->getKey() << '\n';
+  }
+
+  auto files = topRows(state->files, nbRows,
+                       [](const FileCounts &lhs, const FileCounts &rhs) {
+                         return lhs.entered + lhs.skipped <
+                                rhs.entered + rhs.skipped;
+                       });
+  os << llvm::format("%10s %10s  %s\n", "entered", "skipped", "file");
+  for (const llvm::StringMapEntry<FileCounts> *file : files) {
+    const FileCounts &counts = file->getValue();
+    os << llvm::format("%10llu %10llu  ",
+                       static_cast<unsigned long long>(counts.entered),
+                       static_cast<unsigned long long>(counts.skipped))
+       << file->getKey() << '\n';
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,60 @@
+#pragma once
+#include "clang/Basic/FileEntry.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace vf {
+
+/**
+ * @brief Statistics of the context-free macro checks, as reported by
+ * `-macro_stats`: for every macro, its expansions, how many of them were
+ * allowed without a check, and the visibility checks of its definitions with
+ * the time they took; for every header, how often the preprocessor entered it
+ * and how often it skipped it because of its header guard.
+ *
+ * Macros are identified by their name and headers by their path, so the
+ * numbers add up over all translation units. Nothing is recorded unless the
+ * report is enabled, and it must only be enabled when a single thread exports.
+ */
+class MacroStats {
+public:
+  /**
+   * @brief Count an expansion of a macro.
+   *
+   * @param allowed Whether the macro is whitelisted or a frontend macro, so
+   * the expansion is not checked.
+   */
+  static void countExpansion(llvm::StringRef macro, bool allowed);
+
+  /**
+   * @brief Count a check whether a definition of a macro is visible from the
+   * current inclusion, which looks up the file of the definition among the
+   * files the inclusion includes.
+   *
+   * @param seconds Time the check took.
+   */
+  static void countCheck(llvm::StringRef macro, double seconds);
+
+  /**
+   * @brief Count that the preprocessor entered a file.
+   */
+  static void countEnteredFile(const clang::FileEntry *entry);
+
+  /**
+   * @brief Count that the preprocessor skipped an included file because of
+   * its header guard.
+   */
+  static void countSkippedFile(const clang::FileEntry *entry);
+
+  static void enable();
+
+  static bool isEnabled();
+
+  /**
+   * @brief Print the given number of macros whose checks took the most time
+   * and of headers that were entered or skipped most often.
+   */
+  static void print(llvm::raw_ostream &os, unsigned nbRows);
+};
+
+} // namespace vf
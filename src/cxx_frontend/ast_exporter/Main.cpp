@@ -0,0 +1,3 @@
+#include "vf_export.h"
+
+int main(int argc, const char **argv) { return vf_export_main(argc, argv); }
@@ -0,0 +1,70 @@
+#include "MemoryUsage.h"
+#include "llvm/Support/Format.h"
+
+#ifdef _WIN32
+// Memory use is not reported on Windows.
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#else
+#include <cstdio>
+#endif
+#endif
+
+namespace vf {
+
+size_t MemoryUsage::currentRSS() {
+#if defined(_WIN32)
+  return 0;
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.resident_size;
+#else
+  // The second field of statm is the number of resident pages.
+  std::FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+  unsigned long size, resident;
+  int nbFields = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+  return nbFields == 2 ? resident * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+size_t MemoryUsage::peakRSS() {
+#ifdef _WIN32
+  return 0;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return size_t(usage.ru_maxrss); // in bytes
+#else
+  return size_t(usage.ru_maxrss) * 1024; // in KiB
+#endif
+#endif
+}
+
+void MemoryUsage::report(llvm::raw_ostream &os, llvm::StringRef phase,
+                         llvm::StringRef file, size_t arenaBytes) {
+  auto mib = [](size_t bytes) { return double(bytes) / (1024 * 1024); };
+  os << "memory " << phase << " " << file << ": rss "
+     << llvm::format("%.1f", mib(currentRSS())) << " MiB, peak "
+     << llvm::format("%.1f", mib(peakRSS())) << " MiB";
+  if (arenaBytes > 0) {
+    os << ", arena " << llvm::format("%.1f", mib(arenaBytes)) << " MiB";
+  }
+  os << "\n";
+}
+
+} // namespace vf
@@ -0,0 +1,35 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstddef>
+
+namespace vf {
+
+/**
+ * @brief Memory use of the exporter process, as reported by `-report_memory`
+ * and checked against the budget of `-max_memory`.
+ */
+class MemoryUsage {
+public:
+  /**
+   * @brief Current resident set size of the process in bytes, or 0 if it is
+   * unknown on this system.
+   */
+  static size_t currentRSS();
+
+  /**
+   * @brief Largest resident set size the process had so far in bytes, or 0
+   * if it is unknown on this system.
+   */
+  static size_t peakRSS();
+
+  /**
+   * @brief Print one line with the current and peak resident set size, and
+   * the size of the message arena if it is not 0, after the given phase of
+   * the export of a file.
+   */
+  static void report(llvm::raw_ostream &os, llvm::StringRef phase,
+                     llvm::StringRef file, size_t arenaBytes = 0);
+};
+
+} // namespace vf
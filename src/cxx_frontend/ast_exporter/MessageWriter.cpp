@@ -0,0 +1,72 @@
+#include "MessageWriter.h"
+#include "Census.h"
+#include "Timings.h"
+#include "capnp/serialize-packed.h"
+#include "capnp/serialize.h"
+#include "kj/io.h"
+
+namespace vf {
+
+void FdMessageWriter::write(capnp::MessageBuilder &message) {
+  Census::countMessage(message);
+  Timings::Scope timing(Timings::Output);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_packed) {
+    capnp::writePackedMessageToFd(m_fd, message);
+  } else {
+    capnp::writeMessageToFd(m_fd, message);
+  }
+}
+
+void FdMessageWriter::write(kj::ArrayPtr<const capnp::word> words) {
+  Timings::Scope timing(Timings::Output);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  kj::FdOutputStream out(m_fd);
+  if (m_packed) {
+    // The packed encoding of a message is the packed encoding of its flat
+    // array, segment table included.
+    kj::BufferedOutputStreamWrapper buffered(out);
+    capnp::_::PackedOutputStream packed(buffered);
+    packed.write(words.begin(), words.size() * sizeof(capnp::word));
+    buffered.flush();
+  } else {
+    out.write(words.begin(), words.size() * sizeof(capnp::word));
+  }
+}
+
+void BufferedMessageWriter::write(capnp::MessageBuilder &message) {
+  Census::countMessage(message);
+  m_messages.push_back(capnp::messageToFlatArray(message));
+}
+
+void BufferedMessageWriter::write(kj::ArrayPtr<const capnp::word> words) {
+  m_messages.push_back(kj::heapArray(words));
+}
+
+void BufferedMessageWriter::flushTo(MessageWriter &writer) {
+  for (const kj::Array<capnp::word> &words : m_messages) {
+    writer.write(words.asPtr());
+  }
+  m_messages.clear();
+}
+
+void DeferredMessages::add(std::unique_ptr<capnp::MessageBuilder> message) {
+  m_messages.push_back(Message{std::move(message), nullptr});
+}
+
+void DeferredMessages::add(kj::Array<capnp::word> words) {
+  m_messages.push_back(Message{nullptr, std::move(words)});
+}
+
+void DeferredMessages::flushTo(MessageWriter &writer) {
+  for (Message &message : m_messages) {
+    if (message.builder) {
+      writer.write(*message.builder);
+    } else {
+      writer.write(message.words.asPtr());
+    }
+  }
+  m_messages.clear();
+}
+
+} // namespace vf
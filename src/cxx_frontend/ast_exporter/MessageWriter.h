@@ -0,0 +1,104 @@
+#pragma once
+
+#include "capnp/message.h"
+#include "kj/array.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vf {
+
+/**
+ * @brief Destination of the result messages produced by the exporter.
+ *
+ */
+class MessageWriter {
+public:
+  virtual void write(capnp::MessageBuilder &message) = 0;
+
+  /**
+   * @brief Write a message that has already been flattened.
+   *
+   * @param words Flat array of the message, including its segment table.
+   */
+  virtual void write(kj::ArrayPtr<const capnp::word> words) = 0;
+  virtual ~MessageWriter() = default;
+};
+
+/**
+ * @brief Writes messages to a file descriptor as soon as they are produced,
+ * optionally in Cap'n Proto's packed encoding. Writes are serialized, so one
+ * writer can be shared by several threads.
+ *
+ */
+class FdMessageWriter : public MessageWriter {
+public:
+  void write(capnp::MessageBuilder &message) override;
+
+  void write(kj::ArrayPtr<const capnp::word> words) override;
+
+  FdMessageWriter(int fd, bool packed) : m_fd(fd), m_packed(packed) {}
+
+private:
+  int m_fd;
+  bool m_packed;
+  std::mutex m_mutex;
+};
+
+/**
+ * @brief Keeps messages in memory as flat arrays, so they can be written to
+ * another writer later on. Used to write the results of parallel exports in
+ * input order.
+ *
+ */
+class BufferedMessageWriter : public MessageWriter {
+public:
+  void write(capnp::MessageBuilder &message) override;
+
+  void write(kj::ArrayPtr<const capnp::word> words) override;
+
+  /**
+   * @brief Write all buffered messages to the given writer and release them.
+   *
+   * @param writer Target writer.
+   */
+  void flushTo(MessageWriter &writer);
+
+private:
+  std::vector<kj::Array<capnp::word>> m_messages;
+};
+
+/**
+ * @brief Result messages whose writing is deferred until the compiler instance
+ * that produced them has been torn down, so the Clang AST is released before
+ * the messages are written instead of staying alive while the consumer drains
+ * the output.
+ *
+ */
+class DeferredMessages {
+public:
+  void add(std::unique_ptr<capnp::MessageBuilder> message);
+
+  /**
+   * @brief Add a message that has already been flattened.
+   */
+  void add(kj::Array<capnp::word> words);
+
+  /**
+   * @brief Write all deferred messages to the given writer, in the order in
+   * which they were added, and release them.
+   *
+   * @param writer Target writer.
+   */
+  void flushTo(MessageWriter &writer);
+
+private:
+  struct Message {
+    std::unique_ptr<capnp::MessageBuilder> builder; ///< Null if flattened.
+    kj::Array<capnp::word> words;
+  };
+
+  std::vector<Message> m_messages;
+};
+
+} // namespace vf
@@ -0,0 +1,37 @@
+#include "NameTable.h"
+#include <cassert>
+
+namespace vf {
+
+uint32_t NameTable::intern(kj::StringPtr name) {
+  auto [it, inserted] =
+      m_indices.try_emplace(llvm::StringRef(name.begin(), name.size()),
+                            static_cast<uint32_t>(m_names.size()));
+  if (inserted) {
+    m_names.push_back(name);
+  }
+  return it->second;
+}
+
+std::optional<uint32_t> NameTable::find(llvm::StringRef name) const {
+  auto it = m_indices.find(name);
+  if (it == m_indices.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void NameTable::serialize(capnp::List<capnp::Text>::Builder builder) const {
+  assert(builder.size() == m_names.size() && "Target builder has wrong size");
+
+  for (size_t i = 0; i < m_names.size(); ++i) {
+    builder.set(i, m_names[i]);
+  }
+}
+
+void NameTable::clear() {
+  m_indices.clear();
+  m_names.clear();
+}
+
+} // namespace vf
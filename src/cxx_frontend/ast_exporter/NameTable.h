@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stubs_ast.capnp.h"
+#include "kj/string.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include <cstdint>
+#include <optional>
+
+namespace vf {
+
+/**
+ * @brief Table of the distinct names of a message. Name fields refer to a name
+ * by its index in the table instead of embedding it, so that every qualified
+ * name is serialized and translated only once, however often it is used.
+ *
+ */
+class NameTable {
+public:
+  /**
+   * @brief Get the index of a name in the table, adding it if it is not in the
+   * table yet.
+   *
+   * @param name Name to intern, which must outlive the table
+   * @return Index of the name in the table
+   */
+  uint32_t intern(kj::StringPtr name);
+
+  /**
+   * @brief Get the index of a name that is already in the table.
+   *
+   * @return Index of the name, or nothing if it is not in the table
+   */
+  std::optional<uint32_t> find(llvm::StringRef name) const;
+
+  /**
+   * @brief Serialize all names in the table, in the order of their indices.
+   *
+   * @param builder Target list builder, with one element for every name
+   */
+  void serialize(capnp::List<capnp::Text>::Builder builder) const;
+
+  size_t size() const { return m_names.size(); }
+
+  void clear();
+
+private:
+  llvm::StringMap<uint32_t> m_indices;      ///< Index of every name.
+  llvm::SmallVector<kj::StringPtr> m_names; ///< Names by index.
+};
+
+} // namespace vf
@@ -36,8 +36,9 @@ public:
   }
 
   template <typename T> void serialize(llvm::ArrayRef<T> container) {
+    // Items are passed by reference, since annotations cannot be copied.
     for (const T &item : container) {
-      serialize(item);
+      serialize<const T &>(item);
     }
   }
 
@@ -102,7 +103,66 @@ private:
   llvm::SmallVector<NodeOrphan> m_orphans;
 };
 
+/**
+ * @brief Writer of a list of nodes to a list-builder of a known size. Unlike a
+ * `NodeListSerializer`, nodes are serialized in place, without orphans, so the
+ * number of nodes has to be known before the list is initialized.
+ *
+ * @tparam Stub Type of the target node's description
+ * @tparam NodeSerializerImpl Type of concrete `NodeSerializer` that can
+ * serialize nodes.
+ */
+template <typename Stub, typename NodeSerializerImpl> class NodeListWriter {
+public:
+  using Node = stubs::Node<Stub>;
+  using ListBuilder = typename capnp::List<Node, capnp::Kind::STRUCT>::Builder;
+
+  /// @returns The number of serialized items.
+  size_t size() const { return m_size; }
+
+  /// @returns Whether every element of the target list-builder is serialized.
+  bool isComplete() const { return m_size == m_builder.size(); }
+
+  template <typename T> void serialize(T item) {
+    assert(m_size < m_builder.size() && "Target builder is too small");
+    auto itemBuilder = m_builder[m_size++];
+    m_serializer.serialize(item, itemBuilder.initLoc(), itemBuilder.initDesc());
+  }
+
+  template <typename T> void serialize(llvm::ArrayRef<T> container) {
+    // Items are passed by reference, since annotations cannot be copied.
+    for (const T &item : container) {
+      serialize<const T &>(item);
+    }
+  }
+
+  template <typename T> NodeListWriter &operator<<(T item) {
+    serialize(item);
+    return *this;
+  }
+
+  template <typename T>
+  NodeListWriter &operator<<(llvm::ArrayRef<T> container) {
+    serialize(container);
+    return *this;
+  }
+
+  /**
+   * @param builder Concrete list-builder, with one element for every node that
+   * will be serialized.
+   */
+  NodeListWriter(ListBuilder builder, NodeSerializerImpl serializer)
+      : m_builder(builder), m_serializer(serializer) {}
+
+private:
+  ListBuilder m_builder;
+  NodeSerializerImpl m_serializer;
+  size_t m_size = 0;
+};
+
 using DeclListSerializer = NodeListSerializer<stubs::Decl, DeclSerializer>;
 using StmtListSerializer = NodeListSerializer<stubs::Stmt, StmtSerializer>;
+using DeclListWriter = NodeListWriter<stubs::Decl, DeclSerializer>;
+using StmtListWriter = NodeListWriter<stubs::Stmt, StmtSerializer>;
 
 } // namespace vf
\ No newline at end of file
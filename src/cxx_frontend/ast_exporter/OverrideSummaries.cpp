@@ -0,0 +1,93 @@
+#include "OverrideSummaries.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SetVector.h"
+#include <algorithm>
+
+namespace vf {
+
+OverrideSummaries::Methods OverrideSummaries::intern(Methods methods) {
+  if (methods.empty()) {
+    return {};
+  }
+  auto *copy = m_allocator.Allocate<const clang::CXXMethodDecl *>(
+      methods.size());
+  std::copy(methods.begin(), methods.end(), copy);
+  return Methods(copy, methods.size());
+}
+
+OverrideSummaries::Methods
+OverrideSummaries::getOverriddenMethods(const clang::CXXMethodDecl *method) {
+  method = method->getCanonicalDecl();
+  auto it = m_overriddenMethods.find(method);
+  if (it != m_overriddenMethods.end()) {
+    return it->second;
+  }
+
+  llvm::SmallSetVector<const clang::CXXMethodDecl *, 8> overridden;
+  for (const clang::CXXMethodDecl *overriddenMethod :
+       method->overridden_methods()) {
+    overridden.insert(overriddenMethod->getCanonicalDecl());
+    for (const clang::CXXMethodDecl *transitive :
+         getOverriddenMethods(overriddenMethod)) {
+      overridden.insert(transitive);
+    }
+  }
+
+  // The recursive calls may have grown the map, so it is looked up again.
+  return m_overriddenMethods[method] = intern(overridden.getArrayRef());
+}
+
+OverrideSummaries::Methods
+OverrideSummaries::getVirtualMethods(const clang::CXXRecordDecl *decl) {
+  decl = decl->getCanonicalDecl();
+  auto it = m_virtualMethods.find(decl);
+  if (it != m_virtualMethods.end()) {
+    return it->second;
+  }
+
+  llvm::SmallSetVector<const clang::CXXMethodDecl *, 16> methods;
+  if (const clang::CXXRecordDecl *definition = decl->getDefinition()) {
+    for (const clang::CXXBaseSpecifier &base : definition->bases()) {
+      // Dependent bases do not have virtual methods yet.
+      if (const clang::CXXRecordDecl *baseDecl =
+              base.getType()->getAsCXXRecordDecl()) {
+        for (const clang::CXXMethodDecl *method : getVirtualMethods(baseDecl)) {
+          methods.insert(method);
+        }
+      }
+    }
+    for (const clang::CXXMethodDecl *method : definition->methods()) {
+      if (method->isVirtual()) {
+        methods.insert(method->getCanonicalDecl());
+      }
+    }
+  }
+
+  return m_virtualMethods[decl] = intern(methods.getArrayRef());
+}
+
+void OverrideSummaries::getNonOverriddenMethods(
+    const clang::CXXRecordDecl *decl,
+    llvm::SmallVectorImpl<const clang::CXXMethodDecl *> &methods) {
+  // A virtual method's final overrider is declared by the record if the record
+  // declares it or a method that overrides it.
+  llvm::SmallDenseSet<const clang::CXXMethodDecl *, 16> overriddenByRecord;
+  for (const clang::CXXMethodDecl *method : decl->methods()) {
+    if (!method->isVirtual()) {
+      continue;
+    }
+    overriddenByRecord.insert(method->getCanonicalDecl());
+    for (const clang::CXXMethodDecl *overridden :
+         getOverriddenMethods(method)) {
+      overriddenByRecord.insert(overridden);
+    }
+  }
+
+  for (const clang::CXXMethodDecl *method : getVirtualMethods(decl)) {
+    if (!overriddenByRecord.contains(method)) {
+      methods.push_back(method);
+    }
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "clang/AST/DeclCXX.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+
+namespace vf {
+
+/**
+ * @brief Summaries of the virtual methods of records and of the methods that
+ * methods override. Every summary is computed once and shared by all records
+ * that derive from the record it belongs to, so the summaries of a hierarchy
+ * are computed in time linear in its size.
+ *
+ */
+class OverrideSummaries {
+public:
+  /**
+   * @brief Get the virtual methods of a record definition and its bases whose
+   * final overrider in the record is not declared by the record itself. These
+   * are the methods kept by filtering `getFinalOverriders` on overriders that
+   * are not declared by the record.
+   *
+   * @param decl Record definition.
+   * @param methods Receives the canonical declarations of the methods, bases
+   * first.
+   */
+  void getNonOverriddenMethods(
+      const clang::CXXRecordDecl *decl,
+      llvm::SmallVectorImpl<const clang::CXXMethodDecl *> &methods);
+
+private:
+  using Methods = llvm::ArrayRef<const clang::CXXMethodDecl *>;
+
+  /**
+   * @brief Canonical declarations of the virtual methods declared by a record
+   * or any of its bases, bases first and without duplicates.
+   */
+  Methods getVirtualMethods(const clang::CXXRecordDecl *decl);
+
+  /**
+   * @brief Canonical declarations of the methods that a method overrides,
+   * directly or through the methods it overrides.
+   */
+  Methods getOverriddenMethods(const clang::CXXMethodDecl *method);
+
+  /**
+   * @brief Copy methods to the allocator, so that summaries stay valid while
+   * others are added.
+   */
+  Methods intern(Methods methods);
+
+  llvm::BumpPtrAllocator m_allocator;
+  llvm::DenseMap<const clang::CXXRecordDecl *, Methods> m_virtualMethods;
+  llvm::DenseMap<const clang::CXXMethodDecl *, Methods> m_overriddenMethods;
+};
+
+} // namespace vf
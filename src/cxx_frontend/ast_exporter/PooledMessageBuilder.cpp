@@ -0,0 +1,149 @@
+#include "PooledMessageBuilder.h"
+#include "Census.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace vf {
+
+namespace {
+
+// Segments of at least this many words, 2 MiB, are mapped on their own, so
+// they can be backed by huge pages.
+constexpr size_t largeSegmentWords = size_t(1) << 18;
+
+// Segments beyond this many words, 256 MiB, that are given back to a pool are
+// released instead.
+constexpr size_t maxPooledWords = size_t(1) << 25;
+
+// capnp limits the size of a segment to less than 2^29 words.
+constexpr size_t maxSegmentWords = size_t(1) << 28;
+
+capnp::word *allocateZeroed(size_t words) {
+#ifndef _WIN32
+  if (words >= largeSegmentWords) {
+    void *memory = mmap(nullptr, words * sizeof(capnp::word),
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(memory, words * sizeof(capnp::word), MADV_HUGEPAGE);
+#endif
+    return static_cast<capnp::word *>(memory);
+  }
+#endif
+  return static_cast<capnp::word *>(std::calloc(words, sizeof(capnp::word)));
+}
+
+void release(kj::ArrayPtr<capnp::word> segment) {
+#ifndef _WIN32
+  if (segment.size() >= largeSegmentWords) {
+    munmap(segment.begin(), segment.size() * sizeof(capnp::word));
+    return;
+  }
+#endif
+  std::free(segment.begin());
+}
+
+/**
+ * @brief Zeroed segments of one thread that are not part of any message, by
+ * size.
+ */
+class SegmentPool {
+public:
+  /**
+   * @brief Take the smallest pooled segment of at least the given size, or
+   * allocate a new one whose size is the next power of two.
+   */
+  kj::ArrayPtr<capnp::word> take(size_t minimumWords) {
+    auto it = m_free.lower_bound(minimumWords);
+    if (it != m_free.end()) {
+      kj::ArrayPtr<capnp::word> segment(it->second, it->first);
+      m_freeWords -= it->first;
+      m_free.erase(it);
+      return segment;
+    }
+    size_t words = std::min<size_t>(llvm::PowerOf2Ceil(minimumWords),
+                                    std::max(minimumWords, maxSegmentWords));
+    capnp::word *memory = allocateZeroed(words);
+    if (!memory) {
+      // The system is out of memory, as it would be for capnp's own builder.
+      std::abort();
+    }
+    return kj::ArrayPtr<capnp::word>(memory, words);
+  }
+
+  /**
+   * @brief Keep a zeroed segment for later messages, unless the pool is full.
+   */
+  void give(kj::ArrayPtr<capnp::word> segment) {
+    if (m_freeWords + segment.size() > maxPooledWords) {
+      release(segment);
+      return;
+    }
+    m_free.emplace(segment.size(), segment.begin());
+    m_freeWords += segment.size();
+  }
+
+  ~SegmentPool() {
+    for (auto &[words, memory] : m_free) {
+      release(kj::ArrayPtr<capnp::word>(memory, words));
+    }
+  }
+
+private:
+  std::multimap<size_t, capnp::word *> m_free;
+  size_t m_freeWords = 0;
+};
+
+SegmentPool &threadPool() {
+  thread_local SegmentPool pool;
+  return pool;
+}
+
+} // namespace
+
+kj::ArrayPtr<capnp::word>
+PooledMessageBuilder::allocateSegment(uint minimumSize) {
+  // Grows like capnp's GROW_HEURISTICALLY: every segment is at least as large
+  // as all segments before it together.
+  size_t words = std::max<size_t>(minimumSize, m_nextSize);
+  kj::ArrayPtr<capnp::word> segment = threadPool().take(words);
+  m_segments.push_back(segment);
+  m_allocatedWords += segment.size();
+  m_nextSize = unsigned(std::min(m_allocatedWords, maxSegmentWords));
+  Census::countSegment(segment.size());
+  return segment;
+}
+
+PooledMessageBuilder::~PooledMessageBuilder() {
+  if (m_segments.empty()) {
+    return;
+  }
+  // The segments are given back while the arena of the base class still
+  // refers to them, but it does not touch them anymore.
+  kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> used =
+      getSegmentsForOutput();
+  SegmentPool &pool = threadPool();
+  for (kj::ArrayPtr<capnp::word> segment : m_segments) {
+    size_t usedWords = segment.size();
+    for (kj::ArrayPtr<const capnp::word> usedSegment : used) {
+      if (usedSegment.begin() == segment.begin()) {
+        usedWords = usedSegment.size();
+        break;
+      }
+    }
+    std::memset(segment.begin(), 0, usedWords * sizeof(capnp::word));
+    pool.give(segment);
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,44 @@
+#pragma once
+#include "capnp/message.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace vf {
+
+/**
+ * @brief Message builder whose segments are taken from a pool of the calling
+ * thread and given back to it when the builder is destroyed.
+ *
+ * A server, batch or parallel run exports many translation units on the same
+ * threads, so the segments of a message are reused by the next one instead of
+ * being allocated, faulted in and released again for every translation unit.
+ * Segment sizes are rounded up to powers of two to make them reusable across
+ * messages of different sizes, and large segments are backed by huge pages
+ * where the system supports it. Only the words a message used are cleared
+ * when its segments are given back. Like `CountingMessageBuilder`, it counts
+ * its segments in the census.
+ */
+class PooledMessageBuilder : public capnp::MessageBuilder {
+public:
+  explicit PooledMessageBuilder(
+      unsigned firstSegmentWords = capnp::SUGGESTED_FIRST_SEGMENT_WORDS)
+      : m_nextSize(firstSegmentWords) {}
+
+  PooledMessageBuilder(const PooledMessageBuilder &) = delete;
+  PooledMessageBuilder &operator=(const PooledMessageBuilder &) = delete;
+
+  ~PooledMessageBuilder() override;
+
+  kj::ArrayPtr<capnp::word> allocateSegment(uint minimumSize) override;
+
+  /**
+   * @brief Number of words in the segments allocated so far.
+   */
+  size_t allocatedWords() const { return m_allocatedWords; }
+
+private:
+  unsigned m_nextSize;
+  size_t m_allocatedWords = 0;
+  llvm::SmallVector<kj::ArrayPtr<capnp::word>, 4> m_segments;
+};
+
+} // namespace vf
@@ -0,0 +1,67 @@
+#include "PreambleCache.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/PreprocessorOptions.h"
+
+namespace vf {
+
+void PreambleCache::apply(
+    clang::CompilerInvocation &invocation,
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem,
+    std::shared_ptr<clang::PCHContainerOperations> pchContainerOperations) {
+  const clang::FrontendOptions &frontendOpts = invocation.getFrontendOpts();
+  if (frontendOpts.Inputs.size() != 1 || !frontendOpts.Inputs[0].isFile() ||
+      !invocation.getPreprocessorOpts().ImplicitPCHInclude.empty()) {
+    return;
+  }
+
+  llvm::StringRef path = frontendOpts.Inputs[0].getFile();
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> mainBuffer =
+      fileSystem->getBufferForFile(path);
+  if (!mainBuffer) {
+    return;
+  }
+
+  clang::PreambleBounds bounds = clang::ComputePreambleBounds(
+      invocation.getLangOpts(), **mainBuffer, /*MaxLines=*/0);
+  if (bounds.Size == 0) {
+    return;
+  }
+
+  auto it = m_preambles.find(path);
+  if (it != m_preambles.end() &&
+      !it->second.CanReuse(invocation, **mainBuffer, bounds, *fileSystem)) {
+    m_preambles.erase(it);
+    it = m_preambles.end();
+  }
+
+  if (it == m_preambles.end()) {
+    // The loader restores the include directives of the preamble from its
+    // preprocessing record.
+    clang::CompilerInvocation preambleInvocation(invocation);
+    preambleInvocation.getPreprocessorOpts().DetailedRecord = true;
+
+    // Errors in the preamble are reported when the main file is parsed
+    // without it.
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> diags =
+        clang::CompilerInstance::createDiagnostics(
+            &preambleInvocation.getDiagnosticOpts(),
+            new clang::IgnoringDiagConsumer());
+    clang::PreambleCallbacks callbacks;
+    llvm::ErrorOr<clang::PrecompiledPreamble> preamble =
+        clang::PrecompiledPreamble::Build(
+            preambleInvocation, mainBuffer->get(), bounds, *diags, fileSystem,
+            std::move(pchContainerOperations), /*StoreInMemory=*/false,
+            /*StoragePath=*/"", callbacks);
+    if (!preamble || diags->hasErrorOccurred()) {
+      return;
+    }
+    it = m_preambles.try_emplace(path, std::move(*preamble)).first;
+  }
+
+  // The preamble is stored in a temporary file, so the file system is not
+  // replaced.
+  it->second.AddImplicitPreamble(invocation, fileSystem, mainBuffer->get());
+}
+
+} // namespace vf
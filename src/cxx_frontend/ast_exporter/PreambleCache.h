@@ -0,0 +1,45 @@
+#pragma once
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/PCHContainerOperations.h"
+#include "clang/Frontend/PrecompiledPreamble.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include <memory>
+
+namespace vf {
+
+/**
+ * @brief Precompiled preambles of the main files exported in server mode.
+ *
+ * The preamble of a main file is its leading part that only consists of
+ * preprocessor directives and comments, i.e. everything up to the first
+ * declaration, which includes all of its include directives since VeriFast
+ * does not allow an include after a declaration. As long as the preamble and
+ * the files it includes do not change, a later export of the same file only
+ * parses the rest of the main file. The annotations and include directives of
+ * the preamble are restored by the `PrecompiledHeaderLoader`.
+ */
+class PreambleCache {
+public:
+  /**
+   * @brief Let a compiler invocation use the preamble of its main file,
+   * building it first if there is no valid preamble yet.
+   *
+   * Nothing is changed if the invocation already uses a precompiled header,
+   * if the main file has no preamble or if its preamble fails to build.
+   *
+   * @param invocation Invocation of the export of a single main file.
+   * @param fileSystem File system the invocation reads its files from.
+   * @param pchContainerOperations Operations to write the preamble with.
+   */
+  void apply(clang::CompilerInvocation &invocation,
+             llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem,
+             std::shared_ptr<clang::PCHContainerOperations>
+                 pchContainerOperations);
+
+private:
+  ///< Preamble of every main file, by path.
+  llvm::StringMap<clang::PrecompiledPreamble> m_preambles;
+};
+
+} // namespace vf
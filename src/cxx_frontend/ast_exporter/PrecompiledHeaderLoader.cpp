@@ -0,0 +1,352 @@
+#include "PrecompiledHeaderLoader.h"
+#include "Location.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/PreprocessorOptions.h"
+
+namespace vf {
+
+namespace {
+
+// Offset used in snapshots for locations that are invalid.
+constexpr uint32_t invalidOffset = UINT32_MAX;
+
+/**
+ * @brief Compute the range of the file name of an include directive, including
+ * its delimiters. The end of the range points past the closing delimiter, like
+ * the file name range reported to the preprocessor callbacks.
+ */
+clang::SourceRange
+fileNameRange(const clang::InclusionDirective &directive,
+              const clang::SourceManager &sourceManager) {
+  clang::SourceLocation hashLoc = directive.getSourceRange().getBegin();
+  const char *hash = sourceManager.getCharacterData(hashLoc);
+  const char open = directive.wasInQuotes() ? '"' : '<';
+  const char close = directive.wasInQuotes() ? '"' : '>';
+
+  const char *begin = hash;
+  while (*begin != open && *begin != '\n' && *begin != '\0') {
+    ++begin;
+  }
+  const char *end = begin + 1;
+  while (*end != close && *end != '\n' && *end != '\0') {
+    ++end;
+  }
+
+  return {hashLoc.getLocWithOffset(begin - hash),
+          hashLoc.getLocWithOffset(end + 1 - hash)};
+}
+
+} // namespace
+
+void PrecompiledHeaderLoader::load() {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  llvm::SmallVector<unsigned> added;
+  llvm::SmallVector<const clang::FileEntry *> roots;
+  // A precompiled preamble holds the leading part of the main file itself.
+  unsigned preambleSize =
+      m_preprocessor->getPreprocessorOpts().PrecompiledPreambleBytes.first;
+  const clang::FileEntry *mainEntry =
+      preambleSize > 0
+          ? sourceManager.getFileEntryForID(sourceManager.getMainFileID())
+          : nullptr;
+
+  scanLoadedFiles(added, &roots);
+  restoreFiles(added, mainEntry, preambleSize);
+
+  for (const clang::FileEntry *root : roots) {
+    if (root == mainEntry) {
+      replayPreambleIncludes(m_loadedFiles.find(root->getUID())->getSecond());
+    } else {
+      replayInclusion(root);
+    }
+  }
+}
+
+void PrecompiledHeaderLoader::loadImport(const clang::FileEntry *header) {
+  llvm::SmallVector<unsigned> added;
+  scanLoadedFiles(added);
+  restoreFiles(added);
+  replayInclusion(header);
+}
+
+void PrecompiledHeaderLoader::scanLoadedFiles(
+    llvm::SmallVectorImpl<unsigned> &added,
+    llvm::SmallVectorImpl<const clang::FileEntry *> *roots) {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  // Entries of later imports are appended, so the earlier ones keep their
+  // index.
+  unsigned n = sourceManager.loaded_sloc_entry_size();
+  for (unsigned i = m_scannedEntries; i < n; ++i) {
+    const clang::SrcMgr::SLocEntry &entry = sourceManager.getLoadedSLocEntry(i);
+    if (!entry.isFile()) {
+      continue;
+    }
+
+    clang::FileID fileID = sourceManager.getFileID(
+        clang::SourceLocation::getFromRawEncoding(entry.getOffset()));
+    const clang::FileEntry *fileEntry =
+        sourceManager.getFileEntryForID(fileID);
+    std::optional<llvm::MemoryBufferRef> buffer =
+        sourceManager.getBufferOrNone(fileID);
+    if (!fileEntry || !buffer || m_loadedFiles.count(fileEntry->getUID())) {
+      continue;
+    }
+
+    uint64_t hash = AnnotationSnapshot::hashContent(buffer->getBuffer());
+    m_loadedFiles.try_emplace(fileEntry->getUID(),
+                              LoadedFile{fileID, fileEntry, hash, {}});
+    m_filesByHash.try_emplace(hash, fileEntry);
+    added.push_back(fileEntry->getUID());
+
+    // The main file of the precompiled header is the only loaded file that is
+    // not included from another loaded file.
+    if (roots && !sourceManager.isLoadedSourceLocation(
+                     sourceManager.getIncludeLoc(fileID))) {
+      roots->push_back(fileEntry);
+    }
+  }
+  m_scannedEntries = n;
+}
+
+void PrecompiledHeaderLoader::restoreFiles(llvm::ArrayRef<unsigned> uids,
+                                           const clang::FileEntry *mainEntry,
+                                           unsigned preambleSize) {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  llvm::DenseSet<unsigned> missed;
+  llvm::DenseSet<unsigned> lexed;
+  for (unsigned uid : uids) {
+    LoadedFile &file = m_loadedFiles.find(uid)->getSecond();
+    if (file.fileEntry == mainEntry) {
+      // The main file changes between exports, so it is not snapshotted.
+      loadComments(sourceManager.getMainFileID(), preambleSize);
+      lexed.insert(uid);
+      continue;
+    }
+    FileSnapshot snapshot;
+    if (m_snapshot && m_snapshot->lookup(file.hash, snapshot) &&
+        restore(file, snapshot)) {
+      continue;
+    }
+    loadComments(file.fileID);
+    missed.insert(uid);
+    lexed.insert(uid);
+  }
+
+  if (!lexed.empty()) {
+    collectIncludeDirectives(lexed);
+  }
+
+  if (m_snapshot && !missed.empty()) {
+    for (unsigned uid : missed) {
+      const LoadedFile &file = m_loadedFiles.find(uid)->getSecond();
+      m_snapshot->add(file.hash, takeSnapshot(file));
+    }
+    m_snapshot->save();
+  }
+}
+
+bool PrecompiledHeaderLoader::restore(LoadedFile &file,
+                                      const FileSnapshot &snapshot) {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  llvm::StringRef content = sourceManager.getBufferData(file.fileID);
+  auto locOf = [&](uint32_t offset) {
+    return offset == invalidOffset
+               ? clang::SourceLocation()
+               : sourceManager.getComposedLoc(file.fileID, offset);
+  };
+
+  for (const FileSnapshot::IncludeRecord &include : snapshot.includes) {
+    if (!m_filesByHash.count(include.targetHash) ||
+        include.end > content.size() || include.begin + 2 > include.end) {
+      return false;
+    }
+  }
+  for (const FileSnapshot::AnnotationRecord &annotation :
+       snapshot.annotations) {
+    if (annotation.end > content.size() || annotation.begin > annotation.end) {
+      return false;
+    }
+  }
+  for (const FileSnapshot::FailDirectiveRecord &failDirective :
+       snapshot.failDirectives) {
+    if (failDirective.end > content.size() ||
+        failDirective.begin + 3 > failDirective.end) {
+      return false;
+    }
+  }
+
+  for (const FileSnapshot::AnnotationRecord &annotation :
+       snapshot.annotations) {
+    m_annotationManager->addAnnotation(
+        Annotation(Annotation::Kind(annotation.kind),
+                   {locOf(annotation.begin), locOf(annotation.end)},
+                   content.slice(annotation.begin, annotation.end),
+                   locOf(annotation.nextToken)));
+  }
+
+  for (const FileSnapshot::FailDirectiveRecord &failDirective :
+       snapshot.failDirectives) {
+    m_annotationManager->addFailDirective(
+        Text({locOf(failDirective.begin), locOf(failDirective.end)},
+             content.slice(failDirective.begin + 3, failDirective.end)));
+  }
+
+  for (const FileSnapshot::IncludeRecord &include : snapshot.includes) {
+    file.includes.push_back(
+        {{locOf(include.begin), locOf(include.end)},
+         content.slice(include.begin + 1, include.end - 1).str(),
+         m_filesByHash.find(include.targetHash)->getSecond(),
+         include.isAngled != 0});
+  }
+
+  return true;
+}
+
+void PrecompiledHeaderLoader::loadComments(clang::FileID fileID,
+                                           unsigned end) {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  std::optional<llvm::MemoryBufferRef> buffer =
+      sourceManager.getBufferOrNone(fileID);
+  if (!buffer) {
+    return;
+  }
+
+  clang::Lexer lexer(fileID, *buffer, sourceManager,
+                     m_preprocessor->getLangOpts());
+  lexer.SetCommentRetentionState(true);
+
+  clang::Token token;
+  bool atEnd;
+  do {
+    atEnd = lexer.LexFromRawLexer(token);
+    if (sourceManager.getFileOffset(token.getLocation()) >= end) {
+      break;
+    }
+    if (token.is(clang::tok::comment)) {
+      m_commentProcessor->HandleComment(
+          *m_preprocessor, {token.getLocation(), token.getEndLoc()});
+    }
+  } while (!atEnd);
+}
+
+void PrecompiledHeaderLoader::collectIncludeDirectives(
+    const llvm::DenseSet<unsigned> &uids) {
+  clang::PreprocessingRecord *record =
+      m_preprocessor->getPreprocessingRecord();
+  if (!record) {
+    return;
+  }
+
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  for (clang::PreprocessedEntity *entity : *record) {
+    auto *directive = llvm::dyn_cast_or_null<clang::InclusionDirective>(entity);
+    if (!directive || !directive->getFile()) {
+      continue;
+    }
+
+    clang::SourceLocation hashLoc = directive->getSourceRange().getBegin();
+    const clang::FileEntry *fileEntry = fileEntryOfLoc(hashLoc, sourceManager);
+    if (!fileEntry || !uids.contains(fileEntry->getUID())) {
+      continue;
+    }
+
+    // Skip directives of files that were entered more than once, their first
+    // entry already provides them.
+    LoadedFile &file = m_loadedFiles.find(fileEntry->getUID())->getSecond();
+    if (file.fileID != sourceManager.getFileID(hashLoc)) {
+      continue;
+    }
+
+    file.includes.push_back({fileNameRange(*directive, sourceManager),
+                             directive->getFileName().str(),
+                             &directive->getFile()->getFileEntry(),
+                             !directive->wasInQuotes()});
+  }
+}
+
+FileSnapshot
+PrecompiledHeaderLoader::takeSnapshot(const LoadedFile &file) const {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  auto offsetOf = [&](clang::SourceLocation loc) {
+    return loc.isValid() && sourceManager.getFileID(loc) == file.fileID
+               ? uint32_t(sourceManager.getFileOffset(loc))
+               : invalidOffset;
+  };
+
+  FileSnapshot snapshot;
+  for (AnnotationsRef annotations :
+       {m_annotationManager->getAll(file.fileEntry),
+        m_annotationManager->getLeadingIncludes(file.fileEntry)}) {
+    for (const Annotation &annotation : annotations) {
+      snapshot.annotations.push_back(
+          {uint32_t(annotation.getKind()),
+           offsetOf(annotation.getRange().getBegin()),
+           offsetOf(annotation.getRange().getEnd()),
+           offsetOf(annotation.getNextTokenLoc())});
+    }
+  }
+
+  for (const Text &failDirective : m_annotationManager->getFailDirectives()) {
+    clang::SourceRange range = failDirective.getRange();
+    if (sourceManager.getFileID(range.getBegin()) == file.fileID) {
+      snapshot.failDirectives.push_back(
+          {offsetOf(range.getBegin()), offsetOf(range.getEnd())});
+    }
+  }
+
+  for (const LoadedInclude &include : file.includes) {
+    auto it = m_loadedFiles.find(include.target->getUID());
+    if (it == m_loadedFiles.end()) {
+      continue;
+    }
+    snapshot.includes.push_back({it->getSecond().hash,
+                                 offsetOf(include.range.getBegin()),
+                                 offsetOf(include.range.getEnd()),
+                                 include.isAngled});
+  }
+
+  return snapshot;
+}
+
+void PrecompiledHeaderLoader::replayPreambleIncludes(
+    const LoadedFile &preamble) {
+  clang::SourceManager &sourceManager = m_preprocessor->getSourceManager();
+  clang::FileID mainFileID = sourceManager.getMainFileID();
+  // The preamble's copy of the main file has the same offsets as the main
+  // file.
+  auto mainLoc = [&](clang::SourceLocation loc) {
+    return sourceManager.getComposedLoc(mainFileID,
+                                        sourceManager.getFileOffset(loc));
+  };
+
+  m_replayedFiles.insert(preamble.fileEntry->getUID());
+  for (const LoadedInclude &include : preamble.includes) {
+    m_inclusionContext->currentInclusion().addIncludeDirective(
+        {{mainLoc(include.range.getBegin()), mainLoc(include.range.getEnd())},
+         include.fileName,
+         include.target->getUID(),
+         include.isAngled});
+    replayInclusion(include.target);
+  }
+}
+
+void PrecompiledHeaderLoader::replayInclusion(
+    const clang::FileEntry *fileEntry) {
+  m_inclusionContext->startInclusionForFile(fileEntry);
+
+  // Later inclusions of the same file were skipped by its header guard.
+  auto it = m_loadedFiles.find(fileEntry->getUID());
+  if (m_replayedFiles.insert(fileEntry->getUID()).second &&
+      it != m_loadedFiles.end()) {
+    for (const LoadedInclude &include : it->getSecond().includes) {
+      m_inclusionContext->currentInclusion().addIncludeDirective(
+          {include.range, include.fileName, include.target->getUID(),
+           include.isAngled});
+      replayInclusion(include.target);
+    }
+  }
+
+  m_inclusionContext->endCurrentInclusion();
+}
+
+} // namespace vf
@@ -0,0 +1,173 @@
+#pragma once
+#include "AnnotationManager.h"
+#include "AnnotationSnapshot.h"
+#include "CommentProcessor.h"
+#include "InclusionContext.h"
+#include "clang/Lex/PreprocessingRecord.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include <climits>
+
+namespace vf {
+
+/**
+ * @brief Rebuilds the state that is normally collected during preprocessing
+ * for the files that were loaded from a precompiled header. Those files are
+ * never lexed again, so their comments and include directives do not reach the
+ * comment processor and the preprocessor callbacks.
+ *
+ * If an annotation snapshot is given, files whose content has a snapshot are
+ * restored from it. Other files are raw-lexed for their comments and their
+ * include directives are taken from the preprocessing record of the
+ * precompiled header, which requires it to be built with a detailed
+ * preprocessing record, as done by the exporter's -emit_pch option. Their
+ * snapshots are added to the annotation snapshot afterwards.
+ *
+ * A precompiled preamble of the main file is loaded like a precompiled header,
+ * except that the comments of the main file's preamble are lexed from the main
+ * file itself and its include directives become those of the main file.
+ *
+ * With `-fmodules`, an include directive of a header that belongs to a module
+ * imports the module instead of entering the header. The files of the module
+ * are loaded like those of a precompiled header when it is imported, see
+ * #loadImport.
+ */
+class PrecompiledHeaderLoader {
+public:
+  /**
+   * @brief Restore the annotations and inclusions of all files that were
+   * loaded from the precompiled header. Must be called after the precompiled
+   * header has been loaded and before the main file is preprocessed. The
+   * restored inclusions become part of the inclusion that is currently active
+   * in the inclusion context, i.e. the main file.
+   */
+  void load();
+
+  /**
+   * @brief Restore the annotations and inclusions of the files that were loaded
+   * by importing the module of the given header, and replay the inclusion of
+   * the header in the inclusion that is currently active. Must be called for
+   * every include directive that imported a module, after the directive itself
+   * was recorded.
+   *
+   * @param header Entry of the header the include directive named.
+   */
+  void loadImport(const clang::FileEntry *header);
+
+  PrecompiledHeaderLoader(clang::Preprocessor &preprocessor,
+                          AnnotationManager &annotationManager,
+                          CommentProcessor &commentProcessor,
+                          InclusionContext &inclusionContext,
+                          AnnotationSnapshot *snapshot)
+      : m_preprocessor(&preprocessor), m_annotationManager(&annotationManager),
+        m_commentProcessor(&commentProcessor),
+        m_inclusionContext(&inclusionContext), m_snapshot(snapshot) {}
+
+private:
+  /**
+   * @brief Include directive of a loaded file.
+   */
+  struct LoadedInclude {
+    clang::SourceRange range;
+    std::string fileName;
+    const clang::FileEntry *target;
+    bool isAngled;
+  };
+
+  /**
+   * @brief Loaded file with the content hash and include directives.
+   */
+  struct LoadedFile {
+    clang::FileID fileID;
+    const clang::FileEntry *fileEntry;
+    uint64_t hash;
+    llvm::SmallVector<LoadedInclude> includes;
+  };
+
+  /**
+   * @brief Record the files that were loaded since the previous call.
+   *
+   * @param added Receives the UIDs of the recorded files.
+   * @param roots If given, receives the recorded files that were not included
+   * from another loaded file.
+   */
+  void scanLoadedFiles(
+      llvm::SmallVectorImpl<unsigned> &added,
+      llvm::SmallVectorImpl<const clang::FileEntry *> *roots = nullptr);
+
+  /**
+   * @brief Restore the state of the given recorded files from the snapshot, or
+   * lex them and add them to the snapshot.
+   *
+   * @param uids UIDs of the files to restore.
+   * @param mainEntry Entry of the main file if a precompiled preamble holds
+   * its leading part, which is lexed from the main file up to `preambleSize`.
+   */
+  void restoreFiles(llvm::ArrayRef<unsigned> uids,
+                    const clang::FileEntry *mainEntry = nullptr,
+                    unsigned preambleSize = 0);
+
+  /**
+   * @brief Restore the state of a file from its snapshot.
+   *
+   * @return False if the snapshot refers to a file that was not loaded, in
+   * which case nothing is restored.
+   */
+  bool restore(LoadedFile &file, const FileSnapshot &snapshot);
+
+  /**
+   * @brief Raw-lex the given file and pass its comments to the comment
+   * processor.
+   *
+   * @param fileID Loaded file to process, or the main file.
+   * @param end Offset at which lexing stops.
+   */
+  void loadComments(clang::FileID fileID, unsigned end = UINT_MAX);
+
+  /**
+   * @brief Collect the include directives of the preprocessing record that
+   * appear in one of the given files.
+   *
+   * @param uids UIDs of the files to collect the include directives of.
+   */
+  void collectIncludeDirectives(const llvm::DenseSet<unsigned> &uids);
+
+  /**
+   * @brief Take a snapshot of the restored state of a file.
+   */
+  FileSnapshot takeSnapshot(const LoadedFile &file) const;
+
+  /**
+   * @brief Replay the include directives of the main file's preamble as
+   * include directives of the main file, with locations in the main file.
+   */
+  void replayPreambleIncludes(const LoadedFile &preamble);
+
+  /**
+   * @brief Replay the inclusion of a file and, recursively, of the files it
+   * includes.
+   *
+   * @param fileEntry Entry of the included file.
+   */
+  void replayInclusion(const clang::FileEntry *fileEntry);
+
+  clang::Preprocessor *m_preprocessor;
+  AnnotationManager *m_annotationManager;
+  CommentProcessor *m_commentProcessor;
+  InclusionContext *m_inclusionContext;
+  AnnotationSnapshot *m_snapshot;
+
+  ///< Loaded files indexed by file UID. If a file was entered several times,
+  /// only its first loaded file is used.
+  llvm::SmallDenseMap<unsigned, LoadedFile> m_loadedFiles;
+  ///< Entries of the loaded files indexed by content hash.
+  llvm::DenseMap<uint64_t, const clang::FileEntry *> m_filesByHash;
+  ///< UIDs of files whose inclusion has already been replayed.
+  llvm::DenseSet<unsigned> m_replayedFiles;
+  ///< Number of loaded source location entries that were scanned.
+  unsigned m_scannedEntries = 0;
+};
+
+} // namespace vf
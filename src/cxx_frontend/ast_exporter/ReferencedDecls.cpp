@@ -0,0 +1,175 @@
+#include "ReferencedDecls.h"
+#include "Location.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/CharInfo.h"
+#include "clang/Basic/FileManager.h"
+#include "llvm/ADT/StringSet.h"
+
+namespace vf {
+
+namespace {
+
+template <typename OnReference>
+class ReferenceVisitor
+    : public clang::RecursiveASTVisitor<ReferenceVisitor<OnReference>> {
+public:
+  bool VisitDeclRefExpr(clang::DeclRefExpr *expr) {
+    m_onReference(expr->getDecl());
+    return true;
+  }
+
+  bool VisitMemberExpr(clang::MemberExpr *expr) {
+    m_onReference(expr->getMemberDecl());
+    return true;
+  }
+
+  bool VisitCXXConstructExpr(clang::CXXConstructExpr *expr) {
+    m_onReference(expr->getConstructor());
+    return true;
+  }
+
+  bool VisitTagTypeLoc(clang::TagTypeLoc typeLoc) {
+    m_onReference(typeLoc.getDecl());
+    return true;
+  }
+
+  bool VisitTypedefTypeLoc(clang::TypedefTypeLoc typeLoc) {
+    m_onReference(typeLoc.getTypedefNameDecl());
+    return true;
+  }
+
+  bool VisitTemplateSpecializationTypeLoc(
+      clang::TemplateSpecializationTypeLoc typeLoc) {
+    if (const clang::TemplateDecl *decl = typeLoc.getTypePtr()
+                                              ->getTemplateName()
+                                              .getAsTemplateDecl()) {
+      m_onReference(decl);
+    }
+    return true;
+  }
+
+  explicit ReferenceVisitor(OnReference onReference)
+      : m_onReference(onReference) {}
+
+private:
+  OnReference m_onReference;
+};
+
+// Adds the identifiers that occur in the given text to the set.
+void collectIdentifiers(std::string_view text, llvm::StringSet<> &identifiers) {
+  size_t i = 0;
+  while (i < text.size()) {
+    if (!clang::isAsciiIdentifierStart(text[i])) {
+      ++i;
+      continue;
+    }
+    size_t start = i;
+    while (i < text.size() && clang::isAsciiIdentifierContinue(text[i])) {
+      ++i;
+    }
+    identifiers.insert(llvm::StringRef(text.data() + start, i - start));
+  }
+}
+
+bool isNamedIn(const clang::Decl *decl, const llvm::StringSet<> &identifiers) {
+  if (const auto *namedDecl = llvm::dyn_cast<clang::NamedDecl>(decl)) {
+    if (const clang::IdentifierInfo *info = namedDecl->getIdentifier();
+        info && identifiers.contains(info->getName())) {
+      return true;
+    }
+  }
+  if (const auto *enumDecl = llvm::dyn_cast<clang::EnumDecl>(decl)) {
+    for (const clang::EnumConstantDecl *constant : enumDecl->enumerators()) {
+      if (identifiers.contains(constant->getName())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+ReferencedDecls::ReferencedDecls(const clang::ASTContext &context,
+                                 const AnnotationManager &annotationManager) {
+  const clang::SourceManager &sourceManager = context.getSourceManager();
+
+  llvm::StringSet<> annotationIdentifiers;
+  llvm::SmallVector<const clang::FileEntry *> fileEntries;
+  sourceManager.getFileManager().GetUniqueIDMapping(fileEntries);
+  for (const clang::FileEntry *entry : fileEntries) {
+    if (!entry) {
+      continue;
+    }
+    for (const Annotation &annotation : annotationManager.getAll(entry)) {
+      collectIdentifiers(annotation.getText(), annotationIdentifiers);
+    }
+  }
+
+  const clang::FileEntry *mainEntry =
+      sourceManager.getFileEntryForID(sourceManager.getMainFileID());
+  for (const clang::Decl *decl : context.getTranslationUnitDecl()->decls()) {
+    if (decl->getSourceRange().isInvalid()) {
+      continue;
+    }
+    if (fileEntryOfLoc(decl->getBeginLoc(), sourceManager) == mainEntry ||
+        isNamedIn(decl, annotationIdentifiers)) {
+      referenceTopLevel(decl);
+    }
+  }
+
+  auto onReference = [this](const clang::Decl *decl) { reference(decl); };
+  ReferenceVisitor<decltype(onReference)> visitor(onReference);
+  while (!m_worklist.empty()) {
+    const clang::Decl *decl = m_worklist.pop_back_val();
+    // The visitor does not modify the declarations it traverses.
+    visitor.TraverseDecl(const_cast<clang::Decl *>(decl));
+  }
+}
+
+void ReferencedDecls::reference(const clang::Decl *decl) {
+  if (!decl) {
+    return;
+  }
+
+  if (const auto *function = llvm::dyn_cast<clang::FunctionDecl>(decl)) {
+    reference(function->getPrimaryTemplate());
+  } else if (const auto *specialization =
+                 llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(
+                     decl)) {
+    reference(specialization->getSpecializedTemplate());
+  }
+
+  for (const clang::Decl *redecl : decl->redecls()) {
+    // Walk up to the declaration that appears in the translation unit itself.
+    const clang::Decl *topLevel = redecl;
+    while (const clang::DeclContext *context =
+               topLevel->getLexicalDeclContext()) {
+      if (context->isTranslationUnit()) {
+        referenceTopLevel(topLevel);
+        break;
+      }
+      topLevel = llvm::cast<clang::Decl>(context);
+    }
+  }
+}
+
+void ReferencedDecls::referenceTopLevel(const clang::Decl *decl) {
+  if (const auto *function = llvm::dyn_cast<clang::FunctionDecl>(decl)) {
+    if (const clang::Decl *described =
+            function->getDescribedFunctionTemplate()) {
+      decl = described;
+    }
+  } else if (const auto *record = llvm::dyn_cast<clang::CXXRecordDecl>(decl)) {
+    if (const clang::Decl *described = record->getDescribedClassTemplate()) {
+      decl = described;
+    }
+  }
+
+  if (m_decls.insert(decl).second) {
+    m_worklist.push_back(decl);
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,45 @@
+#pragma once
+#include "AnnotationManager.h"
+#include "clang/AST/ASTContext.h"
+#include "llvm/ADT/DenseSet.h"
+
+namespace vf {
+
+/**
+ * @brief Top-level declarations of a translation unit that are transitively
+ * referenced from the declarations in its main file.
+ *
+ * A declaration references the declarations named by its expressions
+ * (`DeclRefExpr`, `MemberExpr` and constructor calls) and types. Annotations
+ * are not parsed by Clang, so every top-level declaration whose name occurs as
+ * an identifier in an annotation is referenced as well.
+ */
+class ReferencedDecls {
+public:
+  /**
+   * @brief Check whether a top-level declaration is referenced.
+   */
+  bool contains(const clang::Decl *decl) const {
+    return m_decls.contains(decl);
+  }
+
+  size_t size() const { return m_decls.size(); }
+
+  ReferencedDecls(const clang::ASTContext &context,
+                  const AnnotationManager &annotationManager);
+
+private:
+  /**
+   * @brief Mark the top-level declarations that contain the given declaration
+   * or one of its redeclarations as referenced.
+   */
+  void reference(const clang::Decl *decl);
+
+  void referenceTopLevel(const clang::Decl *decl);
+
+  llvm::DenseSet<const clang::Decl *> m_decls;
+  ///< Referenced top-level declarations whose references are not followed yet.
+  llvm::SmallVector<const clang::Decl *> m_worklist;
+};
+
+} // namespace vf
@@ -0,0 +1,143 @@
+#include "RemoteCache.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace vf {
+
+namespace {
+
+/** @brief Timeout of every send and receive on a connection, in seconds. */
+constexpr int timeoutSeconds = 10;
+
+} // namespace
+
+std::unique_ptr<RemoteCache> RemoteCache::open(llvm::StringRef url,
+                                               std::string &error) {
+#ifdef _WIN32
+  error = "-remote_cache is not available on Windows";
+  return nullptr;
+#else
+  llvm::StringRef rest = url;
+  if (!rest.consume_front("http://")) {
+    error = "Remote cache URL '" + url.str() + "' does not start with http://";
+    return nullptr;
+  }
+  auto [authority, path] = rest.split('/');
+  auto [host, port] = authority.split(':');
+  if (host.empty()) {
+    error = "Remote cache URL '" + url.str() + "' has no host";
+    return nullptr;
+  }
+  std::string prefix;
+  if (!path.empty()) {
+    prefix = "/" + path.rtrim('/').str();
+  }
+  return std::unique_ptr<RemoteCache>(new RemoteCache(
+      host.str(), port.empty() ? "80" : port.str(), std::move(prefix)));
+#endif
+}
+
+std::optional<std::pair<unsigned, std::string>>
+RemoteCache::request(llvm::StringRef method, llvm::StringRef kind,
+                     llvm::StringRef key, llvm::StringRef body) {
+#ifdef _WIN32
+  return {};
+#else
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses;
+  if (getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &addresses) != 0) {
+    return {};
+  }
+
+  int fd = -1;
+  for (addrinfo *address = addresses; address; address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    timeval timeout{timeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    return {};
+  }
+
+  // HTTP/1.0 makes the server close the connection after the response instead
+  // of using a chunked encoding.
+  std::string data = method.str() + " " + m_prefix + "/" + kind.str() + "/" +
+                     key.str() + " HTTP/1.0\r\nHost: " + m_host +
+                     "\r\nContent-Length: " + std::to_string(body.size()) +
+                     "\r\n\r\n" + body.str();
+  for (size_t sent = 0; sent < data.size();) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ::close(fd);
+      return {};
+    }
+    sent += n;
+  }
+
+  std::string response;
+  char buffer[1 << 16];
+  while (true) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      ::close(fd);
+      return {};
+    }
+    if (n == 0) {
+      break;
+    }
+    response.append(buffer, n);
+  }
+  ::close(fd);
+
+  // Status line: HTTP/1.x <code> <reason>
+  llvm::StringRef text(response);
+  size_t headerEnd = text.find("\r\n\r\n");
+  unsigned status;
+  if (headerEnd == llvm::StringRef::npos || !text.consume_front("HTTP/") ||
+      text.split(' ').second.take_front(3).getAsInteger(10, status)) {
+    return {};
+  }
+  return std::make_pair(status, response.substr(headerEnd + 4));
+#endif
+}
+
+std::optional<std::string> RemoteCache::get(llvm::StringRef kind,
+                                            llvm::StringRef key) {
+  auto response = request("GET", kind, key, {});
+  if (!response || response->first != 200) {
+    return {};
+  }
+  return std::move(response->second);
+}
+
+bool RemoteCache::put(llvm::StringRef kind, llvm::StringRef key,
+                      llvm::StringRef data) {
+  auto response = request("PUT", kind, key, data);
+  return response && response->first >= 200 && response->first < 300;
+}
+
+} // namespace vf
@@ -0,0 +1,68 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief Client of an HTTP cache server with the layout of the Bazel remote
+ * cache: blobs are read with GET and written with PUT at
+ * `<url>/ac/<sha256>` and `<url>/cas/<sha256>`.
+ *
+ * Every request opens its own connection, so the cache can be shared between
+ * threads. A request that fails or times out is reported as a miss, so an
+ * unreachable server only costs the exports it would have saved. Only plain
+ * `http://` URLs are supported, and not on Windows.
+ */
+class RemoteCache {
+public:
+  /**
+   * @brief Create a client of the server at the given URL, of the form
+   * `http://<host>[:<port>][/<prefix>]`.
+   *
+   * @param error Set to a description of the failure if null is returned.
+   */
+  static std::unique_ptr<RemoteCache> open(llvm::StringRef url,
+                                           std::string &error);
+
+  /**
+   * @brief Retrieve a blob.
+   *
+   * @param kind `ac` or `cas`.
+   * @param key Hexadecimal SHA-256 key of the blob.
+   * @return The blob, or nothing if the server does not have it or cannot be
+   * reached.
+   */
+  std::optional<std::string> get(llvm::StringRef kind, llvm::StringRef key);
+
+  /**
+   * @brief Upload a blob.
+   *
+   * @return True if the server accepted the blob.
+   */
+  bool put(llvm::StringRef kind, llvm::StringRef key, llvm::StringRef data);
+
+private:
+  RemoteCache(std::string host, std::string port, std::string prefix)
+      : m_host(std::move(host)), m_port(std::move(port)),
+        m_prefix(std::move(prefix)) {}
+
+  /**
+   * @brief Send a request and read the response until the server closes the
+   * connection.
+   *
+   * @return The status code and body of the response, or nothing if the
+   * request failed.
+   */
+  std::optional<std::pair<unsigned, std::string>>
+  request(llvm::StringRef method, llvm::StringRef kind, llvm::StringRef key,
+          llvm::StringRef body);
+
+  std::string m_host;
+  std::string m_port;
+  std::string m_prefix; ///< Path prefix, without a trailing slash.
+};
+
+} // namespace vf
@@ -0,0 +1,196 @@
+#include "SamplingProfiler.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#endif
+
+namespace vf {
+
+#ifdef _WIN32
+
+bool SamplingProfiler::start(unsigned, std::string &error) {
+  error = "-profile is not available on Windows";
+  return false;
+}
+
+bool SamplingProfiler::stopAndWrite(llvm::StringRef, std::string &) {
+  return true;
+}
+
+#else
+
+namespace {
+
+// The ring buffer holds this many samples, 16 MiB, before the oldest ones are
+// overwritten.
+constexpr size_t nbSamples = size_t(1) << 15;
+
+constexpr int maxDepth = 64;
+
+// Frames of the signal handler and of the signal trampoline, which are on top
+// of every recorded stack.
+constexpr int handlerFrames = 2;
+
+struct Sample {
+  /// Number of frames, or 0 while the sample is being recorded.
+  std::atomic<int> depth;
+  void *frames[maxDepth];
+};
+
+struct ProfilerState {
+  std::unique_ptr<Sample[]> samples{new Sample[nbSamples]()};
+  std::atomic<uint64_t> next = 0;
+  struct sigaction previousAction;
+};
+
+ProfilerState *state = nullptr;
+
+void onProfilingSignal(int) {
+  int savedErrno = errno;
+  uint64_t index = state->next.fetch_add(1, std::memory_order_relaxed);
+  Sample &sample = state->samples[index % nbSamples];
+  sample.depth.store(0, std::memory_order_relaxed);
+  int depth = backtrace(sample.frames, maxDepth);
+  sample.depth.store(depth, std::memory_order_release);
+  errno = savedErrno;
+}
+
+/**
+ * @brief Name of the function that contains the given address: its demangled
+ * name if the dynamic symbol table has it, otherwise its module and offset,
+ * which `addr2line` resolves.
+ */
+std::string symbolize(void *address) {
+  Dl_info info;
+  if (dladdr(address, &info) && info.dli_sname) {
+    return llvm::demangle(std::string(info.dli_sname));
+  }
+  std::string name;
+  llvm::raw_string_ostream os(name);
+  if (dladdr(address, &info) && info.dli_fname) {
+    os << llvm::sys::path::filename(info.dli_fname) << '+'
+       << llvm::format_hex(reinterpret_cast<uintptr_t>(address) -
+                               reinterpret_cast<uintptr_t>(info.dli_fbase),
+                           0);
+  } else {
+    os << llvm::format_hex(reinterpret_cast<uintptr_t>(address), 0);
+  }
+  return name;
+}
+
+} // namespace
+
+bool SamplingProfiler::start(unsigned frequency, std::string &error) {
+  if (state) {
+    return true;
+  }
+  if (frequency == 0 || frequency > 1000000) {
+    error = "the profiling frequency must be between 1 and 1000000";
+    return false;
+  }
+  // The first call of backtrace loads the unwinder, which must not happen in
+  // the signal handler.
+  void *frame;
+  backtrace(&frame, 1);
+
+  state = new ProfilerState();
+  struct sigaction action = {};
+  action.sa_handler = onProfilingSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &state->previousAction) != 0) {
+    error = "cannot install the SIGPROF handler";
+    delete state;
+    state = nullptr;
+    return false;
+  }
+
+  struct itimerval timer = {};
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / frequency;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    error = "cannot start the profiling timer";
+    sigaction(SIGPROF, &state->previousAction, nullptr);
+    delete state;
+    state = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool SamplingProfiler::stopAndWrite(llvm::StringRef path, std::string &error) {
+  if (!state) {
+    return true;
+  }
+  struct itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  sigaction(SIGPROF, &state->previousAction, nullptr);
+  std::unique_ptr<ProfilerState> stopped(state);
+  state = nullptr;
+
+  uint64_t recorded = stopped->next.load();
+  size_t nbKept = std::min<uint64_t>(recorded, nbSamples);
+
+  llvm::DenseMap<void *, std::string> names;
+  llvm::StringMap<uint64_t> stacks;
+  for (size_t i = 0; i < nbKept; ++i) {
+    const Sample &sample = stopped->samples[i];
+    int depth = sample.depth.load(std::memory_order_acquire);
+    if (depth <= handlerFrames) {
+      continue;
+    }
+    llvm::SmallString<512> stack;
+    for (int frame = depth - 1; frame >= handlerFrames; --frame) {
+      void *address = sample.frames[frame];
+      // Return addresses point after the call, which can be the start of the
+      // next function.
+      void *lookup = frame == handlerFrames
+                         ? address
+                         : static_cast<char *>(address) - 1;
+      auto [it, inserted] = names.try_emplace(lookup);
+      if (inserted) {
+        it->second = symbolize(lookup);
+      }
+      if (!stack.empty()) {
+        stack += ';';
+      }
+      stack += it->second;
+    }
+    ++stacks[stack];
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    error = ec.message();
+    return false;
+  }
+  for (const llvm::StringMapEntry<uint64_t> &stack : stacks) {
+    os << stack.getKey() << ' ' << stack.getValue() << '\n';
+  }
+  if (recorded > nbSamples) {
+    llvm::errs() << "The profile holds the last " << nbSamples << " of "
+                 << recorded << " samples\n";
+  }
+  return true;
+}
+
+#endif
+
+} // namespace vf
@@ -0,0 +1,40 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief In-process sampling profiler behind `-profile`, for machines on which
+ * `perf` cannot be run.
+ *
+ * A `SIGPROF` timer interrupts the thread that is using the CPU at the given
+ * frequency, and the signal handler records its stack in a ring buffer that is
+ * allocated when the profiler starts, so the handler neither allocates nor
+ * locks. When the ring buffer is full, the oldest samples are overwritten.
+ * The samples are symbolized when the profile is written, as folded stacks:
+ * one line per distinct stack, with its frames from the outermost to the
+ * innermost separated by semicolons, followed by the number of samples, which
+ * is the input of flamegraph.pl and speedscope. Not available on Windows.
+ */
+class SamplingProfiler {
+public:
+  /**
+   * @brief Start sampling.
+   *
+   * @param frequency Number of samples per second of CPU time.
+   * @param error Receives the reason why sampling could not be started.
+   * @return True if sampling was started.
+   */
+  static bool start(unsigned frequency, std::string &error);
+
+  /**
+   * @brief Stop sampling and write the samples as folded stacks to the given
+   * file. Does nothing if sampling was not started.
+   *
+   * @return True if the file was written.
+   */
+  static bool stopAndWrite(llvm::StringRef path, std::string &error);
+};
+
+} // namespace vf
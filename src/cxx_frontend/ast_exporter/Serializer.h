@@ -1,6 +1,8 @@
 #pragma once
 
 #include "stubs_ast.capnp.h"
+#include <algorithm>
+#include <string_view>
 
 namespace vf {
 
@@ -16,6 +18,17 @@ using TypeNodeBuilder = NodeBuilder<stubs::Type>;
 template <typename T>
 using ListBuilder = typename capnp::List<T, capnp::Kind::STRUCT>::Builder;
 
+/**
+ * @brief Copy text that is not necessarily NUL-terminated to a text field.
+ *
+ * @param builder Text builder of the target field, initialized with the size
+ * of `text`
+ * @param text Text to copy
+ */
+inline void copyText(capnp::Text::Builder builder, std::string_view text) {
+  std::copy(text.begin(), text.end(), builder.begin());
+}
+
 /**
  * @brief Interface for serializers.
  *
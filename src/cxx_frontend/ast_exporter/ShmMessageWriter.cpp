@@ -0,0 +1,175 @@
+#include "ShmMessageWriter.h"
+#include "Census.h"
+#include "Timings.h"
+#include "capnp/serialize.h"
+#include "kj/io.h"
+#include "llvm/Support/Endian.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vf {
+
+#ifdef _WIN32
+
+std::unique_ptr<ShmMessageWriter>
+ShmMessageWriter::open(llvm::StringRef name, int notifyFd, std::string &error) {
+  std::string path = name.str();
+  HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+  if (!mapping) {
+    error = "Cannot open file mapping '" + path +
+            "': error " + std::to_string(GetLastError());
+    return nullptr;
+  }
+
+  // The view keeps the mapping alive once the handle is closed.
+  void *region = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!region) {
+    error = "Cannot map file mapping '" + path +
+            "': error " + std::to_string(GetLastError());
+    return nullptr;
+  }
+
+  MEMORY_BASIC_INFORMATION info;
+  uint64_t size = *reinterpret_cast<uint64_t *>(static_cast<char *>(region) +
+                                                SizeOffset);
+  if (VirtualQuery(region, &info, sizeof(info)) == 0 ||
+      size <= HeaderSize + sizeof(capnp::word) || size > info.RegionSize) {
+    error = "File mapping '" + path + "' is too small";
+    UnmapViewOfFile(region);
+    return nullptr;
+  }
+  return std::unique_ptr<ShmMessageWriter>(
+      new ShmMessageWriter(notifyFd, static_cast<char *>(region), size));
+}
+
+ShmMessageWriter::~ShmMessageWriter() { UnmapViewOfFile(m_region); }
+
+#else
+
+std::unique_ptr<ShmMessageWriter>
+ShmMessageWriter::open(llvm::StringRef name, int notifyFd, std::string &error) {
+  std::string path = name.str();
+  int fd = shm_open(path.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    error = "Cannot open shared memory object '" + path +
+            "': " + std::strerror(errno);
+    return nullptr;
+  }
+
+  struct stat status;
+  if (fstat(fd, &status) != 0 ||
+      status.st_size <= static_cast<off_t>(HeaderSize + sizeof(capnp::word))) {
+    error = "Shared memory object '" + path + "' is too small";
+    close(fd);
+    return nullptr;
+  }
+
+  size_t size = status.st_size;
+  void *region =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  shm_unlink(path.c_str());
+  if (region == MAP_FAILED) {
+    error = "Cannot map shared memory object '" + path +
+            "': " + std::strerror(errno);
+    return nullptr;
+  }
+  return std::unique_ptr<ShmMessageWriter>(
+      new ShmMessageWriter(notifyFd, static_cast<char *>(region), size));
+}
+
+ShmMessageWriter::~ShmMessageWriter() { munmap(m_region, m_size); }
+
+#endif
+
+ShmMessageWriter::ShmMessageWriter(int notifyFd, char *region, size_t size)
+    : m_notifyFd(notifyFd), m_region(region), m_size(size),
+      m_capacity((size - HeaderSize) / sizeof(capnp::word) *
+                 sizeof(capnp::word)) {}
+
+size_t ShmMessageWriter::reserve(size_t bytes) {
+  size_t offset = m_written % m_capacity;
+  if (offset + bytes > m_capacity) {
+    // Skip the end of the ring, so the message is contiguous.
+    m_written += m_capacity - offset;
+    offset = 0;
+  }
+
+  std::atomic_ref<uint64_t> released(
+      *reinterpret_cast<uint64_t *>(m_region));
+  std::chrono::microseconds delay(10);
+  while (m_written + bytes - released.load(std::memory_order_acquire) >
+         m_capacity) {
+    std::this_thread::sleep_for(delay);
+    delay = std::min(delay * 2, std::chrono::microseconds(1000));
+  }
+  m_written += bytes;
+  return offset;
+}
+
+void ShmMessageWriter::notify(uint32_t offset, uint32_t words) {
+  uint8_t notification[8];
+  llvm::support::endian::write32le(notification, offset);
+  llvm::support::endian::write32le(notification + 4, words);
+  kj::FdOutputStream(m_notifyFd).write(notification, sizeof(notification));
+}
+
+void ShmMessageWriter::write(capnp::MessageBuilder &message) {
+  Census::countMessage(message);
+  Timings::Scope timing(Timings::Output);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments =
+      message.getSegmentsForOutput();
+  size_t words = capnp::computeSerializedSizeInWords(message);
+  if (words * sizeof(capnp::word) > m_capacity) {
+    notify(Inline, words);
+    capnp::writeMessageToFd(m_notifyFd, segments);
+    return;
+  }
+
+  // The segment table, as in the standard stream framing.
+  size_t tableWords = segments.size() / 2 + 1;
+  size_t offset = reserve(words * sizeof(capnp::word));
+  char *target = m_region + HeaderSize + offset;
+  std::memset(target, 0, tableWords * sizeof(capnp::word));
+  llvm::support::endian::write32le(target, segments.size() - 1);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    llvm::support::endian::write32le(target + 4 * (i + 1), segments[i].size());
+  }
+  target += tableWords * sizeof(capnp::word);
+  for (kj::ArrayPtr<const capnp::word> segment : segments) {
+    std::memcpy(target, segment.begin(), segment.size() * sizeof(capnp::word));
+    target += segment.size() * sizeof(capnp::word);
+  }
+  notify(offset / sizeof(capnp::word), words);
+}
+
+void ShmMessageWriter::write(kj::ArrayPtr<const capnp::word> words) {
+  Timings::Scope timing(Timings::Output);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t bytes = words.size() * sizeof(capnp::word);
+  if (bytes > m_capacity) {
+    notify(Inline, words.size());
+    kj::FdOutputStream(m_notifyFd).write(words.begin(), bytes);
+    return;
+  }
+
+  size_t offset = reserve(bytes);
+  std::memcpy(m_region + HeaderSize + offset, words.begin(), bytes);
+  notify(offset / sizeof(capnp::word), words.size());
+}
+
+} // namespace vf
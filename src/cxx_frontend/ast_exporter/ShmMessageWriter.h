@@ -0,0 +1,76 @@
+#pragma once
+
+#include "MessageWriter.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief Writes messages into a ring buffer in a shared memory object that
+ * the reader maps, and notifies the reader of every message through a file
+ * descriptor. A message that does not fit in the ring is written to the file
+ * descriptor right after its notification. The object is a POSIX shared
+ * memory object, or a named file mapping on Windows, where the pipe only
+ * carrying notifications avoids most of the cost of the CRT pipe.
+ *
+ * The object starts with a header of `HeaderSize` bytes. Its first 8 bytes
+ * hold the number of bytes of the ring the reader has released so far, as a
+ * 64-bit integer in native byte order that only the reader updates. The next
+ * 8 bytes hold the size of the object in the same format, which the reader
+ * writes before it starts the exporter, since the size of a file mapping
+ * cannot be queried. The ring takes the remainder of the object. Messages are placed one after the other and never
+ * wrap around the end of the ring. A notification consists of two 32-bit
+ * little-endian integers: the offset of the message in the ring in words, or
+ * `Inline` if the message follows the notification, and the size of the
+ * message in words, segment table included.
+ */
+class ShmMessageWriter : public MessageWriter {
+public:
+  static constexpr size_t HeaderSize = 64;
+  static constexpr size_t SizeOffset = 8;
+  static constexpr uint32_t Inline = 0xffffffff;
+
+  /**
+   * @brief Open the shared memory object with the given name, which the
+   * reader created, and unlink it, so it disappears with the last mapping.
+   * A file mapping disappears with its last handle or view by itself.
+   *
+   * @param notifyFd File descriptor to write the notifications to.
+   * @param error Set to a description of the failure if null is returned.
+   */
+  static std::unique_ptr<ShmMessageWriter>
+  open(llvm::StringRef name, int notifyFd, std::string &error);
+
+  void write(capnp::MessageBuilder &message) override;
+
+  void write(kj::ArrayPtr<const capnp::word> words) override;
+
+  ~ShmMessageWriter() override;
+
+private:
+  ShmMessageWriter(int notifyFd, char *region, size_t size);
+
+  /**
+   * @brief Reserve contiguous space in the ring, waiting for the reader to
+   * release enough of it.
+   *
+   * @param bytes Size of the space, a multiple of the word size.
+   * @return Offset of the space in the ring.
+   */
+  size_t reserve(size_t bytes);
+
+  void notify(uint32_t offset, uint32_t words);
+
+  int m_notifyFd;
+  char *m_region;
+  size_t m_size;
+  size_t m_capacity;    ///< Size of the ring in bytes.
+  uint64_t m_written = 0; ///< Bytes of the ring used so far, skips included.
+  std::mutex m_mutex;
+};
+
+} // namespace vf
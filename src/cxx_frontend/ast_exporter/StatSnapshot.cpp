@@ -0,0 +1,186 @@
+#include "StatSnapshot.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace vf {
+
+namespace {
+
+constexpr llvm::StringLiteral snapshotHeader = "vf-stat-snapshot 1";
+
+/**
+ * @brief File system that reports the paths a `StatSnapshot` knows to be
+ * missing without looking them up, and records the ones that turn out to be.
+ */
+class SnapshotFileSystem : public llvm::vfs::ProxyFileSystem {
+public:
+  SnapshotFileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem,
+                     StatSnapshot &snapshot)
+      : ProxyFileSystem(std::move(fileSystem)), m_snapshot(&snapshot) {}
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &path) override {
+    llvm::SmallString<256> storage;
+    llvm::StringRef pathRef = path.toStringRef(storage);
+    if (m_snapshot->isMissing(getUnderlyingFS(), pathRef)) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    llvm::ErrorOr<llvm::vfs::Status> result =
+        ProxyFileSystem::status(pathRef);
+    record(pathRef, result.getError());
+    return result;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+  openFileForRead(const llvm::Twine &path) override {
+    llvm::SmallString<256> storage;
+    llvm::StringRef pathRef = path.toStringRef(storage);
+    if (m_snapshot->isMissing(getUnderlyingFS(), pathRef)) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> result =
+        ProxyFileSystem::openFileForRead(pathRef);
+    record(pathRef, result.getError());
+    return result;
+  }
+
+private:
+  void record(llvm::StringRef path, std::error_code error) {
+    if (error == std::errc::no_such_file_or_directory) {
+      m_snapshot->recordMissing(getUnderlyingFS(), path);
+    }
+  }
+
+  StatSnapshot *m_snapshot;
+};
+
+int64_t modificationTime(llvm::vfs::FileSystem &fileSystem,
+                         llvm::StringRef directory) {
+  llvm::ErrorOr<llvm::vfs::Status> status = fileSystem.status(directory);
+  if (!status) {
+    return -1;
+  }
+  return status->getLastModificationTime().time_since_epoch().count();
+}
+
+} // namespace
+
+StatSnapshot::StatSnapshot(std::string path) : m_path(std::move(path)) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(m_path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return;
+  }
+
+  // A header line, then for every directory a line with its modification
+  // time and path, followed by one line per missing name, indented by a tab.
+  llvm::SmallVector<llvm::StringRef> lines;
+  (*buffer)->getBuffer().split(lines, '\n', -1, false);
+  if (lines.empty() || lines.front() != snapshotHeader) {
+    return;
+  }
+  Directory *directory = nullptr;
+  for (llvm::StringRef line : llvm::ArrayRef(lines).drop_front()) {
+    if (line.consume_front("\t")) {
+      if (!directory) {
+        m_directories.clear();
+        return;
+      }
+      directory->missing.insert(line);
+      continue;
+    }
+    auto [time, path] = line.split(' ');
+    int64_t modificationTime;
+    if (path.empty() || time.getAsInteger(10, modificationTime)) {
+      m_directories.clear();
+      return;
+    }
+    directory = &m_directories[path];
+    directory->modificationTime = modificationTime;
+  }
+}
+
+void StatSnapshot::save() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_changed) {
+    return;
+  }
+
+  std::string tempPath = m_path + ".tmp";
+  {
+    std::error_code error;
+    llvm::raw_fd_ostream out(tempPath, error);
+    if (error) {
+      return;
+    }
+    out << snapshotHeader << '\n';
+    for (const auto &directory : m_directories) {
+      if (directory.getValue().missing.empty()) {
+        continue;
+      }
+      out << directory.getValue().modificationTime << ' '
+          << directory.getKey() << '\n';
+      for (const auto &name : directory.getValue().missing) {
+        out << '\t' << name.getKey() << '\n';
+      }
+    }
+  }
+  if (!llvm::sys::fs::rename(tempPath, m_path)) {
+    m_changed = false;
+  }
+}
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+StatSnapshot::wrap(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem) {
+  return llvm::makeIntrusiveRefCnt<SnapshotFileSystem>(std::move(fileSystem),
+                                                      *this);
+}
+
+StatSnapshot::Directory &
+StatSnapshot::validated(llvm::vfs::FileSystem &fileSystem,
+                        llvm::StringRef directory) {
+  Directory &entry = m_directories[directory];
+  if (!entry.validated) {
+    int64_t time = modificationTime(fileSystem, directory);
+    if (time != entry.modificationTime) {
+      entry.missing.clear();
+      entry.modificationTime = time;
+      m_changed = true;
+    }
+    entry.validated = true;
+  }
+  return entry;
+}
+
+bool StatSnapshot::isMissing(llvm::vfs::FileSystem &fileSystem,
+                             llvm::StringRef path) {
+  if (!llvm::sys::path::is_absolute(path)) {
+    return false;
+  }
+  llvm::StringRef directory = llvm::sys::path::parent_path(path);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_directories.find(directory);
+  if (it == m_directories.end() || it->getValue().missing.empty()) {
+    return false;
+  }
+  return validated(fileSystem, directory)
+      .missing.contains(llvm::sys::path::filename(path));
+}
+
+void StatSnapshot::recordMissing(llvm::vfs::FileSystem &fileSystem,
+                                 llvm::StringRef path) {
+  if (!llvm::sys::path::is_absolute(path)) {
+    return;
+  }
+  llvm::StringRef directory = llvm::sys::path::parent_path(path);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (validated(fileSystem, directory)
+          .missing.insert(llvm::sys::path::filename(path))
+          .second) {
+    m_changed = true;
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,74 @@
+#pragma once
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include <mutex>
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief Lookups of missing files, remembered across exporter runs in a
+ * snapshot file.
+ *
+ * Header search probes every include directory for every include directive,
+ * so most lookups are for files that do not exist. The snapshot records the
+ * missing names of every directory together with the modification time of
+ * the directory. As long as a directory has the same modification time, which
+ * changes whenever an entry is added to or removed from it, its missing names
+ * are reported as missing without asking the file system. Files that exist
+ * are always looked up, so changed contents are never missed. The snapshot can
+ * be shared by several threads.
+ */
+class StatSnapshot {
+public:
+  /**
+   * @brief Load the snapshot from the given file. A missing or malformed file
+   * yields an empty snapshot.
+   */
+  explicit StatSnapshot(std::string path);
+
+  /**
+   * @brief Write the snapshot back to its file if it changed. The file is
+   * replaced atomically, so concurrent runs never read a partial snapshot.
+   */
+  void save();
+
+  /**
+   * @brief Return a file system that consults the snapshot before the given
+   * one. The snapshot must outlive it.
+   */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+  wrap(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem);
+
+  /**
+   * @brief Check whether an absolute path is known to be missing.
+   *
+   * @param fileSystem File system to validate the directory of the path with.
+   */
+  bool isMissing(llvm::vfs::FileSystem &fileSystem, llvm::StringRef path);
+
+  /**
+   * @brief Remember that an absolute path is missing.
+   */
+  void recordMissing(llvm::vfs::FileSystem &fileSystem, llvm::StringRef path);
+
+private:
+  struct Directory {
+    int64_t modificationTime = -1; ///< -1 if the directory does not exist.
+    bool validated = false;        ///< Whether checked during this run.
+    llvm::StringSet<> missing;     ///< Names of missing entries.
+  };
+
+  // Check once per run that a directory did not change since the snapshot,
+  // and forget its missing names otherwise.
+  Directory &validated(llvm::vfs::FileSystem &fileSystem,
+                       llvm::StringRef directory);
+
+  std::string m_path;
+  llvm::StringMap<Directory> m_directories;
+  bool m_changed = false;
+  std::mutex m_mutex;
+};
+
+} // namespace vf
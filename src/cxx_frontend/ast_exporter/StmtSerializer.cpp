@@ -1,40 +1,55 @@
 #include "StmtSerializer.h"
+#include "Census.h"
 #include "Location.h"
 #include "NodeListSerializer.h"
+#include "Trace.h"
 #include "clang/AST/StmtVisitor.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Lex/Token.h"
+#include "llvm/ADT/APSInt.h"
+#include "llvm/ADT/STLExtras.h"
 
 namespace vf {
 
 namespace {
 
+/// Number of case labels from which a switch gets a table of its labels.
+constexpr size_t minDenseCases = 4;
+
 struct StmtSerializerImpl
     : public clang::ConstStmtVisitor<StmtSerializerImpl, bool> {
 
   bool VisitCompoundStmt(const clang::CompoundStmt *stmt) {
-    StmtListSerializer stmtListSerializer(
-        capnp::Orphanage::getForMessageContaining(m_builder),
-        StmtSerializer(*m_ASTSerializer));
+    // The annotations before every child and before the closing brace are
+    // looked up first, so the children can be serialized in place.
+    AnnotationCursor annotationCursor(m_ASTSerializer->getAnnotationManager());
+    llvm::SmallVector<AnnotationsRef, 16> annotationsBefore;
+    annotationsBefore.reserve(stmt->size() + 1);
+    size_t nbChildren = stmt->size();
 
     clang::SourceLocation beginLoc = stmt->getLBracLoc();
     for (const clang::Stmt *childStmt : stmt->body()) {
       AnnotationsRef annotations =
-          m_ASTSerializer->getAnnotationManager().getInRange(
-              beginLoc, childStmt->getBeginLoc());
-      stmtListSerializer << annotations << childStmt;
+          annotationCursor.getInRange(beginLoc, childStmt->getBeginLoc());
+      annotationsBefore.push_back(annotations);
+      nbChildren += annotations.size();
       beginLoc = childStmt->getEndLoc();
     }
 
     AnnotationsRef annotations =
-        m_ASTSerializer->getAnnotationManager().getInRange(beginLoc,
-                                                           stmt->getRBracLoc());
-    stmtListSerializer << annotations;
+        annotationCursor.getInRange(beginLoc, stmt->getRBracLoc());
+    annotationsBefore.push_back(annotations);
+    nbChildren += annotations.size();
 
     stubs::Stmt::Compound::Builder compoundBuilder = m_builder.initCompound();
-    ListBuilder<stubs::Node<stubs::Stmt>> children =
-        compoundBuilder.initStmts(stmtListSerializer.size());
-    stmtListSerializer.adoptToListBuilder(children);
+    StmtListWriter children(compoundBuilder.initStmts(nbChildren),
+                            StmtSerializer(*m_ASTSerializer));
+    const AnnotationsRef *childAnnotations = annotationsBefore.begin();
+    for (const clang::Stmt *childStmt : stmt->body()) {
+      children << *childAnnotations++ << childStmt;
+    }
+    children << *childAnnotations;
+    assert(children.isComplete() && "Not every child is serialized");
 
     LocBuilder rBraceLocBuilder = compoundBuilder.initRBrace();
     auto rBraceLoc = stmt->getRBracLoc();
@@ -162,32 +177,96 @@ struct StmtSerializerImpl
     return true;
   }
 
-  using SwitchCaseSerializers =
-      std::pair<const clang::SwitchCase *, StmtListSerializer>;
-
-  void
-  serializeSwitchCases(stubs::Stmt::Switch::Builder switchBuilder,
-                       llvm::MutableArrayRef<SwitchCaseSerializers> cases) {
+  /**
+   * @brief A case label of a switch body and the nodes it contributes: the
+   * annotations after its colon and the statements up to the next label,
+   * which are stored in the flat list of the switch.
+   */
+  struct SwitchCaseNodes {
+    const clang::SwitchCase *switchCase;
+    AnnotationsRef leadingAnnotations;
+    size_t firstStmt; ///< Index of its first statement in the flat list.
+    size_t nbNodes;   ///< Number of nodes of its statement list.
+  };
+
+  /// A statement of a switch body with the annotations that follow it.
+  using SwitchStmtNodes = std::pair<const clang::Stmt *, AnnotationsRef>;
+
+  /**
+   * @brief Serialize the cases of a switch whose nodes have all been looked
+   * up, so every statement list is sized up front and written in place.
+   */
+  void serializeSwitchCases(stubs::Stmt::Switch::Builder switchBuilder,
+                            llvm::ArrayRef<SwitchCaseNodes> cases,
+                            llvm::ArrayRef<SwitchStmtNodes> stmts) {
     ListBuilder<stubs::Node<stubs::Stmt>> casesBuilder =
         switchBuilder.initCases(cases.size());
-    size_t i(0);
-    for (auto &[switchCase, listSerializer] : cases) {
-      StmtNodeBuilder stmtBuilder = casesBuilder[i++];
+    for (size_t i = 0; i < cases.size(); ++i) {
+      const SwitchCaseNodes &caseNodes = cases[i];
+      StmtNodeBuilder stmtBuilder = casesBuilder[i];
       m_ASTSerializer->serialize(stmtBuilder.initLoc(),
-                                 switchCase->getKeywordLoc());
+                                 caseNodes.switchCase->getKeywordLoc());
+
+      ListBuilder<stubs::Node<stubs::Stmt>> stmtsBuilder;
       if (const clang::CaseStmt *caseStmt =
-              llvm::dyn_cast<clang::CaseStmt>(switchCase)) {
+              llvm::dyn_cast<clang::CaseStmt>(caseNodes.switchCase)) {
         stubs::Stmt::Case::Builder caseBuilder =
             stmtBuilder.initDesc().initCase();
         m_ASTSerializer->serialize(caseBuilder.initLhs(), caseStmt->getLHS());
-        listSerializer.adoptToListBuilder(
-            caseBuilder.initStmts(listSerializer.size()));
+        stmtsBuilder = caseBuilder.initStmts(caseNodes.nbNodes);
+      } else {
+        stmtsBuilder =
+            stmtBuilder.initDesc().initDefCase().initStmts(caseNodes.nbNodes);
+      }
+
+      StmtListWriter writer(stmtsBuilder, StmtSerializer(*m_ASTSerializer));
+      writer << caseNodes.leadingAnnotations;
+      size_t end = i + 1 < cases.size() ? cases[i + 1].firstStmt : stmts.size();
+      for (size_t j = caseNodes.firstStmt; j < end; ++j) {
+        writer << stmts[j].first << stmts[j].second;
+      }
+      assert(writer.isComplete() && "Not every node is serialized");
+    }
+
+    serializeDenseCases(switchBuilder, cases);
+  }
+
+  /**
+   * @brief Serialize the sorted values of the case labels of a switch if all
+   * labels are constants, which is the case unless a label is a GNU case range
+   * or depends on a template parameter.
+   */
+  void serializeDenseCases(stubs::Stmt::Switch::Builder switchBuilder,
+                           llvm::ArrayRef<SwitchCaseNodes> cases) {
+    llvm::SmallVector<std::pair<int64_t, uint32_t>> values;
+    for (size_t i = 0; i < cases.size(); ++i) {
+      const auto *caseStmt =
+          llvm::dyn_cast<clang::CaseStmt>(cases[i].switchCase);
+      if (!caseStmt) {
         continue;
       }
+      const clang::Expr *lhs = caseStmt->getLHS();
+      if (caseStmt->getRHS() || lhs->isValueDependent()) {
+        return;
+      }
+      std::optional<int64_t> value =
+          lhs->EvaluateKnownConstInt(m_ASTSerializer->getASTContext())
+              .tryExtValue();
+      if (!value) {
+        return;
+      }
+      values.emplace_back(*value, i);
+    }
+    if (values.size() < minDenseCases) {
+      return;
+    }
 
-      listSerializer.adoptToListBuilder(
-          stmtBuilder.initDesc().initDefCase().initStmts(
-              listSerializer.size()));
+    llvm::sort(values);
+    ListBuilder<stubs::Stmt::DenseCase> denseBuilder =
+        switchBuilder.initDenseCases(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      denseBuilder[i].setValue(values[i].first);
+      denseBuilder[i].setCase(values[i].second);
     }
   }
 
@@ -195,7 +274,10 @@ struct StmtSerializerImpl
     stubs::Stmt::Switch::Builder switchBuilder = m_builder.initSwitch();
     m_ASTSerializer->serialize(switchBuilder.initCond(), stmt->getCond());
 
-    llvm::SmallVector<SwitchCaseSerializers> cases;
+    // The cases and their statements are looked up first, so that no case
+    // needs a list of orphans of its own.
+    llvm::SmallVector<SwitchCaseNodes> cases;
+    llvm::SmallVector<SwitchStmtNodes> stmts;
     bool hasCases(false);
 
     // Switch body can be any statement in C++. The statement is unreachable if
@@ -203,20 +285,17 @@ struct StmtSerializerImpl
     const clang::Stmt *bodyStmt = stmt->getBody();
     if (const clang::CompoundStmt *body =
             llvm::dyn_cast<clang::CompoundStmt>(bodyStmt)) {
+      const AnnotationManager &annotationManager =
+          m_ASTSerializer->getAnnotationManager();
+      AnnotationCursor annotationCursor(annotationManager);
       for (const clang::Stmt *childStmt : body->body()) {
         // Cases are nested if they do not contain a break statement
         while (const clang::SwitchCase *switchCase =
                    llvm::dyn_cast_or_null<clang::SwitchCase>(childStmt)) {
           AnnotationsRef annotations =
-              m_ASTSerializer->getAnnotationManager().getSequenceAfterLoc(
-                  switchCase->getColonLoc());
-          cases.emplace_back(
-                   switchCase,
-                   StmtListSerializer(
-                       capnp::Orphanage::getForMessageContaining(m_builder),
-                       StmtSerializer(*m_ASTSerializer)))
-                  .second
-              << annotations;
+              annotationCursor.getSequenceAfterLoc(switchCase->getColonLoc());
+          cases.push_back(
+              {switchCase, annotations, stmts.size(), annotations.size()});
           childStmt = switchCase->getSubStmt();
         }
 
@@ -224,34 +303,31 @@ struct StmtSerializerImpl
           continue;
 
         clang::Token nextToken =
-            getNextToken(childStmt->getEndLoc(),
-                         m_ASTSerializer->getASTContext().getSourceManager(),
-                         m_ASTSerializer->getASTContext().getLangOpts());
+            annotationManager.getTokenIndex().getNextToken(
+                childStmt->getEndLoc());
 
         // Other statements for the same case are listed within the switch body
-        cases.back().second
-            << childStmt
-            << m_ASTSerializer->getAnnotationManager().getSequenceAfterLoc(
-                   nextToken.is(clang::tok::semi) ? nextToken.getLocation()
-                                                  : childStmt->getEndLoc());
+        AnnotationsRef annotations = annotationCursor.getSequenceAfterLoc(
+            nextToken.is(clang::tok::semi) ? nextToken.getLocation()
+                                           : childStmt->getEndLoc());
+        stmts.emplace_back(childStmt, annotations);
+        cases.back().nbNodes += 1 + annotations.size();
       }
       hasCases = true;
     }
 
     else if (const clang::SwitchCase *switchCase =
                  llvm::dyn_cast<clang::SwitchCase>(bodyStmt)) {
-      cases.emplace_back(
-          switchCase, StmtListSerializer(
-                          capnp::Orphanage::getForMessageContaining(m_builder),
-                          StmtSerializer(*m_ASTSerializer)));
+      cases.push_back({switchCase, {}, 0, 0});
       if (const clang::Stmt *subStmt = switchCase->getSubStmt()) {
-        cases.back().second << subStmt;
+        stmts.emplace_back(subStmt, AnnotationsRef());
+        cases.back().nbNodes = 1;
       }
       hasCases = true;
     }
 
     if (hasCases) {
-      serializeSwitchCases(switchBuilder, cases);
+      serializeSwitchCases(switchBuilder, cases, stmts);
       return true;
     }
 
@@ -312,10 +388,13 @@ void StmtSerializer::serialize(const clang::Stmt *stmt,
                                stubs::Stmt::Builder stmtBuilder) const {
   assert(stmt && "Statement should not be null");
 
+  Census::Node census(Census::Stmts, stmt->getStmtClassName());
+  VF_TRACE_SCOPE("SerializeStmt", stmt->getStmtClassName());
   clang::SourceRange range = getRange(stmt);
   StmtSerializerImpl serializer(*m_ASTSerializer, stmtBuilder);
   serializer.serialize(stmt);
   m_ASTSerializer->serialize(locBuilder, range);
+  census.record(stmtBuilder, locBuilder);
 }
 
 void StmtSerializer::serialize(const Annotation &annotation,
@@ -323,7 +402,15 @@ void StmtSerializer::serialize(const Annotation &annotation,
                                stubs::Stmt::Builder stmtBuilder) const {
   clang::SourceRange range = annotation.getRange();
   m_ASTSerializer->serialize(locBuilder, range);
-  stmtBuilder.setAnn(annotation.getText().data());
+  m_ASTSerializer->serializeText(
+      annotation.getText(), range.getBegin(),
+      [&](unsigned size) { return stmtBuilder.initAnn(size); },
+      [&]() { return stmtBuilder.initAnnSlice(); });
+  m_ASTSerializer->serializeTokens(annotation.getText(), [&](unsigned size) {
+    return stmtBuilder.initAnnTokens(size);
+  });
+  stmtBuilder.setAnnKeyword(
+      static_cast<stubs::AnnotationKeyword>(annotation.getKeyword()));
 }
 
 } // namespace vf
\ No newline at end of file
@@ -12,8 +12,9 @@ namespace vf {
  * @brief Specialized serializer for statements.
  * 
  */
-class StmtSerializer : public NodeSerializer<stubs::Stmt, const clang::Stmt *>,
-                       public NodeSerializer<stubs::Stmt, const Annotation &> {
+class StmtSerializer final
+    : public NodeSerializer<stubs::Stmt, const clang::Stmt *>,
+      public NodeSerializer<stubs::Stmt, const Annotation &> {
 public:
   void serialize(const clang::Stmt *stmt, stubs::Loc::Builder locBuilder,
                  stubs::Stmt::Builder stmtBuilder) const override;
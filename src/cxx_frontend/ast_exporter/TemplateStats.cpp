@@ -0,0 +1,147 @@
+#include "TemplateStats.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/Sema/Sema.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include <chrono>
+
+namespace vf {
+
+namespace {
+
+struct TemplateCounts {
+  uint64_t instantiations = 0;
+  double seconds = 0;
+  uint64_t specs = 0;
+  uint64_t words = 0;
+};
+
+std::unique_ptr<llvm::StringMap<TemplateCounts>> state;
+
+/**
+ * @brief Template to which the work on a declaration is attributed, if any.
+ */
+const clang::TemplateDecl *templateOf(const clang::Decl *decl) {
+  if (!decl) {
+    return nullptr;
+  }
+  if (const auto *templ = llvm::dyn_cast<clang::TemplateDecl>(decl)) {
+    return templ;
+  }
+  if (const auto *spec =
+          llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(decl)) {
+    return spec->getSpecializedTemplate();
+  }
+  if (const auto *func = llvm::dyn_cast<clang::FunctionDecl>(decl)) {
+    if (const clang::FunctionTemplateDecl *templ = func->getPrimaryTemplate()) {
+      return templ;
+    }
+  }
+  // Members of class template specializations.
+  return templateOf(
+      llvm::dyn_cast_or_null<clang::Decl>(decl->getDeclContext()));
+}
+
+class TemplateTimer : public clang::TemplateInstantiationCallback {
+public:
+  void initialize(const clang::Sema &) override {}
+
+  void finalize(const clang::Sema &) override {}
+
+  void
+  atTemplateBegin(const clang::Sema &,
+                  const clang::Sema::CodeSynthesisContext &inst) override {
+    const clang::TemplateDecl *templ = templateOf(inst.Entity);
+    TemplateCounts *counts =
+        templ ? &(*state)[templ->getQualifiedNameAsString()] : nullptr;
+    if (counts &&
+        inst.Kind == clang::Sema::CodeSynthesisContext::TemplateInstantiation) {
+      ++counts->instantiations;
+    }
+    m_stack.push_back({counts, std::chrono::steady_clock::now(), 0});
+  }
+
+  void atTemplateEnd(const clang::Sema &,
+                     const clang::Sema::CodeSynthesisContext &) override {
+    if (m_stack.empty()) {
+      return;
+    }
+    Frame frame = m_stack.pop_back_val();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - frame.start)
+                         .count();
+    if (frame.counts) {
+      frame.counts->seconds += seconds - frame.nestedSeconds;
+    }
+    if (!m_stack.empty()) {
+      m_stack.back().nestedSeconds += seconds;
+    }
+  }
+
+private:
+  struct Frame {
+    TemplateCounts *counts;
+    std::chrono::steady_clock::time_point start;
+    double nestedSeconds;
+  };
+
+  llvm::SmallVector<Frame, 16> m_stack;
+};
+
+} // namespace
+
+std::unique_ptr<clang::TemplateInstantiationCallback>
+TemplateStats::callback() {
+  return std::make_unique<TemplateTimer>();
+}
+
+void TemplateStats::countSpecializations(const clang::TemplateDecl *decl,
+                                         uint64_t specs, uint64_t words) {
+  if (!state) {
+    return;
+  }
+  TemplateCounts &counts = (*state)[decl->getQualifiedNameAsString()];
+  counts.specs += specs;
+  counts.words += words;
+}
+
+void TemplateStats::enable() {
+  if (!state) {
+    state = std::make_unique<llvm::StringMap<TemplateCounts>>();
+  }
+}
+
+bool TemplateStats::isEnabled() { return state != nullptr; }
+
+void TemplateStats::print(llvm::raw_ostream &os, unsigned nbRows) {
+  if (!state) {
+    return;
+  }
+
+  llvm::SmallVector<const llvm::StringMapEntry<TemplateCounts> *, 64> rows;
+  for (const llvm::StringMapEntry<TemplateCounts> &entry : *state) {
+    rows.push_back(&entry);
+  }
+  llvm::stable_sort(rows, [](const auto *lhs, const auto *rhs) {
+    return std::make_pair(lhs->getValue().seconds, lhs->getValue().words) >
+           std::make_pair(rhs->getValue().seconds, rhs->getValue().words);
+  });
+  if (rows.size() > nbRows) {
+    rows.resize(nbRows);
+  }
+
+  os << llvm::format("%10s %14s %8s %12s  %s\n", "seconds", "instantiations",
+                     "specs", "words", "template");
+  for (const llvm::StringMapEntry<TemplateCounts> *row : rows) {
+    const TemplateCounts &counts = row->getValue();
+    os << llvm::format("%10.6f %14llu %8llu %12llu  ", counts.seconds,
+                       static_cast<unsigned long long>(counts.instantiations),
+                       static_cast<unsigned long long>(counts.specs),
+                       static_cast<unsigned long long>(counts.words))
+       << row->getKey() << '\n';
+  }
+}
+
+} // namespace vf
@@ -0,0 +1,52 @@
+#pragma once
+#include "clang/AST/DeclTemplate.h"
+#include "clang/Sema/TemplateInstCallback.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+
+namespace vf {
+
+/**
+ * @brief Cost of every template of the exported translation units, as
+ * reported by `-template_stats`: the instantiations Sema performed for it and
+ * the time they took, and the specializations of function templates that were
+ * serialized with the words they take in the output.
+ *
+ * The time of an instantiation excludes that of the instantiations it
+ * triggered, which are attributed to their own templates, and includes the
+ * substitutions of template arguments during overload resolution. Members of
+ * class template specializations count towards their class template.
+ * Templates are identified by their qualified name, so the numbers add up over
+ * all translation units. Nothing is recorded unless the report is enabled, and
+ * it must only be enabled when a single thread exports.
+ */
+class TemplateStats {
+public:
+  /**
+   * @brief Callback to register with the Sema of a translation unit, which
+   * times its instantiations.
+   */
+  static std::unique_ptr<clang::TemplateInstantiationCallback> callback();
+
+  /**
+   * @brief Count the serialized specializations of a function template.
+   *
+   * @param specs Number of specializations.
+   * @param words Words of the specializations in the output.
+   */
+  static void countSpecializations(const clang::TemplateDecl *decl,
+                                   uint64_t specs, uint64_t words);
+
+  static void enable();
+
+  static bool isEnabled();
+
+  /**
+   * @brief Print the given number of templates whose instantiations took the
+   * most time, most expensive first.
+   */
+  static void print(llvm::raw_ostream &os, unsigned nbRows);
+};
+
+} // namespace vf
@@ -1,9 +1,15 @@
 #pragma once
 #include "clang/Basic/SourceLocation.h"
-#include <string>
 #include <string_view>
 
 namespace vf {
+
+/**
+ * @brief Text of a comment. The text is not copied; it refers to the buffer of
+ * the source manager that the comment was lexed from, which outlives it.
+ * Hence, the text is not NUL-terminated.
+ *
+ */
 class Text {
 public:
   clang::SourceRange getRange() const { return m_range; }
@@ -13,8 +19,13 @@ public:
   Text(clang::SourceRange range, std::string_view text)
       : m_range(range), m_text(text) {}
 
+  Text(Text &&) = default;
+  Text &operator=(Text &&) = default;
+  Text(const Text &) = delete;
+  Text &operator=(const Text &) = delete;
+
 private:
   clang::SourceRange m_range;
-  std::string m_text;
+  std::string_view m_text;
 };
 } // namespace vf
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "ThreadedMessageWriter.h"
+#include "Census.h"
+#include "capnp/serialize.h"
+
+namespace vf {
+
+ThreadedMessageWriter::ThreadedMessageWriter(MessageWriter &target,
+                                             size_t maxQueuedBytes)
+    : m_target(&target), m_maxQueuedBytes(maxQueuedBytes) {
+  // Started last, once the members it uses are initialized.
+  m_thread = std::thread([this] { run(); });
+}
+
+void ThreadedMessageWriter::write(capnp::MessageBuilder &message) {
+  // The builder may be reused or destroyed as soon as this returns.
+  Census::countMessage(message);
+  push(capnp::messageToFlatArray(message));
+}
+
+void ThreadedMessageWriter::write(kj::ArrayPtr<const capnp::word> words) {
+  push(kj::heapArray(words));
+}
+
+void ThreadedMessageWriter::push(kj::Array<capnp::word> words) {
+  size_t bytes = words.size() * sizeof(capnp::word);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  // A message larger than the bound is still queued once the queue is empty.
+  m_changed.wait(lock, [&] {
+    return m_queue.empty() || m_queuedBytes + bytes <= m_maxQueuedBytes;
+  });
+  m_queuedBytes += bytes;
+  m_queue.push_back(std::move(words));
+  m_changed.notify_all();
+}
+
+void ThreadedMessageWriter::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_changed.wait(lock, [&] { return m_closed || !m_queue.empty(); });
+    if (m_queue.empty()) {
+      return;
+    }
+    kj::Array<capnp::word> words = std::move(m_queue.front());
+    m_queue.pop_front();
+
+    lock.unlock();
+    m_target->write(words.asPtr());
+    size_t bytes = words.size() * sizeof(capnp::word);
+    words = nullptr;
+    lock.lock();
+
+    m_queuedBytes -= bytes;
+    m_changed.notify_all();
+  }
+}
+
+ThreadedMessageWriter::~ThreadedMessageWriter() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+  }
+  m_changed.notify_all();
+  m_thread.join();
+}
+
+} // namespace vf
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "MessageWriter.h"
+#include "kj/array.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace vf {
+
+/**
+ * @brief Hands messages to a dedicated thread that writes them to another
+ * writer, so serialization goes on while a slow consumer drains the output.
+ * Messages are flattened on the calling thread and written in the order in
+ * which they were handed over. Writes are serialized, so one writer can be
+ * shared by several threads.
+ *
+ * The target is only used by the writer thread, so it must not record
+ * `-timings`, which are not thread-safe.
+ */
+class ThreadedMessageWriter : public MessageWriter {
+public:
+  /**
+   * @param target Writer the messages are written to. It must outlive this
+   * writer.
+   * @param maxQueuedBytes Size of the queued messages beyond which `write`
+   * waits for the writer thread, which bounds the memory they take.
+   */
+  explicit ThreadedMessageWriter(MessageWriter &target,
+                                 size_t maxQueuedBytes = size_t(256) << 20);
+
+  void write(capnp::MessageBuilder &message) override;
+
+  void write(kj::ArrayPtr<const capnp::word> words) override;
+
+  /**
+   * @brief Wait until all queued messages are written and stop the writer
+   * thread.
+   */
+  ~ThreadedMessageWriter() override;
+
+  ThreadedMessageWriter(const ThreadedMessageWriter &) = delete;
+  ThreadedMessageWriter &operator=(const ThreadedMessageWriter &) = delete;
+
+private:
+  void push(kj::Array<capnp::word> words);
+
+  void run();
+
+  MessageWriter *m_target;
+  size_t m_maxQueuedBytes;
+  size_t m_queuedBytes = 0;
+  bool m_closed = false;
+  std::deque<kj::Array<capnp::word>> m_queue;
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  std::thread m_thread;
+};
+
+} // namespace vf
@@ -0,0 +1,87 @@
+#include "Timings.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+#include <array>
+#include <memory>
+
+namespace vf {
+
+namespace {
+
+constexpr std::array<const char *, Timings::NbPhases> phaseNames = {
+    "parse", "comments", "context_free_checks", "serialize",
+    "decls", "stmts",    "exprs",               "types",
+    "locations", "inclusions", "output"};
+
+struct TimingsState {
+  std::array<llvm::TimeRecord, Timings::NbPhases> totals;
+  ///< Phases of the active scopes, innermost last.
+  llvm::SmallVector<Timings::Phase, 16> stack;
+  ///< Time at which the innermost phase started or resumed.
+  llvm::TimeRecord start;
+
+  void stopInnermost() {
+    llvm::TimeRecord now = llvm::TimeRecord::getCurrentTime(false);
+    now -= start;
+    totals[stack.back()] += now;
+  }
+
+  void resume() { start = llvm::TimeRecord::getCurrentTime(true); }
+};
+
+std::unique_ptr<TimingsState> state;
+
+} // namespace
+
+Timings::Scope::Scope(Phase phase) : m_active(false) {
+  if (!state) {
+    return;
+  }
+  // Nested scopes of the same phase, like a statement within a statement, do
+  // not stop its timer.
+  if (!state->stack.empty()) {
+    if (state->stack.back() == phase) {
+      return;
+    }
+    state->stopInnermost();
+  }
+  state->stack.push_back(phase);
+  state->resume();
+  m_active = true;
+}
+
+Timings::Scope::~Scope() {
+  if (!m_active) {
+    return;
+  }
+  state->stopInnermost();
+  state->stack.pop_back();
+  if (!state->stack.empty()) {
+    state->resume();
+  }
+}
+
+void Timings::enable() {
+  if (!state) {
+    state = std::make_unique<TimingsState>();
+  }
+}
+
+bool Timings::isEnabled() { return state != nullptr; }
+
+void Timings::printJSON(llvm::raw_ostream &os) {
+  if (!state) {
+    return;
+  }
+  os << '{';
+  for (unsigned i = 0; i < NbPhases; ++i) {
+    const llvm::TimeRecord &total = state->totals[i];
+    os << (i == 0 ? "" : ",") << '"' << phaseNames[i] << "\":{\"wall\":"
+       << llvm::format("%.6f", total.getWallTime()) << ",\"cpu\":"
+       << llvm::format("%.6f", total.getProcessTime()) << '}';
+  }
+  os << "}\n";
+}
+
+} // namespace vf
@@ -0,0 +1,58 @@
+#pragma once
+#include "llvm/Support/raw_ostream.h"
+
+namespace vf {
+
+/**
+ * @brief Wall and CPU time spent by the exporter in each of its phases, as
+ * reported by `-timings`.
+ *
+ * A phase is timed by a `Scope`. Scopes nest: the time spent in an inner scope
+ * of another phase is only attributed to the inner phase, so the times of all
+ * phases add up to the total time. Nothing is recorded unless timings are
+ * enabled, and they must only be enabled when a single thread exports.
+ */
+class Timings {
+public:
+  enum Phase : unsigned {
+    Parse,             ///< Preprocessing and Sema, without the phases below.
+    Comments,          ///< The comment processor.
+    ContextFreeChecks, ///< The context-free macro checks.
+    Serialize,         ///< Serialization, without the phases below.
+    Decls,
+    Stmts,
+    Exprs,
+    Types,
+    Locations,
+    Inclusions, ///< The include tree of a translation unit.
+    Output,     ///< Writing the messages to their file descriptor.
+    NbPhases
+  };
+
+  /**
+   * @brief Attributes the time until its destruction to a phase.
+   */
+  class Scope {
+  public:
+    explicit Scope(Phase phase);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    bool m_active;
+  };
+
+  static void enable();
+
+  static bool isEnabled();
+
+  /**
+   * @brief Print the times of every phase as a single-line JSON object that
+   * maps each phase to its `wall` and `cpu` time in seconds.
+   */
+  static void printJSON(llvm::raw_ostream &os);
+};
+
+} // namespace vf
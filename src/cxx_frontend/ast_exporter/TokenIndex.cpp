@@ -0,0 +1,63 @@
+#include "TokenIndex.h"
+#include "Location.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/STLExtras.h"
+#include <cassert>
+
+namespace vf {
+
+llvm::ArrayRef<clang::Token>
+TokenIndex::getTokens(clang::FileID fileID) const {
+  auto it = m_tokensMap.find(fileID);
+  if (it != m_tokensMap.end()) {
+    return it->getSecond();
+  }
+
+  llvm::SmallVector<clang::Token, 0> &tokens = m_tokensMap[fileID];
+  bool invalid = false;
+  llvm::StringRef buffer = m_sourceManager->getBufferData(fileID, &invalid);
+  if (invalid) {
+    return tokens;
+  }
+
+  clang::Lexer lexer(m_sourceManager->getLocForStartOfFile(fileID), *m_langOpts,
+                     buffer.begin(), buffer.begin(), buffer.end());
+  clang::Token token;
+  do {
+    lexer.LexFromRawLexer(token);
+    tokens.push_back(token);
+  } while (token.isNot(clang::tok::eof));
+
+  return tokens;
+}
+
+clang::Token TokenIndex::getNextToken(clang::SourceLocation loc) const {
+  // Tokens from macro expansions are not indexed.
+  if (loc.isMacroID()) {
+    return vf::getNextToken(loc, *m_sourceManager, *m_langOpts);
+  }
+
+  llvm::ArrayRef<clang::Token> tokens =
+      getTokens(m_sourceManager->getFileID(loc));
+
+  // Comments are not indexed and no token starts inside of a token or
+  // comment, so the next token is the first one that starts after `loc`.
+  const clang::Token *next =
+      llvm::partition_point(tokens, [loc](const clang::Token &token) {
+        return token.getLocation() <= loc;
+      });
+
+  if (next == tokens.end()) {
+    return vf::getNextToken(loc, *m_sourceManager, *m_langOpts);
+  }
+  return *next;
+}
+
+clang::Token TokenIndex::expectNextToken(clang::SourceLocation loc,
+                                         clang::tok::TokenKind kind) const {
+  clang::Token nextToken(getNextToken(loc));
+  assert(nextToken.is(kind) && "Expected other token");
+  return nextToken;
+}
+
+} // namespace vf
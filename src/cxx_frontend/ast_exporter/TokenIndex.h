@@ -0,0 +1,58 @@
+#pragma once
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Token.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace vf {
+
+/**
+ * @brief Index of the raw tokens of the files of a translation unit. Each file
+ * is lexed once, on its first query, after which the token that follows a
+ * location is found by a binary search instead of by lexing from that
+ * location again.
+ *
+ */
+class TokenIndex {
+public:
+  /**
+   * @brief Get the first raw token after the token or comment at the given
+   * location. Comments are skipped, as by `clang::Lexer::findNextToken`.
+   *
+   * @param loc Location of a token or comment
+   * @return Next token
+   */
+  clang::Token getNextToken(clang::SourceLocation loc) const;
+
+  /**
+   * @brief Same as `getNextToken`, but asserts that the next token is of the
+   * given kind.
+   */
+  clang::Token expectNextToken(clang::SourceLocation loc,
+                               clang::tok::TokenKind kind) const;
+
+  TokenIndex(const clang::SourceManager &sourceManager,
+             const clang::LangOptions &langOpts)
+      : m_sourceManager(&sourceManager), m_langOpts(&langOpts) {}
+
+private:
+  /**
+   * @brief Get the raw tokens of a file, ordered by offset and ending with the
+   * end of file token. Lexes the file if it has not been indexed yet.
+   *
+   * @param fileID File to get the tokens of
+   * @return Tokens of the file, or an empty list if its buffer is invalid
+   */
+  llvm::ArrayRef<clang::Token> getTokens(clang::FileID fileID) const;
+
+  const clang::SourceManager *m_sourceManager;
+  const clang::LangOptions *m_langOpts;
+  ///< Raw tokens indexed by file.
+  mutable llvm::DenseMap<clang::FileID, llvm::SmallVector<clang::Token, 0>>
+      m_tokensMap;
+};
+
+} // namespace vf
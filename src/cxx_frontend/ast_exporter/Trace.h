@@ -0,0 +1,22 @@
+#pragma once
+
+/**
+ * @brief Scoped trace events of the exporter, which are compiled in when the
+ * exporter is built with VF_TRACE (the VF_CXX_EXPORTER_TRACE CMake option) and
+ * written by `-trace` in Chrome's trace event format.
+ *
+ * Events are recorded with `llvm::TimeTraceScope`, so the events of Clang
+ * itself, like parsing a class or instantiating templates, land in the same
+ * trace. The detail of an event is only computed when the trace is enabled.
+ */
+#ifdef VF_TRACE
+#include "llvm/Support/TimeProfiler.h"
+
+#define VF_TRACE_SCOPE(NAME, DETAIL)                                           \
+  llvm::TimeTraceScope vfTraceScope(                                           \
+      NAME, [&] { return std::string(DETAIL); })
+#else
+#define VF_TRACE_SCOPE(NAME, DETAIL)                                           \
+  do {                                                                         \
+  } while (false)
+#endif
@@ -1,22 +1,18 @@
 #include "TranslationUnitSerializer.h"
 #include "ASTSerializer.h"
+#include "FileCosts.h"
+#include "ForkedPartitions.h"
 #include "InclusionSerializer.h"
+#include "PooledMessageBuilder.h"
+#include "Timings.h"
 #include "Location.h"
+#include "Trace.h"
 #include "clang/Basic/FileManager.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
 
 namespace vf {
 
-DeclListSerializer &
-TranslationUnitSerializer::getDeclSerializer(unsigned uid) const {
-  auto it = m_declsMap.find(uid);
-  if (it != m_declsMap.end()) {
-    return it->getSecond();
-  }
-
-  return m_declsMap.try_emplace(uid, m_orphanage, DeclSerializer(m_serializer))
-      .first->getSecond();
-}
-
 namespace {
 
 void updateFirstDecl(llvm::SmallDenseMap<unsigned, clang::SourceLocation> &map,
@@ -27,79 +23,397 @@ void updateFirstDecl(llvm::SmallDenseMap<unsigned, clang::SourceLocation> &map,
   }
 }
 
+// Serializes the locations, names and types interned by the nodes of a message
+// to the tables of its translation unit or declarations.
+template <typename Builder>
+void serializeTables(const ASTSerializer &serializer, Builder builder) {
+  if (serializer.usesLocationTable()) {
+    serializer.serializeLocationTable(
+        builder.initLocs(serializer.nbInternedLocations()));
+  }
+  if (serializer.usesNameTable()) {
+    serializer.serializeNameTable(
+        builder.initNames(serializer.nbInternedNames()));
+  }
+  if (serializer.usesTypeTable()) {
+    serializer.serializeTypeTable(
+        builder.initTypes(serializer.nbInternedTypes()));
+  }
+}
+
 } // namespace
 
-void TranslationUnitSerializer::serializeDecl(const clang::Decl *decl) const {
-  clang::SourceRange declRange = decl->getSourceRange();
+TranslationUnitSerializer::DeclNodes
+TranslationUnitSerializer::getDeclNodes(
+    const clang::Decl *decl, bool firstInFile,
+    AnnotationCursor &annotationCursor) const {
+  DeclNodes nodes;
+  if (firstInFile) {
+    nodes.leadingAnnotations =
+        m_annotationManager->getInRange({}, decl->getSourceRange().getBegin());
+  }
 
-  const clang::FileEntry *fileEntry =
-      fileEntryOfLoc(decl->getBeginLoc(), m_ASTContext->getSourceManager());
-  unsigned fileUID = fileEntry->getUID();
+  nodes.decl =
+      !m_referencedDecls || m_referencedDecls->contains(decl) ? decl : nullptr;
 
-  updateFirstDecl(m_firstDeclLocMap, fileUID, declRange.getBegin());
-  DeclListSerializer &declSerializer = getDeclSerializer(fileUID);
+  clang::Token nextToken(
+      m_annotationManager->getTokenIndex().getNextToken(decl->getEndLoc()));
+  nodes.trailingAnnotations =
+      annotationCursor
+          .getSequenceAfterLoc(nextToken.is(clang::tok::semi)
+                                   ? nextToken.getLocation()
+                                   : decl->getEndLoc())
+          .drop_while(Annotation::Predicate<Annotation::Ann_ContractClause>());
+  return nodes;
+}
 
-  if (declSerializer.size() == 0) {
-    AnnotationsRef leadingAnnotations =
-        m_annotationManager->getInRange({}, declRange.getBegin());
-    declSerializer << leadingAnnotations;
+bool TranslationUnitSerializer::checkCancelled() const {
+  if (!m_cancelled && m_cancellation && m_cancellation->isRequested()) {
+    m_cancelled = true;
   }
+  return m_cancelled;
+}
 
-  clang::Token nextToken(getNextToken(decl->getEndLoc(),
-                                      m_ASTContext->getSourceManager(),
-                                      m_ASTContext->getLangOpts()));
-  declSerializer
-      << decl
-      << m_annotationManager
-             ->getSequenceAfterLoc(nextToken.is(clang::tok::semi)
-                                       ? nextToken.getLocation()
-                                       : decl->getEndLoc())
-             .drop_while(
-                 Annotation::Predicate<Annotation::Ann_ContractClause>());
+size_t TranslationUnitSerializer::nbNodes(llvm::ArrayRef<DeclNodes> nodes) {
+  size_t size = 0;
+  for (const DeclNodes &declNodes : nodes) {
+    size += declNodes.size();
+  }
+  return size;
 }
 
-void TranslationUnitSerializer::serializeFile(
-    const clang::FileEntry *fileEntry, stubs::File::Builder fileBuilder) const {
-  DeclListSerializer &declSerializer = getDeclSerializer(fileEntry->getUID());
+size_t TranslationUnitSerializer::nbDecls(llvm::ArrayRef<DeclNodes> nodes) {
+  return llvm::count_if(
+      nodes, [](const DeclNodes &declNodes) { return declNodes.decl; });
+}
 
-  if (declSerializer.size() == 0) {
-    declSerializer << m_annotationManager->getAll(fileEntry);
+void TranslationUnitSerializer::serializeDeclNodes(
+    llvm::ArrayRef<DeclNodes> nodes,
+    ListBuilder<stubs::Node<stubs::Decl>> builder) const {
+  DeclListWriter declWriter(builder, DeclSerializer(m_serializer));
+  for (const DeclNodes &declNodes : nodes) {
+    if (declNodes.decl && checkCancelled()) {
+      return;
+    }
+    declWriter << declNodes.leadingAnnotations;
+    if (declNodes.decl) {
+      VF_TRACE_SCOPE("SerializeTopLevelDecl", [decl = declNodes.decl] {
+        const auto *named = llvm::dyn_cast<clang::NamedDecl>(decl);
+        return named ? named->getQualifiedNameAsString()
+                     : std::string(decl->getDeclKindName());
+      }());
+      declWriter << declNodes.decl;
+    }
+    declWriter << declNodes.trailingAnnotations;
   }
+  assert(declWriter.isComplete() && "Not every node is serialized");
+}
 
-  fileBuilder.setFd(fileEntry->getUID());
+void TranslationUnitSerializer::serializeFile(
+    const clang::FileEntry *fileEntry, stubs::File::Builder fileBuilder,
+    const FileDeclNodes &fileDeclNodes) const {
+  fileBuilder.setFd(m_serializer.getFileIds().fd(*fileEntry));
   fileBuilder.setPath(fileEntry->getName().str());
 
-  declSerializer.adoptToListBuilder(
-      fileBuilder.initDecls(declSerializer.size()));
+  auto it = fileDeclNodes.find(fileEntry->getUID());
+  if (it != fileDeclNodes.end()) {
+    llvm::ArrayRef<DeclNodes> nodes = it->getSecond();
+    serializeDeclNodes(nodes, fileBuilder.initDecls(nbNodes(nodes)));
+    if (FileCosts::isEnabled()) {
+      FileCosts::countDecls(
+          fileEntry, nbDecls(nodes),
+          fileBuilder.getDecls().asReader().totalSize().wordCount);
+    }
+    return;
+  }
+
+  DeclNodes annotations{m_annotationManager->getAll(fileEntry), nullptr, {}};
+  serializeDeclNodes(annotations, fileBuilder.initDecls(annotations.size()));
+}
+
+bool TranslationUnitSerializer::shouldSerialize(const clang::Decl *decl) const {
+  return !m_serializer.isSkipped(decl) && decl->getSourceRange().isValid();
 }
 
 void TranslationUnitSerializer::serialize(
     const clang::TranslationUnitDecl *translationUnitDecl,
     stubs::TU::Builder translationUnitBuilder) const {
+  const clang::SourceManager &sourceManager = m_ASTContext->getSourceManager();
+
+  // All nodes are looked up first, so every file's declarations can be
+  // serialized in place.
+  llvm::SmallVector<const clang::Decl *> decls;
+  collectDecls(translationUnitDecl, decls);
+
+  FileDeclNodes fileDeclNodes;
+  AnnotationCursor annotationCursor(*m_annotationManager);
+  for (const clang::Decl *decl : decls) {
+    llvm::SmallVector<DeclNodes, 0> &nodes =
+        fileDeclNodes[fileEntryOfLoc(decl->getBeginLoc(), sourceManager)
+                          ->getUID()];
+    nodes.push_back(getDeclNodes(decl, nodes.empty(), annotationCursor));
+  }
+
+  serializeHeader(translationUnitBuilder, &fileDeclNodes);
+  if (m_cancelled) {
+    return;
+  }
+  serializeTables(m_serializer, translationUnitBuilder);
+}
+
+void TranslationUnitSerializer::collectDecls(
+    const clang::TranslationUnitDecl *translationUnitDecl,
+    llvm::SmallVectorImpl<const clang::Decl *> &decls) const {
+  const clang::SourceManager &sourceManager = m_ASTContext->getSourceManager();
   for (const clang::Decl *decl : translationUnitDecl->decls()) {
-    if (decl->getSourceRange().isInvalid() ||
-        (decl->isImplicit() && m_serializer.skipImplicitDecls())) {
+    if (shouldSerialize(decl)) {
+      decls.push_back(decl);
+      updateFirstDecl(m_firstDeclLocMap,
+                      fileEntryOfLoc(decl->getBeginLoc(), sourceManager)
+                          ->getUID(),
+                      decl->getSourceRange().getBegin());
+    }
+  }
+}
+
+void TranslationUnitSerializer::writeFileDecls(
+    unsigned fileUID, llvm::ArrayRef<DeclNodes> nodes,
+    llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage) const {
+  PooledMessageBuilder messageBuilder;
+  stubs::FileDecls::Builder fileDeclsBuilder =
+      messageBuilder.initRoot<stubs::StreamMessage>().initDecls();
+  fileDeclsBuilder.setFd(m_serializer.getFileIds().fd(fileUID));
+  serializeDeclNodes(nodes, fileDeclsBuilder.initDecls(nbNodes(nodes)));
+  if (m_cancelled) {
+    return;
+  }
+  serializeTables(m_serializer, fileDeclsBuilder);
+  if (FileCosts::isEnabled()) {
+    llvm::SmallVector<const clang::FileEntry *> fileEntries;
+    m_ASTContext->getSourceManager().getFileManager().GetUniqueIDMapping(
+        fileEntries);
+    FileCosts::countDecls(
+        fileUID < fileEntries.size() ? fileEntries[fileUID] : nullptr,
+        nbDecls(nodes),
+        fileDeclsBuilder.asReader().totalSize().wordCount);
+  }
+  writeMessage(messageBuilder);
+}
+
+void TranslationUnitSerializer::serializeStreamed(
+    const clang::TranslationUnitDecl *translationUnitDecl,
+    stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+    llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage) const {
+  serializeStreamed(translationUnitDecl, headerBuilder, writeHeader,
+                    writeMessage, nullptr);
+}
+
+void TranslationUnitSerializer::serializePartitioned(
+    const clang::TranslationUnitDecl *translationUnitDecl,
+    stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+    llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage,
+    const Partitions &partitions) const {
+  serializeStreamed(translationUnitDecl, headerBuilder, writeHeader,
+                    writeMessage, &partitions);
+}
+
+void TranslationUnitSerializer::serializeStreamed(
+    const clang::TranslationUnitDecl *translationUnitDecl,
+    stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+    llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage,
+    const Partitions *partitions) const {
+  const clang::SourceManager &sourceManager = m_ASTContext->getSourceManager();
+
+  // The includes of the header depend on the first declaration of each file.
+  llvm::SmallVector<const clang::Decl *> decls;
+  collectDecls(translationUnitDecl, decls);
+
+  serializeHeader(headerBuilder, nullptr);
+  serializeTables(m_serializer, headerBuilder);
+  writeHeader();
+
+  // The first declaration of each file is known up front, so a partition can
+  // start anywhere.
+  llvm::DenseSet<unsigned> startedFiles;
+  llvm::SmallVector<StreamedDecl, 0> streamedDecls;
+  streamedDecls.reserve(decls.size());
+  for (const clang::Decl *decl : decls) {
+    unsigned fileUID =
+        fileEntryOfLoc(decl->getBeginLoc(), sourceManager)->getUID();
+    streamedDecls.push_back(
+        {decl, fileUID, startedFiles.insert(fileUID).second});
+  }
+
+  // Forked processes do not see later cancellations, but they must not start
+  // out cancelled, since each of them writes a message per declaration.
+  if (!partitions || checkCancelled() ||
+      !writePartitionedDecls(streamedDecls, *partitions)) {
+    writeStreamedDecls(streamedDecls, writeMessage);
+  }
+
+  // Indexed, since serializing declarations can number more files.
+  const FileIds &fileIds = m_serializer.getFileIds();
+  for (unsigned fd = 0; fd < fileIds.entries().size(); ++fd) {
+    const clang::FileEntry *entry = fileIds.entry(fd);
+    if (!entry || startedFiles.contains(entry->getUID())) {
       continue;
     }
-    serializeDecl(decl);
+    AnnotationsRef annotations = m_annotationManager->getAll(entry);
+    if (!annotations.empty()) {
+      writeFileDecls(entry->getUID(), DeclNodes{annotations, nullptr, {}},
+                     writeMessage);
+    }
+  }
+}
+
+void TranslationUnitSerializer::writeStreamedDecls(
+    llvm::ArrayRef<StreamedDecl> decls,
+    llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage) const {
+  AnnotationCursor annotationCursor(*m_annotationManager);
+  for (const StreamedDecl &decl : decls) {
+    if (checkCancelled()) {
+      return;
+    }
+    writeFileDecls(
+        decl.fileUID,
+        getDeclNodes(decl.decl, decl.firstInFile, annotationCursor),
+        writeMessage);
+  }
+}
+
+bool TranslationUnitSerializer::writePartitionedDecls(
+    llvm::ArrayRef<StreamedDecl> decls, const Partitions &partitions) const {
+  size_t nbPartitions = std::min<size_t>(partitions.count, decls.size());
+  if (nbPartitions < 2) {
+    return false;
   }
+  auto partition = [&](unsigned index) {
+    size_t begin = decls.size() * index / nbPartitions;
+    size_t end = decls.size() * (index + 1) / nbPartitions;
+    return decls.slice(begin, end - begin);
+  };
 
-  llvm::SmallVector<const clang::FileEntry *> fileEntries;
-  m_ASTContext->getSourceManager().getFileManager().GetUniqueIDMapping(
-      fileEntries);
+  size_t nbFiles = m_serializer.getFileIds().entries().size();
+  std::vector<size_t> nbWritten(nbPartitions);
+  return runForked(
+      nbPartitions,
+      [&](unsigned index, MessageWriter &writer) {
+        writeStreamedDecls(partition(index),
+                           [&writer](capnp::MessageBuilder &message) {
+                             writer.write(message);
+                           });
+        // A file numbered by a child would get the same fd as a file
+        // numbered by another child.
+        if (m_serializer.getFileIds().entries().size() != nbFiles) {
+          return false;
+        }
+        capnp::MallocMessageBuilder stateBuilder;
+        partitions.saveState(stateBuilder);
+        writer.write(stateBuilder);
+        return true;
+      },
+      [&](unsigned index, kj::ArrayPtr<const capnp::word> words) {
+        // Every declaration is one message, followed by the saved state.
+        if (nbWritten[index]++ < partition(index).size()) {
+          partitions.writeMessage(words);
+        } else {
+          partitions.restoreState(words);
+        }
+      });
+}
+
+void TranslationUnitSerializer::serializeOnDemand(
+    const clang::TranslationUnitDecl *translationUnitDecl,
+    stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+    llvm::function_ref<bool(unsigned &)> nextRequest,
+    llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage,
+    llvm::function_ref<void()> endResponse) const {
+  const clang::SourceManager &sourceManager = m_ASTContext->getSourceManager();
+
+  llvm::SmallVector<const clang::Decl *> decls;
+  collectDecls(translationUnitDecl, decls);
+
+  serializeHeader(headerBuilder, nullptr);
+  serializeTables(m_serializer, headerBuilder);
+  writeHeader();
+
+  llvm::DenseMap<unsigned, llvm::SmallVector<const clang::Decl *, 0>>
+      declsOfFile;
+  for (const clang::Decl *decl : decls) {
+    declsOfFile[fileEntryOfLoc(decl->getBeginLoc(), sourceManager)->getUID()]
+        .push_back(decl);
+  }
+
+  unsigned fd;
+  while (nextRequest(fd)) {
+    const clang::FileEntry *entry = m_serializer.getFileIds().entry(fd);
+    if (!entry) {
+      endResponse();
+      continue;
+    }
+    unsigned fileUID = entry->getUID();
+    auto it = declsOfFile.find(fileUID);
+    if (it != declsOfFile.end()) {
+      bool firstInFile = true;
+      AnnotationCursor annotationCursor(*m_annotationManager);
+      for (const clang::Decl *decl : it->getSecond()) {
+        writeFileDecls(fileUID,
+                       getDeclNodes(decl, firstInFile, annotationCursor),
+                       writeMessage);
+        firstInFile = false;
+      }
+    } else {
+      AnnotationsRef annotations = m_annotationManager->getAll(entry);
+      if (!annotations.empty()) {
+        writeFileDecls(fileUID, DeclNodes{annotations, nullptr, {}},
+                       writeMessage);
+      }
+    }
+    endResponse();
+  }
+}
+
+void TranslationUnitSerializer::serializeFiles(
+    const clang::SourceManager &sourceManager, stubs::TU::Builder builder) {
+  FileIds fileIds(sourceManager);
+  llvm::ArrayRef<const clang::FileEntry *> fileEntries = fileIds.entries();
+  ListBuilder<stubs::File> filesBuilder = builder.initFiles(fileEntries.size());
+
+  for (unsigned fd = 0; fd < fileEntries.size(); ++fd) {
+    stubs::File::Builder fileBuilder = filesBuilder[fd];
+    fileBuilder.setFd(fd);
+    fileBuilder.setPath(fileEntries[fd]->getName().str());
+  }
+
+  builder.setMainFd(fileIds.fd(
+      *sourceManager.getFileEntryForID(sourceManager.getMainFileID())));
+}
+
+void TranslationUnitSerializer::serializeHeader(
+    stubs::TU::Builder translationUnitBuilder,
+    const FileDeclNodes *fileDeclNodes) const {
+  // Copied, since serializing declarations can number files that the file
+  // manager created after the numbering.
+  const FileIds &fileIds = m_serializer.getFileIds();
+  llvm::SmallVector<const clang::FileEntry *> fileEntries(
+      fileIds.entries().begin(), fileIds.entries().end());
   ListBuilder<stubs::File> filesBuilder =
       translationUnitBuilder.initFiles(fileEntries.size());
 
-  size_t i(0);
-  for (const clang::FileEntry *entry : fileEntries) {
-    stubs::File::Builder fileBuilder = filesBuilder[i++];
-    serializeFile(entry, fileBuilder);
+  for (unsigned fd = 0; fd < fileEntries.size(); ++fd) {
+    stubs::File::Builder fileBuilder = filesBuilder[fd];
+    if (fileDeclNodes) {
+      serializeFile(fileEntries[fd], fileBuilder, *fileDeclNodes);
+    } else {
+      fileBuilder.setFd(fd);
+      fileBuilder.setPath(fileEntries[fd]->getName().str());
+    }
   }
 
   clang::FileID mainUID = m_ASTContext->getSourceManager().getMainFileID();
   const clang::FileEntry *mainEntry =
       m_ASTContext->getSourceManager().getFileEntryForID(mainUID);
-  translationUnitBuilder.setMainFd(mainEntry->getUID());
+  translationUnitBuilder.setMainFd(fileIds.fd(*mainEntry));
 
   llvm::ArrayRef<Text> failDirectives =
       m_annotationManager->getFailDirectives();
@@ -107,14 +421,18 @@ void TranslationUnitSerializer::serialize(
       translationUnitBuilder.initFailDirectives(failDirectives.size());
   m_serializer.serialize(failDirectivesBuilder, failDirectives);
 
+  Timings::Scope timing(Timings::Inclusions);
   const Inclusion &mainInclusion =
       m_inclusionContext->getInclusionOfFileUID(mainEntry->getUID());
-  size_t nbIncludes = mainInclusion.nbIncludeDirectives() +
-                      m_annotationManager->getLeadingIncludes(mainEntry).size();
   InclusionSerializer inclusionSerializer(m_serializer, *m_inclusionContext,
                                           m_firstDeclLocMap);
+  inclusionSerializer.indexInclusions(mainInclusion);
   inclusionSerializer.serialize(
-      mainInclusion, translationUnitBuilder.initIncludes(nbIncludes));
+      mainInclusion, translationUnitBuilder.initIncludes(
+                         inclusionSerializer.nbDirectives(mainInclusion)));
+  inclusionSerializer.serializeIndexedInclusions(
+      translationUnitBuilder.initInclusions(
+          inclusionSerializer.nbIndexedInclusions()));
 }
 
 } // namespace vf
\ No newline at end of file
@@ -1,17 +1,21 @@
 #pragma once
+#include "Cancellation.h"
 #include "DeclSerializer.h"
 #include "InclusionContext.h"
 #include "NodeListSerializer.h"
+#include "ReferencedDecls.h"
 #include "Serializer.h"
 #include "clang/AST/Decl.h"
+#include "capnp/message.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/IndexedMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
 
 namespace vf {
 
 /**
- * @brief Specialized serializer for translation units.
- *
+ * @brief Specialized serializer for translation units. Like the
+ * `ASTSerializer` it owns, an instance is used by one thread only.
  */
 class TranslationUnitSerializer
     : public Serializer<const clang::TranslationUnitDecl *,
@@ -20,65 +24,288 @@ public:
   void serialize(const clang::TranslationUnitDecl *decl,
                  stubs::TU::Builder builder) const override;
 
+  /**
+   * @brief Serialize a translation unit as a sequence of messages instead of a
+   * single one.
+   *
+   * The header, i.e. the translation unit without declarations in its files,
+   * is serialized to the given builder and passed to `writeHeader`. Then every
+   * top-level declaration is serialized, together with its surrounding
+   * annotations, to its own `StreamMessage` that is passed to `writeMessage`.
+   * Annotations of files without declarations are written last.
+   *
+   * @param decl Translation unit to serialize.
+   * @param headerBuilder Target builder of the header.
+   * @param writeHeader Called once the header has been serialized.
+   * @param writeMessage Called for every message with declarations.
+   */
+  void serializeStreamed(
+      const clang::TranslationUnitDecl *decl,
+      stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+      llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage) const;
+
+  /**
+   * @brief How `serializePartitioned` splits the top-level declarations of a
+   * translation unit over forked processes.
+   */
+  struct Partitions {
+    ///< Number of partitions, and of forked processes.
+    unsigned count;
+    ///< Called in the parent for every message that a child flattened.
+    llvm::function_ref<void(kj::ArrayPtr<const capnp::word>)> writeMessage;
+    ///< Called in a child after its declarations, to save state outside of
+    ///< the serializer that they changed, e.g. the diagnostics they reported.
+    llvm::function_ref<void(capnp::MessageBuilder &)> saveState;
+    ///< Called in the parent with the state saved by every child, in order.
+    llvm::function_ref<void(kj::ArrayPtr<const capnp::word>)> restoreState;
+  };
+
+  /**
+   * @brief Serialize a translation unit as `serializeStreamed` does, but
+   * serialize its top-level declarations in `partitions.count` forked
+   * processes, each of which serializes a contiguous run of them with its own
+   * copy of this serializer. Their messages are written in source order, once
+   * all processes have finished.
+   *
+   * If the processes cannot be started or fail, nothing of them is written
+   * and the declarations are serialized by this process instead.
+   *
+   * @param decl Translation unit to serialize.
+   * @param headerBuilder Target builder of the header.
+   * @param writeHeader Called once the header has been serialized.
+   * @param writeMessage Called for every message this process serializes.
+   * @param partitions How to split the declarations.
+   */
+  void serializePartitioned(
+      const clang::TranslationUnitDecl *decl,
+      stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+      llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage,
+      const Partitions &partitions) const;
+
+  /**
+   * @brief Serialize the declarations of a translation unit only when they are
+   * requested.
+   *
+   * The header is serialized as by `serializeStreamed` and passed to
+   * `writeHeader`. Then `nextRequest` is called until it returns false. For
+   * every requested file, its top-level declarations are serialized, together
+   * with their surrounding annotations, to one `StreamMessage` each that is
+   * passed to `writeMessage`, followed by a call to `endResponse`. The
+   * declarations of files that are never requested are not serialized.
+   *
+   * @param decl Translation unit to serialize.
+   * @param headerBuilder Target builder of the header.
+   * @param writeHeader Called once the header has been serialized.
+   * @param nextRequest Stores the `fd` of the next requested file in its
+   * argument, or returns false if there are no more requests.
+   * @param writeMessage Called for every message with declarations.
+   * @param endResponse Called once all messages of a request have been written.
+   */
+  void serializeOnDemand(
+      const clang::TranslationUnitDecl *decl,
+      stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+      llvm::function_ref<bool(unsigned &)> nextRequest,
+      llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage,
+      llvm::function_ref<void()> endResponse) const;
+
+  /**
+   * @brief Serialize only the files of a translation unit, with their
+   * identifiers and paths, and its main file, so the locations of errors can
+   * be resolved without serializing anything else.
+   */
+  static void serializeFiles(const clang::SourceManager &sourceManager,
+                             stubs::TU::Builder builder);
+
   TranslationUnitSerializer(const clang::ASTContext &ASTContext,
                             const AnnotationManager &annotationManager,
                             const InclusionContext &inclusionContext,
-                            capnp::Orphanage orphanage, bool skipImplicitDecls)
+                            bool skipImplicitDecls,
+                            bool useLocationTable, bool useNameTable,
+                            bool useTypeTable, bool compactIntArrays,
+                            bool dedupTemplateBodies, bool annotationTokens,
+                            bool annotationSlices, bool flatExprs,
+                            bool compactExprs,
+                            std::optional<Focus> focus,
+                            bool pruneUnreferenced,
+                            const Cancellation *cancellation = nullptr)
       : m_ASTContext(&ASTContext), m_annotationManager(&annotationManager),
-        m_inclusionContext(&inclusionContext),
-        m_serializer(ASTContext, annotationManager, skipImplicitDecls),
-        m_orphanage(orphanage) {}
+        m_inclusionContext(&inclusionContext), m_cancellation(cancellation),
+        m_serializer(ASTContext, annotationManager, skipImplicitDecls,
+                     useLocationTable, useNameTable, useTypeTable,
+                     compactIntArrays, dedupTemplateBodies, annotationTokens,
+                     annotationSlices, flatExprs, compactExprs,
+                     std::move(focus)) {
+    if (pruneUnreferenced) {
+      m_referencedDecls.emplace(ASTContext, annotationManager);
+    }
+  }
+
+  /**
+   * @brief Check whether serialization stopped early because its request was
+   * cancelled. Declarations are only skipped between top-level declarations:
+   * `serialize` then leaves the rest of the translation unit unset, and
+   * `serializeStreamed` writes no further declaration messages. The result
+   * must be discarded in the former case.
+   */
+  bool isCancelled() const { return m_cancelled; }
 
 private:
   /**
-   * @brief Get declaration list serializer for the given file.
-   *
-   * @param uid Unique identifier of the file for which the serializer has to be
-   * returned.
-   * @return Declaration list serializer for the file.
+   * @brief Poll the cancellation of the request, if any. Once it is
+   * cancelled, it stays cancelled.
    */
-  DeclListSerializer &getDeclSerializer(unsigned uid) const;
+  bool checkCancelled() const;
+
+  /**
+   * @brief Nodes that a top-level declaration contributes to the declarations
+   * of its file. They are looked up before any of them is serialized, so that
+   * the declaration lists can be sized up front.
+   */
+  struct DeclNodes {
+    ///< Annotations before the declaration, if it is the first of its file.
+    AnnotationsRef leadingAnnotations;
+    ///< The declaration, or null if it is pruned.
+    const clang::Decl *decl = nullptr;
+    ///< Annotations after the declaration and before the next one.
+    AnnotationsRef trailingAnnotations;
+
+    size_t size() const {
+      return leadingAnnotations.size() + (decl ? 1 : 0) +
+             trailingAnnotations.size();
+    }
+  };
+
+  using FileDeclNodes =
+      llvm::SmallDenseMap<unsigned, llvm::SmallVector<DeclNodes, 0>>;
 
   /**
-   * @brief Serialize a declaration in the translation unit associated with this
-   * serializer.
+   * @brief Get the nodes of a top-level declaration: the declaration itself
+   * and the annotations that follow it, up to the next declaration or the end
+   * of its file.
    *
-   * Updates the mapping of the declaration's file to the source location of the
-   * first declaration in that file if needed.
+   * @param decl Declaration to get the nodes of.
+   * @param firstInFile Whether the declaration is the first declaration of its
+   * file, in which case the annotations before it are included as well.
+   * @param annotationCursor Cursor for the annotations that follow the
+   * declarations, which are passed in source order.
    *
-   * Serializes annotation declarations that appear before the given declaration
-   * if it is the first declaration in its file.
+   * When unreferenced declarations are pruned, only the annotations of an
+   * unreferenced declaration are included.
+   */
+  DeclNodes getDeclNodes(const clang::Decl *decl, bool firstInFile,
+                         AnnotationCursor &annotationCursor) const;
+
+  /// @returns The total number of nodes of declarations.
+  static size_t nbNodes(llvm::ArrayRef<DeclNodes> nodes);
+
+  /// @returns The number of declarations, without their annotations.
+  static size_t nbDecls(llvm::ArrayRef<DeclNodes> nodes);
+
+  /**
+   * @brief Serialize the nodes of declarations, in order, to a list of
+   * declarations with exactly one element for every node.
+   */
+  void
+  serializeDeclNodes(llvm::ArrayRef<DeclNodes> nodes,
+                     ListBuilder<stubs::Node<stubs::Decl>> builder) const;
+
+  /**
+   * @brief Collect the top-level declarations that have to be serialized and
+   * record the first declaration of each file, which the header depends on.
    *
-   * Serializes declarations tha appear after the given declaration and before
-   * the next declaration (or end of file if the given declaration is the last
-   * declaration in its file).
+   * @param translationUnitDecl Translation unit to collect the declarations of.
+   * @param decls Receives the declarations in source order.
+   */
+  void collectDecls(const clang::TranslationUnitDecl *translationUnitDecl,
+                    llvm::SmallVectorImpl<const clang::Decl *> &decls) const;
+
+  /**
+   * @brief Serialize declarations or annotations of a file to their own
+   * `StreamMessage`.
+   *
+   * @param fileUID Unique identifier of the file in the file manager.
+   * @param nodes Nodes that make up the content of the message.
+   * @param writeMessage Called with the serialized message.
+   */
+  void writeFileDecls(
+      unsigned fileUID, llvm::ArrayRef<DeclNodes> nodes,
+      llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage) const;
+
+  /**
+   * @brief A top-level declaration that is serialized to its own message.
+   */
+  struct StreamedDecl {
+    const clang::Decl *decl;
+    unsigned fileUID;
+    ///< Whether it is the first declaration of its file.
+    bool firstInFile;
+  };
+
+  /**
+   * @brief Serialize a translation unit as a sequence of messages, with the
+   * declarations in forked processes if `partitions` is given.
+   */
+  void serializeStreamed(
+      const clang::TranslationUnitDecl *decl,
+      stubs::TU::Builder headerBuilder, llvm::function_ref<void()> writeHeader,
+      llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage,
+      const Partitions *partitions) const;
+
+  /**
+   * @brief Serialize every declaration, together with its surrounding
+   * annotations, to its own message.
+   */
+  void writeStreamedDecls(
+      llvm::ArrayRef<StreamedDecl> decls,
+      llvm::function_ref<void(capnp::MessageBuilder &)> writeMessage) const;
+
+  /**
+   * @brief Serialize the declarations in forked processes.
    *
-   * @param decl Declaration to serialize.
+   * @return False if the processes could not be used, in which case nothing
+   * has been written.
+   */
+  bool writePartitionedDecls(llvm::ArrayRef<StreamedDecl> decls,
+                             const Partitions &partitions) const;
+
+  /**
+   * @brief Check whether a top-level declaration has to be serialized.
    */
-  void serializeDecl(const clang::Decl *decl) const;
+  bool shouldSerialize(const clang::Decl *decl) const;
 
   /**
-   * @brief Serialize a file of the translation unit.
+   * @brief Serialize everything of the translation unit except for its
+   * declarations, or including them if `fileDeclNodes` is given. Must be
+   * called after the first declaration of each file is known.
    *
-   * Retrieves the declaration list serializer associated with the given file
-   * and adopts all its serialized declarations to the target builder of the
-   * file. Hence, all declarations must have been serialized before using this
-   * method.
+   * @param builder Target builder.
+   * @param fileDeclNodes Nodes of the declarations of every file, which are
+   * serialized to the files of the translation unit, or null.
+   */
+  void serializeHeader(stubs::TU::Builder builder,
+                       const FileDeclNodes *fileDeclNodes) const;
+
+  /**
+   * @brief Serialize a file of the translation unit, including its
+   * declarations. A file without declarations only holds its annotations.
    *
    * @param fileEntry Entry of the file to serialize.
    * @param builder Target builder to serialize to.
+   * @param fileDeclNodes Nodes of the declarations of every file.
    */
   void serializeFile(const clang::FileEntry *fileEntry,
-                     stubs::File::Builder builder) const;
+                     stubs::File::Builder builder,
+                     const FileDeclNodes &fileDeclNodes) const;
 
   const clang::ASTContext *m_ASTContext;
   const AnnotationManager *m_annotationManager;
   const InclusionContext *m_inclusionContext;
+  const Cancellation *m_cancellation;
+  mutable bool m_cancelled = false;
   ASTSerializer m_serializer;
-  capnp::Orphanage m_orphanage;
+  ///< Declarations to serialize, or none if all of them are serialized.
+  std::optional<ReferencedDecls> m_referencedDecls;
 
-  ///< Mapping from files to declaration list serializers
-  mutable llvm::SmallDenseMap<unsigned, DeclListSerializer> m_declsMap;
   ///< Mapping from files to the location of the first declaration in that file.
   mutable llvm::SmallDenseMap<unsigned, clang::SourceLocation>
       m_firstDeclLocMap;
@@ -0,0 +1,45 @@
+#include "TrustedDirs.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+namespace vf {
+
+TrustedDirs::TrustedDirs(llvm::ArrayRef<std::string> dirs) {
+  for (llvm::StringRef dir : dirs) {
+    if (dir.empty()) {
+      continue;
+    }
+    llvm::SmallString<256> realDir;
+    if (llvm::sys::fs::real_path(dir, realDir)) {
+      continue;
+    }
+    if (!llvm::sys::path::is_separator(realDir.back())) {
+      realDir += llvm::sys::path::get_separator();
+    }
+    m_dirs.emplace_back(realDir.str());
+  }
+}
+
+bool TrustedDirs::contains(const clang::FileEntry *fileEntry) {
+  if (m_dirs.empty()) {
+    return false;
+  }
+
+  auto [it, inserted] = m_verdicts.try_emplace(fileEntry->getUID(), false);
+  if (!inserted) {
+    return it->second;
+  }
+
+  llvm::SmallString<256> path(fileEntry->tryGetRealPathName());
+  if (path.empty() && llvm::sys::fs::real_path(fileEntry->getName(), path)) {
+    return false;
+  }
+  it->second = llvm::any_of(m_dirs, [&path](const std::string &dir) {
+    return path.startswith(dir);
+  });
+  return it->second;
+}
+
+} // namespace vf
@@ -0,0 +1,38 @@
+#pragma once
+#include "clang/Basic/FileEntry.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include <string>
+
+namespace vf {
+
+/**
+ * @brief Directories of trusted headers, given by `-trusted_header_dir`, and
+ * the verdicts on the files that have been looked up.
+ *
+ */
+class TrustedDirs {
+public:
+  /**
+   * @brief Check whether a file lies in one of the trusted directories. The
+   * verdict is cached per file.
+   */
+  bool contains(const clang::FileEntry *fileEntry);
+
+  bool empty() const { return m_dirs.empty(); }
+
+  /**
+   * @param dirs Trusted directories. Empty paths and directories that do not
+   * exist are ignored.
+   */
+  explicit TrustedDirs(llvm::ArrayRef<std::string> dirs);
+
+private:
+  ///< Real paths of the trusted directories, ending with a separator.
+  llvm::SmallVector<std::string> m_dirs;
+  ///< Verdicts of `contains` by file UID.
+  llvm::DenseMap<unsigned, bool> m_verdicts;
+};
+
+} // namespace vf
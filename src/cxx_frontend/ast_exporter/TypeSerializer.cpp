@@ -1,5 +1,7 @@
 #include "TypeSerializer.h"
+#include "Census.h"
 #include "Location.h"
+#include "Trace.h"
 #include "clang/AST/TypeLocVisitor.h"
 #include "clang/AST/TypeVisitor.h"
 
@@ -11,41 +13,7 @@ struct TypeSerializerImpl
     : public clang::TypeVisitor<TypeSerializerImpl, bool> {
 
   bool VisitBuiltinType(const clang::BuiltinType *type) {
-#define CASE_TYPE(CLANG_TYPE, STUBS_TYPE)                                      \
-  case clang::BuiltinType::Kind::CLANG_TYPE:                                   \
-    m_builder.setBuiltin(stubs::Type::BuiltinKind::STUBS_TYPE);                \
-    return true;
-
-#define CASE_TYPE_FW(CLANG_TYPE, STUBS_TYPE, BITS)                             \
-  case clang::BuiltinType::Kind::CLANG_TYPE: {                                 \
-    auto FWBuilder = m_builder.initFixedWidth();                               \
-    FWBuilder.setKind(stubs::Type::FixedWidth::FixedWidthKind::STUBS_TYPE);    \
-    FWBuilder.setBits(BITS);                                                   \
-    return true;                                                               \
-  }
-
-    switch (type->getKind()) {
-      CASE_TYPE(Char_U, CHAR)
-      CASE_TYPE(Char_S, CHAR)
-      CASE_TYPE(UChar, U_CHAR)
-      CASE_TYPE(SChar, CHAR)
-      CASE_TYPE(Void, VOID)
-      CASE_TYPE(Int, INT)
-      CASE_TYPE(UInt, U_INT)
-      CASE_TYPE(Short, SHORT)
-      CASE_TYPE(UShort, U_SHORT)
-      CASE_TYPE(Long, LONG)
-      CASE_TYPE(LongLong, LONG_LONG)
-      CASE_TYPE(ULong, U_LONG)
-      CASE_TYPE(ULongLong, U_LONG_LONG)
-      CASE_TYPE(Bool, BOOL)
-      CASE_TYPE_FW(Int128, INT, 128)
-      CASE_TYPE_FW(UInt128, U_INT, 128)
-    default:
-      return false;
-    }
-#undef CASE_TYPE
-#undef CASE_TYPE_FW
+    return m_ASTSerializer->getBuiltinTypes().serialize(type, m_builder);
   }
 
   bool VisitConstantArrayType(const clang::ConstantArrayType *type) {
@@ -87,7 +55,8 @@ struct TypeSerializerImpl
 
   bool VisitRecordType(const clang::RecordType *type) {
     stubs::RecordRef::Builder recordBuilder = m_builder.initRecord();
-    recordBuilder.setName(type->getDecl()->getQualifiedNameAsString());
+    m_ASTSerializer->serializeName(
+        recordBuilder, m_ASTSerializer->getQualifiedName(type->getDecl()));
     if (type->isClassType()) {
       recordBuilder.setKind(stubs::RecordKind::CLASS);
     } else if (type->isUnionType()) {
@@ -101,7 +70,12 @@ struct TypeSerializerImpl
   }
 
   bool VisitEnumType(const clang::EnumType *type) {
-    m_builder.setEnumType(type->getDecl()->getQualifiedNameAsString());
+    kj::StringPtr name = m_ASTSerializer->getQualifiedName(type->getDecl());
+    if (m_ASTSerializer->usesNameTable()) {
+      m_builder.setEnumTypeRef(m_ASTSerializer->getNameRef(name));
+    } else {
+      m_builder.setEnumType(name);
+    }
     return true;
   }
 
@@ -113,7 +87,12 @@ struct TypeSerializerImpl
   }
 
   bool VisitTypedefType(const clang::TypedefType *type) {
-    m_builder.setTypedef(type->getDecl()->getQualifiedNameAsString());
+    kj::StringPtr name = m_ASTSerializer->getQualifiedName(type->getDecl());
+    if (m_ASTSerializer->usesNameTable()) {
+      m_builder.setTypedefRef(m_ASTSerializer->getNameRef(name));
+    } else {
+      m_builder.setTypedef(name);
+    }
     return true;
   }
 
@@ -173,9 +152,9 @@ struct TypeLocSerializerImpl
     TypeNodeBuilder returnTypeBuilder = protoTypeBuilder.initReturnType();
     m_ASTSerializer->serialize(returnTypeBuilder, typeLoc.getReturnLoc());
 
-    AnnotationsRef ghostParams =
-        m_ASTSerializer->getAnnotationManager().getInRange(
-            typeLoc.getReturnLoc().getEndLoc(), typeLoc.getLParenLoc());
+    FunctionAnnotations annotations =
+        m_ASTSerializer->getAnnotationManager().getFunctionAnnotations(typeLoc);
+    AnnotationsRef ghostParams = annotations.ghostParams;
     m_ASTSerializer->serialize(
         protoTypeBuilder.initGhostParams(ghostParams.size()), ghostParams);
 
@@ -183,8 +162,7 @@ struct TypeLocSerializerImpl
         protoTypeBuilder.initParams(typeLoc.getNumParams());
     m_ASTSerializer->serialize(paramsBuilder, typeLoc.getParams());
 
-    AnnotationsRef contract =
-        m_ASTSerializer->getAnnotationManager().getContract(typeLoc);
+    AnnotationsRef contract = annotations.contract;
     ListBuilder<stubs::Clause> contractBuilder =
         protoTypeBuilder.initContract(contract.size());
     m_ASTSerializer->serialize(contractBuilder, contract);
@@ -232,6 +210,13 @@ struct TypeLocSerializerImpl
   }
 
   bool serialize(clang::TypeLoc typeLoc) {
+    // Builtin types have no type locations that are visited, so they would
+    // only be serialized by the delegate serializer below.
+    if (m_ASTSerializer->getBuiltinTypes().serialize(typeLoc.getTypePtr(),
+                                                     m_builder)) {
+      return true;
+    }
+
     if (Visit(typeLoc)) {
       return true;
     }
@@ -256,9 +241,16 @@ void TypeSerializer::serialize(const clang::Type *type,
                                stubs::Type::Builder builder) const {
   assert(type && "Type should not be null");
 
-  TypeSerializerImpl serializer(*m_ASTSerializer, builder);
+  Census::Node census(Census::Types, type->getTypeClassName());
+  VF_TRACE_SCOPE("SerializeType", type->getTypeClassName());
+  if (m_ASTSerializer->getBuiltinTypes().serialize(type, builder)) {
+    census.record(builder);
+    return;
+  }
 
+  TypeSerializerImpl serializer(*m_ASTSerializer, builder);
   if (serializer.Visit(type)) {
+    census.record(builder);
     return;
   }
 
@@ -275,8 +267,12 @@ void TypeLocSerializer::serialize(clang::TypeLoc typeLoc, LocBuilder locBuilder,
 
   clang::SourceRange range = getRange(typeLoc);
   TypeLocSerializerImpl serializer(*m_ASTSerializer, typeBuilder);
+  Census::Node census(Census::Types,
+                      typeLoc.getTypePtr()->getTypeClassName());
+  VF_TRACE_SCOPE("SerializeTypeLoc", typeLoc.getTypePtr()->getTypeClassName());
   m_ASTSerializer->serialize(locBuilder, range);
   if (serializer.serialize(typeLoc)) {
+    census.record(typeBuilder, locBuilder);
     return;
   }
 
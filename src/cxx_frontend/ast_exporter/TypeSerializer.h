@@ -9,7 +9,7 @@ namespace vf {
  * @brief Serializer for types that are not associated with a source range.
  *
  */
-class TypeSerializer
+class TypeSerializer final
     : public Serializer<const clang::Type *, stubs::Type::Builder> {
 public:
   void serialize(const clang::Type *type,
@@ -26,7 +26,8 @@ private:
  * @brief Serializer for types that have a source range.
  *
  */
-class TypeLocSerializer : public NodeSerializer<stubs::Type, clang::TypeLoc> {
+class TypeLocSerializer final
+    : public NodeSerializer<stubs::Type, clang::TypeLoc> {
 public:
   void serialize(clang::TypeLoc typeLoc, LocBuilder locBuilder,
                  stubs::Type::Builder typeBuilder) const override;
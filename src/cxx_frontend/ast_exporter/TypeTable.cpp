@@ -0,0 +1,41 @@
+#include "TypeTable.h"
+#include <cassert>
+
+namespace vf {
+
+uint32_t TypeTable::intern(
+    const clang::Type *type,
+    llvm::function_ref<void(stubs::Type::Builder)> serializeType) {
+  auto [it, inserted] =
+      m_indices.try_emplace(type, static_cast<uint32_t>(m_entries.size()));
+  if (!inserted) {
+    return it->second;
+  }
+  uint32_t index = it->second;
+
+  if (!m_arena) {
+    m_arena = std::make_unique<CountingMessageBuilder>();
+  }
+  m_entries.push_back(m_arena->getOrphanage().newOrphan<stubs::Type>());
+  // Nested types may add entries, so the builder is obtained before serializing
+  // and the entry is not referred to through the vector afterwards.
+  serializeType(m_entries.back().get());
+  return index;
+}
+
+void TypeTable::serialize(ListBuilder<stubs::Type> builder) const {
+  assert(builder.size() == m_entries.size() && "Target builder has wrong size");
+
+  for (size_t i = 0; i < m_entries.size(); ++i) {
+    builder.setWithCaveats(i, m_entries[i].getReader());
+  }
+}
+
+void TypeTable::clear() {
+  m_indices.clear();
+  // The entries live in the arena, so they are released before it.
+  m_entries.clear();
+  m_arena.reset();
+}
+
+} // namespace vf
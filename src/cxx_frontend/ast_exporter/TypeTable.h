@@ -0,0 +1,58 @@
+#pragma once
+
+#include "CountingMessageBuilder.h"
+#include "Serializer.h"
+#include "stubs_ast.capnp.h"
+#include "clang/AST/Type.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include <cstdint>
+#include <memory>
+
+namespace vf {
+
+/**
+ * @brief Table of the distinct types of a message. Types that are serialized
+ * without a source location, like the types of expressions, refer to a type by
+ * its index in the table instead of embedding its subtree, so that every type
+ * is serialized only once, however often it is used.
+ *
+ */
+class TypeTable {
+public:
+  /**
+   * @brief Get the index of a type in the table. A type that is not in the
+   * table yet is added and serialized to its new entry first.
+   *
+   * @param type Type to intern
+   * @param serializeType Serializes the type to the given entry. Types nested
+   * in it can be interned meanwhile.
+   * @return Index of the type in the table
+   */
+  uint32_t intern(const clang::Type *type,
+                  llvm::function_ref<void(stubs::Type::Builder)> serializeType);
+
+  /**
+   * @brief Serialize all types in the table, in the order of their indices.
+   *
+   * @param builder Target list builder, with one element for every type
+   */
+  void serialize(ListBuilder<stubs::Type> builder) const;
+
+  size_t size() const { return m_entries.size(); }
+
+  void clear();
+
+private:
+  llvm::DenseMap<const clang::Type *, uint32_t> m_indices; ///< Index of every
+                                                           ///< type.
+  /**
+   * @brief Arena of the entries, which are only copied to a message when the
+   * table is serialized. Created on first use.
+   */
+  std::unique_ptr<CountingMessageBuilder> m_arena;
+  llvm::SmallVector<capnp::Orphan<stubs::Type>> m_entries; ///< Types by index.
+};
+
+} // namespace vf
@@ -1,19 +1,73 @@
 #include "AnnotationManager.h"
+#include "AnnotationSnapshot.h"
+#include "BundleWriter.h"
+#include "Cancellation.h"
+#include "Census.h"
 #include "CommentProcessor.h"
 #include "ContextFreePPCallbacks.h"
+#include "CountingMessageBuilder.h"
+#include "Daemon.h"
+#include "DepFile.h"
 #include "DiagnosticSerializer.h"
+#include "EmbeddedHeaders.h"
+#include "ExportCache.h"
+#include "Exporter.h"
+#include "FileCosts.h"
+#include "IncludePrefetch.h"
+#include "IncrementalExports.h"
 #include "InclusionContext.h"
+#include "Lsp.h"
+#include "MacroStats.h"
+#include "MemoryUsage.h"
+#include "MessageWriter.h"
+#include "PooledMessageBuilder.h"
+#include "PrecompiledHeaderLoader.h"
+#include "PreambleCache.h"
+#include "SamplingProfiler.h"
+#include "ShmMessageWriter.h"
+#include "StatSnapshot.h"
+#include "TemplateStats.h"
+#include "ThreadedMessageWriter.h"
+#include "Timings.h"
+#include "Trace.h"
 #include "TranslationUnitSerializer.h"
+#include "TrustedDirs.h"
 #include "capnp/message.h"
 #include "capnp/serialize.h"
 #include "stubs_ast.capnp.h"
+#include "clang/Basic/FileManager.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#else
+#include <unistd.h>
 #endif
 
 namespace {
@@ -32,103 +86,2498 @@ static llvm::cl::opt<bool> exportImplicitDecls(
     llvm::cl::desc("Enable exporting implicit declarations."),
     llvm::cl::cat(category));
 
+static llvm::cl::opt<bool> serverMode(
+    "server",
+    llvm::cl::desc(
+        "Keep running and export the files requested on stdin. Each request "
+        "is a 32-bit little-endian length followed by that many bytes of "
+        "NUL-separated arguments: the source file followed by extra compiler "
+        "arguments. One SerResult message is written per request."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> lspMode(
+    "lsp",
+    llvm::cl::desc(
+        "Run as a language server on stdin and stdout. Open documents are "
+        "exported on every change, from their unsaved contents, and the "
+        "diagnostics of the export are published to the client."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> listenSocket(
+    "listen",
+    llvm::cl::desc(
+        "Run as a daemon that serves exporter runs to the clients of the "
+        "Unix socket at the given path. Each run is forked from the daemon "
+        "and uses the command line and standard streams of its client. The "
+        "other options are taken from the command line of each run."),
+    llvm::cl::value_desc("socket"), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> standbyMode(
+    "standby",
+    llvm::cl::desc(
+        "Wait on stdin for the command line of one run, in the format of the "
+        "requests of -listen without file descriptors, and run it on the "
+        "standard streams of this process. The other options are taken from "
+        "that command line."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> incrementalExport(
+    "incremental",
+    llvm::cl::desc(
+        "In server mode, replace every top-level declaration node that is "
+        "identical to a node of the same file in the previous result for the "
+        "same source file by a reference to the index of that node. Cannot be "
+        "combined with streaming output, the export cache or the location, "
+        "name and type tables."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> reusePreamble(
+    "reuse_preamble",
+    llvm::cl::desc(
+        "In server mode, keep a precompiled preamble of every main file, "
+        "covering its leading preprocessor directives and comments, and only "
+        "parse the rest of the file as long as the preamble and the files it "
+        "includes do not change."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> nbJobs(
+    "j",
+    llvm::cl::desc("Number of translation units to export in parallel. 0 "
+                   "uses all available hardware threads."),
+    llvm::cl::init(1), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> projectMode(
+    "project",
+    llvm::cl::desc(
+        "Export every source file of the compilation database given with -p, "
+        "instead of the source files on the command line, on all hardware "
+        "threads unless -j is given."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> orderedOutput(
+    "ordered_output",
+    llvm::cl::desc("When exporting in parallel, write the result messages in "
+                   "the order in which the source files were given instead of "
+                   "as soon as they are ready."),
+    llvm::cl::init(true), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> emitPCH(
+    "emit_pch",
+    llvm::cl::desc(
+        "Write a precompiled header for the given source file instead of "
+        "exporting it. It can be used by later exports through "
+        "'-include-pch <file>' as compiler argument, as long as the other "
+        "compiler arguments are the same."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> annotationSnapshot(
+    "annotation_snapshot",
+    llvm::cl::desc(
+        "Cache file for the annotations and include directives of the files "
+        "loaded from a precompiled header. Files whose content has an entry "
+        "are restored without lexing them; entries for the other files are "
+        "added to the file."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> cacheDir(
+    "cache_dir",
+    llvm::cl::desc(
+        "Directory in which exported translation units are cached. A source "
+        "file is not parsed again if its compile command and all files it "
+        "depends on are unchanged since it was cached."),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> prefetchThreads(
+    "prefetch_threads",
+    llvm::cl::desc(
+        "Read the files a source file included when it was cached on this "
+        "many threads while it is parsed again, so the preprocessor finds "
+        "them in the page cache. Requires -cache_dir. 0 disables it."),
+    llvm::cl::init(0), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> remoteCacheUrl(
+    "remote_cache",
+    llvm::cl::desc(
+        "HTTP cache server, e.g. a Bazel remote cache, that backs the export "
+        "cache of -cache_dir so that machines share their exports."),
+    llvm::cl::value_desc("http://host[:port][/prefix]"),
+    llvm::cl::cat(category));
+
+static llvm::cl::list<std::string> overlayArgs(
+    "overlay",
+    llvm::cl::desc(
+        "Export the contents read from file descriptor <fd> until its end "
+        "instead of the file at <path>, e.g. the unsaved buffer of an editor. "
+        "<path>=@<file> reads them from <file> instead. Disables the export "
+        "cache."),
+    llvm::cl::value_desc("path=fd"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> statSnapshot(
+    "stat_snapshot",
+    llvm::cl::desc(
+        "File in which lookups of missing files are remembered across runs, "
+        "with the modification time of their directory, so header search "
+        "does not probe unchanged include directories again."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> embeddedHeaders(
+    "embedded_headers",
+    llvm::cl::desc(
+        "Directory of the headers VeriFast ships, whose files are read from "
+        "the copies compiled into the exporter instead of from disk."),
+    llvm::cl::value_desc("dir"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> depFile(
+    "dep_file",
+    llvm::cl::desc(
+        "Write the files that every exported translation unit read, including "
+        "ghost headers, to the given file as Makefile rules. The target of the "
+        "rules is the -output or -bundle file, or else the source file."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> outputFile(
+    "output",
+    llvm::cl::desc(
+        "Write the result messages to the given file instead of stdout. The "
+        "file holds the flat segment arrays of the messages, so a reader can "
+        "map it in memory instead of copying it through a pipe."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> errorFile(
+    "error_file",
+    llvm::cl::desc(
+        "Write what the exporter writes to stderr to the given file instead, "
+        "once the command line is parsed, so a reader that only reads stderr "
+        "after a failed run does not block the run when the pipe is full."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> shmName(
+    "shm",
+    llvm::cl::desc(
+        "Write the result messages into a ring buffer in the POSIX shared "
+        "memory object, or on Windows the named file mapping, with the given "
+        "name, which the reader created, and only notify the reader of them "
+        "on stdout."),
+    llvm::cl::value_desc("name"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> bundleFile(
+    "bundle",
+    llvm::cl::desc(
+        "Write the results to the given bundle file, which holds the "
+        "declarations of headers that are identical across translation units "
+        "once, followed by an index of its messages."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> headerUnit(
+    "header_unit",
+    llvm::cl::desc(
+        "Export every source file as a C++ header on its own and share its "
+        "declarations in the -bundle file, so the bundle can be linked with "
+        "-link_header_units."),
+    llvm::cl::cat(category));
+
+static llvm::cl::list<std::string> linkHeaderUnits(
+    "link_header_units",
+    llvm::cl::desc(
+        "Copy the shared headers of the given bundle, e.g. header units, into "
+        "the -bundle file before exporting, so that translation units with "
+        "the same headers refer to them."),
+    llvm::cl::value_desc("bundle"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> captureFile(
+    "capture",
+    llvm::cl::desc(
+        "Also write the complete result of every translation unit to the "
+        "given file, as unpacked SerResult messages, so its export can be "
+        "replayed with -replay without the sources and without Clang."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> replayFile(
+    "replay",
+    llvm::cl::desc(
+        "Write the results captured with -capture in the given file instead "
+        "of exporting source files, in the output mode given by the other "
+        "options. With -on_demand, the requests on stdin are answered from "
+        "the captured results. Source files on the command line are ignored."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> singleSegment(
+    "single_segment",
+    llvm::cl::desc("Copy result messages that span several segments into a "
+                   "single segment before writing them."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<llvm::cl::boolOrDefault> packedOutput(
+    "packed",
+    llvm::cl::desc("Write the result messages in Cap'n Proto's packed "
+                   "encoding. By default, messages are packed when the output "
+                   "is a pipe."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> writerThread(
+    "writer_thread",
+    llvm::cl::desc(
+        "Write the result messages on a dedicated thread, so serialization "
+        "goes on while the consumer drains the output, e.g. with -stream. "
+        "Cannot be combined with -timings."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> streamOutput(
+    "stream",
+    llvm::cl::desc(
+        "Write every translation unit as a sequence of StreamMessages: a "
+        "header, one message per top-level declaration and an end message "
+        "with the errors. The export cache is not used in this mode."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> serializeProcesses(
+    "serialize_processes",
+    llvm::cl::desc(
+        "With -stream, serialize the top-level declarations of every "
+        "translation unit in this many forked processes, each of which "
+        "serializes a contiguous run of them. Not available on Windows, "
+        "in-process or with -on_demand, -stats, -cost_by_file, "
+        "-template_stats and -timings."),
+    llvm::cl::init(1), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> onDemand(
+    "on_demand",
+    llvm::cl::desc(
+        "Like -stream, but write the declarations of a file only when it is "
+        "requested on stdin. The header is followed by an end message with "
+        "the errors so far. Each request is a 32-bit little-endian length "
+        "followed by that many bytes holding the decimal identifier of a "
+        "file; it is answered by the messages with the declarations of that "
+        "file and an end message with the errors reported meanwhile."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> locationTable(
+    "location_table",
+    llvm::cl::desc(
+        "Serialize every distinct source range of a message once, to the "
+        "location table of its translation unit or declarations, and let the "
+        "locations of nodes refer to their entry in that table."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> nameTable(
+    "name_table",
+    llvm::cl::desc(
+        "Serialize every distinct record, typedef, enum and non-overridden "
+        "method name of a message once, to the name table of its translation "
+        "unit or declarations, and let the name fields refer to their entry "
+        "in that table."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> typeTable(
+    "type_table",
+    llvm::cl::desc(
+        "Serialize every distinct type of a message that has no source "
+        "location, like the type of an expression, once, to the type table of "
+        "its translation unit or declarations, and let those types refer to "
+        "their entry in that table."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> compactIntArrays(
+    "compact_int_arrays",
+    llvm::cl::desc(
+        "Serialize a long initializer list whose elements are integer literals "
+        "with the same suffixes and base as a single integer array literal, "
+        "with one location for the whole list."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> dedupTemplateBodies(
+    "dedup_template_bodies",
+    llvm::cl::desc(
+        "Serialize the body of a function template specialization only if no "
+        "earlier specialization of the same template has an identical body, "
+        "and let the specialization refer to that one otherwise."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> annotationTokens(
+    "annotation_tokens",
+    llvm::cl::desc(
+        "Serialize the tokens of every annotation, so VeriFast does not lex "
+        "its text again. The spellings of the tokens refer to the name "
+        "table. Annotations with literals other than decimal integers, "
+        "nested comments or directives have no tokens. Requires "
+        "-name_table."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> annotationSlices(
+    "annotation_slices",
+    llvm::cl::desc(
+        "Serialize the text of every annotation as the offset and length of "
+        "the text in its source file, which VeriFast reads, instead of a copy "
+        "of the text."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> flatExprs(
+    "flat_exprs",
+    llvm::cl::desc(
+        "Serialize expression trees that only hold operators, literals, "
+        "variables and lvalue-to-rvalue conversions as one FlatExpr: an array "
+        "of entries in pre-order, without a pointer per operand. Requires "
+        "-location_table and -name_table."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> compactExprs(
+    "compact_exprs",
+    llvm::cl::desc(
+        "Leave out the expression nodes that the translator looks through: "
+        "cleanups and temporary bindings are not serialized, and "
+        "lvalue-to-rvalue conversions have no location of their own, since "
+        "it is the one of their operand."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> focus(
+    "focus",
+    llvm::cl::desc(
+        "Only serialize the body of the function definition that spans the "
+        "given line, like VeriFast's -focus option, which only verifies that "
+        "function. Other definitions get an empty body."),
+    llvm::cl::value_desc("path:line"), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> leanSema(
+    "lean_sema",
+    llvm::cl::desc(
+        "Parse with a language profile restricted to what VeriFast supports: "
+        "no exceptions, no run-time type information, no delayed template "
+        "parsing and no typo correction. Precompiled headers used with this "
+        "option have to be emitted with it as well."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> skipTrustedBodies(
+    "skip_trusted_bodies",
+    llvm::cl::desc(
+        "Do not parse the bodies of functions defined in headers below a "
+        "-trusted_header_dir, other than the main file. Such functions are "
+        "exported as declarations with their contracts."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> maxErrors(
+    "max_errors",
+    llvm::cl::desc(
+        "Maximum number of distinct errors that are formatted and written per "
+        "translation unit, or per response with -on_demand. The translator "
+        "only reports the first one. Later reports of a written error only "
+        "increase its count."),
+    llvm::cl::init(1), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> failFast(
+    "fail_fast",
+    llvm::cl::desc(
+        "Stop parsing at the first top-level declaration after an error and "
+        "write a result with only the files of the translation unit and the "
+        "errors so far, since the translator only reports the first error."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> timings(
+    "timings",
+    llvm::cl::desc(
+        "Write the wall and CPU time spent in each phase of the export, like "
+        "parsing, serializing every kind of node and writing the output, as a "
+        "JSON object on stderr when the exporter exits. Requires -j 1."),
+    llvm::cl::cat(category));
+
+#ifdef VF_TRACE
+static llvm::cl::opt<std::string> traceFile(
+    "trace",
+    llvm::cl::desc(
+        "Write the trace events of the export, including those of Clang, to "
+        "the given file in Chrome's trace event format. Requires -j 1."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> traceGranularity(
+    "trace_granularity",
+    llvm::cl::desc("Minimum duration of a traced event in microseconds."),
+    llvm::cl::init(500), llvm::cl::cat(category));
+#endif
+
+static llvm::cl::opt<bool> stats(
+    "stats",
+    llvm::cl::desc(
+        "Write the number of serialized nodes of every kind, with the words "
+        "they and their locations take in the output, and the number of "
+        "truncating expressions as a table on stderr when the exporter exits. "
+        "Requires -j 1."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> costByFile(
+    "cost_by_file",
+    llvm::cl::desc(
+        "Write the given number of files whose preprocessing took the most "
+        "time on stderr when the exporter exits, with their number of "
+        "annotations and top-level declarations and the words those take in "
+        "the output. Requires -j 1."),
+    llvm::cl::value_desc("N"), llvm::cl::init(0), llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> macroStats(
+    "macro_stats",
+    llvm::cl::desc(
+        "Write the given number of macros whose context-free checks took the "
+        "most time on stderr when the exporter exits, with their expansions, "
+        "whitelisted expansions and visibility checks, followed by the headers "
+        "the preprocessor entered or skipped most often. Requires -j 1."),
+    llvm::cl::value_desc("N"), llvm::cl::init(0), llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> templateStats(
+    "template_stats",
+    llvm::cl::desc(
+        "Write the given number of templates whose instantiations took the "
+        "most time on stderr when the exporter exits, with their number of "
+        "instantiations and serialized specializations and the words those "
+        "take in the output. Requires -j 1."),
+    llvm::cl::value_desc("N"), llvm::cl::init(0), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> profileFile(
+    "profile",
+    llvm::cl::desc(
+        "Sample the stacks of the exporter while it runs and write them to the "
+        "given file as folded stacks when it exits, for flame graphs. Not "
+        "available on Windows."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> profileFrequency(
+    "profile_frequency",
+    llvm::cl::desc("Samples per second of CPU time taken by -profile."),
+    llvm::cl::init(997), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> reportMemory(
+    "report_memory",
+    llvm::cl::desc(
+        "Write the current and peak resident set size of the exporter on "
+        "stderr after parsing, serializing and writing every translation "
+        "unit, with the size of the message arena of the translation unit."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> maxMemory(
+    "max_memory",
+    llvm::cl::desc(
+        "Memory budget of the exporter in MiB. A translation unit whose "
+        "message is estimated to exceed the budget when added to the resident "
+        "set size after parsing is not serialized; its result holds an error "
+        "that suggests -stream or -on_demand instead. 0 means no budget."),
+    llvm::cl::value_desc("MiB"), llvm::cl::init(0), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> pruneUnreferenced(
+    "prune_unreferenced",
+    llvm::cl::desc(
+        "Only export the top-level declarations that are transitively "
+        "referenced from the main file, or whose name occurs in an "
+        "annotation. The annotations of all files are still exported."),
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> skipSystemComments(
+    "skip_system_comments",
+    llvm::cl::desc(
+        "Ignore the comments of system headers, i.e. headers found through "
+        "-isystem or a default system include directory, without looking for "
+        "annotations or fail directives in them. Headers with annotations, "
+        "like the ones shipped with VeriFast, must then be included through "
+        "-I."),
+    llvm::cl::cat(category));
+
+static llvm::cl::list<std::string> trustedHeaderDirs(
+    "trusted_header_dir",
+    llvm::cl::desc(
+        "Do not check macros in headers below the given directories for "
+        "context-free use; their inclusions are still recorded. Defaults to "
+        "the directory of the exporter, which holds the headers shipped with "
+        "VeriFast. Pass an empty directory to check all headers."),
+    llvm::cl::value_desc("directory"), llvm::cl::ZeroOrMore,
+    llvm::cl::cat(category));
+
 static llvm::cl::extrahelp
     commonHelp(clang::tooling::CommonOptionsParser::HelpMessage);
 
 } // namespace
 
-namespace vf {
+namespace vf {
+
+namespace {
+
+/**
+ * @brief Estimate the size of the result message of a translation unit, so
+ * the message fits in its first segment in most cases. The size of a previous
+ * result is used when it is known, otherwise the size is derived from the size
+ * of the files in the translation unit and the number of top-level
+ * declarations.
+ *
+ * @return Estimated size in words.
+ */
+unsigned estimateMessageWords(clang::ASTContext &context,
+                              llvm::StringRef inFile, ExportCache *cache) {
+  constexpr size_t maxWords = size_t(1) << 26;
+  size_t words = cache ? cache->sizeHint(inFile) : 0;
+
+  if (words > 0) {
+    // leave some room for growth
+    words += words / 8;
+  } else {
+    llvm::SmallVector<const clang::FileEntry *> fileEntries;
+    context.getSourceManager().getFileManager().GetUniqueIDMapping(
+        fileEntries);
+    for (const clang::FileEntry *entry : fileEntries) {
+      if (entry) {
+        words += entry->getSize() / 2;
+      }
+    }
+    const clang::TranslationUnitDecl *tu = context.getTranslationUnitDecl();
+    words += 16 * std::distance(tu->decls_begin(), tu->decls_end());
+  }
+
+  return unsigned(std::clamp<size_t>(
+      words, capnp::SUGGESTED_FIRST_SEGMENT_WORDS, maxWords));
+}
+
+/**
+ * @brief Options that affect the export of a translation unit. They are taken
+ * from the command line once, before any export starts, and are then only
+ * read through the action that runs an export, so concurrent exports do not
+ * touch the global options.
+ */
+struct ExportOptions {
+  bool exportImplicitDecls;
+  bool locationTable;
+  bool nameTable;
+  bool typeTable;
+  bool compactIntArrays;
+  bool dedupTemplateBodies;
+  bool annotationTokens;
+  bool annotationSlices;
+  bool flatExprs;
+  bool compactExprs;
+  std::optional<Focus> focus;
+  bool pruneUnreferenced;
+  bool leanSema;
+  bool skipTrustedBodies;
+  bool failFast;
+  unsigned maxErrors;
+  bool streamOutput;
+  unsigned serializeProcesses;
+  bool onDemand;
+  bool singleSegment;
+  bool headerUnit;
+  bool skipSystemComments;
+  bool reportMemory;
+  unsigned maxMemory; ///< Memory budget in MiB, or 0 for no budget.
+  unsigned prefetchThreads; ///< Threads of `-prefetch_threads`, or 0.
+  /// Whether the export is the only one of a process that exits right after
+  /// it, so Clang can skip freeing its compiler instance.
+  bool fastExit = false;
+  std::vector<std::string> allowExpansions;
+  std::vector<std::string> trustedHeaderDirs;
+  std::string embeddedHeadersDir; ///< Directory of `-embedded_headers`, if any.
+  MessageWriter *captureWriter =
+      nullptr; ///< Writer of the capture file given with `-capture`, if any.
+  StatSnapshot *statSnapshot =
+      nullptr; ///< Snapshot given with `-stat_snapshot`, if any.
+  AnnotationSnapshot *annotationSnapshot =
+      nullptr; ///< Snapshots of loaded files, shared by all exports.
+  DepFile *depFile = nullptr; ///< Rules to write to `-dep_file`, if any.
+  const Cancellation *cancellation =
+      nullptr; ///< Cancellation of the server request being exported, if any.
+
+  /**
+   * @brief The file system exports read their files from, on top of the
+   * given one.
+   */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+  fileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base) const {
+    if (statSnapshot) {
+      base = statSnapshot->wrap(std::move(base));
+    }
+    return embeddedHeadersDir.empty()
+               ? base
+               : withEmbeddedHeaders(std::move(base), embeddedHeadersDir);
+  }
+
+  static ExportOptions fromCommandLine() {
+    ExportOptions options;
+    options.exportImplicitDecls = exportImplicitDecls;
+    options.locationTable = locationTable;
+    options.nameTable = nameTable;
+    options.typeTable = typeTable;
+    options.compactIntArrays = compactIntArrays;
+    options.dedupTemplateBodies = dedupTemplateBodies;
+    options.annotationTokens = annotationTokens;
+    options.annotationSlices = annotationSlices;
+    options.flatExprs = flatExprs;
+    options.compactExprs = compactExprs;
+    options.focus = Focus::parse(focus);
+    options.pruneUnreferenced = pruneUnreferenced;
+    options.leanSema = leanSema;
+    options.skipTrustedBodies = skipTrustedBodies;
+    options.failFast = failFast;
+    options.maxErrors = maxErrors;
+    options.streamOutput = streamOutput;
+    options.serializeProcesses = serializeProcesses;
+    options.onDemand = onDemand;
+    options.singleSegment = singleSegment;
+    options.headerUnit = headerUnit;
+    options.skipSystemComments = skipSystemComments;
+    options.reportMemory = reportMemory;
+    options.maxMemory = maxMemory;
+    options.prefetchThreads = prefetchThreads;
+    options.allowExpansions.assign(allowExpansions.begin(),
+                                   allowExpansions.end());
+    options.trustedHeaderDirs.assign(trustedHeaderDirs.begin(),
+                                     trustedHeaderDirs.end());
+    options.embeddedHeadersDir = embeddedHeaders;
+    return options;
+  }
+};
+
+bool readFully(void *buffer, size_t size) {
+  return std::fread(buffer, 1, size, stdin) == size;
+}
+
+/**
+ * @brief Read the payload of one request from stdin.
+ *
+ * @return False if stdin was closed.
+ */
+bool readPayload(std::string &payload) {
+  char header[4];
+  if (!readFully(header, sizeof(header))) {
+    return false;
+  }
+
+  uint32_t length =
+      llvm::support::endian::read32le(reinterpret_cast<uint8_t *>(header));
+  payload.assign(length, '\0');
+  return length == 0 || readFully(payload.data(), length);
+}
+
+/**
+ * @brief Split the payload of a request into its NUL-separated arguments.
+ *
+ * @return False if the request is malformed.
+ */
+bool splitRequest(llvm::StringRef payload, std::vector<std::string> &args) {
+  args.clear();
+  llvm::SmallVector<llvm::StringRef> parts;
+  payload.split(parts, '\0', -1, false);
+  for (llvm::StringRef part : parts) {
+    args.push_back(part.str());
+  }
+  return !args.empty();
+}
+
+/**
+ * @brief Read one request from stdin.
+ *
+ * @param args Receives the NUL-separated arguments of the request.
+ * @return False if stdin was closed or the request is malformed.
+ */
+bool readRequest(std::vector<std::string> &args) {
+  std::string payload;
+  return readPayload(payload) && splitRequest(payload, args);
+}
+
+/**
+ * @brief Requests of the server mode, read from stdin on a thread of their
+ * own, so that a cancellation request is seen while the requests before it
+ * are exported. A cancellation request, whose payload is `\0cancel`, is not
+ * queued: it cancels every request read before it.
+ */
+class RequestQueue {
+public:
+  struct Request {
+    std::string payload;
+    uint64_t number;
+  };
+
+  /**
+   * @brief Start reading requests. The reading thread shares the queue, so it
+   * may outlive the server, which stops at a malformed request.
+   */
+  static std::shared_ptr<RequestQueue> start() {
+    auto queue = std::make_shared<RequestQueue>();
+    std::thread([queue] { queue->readAll(); }).detach();
+    return queue;
+  }
+
+  /**
+   * @brief Wait for the next request.
+   *
+   * @return False once stdin is closed and every request has been taken.
+   */
+  bool pop(Request &request) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_ready.wait(lock, [this] { return m_closed || !m_requests.empty(); });
+    if (m_requests.empty()) {
+      return false;
+    }
+    request = std::move(m_requests.front());
+    m_requests.pop_front();
+    return true;
+  }
+
+  Cancellation &cancellation() { return m_cancellation; }
+
+private:
+  void readAll() {
+    std::string payload;
+    while (readPayload(payload)) {
+      if (payload == llvm::StringRef("\0cancel", 7)) {
+        m_cancellation.cancel();
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_requests.push_back({std::move(payload), m_cancellation.number()});
+      m_ready.notify_one();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_ready.notify_one();
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_ready;
+  std::deque<Request> m_requests;
+  bool m_closed = false;
+  Cancellation m_cancellation;
+};
+
+/**
+ * @brief Contents that replace files on disk, by absolute path.
+ */
+using Overlays = llvm::StringMap<std::string>;
+
+/**
+ * @brief Add the overlay given by an `-overlay=<path>=<fd>` argument, reading
+ * the contents from the file descriptor until its end, or by an
+ * `-overlay=<path>=@<file>` argument, reading them from the file.
+ *
+ * @return False, after reporting the problem, if the overlay cannot be read.
+ */
+bool readOverlayArg(llvm::StringRef arg, Overlays &overlays) {
+  auto [path, source] = arg.rsplit('=');
+  bool fromFile = source.consume_front("@");
+  int fd = -1;
+  if (path.empty() || source.empty() ||
+      (!fromFile && source.getAsInteger(10, fd))) {
+    llvm::errs() << "-overlay expects <path>=<fd> or <path>=@<file>\n";
+    return false;
+  }
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      fromFile ? llvm::MemoryBuffer::getFile(source, /*IsText=*/false,
+                                             /*RequiresNullTerminator=*/false)
+               : llvm::MemoryBuffer::getOpenFile(
+                     llvm::sys::fs::convertFDToNativeFile(fd), path,
+                     /*FileSize=*/-1,
+                     /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    llvm::errs() << "Cannot read the overlay of '" << path
+                 << "': " << buffer.getError().message() << "\n";
+    return false;
+  }
+  overlays[clang::tooling::getAbsolutePath(path)] =
+      (*buffer)->getBuffer().str();
+  return true;
+}
+
+/**
+ * @brief Apply an overlay request of the server protocol, whose payload is
+ * `\0overlay\0<path>\0<contents>` to replace a file, or `\0overlay\0<path>`
+ * to export the file on disk again.
+ *
+ * @return False if the request is malformed.
+ */
+bool applyOverlayRequest(llvm::StringRef payload, Overlays &overlays) {
+  if (!payload.consume_front(llvm::StringRef("\0overlay\0", 9))) {
+    return false;
+  }
+  auto [path, contents] = payload.split('\0');
+  if (path.empty()) {
+    return false;
+  }
+  std::string absolutePath = clang::tooling::getAbsolutePath(path);
+  if (path.size() == payload.size()) {
+    overlays.erase(absolutePath);
+  } else {
+    overlays[absolutePath] = contents.str();
+  }
+  return true;
+}
+
+/**
+ * @brief The real file system with the given overlays on top of it.
+ */
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>
+overlayFileSystem(const Overlays &overlays) {
+  if (overlays.empty()) {
+    return llvm::vfs::getRealFileSystem();
+  }
+  auto memory = llvm::makeIntrusiveRefCnt<llvm::vfs::InMemoryFileSystem>();
+  for (const auto &overlay : overlays) {
+    memory->addFile(overlay.getKey(), 0,
+                    llvm::MemoryBuffer::getMemBufferCopy(overlay.getValue(),
+                                                         overlay.getKey()));
+  }
+  auto fileSystem = llvm::makeIntrusiveRefCnt<llvm::vfs::OverlayFileSystem>(
+      llvm::vfs::getRealFileSystem());
+  fileSystem->pushOverlay(std::move(memory));
+  return fileSystem;
+}
+
+/**
+ * @brief Make a tool export the given overlays instead of the files on disk.
+ * The overlays must outlive the tool.
+ */
+void mapOverlays(clang::tooling::ClangTool &tool, const Overlays &overlays) {
+  for (const auto &overlay : overlays) {
+    tool.mapVirtualFile(overlay.getKey(), overlay.getValue());
+  }
+}
+
+/**
+ * @brief Restrict the language options of a compiler invocation to the subset
+ * VeriFast supports when `-lean_sema` is given, so Sema does not perform work
+ * for features whose declarations and expressions are rejected anyway.
+ */
+void applyLeanSema(clang::CompilerInvocation &invocation, bool enabled) {
+  if (!enabled) {
+    return;
+  }
+  clang::LangOptions &langOpts = invocation.getLangOpts();
+  langOpts.Exceptions = false;
+  langOpts.CXXExceptions = false;
+  langOpts.RTTI = false;
+  langOpts.RTTIData = false;
+  langOpts.DelayedTemplateParsing = false;
+  // Typo correction only runs for erroneous code, which is not exported.
+  langOpts.SpellChecking = false;
+}
+
+} // namespace
+
+class VeriFastASTConsumer : public clang::ASTConsumer {
+public:
+  void Initialize(clang::ASTContext &context) override { m_context = &context; }
+
+  bool HandleTopLevelDecl(clang::DeclGroupRef group) override {
+    // Returning false stops the parser, in which case the translation unit is
+    // never handled.
+    if (isCancelled()) {
+      handleCancelled(*m_context);
+      return false;
+    }
+    if (m_options->failFast && m_diags->nbDiags() > 0) {
+      handleFailure(*m_context);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Only called with `-skip_trusted_bodies`. VeriFast does not verify
+   * the functions of trusted headers, so their contracts are all it needs.
+   * Sema itself never skips the bodies of constexpr functions and of functions
+   * with a deduced return type.
+   */
+  bool shouldSkipFunctionBody(clang::Decl *decl) override {
+    const clang::SourceManager &sourceManager = m_context->getSourceManager();
+    clang::FileID fileId = sourceManager.getFileID(
+        sourceManager.getExpansionLoc(decl->getLocation()));
+    if (fileId == sourceManager.getMainFileID()) {
+      return false;
+    }
+    const clang::FileEntry *entry = sourceManager.getFileEntryForID(fileId);
+    return entry && m_trustedDirs.contains(entry);
+  }
+
+  void HandleTranslationUnit(clang::ASTContext &context) override {
+    Timings::Scope timing(Timings::Serialize);
+    VF_TRACE_SCOPE("VeriFastExport", m_inFile);
+    FileCosts::endParse();
+    FileCosts::countAnnotations(context.getSourceManager(),
+                                *m_annotationManager);
+    if (m_options->reportMemory) {
+      MemoryUsage::report(llvm::errs(), "parsed", m_inFile);
+    }
+    if (m_options->depFile) {
+      m_options->depFile->addTranslationUnit(
+          m_inFile, context.getSourceManager(), *m_inclusionContext,
+          *m_annotationManager);
+    }
+    if (m_options->failFast && m_diags->nbDiags() > 0) {
+      handleFailure(context);
+      return;
+    }
+    if (isCancelled()) {
+      handleCancelled(context);
+      return;
+    }
+    if (m_options->onDemand) {
+      handleTranslationUnitOnDemand(context);
+      if (m_options->captureWriter) {
+        captureTranslationUnit(context);
+      }
+      return;
+    }
+    if (m_options->streamOutput) {
+      handleTranslationUnitStreamed(context);
+      if (m_options->captureWriter) {
+        captureTranslationUnit(context);
+      }
+      return;
+    }
+
+    unsigned estimatedWords = estimateMessageWords(context, m_inFile, m_cache);
+    if (exceedsMemoryBudget(estimatedWords)) {
+      handleOverBudget(context);
+      return;
+    }
+
+    // Its segments are reused by the next translation unit of this thread.
+    auto messageBuilder =
+        std::make_unique<PooledMessageBuilder>(estimatedWords);
+    stubs::SerResult::Builder resultBuilder =
+        messageBuilder->initRoot<stubs::SerResult>();
+
+    TranslationUnitSerializer serializer = makeSerializer(context);
+
+    serializer.serialize(context.getTranslationUnitDecl(),
+                         resultBuilder.initTu());
+    if (serializer.isCancelled()) {
+      handleCancelled(context);
+      return;
+    }
+    if (m_incremental) {
+      m_incremental->reuse(m_inFile, resultBuilder.getTu());
+    }
+
+    if (m_diags->nbDiags() > 0) {
+      m_diags->serialize(resultBuilder.initErrors(m_diags->nbDiags()));
+    }
+
+    resultBuilder.setSourcePath(m_inFile);
+    if (m_options->reportMemory) {
+      MemoryUsage::report(llvm::errs(), "serialized", m_inFile,
+                          messageBuilder->allocatedWords() *
+                              sizeof(capnp::word));
+    }
+
+    std::unique_ptr<capnp::MessageBuilder> output = std::move(messageBuilder);
+    if (m_options->singleSegment && output->getSegmentsForOutput().size() > 1) {
+      // A copy is laid out without far pointers, so the serialized size is an
+      // upper bound of its size.
+      auto flatBuilder = std::make_unique<CountingMessageBuilder>(
+          capnp::computeSerializedSizeInWords(*output),
+          capnp::AllocationStrategy::FIXED_SIZE);
+      flatBuilder->setRoot(resultBuilder.asReader());
+      output = std::move(flatBuilder);
+    }
+
+    if (m_options->captureWriter) {
+      m_options->captureWriter->write(
+          capnp::messageToFlatArray(*output).asPtr());
+    }
+
+    // The message is written once the compiler instance is torn down.
+    if (m_cache) {
+      Census::countMessage(*output);
+      kj::Array<capnp::word> words = capnp::messageToFlatArray(*output);
+      m_cache->store(m_inFile, context.getSourceManager().getFileManager(),
+                     words.asPtr());
+      m_deferred->add(std::move(words));
+    } else {
+      m_deferred->add(std::move(output));
+    }
+    m_exportedFiles->insert(m_inFile);
+  }
+
+  VeriFastASTConsumer(const ExportOptions &options,
+                      DiagnosticSerializer &diags,
+                      const AnnotationManager &annotationManager,
+                      const InclusionContext &inclusionContext,
+                      llvm::StringRef inFile, MessageWriter &writer,
+                      DeferredMessages &deferred, ExportCache *cache,
+                      llvm::StringSet<> &exportedFiles,
+                      IncrementalExports *incremental)
+      : m_options(&options), m_diags(&diags),
+        m_annotationManager(&annotationManager),
+        m_inclusionContext(&inclusionContext), m_inFile(inFile.str()),
+        m_writer(&writer), m_deferred(&deferred), m_cache(cache),
+        m_exportedFiles(&exportedFiles), m_incremental(incremental),
+        m_trustedDirs(options.trustedHeaderDirs) {}
+
+private:
+  TranslationUnitSerializer makeSerializer(clang::ASTContext &context) const {
+    return TranslationUnitSerializer(
+        context, *m_annotationManager, *m_inclusionContext,
+        !m_options->exportImplicitDecls, m_options->locationTable,
+        m_options->nameTable, m_options->typeTable,
+        m_options->compactIntArrays, m_options->dedupTemplateBodies,
+        m_options->annotationTokens, m_options->annotationSlices,
+        m_options->flatExprs,
+        m_options->compactExprs, m_options->focus,
+        m_options->pruneUnreferenced, m_options->cancellation);
+  }
+
+  bool isCancelled() const {
+    return m_options->cancellation && m_options->cancellation->isRequested();
+  }
+
+  void reportCancelled(clang::ASTContext &context) {
+    clang::DiagnosticsEngine &diagsEngine = context.getDiagnostics();
+    unsigned id = diagsEngine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error, "Export of '%0' was cancelled");
+    diagsEngine.Report(id) << m_inFile;
+  }
+
+  /**
+   * @brief Report that the request of the translation unit was cancelled and
+   * write the result of a failed export, so the server answers the request
+   * and can go on with the next one. Everything shared between requests, such
+   * as the preamble and the caches, is kept.
+   */
+  void handleCancelled(clang::ASTContext &context) {
+    reportCancelled(context);
+    handleFailure(context);
+  }
+
+  /**
+   * @brief Whether building a message of the given estimated size on top of
+   * the current resident set size would exceed the budget of `-max_memory`.
+   * There is no budget if the resident set size is unknown on this system.
+   */
+  bool exceedsMemoryBudget(unsigned estimatedWords) const {
+    if (m_options->maxMemory == 0) {
+      return false;
+    }
+    size_t rss = MemoryUsage::currentRSS();
+    size_t budget = size_t(m_options->maxMemory) * 1024 * 1024;
+    return rss > 0 &&
+           rss + size_t(estimatedWords) * sizeof(capnp::word) > budget;
+  }
+
+  /**
+   * @brief Write a result with only the files of the translation unit and an
+   * error that the translation unit does not fit in the memory budget. The
+   * translation unit is not serialized, so the exporter stays within its
+   * budget and can go on with the next one.
+   */
+  void handleOverBudget(clang::ASTContext &context) {
+    CountingMessageBuilder messageBuilder;
+    stubs::SerResult::Builder resultBuilder =
+        messageBuilder.initRoot<stubs::SerResult>();
+    TranslationUnitSerializer::serializeFiles(context.getSourceManager(),
+                                              resultBuilder.initTu());
+    resultBuilder.setSourcePath(m_inFile);
+    stubs::Error::Builder errorBuilder = resultBuilder.initErrors(1)[0];
+    errorBuilder.initLoc().initLexed();
+    errorBuilder.setReason(
+        "Exporting '" + m_inFile + "' would exceed the memory budget of " +
+        std::to_string(m_options->maxMemory) +
+        " MiB given with -max_memory; export it with -stream or -on_demand, "
+        "which write the result in parts, or raise the budget");
+    m_writer->write(messageBuilder);
+    m_exportedFiles->insert(m_inFile);
+  }
+
+  /**
+   * @brief Write a result with only the files of the translation unit, which
+   * the locations of the errors refer to, and the errors reported so far.
+   */
+  void handleFailure(clang::ASTContext &context) {
+    CountingMessageBuilder messageBuilder;
+    stubs::SerResult::Builder resultBuilder =
+        m_options->streamOutput
+            ? messageBuilder.initRoot<stubs::StreamMessage>().initHeader()
+            : messageBuilder.initRoot<stubs::SerResult>();
+    TranslationUnitSerializer::serializeFiles(context.getSourceManager(),
+                                              resultBuilder.initTu());
+    resultBuilder.setSourcePath(m_inFile);
+
+    if (m_options->streamOutput) {
+      m_writer->write(messageBuilder);
+      CountingMessageBuilder endBuilder;
+      m_diags->serialize(endBuilder.initRoot<stubs::StreamMessage>().initEnd(
+          m_diags->nbDiags()));
+      m_writer->write(endBuilder);
+    } else {
+      m_diags->serialize(resultBuilder.initErrors(m_diags->nbDiags()));
+      m_writer->write(messageBuilder);
+    }
+    m_exportedFiles->insert(m_inFile);
+
+    if (m_options->captureWriter) {
+      CountingMessageBuilder captureBuilder;
+      stubs::SerResult::Builder captureResult =
+          captureBuilder.initRoot<stubs::SerResult>();
+      TranslationUnitSerializer::serializeFiles(context.getSourceManager(),
+                                                captureResult.initTu());
+      captureResult.setSourcePath(m_inFile);
+      m_diags->serialize(captureResult.initErrors(m_diags->nbDiags()));
+      m_options->captureWriter->write(
+          capnp::messageToFlatArray(captureBuilder).asPtr());
+    }
+  }
+
+  /**
+   * @brief Write the complete result of the translation unit to the capture
+   * file, after it was exported in streaming or on-demand mode. The result
+   * holds all errors reported so far, including the ones of files that were
+   * never requested.
+   */
+  void captureTranslationUnit(clang::ASTContext &context) {
+    CountingMessageBuilder messageBuilder(
+        estimateMessageWords(context, m_inFile, nullptr));
+    stubs::SerResult::Builder resultBuilder =
+        messageBuilder.initRoot<stubs::SerResult>();
+
+    TranslationUnitSerializer serializer = makeSerializer(context);
+
+    serializer.serialize(context.getTranslationUnitDecl(),
+                         resultBuilder.initTu());
+    if (serializer.isCancelled()) {
+      return;
+    }
+    if (m_diags->nbDiags() > 0) {
+      m_diags->serialize(resultBuilder.initErrors(m_diags->nbDiags()));
+    }
+    resultBuilder.setSourcePath(m_inFile);
+    m_options->captureWriter->write(
+        capnp::messageToFlatArray(messageBuilder).asPtr());
+  }
+
+  void handleTranslationUnitStreamed(clang::ASTContext &context) {
+    CountingMessageBuilder headerBuilder;
+    stubs::SerResult::Builder resultBuilder =
+        headerBuilder.initRoot<stubs::StreamMessage>().initHeader();
+    resultBuilder.setSourcePath(m_inFile);
+
+    TranslationUnitSerializer serializer = makeSerializer(context);
+
+    auto writeMessage = [&](capnp::MessageBuilder &message) {
+      m_writer->write(message);
+    };
+    if (m_options->serializeProcesses > 1) {
+      // Diagnostics reported by the forked processes are carried over to
+      // this one, relative to those reported when the header was written.
+      llvm::SmallVector<unsigned> diagCounts;
+      TranslationUnitSerializer::Partitions partitions{
+          m_options->serializeProcesses,
+          [&](kj::ArrayPtr<const capnp::word> words) {
+            m_writer->write(words);
+          },
+          [&](capnp::MessageBuilder &message) {
+            m_diags->saveReportedSince(diagCounts, message);
+          },
+          [&](kj::ArrayPtr<const capnp::word> words) {
+            m_diags->restoreReported(words, context.getSourceManager());
+          }};
+      serializer.serializePartitioned(
+          context.getTranslationUnitDecl(), resultBuilder.initTu(),
+          [&] {
+            m_writer->write(headerBuilder);
+            diagCounts = m_diags->getCounts();
+          },
+          writeMessage, partitions);
+    } else {
+      serializer.serializeStreamed(context.getTranslationUnitDecl(),
+                                   resultBuilder.initTu(),
+                                   [&] { m_writer->write(headerBuilder); },
+                                   writeMessage);
+    }
+    // The declarations written so far are complete, so the stream ends
+    // early, with the cancellation among its errors.
+    if (serializer.isCancelled()) {
+      reportCancelled(context);
+    }
+
+    // Errors are reported while serializing, so they are written last.
+    CountingMessageBuilder endBuilder;
+    m_diags->serialize(endBuilder.initRoot<stubs::StreamMessage>().initEnd(
+        m_diags->nbDiags()));
+    m_writer->write(endBuilder);
+    m_exportedFiles->insert(m_inFile);
+  }
+
+  void handleTranslationUnitOnDemand(clang::ASTContext &context) {
+    CountingMessageBuilder headerBuilder;
+    stubs::SerResult::Builder resultBuilder =
+        headerBuilder.initRoot<stubs::StreamMessage>().initHeader();
+    resultBuilder.setSourcePath(m_inFile);
+
+    TranslationUnitSerializer serializer = makeSerializer(context);
+
+    // Every response ends with the errors that were reported since the
+    // previous one, even those that an earlier response reported already, and
+    // -max_errors applies to each response.
+    auto writeEnd = [&] {
+      CountingMessageBuilder endBuilder;
+      m_diags->serializeSinceMark(
+          endBuilder.initRoot<stubs::StreamMessage>().initEnd(
+              m_diags->nbDiagsSinceMark()));
+      m_writer->write(endBuilder);
+      m_diags->mark();
+    };
+
+    std::vector<std::string> args;
+    serializer.serializeOnDemand(
+        context.getTranslationUnitDecl(), resultBuilder.initTu(),
+        [&] {
+          m_writer->write(headerBuilder);
+          writeEnd();
+        },
+        [&](unsigned &fd) {
+          while (readRequest(args)) {
+            if (!llvm::StringRef(args.front()).getAsInteger(10, fd)) {
+              return true;
+            }
+          }
+          return false;
+        },
+        [&](capnp::MessageBuilder &message) { m_writer->write(message); },
+        writeEnd);
+    m_exportedFiles->insert(m_inFile);
+  }
+
+  const ExportOptions *m_options;
+  DiagnosticSerializer *m_diags;
+  const AnnotationManager *m_annotationManager;
+  const InclusionContext *m_inclusionContext;
+  std::string m_inFile;
+  MessageWriter *m_writer;
+  DeferredMessages *m_deferred;
+  ExportCache *m_cache;
+  llvm::StringSet<> *m_exportedFiles;
+  IncrementalExports *m_incremental;
+  TrustedDirs m_trustedDirs;
+  clang::ASTContext *m_context = nullptr;
+};
+
+class VeriFastFrontendAction : public clang::ASTFrontendAction {
+public:
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &compiler,
+                    llvm::StringRef inFile) override {
+    m_annotationManager = std::make_unique<AnnotationManager>(
+        compiler.getSourceManager(), compiler.getLangOpts());
+    m_commentProcessor = std::make_unique<CommentProcessor>(
+        *m_annotationManager, m_options->skipSystemComments);
+
+    // Files loaded from a precompiled header or from the modules that are
+    // imported are not preprocessed again.
+    if (!compiler.getPreprocessorOpts().ImplicitPCHInclude.empty() ||
+        compiler.getLangOpts().Modules) {
+      m_loader = std::make_unique<PrecompiledHeaderLoader>(
+          compiler.getPreprocessor(), *m_annotationManager,
+          *m_commentProcessor, m_inclusionContext,
+          m_options->annotationSnapshot);
+    }
+
+    compiler.getDiagnostics().setClient(&m_diags, false);
+    compiler.getPreprocessor().addCommentHandler(m_commentProcessor.get());
+    compiler.getPreprocessor().addPPCallbacks(
+        std::make_unique<ContextFreePPCallbacks>(
+            m_inclusionContext, compiler.getPreprocessor(),
+            m_options->allowExpansions, m_options->trustedHeaderDirs,
+            compiler.getLangOpts().Modules ? m_loader.get() : nullptr));
+
+    return std::make_unique<VeriFastASTConsumer>(
+        *m_options, m_diags, *m_annotationManager, m_inclusionContext, inFile,
+        *m_writer, *m_deferred, m_cache, *m_exportedFiles, m_incremental);
+  }
+
+  VeriFastFrontendAction(const ExportOptions &options, MessageWriter &writer,
+                         DeferredMessages &deferred, ExportCache *cache,
+                         llvm::StringSet<> &exportedFiles,
+                         IncrementalExports *incremental)
+      : m_options(&options),
+        m_diags(clang::DiagnosticsEngine::Error, options.maxErrors),
+        m_writer(&writer), m_deferred(&deferred), m_cache(cache),
+        m_exportedFiles(&exportedFiles), m_incremental(incremental) {}
+
+protected:
+  bool BeginInvocation(clang::CompilerInstance &compiler) override {
+    applyLeanSema(compiler.getInvocation(), m_options->leanSema);
+    // The parser asks the consumer which bodies to skip.
+    compiler.getFrontendOpts().SkipFunctionBodies =
+        m_options->skipTrustedBodies;
+    return true;
+  }
+
+  void ExecuteAction() override {
+    Timings::Scope timing(Timings::Parse);
+    if (!getCompilerInstance()
+             .getPreprocessorOpts()
+             .ImplicitPCHInclude.empty()) {
+      m_loader->load();
+    }
+    if (TemplateStats::isEnabled()) {
+      clang::CompilerInstance &compiler = getCompilerInstance();
+      if (!compiler.hasSema()) {
+        compiler.createSema(getTranslationUnitKind(), nullptr);
+      }
+      compiler.getSema().TemplateInstCallbacks.push_back(
+          TemplateStats::callback());
+    }
+    clang::ASTFrontendAction::ExecuteAction();
+  }
+
+private:
+  const ExportOptions *m_options;
+  DiagnosticSerializer m_diags;
+  std::unique_ptr<AnnotationManager> m_annotationManager;
+  std::unique_ptr<CommentProcessor> m_commentProcessor;
+  InclusionContext m_inclusionContext;
+  std::unique_ptr<PrecompiledHeaderLoader> m_loader;
+  MessageWriter *m_writer;
+  DeferredMessages *m_deferred;
+  ExportCache *m_cache;
+  llvm::StringSet<> *m_exportedFiles;
+  IncrementalExports *m_incremental;
+};
+
+class VeriFastActionFactory : public clang::tooling::FrontendActionFactory {
+public:
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<VeriFastFrontendAction>(
+        *m_options, *m_writer, m_deferred, m_cache, m_exportedFiles,
+        m_incremental);
+  }
+
+  bool runInvocation(
+      std::shared_ptr<clang::CompilerInvocation> invocation,
+      clang::FileManager *files,
+      std::shared_ptr<clang::PCHContainerOperations> pchContainerOperations,
+      clang::DiagnosticConsumer *diagConsumer) override {
+    if (m_preambles) {
+      // The preamble has to be built with the same language options.
+      applyLeanSema(*invocation, m_options->leanSema);
+      m_preambles->apply(*invocation, files->getVirtualFileSystemPtr(),
+                         pchContainerOperations);
+    }
+    // Tooling clears DisableFree, which is only safe to set again when the
+    // process exits right after the export.
+    if (m_options->fastExit) {
+      invocation->getFrontendOpts().DisableFree = true;
+    }
+    const clang::FrontendOptions &frontendOpts = invocation->getFrontendOpts();
+    std::string inFile = frontendOpts.Inputs.empty()
+                             ? std::string()
+                             : frontendOpts.Inputs[0].getFile().str();
+    std::optional<IncludePrefetch> prefetch;
+    if (m_cache && m_options->prefetchThreads > 0) {
+      std::vector<std::string> closure = m_cache->includeClosure(inFile);
+      if (!closure.empty()) {
+        prefetch.emplace(std::move(closure), m_options->prefetchThreads);
+      }
+    }
+    bool success = clang::tooling::FrontendActionFactory::runInvocation(
+        std::move(invocation), files, std::move(pchContainerOperations),
+        diagConsumer);
+    // The compiler instance, and with it the Clang AST unless DisableFree is
+    // set, is gone, so writing the result adds no more to the peak RSS.
+    m_deferred.flushTo(*m_writer);
+    if (m_options->reportMemory) {
+      MemoryUsage::report(llvm::errs(), "written", inFile);
+    }
+    return success;
+  }
+
+  VeriFastActionFactory(const ExportOptions &options, MessageWriter &writer,
+                        ExportCache *cache,
+                        IncrementalExports *incremental = nullptr,
+                        PreambleCache *preambles = nullptr)
+      : m_options(&options), m_writer(&writer), m_cache(cache),
+        m_incremental(incremental), m_preambles(preambles) {}
+
+  /**
+   * @brief Check whether a result message has been written for a source file.
+   *
+   * @param path Absolute path of the source file.
+   */
+  bool isExported(llvm::StringRef path) const {
+    return m_exportedFiles.contains(path);
+  }
+
+private:
+  const ExportOptions *m_options;
+  MessageWriter *m_writer;
+  DeferredMessages m_deferred;
+  ExportCache *m_cache;
+  llvm::StringSet<> m_exportedFiles;
+  IncrementalExports *m_incremental;
+  PreambleCache *m_preambles;
+};
+
+/**
+ * @brief Writes a precompiled header that keeps a detailed preprocessing
+ * record, so the exporter can restore the include directives of the
+ * precompiled files when it is used.
+ *
+ */
+class EmitPCHAction : public clang::GeneratePCHAction {
+public:
+  EmitPCHAction(llvm::StringRef outputPath, bool leanSema)
+      : m_outputPath(outputPath.str()), m_leanSema(leanSema) {}
+
+protected:
+  bool BeginInvocation(clang::CompilerInstance &compiler) override {
+    applyLeanSema(compiler.getInvocation(), m_leanSema);
+    return clang::GeneratePCHAction::BeginInvocation(compiler);
+  }
+
+  bool BeginSourceFileAction(clang::CompilerInstance &compiler) override {
+    compiler.getFrontendOpts().OutputFile = m_outputPath;
+    if (!compiler.getPreprocessor().getPreprocessingRecord()) {
+      compiler.getPreprocessor().createPreprocessingRecord();
+    }
+    return clang::GeneratePCHAction::BeginSourceFileAction(compiler);
+  }
+
+private:
+  std::string m_outputPath;
+  bool m_leanSema;
+};
 
-class VeriFastASTConsumer : public clang::ASTConsumer {
+class EmitPCHActionFactory : public clang::tooling::FrontendActionFactory {
 public:
-  void HandleTranslationUnit(clang::ASTContext &context) override {
-    capnp::MallocMessageBuilder messageBuilder;
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<EmitPCHAction>(m_outputPath, m_leanSema);
+  }
+
+  EmitPCHActionFactory(llvm::StringRef outputPath, bool leanSema)
+      : m_outputPath(outputPath.str()), m_leanSema(leanSema) {}
+
+private:
+  std::string m_outputPath;
+  bool m_leanSema;
+};
+
+namespace {
+
+/**
+ * @brief Write a result message that only contains the given error. Used when
+ * a request could not produce a translation unit, e.g. because the source file
+ * does not exist.
+ */
+void writeErrorResult(const ExportOptions &options, MessageWriter &writer,
+                      llvm::StringRef path, llvm::StringRef reason) {
+  if (options.streamOutput) {
+    CountingMessageBuilder headerBuilder;
     stubs::SerResult::Builder resultBuilder =
-        messageBuilder.initRoot<stubs::SerResult>();
+        headerBuilder.initRoot<stubs::StreamMessage>().initHeader();
+    resultBuilder.initTu();
+    resultBuilder.setSourcePath(path.str());
+    writer.write(headerBuilder);
 
-    TranslationUnitSerializer serializer(
-        context, *m_annotationManager, *m_inclusionContext,
-        messageBuilder.getOrphanage(), !exportImplicitDecls);
+    CountingMessageBuilder endBuilder;
+    stubs::Error::Builder errorBuilder =
+        endBuilder.initRoot<stubs::StreamMessage>().initEnd(1)[0];
+    errorBuilder.initLoc().initLexed();
+    errorBuilder.setReason(reason.str());
+    writer.write(endBuilder);
+    return;
+  }
 
-    serializer.serialize(context.getTranslationUnitDecl(),
-                         resultBuilder.initTu());
+  CountingMessageBuilder messageBuilder;
+  stubs::SerResult::Builder resultBuilder =
+      messageBuilder.initRoot<stubs::SerResult>();
+  resultBuilder.initTu();
+  resultBuilder.setSourcePath(path.str());
+  stubs::Error::Builder errorBuilder = resultBuilder.initErrors(1)[0];
+  errorBuilder.initLoc().initLexed();
+  errorBuilder.setReason(reason.str());
+  writer.write(messageBuilder);
+}
 
-    if (m_diags->nbDiags() > 0) {
-      m_diags->serialize(resultBuilder.initErrors(m_diags->nbDiags()));
+/**
+ * @brief Check whether any file known to the file manager changed on disk
+ * since it was first seen. Used by the server mode to decide whether the
+ * cached file entries can be reused for the next request.
+ */
+bool filesChanged(clang::FileManager &fileManager) {
+  llvm::SmallVector<const clang::FileEntry *> fileEntries;
+  fileManager.GetUniqueIDMapping(fileEntries);
+  llvm::vfs::FileSystem &fileSystem = fileManager.getVirtualFileSystem();
+  for (const clang::FileEntry *entry : fileEntries) {
+    if (!entry) {
+      continue;
+    }
+    llvm::ErrorOr<llvm::vfs::Status> status =
+        fileSystem.status(entry->getName());
+    if (!status || status->getSize() != uint64_t(entry->getSize()) ||
+        llvm::sys::toTimeT(status->getLastModificationTime()) !=
+            entry->getModificationTime()) {
+      return true;
     }
+  }
+  return false;
+}
 
-    capnp::writeMessageToFd(1, messageBuilder);
+/**
+ * @brief Export the given source files. One result message is written per
+ * source file, in the order in which the files are processed. Each message is
+ * tagged with the path of its source file. Source files that could not be
+ * exported are reported by an error-only result message.
+ *
+ * @param incremental Previous results the new ones are reduced against, or
+ * null.
+ * @param preambles Preambles of the source files, or null.
+ * @return Non-zero if any of the source files failed to compile.
+ */
+int runExport(const ExportOptions &options, clang::tooling::ClangTool &tool,
+              llvm::ArrayRef<std::string> sourcePaths, MessageWriter &writer,
+              ExportCache *cache, IncrementalExports *incremental = nullptr,
+              PreambleCache *preambles = nullptr) {
+  if (options.headerUnit) {
+    // Header units are parsed as headers whatever their extension, and as
+    // C++ rather than as C.
+    tool.appendArgumentsAdjuster(clang::tooling::getInsertArgumentAdjuster(
+        "-xc++-header", clang::tooling::ArgumentInsertPosition::BEGIN));
   }
+  VeriFastActionFactory factory(options, writer, cache, incremental,
+                                preambles);
+  int error = tool.run(&factory);
 
-  VeriFastASTConsumer(const DiagnosticSerializer &diags,
-                      const AnnotationManager &annotationManager,
-                      const InclusionContext &inclusionContext)
-      : m_diags(&diags), m_annotationManager(&annotationManager),
-        m_inclusionContext(&inclusionContext) {}
+  for (const std::string &path : sourcePaths) {
+    std::string absolutePath = clang::tooling::getAbsolutePath(path);
+    if (!factory.isExported(absolutePath)) {
+      writeErrorResult(options, writer, absolutePath,
+                       "Failed to export '" + path + "'");
+    }
+  }
 
-private:
-  const DiagnosticSerializer *m_diags;
-  const AnnotationManager *m_annotationManager;
-  const InclusionContext *m_inclusionContext;
-};
+  return error;
+}
 
-class VeriFastFrontendAction : public clang::ASTFrontendAction {
-public:
-  std::unique_ptr<clang::ASTConsumer>
-  CreateASTConsumer(clang::CompilerInstance &compiler,
-                    llvm::StringRef inFile) override {
-    m_annotationManager = std::make_unique<AnnotationManager>(
-        compiler.getSourceManager(), compiler.getLangOpts());
-    m_commentProcessor =
-        std::make_unique<CommentProcessor>(*m_annotationManager);
+/**
+ * @brief Export the given source files on a pool of worker threads. Each
+ * worker uses its own tool, file manager and file system, so workers do not
+ * share any mutable state apart from the output writer.
+ *
+ * @param nbThreads Number of workers, 0 to use all hardware threads.
+ * @param overlays Contents exported instead of the files on disk.
+ * @param cache Export cache, or nullptr if caching is disabled.
+ * @return Non-zero if any of the source files failed to compile.
+ */
+int runParallelExport(const ExportOptions &options,
+                      const clang::tooling::CompilationDatabase &compilations,
+                      llvm::ArrayRef<std::string> sourcePaths,
+                      unsigned nbThreads, const Overlays &overlays,
+                      MessageWriter &out, ExportCache *cache) {
+  // Buffered results are only needed to preserve the input order. Streamed
+  // messages of different translation units must not be interleaved.
+  bool ordered = orderedOutput || options.streamOutput;
+  std::vector<BufferedMessageWriter> buffers(ordered ? sourcePaths.size() : 0);
+  std::atomic<int> error = 0;
 
-    compiler.getDiagnostics().setClient(&m_diags, false);
-    compiler.getPreprocessor().addCommentHandler(m_commentProcessor.get());
-    compiler.getPreprocessor().addPPCallbacks(
-        std::make_unique<ContextFreePPCallbacks>(
-            m_inclusionContext, compiler.getPreprocessor(), allowExpansions));
+  {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(nbThreads));
+    for (size_t i = 0; i < sourcePaths.size(); ++i) {
+      pool.async([&, i] {
+        MessageWriter &writer =
+            ordered ? static_cast<MessageWriter &>(buffers[i]) : out;
+        if (cache &&
+            cache->replay(compilations, sourcePaths[i], {}, writer).empty()) {
+          return;
+        }
 
-    return std::make_unique<VeriFastASTConsumer>(m_diags, *m_annotationManager,
-                                                 m_inclusionContext);
+        // The real file system changes the process' working directory, which
+        // is not safe when several tools run at once.
+        clang::tooling::ClangTool tool(
+            compilations, sourcePaths[i],
+            std::make_shared<clang::PCHContainerOperations>(),
+            options.fileSystem(llvm::vfs::createPhysicalFileSystem()));
+        mapOverlays(tool, overlays);
+        if (runExport(options, tool, sourcePaths[i], writer, cache)) {
+          error = 1;
+        }
+      });
+    }
+    pool.wait();
   }
 
-  explicit VeriFastFrontendAction()
-      : m_diags(clang::DiagnosticsEngine::Error) {}
+  for (BufferedMessageWriter &buffer : buffers) {
+    buffer.flushTo(out);
+  }
 
-private:
-  DiagnosticSerializer m_diags;
-  std::unique_ptr<AnnotationManager> m_annotationManager;
-  std::unique_ptr<CommentProcessor> m_commentProcessor;
-  InclusionContext m_inclusionContext;
-};
+  return error;
+}
 
-class VeriFastActionFactory : public clang::tooling::FrontendActionFactory {
-public:
-  std::unique_ptr<clang::FrontendAction> create() override {
-    return std::make_unique<VeriFastFrontendAction>();
+/**
+ * @brief Serve export requests from stdin until it is closed. All requests
+ * share one file manager, so header lookups and file entries are reused
+ * between requests as long as the files do not change on disk. Overlay
+ * requests replace the contents of files until they are dropped; the export
+ * cache is bypassed while any overlay is active. Cancellation requests make
+ * the exports of the requests before them stop at the next top-level
+ * declaration, see `RequestQueue`.
+ *
+ * @param overlays Initial overlays, see `applyOverlayRequest`.
+ */
+int runServer(const ExportOptions &serverOptions,
+              const clang::tooling::CompilationDatabase &compilations,
+              Overlays overlays, MessageWriter &out, ExportCache *cache) {
+  std::shared_ptr<RequestQueue> requests = RequestQueue::start();
+  Cancellation &cancellation = requests->cancellation();
+  ExportOptions options = serverOptions;
+  options.cancellation = &cancellation;
+
+  llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager;
+  RequestQueue::Request request;
+  std::vector<std::string> args;
+  std::optional<IncrementalExports> incremental;
+  if (incrementalExport) {
+    incremental.emplace();
   }
-};
+  std::optional<PreambleCache> preambles;
+  if (reusePreamble) {
+    preambles.emplace();
+  }
+
+  while (requests->pop(request)) {
+    const std::string &payload = request.payload;
+    if (!payload.empty() && payload.front() == '\0') {
+      // The file system is rebuilt with the new overlays.
+      if (applyOverlayRequest(payload, overlays)) {
+        fileManager = nullptr;
+      }
+      continue;
+    }
+    if (!splitRequest(payload, args)) {
+      break;
+    }
+    // A request that was cancelled before it started is still answered.
+    if (cancellation.isCancelled(request.number)) {
+      writeErrorResult(options, out,
+                       clang::tooling::getAbsolutePath(args.front()),
+                       "Export of '" + args.front() + "' was cancelled");
+      continue;
+    }
+    cancellation.start(request.number);
+
+    if (!fileManager || filesChanged(*fileManager)) {
+      fileManager = llvm::makeIntrusiveRefCnt<clang::FileManager>(
+          clang::FileSystemOptions(),
+          options.fileSystem(overlayFileSystem(overlays)));
+    }
+    ExportCache *requestCache = overlays.empty() ? cache : nullptr;
+
+    std::string &path = args.front();
+    clang::tooling::CommandLineArguments extraArgs(args.begin() + 1,
+                                                   args.end());
+    if (requestCache &&
+        requestCache->replay(compilations, path, extraArgs, out).empty()) {
+      continue;
+    }
+
+    clang::tooling::ClangTool tool(
+        compilations, {path}, std::make_shared<clang::PCHContainerOperations>(),
+        fileManager->getVirtualFileSystemPtr(), fileManager);
+    tool.appendArgumentsAdjuster(clang::tooling::getInsertArgumentAdjuster(
+        extraArgs, clang::tooling::ArgumentInsertPosition::END));
+
+    runExport(options, tool, args.front(), out, requestCache,
+              incremental ? &*incremental : nullptr,
+              preambles ? &*preambles : nullptr);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Serve the Language Server Protocol on stdin and stdout until the
+ * client exits. Documents are kept as overlays while they are open and are
+ * exported on every change; the diagnostics of the export replace the ones
+ * published for the document before. Like in server mode, the file manager is
+ * reused as long as no overlay and no file on disk changed, and the preamble
+ * of every document is kept, so an edit below the includes only parses the
+ * rest of the document again.
+ *
+ * @param overlays Initial overlays, see `readOverlayArg`.
+ */
+int runLspServer(const ExportOptions &options,
+                 const clang::tooling::CompilationDatabase &compilations,
+                 Overlays overlays) {
+  LspConnection connection(stdin, stdout);
+  llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager;
+  PreambleCache preambles;
+  bool shutdown = false;
+
+  auto publish = [&](llvm::StringRef path, llvm::json::Array diagnostics) {
+    connection.notify(
+        "textDocument/publishDiagnostics",
+        llvm::json::Object{{"uri", pathToUri(path)},
+                           {"diagnostics", std::move(diagnostics)}});
+  };
+
+  auto check = [&](const std::string &path) {
+    if (!fileManager || filesChanged(*fileManager)) {
+      fileManager = llvm::makeIntrusiveRefCnt<clang::FileManager>(
+          clang::FileSystemOptions(),
+          options.fileSystem(overlayFileSystem(overlays)));
+    }
+    clang::tooling::ClangTool tool(
+        compilations, {path}, std::make_shared<clang::PCHContainerOperations>(),
+        fileManager->getVirtualFileSystemPtr(), fileManager);
+    ResultCapture capture;
+    runExport(options, tool, path, capture, nullptr, nullptr, &preambles);
+    if (capture.words().size() == 0) {
+      return;
+    }
+    capnp::ReaderOptions readerOptions;
+    readerOptions.traversalLimitInWords = kj::maxValue;
+    capnp::FlatArrayMessageReader reader(capture.words(), readerOptions);
+    publish(path, diagnosticsOf(reader.getRoot<stubs::SerResult>(), path));
+  };
+
+  while (std::optional<llvm::json::Object> message = connection.read()) {
+    std::optional<llvm::StringRef> method = message->getString("method");
+    const llvm::json::Value *id = message->get("id");
+    const llvm::json::Object *params = message->getObject("params");
+    if (!method) {
+      continue;
+    }
+
+    if (*method == "initialize") {
+      // Documents are synchronized by sending their full contents.
+      connection.reply(
+          *id, llvm::json::Object{
+                   {"capabilities",
+                    llvm::json::Object{{"textDocumentSync", 1}}},
+                   {"serverInfo",
+                    llvm::json::Object{{"name", "vf-cxx-ast-exporter"}}}});
+    } else if (*method == "shutdown") {
+      shutdown = true;
+      connection.reply(*id, nullptr);
+    } else if (*method == "exit") {
+      return shutdown ? 0 : 1;
+    } else if (method->starts_with("textDocument/did") && params) {
+      const llvm::json::Object *document = params->getObject("textDocument");
+      std::optional<llvm::StringRef> uri =
+          document ? document->getString("uri") : std::nullopt;
+      std::string path = uri ? uriToPath(*uri) : std::string();
+      if (path.empty()) {
+        continue;
+      }
+
+      std::optional<llvm::StringRef> text;
+      if (*method == "textDocument/didOpen") {
+        text = document->getString("text");
+      } else if (*method == "textDocument/didChange") {
+        const llvm::json::Array *changes = params->getArray("contentChanges");
+        if (changes && !changes->empty() && changes->back().getAsObject()) {
+          text = changes->back().getAsObject()->getString("text");
+        }
+      } else if (*method == "textDocument/didClose") {
+        // The file on disk is exported again when the document is reopened.
+        if (overlays.erase(path)) {
+          fileManager = nullptr;
+        }
+        publish(path, llvm::json::Array());
+        continue;
+      }
+
+      if (text) {
+        overlays[path] = text->str();
+        fileManager = nullptr;
+      }
+      check(path);
+    } else if (id) {
+      connection.replyError(*id, -32601, "Method not supported");
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * @brief Write the messages of one captured result in the current output mode.
+ * In on-demand mode, the requests on stdin are answered until it is closed;
+ * all errors of the result are written after the header.
+ *
+ * @param message Flat array of the captured SerResult.
+ */
+void replayResult(stubs::SerResult::Reader result,
+                  kj::ArrayPtr<const capnp::word> message, MessageWriter &out) {
+  if (!streamOutput) {
+    out.write(message);
+    return;
+  }
+
+  stubs::TU::Reader tu = result.getTu();
+  CountingMessageBuilder headerBuilder;
+  stubs::SerResult::Builder headerResult =
+      headerBuilder.initRoot<stubs::StreamMessage>().initHeader();
+  headerResult.setSourcePath(result.getSourcePath());
+  stubs::TU::Builder headerTu = headerResult.initTu();
+  headerTu.setMainFd(tu.getMainFd());
+  headerTu.setIncludes(tu.getIncludes());
+  headerTu.setFailDirectives(tu.getFailDirectives());
+  headerTu.setInclusions(tu.getInclusions());
+  headerTu.setLocs(tu.getLocs());
+  headerTu.setNames(tu.getNames());
+  headerTu.setTypes(tu.getTypes());
+  ListBuilder<stubs::File> filesBuilder =
+      headerTu.initFiles(tu.getFiles().size());
+  for (unsigned i = 0; i < tu.getFiles().size(); ++i) {
+    filesBuilder[i].setFd(tu.getFiles()[i].getFd());
+    filesBuilder[i].setPath(tu.getFiles()[i].getPath());
+  }
+  out.write(headerBuilder);
+
+  // The declarations of a file refer to the tables of the whole translation
+  // unit, so every response holds a copy of them.
+  auto writeFileDecls = [&](stubs::File::Reader file) {
+    if (file.getDecls().size() == 0) {
+      return;
+    }
+    CountingMessageBuilder declsBuilder;
+    stubs::FileDecls::Builder fileDecls =
+        declsBuilder.initRoot<stubs::StreamMessage>().initDecls();
+    fileDecls.setFd(file.getFd());
+    fileDecls.setDecls(file.getDecls());
+    fileDecls.setLocs(tu.getLocs());
+    fileDecls.setNames(tu.getNames());
+    fileDecls.setTypes(tu.getTypes());
+    out.write(declsBuilder);
+  };
+  auto writeEnd = [&](capnp::List<stubs::Error>::Reader errors) {
+    CountingMessageBuilder endBuilder;
+    endBuilder.initRoot<stubs::StreamMessage>().setEnd(errors);
+    out.write(endBuilder);
+  };
+
+  if (!onDemand) {
+    for (stubs::File::Reader file : tu.getFiles()) {
+      writeFileDecls(file);
+    }
+    writeEnd(result.getErrors());
+    return;
+  }
+
+  writeEnd(result.getErrors());
+  std::vector<std::string> args;
+  while (readRequest(args)) {
+    unsigned fd;
+    if (llvm::StringRef(args.front()).getAsInteger(10, fd)) {
+      continue;
+    }
+    for (stubs::File::Reader file : tu.getFiles()) {
+      if (file.getFd() == fd) {
+        writeFileDecls(file);
+      }
+    }
+    writeEnd({});
+  }
+}
+
+/**
+ * @brief Write the results captured with `-capture` in the given file, as if
+ * their translation units were exported again with the current options.
+ *
+ * @return Non-zero if the capture cannot be read or any of its results has
+ * errors.
+ */
+int runReplay(llvm::StringRef path, MessageWriter &out) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false,
+                                  /*IsVolatile=*/false,
+                                  llvm::Align(sizeof(capnp::word)));
+  if (!buffer) {
+    llvm::errs() << "Cannot read '" << path
+                 << "': " << buffer.getError().message() << "\n";
+    return 1;
+  }
+
+  llvm::StringRef bytes = (*buffer)->getBuffer();
+  kj::ArrayPtr<const capnp::word> words(
+      reinterpret_cast<const capnp::word *>(bytes.data()),
+      bytes.size() / sizeof(capnp::word));
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+
+  int error = 0;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words, options);
+    size_t messageWords = reader.getEnd() - words.begin();
+    stubs::SerResult::Reader result = reader.getRoot<stubs::SerResult>();
+    if (result.hasErrors() && result.getErrors().size() > 0) {
+      error = 1;
+    }
+    replayResult(result, words.slice(0, messageWords), out);
+    words = words.slice(messageWords, words.size());
+  }
+  return error;
+}
+
+/**
+ * @brief Exporter options that affect the exported messages. Part of the key
+ * of the export cache.
+ */
+std::string optionsKey() {
+  std::string key = exportImplicitDecls ? "implicit" : "explicit";
+  if (locationTable) {
+    key += ",location_table";
+  }
+  if (nameTable) {
+    key += ",name_table";
+  }
+  if (typeTable) {
+    key += ",type_table";
+  }
+  if (compactIntArrays) {
+    key += ",compact_int_arrays";
+  }
+  if (annotationTokens) {
+    key += ",annotation_tokens";
+  }
+  if (annotationSlices) {
+    key += ",annotation_slices";
+  }
+  if (flatExprs) {
+    key += ",flat_exprs";
+  }
+  if (compactExprs) {
+    key += ",compact_exprs";
+  }
+  if (dedupTemplateBodies) {
+    key += ",dedup_template_bodies";
+  }
+  if (!focus.empty()) {
+    key += ";focus=";
+    key += focus;
+  }
+  if (leanSema) {
+    key += ",lean_sema";
+  }
+  if (skipTrustedBodies) {
+    key += ",skip_trusted_bodies";
+  }
+  key += ";max_errors=";
+  key += std::to_string(maxErrors);
+  if (failFast) {
+    key += ",fail_fast";
+  }
+  if (skipSystemComments) {
+    key += ",skip_system_comments";
+  }
+  if (pruneUnreferenced) {
+    key += ",prune_unreferenced";
+  }
+  for (const std::string &macro : allowExpansions) {
+    key += ',';
+    key += macro;
+  }
+  for (const std::string &dir : trustedHeaderDirs) {
+    key += ";trusted=";
+    key += dir;
+  }
+  // The contents of the embedded headers are covered by the identity of the
+  // exporter build, which is part of every key.
+  if (!embeddedHeaders.empty()) {
+    key += ";embedded_headers=";
+    key += embeddedHeaders;
+  }
+  return key;
+}
+
+/**
+ * @brief Redirect stderr to the file at @p path, see -error_file.
+ *
+ * @return Whether stderr was redirected; otherwise an error is written to it.
+ */
+bool redirectStderr(llvm::StringRef path) {
+  int fd;
+  if (std::error_code error = llvm::sys::fs::openFileForWrite(path, fd)) {
+    llvm::errs() << "Cannot open '" << path << "': " << error.message()
+                 << "\n";
+    return false;
+  }
+  llvm::errs().flush();
+#ifdef _WIN32
+  bool redirected = _dup2(fd, 2) == 0;
+  _close(fd);
+#else
+  bool redirected = dup2(fd, 2) != -1;
+  close(fd);
+#endif
+  if (!redirected) {
+    llvm::errs() << "Cannot redirect stderr to '" << path << "'\n";
+  }
+  return redirected;
+}
+
+// Directory of the running exporter, which also holds the headers shipped with
+// VeriFast.
+std::string getExecutableDir(const char *argv0) {
+  std::string executable = llvm::sys::fs::getMainExecutable(
+      argv0, reinterpret_cast<void *>(&getExecutableDir));
+  return llvm::sys::path::parent_path(executable).str();
+}
+
+} // namespace
 
 } // namespace vf
 
-int main(int argc, const char **argv) {
+int vf::runExporter(int argc, const char **argv, MessageWriter *writer) {
+  // The options are global, so the occurrences of a previous in-process run
+  // are forgotten first.
+  llvm::cl::ResetAllOptionOccurrences();
+
+  // Source files are passed per request in server mode, so they are optional
+  // on the command line.
   llvm::Expected<clang::tooling::CommonOptionsParser> expectedParser =
-      clang::tooling::CommonOptionsParser::create(argc, argv, category);
+      clang::tooling::CommonOptionsParser::create(argc, argv, category,
+                                                  llvm::cl::ZeroOrMore);
 
   if (!expectedParser) {
     llvm::errs() << expectedParser.takeError();
+    return 1;
   }
 
   clang::tooling::CommonOptionsParser &optionsParser = expectedParser.get();
-  clang::tooling::ClangTool tool(optionsParser.getCompilations(),
-                                 optionsParser.getSourcePathList());
 
+  if (!focus.empty() && !vf::Focus::parse(focus)) {
+    llvm::errs() << "-focus expects <path>:<line>\n";
+    return 1;
+  }
+
+  if (annotationTokens && !nameTable) {
+    llvm::errs() << "-annotation_tokens requires -name_table\n";
+    return 1;
+  }
+
+  if (flatExprs && (!locationTable || !nameTable)) {
+    llvm::errs() << "-flat_exprs requires -location_table and -name_table\n";
+    return 1;
+  }
+
+  if (writer && (onDemand || serverMode || lspMode || !outputFile.empty() ||
+                 !shmName.empty() || !listenSocket.empty() || standbyMode ||
+                 !errorFile.empty())) {
+    llvm::errs() << "-on_demand, -server, -lsp, -output, -shm, -listen, "
+                    "-standby and -error_file are not available in-process\n";
+    return 1;
+  }
+
+  if (!errorFile.empty() && !redirectStderr(errorFile)) {
+    return 1;
+  }
+
+  if (lspMode && (serverMode || onDemand || streamOutput || projectMode ||
+                  !outputFile.empty() || !shmName.empty() ||
+                  !bundleFile.empty())) {
+    llvm::errs() << "-lsp writes the protocol to stdout, so it cannot be "
+                    "combined with -server, -on_demand, -stream, -project, "
+                    "-output, -shm or -bundle\n";
+    return 1;
+  }
+
+  if (serializeProcesses > 1) {
 #ifdef _WIN32
-  _setmode(1, _O_BINARY);
+    llvm::errs() << "-serialize_processes is not available on Windows\n";
+    return 1;
 #endif
+    if (writer || !streamOutput || onDemand || stats || costByFile > 0 ||
+        templateStats > 0 || timings) {
+      llvm::errs()
+          << "-serialize_processes requires -stream, is not available "
+             "in-process and cannot be combined with -on_demand, -stats, "
+             "-cost_by_file, -template_stats or -timings, whose state stays "
+             "in the forked processes\n";
+      return 1;
+    }
+  }
 
-  vf::VeriFastActionFactory factory;
-  int error = tool.run(&factory);
+  if (!listenSocket.empty()) {
+    return vf::runDaemon(listenSocket);
+  }
 
-  return error;
+  if (standbyMode) {
+    return vf::runStandby();
+  }
+
+  if (projectMode) {
+    if (serverMode || onDemand || !optionsParser.getSourcePathList().empty()) {
+      llvm::errs() << "-project exports the source files of the compilation "
+                      "database, so it cannot be combined with source files, "
+                      "-server or -on_demand\n";
+      return 1;
+    }
+    if (nbJobs.getNumOccurrences() == 0) {
+      nbJobs = 0;
+    }
+  }
+
+  if (onDemand) {
+    if (serverMode || optionsParser.getSourcePathList().size() > 1) {
+      llvm::errs() << "-on_demand requires exactly one source file and reads "
+                      "its requests from stdin, so it cannot be combined "
+                      "with -server\n";
+      return 1;
+    }
+    streamOutput = true;
+  }
+
+  if (incrementalExport &&
+      (!serverMode || streamOutput || !cacheDir.empty() || locationTable ||
+       nameTable || typeTable)) {
+    llvm::errs() << "-incremental requires -server and cannot be combined "
+                    "with -stream, -cache_dir or the location, name and type "
+                    "tables, since it relies on the previous result of every "
+                    "source file\n";
+    return 1;
+  }
+
+  if (timings) {
+    if (nbJobs != 1) {
+      llvm::errs() << "-timings requires -j 1\n";
+      return 1;
+    }
+    if (writerThread) {
+      llvm::errs() << "-timings cannot be combined with -writer_thread\n";
+      return 1;
+    }
+    vf::Timings::enable();
+  }
+  // The timings are written however the exporter returns.
+  auto printTimings = llvm::make_scope_exit(
+      [] { vf::Timings::printJSON(llvm::errs()); });
+
+  if (stats) {
+    if (nbJobs != 1) {
+      llvm::errs() << "-stats requires -j 1\n";
+      return 1;
+    }
+    vf::Census::enable();
+  }
+  auto printStats =
+      llvm::make_scope_exit([] { vf::Census::print(llvm::errs()); });
+
+  if (costByFile > 0) {
+    if (nbJobs != 1) {
+      llvm::errs() << "-cost_by_file requires -j 1\n";
+      return 1;
+    }
+    vf::FileCosts::enable();
+  }
+  auto printFileCosts = llvm::make_scope_exit(
+      [] { vf::FileCosts::print(llvm::errs(), costByFile); });
+
+  if (macroStats > 0) {
+    if (nbJobs != 1) {
+      llvm::errs() << "-macro_stats requires -j 1\n";
+      return 1;
+    }
+    vf::MacroStats::enable();
+  }
+  auto printMacroStats = llvm::make_scope_exit(
+      [] { vf::MacroStats::print(llvm::errs(), macroStats); });
+
+  if (templateStats > 0) {
+    if (nbJobs != 1) {
+      llvm::errs() << "-template_stats requires -j 1\n";
+      return 1;
+    }
+    vf::TemplateStats::enable();
+  }
+  auto printTemplateStats = llvm::make_scope_exit(
+      [] { vf::TemplateStats::print(llvm::errs(), templateStats); });
+
+  if (!profileFile.empty()) {
+    std::string error;
+    if (!vf::SamplingProfiler::start(profileFrequency, error)) {
+      llvm::errs() << "Cannot start the profiler: " << error << '\n';
+      return 1;
+    }
+  }
+  auto writeProfile = llvm::make_scope_exit([] {
+    std::string error;
+    if (!vf::SamplingProfiler::stopAndWrite(profileFile, error)) {
+      llvm::errs() << "Cannot write the profile: " << error << '\n';
+    }
+  });
+
+#ifdef VF_TRACE
+  if (!traceFile.empty()) {
+    if (nbJobs != 1) {
+      llvm::errs() << "-trace requires -j 1\n";
+      return 1;
+    }
+    llvm::timeTraceProfilerInitialize(traceGranularity, argv[0]);
+  }
+  auto writeTrace = llvm::make_scope_exit([] {
+    if (!llvm::timeTraceProfilerEnabled()) {
+      return;
+    }
+    if (llvm::Error error = llvm::timeTraceProfilerWrite(traceFile, "-")) {
+      llvm::errs() << "Cannot write the trace: "
+                   << llvm::toString(std::move(error)) << '\n';
+    }
+    llvm::timeTraceProfilerCleanup();
+  });
+#endif
+
+  if (reusePreamble && !serverMode) {
+    llvm::errs() << "-reuse_preamble requires -server\n";
+    return 1;
+  }
+
+  if (trustedHeaderDirs.getNumOccurrences() == 0) {
+    trustedHeaderDirs.push_back(vf::getExecutableDir(argv[0]));
+  }
+
+  vf::ExportOptions exportOptions = vf::ExportOptions::fromCommandLine();
+
+  vf::Overlays overlays;
+  for (const std::string &arg : overlayArgs) {
+    if (!vf::readOverlayArg(arg, overlays)) {
+      return 1;
+    }
+  }
+
+  std::optional<vf::StatSnapshot> snapshot;
+  if (!statSnapshot.empty()) {
+    snapshot.emplace(statSnapshot);
+    exportOptions.statSnapshot = &*snapshot;
+  }
+  auto saveSnapshot = llvm::make_scope_exit([&] {
+    if (snapshot) {
+      snapshot->save();
+    }
+  });
+
+  // Files loaded from a precompiled header, preamble or module are lexed once
+  // per process, whether or not their snapshots are kept on disk.
+  std::optional<vf::AnnotationSnapshot> fileSnapshots;
+  if (!annotationSnapshot.empty()) {
+    fileSnapshots.emplace(annotationSnapshot);
+  } else {
+    fileSnapshots.emplace();
+  }
+  exportOptions.annotationSnapshot = &*fileSnapshots;
+
+  std::optional<vf::DepFile> deps;
+  if (!depFile.empty()) {
+    // Cached and replayed results are not parsed, so their dependencies are
+    // unknown.
+    if (serverMode || !cacheDir.empty() || !replayFile.empty()) {
+      llvm::errs() << "-dep_file cannot be combined with -server, -cache_dir "
+                      "or -replay\n";
+      return 1;
+    }
+    deps.emplace(depFile, !outputFile.empty() ? outputFile : bundleFile);
+    exportOptions.depFile = &*deps;
+  }
+  auto saveDeps = llvm::make_scope_exit([&] {
+    if (deps && !deps->save()) {
+      llvm::errs() << "Cannot write '" << depFile << "'\n";
+    }
+  });
+
+#ifdef _WIN32
+  if (!writer) {
+    _setmode(0, _O_BINARY);
+    _setmode(1, _O_BINARY);
+  }
+#endif
+
+  int outputFd = 1;
+  if (!outputFile.empty()) {
+    if (std::error_code error =
+            llvm::sys::fs::openFileForWrite(outputFile, outputFd)) {
+      llvm::errs() << "Cannot open '" << outputFile
+                   << "': " << error.message() << "\n";
+      return 1;
+    }
+  }
+
+  bool packed = packedOutput == llvm::cl::BOU_TRUE;
+  if (packedOutput == llvm::cl::BOU_UNSET) {
+    llvm::sys::fs::file_status status;
+    packed = !llvm::sys::fs::status(outputFd, status) &&
+             status.type() == llvm::sys::fs::file_type::fifo_file;
+  }
+
+  vf::FdMessageWriter fdOut(outputFd, packed);
+  std::unique_ptr<vf::ShmMessageWriter> shmOut;
+  if (!shmName.empty()) {
+    if (!outputFile.empty()) {
+      llvm::errs() << "-shm cannot be combined with -output\n";
+      return 1;
+    }
+    std::string error;
+    shmOut = vf::ShmMessageWriter::open(shmName, outputFd, error);
+    if (!shmOut) {
+      llvm::errs() << error << "\n";
+      return 1;
+    }
+  }
+
+  std::unique_ptr<vf::BundleWriter> bundleOut;
+  if (!bundleFile.empty()) {
+    if (writer || !outputFile.empty() || !shmName.empty() || streamOutput ||
+        incrementalExport || !overlayArgs.empty()) {
+      llvm::errs() << "-bundle cannot be combined with -output, -shm, "
+                      "-stream, -on_demand, -incremental or -overlay, and is "
+                      "not available in-process\n";
+      return 1;
+    }
+    std::string error;
+    bundleOut = vf::BundleWriter::open(bundleFile, error);
+    if (!bundleOut) {
+      llvm::errs() << error << "\n";
+      return 1;
+    }
+    bundleOut->setShareMainFiles(headerUnit);
+    for (const std::string &path : linkHeaderUnits) {
+      if (!bundleOut->link(path, error)) {
+        llvm::errs() << error << "\n";
+        return 1;
+      }
+    }
+  } else if (headerUnit || !linkHeaderUnits.empty()) {
+    llvm::errs() << "-header_unit and -link_header_units require -bundle\n";
+    return 1;
+  }
+  // The index is written once all results are.
+  auto finishBundle = llvm::make_scope_exit([&] {
+    if (bundleOut) {
+      bundleOut->finish();
+    }
+  });
+
+  vf::MessageWriter *target = writer;
+  if (!target && bundleOut) {
+    target = bundleOut.get();
+  }
+  if (!target && shmOut) {
+    target = shmOut.get();
+  }
+  vf::MessageWriter &directOut = target ? *target : fdOut;
+  // Queued messages are written before the exporter returns, even on errors.
+  std::optional<vf::ThreadedMessageWriter> threadedOut;
+  if (writerThread) {
+    threadedOut.emplace(directOut);
+  }
+  vf::MessageWriter &out = threadedOut ? *threadedOut : directOut;
+
+  if (!replayFile.empty()) {
+    if (serverMode || incrementalExport || !cacheDir.empty() ||
+        !captureFile.empty()) {
+      llvm::errs() << "-replay cannot be combined with -server, -incremental, "
+                      "-cache_dir or -capture\n";
+      return 1;
+    }
+    return vf::runReplay(replayFile, out);
+  }
+
+  std::optional<vf::FdMessageWriter> capture;
+  int captureFd = -1;
+  if (!captureFile.empty()) {
+    if (!cacheDir.empty()) {
+      llvm::errs() << "-capture cannot be combined with -cache_dir, since "
+                      "cached results are not exported again\n";
+      return 1;
+    }
+    if (std::error_code error =
+            llvm::sys::fs::openFileForWrite(captureFile, captureFd)) {
+      llvm::errs() << "Cannot open '" << captureFile
+                   << "': " << error.message() << "\n";
+      return 1;
+    }
+    capture.emplace(captureFd, false);
+    exportOptions.captureWriter = &*capture;
+  }
+  auto closeCapture = llvm::make_scope_exit([&] {
+    if (capture) {
+      llvm::sys::Process::SafelyCloseFileDescriptor(captureFd);
+    }
+  });
+
+  std::unique_ptr<vf::RemoteCache> remoteCache;
+  if (prefetchThreads > 0 && cacheDir.empty()) {
+    llvm::errs() << "-prefetch_threads requires -cache_dir\n";
+    return 1;
+  }
+
+  if (!remoteCacheUrl.empty()) {
+    if (cacheDir.empty()) {
+      llvm::errs() << "-remote_cache requires -cache_dir\n";
+      return 1;
+    }
+    std::string error;
+    remoteCache = vf::RemoteCache::open(remoteCacheUrl, error);
+    if (!remoteCache) {
+      llvm::errs() << error << "\n";
+      return 1;
+    }
+  }
+
+  std::optional<vf::ExportCache> cache;
+  if (!cacheDir.empty() && !streamOutput && overlays.empty()) {
+    cache.emplace(cacheDir, vf::optionsKey(), remoteCache.get());
+  }
+  vf::ExportCache *cachePtr = cache ? &*cache : nullptr;
+
+  if (lspMode) {
+    return vf::runLspServer(exportOptions, optionsParser.getCompilations(),
+                            std::move(overlays));
+  }
+
+  if (serverMode) {
+    return vf::runServer(exportOptions, optionsParser.getCompilations(),
+                         std::move(overlays), out, cachePtr);
+  }
+
+  const std::vector<std::string> sourcePaths =
+      projectMode ? optionsParser.getCompilations().getAllFiles()
+                  : optionsParser.getSourcePathList();
+
+  if (sourcePaths.empty()) {
+    llvm::errs() << (projectMode ? "The compilation database has no source "
+                                   "files\n"
+                                 : "No source files were given\n");
+    return 1;
+  }
+
+  if (!emitPCH.empty()) {
+    if (sourcePaths.size() != 1) {
+      llvm::errs() << "Exactly one source file is required to emit a "
+                      "precompiled header\n";
+      return 1;
+    }
+    // The header is built from the same files as the exports that use it, so
+    // Clang does not find the embedded headers changed when it loads it.
+    clang::tooling::ClangTool tool(
+        optionsParser.getCompilations(), sourcePaths,
+        std::make_shared<clang::PCHContainerOperations>(),
+        exportOptions.fileSystem(llvm::vfs::getRealFileSystem()));
+    vf::EmitPCHActionFactory factory(emitPCH, exportOptions.leanSema);
+    return tool.run(&factory);
+  }
+
+  if (nbJobs != 1 && sourcePaths.size() > 1) {
+    return vf::runParallelExport(exportOptions,
+                                 optionsParser.getCompilations(), sourcePaths,
+                                 nbJobs, overlays, out, cachePtr);
+  }
+
+  std::vector<std::string> misses =
+      cache ? cache->replay(optionsParser.getCompilations(), sourcePaths, {},
+                            out)
+            : sourcePaths;
+  if (misses.empty()) {
+    return 0;
+  }
+
+  clang::tooling::ClangTool tool(
+      optionsParser.getCompilations(), misses,
+      std::make_shared<clang::PCHContainerOperations>(),
+      exportOptions.fileSystem(llvm::vfs::getRealFileSystem()));
+  vf::mapOverlays(tool, overlays);
+
+  // An in-process export must free its memory.
+  exportOptions.fastExit = !writer && misses.size() == 1;
+  return vf::runExport(exportOptions, tool, misses, out, cachePtr);
 }
\ No newline at end of file
@@ -0,0 +1,585 @@
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+
+static llvm::cl::OptionCategory category("VeriFast AST exporter benchmark "
+                                         "options");
+
+static llvm::cl::opt<std::string> exporterPath(
+    "exporter",
+    llvm::cl::desc("The exporter to benchmark. Defaults to the "
+                   "vf-cxx-ast-exporter next to this executable, or else the "
+                   "one in PATH."),
+    llvm::cl::value_desc("path"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> testsDir(
+    "tests_dir",
+    llvm::cl::desc("Directory whose C++ source files are exported besides the "
+                   "generated inputs, e.g. tests/cxx."),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(category));
+
+static llvm::cl::list<unsigned>
+    sizes("sizes",
+          llvm::cl::desc("Sizes of the generated inputs. Defaults to "
+                         "100,1000."),
+          llvm::cl::value_desc("N"), llvm::cl::CommaSeparated,
+          llvm::cl::cat(category));
+
+static llvm::cl::opt<unsigned> repetitions(
+    "repetitions",
+    llvm::cl::desc("Number of times every input is exported. The median of "
+                   "the runs is reported."),
+    llvm::cl::init(5), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string> baselineFile(
+    "baseline",
+    llvm::cl::desc("Compare the results to those previously saved in the "
+                   "given file with -save."),
+    llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<std::string>
+    saveFile("save",
+             llvm::cl::desc("Save the results as JSON to the given file."),
+             llvm::cl::value_desc("file"), llvm::cl::cat(category));
+
+static llvm::cl::opt<double> maxSlowdown(
+    "max_slowdown",
+    llvm::cl::desc("Fail if an input takes more than this fraction longer "
+                   "than in the baseline. A negative fraction does not "
+                   "compare the times."),
+    llvm::cl::init(0.2), llvm::cl::cat(category));
+
+static llvm::cl::opt<double> maxGrowth(
+    "max_growth",
+    llvm::cl::desc("Fail if the output of an input has more than this "
+                   "fraction more words or nodes than in the baseline."),
+    llvm::cl::init(0.02), llvm::cl::cat(category));
+
+static llvm::cl::list<std::string> extraArgs(
+    "extra_arg",
+    llvm::cl::desc("Additional compiler argument passed to the exporter."),
+    llvm::cl::value_desc("argument"), llvm::cl::cat(category));
+
+static llvm::cl::opt<bool> scalingCheck(
+    "check_scaling",
+    llvm::cl::desc("Instead of benchmarking, export functions with an "
+                   "increasing number of interleaved statements and ghost "
+                   "statements, and fail if the export time grows faster "
+                   "than -max_exponent allows."),
+    llvm::cl::cat(category));
+
+static llvm::cl::list<unsigned> scalingSizes(
+    "scaling_sizes",
+    llvm::cl::desc("Numbers of ghost statements checked by -check_scaling. "
+                   "Defaults to 1000,10000,100000."),
+    llvm::cl::value_desc("N"), llvm::cl::CommaSeparated,
+    llvm::cl::cat(category));
+
+static llvm::cl::opt<double> maxExponent(
+    "max_exponent",
+    llvm::cl::desc("Largest exponent k accepted by -check_scaling when the "
+                   "export time grows like N^k."),
+    llvm::cl::init(1.3), llvm::cl::cat(category));
+
+constexpr const char *frontendMacro = "__VF_CXX_CLANG_FRONTEND__";
+
+struct Input {
+  std::string name;
+  std::string path;
+};
+
+struct PhaseTime {
+  double wall = 0;
+  double cpu = 0;
+};
+
+struct Result {
+  uint64_t bytes = 0;
+  uint64_t words = 0; ///< Words of the messages, before packing.
+  uint64_t nodes = 0; ///< Serialized declarations, statements, expressions
+                      ///< and types.
+  double wall = 0; ///< Sum of the wall times of all phases.
+  std::map<std::string, PhaseTime> phases;
+};
+
+using Generator =
+    std::string (*)(llvm::StringRef dir, llvm::StringRef name, unsigned n);
+
+bool writeFile(llvm::StringRef path,
+               llvm::function_ref<void(llvm::raw_ostream &)> write) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    llvm::errs() << "Cannot write '" << path << "': " << ec.message() << '\n';
+    return false;
+  }
+  write(os);
+  return true;
+}
+
+std::string joinPath(llvm::StringRef dir, llvm::StringRef file) {
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, file);
+  return std::string(path);
+}
+
+// N functions, each with a contract.
+std::string generateFunctions(llvm::StringRef dir, llvm::StringRef name,
+                              unsigned n) {
+  std::string path = joinPath(dir, name.str() + ".cpp");
+  writeFile(path, [n](llvm::raw_ostream &os) {
+    for (unsigned i = 0; i < n; ++i) {
+      os << "int f" << i << "(int x)\n"
+         << "//@ requires 0 <= x &*& x < 1000;\n"
+         << "//@ ensures result == x + " << i << ";\n"
+         << "{\n  return x + " << i << ";\n}\n\n";
+    }
+  });
+  return path;
+}
+
+// N headers, each including the next one. Clang limits the depth of includes
+// to 200, so the headers form chains of at most `maxChain` headers that are
+// all included by the source file.
+std::string generateIncludes(llvm::StringRef dir, llvm::StringRef name,
+                             unsigned n) {
+  constexpr unsigned maxChain = 100;
+  for (unsigned i = 0; i < n; ++i) {
+    std::string header = name.str() + "_" + std::to_string(i) + ".h";
+    writeFile(joinPath(dir, header), [&](llvm::raw_ostream &os) {
+      os << "#pragma once\n";
+      if (i + 1 < n && (i + 1) % maxChain != 0) {
+        os << "#include \"" << name << '_' << i + 1 << ".h\"\n";
+      }
+      os << "int g" << i << "();\n//@ requires true;\n//@ ensures true;\n";
+    });
+  }
+  std::string path = joinPath(dir, name.str() + ".cpp");
+  writeFile(path, [&](llvm::raw_ostream &os) {
+    for (unsigned i = 0; i < n; i += maxChain) {
+      os << "#include \"" << name << '_' << i << ".h\"\n";
+    }
+  });
+  return path;
+}
+
+// One function with N statements, each followed by a ghost statement.
+std::string generateAnnotations(llvm::StringRef dir, llvm::StringRef name,
+                                unsigned n) {
+  std::string path = joinPath(dir, name.str() + ".cpp");
+  writeFile(path, [n](llvm::raw_ostream &os) {
+    os << "void f()\n//@ requires true;\n//@ ensures true;\n{\n"
+       << "  int x = 0;\n";
+    for (unsigned i = 0; i < n; ++i) {
+      os << "  x = " << i << ";\n  //@ assert x == " << i << ";\n";
+    }
+    os << "}\n";
+  });
+  return path;
+}
+
+// An array initialized by a list of N elements.
+std::string generateInitList(llvm::StringRef dir, llvm::StringRef name,
+                             unsigned n) {
+  std::string path = joinPath(dir, name.str() + ".cpp");
+  writeFile(path, [n](llvm::raw_ostream &os) {
+    os << "int values[] = {";
+    for (unsigned i = 0; i < n; ++i) {
+      os << (i == 0 ? "" : ", ") << i;
+    }
+    os << "};\n";
+  });
+  return path;
+}
+
+// A hierarchy of N classes, each deriving from the previous one.
+std::string generateHierarchy(llvm::StringRef dir, llvm::StringRef name,
+                              unsigned n) {
+  std::string path = joinPath(dir, name.str() + ".cpp");
+  writeFile(path, [n](llvm::raw_ostream &os) {
+    for (unsigned i = 0; i < n; ++i) {
+      os << "struct C" << i;
+      if (i > 0) {
+        os << " : C" << i - 1;
+      }
+      os << " {\n  int m" << i << ";\n};\n";
+    }
+  });
+  return path;
+}
+
+constexpr std::pair<const char *, Generator> generators[] = {
+    {"functions", generateFunctions},   {"includes", generateIncludes},
+    {"annotations", generateAnnotations}, {"init_list", generateInitList},
+    {"hierarchy", generateHierarchy}};
+
+std::optional<std::string> findExporter(const char *argv0) {
+  if (!exporterPath.empty()) {
+    return exporterPath.getValue();
+  }
+  std::string executable = llvm::sys::fs::getMainExecutable(
+      argv0, reinterpret_cast<void *>(&findExporter));
+  llvm::StringRef dir = llvm::sys::path::parent_path(executable);
+  if (llvm::ErrorOr<std::string> path =
+          llvm::sys::findProgramByName("vf-cxx-ast-exporter", {dir})) {
+    return *path;
+  }
+  if (llvm::ErrorOr<std::string> path =
+          llvm::sys::findProgramByName("vf-cxx-ast-exporter")) {
+    return *path;
+  }
+  return {};
+}
+
+// Reads the timings that the exporter writes as the last line of its stderr.
+std::optional<llvm::json::Object> readTimings(llvm::StringRef stderrPath) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(stderrPath);
+  if (!buffer) {
+    return {};
+  }
+  llvm::StringRef text = (*buffer)->getBuffer().rtrim();
+  llvm::StringRef lastLine = text.substr(text.rfind('\n') + 1);
+  llvm::Expected<llvm::json::Value> value = llvm::json::parse(lastLine);
+  if (!value) {
+    llvm::consumeError(value.takeError());
+    return {};
+  }
+  if (llvm::json::Object *object = value->getAsObject()) {
+    return std::move(*object);
+  }
+  return {};
+}
+
+// Reads the size of the output from the node census that the exporter writes
+// to its stderr with -stats: the nodes of its total row and the words of the
+// messages that were written.
+bool readCensus(llvm::StringRef stderrPath, Result &result) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(stderrPath);
+  if (!buffer) {
+    return false;
+  }
+  bool hasNodes = false, hasWords = false;
+  llvm::SmallVector<llvm::StringRef> lines;
+  (*buffer)->getBuffer().split(lines, '\n');
+  for (llvm::StringRef line : lines) {
+    llvm::SmallVector<llvm::StringRef> fields;
+    line.split(fields, ' ', -1, false);
+    if (fields.size() == 4 && fields[0] == "total") {
+      hasNodes = !fields[1].getAsInteger(10, result.nodes);
+    } else if (line.consume_front("messages written: ")) {
+      line = line.drop_until([](char c) { return c == '('; }).drop_front();
+      hasWords = !line.consumeInteger(10, result.words);
+    }
+  }
+  return hasNodes && hasWords;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t middle = values.size() / 2;
+  return values.size() % 2 ? values[middle]
+                           : (values[middle - 1] + values[middle]) / 2;
+}
+
+std::optional<Result> run(llvm::StringRef exporter, llvm::StringRef workDir,
+                          const Input &input) {
+  std::string outputPath = joinPath(workDir, "output.bin");
+  std::string stderrPath = joinPath(workDir, "stderr.txt");
+  std::string includeDir =
+      "-I" + llvm::sys::path::parent_path(exporter).str();
+
+  // The options of the translator, except that the whole translation unit is
+  // serialized rather than the declarations that are requested on demand.
+  std::vector<llvm::StringRef> args = {exporter,
+                                       input.path,
+                                       "-location_table",
+                                       "-name_table",
+                                       "-type_table",
+                                       "-compact_int_arrays",
+                                       "-dedup_template_bodies",
+                                       "-annotation_tokens",
+                                       "-flat_exprs",
+                                       "-lean_sema",
+                                       "-packed",
+                                       "-timings"};
+  std::string allowExpansions =
+      std::string("-allow_macro_expansion=") + frontendMacro;
+  std::string output = "-output=" + outputPath;
+  std::string define = std::string("-D") + frontendMacro;
+  args.insert(args.end(), {allowExpansions, output, "--", "-xc++",
+                           "-std=c++17", includeDir, define});
+  for (const std::string &arg : extraArgs) {
+    args.push_back(arg);
+  }
+
+  std::map<std::string, std::vector<double>> walls, cpus;
+  std::vector<double> totals;
+  Result result;
+  for (unsigned i = 0; i < repetitions; ++i) {
+    std::optional<llvm::StringRef> redirects[] = {
+        llvm::StringRef(""), llvm::StringRef(""), llvm::StringRef(stderrPath)};
+    std::string error;
+    int status = llvm::sys::ExecuteAndWait(exporter, args, std::nullopt,
+                                           redirects, 0, 0, &error);
+    std::optional<llvm::json::Object> timings = readTimings(stderrPath);
+    if (status != 0 || !timings) {
+      llvm::errs() << input.name << ": the exporter failed"
+                   << (error.empty() ? "" : ": ") << error << '\n';
+      return {};
+    }
+    double total = 0;
+    for (const auto &[phase, value] : *timings) {
+      const llvm::json::Object *times = value.getAsObject();
+      if (!times) {
+        continue;
+      }
+      std::string name = phase.str().str();
+      double wall = times->getNumber("wall").value_or(0);
+      walls[name].push_back(wall);
+      cpus[name].push_back(times->getNumber("cpu").value_or(0));
+      total += wall;
+    }
+    totals.push_back(total);
+    uint64_t size = 0;
+    llvm::sys::fs::file_size(outputPath, size);
+    result.bytes = size;
+  }
+  for (const auto &[phase, values] : walls) {
+    result.phases[phase] = {median(values), median(cpus[phase])};
+  }
+  result.wall = median(totals);
+
+  // The census is taken by a separate run, so it does not slow down the
+  // timed ones.
+  args.insert(args.begin() + 2, "-stats");
+  std::optional<llvm::StringRef> redirects[] = {
+      llvm::StringRef(""), llvm::StringRef(""), llvm::StringRef(stderrPath)};
+  if (llvm::sys::ExecuteAndWait(exporter, args, std::nullopt, redirects) !=
+          0 ||
+      !readCensus(stderrPath, result)) {
+    llvm::errs() << input.name << ": the exporter failed to report its "
+                 << "node census\n";
+    return {};
+  }
+  return result;
+}
+
+llvm::json::Value toJSON(const Result &result) {
+  llvm::json::Object phases;
+  for (const auto &[phase, time] : result.phases) {
+    phases[phase] = llvm::json::Object{{"wall", time.wall}, {"cpu", time.cpu}};
+  }
+  return llvm::json::Object{{"bytes", static_cast<int64_t>(result.bytes)},
+                            {"words", static_cast<int64_t>(result.words)},
+                            {"nodes", static_cast<int64_t>(result.nodes)},
+                            {"wall", result.wall},
+                            {"phases", std::move(phases)}};
+}
+
+std::optional<llvm::json::Object> readBaseline() {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(baselineFile);
+  if (!buffer) {
+    llvm::errs() << "Cannot read '" << baselineFile
+                 << "': " << buffer.getError().message() << '\n';
+    return {};
+  }
+  llvm::Expected<llvm::json::Value> value =
+      llvm::json::parse((*buffer)->getBuffer());
+  if (!value) {
+    llvm::errs() << "Invalid baseline '" << baselineFile
+                 << "': " << llvm::toString(value.takeError()) << '\n';
+    return {};
+  }
+  if (llvm::json::Object *object = value->getAsObject()) {
+    return std::move(*object);
+  }
+  llvm::errs() << "Invalid baseline '" << baselineFile << "'\n";
+  return {};
+}
+
+void printChange(llvm::raw_ostream &os, double value,
+                 std::optional<double> base) {
+  if (base && *base > 0) {
+    os << llvm::format(" (%+.1f%%)", (value / *base - 1) * 100);
+  }
+}
+
+// Checks that the export time of annotation-dense functions grows close to
+// linearly, which catches quadratic lookups of the annotations of statements.
+bool checkScaling(llvm::StringRef exporter, llvm::StringRef workDir) {
+  std::vector<unsigned> ns(scalingSizes.begin(), scalingSizes.end());
+  if (ns.empty()) {
+    ns = {1000, 10000, 100000};
+  }
+  std::sort(ns.begin(), ns.end());
+
+  llvm::raw_ostream &os = llvm::outs();
+  bool ok = true;
+  std::optional<std::pair<unsigned, double>> previous;
+  for (unsigned n : ns) {
+    std::string name = "annotations_" + std::to_string(n);
+    std::optional<Result> result =
+        run(exporter, workDir, {name, generateAnnotations(workDir, name, n)});
+    if (!result) {
+      return false;
+    }
+    os << name << ": " << llvm::format("%.3f", result->wall * 1000) << " ms";
+    if (previous && previous->first < n && previous->second > 0) {
+      double exponent = std::log(result->wall / previous->second) /
+                        std::log(static_cast<double>(n) / previous->first);
+      os << llvm::format(", grows like N^%.2f", exponent);
+      if (exponent > maxExponent) {
+        os << " (more than N^" << maxExponent.getValue() << ')';
+        ok = false;
+      }
+    }
+    os << '\n';
+    previous = {n, result->wall};
+  }
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  llvm::cl::HideUnrelatedOptions(category);
+  llvm::cl::ParseCommandLineOptions(
+      argc, argv,
+      "Benchmark of vf-cxx-ast-exporter over the source files of a directory "
+      "and generated inputs of increasing size.\n");
+
+  std::optional<std::string> exporter = findExporter(argv[0]);
+  if (!exporter) {
+    llvm::errs() << "Cannot find vf-cxx-ast-exporter, pass it with "
+                    "-exporter\n";
+    return 1;
+  }
+
+  std::optional<llvm::json::Object> baseline;
+  if (!baselineFile.empty() && !(baseline = readBaseline())) {
+    return 1;
+  }
+
+  llvm::SmallString<128> workDir;
+  if (std::error_code ec = llvm::sys::fs::createUniqueDirectory(
+          "vf-cxx-ast-exporter-bench", workDir)) {
+    llvm::errs() << "Cannot create a temporary directory: " << ec.message()
+                 << '\n';
+    return 1;
+  }
+
+  if (scalingCheck) {
+    bool ok = checkScaling(*exporter, workDir);
+    llvm::sys::fs::remove_directories(workDir);
+    return ok ? 0 : 1;
+  }
+
+  std::vector<Input> inputs;
+  if (!testsDir.empty()) {
+    std::error_code ec;
+    for (llvm::sys::fs::recursive_directory_iterator it(testsDir, ec), end;
+         it != end && !ec; it.increment(ec)) {
+      if (llvm::sys::path::extension(it->path()) == ".cpp") {
+        llvm::StringRef name = it->path();
+        name.consume_front(testsDir);
+        name = name.ltrim("/\\");
+        inputs.push_back({name.str(), it->path()});
+      }
+    }
+    std::sort(inputs.begin(), inputs.end(),
+              [](const Input &lhs, const Input &rhs) {
+                return lhs.name < rhs.name;
+              });
+  }
+  std::vector<unsigned> ns(sizes.begin(), sizes.end());
+  if (ns.empty()) {
+    ns = {100, 1000};
+  }
+  for (const auto &[kind, generate] : generators) {
+    for (unsigned n : ns) {
+      std::string name = std::string(kind) + "_" + std::to_string(n);
+      inputs.push_back({name, generate(workDir, name, n)});
+    }
+  }
+
+  llvm::json::Object results;
+  bool ok = true;
+  llvm::raw_ostream &os = llvm::outs();
+  for (const Input &input : inputs) {
+    std::optional<Result> result = run(*exporter, workDir, input);
+    if (!result) {
+      ok = false;
+      continue;
+    }
+    const llvm::json::Object *base =
+        baseline ? baseline->getObject(input.name) : nullptr;
+    std::optional<double> baseWall =
+        base ? base->getNumber("wall") : std::nullopt;
+    std::optional<double> baseBytes =
+        base ? base->getNumber("bytes") : std::nullopt;
+    std::optional<double> baseWords =
+        base ? base->getNumber("words") : std::nullopt;
+    std::optional<double> baseNodes =
+        base ? base->getNumber("nodes") : std::nullopt;
+
+    os << input.name << ": " << llvm::format("%.3f", result->wall * 1000)
+       << " ms";
+    printChange(os, result->wall, baseWall);
+    os << ", " << result->bytes << " bytes";
+    printChange(os, result->bytes, baseBytes);
+    os << ", " << result->words << " words";
+    printChange(os, result->words, baseWords);
+    os << ", " << result->nodes << " nodes";
+    printChange(os, result->nodes, baseNodes);
+    os << '\n';
+    for (const auto &[phase, time] : result->phases) {
+      if (time.wall == 0) {
+        continue;
+      }
+      os << llvm::format("  %-20s %10.3f ms wall %10.3f ms cpu\n",
+                         phase.c_str(), time.wall * 1000, time.cpu * 1000);
+    }
+    if (maxSlowdown >= 0 && baseWall && *baseWall > 0 &&
+        result->wall > *baseWall * (1 + maxSlowdown)) {
+      llvm::errs() << input.name << ": slower than the baseline\n";
+      ok = false;
+    }
+    if ((baseWords && result->words > *baseWords * (1 + maxGrowth)) ||
+        (baseNodes && result->nodes > *baseNodes * (1 + maxGrowth))) {
+      llvm::errs() << input.name << ": larger output than the baseline\n";
+      ok = false;
+    }
+    results[input.name] = toJSON(*result);
+  }
+
+  llvm::sys::fs::remove_directories(workDir);
+
+  if (!saveFile.empty()) {
+    writeFile(saveFile, [&results](llvm::raw_ostream &file) {
+      file << llvm::formatv("{0:2}", llvm::json::Value(std::move(results)))
+           << '\n';
+    });
+  }
+  return ok ? 0 : 1;
+}
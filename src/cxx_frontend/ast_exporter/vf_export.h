@@ -0,0 +1,45 @@
+#ifndef VF_EXPORT_H
+#define VF_EXPORT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Export a C++ source file in-process, as `vf-cxx-ast-exporter`
+ * would with the given options. Exports run one at a time, since the
+ * exporter's options are global. Diagnostics are written to stderr.
+ *
+ * @param path Source file to export.
+ * @param args Null-terminated exporter options, followed by `--` and the
+ * compiler arguments if any. `-on_demand`, `-server`, `-output`, `-shm` and
+ * `-listen` are not available.
+ * @param out_buf Set to a buffer with the result messages, unpacked and in
+ * the standard stream framing, which must be released with
+ * `vf_export_free`, or to null if there are none.
+ * @param out_len Set to the size of that buffer in bytes.
+ * @return The exit status of the exporter: 0 on success.
+ */
+int vf_export(const char *path, const char **args, void **out_buf,
+              size_t *out_len);
+
+/**
+ * @brief Release a buffer returned by `vf_export`.
+ */
+void vf_export_free(void *buf);
+
+/**
+ * @brief Run the exporter with the given command line, writing its results
+ * like the `vf-cxx-ast-exporter` executable does.
+ *
+ * @return The exit status of the exporter.
+ */
+int vf_export_main(int argc, const char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
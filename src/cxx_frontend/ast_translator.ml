@@ -7,12 +7,55 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
      the first integer represents the file. This map is used to retrieve the filename.
   *)
   let files_table : (int, string) Hashtbl.t = Hashtbl.create 8
-  let get_fd_path = Hashtbl.find files_table
+
+  (*
+     The same mapping indexed by file identifier, which Clang assigns densely, for identifiers
+     below [max_indexed_fd]. Every location of a file shares the path string of its entry.
+  *)
+  let fd_paths : string option array ref = ref [||]
+  let max_indexed_fd = 1 lsl 16
+
+  let get_fd_path fd =
+    match !fd_paths with
+    | paths when fd >= 0 && fd < Array.length paths -> (
+        match Array.unsafe_get paths fd with
+        | Some path -> path
+        | None -> Hashtbl.find files_table fd)
+    | _ -> Hashtbl.find files_table fd
+
+  (* Reports made while the declarations of a header are translated, most recent first, see [Header_cache]. *)
+  let header_reports : Header_cache.report list ref option ref = ref None
+
+  (* Reports made while the current translation unit is translated, most recent first, if its translation is
+     cached, see [Tu_cache]. *)
+  let tu_reports : Header_cache.report list ref option ref = ref None
+
+  let record_report report =
+    (match !header_reports with
+    | Some reports -> reports := report :: !reports
+    | None -> ());
+    match !tu_reports with
+    | Some reports -> reports := report :: !reports
+    | None -> ()
+
+  (* Makes [report] and records it for the caches. *)
+  let report (report : Header_cache.report) =
+    record_report report;
+    match report with
+    | Header_cache.Range (kind, loc) -> Args.report_range kind loc
+    | Should_fail (directive, loc) -> Args.report_should_fail directive loc
+    | Macro_call (call, def) -> Args.report_macro_call call def
 
   module Node_translator = Node_translator.Make (struct
     include Args
 
     let path_of_int = get_fd_path
+    let report_range kind loc = report (Header_cache.Range (kind, loc))
+
+    let report_should_fail directive loc =
+      report (Header_cache.Should_fail (directive, loc))
+
+    let report_macro_call call def = report (Header_cache.Macro_call (call, def))
   end)
 
   module AP = Node_translator.Annotation_parser
@@ -22,24 +65,12 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
     Parser.decompose_data_model Args.data_model_opt
 
   (**
-    [invoke_exporter path allow_expansions] runs the C++ AST exporter. This tool visits each node
-    in the C++ AST and serializes it. It also checks if every macro expansion is context free. 
-    [allow_expansions] is a list of macros that should be allowed to expand, even
-    if they depend on the context where they are included. 
-    
-    Returns ({i in_channel}, {i out_channel}, {i error_channel}), which should be closed afterwards.
-    The serialized AST will be transmitted through {i in_channel} in case of success. Otherwise an error
-    is transmitted through {i error_channel}. {i out_channel} should not be used.
-
-    In case of success, the exporter first transmits a message {i SerResult.Ok} through {i in_channel} 
-    to report that the compilation, context free macro expansion check, and AST serialization were successful.
-    The next message that is transmitted through {i in_channel} represents the serialized C++ AST.
-
-    Otherwise a message {i SerResult.Error} is transmitted through {i error_channel}
-    if any error occurred during compilation, context free macro expansion checking, or AST serialization.
-    This error message contains an explanation why the C++ AST exporter produced an error.
+    [exporter_args ?shm file allow_expansions] returns the command line that runs the exporter for [file],
+    see [invoke_exporter], as a list of arguments. The exporter writes its messages through the shared
+    memory object named [shm], if given.
   *)
-  let invoke_exporter (file : string) (allow_expansions : string list) =
+  let exporter_args ?(shm : string option) (file : string)
+      (allow_expansions : string list) : string list =
     let bin_dir = Filename.dirname Sys.executable_name in
     let frontend_macro = "__VF_CXX_CLANG_FRONTEND__" in
     let allow_expansions = frontend_macro :: allow_expansions in
@@ -48,26 +79,174 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
        -x<language>                          Treat input files as having type <language>
        -I<dir>                               Include dir
        -D<macros>                            Define macros <macros>
+       -focus=<path>:<line>                  Only serialize the body of the function on <line>
+       -skip_trusted_bodies                  Don't parse or serialize the bodies of functions in the headers
+                                             shipped with VeriFast, which are not verified; their bodies are
+                                             then never translated either
+    *)
+    let focus =
+      match Args.focus with
+      | Some (path, line) -> [ Printf.sprintf "-focus=%s:%d" path line ]
+      | None -> []
+    in
+    (*
+       VF_CXX_EXPORT_CAPTURE=<dir>   Capture the complete result in <dir>/<file>.ser and
+                                     the exporter command in <dir>/<file>.cmd
+       VF_CXX_EXPORT_REPLAY=<file>   Replay the result captured in <file> instead of exporting
+    *)
+    let capture_dir = Sys.getenv_opt "VF_CXX_EXPORT_CAPTURE" in
+    let replay =
+      match (Sys.getenv_opt "VF_CXX_EXPORT_REPLAY", capture_dir) with
+      | Some replay_file, _ -> [ "-replay=" ^ replay_file ]
+      | None, Some dir ->
+          [ "-capture=" ^ Filename.concat dir (Filename.basename file ^ ".ser") ]
+      | None, None -> []
+    in
+    let shm = match shm with Some name -> [ "-shm=" ^ name ] | None -> [] in
+    (*
+       VF_CXX_EXPORT_STAT_SNAPSHOT=<file>   Remember missing headers across runs in <file>
+    *)
+    let stat_snapshot =
+      match Sys.getenv_opt "VF_CXX_EXPORT_STAT_SNAPSHOT" with
+      | Some file -> [ "-stat_snapshot=" ^ file ]
+      | None -> []
+    in
+    (*
+       VF_CXX_MODULE_MAP=<file>   Import the headers of the modules declared in the module map <file> as
+                                  modules, built once into a cache next to it
     *)
-    let cmd =
-      Printf.sprintf
-        "%s/vf-cxx-ast-exporter %s -allow_macro_expansion=%s -- -x%s \
-         -std=c++17 -I%s -D%s %s"
-        bin_dir file
-        (String.concat "," allow_expansions)
-        (match Args.dialect_opt with Some Cxx -> "c++" | _ -> "c")
-        bin_dir frontend_macro
-        (Args.include_paths |> List.map (fun s -> "-I" ^ s) |> String.concat " ")
+    let module_map, module_flags =
+      match Sys.getenv_opt "VF_CXX_MODULE_MAP" with
+      | Some map ->
+          let cache = Filename.concat (Filename.dirname map) ".vf-module-cache" in
+          ( [ "-annotation_snapshot=" ^ Filename.concat cache "annotations.snapshot" ],
+            [ "-fmodules"; "-fmodule-map-file=" ^ map; "-fmodules-cache-path=" ^ cache ] )
+      | None -> ([], [])
     in
-    let inchan, outchan, errchan = Unix.open_process_full cmd [||] in
-    (inchan, outchan, errchan)
+    [ bin_dir ^ "/vf-cxx-ast-exporter"; file ]
+    @ focus @ replay @ shm @ stat_snapshot @ module_map
+    @ [
+        "-on_demand"; "-location_table"; "-name_table"; "-type_table";
+        "-compact_int_arrays"; "-dedup_template_bodies"; "-annotation_tokens";
+        "-annotation_slices"; "-flat_exprs"; "-compact_exprs"; "-lean_sema";
+        "-fail_fast"; "-packed"; "-skip_trusted_bodies";
+        "-embedded_headers=" ^ bin_dir;
+        "-allow_macro_expansion=" ^ String.concat "," allow_expansions;
+        "--";
+      ]
+    @ (match Args.dialect_opt with
+      | Some Cxx -> [ "-xc++"; "-std=c++17" ]
+      | _ -> [ "-xc" ])
+    @ [ "-I" ^ bin_dir; "-D" ^ frontend_macro ]
+    @ module_flags
+    @ List.map (fun s -> "-I" ^ s) Args.include_paths
+
+  (**
+    [exporter_command args] returns the shell command that runs the exporter with the arguments [args] of
+    [exporter_args]. It also identifies the run, e.g. for [Exporter_prefetch].
+  *)
+  let exporter_command (args : string list) : string = String.concat " " args
 
   (**
-    [subs_ast_inc_channel pipe] creates a read context to dezerialize cap'n proto messages from the given
+    [launch_exporter file args] starts the exporter with the arguments [args] for [file], see [invoke_exporter].
+    The run is forked by the exporter daemon at [VF_CXX_EXPORT_DAEMON], if it is given and can be reached,
+    see [Exporter_daemon]; otherwise it is handed to a process that is waiting for it, see [Exporter_pool],
+    or a process is started. The run writes its stderr to a temporary file, see [Exporter_daemon.error_output],
+    since stderr is only read once the run failed, and a full pipe would block the run meanwhile.
+  *)
+  let launch_exporter (file : string) (args : string list) =
+    let cmd = exporter_command args in
+    let error_file = Filename.temp_file "vf-cxx-exporter" ".err" in
+    let args =
+      match args with
+      | exporter :: file :: rest -> exporter :: file :: ("-error_file=" ^ error_file) :: rest
+      | _ -> args
+    in
+    (match Sys.getenv_opt "VF_CXX_EXPORT_CAPTURE" with
+    | Some dir ->
+        let chan =
+          open_out (Filename.concat dir (Filename.basename file ^ ".cmd"))
+        in
+        output_string chan (cmd ^ "\n");
+        close_out chan
+    | None -> ());
+    let daemon_channels =
+      match Exporter_daemon.socket_opt () with
+      | Some socket -> (
+          try Some (Exporter_daemon.connect socket args) with Failure _ -> None)
+      | None -> None
+    in
+    let channels_opt =
+      match daemon_channels with
+      | Some _ -> daemon_channels
+      | None -> Exporter_pool.take args
+    in
+    let channels =
+      match channels_opt with
+      | Some channels -> channels
+      | None -> (
+          try Unix.open_process_full (exporter_command args) [||]
+          with e ->
+            (try Sys.remove error_file with Sys_error _ -> ());
+            raise e)
+    in
+    Exporter_daemon.set_error_file channels error_file;
+    channels
+
+  (**
+    [invoke_exporter path allow_expansions] runs the C++ AST exporter. This tool visits each node
+    in the C++ AST and serializes it. It also checks if every macro expansion is context free. 
+    [allow_expansions] is a list of macros that should be allowed to expand, even
+    if they depend on the context where they are included. 
+    
+    Returns ({i in_channel}, {i out_channel}, {i error_channel}), which should be closed with
+    [Exporter_daemon.close] afterwards.
+
+    The exporter uses its on-demand protocol, see [transl_on_demand]: the declarations of a file are
+    requested through {i out_channel}, and {i in_channel} carries the header of the translation unit, the
+    declarations of every requested file and an end message with the errors reported meanwhile, such as
+    context-sensitive macro expansions. Messages transmitted through {i in_channel} are packed, unless [shm]
+    names a shared memory object, see [Shm_transport], in which case {i in_channel} carries notifications of
+    the messages in that object. If the exporter fails, e.g. on a bad command line or a crash, {i in_channel}
+    ends early and [Exporter_daemon.error_output] returns what it wrote to stderr, which it writes to a
+    temporary file rather than to {i error_channel}, see [launch_exporter].
+
+    The process that was prefetched for the same command line is used if there is one, and the command
+    line is remembered for speculative exports of [file], see [Exporter_prefetch.speculate].
+  *)
+  let invoke_exporter ?(shm : string option) (file : string)
+      (allow_expansions : string list) =
+    let args = exporter_args ?shm file allow_expansions in
+    let cmd = exporter_command args in
+    if shm = None then
+      Exporter_prefetch.remember file cmd (fun options ->
+          match args with
+          | exporter :: file :: rest -> launch_exporter file (exporter :: file :: options @ rest)
+          | _ -> launch_exporter file args);
+    match Exporter_prefetch.take file cmd with
+    | Some channels -> channels
+    | None -> launch_exporter file args
+
+  (**
+    [prefetch_exporter allow_expansions] starts the exporter for the source file that is translated after
+    this one, if any, see [Exporter_prefetch]. It is started with the arguments of this translator, as it
+    is only used if the next translation unit uses the same command line. Nothing is prefetched with the
+    shared memory transport, whose object is created per translation unit.
+  *)
+  let prefetch_exporter (allow_expansions : string list) =
+    match Exporter_prefetch.next_after Args.path with
+    | Some next when Shm_transport.size_opt () = None ->
+        let args = exporter_args next allow_expansions in
+        Exporter_prefetch.start next (exporter_command args) (fun () ->
+            launch_exporter next args)
+    | _ -> ()
+
+  (**
+    [stubs_ast_in_channel ~compression pipe] creates a read context to dezerialize cap'n proto messages from the given
     [pipe]. This read context can be used to read multiple cap'n proto messages.
   *)
-  let stubs_ast_in_channel pipe =
-    Capnp_unix.IO.create_read_context_for_channel ~compression:`None pipe
+  let stubs_ast_in_channel ~compression pipe =
+    Capnp_unix.IO.create_read_context_for_channel ~compression pipe
 
   (**
     [read_capn_message read_context] reads {e one} cap'n proto message from [read_context].
@@ -79,23 +258,37 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
   (* translation unit *)
   (********************)
 
-  let transl_includes (decls_map : (int * R.Node.t Capnp_util.capnp_arr) list)
+  (**
+    [transl_includes transl_header inclusions includes] translates the include directives [includes] of the main file.
+    [inclusions] is the inclusion table of the translation unit, which holds the directives of every included file.
+    [transl_header path fd] has to translate the declarations of header [path], whose file descriptor is [fd].
+  *)
+  let transl_includes (transl_header : string -> int -> Ast.decl list)
+      (inclusions : R.Inclusion.t Capnp_util.capnp_arr)
       (includes : R.Include.t list) : Sig.header_type list =
+    let inclusion_includes =
+      Array.init (Capnp_util.arr_length inclusions) @@ fun i ->
+      lazy (Capnp_util.arr_get inclusions i |> R.Inclusion.includes_get_list)
+    in
+    (* The parser of ghost includes takes the active headers as a list, the set is used to look them up. *)
     let active_headers = ref [] in
+    let active_header_set = Hashtbl.create 16 in
     let test_include_cycle l path =
-      if List.mem path !active_headers then
+      if Hashtbl.mem active_header_set path then
         raise
           (Lexer.ParseException
              (l, "Include cycles (even with header guards) are not supported"))
     in
-    let add_active_header path = active_headers := path :: !active_headers in
-    let remove_active_header path =
-      active_headers := List.filter (fun h -> h <> path) !active_headers
+    let add_active_header path =
+      active_headers := path :: !active_headers;
+      Hashtbl.replace active_header_set path ()
     in
-    let transl_decls fd =
-      List.assoc fd decls_map
-      |> Capnp_util.arr_map Decl_translator.translate
-      |> List.flatten
+    let remove_active_header path =
+      (active_headers :=
+         match !active_headers with
+         | h :: tl when h = path -> tl
+         | headers -> List.filter (fun h -> h <> path) headers);
+      Hashtbl.remove active_header_set path
     in
     let open R.Include in
     let rec transl_includes_rec path incls header_names all_includes_done_paths
@@ -116,6 +309,18 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
               (List.append headers other_headers, other_header_names)
           | GhostInclude incl ->
               let ann = Node_translator.map_annotation incl in
+              let rec ghost_siblings incls () =
+                match incls with
+                | h :: tl -> (
+                    match get h with
+                    | GhostInclude incl ->
+                        Seq.Cons
+                          (Node_translator.map_annotation incl, ghost_siblings tl)
+                    | RealInclude _ -> Seq.Nil)
+                | [] -> Seq.Nil
+              in
+              AP.prefetch_include_directives path ann (ghost_siblings tl)
+                active_headers all_includes_done_paths;
               let included_files_ref = ref all_includes_done_paths in
               let ghost_headers, ghost_header_names =
                 AP.parse_include_directives path ann active_headers
@@ -141,21 +346,108 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
           if is_angled_get incl then Lexer.AngleBracketInclude
           else Lexer.DoubleQuoteInclude
         in
-        let includes = includes_get_list incl in
+        let includes =
+          Lazy.force inclusion_includes.(inclusion_get incl |> Uint32.to_int)
+        in
         let () = add_active_header path in
         let headers, header_names =
           transl_includes_rec path includes [] (path :: all_includes_done_paths)
         in
         let () = remove_active_header path in
-        let decls = transl_decls fd in
+        let decls = transl_header path fd in
         let ps = [ Ast.PackageDecl (Ast.dummy_loc, "", [], decls) ] in
         ( List.append headers
             [ (loc, (incl_kind, file_name, path), header_names, ps) ],
           path )
     in
-    let headers, _ = transl_includes_rec Args.path includes [] [] in
+    let headers, _ =
+      Util.do_finally
+        (fun () -> transl_includes_rec Args.path includes [] [])
+        AP.cancel_prefetched_include_directives
+    in
     headers
 
+  (*
+     Options the translation of a header depends on, which key its entry in [Header_cache], or [None]
+     if translations are not shared. A focus empties the bodies of functions in headers as well, and a
+     replayed export need not match the headers on disk.
+  *)
+  let header_cache_options =
+    match (Args.focus, Sys.getenv_opt "VF_CXX_EXPORT_REPLAY") with
+    | None, None ->
+        Some
+          (String.concat "\000"
+             ([
+                (match Args.data_model_opt with
+                | Some { Ast.int_width; long_width; ptr_width } ->
+                    Printf.sprintf "%d,%d,%d" int_width long_width ptr_width
+                | None -> "");
+                string_of_bool Args.enforce_annotations;
+              ]
+             @ Args.include_paths @ ("" :: Args.define_macros)))
+    | _ -> None
+
+  (* Digests of the headers of the current translation unit, by path, see [header_digest]. *)
+  let header_digests : (string, Digest.t option) Hashtbl.t = Hashtbl.create 16
+
+  (**
+    [header_digest tu path] returns a digest of the contents of header [path] of [tu], of the macros of
+    the context of its inclusion that it used and of the headers it includes, or [None] if one of those
+    files cannot be read or is part of an include cycle. The exporter records the macros that a header used
+    while their definitions are outside of its inclusion, which only allowed macros and trusted headers may
+    do, so two translation units share a header only if it preprocesses to the same code in both. Names of
+    types and declarations of the context are kept as names by the translation and resolved when the
+    translation unit is checked.
+    The digests of [tu] are computed by the first call after [transl_files].
+  *)
+  let header_digest (tu : R.TU.t) (path : string) : Digest.t option =
+    let open R.Include in
+    let inclusions = R.TU.inclusions_get tu in
+    let rec digest_includes includes =
+      includes
+      |> List.filter_map @@ fun incl ->
+         match get incl with
+         | RealInclude incl ->
+             let open RealInclude in
+             Some
+               (digest_header
+                  (Util.abs_path (file_name_get incl))
+                  (inclusion_get incl |> Uint32.to_int))
+         | GhostInclude _ -> None
+    and digest_header path inclusion =
+      match Hashtbl.find_opt header_digests path with
+      | Some digest -> digest
+      | None ->
+          (* A header that is reached again while its digest is computed is part of a cycle. *)
+          Hashtbl.replace header_digests path None;
+          let inclusion = Capnp_util.arr_get inclusions inclusion in
+          let included = R.Inclusion.includes_get_list inclusion |> digest_includes in
+          let digest =
+            if List.mem None included then None
+            else
+              try
+                Some
+                  (Digest.string
+                     (String.concat ""
+                        (Digest.file path :: R.Inclusion.context_get inclusion
+                        :: List.filter_map Fun.id included)))
+              with Sys_error _ -> None
+          in
+          Hashtbl.replace header_digests path digest;
+          digest
+    in
+    if Hashtbl.length header_digests = 0 then
+      ignore (digest_includes (R.TU.includes_get_list tu));
+    Hashtbl.find_opt header_digests path |> Option.join
+
+  (**
+    [cached_header tu path] returns the entry of header [path] of [tu] in [Header_cache], if any.
+  *)
+  let cached_header (tu : R.TU.t) (path : string) : Header_cache.entry option =
+    match (header_cache_options, header_digest tu path) with
+    | Some options, Some digest -> Header_cache.find ~options path digest
+    | _ -> None
+
   (**
     [update_file_mapping file] updates the mapping from [file]'s file descriptor to its name and returns the mapping.
   *)
@@ -164,36 +456,387 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
     let fd = fd_get file in
     let name = path_get file in
     Hashtbl.replace files_table fd name;
+    if fd >= 0 && fd < max_indexed_fd then (
+      if fd >= Array.length !fd_paths then (
+        let paths = Array.make (max (fd + 1) (2 * Array.length !fd_paths)) None in
+        Array.blit !fd_paths 0 paths 0 (Array.length !fd_paths);
+        fd_paths := paths);
+      !fd_paths.(fd) <- Some name);
     (fd, name)
 
+  (**
+    [transl_files files] updates the file mapping with [files] and returns the declarations of every file,
+    keyed by its file descriptor.
+  *)
   let transl_files (files : R.File.t Capnp_util.capnp_arr) :
-      (int * R.Node.t Capnp_util.capnp_arr) list =
+      (int, R.Node.t Capnp_util.capnp_arr) Hashtbl.t =
     Hashtbl.clear files_table;
-    let transl_file file =
-      let open R.File in
-      let fd, _ = update_file_mapping file in
-      let decls = decls_get file in
-      (fd, decls)
-    in
-    files |> Capnp_util.arr_map transl_file
+    Array.fill !fd_paths 0 (Array.length !fd_paths) None;
+    Hashtbl.reset header_digests;
+    Source_text.clear ();
+    let decls_table = Hashtbl.create (Capnp_util.arr_length files) in
+    files
+    |> Capnp_util.arr_iter (fun file ->
+           let fd, _ = update_file_mapping file in
+           Hashtbl.replace decls_table fd (R.File.decls_get file));
+    decls_table
 
-  let transl_tu (tu : R.TU.t) : Sig.header_type list * Ast.decl list =
+  (**
+    [transl_tu_decls tu transl_decls] translates [tu], whose file mapping must already be known.
+    [transl_decls fd] has to translate the declarations of file [fd] and tell whether they can be shared
+    with other translation units, see [Decl_translator.depends_on_includer]. It is called at most once per
+    file: a header that is reached through several parents reuses its first translation. It is not
+    called for a header whose translation is found in [Header_cache], and the translations of headers
+    that can be shared are added to it.
+  *)
+  let transl_tu_decls (tu : R.TU.t)
+      (transl_decls : int -> Ast.decl list * bool) :
+      Sig.header_type list * Ast.decl list =
     let open R.TU in
-    let decls_table = files_get tu |> transl_files in
-    let includes = includes_get_list tu |> transl_includes decls_table in
-    let main_fd = main_fd_get tu in
-    let main_decls =
-      List.assoc main_fd decls_table
-      |> Capnp_util.arr_map Decl_translator.translate
-      |> List.flatten
+    let translated = Hashtbl.create 16 in
+    let transl_decls fd =
+      match Hashtbl.find_opt translated fd with
+      | Some result -> result
+      | None ->
+          let result = transl_decls fd in
+          Hashtbl.replace translated fd result;
+          result
+    in
+    let transl_header path fd =
+      match (Hashtbl.find_opt translated fd, cached_header tu path) with
+      | Some (decls, _), _ -> decls
+      | None, Some { decls; reports; _ } ->
+          List.iter report reports;
+          decls
+      | None, None -> (
+          let reports = ref [] in
+          let (decls, shareable), reports =
+            Util.do_finally
+              (fun () ->
+                header_reports := Some reports;
+                let result = transl_decls fd in
+                (result, List.rev !reports))
+              (fun () -> header_reports := None)
+          in
+          match (header_cache_options, header_digest tu path) with
+          | Some options, Some digest when shareable ->
+              Header_cache.add ~options path { digest; decls; reports };
+              decls
+          | _ -> decls)
     in
+    let includes =
+      includes_get_list tu |> transl_includes transl_header (inclusions_get tu)
+    in
+    let main_decls, _ = transl_decls (main_fd_get tu) in
     let () =
       fail_directives_get tu
       |> Capnp_util.arr_map Node_translator.map_annotation
-      |> List.iter @@ fun (l, s) -> Args.report_should_fail s l
+      |> List.iter @@ fun (l, s, _) -> report (Header_cache.Should_fail (s, l))
     in
     (includes, main_decls)
 
+  let transl_tu (tu : R.TU.t) : Sig.header_type list * Ast.decl list =
+    let decls_table = R.TU.files_get tu |> transl_files in
+    Node_translator.with_location_table (R.TU.locs_get tu) @@ fun () ->
+    Node_translator.with_name_table (R.TU.names_get tu) @@ fun () ->
+    Node_translator.with_type_table (R.TU.types_get tu) @@ fun () ->
+    transl_tu_decls tu @@ fun fd ->
+    let decls = Hashtbl.find decls_table fd in
+    ( Capnp_util.arr_concat_map Decl_translator.translate decls,
+      not (Decl_translator.depends_on_includer decls) )
+
+  let transl_errors (errors : R.Error.t Capnp_util.capnp_arr) =
+    let error = Capnp.Array.get errors 0 in
+    let open R.Error in
+    let error_loc = loc_get error |> Node_translator.translate_loc in
+    Error.error error_loc (reason_get error)
+
+  let transl_file_decls (file_decls : R.FileDecls.t) : Ast.decl list =
+    let open R.FileDecls in
+    Node_translator.with_location_table (locs_get file_decls) @@ fun () ->
+    Node_translator.with_name_table (names_get file_decls) @@ fun () ->
+    Node_translator.with_type_table (types_get file_decls) @@ fun () ->
+    Capnp_util.arr_concat_map Decl_translator.translate (decls_get file_decls)
+
+  (**
+    [transl_file_decls_list file_decls] translates the messages [file_decls] holding the declarations of a
+    file, and tells whether they can be shared with other translation units.
+  *)
+  let transl_file_decls_list (file_decls : R.FileDecls.t list) :
+      Ast.decl list * bool =
+    ( List.concat_map transl_file_decls file_decls,
+      not
+        (List.exists
+           (fun decls ->
+             R.FileDecls.decls_get decls |> Decl_translator.depends_on_includer)
+           file_decls) )
+
+  (**
+    [transl_stream next_message] translates the translation unit transmitted by the messages of the
+    streaming protocol, which are obtained by calling [next_message].
+    The declarations of every file are collected while they are received and only translated once
+    the end message has been received, in the same order as for a single {i SerResult} message.
+  *)
+  let transl_stream (next_message : unit -> R.StreamMessage.unnamed_union_t) :
+      Sig.header_type list * Ast.decl list =
+    let open R.StreamMessage in
+    match next_message () with
+    | Header result ->
+        let tu = R.SerResult.tu_get result in
+        let _ = R.TU.files_get tu |> transl_files in
+        let decls_table = Hashtbl.create 8 in
+        let rec receive_decls () =
+          match next_message () with
+          | Decls file_decls ->
+              let open R.FileDecls in
+              let fd = fd_get file_decls in
+              let received =
+                Hashtbl.find_opt decls_table fd |> Option.value ~default:[]
+              in
+              Hashtbl.replace decls_table fd (file_decls :: received);
+              receive_decls ()
+          | End errors -> errors
+          | _ ->
+              Error.error Ast.dummy_loc
+                "Unexpected message received from the Cxx AST exporter."
+        in
+        let errors = receive_decls () in
+        if Capnp.Array.length errors > 0 then transl_errors errors
+        else
+          Node_translator.with_location_table (R.TU.locs_get tu) @@ fun () ->
+          Node_translator.with_name_table (R.TU.names_get tu) @@ fun () ->
+          Node_translator.with_type_table (R.TU.types_get tu) @@ fun () ->
+          transl_tu_decls tu @@ fun fd ->
+          Hashtbl.find_opt decls_table fd
+          |> Option.value ~default:[] |> List.rev |> transl_file_decls_list
+    | _ -> Error.error Ast.dummy_loc "No translatotion unit received."
+
+  (**
+    [predicted_fds tu] returns the files whose declarations [transl_tu_decls] translates, in the order
+    it translates them: the files of real includes after the files they include, as [transl_includes]
+    visits them, and the main file last. Every file is predicted once, as its translation is reused,
+    and headers whose translation is found in [Header_cache] are not predicted.
+    Ghost includes are skipped, so a real include that is only skipped because of a ghost include is
+    predicted anyway.
+  *)
+  let predicted_fds (tu : R.TU.t) : int list =
+    let open R.Include in
+    let inclusions = R.TU.inclusions_get tu in
+    let predicted = Hashtbl.create 16 in
+    let rec visit done_paths incls acc =
+      match incls with
+      | [] -> acc
+      | h :: tl -> (
+          match get h with
+          | RealInclude incl ->
+              let open RealInclude in
+              let path = Util.abs_path (file_name_get incl) in
+              let acc =
+                if List.mem path done_paths then acc
+                else
+                  let includes =
+                    Capnp_util.arr_get inclusions
+                      (inclusion_get incl |> Uint32.to_int)
+                    |> R.Inclusion.includes_get_list
+                  in
+                  let acc = visit (path :: done_paths) includes acc in
+                  let fd = fd_get incl in
+                  if Hashtbl.mem predicted fd || Option.is_some (cached_header tu path)
+                  then acc
+                  else (
+                    Hashtbl.replace predicted fd ();
+                    fd :: acc)
+              in
+              visit (path :: done_paths) tl acc
+          | GhostInclude _ -> visit done_paths tl acc)
+    in
+    List.rev (R.TU.main_fd_get tu :: visit [] (R.TU.includes_get_list tu) [])
+
+  (* Number of files whose declarations are requested ahead of their translation. *)
+  let prefetch_window = 4
+
+  (**
+    [translation_file_digests headers] returns digests of the files the translation of the current translation
+    unit, with headers [headers], read itself, see [Tu_cache]: the files of its annotation slices and its
+    ghost headers, i.e. the headers that were not exported. Returns [None] if one of them cannot be read.
+  *)
+  let translation_file_digests (headers : Sig.header_type list) :
+      (string * Digest.t) list option =
+    let exported = Hashtbl.create 16 in
+    files_table |> Hashtbl.iter (fun _ path -> Hashtbl.replace exported (Util.abs_path path) ());
+    try
+      Some
+        (Source_text.digests ()
+        @ (headers
+          |> List.filter_map @@ fun (_, (_, _, path), _, _) ->
+             if Hashtbl.mem exported path then None else Some (path, Digest.file path)))
+    with Sys_error _ -> None
+
+  (**
+    [transl_on_demand ?cache next_message request_decls] translates the translation unit transmitted by the
+    messages of the on-demand protocol, which are obtained by calling [next_message].
+    The header is followed by an end message with the errors reported so far. The declarations of a
+    file are requested by calling [request_decls fd]. The exporter answers with their messages,
+    followed by an end message with the errors reported meanwhile.
+    Up to [prefetch_window] files are requested before they are translated, in the order given by
+    [predicted_fds], so the exporter serializes the next files while the current one is translated.
+    The errors of an answer are only reported once its file is translated. A file that is translated
+    but was not predicted is requested at that point.
+    [next_message] also returns a function that releases the storage of the message, and one that returns
+    a digest of it. The messages of an answer are released as soon as its file is translated, and the
+    header once the translation unit is, so a large translation unit is not held in memory next to its
+    translation.
+    If [cache] gives the source file and options of an entry in [Tu_cache], the files of that entry are
+    requested first, in the same order. If the messages received so far have the digest of the entry, its
+    translation is reused; otherwise the translation unit is translated with the answers received so far
+    and replaces the entry.
+  *)
+  let transl_on_demand ?(cache : (string * string) option)
+      (next_message :
+        unit -> R.StreamMessage.unnamed_union_t * (unit -> unit) * (unit -> Digest.t))
+      (request_decls : int -> unit) : Sig.header_type list * Ast.decl list =
+    let open R.StreamMessage in
+    (* Digests of the messages received so far, most recent first, if the translation is cached. *)
+    let received = ref [] in
+    let next_message () =
+      let message, release, digest = next_message () in
+      if cache <> None then received := digest () :: !received;
+      (message, release)
+    in
+    let messages_digest () = Digest.string (String.concat "" (List.rev !received)) in
+    let rec receive_decls received releases =
+      match next_message () with
+      | Decls file_decls, release ->
+          receive_decls (file_decls :: received) (release :: releases)
+      | End errors, release -> (List.rev received, errors, release :: releases)
+      | _ ->
+          Error.error Ast.dummy_loc
+            "Unexpected message received from the Cxx AST exporter."
+    in
+    let release_all releases = List.iter (fun release -> release ()) releases in
+    match next_message () with
+    | Header result, release_header ->
+        let tu = R.SerResult.tu_get result in
+        let _ = R.TU.files_get tu |> transl_files in
+        let _, errors, releases = receive_decls [] [] in
+        if Capnp.Array.length errors > 0 then transl_errors errors
+        else
+          let () = release_all releases in
+          (* Files requested but not answered yet, in the order of their requests. *)
+          let outstanding = Queue.create () in
+          (* Answers that have been received but not translated yet. *)
+          let answers = Hashtbl.create 16 in
+          (* Files requested so far, most recent first. *)
+          let requests = ref [] in
+          let request fd =
+            request_decls fd;
+            Queue.push fd outstanding;
+            requests := fd :: !requests
+          in
+          let receive () =
+            let fd = Queue.pop outstanding in
+            let answer = receive_decls [] [] in
+            match Hashtbl.find_opt answers fd with
+            | Some queue -> Queue.push answer queue
+            | None ->
+                let queue = Queue.create () in
+                Queue.push answer queue;
+                Hashtbl.replace answers fd queue
+          in
+          let release_answers () =
+            answers |> Hashtbl.iter (fun _ queue -> queue |> Queue.iter (fun (_, _, releases) -> release_all releases))
+          in
+          let cached =
+            match Option.bind cache (fun (path, options) -> Tu_cache.find path options) with
+            | Some entry ->
+                let rec replay fds =
+                  match fds with
+                  | fd :: rest when Queue.length outstanding < prefetch_window ->
+                      request fd;
+                      replay rest
+                  | [] when Queue.is_empty outstanding -> ()
+                  | _ ->
+                      receive ();
+                      replay fds
+                in
+                replay entry.Tu_cache.requests;
+                if Digest.equal (messages_digest ()) entry.Tu_cache.digest then Some entry
+                else None
+            | None -> None
+          in
+          (match cached with
+          | Some entry ->
+              List.iter report entry.Tu_cache.reports;
+              release_answers ();
+              release_header ();
+              (entry.Tu_cache.headers, entry.Tu_cache.decls)
+          | None ->
+              let predicted =
+                ref (predicted_fds tu |> List.filter (fun fd -> not (Hashtbl.mem answers fd)))
+              in
+              let rec prefetch () =
+                match !predicted with
+                | fd :: rest when Queue.length outstanding < prefetch_window ->
+                    predicted := rest;
+                    request fd;
+                    prefetch ()
+                | _ -> ()
+              in
+              let rec take fd =
+                match Hashtbl.find_opt answers fd with
+                | Some queue when not (Queue.is_empty queue) -> Queue.pop queue
+                | _ ->
+                    let requested =
+                      Queue.fold (fun found fd' -> found || fd' = fd) false outstanding
+                    in
+                    if not requested then request fd;
+                    receive ();
+                    take fd
+              in
+              let reports = ref [] in
+              let result =
+                Util.do_finally
+                  (fun () ->
+                    if cache <> None then tu_reports := Some reports;
+                    Node_translator.with_location_table (R.TU.locs_get tu) @@ fun () ->
+                    Node_translator.with_name_table (R.TU.names_get tu) @@ fun () ->
+                    Node_translator.with_type_table (R.TU.types_get tu) @@ fun () ->
+                    transl_tu_decls tu @@ fun fd ->
+                    prefetch ();
+                    let decls, errors, releases = take fd in
+                    prefetch ();
+                    if Capnp.Array.length errors > 0 then transl_errors errors
+                    else
+                      let result = transl_file_decls_list decls in
+                      release_all releases;
+                      result)
+                  (fun () -> tu_reports := None)
+              in
+              (* Answers to mispredicted requests are still read, so the exporter does not block on them. *)
+              while not (Queue.is_empty outstanding) do
+                receive ()
+              done;
+              release_answers ();
+              release_header ();
+              (match cache with
+              | Some (path, options) -> (
+                  let headers, decls = result in
+                  match translation_file_digests headers with
+                  | Some file_digests ->
+                      Tu_cache.add path options
+                        {
+                          Tu_cache.requests = List.rev !requests;
+                          digest = messages_digest ();
+                          file_digests;
+                          headers;
+                          decls;
+                          reports = List.rev !reports;
+                        }
+                  | None -> ())
+              | None -> ());
+              result)
+    | _ -> Error.error Ast.dummy_loc "No translatotion unit received."
+
   let transl_ser_result result =
     let open R.SerResult in
     if not @@ has_tu result then
@@ -208,13 +851,25 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
         let errors = errors_get result in
         match Capnp.Array.length errors with
         | 0 -> Error.error Ast.dummy_loc "Expected non-empty list of errors."
-        | _ ->
-            let error = Capnp.Array.get errors 0 in
-            let open R.Error in
-            let error_loc = loc_get error |> Node_translator.translate_loc in
-            Error.error error_loc (reason_get error)
+        | _ -> transl_errors errors
       else transl_tu tu
 
+  (* Digest of the segments of [msg]. *)
+  let message_digest (msg : Capnp.Message.ro Capnp.BytesMessage.Message.t) : Digest.t =
+    Capnp.BytesMessage.Message.to_storage msg
+    |> List.map (fun { Capnp.BytesMessage.Message.segment; bytes_consumed } ->
+           Digest.subbytes segment 0 bytes_consumed)
+    |> String.concat "" |> Digest.string
+
+  (*
+     Source file and options of the entry of the translation unit in [Tu_cache], or [None] if the translation is
+     not cached. It depends on the same options as the translations of headers.
+  *)
+  let tu_cache_key () : (string * string) option =
+    match header_cache_options with
+    | Some options when Tu_cache.active () -> Some (Args.path, options)
+    | _ -> None
+
   let parse_cxx_file () : Sig.header_type list * Ast.package list =
     (* TODO: pass macros that are whitelisted *)
     let type_macros pref =
@@ -222,27 +877,78 @@ module Make (Args : Sig.CXX_TRANSLATOR_ARGS) : Sig.Cxx_Ast_Translator = struct
       |> List.map @@ fun n -> Printf.sprintf "__%s%u_TYPE__" pref n
     in
     let enable_types = type_macros "INT" @ type_macros "UINT" in
-    let inchan, outchan, errchan = invoke_exporter Args.path enable_types in
+    (*
+       VF_CXX_EXPORT_SHM=<MiB>   Receive the messages through a shared memory ring buffer of <MiB> MiB
+    *)
+    let shm = Option.map Shm_transport.create (Shm_transport.size_opt ()) in
+    let inchan, outchan, errchan =
+      try
+        invoke_exporter
+          ?shm:(Option.map (fun (t : Shm_transport.t) -> t.name) shm)
+          Args.path enable_types
+      with e ->
+        Option.iter Shm_transport.close shm;
+        raise e
+    in
     let close_channels () =
-      let _ = Unix.close_process_full (inchan, outchan, errchan) in
-      ()
+      let children_time () =
+        let times = Unix.times () in
+        times.Unix.tms_cutime +. times.Unix.tms_cstime
+      in
+      let time0 = children_time () in
+      Exporter_daemon.close (inchan, outchan, errchan);
+      Option.iter Shm_transport.close shm;
+      Stats.cxx_exporter_time :=
+        !Stats.cxx_exporter_time +. (children_time () -. time0)
     in
     let on_error () =
-      match Util.input_fully errchan with
+      match Exporter_daemon.error_output (inchan, outchan, errchan) with
       | "" ->
           Error.error Ast.dummy_loc
             "the Cxx frontend was unable to deserialize the received message."
       | s -> Error.error Ast.dummy_loc @@ "Cxx AST exporter error:\n" ^ s
     in
-    let in_channel = stubs_ast_in_channel inchan in
-    Util.do_finally
-      (fun () ->
-        match read_capnp_message in_channel with
-        | None -> on_error ()
-        | Some res ->
-            let headers, decls =
-              R.SerResult.of_message res |> transl_ser_result
-            in
-            (headers, [ Ast.PackageDecl (Ast.dummy_loc, "", [], decls) ]))
-      (fun () -> close_channels ())
+    let read_context = stubs_ast_in_channel ~compression:`Packing inchan in
+    let next_message () =
+      let msg =
+        Util.do_finally
+          (fun () ->
+            Stopwatch.start Stats.cxx_read_stopwatch;
+            match shm with
+            | Some t -> Shm_transport.read_message t inchan
+            | None -> read_capnp_message read_context)
+          (fun () -> Stopwatch.stop Stats.cxx_read_stopwatch)
+      in
+      match msg with
+      | None -> on_error ()
+      | Some msg ->
+          ( R.StreamMessage.of_message msg |> R.StreamMessage.get,
+            (fun () -> Capnp.BytesMessage.Message.release msg),
+            fun () -> message_digest msg )
+    in
+    (* A request is a 32-bit little-endian length followed by the decimal
+       identifier of the file. *)
+    let request_decls fd =
+      let payload = string_of_int fd in
+      let header = Bytes.create 4 in
+      Bytes.set_int32_le header 0 (Int32.of_int (String.length payload));
+      output_bytes outchan header;
+      output_string outchan payload;
+      flush outchan
+    in
+    Stopwatch.start Stats.cxx_frontend_stopwatch;
+    let result =
+      Util.do_finally
+        (fun () ->
+          let headers, decls =
+            transl_on_demand ?cache:(tu_cache_key ()) next_message request_decls
+          in
+          (headers, [ Ast.PackageDecl (Ast.dummy_loc, "", [], decls) ]))
+        (fun () ->
+          close_channels ();
+          Stopwatch.stop Stats.cxx_frontend_stopwatch)
+    in
+    (* The next translation unit is exported while this one is verified. *)
+    prefetch_exporter enable_types;
+    result
 end
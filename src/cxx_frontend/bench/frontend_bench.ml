@@ -0,0 +1,154 @@
+(*
+  Benchmark of the two frontends that can parse C programs: the native parser of [Parser.parse_c_file]
+  and the Clang path of the C++ frontend, which runs the exporter with -xc and translates its output.
+  For every file it reports, for both frontends, the median time to parse and translate the file and the
+  peak resident set size, and the ratio of the times. For the Clang path, the peak of the exporter is
+  reported next to the one of the translator; as they run concurrently, their sum bounds the peak of the
+  path.
+  Every measurement runs in a fresh process started from this executable, without the [VF_CXX_*]
+  variables, so no cache of either frontend carries over from an earlier measurement. As both frontends
+  look for headers and the exporter next to the executable, it has to run from the [bin] folder.
+*)
+open Cxx_frontend
+
+external max_rss : unit -> int * int = "caml_frontend_bench_max_rss"
+
+let repetitions = ref 3
+let max_ratio = ref None
+let measure = ref None
+let files = ref []
+
+let parse_native path =
+  ignore
+    (Parser.parse_c_file
+       (fun _ _ -> ())
+       path
+       (fun _ _ -> ())
+       (fun _ _ -> ())
+       0 [] [] false None)
+
+let parse_clang path =
+  let module Translator = Ast_translator.Make (struct
+    let data_model_opt = None
+    let enforce_annotations = false
+    let report_should_fail _ _ = ()
+    let report_range _ _ = ()
+    let dialect_opt = None
+    let report_macro_call _ _ = ()
+    let path = path
+    let verbose = 0
+    let include_paths = []
+    let define_macros = []
+    let focus = None
+  end) in
+  ignore (Translator.parse_cxx_file ())
+
+(**
+  [run_measurement frontend path] parses [path] with [frontend] in this process, and prints the time it
+  took in seconds and the peak resident set sizes in kilobytes of this process and of the exporter, or the
+  reason it failed.
+*)
+let run_measurement frontend path =
+  let parse = match frontend with "native" -> parse_native | _ -> parse_clang in
+  match
+    let time0 = Unix.gettimeofday () in
+    parse path;
+    Unix.gettimeofday () -. time0
+  with
+  | time ->
+      let self_kb, children_kb = max_rss () in
+      Printf.printf "ok %f %d %d\n" time self_kb children_kb
+  | exception e ->
+      Printf.printf "failed %s\n" (String.map (function '\n' -> ' ' | c -> c) (Printexc.to_string e))
+
+type measurement = { time : float; self_kb : int; exporter_kb : int }
+
+let environment =
+  lazy
+    (Unix.environment ()
+    |> Array.to_list
+    |> List.filter (fun var -> not (String.starts_with ~prefix:"VF_CXX_" var))
+    |> Array.of_list)
+
+(**
+  [measure_once frontend path] runs one measurement of [frontend] on [path] in a new process, see
+  [run_measurement].
+*)
+let measure_once frontend path : (measurement, string) result =
+  let args = [| Sys.executable_name; "-measure"; frontend; path |] in
+  let output, child_output = Unix.pipe ~cloexec:true () in
+  let pid =
+    Unix.create_process_env Sys.executable_name args (Lazy.force environment) Unix.stdin child_output
+      Unix.stderr
+  in
+  Unix.close child_output;
+  let channel = Unix.in_channel_of_descr output in
+  let line = try input_line channel with End_of_file -> "failed no output" in
+  close_in channel;
+  ignore (Unix.waitpid [] pid);
+  match String.split_on_char ' ' line with
+  | [ "ok"; time; self_kb; exporter_kb ] ->
+      Ok { time = float_of_string time; self_kb = int_of_string self_kb; exporter_kb = int_of_string exporter_kb }
+  | "failed" :: reason -> Error (String.concat " " reason)
+  | _ -> Error line
+
+let median times =
+  let times = List.sort compare times |> Array.of_list in
+  let n = Array.length times in
+  if n mod 2 = 1 then times.(n / 2) else (times.(n / 2 - 1) +. times.(n / 2)) /. 2.0
+
+(**
+  [measure frontend path] returns the median time of [!repetitions] measurements of [frontend] on
+  [path] and the largest peaks they had, or the reason the first failed measurement failed.
+*)
+let measure frontend path : (measurement, string) result =
+  let rec loop n results =
+    if n = 0 then
+      Ok
+        {
+          time = median (List.map (fun m -> m.time) results);
+          self_kb = List.fold_left (fun kb m -> max kb m.self_kb) 0 results;
+          exporter_kb = List.fold_left (fun kb m -> max kb m.exporter_kb) 0 results;
+        }
+    else
+      match measure_once frontend path with
+      | Ok m -> loop (n - 1) (m :: results)
+      | Error reason -> Error reason
+  in
+  loop !repetitions []
+
+let mb kb = float_of_int kb /. 1024.0
+
+let () =
+  Arg.parse
+    [
+      ("-repetitions", Int (fun n -> repetitions := max 1 n), "<n> Number of runs per file and frontend, of which the median is reported (default 3)");
+      ("-max_ratio", Float (fun r -> max_ratio := Some r), "<r> Fail if the Clang path takes more than <r> times as long as the native parser over all files");
+      ("-measure", Tuple [ String (fun frontend -> measure := Some frontend); String (fun path -> files := [ path ]) ], "<native|clang> <file> Run one measurement in this process (used internally)");
+    ]
+    (fun path -> files := path :: !files)
+    "Usage: frontend_bench [-repetitions n] [-max_ratio r] file...\nCompares the native C parser with the Clang path of the C++ frontend; times are in milliseconds, memory in megabytes.";
+  match !measure with
+  | Some frontend -> run_measurement frontend (List.hd !files)
+  | None ->
+      Printf.printf "%10s %10s %10s %10s %10s %8s  %s\n" "native" "native MB" "clang" "clang MB" "exporter MB" "ratio" "file";
+      let native_total = ref 0.0 and clang_total = ref 0.0 in
+      List.rev !files |> List.iter begin fun path ->
+        match (measure "native" path, measure "clang" path) with
+        | Ok native, Ok clang ->
+            native_total := !native_total +. native.time;
+            clang_total := !clang_total +. clang.time;
+            Printf.printf "%10.3f %10.1f %10.3f %10.1f %10.1f %8.2f  %s\n%!"
+              (native.time *. 1000.0) (mb native.self_kb) (clang.time *. 1000.0) (mb clang.self_kb)
+              (mb clang.exporter_kb) (clang.time /. native.time) path
+        | Error reason, _ -> Printf.printf "%s: native parser failed: %s\n%!" path reason
+        | _, Error reason -> Printf.printf "%s: Clang path failed: %s\n%!" path reason
+      end;
+      let ratio = !clang_total /. !native_total in
+      Printf.printf "%10.3f %10s %10.3f %10s %10s %8.2f  total of the files both frontends parsed\n"
+        (!native_total *. 1000.0) "" (!clang_total *. 1000.0) "" "" ratio;
+      match !max_ratio with
+      | Some max_ratio when not (ratio <= max_ratio) ->
+          Printf.printf "The Clang path takes %.2f times as long as the native parser, more than %.2f\n" ratio max_ratio;
+          exit 1
+      | _ -> ()
@@ -0,0 +1,41 @@
+#include <caml/mlvalues.h>
+#include <caml/alloc.h>
+#include <caml/memory.h>
+
+#ifndef _WIN32
+
+#include <sys/resource.h>
+
+/* Largest resident set size in kilobytes of [who], which Darwin reports in bytes. */
+static long max_rss_kb(int who) {
+    struct rusage usage;
+    if (getrusage(who, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+/* Returns the peak resident set sizes in kilobytes of this process and of its largest reaped child. */
+value caml_frontend_bench_max_rss(value unit) {
+    CAMLparam1(unit);
+    CAMLlocal1(result);
+    result = caml_alloc_tuple(2);
+    Store_field(result, 0, Val_long(max_rss_kb(RUSAGE_SELF)));
+    Store_field(result, 1, Val_long(max_rss_kb(RUSAGE_CHILDREN)));
+    CAMLreturn(result);
+}
+
+#else
+
+value caml_frontend_bench_max_rss(value unit) {
+    CAMLparam1(unit);
+    CAMLlocal1(result);
+    result = caml_alloc_tuple(2);
+    Store_field(result, 0, Val_long(0));
+    Store_field(result, 1, Val_long(0));
+    CAMLreturn(result);
+}
+
+#endif
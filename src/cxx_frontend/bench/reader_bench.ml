@@ -0,0 +1,99 @@
+(*
+  Benchmark of the reader side of the C++ frontend. It loads SerResult messages captured with the
+  exporter's -output option and times, for every file:
+  - read: framing the messages, which Cap'n Proto decodes lazily, from a mapping of the file with
+    Mapped_messages unless they are packed;
+  - arr_map: walking the declarations of every file with Capnp_util.arr_map, which materializes
+    each array as a list;
+  - arr_iter: the same walk with Capnp_util.arr_iter, without materialization;
+  - transl_tu: translating the translation units.
+  Capturing the same sources with different exporter options (e.g. -location_table,
+  -name_table or -packed) compares the reader cost of the schema variants.
+*)
+open Cxx_frontend
+
+module R = Reader.R
+
+module Translator = Ast_translator.Make (struct
+  let data_model_opt = None
+  let enforce_annotations = false
+  let report_should_fail _ _ = ()
+  let report_range _ _ = ()
+  let dialect_opt = Some Ast.Cxx
+  let report_macro_call _ _ = ()
+  let path = ""
+  let verbose = 0
+  let include_paths = []
+  let define_macros = []
+  let focus = None
+end)
+
+let repetitions = ref 5
+let packed = ref false
+let files = ref []
+
+let read_results path =
+  if not !packed then List.map R.SerResult.of_message (Mapped_messages.read_messages path)
+  else
+    let channel = open_in_bin path in
+    Fun.protect ~finally:(fun () -> close_in channel) @@ fun () ->
+    let read_context = Capnp_unix.IO.create_read_context_for_channel ~compression:`Packing channel in
+    let rec read results =
+      match Capnp_unix.IO.ReadContext.read_message read_context with
+      | Some message -> read (R.SerResult.of_message message :: results)
+      | None -> List.rev results
+    in
+    read []
+
+let walk_decls walk results =
+  let count = ref 0 in
+  results |> List.iter (fun result ->
+    R.SerResult.tu_get result |> R.TU.files_get |> walk (fun file ->
+      R.File.decls_get file |> walk (fun _ -> incr count)));
+  !count
+
+let arr_map_walk f arr = ignore (Capnp_util.arr_map f arr)
+let arr_iter_walk f arr = Capnp_util.arr_iter f arr
+
+let time f =
+  let time0 = Unix.gettimeofday () in
+  let result = f () in
+  (result, Unix.gettimeofday () -. time0)
+
+let median times =
+  let times = List.sort compare times |> Array.of_list in
+  let n = Array.length times in
+  if n mod 2 = 1 then times.(n / 2) else (times.(n / 2 - 1) +. times.(n / 2)) /. 2.0
+
+let bench path =
+  let phase_times = Hashtbl.create 4 in
+  let record phase t =
+    Hashtbl.replace phase_times phase (t :: Option.value ~default:[] (Hashtbl.find_opt phase_times phase))
+  in
+  let decls = ref 0 in
+  for _ = 1 to !repetitions do
+    let results, t = time (fun () -> read_results path) in
+    record "read" t;
+    let n, t = time (fun () -> walk_decls arr_map_walk results) in
+    record "arr_map" t;
+    decls := n;
+    let _, t = time (fun () -> walk_decls arr_iter_walk results) in
+    record "arr_iter" t;
+    let _, t = time (fun () -> results |> List.iter (fun result -> ignore (Translator.transl_ser_result result))) in
+    record "transl_tu" t
+  done;
+  let ms phase = median (Hashtbl.find phase_times phase) *. 1000.0 in
+  Printf.printf "%10.3f %10.3f %10.3f %10.3f %8d  %s\n"
+    (ms "read") (ms "arr_map") (ms "arr_iter") (ms "transl_tu") !decls path
+
+let () =
+  Arg.parse
+    [ "-repetitions", Set_int repetitions, "<n> Number of runs per file, of which the median is reported (default 5)";
+      "-packed", Set packed, " The files hold messages in the packed encoding" ]
+    (fun path -> files := path :: !files)
+    "Usage: reader_bench [-repetitions n] [-packed] file...\nTimes the translation of captured SerResult messages; times are in milliseconds.";
+  Printf.printf "%10s %10s %10s %10s %8s  %s\n" "read" "arr_map" "arr_iter" "transl_tu" "decls" "file";
+  List.rev !files |> List.iter begin fun path ->
+    try bench path with
+    | e -> Printf.printf "%s: %s\n" path (Printexc.to_string e)
+  end
@@ -0,0 +1,70 @@
+(*
+   Reading of bundles written by the exporter's -bundle option, see BundleIndex in the schema. A
+   bundle is mapped once, and only the messages that are used are copied out of the mapping. The
+   declarations of a file whose [bundleHeader] is set are held by the shared header at that index,
+   see [header], which is read once per bundle however many translation units refer to it.
+*)
+
+module R = Reader.R
+open Stdint
+
+type t = {
+  path : string;
+  data : Mapped_messages.bigstring;
+  index : R.BundleIndex.t;
+  headers : R.BundleHeader.t option array;  (** Shared headers read so far. *)
+}
+
+let message_at (path : string) (data : Mapped_messages.bigstring) ~(offset : int) ~(size : int) =
+  let truncated () = failwith ("Truncated bundle " ^ path) in
+  let pos = offset * 8 in
+  let limit = pos + (size * 8) in
+  if offset < 0 || limit > Bigarray.Array1.dim data then truncated ();
+  Mapped_messages.frame_message ~truncated
+    ~get_uint32:(Mapped_messages.get_uint32_le data)
+    ~segment:(Mapped_messages.bigstring_segment data) ~limit pos
+  |> fst
+
+let entry_message (t : t) (entry : R.BundleEntry.t) =
+  let open R.BundleEntry in
+  message_at t.path t.data
+    ~offset:(offset_get entry |> Uint64.to_int)
+    ~size:(size_get entry |> Uint64.to_int)
+
+(** [open_bundle path] maps the bundle at [path] and reads its index. *)
+let open_bundle (path : string) : t =
+  let data =
+    match Mapped_messages.map_file path with
+    | Some data when Bigarray.Array1.dim data >= 8 -> data
+    | _ -> failwith ("Truncated bundle " ^ path)
+  in
+  (* The bundle ends with the offset of its index in words. *)
+  let words = (Bigarray.Array1.dim data / 8) - 1 in
+  let offset =
+    Mapped_messages.get_uint32_le data (words * 8)
+    lor (Mapped_messages.get_uint32_le data ((words * 8) + 4) lsl 32)
+  in
+  let index =
+    message_at path data ~offset ~size:(words - offset) |> R.BundleIndex.of_message
+  in
+  let headers = Array.make (Capnp_util.arr_length (R.BundleIndex.headers_get index)) None in
+  { path; data; index; headers }
+
+(** [tus t] returns the results of the translation units of bundle [t], in output order. *)
+let tus (t : t) : R.SerResult.t list =
+  R.BundleIndex.tus_get_list t.index
+  |> List.map @@ fun entry -> entry_message t entry |> R.SerResult.of_message
+
+(**
+  [header t ref] returns the shared header that a file with [bundleHeader] [ref] refers to.
+*)
+let header (t : t) (ref : int) : R.BundleHeader.t =
+  match t.headers.(ref - 1) with
+  | Some header -> header
+  | None ->
+      let header =
+        Capnp_util.arr_get (R.BundleIndex.headers_get t.index) (ref - 1)
+        |> entry_message t |> R.BundleHeader.of_message
+      in
+      t.headers.(ref - 1) <- Some header;
+      header
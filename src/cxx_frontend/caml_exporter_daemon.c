@@ -0,0 +1,129 @@
+#include <string.h>
+#include <caml/mlvalues.h>
+#include <caml/alloc.h>
+#include <caml/fail.h>
+#include <caml/memory.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void close_pipes(int pipes[3][2]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (pipes[i][j] >= 0) close(pipes[i][j]);
+        }
+    }
+}
+
+/* Sends all [size] bytes of [buffer], the first of them with the file descriptors [fds] attached. */
+static int send_request(int sock, const char *buffer, size_t size, int fds[3]) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { (void *)buffer, size };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+    while ((size_t)n < size) {
+        ssize_t m = write(sock, buffer + n, size - n);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) return -1;
+        n += m;
+    }
+    return 0;
+}
+
+/*
+  Asks the exporter daemon listening on [path] to run the exporter with command line [args] in
+  directory [cwd]. Returns the ends of the pipes connected to the run's stdout, stdin and stderr,
+  in the order of [Unix.open_process_full].
+*/
+value caml_cxx_daemon_connect(value path, value cwd, value args) {
+    CAMLparam3(path, cwd, args);
+    CAMLlocal1(result);
+    char message[256];
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (caml_string_length(path) >= sizeof(address.sun_path))
+        caml_failwith("The path of the exporter daemon's socket is too long");
+    memcpy(address.sun_path, String_val(path), caml_string_length(path));
+
+    /* The payload: a 32-bit little-endian length, then the NUL-separated working directory and arguments. */
+    size_t size = 4 + caml_string_length(cwd);
+    mlsize_t nb_args = Wosize_val(args);
+    for (mlsize_t i = 0; i < nb_args; i++) size += 1 + caml_string_length(Field(args, i));
+    char *buffer = malloc(size);
+    if (buffer == NULL) caml_raise_out_of_memory();
+    uint32_t length = (uint32_t)(size - 4);
+    for (int i = 0; i < 4; i++) buffer[i] = (char)(length >> (8 * i));
+    size_t offset = 4;
+    memcpy(buffer + offset, String_val(cwd), caml_string_length(cwd));
+    offset += caml_string_length(cwd);
+    for (mlsize_t i = 0; i < nb_args; i++) {
+        buffer[offset++] = '\0';
+        memcpy(buffer + offset, String_val(Field(args, i)), caml_string_length(Field(args, i)));
+        offset += caml_string_length(Field(args, i));
+    }
+
+    /* stdin, stdout and stderr of the run; the run gets [pipes[0][0]], [pipes[1][1]] and [pipes[2][1]]. */
+    int pipes[3][2] = { { -1, -1 }, { -1, -1 }, { -1, -1 } };
+    int sock = -1;
+    for (int i = 0; i < 3; i++) {
+        if (pipe(pipes[i]) != 0) goto fail;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) goto fail;
+    if (connect(sock, (struct sockaddr *)&address, sizeof(address)) != 0) goto fail;
+    int fds[3] = { pipes[0][0], pipes[1][1], pipes[2][1] };
+    if (send_request(sock, buffer, size, fds) != 0) goto fail;
+    close(sock);
+    free(buffer);
+    close(pipes[0][0]);
+    close(pipes[1][1]);
+    close(pipes[2][1]);
+    /* Processes started later must not keep the run's pipes open. */
+    fcntl(pipes[0][1], F_SETFD, FD_CLOEXEC);
+    fcntl(pipes[1][0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipes[2][0], F_SETFD, FD_CLOEXEC);
+    result = caml_alloc_tuple(3);
+    Store_field(result, 0, Val_int(pipes[1][0]));
+    Store_field(result, 1, Val_int(pipes[0][1]));
+    Store_field(result, 2, Val_int(pipes[2][0]));
+    CAMLreturn(result);
+
+fail:
+    snprintf(message, sizeof(message), "Cannot connect to the exporter daemon at %s: %s", String_val(path), strerror(errno));
+    if (sock >= 0) close(sock);
+    close_pipes(pipes);
+    free(buffer);
+    caml_failwith(message);
+}
+
+#else
+
+value caml_cxx_daemon_connect(value path, value cwd, value args) {
+    caml_failwith("The exporter daemon is not available on Windows");
+}
+
+#endif
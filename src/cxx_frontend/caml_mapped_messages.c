@@ -0,0 +1,8 @@
+#include <string.h>
+#include <caml/mlvalues.h>
+#include <caml/bigarray.h>
+
+value caml_cxx_blit_bigstring_to_bytes(value src, value src_pos, value dst, value dst_pos, value len) {
+    memcpy(Bytes_val(dst) + Long_val(dst_pos), (char *)Caml_ba_data_val(src) + Long_val(src_pos), Long_val(len));
+    return Val_unit;
+}
@@ -0,0 +1,118 @@
+#include <string.h>
+#include <caml/mlvalues.h>
+#include <caml/alloc.h>
+#include <caml/bigarray.h>
+#include <caml/fail.h>
+#include <caml/memory.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Creates the shared memory object [name] of [size] bytes and maps it. */
+value caml_cxx_shm_create(value name, value size) {
+    CAMLparam2(name, size);
+    char message[256];
+    intnat len = Long_val(size);
+    int fd = shm_open(String_val(name), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        snprintf(message, sizeof(message), "Cannot create shared memory object %s: %s", String_val(name), strerror(errno));
+        caml_failwith(message);
+    }
+    if (ftruncate(fd, len) != 0) {
+        snprintf(message, sizeof(message), "Cannot resize shared memory object %s: %s", String_val(name), strerror(errno));
+        close(fd);
+        shm_unlink(String_val(name));
+        caml_failwith(message);
+    }
+    void *data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        snprintf(message, sizeof(message), "Cannot map shared memory object %s: %s", String_val(name), strerror(errno));
+        shm_unlink(String_val(name));
+        caml_failwith(message);
+    }
+    /* The size of the object, which follows the released bytes in the header. */
+    ((uint64_t *)data)[1] = (uint64_t)len;
+    CAMLreturn(caml_ba_alloc_dims(CAML_BA_CHAR | CAML_BA_C_LAYOUT | CAML_BA_EXTERNAL, 1, data, len));
+}
+
+value caml_cxx_shm_unlink(value name) {
+    shm_unlink(String_val(name));
+    return Val_unit;
+}
+
+/* Unmaps a region returned by [caml_cxx_shm_create], which becomes empty. */
+value caml_cxx_shm_unmap(value region) {
+    struct caml_ba_array *array = Caml_ba_array_val(region);
+    if (array->dim[0] > 0) {
+        munmap(array->data, array->dim[0]);
+        array->dim[0] = 0;
+    }
+    return Val_unit;
+}
+
+/* Publishes the number of bytes released by the reader, at the start of the region. */
+value caml_cxx_shm_store_released(value region, value released) {
+    __atomic_store_n((uint64_t *)Caml_ba_data_val(region), (uint64_t)Long_val(released), __ATOMIC_RELEASE);
+    return Val_unit;
+}
+
+#else
+
+#include <stdint.h>
+#include <stdio.h>
+#include <windows.h>
+
+/*
+  Creates the file mapping [name] of [size] bytes, backed by the paging file, and maps it. Its handle is
+  closed right away: the view keeps the mapping, and its name, alive until it is unmapped.
+*/
+value caml_cxx_shm_create(value name, value size) {
+    CAMLparam2(name, size);
+    char message[256];
+    intnat len = Long_val(size);
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        (DWORD)((uint64_t)len >> 32), (DWORD)((uint64_t)len & 0xffffffff),
+                                        String_val(name));
+    if (mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS) {
+        snprintf(message, sizeof(message), "Cannot create file mapping %s: error %lu", String_val(name), GetLastError());
+        if (mapping != NULL) CloseHandle(mapping);
+        caml_failwith(message);
+    }
+    void *data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, len);
+    CloseHandle(mapping);
+    if (data == NULL) {
+        snprintf(message, sizeof(message), "Cannot map file mapping %s: error %lu", String_val(name), GetLastError());
+        caml_failwith(message);
+    }
+    /* The exporter cannot query the size of a file mapping, so it reads it from the header. */
+    ((uint64_t *)data)[1] = (uint64_t)len;
+    CAMLreturn(caml_ba_alloc_dims(CAML_BA_CHAR | CAML_BA_C_LAYOUT | CAML_BA_EXTERNAL, 1, data, len));
+}
+
+/* A file mapping has no name to unlink; it disappears with its last view. */
+value caml_cxx_shm_unlink(value name) {
+    return Val_unit;
+}
+
+value caml_cxx_shm_unmap(value region) {
+    struct caml_ba_array *array = Caml_ba_array_val(region);
+    if (array->dim[0] > 0) {
+        UnmapViewOfFile(array->data);
+        array->dim[0] = 0;
+    }
+    return Val_unit;
+}
+
+value caml_cxx_shm_store_released(value region, value released) {
+    __atomic_store_n((uint64_t *)Caml_ba_data_val(region), (uint64_t)Long_val(released), __ATOMIC_RELEASE);
+    return Val_unit;
+}
+
+#endif
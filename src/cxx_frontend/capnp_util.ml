@@ -1,14 +1,82 @@
 type 'a capnp_arr = (Stubs_ast.ro, 'a, Reader.R.array_t) Capnp.Array.t
 
+(**
+  [arr_length arr] returns the number of elements of cap'n proto array [arr].
+*)
+let arr_length (arr: 'a capnp_arr): int = Capnp.Array.length arr
+
+(**
+  [arr_get arr i] returns element [i] of cap'n proto array [arr], without traversing the elements before it.
+*)
+let arr_get (arr: 'a capnp_arr) (i: int): 'a = Capnp.Array.get arr i
+
+(**
+  [arr_to_array arr] copies the elements of cap'n proto array [arr] into an OCaml array in one pass, so
+  repeated lookups by index do not go through the reader again.
+*)
+let arr_to_array (arr: 'a capnp_arr): 'a array =
+  Array.init (Capnp.Array.length arr) (fun i -> Capnp.Array.get arr i)
+
+(**
+  [arr_map_array f arr] applies [f] to every element of cap'n proto array [arr], in order, and returns the
+  results as an OCaml array, without building an intermediate list.
+*)
+let arr_map_array (f: 'a -> 'b) (arr: 'a capnp_arr): 'b array =
+  Array.init (Capnp.Array.length arr) (fun i -> f (Capnp.Array.get arr i))
+
 (**
   [capnp_arr_map f arr] applies [f] to every element of cap'n proto array [arr] and returns a new list containing those elements.
 *)
 let arr_map (f: 'a -> 'b) (arr: 'a capnp_arr): 'b list =
-  (* map array to list first, the map function of capnp traverses the array in reverse order *)
-  arr |> Capnp.Array.to_list |> List.map f
+  (* index the array directly, in order: the map function of capnp traverses the array in reverse order *)
+  let n = Capnp.Array.length arr in
+  let rec map_from i =
+    if i = n then []
+    else
+      let y = f (Capnp.Array.get arr i) in
+      y :: map_from (i + 1)
+  in
+  map_from 0
+
+(**
+  [arr_concat_map f arr] applies [f] to every element of cap'n proto array [arr] and concatenates the resulting lists,
+  without building the list of those lists.
+*)
+let arr_concat_map (f: 'a -> 'b list) (arr: 'a capnp_arr): 'b list =
+  let n = Capnp.Array.length arr in
+  let rec concat_map_from i =
+    if i = n then []
+    else
+      let ys = f (Capnp.Array.get arr i) in
+      ys @ concat_map_from (i + 1)
+  in
+  concat_map_from 0
+
+(**
+  [arr_filter_map f arr] applies [f] to every element of cap'n proto array [arr] and returns the list of the results
+  [Some y], without building the list of all results.
+*)
+let arr_filter_map (f: 'a -> 'b option) (arr: 'a capnp_arr): 'b list =
+  let n = Capnp.Array.length arr in
+  let rec filter_map_from i =
+    if i = n then []
+    else
+      match f (Capnp.Array.get arr i) with
+      | Some y -> y :: filter_map_from (i + 1)
+      | None -> filter_map_from (i + 1)
+  in
+  filter_map_from 0
+
+(**
+  [arr_exists p arr] checks whether some element of cap'n proto array [arr] satisfies [p], stopping at the first one.
+*)
+let arr_exists (p: 'a -> bool) (arr: 'a capnp_arr): bool =
+  let n = Capnp.Array.length arr in
+  let rec exists_from i = i < n && (p (Capnp.Array.get arr i) || exists_from (i + 1)) in
+  exists_from 0
 
 (**
   [capnp_arr_iter] applies [f] to every element of cap'n proto array [arr].
 *)
 let arr_iter (f: 'a -> 'b) (arr: 'a capnp_arr): unit =
-  arr |> Capnp.Array.iter ~f
\ No newline at end of file
+  arr |> Capnp.Array.iter ~f
@@ -3,6 +3,11 @@ module D = R.Decl
 
 module type Translator = sig
   val translate : R.Node.t -> Ast.decl list
+
+  val depends_on_includer : R.Node.t Capnp_util.capnp_arr -> bool
+  (**
+    [depends_on_includer decls] checks whether [decls] hold a function template, whose specializations
+    depend on the translation unit that includes them. *)
 end
 
 module Make (Node_translator : Node_translator.Translator) : Translator = struct
@@ -12,6 +17,17 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
   module Var_translator = Var_translator.Make (Node_translator)
   module AP = Node_translator.Annotation_parser
 
+  let rec depends_on_includer (decls : R.Node.t Capnp_util.capnp_arr) : bool =
+    decls
+    |> Capnp_util.arr_exists @@ fun node ->
+       match D.get (R.Node.desc_get node |> R.of_pointer) with
+       | FunctionTemplate _ -> true
+       | Namespace ns -> D.Namespace.decls_get ns |> depends_on_includer
+       | Record r ->
+           D.Record.has_body r
+           && D.Record.(body_get r |> Body.decls_get) |> depends_on_includer
+       | _ -> false
+
   let translate_param (param : R.Param.t) : Ast.type_expr * string =
     let open R.Param in
       (type_get param |> Type_translator.translate, name_get param)
@@ -23,7 +39,9 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
       | UnionNotInitialized -> Error.union_no_init_err "declaration"
       | Empty | Deleted -> []
       | Function f -> [ transl_func_decl loc f ]
-      | Ann a -> transl_ann_decls loc a
+      | Ann a ->
+          let a = if D.has_ann_slice decl_desc then D.ann_slice_get decl_desc |> Node_translator.slice_text else a in
+          transl_ann_decls loc a (D.ann_tokens_get decl_desc)
       | Record r -> transl_record_decl loc r
       | Method m -> [ transl_meth_decl loc m ]
       | Var v -> [ transl_var_decl_global loc v ]
@@ -88,9 +106,9 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
         false,
         [] )
 
-  and transl_ann_decls (loc : Ast.loc) (text : string) : Ast.decl list =
+  and transl_ann_decls (loc : Ast.loc) (text : string) tokens : Ast.decl list =
     let (Ast.Lexed l) = loc in
-    AP.parse_decls (l, text)
+    AP.parse_decls (l, text, Node_translator.map_tokens text tokens)
 
   and transl_var_init (i : D.Var.VarInit.t) : Ast.expr =
     let open D.Var.VarInit in
@@ -116,7 +134,8 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
         match D.get desc with
         | D.Ann ann ->
             let (Ast.Lexed l) = loc in
-            AP.parse_struct_members name (l, ann)
+            AP.parse_struct_members name
+              (l, ann, Node_translator.map_tokens ann (D.ann_tokens_get desc))
         | D.Field f ->
             let field = transl_field_decl loc f in
             [ Sig.CxxFieldMem field ]
@@ -132,7 +151,12 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
           Ast.CxxBaseSpec (loc, name_get desc, virtual_get desc)
         in
         let body = body_get record in
-        match (is_abstract_get body, non_overridden_methods_get_list body) with
+        let non_overridden_methods =
+          match non_overridden_method_refs_get_list body with
+          | [] -> non_overridden_methods_get_list body
+          | refs -> List.map Node_translator.translate_name_ref refs
+        in
+        match (is_abstract_get body, non_overridden_methods) with
         | false, meth :: _ ->
             Error.error loc
               ("This record must override virtual method '" ^ meth
@@ -239,7 +263,7 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
   and transl_record_ref (loc : Ast.loc) (record_ref : R.RecordRef.t) : Ast.type_
       =
     let open R.RecordRef in
-    let name = name_get record_ref in
+    let name = Node_translator.record_ref_name record_ref in
     match kind_get record_ref with
     | R.RecordKind.Struc | R.RecordKind.Class -> Ast.StructType (name, [])
     | R.RecordKind.Unio -> Ast.UnionType name
@@ -393,7 +417,7 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
       Ast.decl list =
     let open D.Namespace in
     (* let name = name_get decl in *)
-    decls_get decl |> Capnp_util.arr_map translate |> List.flatten
+    decls_get decl |> Capnp_util.arr_concat_map translate
 
   and transl_function_template_decl (loc : Ast.loc)
       (decl : D.FunctionTemplate.t) : Ast.decl list =
@@ -404,8 +428,18 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
       |> Capnp_util.arr_map Node_translator.map_annotation
       |> AP.parse_func_contract loc
     in
+    let specs = specs_get decl in
+    (* A specialization that shares the body of an earlier one gets its own translation of it. *)
+    let shared_body desc =
+      match D.Function.body_spec_get desc |> Uint32.to_int with
+      | 0 -> None
+      | i ->
+          let _, spec_desc = Node_translator.decompose (Capnp.Array.get specs (i - 1)) in
+          Some (D.Function.body_get spec_desc |> Stmt_translator.expect_compound_stmt)
+    in
     let transl_spec loc desc =
       let name, params, body_opt, _, return_type = transl_func loc desc in
+      let body_opt = if Option.is_some body_opt then body_opt else shared_body desc in
       Ast.Func
         ( loc,
           Ast.Regular,
@@ -421,5 +455,5 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
           false,
           [] )
     in
-    specs_get decl |> Capnp_util.arr_map (Node_translator.map ~f:transl_spec)
+    specs |> Capnp_util.arr_map (Node_translator.map ~f:transl_spec)
 end
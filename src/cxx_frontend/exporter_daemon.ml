@@ -0,0 +1,86 @@
+(*
+   Client side of the exporter's -listen daemon. Instead of starting an exporter process, the translator
+   connects to the daemon at [VF_CXX_EXPORT_DAEMON] and hands it the command line of the run, together
+   with the ends of three pipes that become the stdin, stdout and stderr of the run, which the daemon
+   forks from its already initialized process. The channels are then used as those of a process
+   started by [Unix.open_process_full]. See "Exporter daemon" in ast_exporter/Readme.md. Only available
+   on Unix.
+*)
+
+type channels = in_channel * out_channel * in_channel
+
+external connect_fds :
+  string -> string -> string array -> Unix.file_descr * Unix.file_descr * Unix.file_descr
+  = "caml_cxx_daemon_connect"
+
+(**
+  [socket_opt ()] returns the path of the socket of the daemon given by [VF_CXX_EXPORT_DAEMON], or [None]
+  if no daemon is used.
+*)
+let socket_opt () : string option =
+  if Sys.os_type <> "Unix" then None
+  else
+    match Sys.getenv_opt "VF_CXX_EXPORT_DAEMON" with
+    | Some "" | None -> None
+    | socket -> socket
+
+(* The stdout channels of the runs that are connected to the daemon and not closed yet. *)
+let connections : in_channel list ref = ref []
+
+(**
+  [connect socket args] runs the exporter with command line [args] on the daemon listening on [socket],
+  in the current directory. Raises [Failure] if the daemon cannot be reached.
+*)
+let connect (socket : string) (args : string list) : channels =
+  let in_fd, out_fd, err_fd = connect_fds socket (Sys.getcwd ()) (Array.of_list args) in
+  let inchan = Unix.in_channel_of_descr in_fd in
+  connections := inchan :: !connections;
+  (inchan, Unix.out_channel_of_descr out_fd, Unix.in_channel_of_descr err_fd)
+
+(* The files that runs write their stderr to, see [set_error_file], by the stdout channel of the run. *)
+let error_files : (in_channel * string) list ref = ref []
+
+(**
+  [set_error_file channels path] records that the run of [channels] writes its stderr to the file [path],
+  see [-error_file] in ast_exporter/Readme.md. The file is removed when the run is closed.
+*)
+let set_error_file ((inchan, _, _) : channels) (path : string) : unit =
+  error_files := (inchan, path) :: !error_files
+
+(**
+  [error_output channels] returns what the run of [channels] wrote to stderr: to its stderr channel, which
+  it only uses before it parses its command line if it was given an error file, and to that file.
+*)
+let error_output ((inchan, _, errchan) : channels) : string =
+  let output = Util.input_fully errchan in
+  match List.assq_opt inchan !error_files with
+  | Some path -> (
+      try
+        let chan = open_in_bin path in
+        output ^ Util.do_finally (fun () -> Util.input_fully chan) (fun () -> close_in chan)
+      with Sys_error _ -> output)
+  | None -> output
+
+(**
+  [close ~kill channels] closes the channels of an exporter run, which was either started by
+  [Unix.open_process_full] or connected by [connect], and removes its error file, if any. The process is
+  killed first if [kill] holds; a run on the daemon ends anyway as soon as its pipes are closed.
+*)
+let close ?(kill = false) ((inchan, outchan, errchan) as channels : channels) : unit =
+  (match List.assq_opt inchan !error_files with
+  | Some path ->
+      error_files := List.filter (fun (chan, _) -> chan != inchan) !error_files;
+      (try Sys.remove path with Sys_error _ -> ())
+  | None -> ());
+  if List.memq inchan !connections then begin
+    connections := List.filter (fun chan -> chan != inchan) !connections;
+    close_out_noerr outchan;
+    close_in_noerr inchan;
+    close_in_noerr errchan
+  end
+  else begin
+    if kill then (
+      try Unix.kill (Unix.process_full_pid channels) Sys.sigkill
+      with Unix.Unix_error _ -> ());
+    ignore (Unix.close_process_full channels)
+  end
@@ -0,0 +1,80 @@
+(*
+   Pool of exporter processes that are started ahead of time with [-standby]. Such a process loads and
+   initializes LLVM and Clang and then waits on its stdin for the command line of a run. When the
+   translator needs an exporter and no daemon is used, see [Exporter_daemon], it takes a waiting process,
+   sends it the command line and uses its channels as those of a process started for that command line,
+   so the run does not wait for the exporter to start. The pool is refilled right away, so the next run
+   finds a warm process as well. Spare processes are killed at exit.
+   See "Standby processes" in ast_exporter/Readme.md.
+*)
+
+type channels = in_channel * out_channel * in_channel
+
+(* The waiting processes, with the path of the exporter they run. *)
+let spares : (string * channels) list ref = ref []
+
+(**
+  [size ()] returns the number of processes to keep waiting, given by [VF_CXX_EXPORT_POOL]. By default, one
+  process is kept while more C++ source files are to be translated after the current one, see
+  [Exporter_prefetch.set_upcoming], and none otherwise, since a single translation unit only needs one run.
+*)
+let size () : int =
+  match Sys.getenv_opt "VF_CXX_EXPORT_POOL" with
+  | Some n -> ( try max 0 (int_of_string n) with Failure _ -> 0)
+  | None -> (
+      match !Exporter_prefetch.upcoming with _ :: _ :: _ -> 1 | _ -> 0)
+
+let spawn (exporter : string) : channels =
+  Unix.open_process_args_full exporter [| exporter; "-standby" |] (Unix.environment ())
+
+(**
+  [fill exporter] starts processes running [exporter] until [size ()] of them are waiting.
+*)
+let fill (exporter : string) : unit =
+  let waiting = List.length (List.filter (fun (path, _) -> path = exporter) !spares) in
+  for _ = waiting + 1 to size () do
+    match spawn exporter with
+    | channels -> spares := !spares @ [ (exporter, channels) ]
+    | exception Unix.Unix_error _ -> ()
+  done
+
+(* A request: a 32-bit little-endian length, then the NUL-separated working directory and arguments. *)
+let request (args : string list) : string =
+  let payload = String.concat "\000" (Sys.getcwd () :: args) in
+  let buffer = Buffer.create (4 + String.length payload) in
+  Buffer.add_int32_le buffer (Int32.of_int (String.length payload));
+  Buffer.add_string buffer payload;
+  Buffer.contents buffer
+
+(**
+  [take args] sends the command line [args], which starts with the path of the exporter, to a waiting
+  process that runs that exporter and returns its channels, if there is one. The pool is refilled
+  afterwards.
+*)
+let take (args : string list) : channels option =
+  let exporter = List.hd args in
+  let rec find = function
+    | [] -> None
+    | ((path, ((_, outchan, _) as channels)) as spare) :: _ when path = exporter -> (
+        spares := List.filter (fun s -> s != spare) !spares;
+        match
+          output_string outchan (request args);
+          flush outchan
+        with
+        | () -> Some channels
+        | exception Sys_error _ ->
+            (* The process is gone; try the next one. *)
+            Exporter_daemon.close ~kill:true channels;
+            find !spares)
+    | _ :: rest -> find rest
+  in
+  let result = find !spares in
+  fill exporter;
+  result
+
+let discard () =
+  let waiting = !spares in
+  spares := [];
+  List.iter (fun (_, channels) -> Exporter_daemon.close ~kill:true channels) waiting
+
+let () = at_exit discard
@@ -0,0 +1,125 @@
+(*
+   Prefetching of exporter processes for the translation units a run verifies after the current
+   one, e.g. the C++ source files given to vfconsole. Once a translation unit has been translated,
+   the exporter for the next upcoming source file is started with the same command line. It parses
+   that file while the current one is verified, and its output waits in the pipe until the file is
+   translated. A prefetched process is only used for the command it was started with. It is killed
+   when its file is exported with another command, when another process is prefetched and at exit.
+
+   An editor can also speculate on the export of a file it is about to verify, see [speculate]: the
+   exporter is started with the command line of the previous export of the file and with the unsaved
+   buffers of the editor as overlays, see "Overlays" in ast_exporter/Readme.md. Such a process is only
+   used if, when the file is exported, the overlaid files on disk hold the contents it was given.
+*)
+
+type channels = in_channel * out_channel * in_channel
+
+(* Source files that are still to be translated, in order. *)
+let upcoming : string list ref = ref []
+
+(* The prefetched process with its file, its command and the digests of the files it was given as
+   overlays, by path, if any. *)
+let pending : (string * string * (string * Digest.t) list * channels) option ref = ref None
+
+(* The command of the last export of every file, with a function that starts the exporter with that
+   command and additional exporter options. *)
+let last_exports : (string, string * (string list -> channels)) Hashtbl.t = Hashtbl.create 4
+
+(* The files that hold the contents of the overlays of speculative processes. *)
+let overlay_files : string list ref = ref []
+
+let remove_overlay_files () =
+  List.iter (fun file -> try Sys.remove file with Sys_error _ -> ()) !overlay_files;
+  overlay_files := []
+
+(**
+  [set_upcoming paths] registers the C++ source files [paths] that are going to be translated, in order.
+*)
+let set_upcoming (paths : string list) : unit = upcoming := paths
+
+(**
+  [next_after path] returns the upcoming source file that follows [path], if any, and forgets the files
+  up to it.
+*)
+let next_after (path : string) : string option =
+  let rec drop = function
+    | [] -> []
+    | p :: rest -> if p = path then rest else drop rest
+  in
+  match drop !upcoming with
+  | next :: _ as rest ->
+      upcoming := rest;
+      Some next
+  | [] -> None
+
+let discard () =
+  match !pending with
+  | Some (_, _, _, channels) ->
+      pending := None;
+      Exporter_daemon.close ~kill:true channels
+  | None -> ()
+
+let () =
+  at_exit (fun () ->
+      discard ();
+      remove_overlay_files ())
+
+(**
+  [start file cmd launch] prefetches the process that exports [file] with [cmd], which [launch] starts,
+  in place of a process that was prefetched before.
+*)
+let start (file : string) (cmd : string) (launch : unit -> channels) : unit =
+  discard ();
+  pending := Some (file, cmd, [], launch ())
+
+(**
+  [remember file cmd relaunch] records that [file] is exported with [cmd], for [speculate]. [relaunch options]
+  has to start the exporter with [cmd] and the additional exporter options [options].
+*)
+let remember (file : string) (cmd : string) (relaunch : string list -> channels) : unit =
+  Hashtbl.replace last_exports file (cmd, relaunch)
+
+(**
+  [speculate file overlays] prefetches the process that exports [file] with the command of its previous
+  export, in place of a process that was prefetched before. The exporter reads each of [overlays], pairs of a
+  path and contents, instead of the file at that path. Returns [false], without starting a process, if [file]
+  was not exported before.
+*)
+let speculate (file : string) (overlays : (string * string) list) : bool =
+  match Hashtbl.find_opt last_exports file with
+  | None -> false
+  | Some (cmd, relaunch) ->
+      discard ();
+      (* A process that was taken may still read its overlays, until the next one is started. *)
+      remove_overlay_files ();
+      let options =
+        overlays
+        |> List.map (fun (path, contents) ->
+               let overlay_file = Filename.temp_file "vf-overlay" (Filename.extension path) in
+               overlay_files := overlay_file :: !overlay_files;
+               let chan = open_out_bin overlay_file in
+               output_string chan contents;
+               close_out chan;
+               "-overlay=" ^ path ^ "=@" ^ overlay_file)
+      in
+      let digests = List.map (fun (path, contents) -> (path, Digest.string contents)) overlays in
+      pending := Some (file, cmd, digests, relaunch options);
+      true
+
+(**
+  [take file cmd] returns the channels of the process that was prefetched to export [file] with [cmd], if
+  any, provided the files it was given as overlays hold the same contents on disk. A process that was
+  prefetched for [file] with another command or other contents is killed, one that was prefetched for
+  another file is kept, e.g. while a prelude is exported.
+*)
+let take (file : string) (cmd : string) : channels option =
+  let unchanged (path, digest) = try Digest.file path = digest with Sys_error _ -> false in
+  match !pending with
+  | Some (_, pending_cmd, digests, channels)
+    when pending_cmd = cmd && List.for_all unchanged digests ->
+      pending := None;
+      Some channels
+  | Some (pending_file, _, _, _) when pending_file = file ->
+      discard ();
+      None
+  | _ -> None
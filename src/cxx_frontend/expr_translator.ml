@@ -12,46 +12,56 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
   let make_int_lit (loc : Ast.loc) (n : int) =
     Ast.IntLit (loc, Big_int.big_int_of_int n, true, false, Ast.NoLSuffix)
 
-  let rec translate_decomposed loc expr_desc =
-    match E.get expr_desc with
-    | UnionNotInitialized -> Error.union_no_init_err "expression"
-    | UnaryOp op -> transl_unary_op_expr loc op
-    | BinaryOp op -> transl_binary_op_expr loc op
-    | IntLit int_lit -> transl_int_lit_expr loc int_lit
-    | BoolLit bool_lit -> transl_bool_lit_expr loc bool_lit
-    | StringLit str_lit -> transl_str_lit_expr loc str_lit
-    | Call c -> transl_call_expr loc c
-    | DeclRef ref -> transl_decl_ref_expr loc ref
-    | This -> transl_this_expr loc
-    | New n -> transl_new_expr loc n
-    | Construct c -> transl_construct_expr loc c
-    | Member m -> transl_member_expr loc m
-    | MemberCall c -> transl_member_call_expr loc c
-    | NullPtrLit -> transl_null_ptr_lit_expr loc
-    | Delete d -> transl_delete_expr loc d
-    | Truncating t -> transl_trunc_expr loc t
-    | LValueToRValue l -> transl_lvalue_to_rvalue_expr loc l
-    | DerivedToBase e -> transl_derived_to_base_expr loc e
-    | OperatorCall o -> transl_operator_call_expr loc o
-    | Cleanups c -> transl_cleanups_expr c
-    | BindTemporary t -> transl_bind_temporary_expr t
-    | IntegralCast c -> transl_integral_cast loc c
-    | ConditionalOp op -> transl_conditional_op loc op
-    | ArraySubscript s -> transl_array_subscript loc s
-    | InitList il -> transl_initializer_list loc il
-    | Undefined _ -> failwith "Undefined expression"
-    | _ -> Error.error loc "Unsupported expression."
-
-  and translate expr_node =
-    Node_translator.map ~f:translate_decomposed expr_node
+  let big_int_of_uint64 (value : Stdint.uint64) =
+    let open Stdint in
+    let open Big_int in
+    (* Most literals are small, and fit in a native int. *)
+    if Uint64.(compare value (of_int max_int)) <= 0 then big_int_of_int (Uint64.to_int value)
+    else begin
+      let lowPart = Uint64.to_int64 (Uint64.logand value (Uint64.of_int 0xFFFFFFFF)) in
+      let highPart = Uint64.to_int64 (Uint64.shift_right value 32) in
+      let result = ref (big_int_of_int64 highPart) in
+      result := shift_left_big_int !result 32;
+      or_big_int (big_int_of_int64 lowPart) !result
+    end
+
+  (**
+    [make_spelled_int_lit loc u_suf l_suf base value] makes an integer literal with [value], spelled
+    with the given suffixes and base.
+  *)
+  let make_spelled_int_lit (loc : Ast.loc) (u_suf : bool) (l_suf : R.SufKind.t)
+      (base : R.NbBase.t) value =
+    let l_suf =
+      match l_suf with
+      | R.SufKind.LSuf -> Ast.LSuffix
+      | R.SufKind.LLSuf -> Ast.LLSuffix
+      | R.SufKind.NoSuf -> Ast.NoLSuffix
+    in
+    let dec =
+      match base with
+      | R.NbBase.Decimal -> true
+      | _ -> false
+    in
+    Ast.IntLit (loc, value, dec, u_suf, l_suf)
 
-  and transl_unary_op_expr (loc : Ast.loc) (op : E.UnaryOp.t) : Ast.expr =
-    let open E.UnaryOp in
-    let operand = translate @@ operand_get op in
+  (**
+    [make_int_lit_with_spelling loc int_lit value] makes an integer literal with [value], spelled
+    with the suffixes and base of [int_lit].
+  *)
+  let make_int_lit_with_spelling (loc : Ast.loc) (int_lit : E.IntLit.t) value =
+    let open E.IntLit in
+    make_spelled_int_lit loc (u_suffix_get int_lit) (l_suffix_get int_lit)
+      (base_get int_lit) value
+
+  (**
+    [make_unary_op loc kind operand] makes the expression of unary operator [kind] applied to the
+    translated [operand].
+  *)
+  let make_unary_op (loc : Ast.loc) (kind : R.UnaryOpKind.t) (operand : Ast.expr) : Ast.expr =
     let make_assign loc op lhs post =
       Ast.AssignOpExpr (loc, lhs, op, make_int_lit loc 1, post)
     in
-    match kind_get op with
+    match kind with
     | R.UnaryOpKind.Plus -> operand (* +i *)
     | R.UnaryOpKind.Minus ->
         Ast.Operation (loc, Ast.Sub, [ make_int_lit loc 0; operand ]) (* -i *)
@@ -65,15 +75,17 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
     | R.UnaryOpKind.PostDec -> make_assign loc Ast.Sub operand true (* i-- *)
     | _ -> Error.error loc "Unsupported unary expression."
 
-  and transl_binary_op_expr (loc : Ast.loc) (op : E.BinaryOp.t) : Ast.expr =
-    let open E.BinaryOp in
-    let lhs = translate @@ lhs_get op in
-    let rhs = translate @@ rhs_get op in
+  (**
+    [make_binary_op loc kind lhs rhs] makes the expression of binary operator [kind] applied to the
+    translated operands [lhs] and [rhs].
+  *)
+  let make_binary_op (loc : Ast.loc) (kind : R.BinaryOpKind.t) (lhs : Ast.expr) (rhs : Ast.expr) :
+      Ast.expr =
     let make_op loc op lhs rhs = Ast.Operation (loc, op, [ lhs; rhs ]) in
     let make_assign loc op lhs rhs =
       Ast.AssignOpExpr (loc, lhs, op, rhs, false)
     in
-    match kind_get op with
+    match kind with
     (* binary operators *)
     | R.BinaryOpKind.Add -> make_op loc Ast.Add lhs rhs (* + *)
     | R.BinaryOpKind.Sub -> make_op loc Ast.Sub lhs rhs (* - *)
@@ -110,34 +122,117 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
     | R.BinaryOpKind.OrAssign -> make_assign loc Ast.BitOr lhs rhs (* |= *)
     | _ -> Error.error loc "Unsupported binary expression."
 
-  and transl_int_lit_expr (loc : Ast.loc) (int_lit : E.IntLit.t) : Ast.expr =
-    let open Stdint in
-    let open Big_int in
-    let big_int_of_uint64 (value : Stdint.uint64) =
-      let lowPart = Uint64.to_int64 (Uint64.logand value (Uint64.of_int 0xFFFFFFFF)) in
-      let highPart = Uint64.to_int64 (Uint64.shift_right value 32) in
-      let result = ref (big_int_of_int64 highPart) in
-      result := shift_left_big_int !result 32;
-      or_big_int (big_int_of_int64 lowPart) !result
+  let rec translate_decomposed loc expr_desc =
+    match E.get expr_desc with
+    | UnionNotInitialized -> Error.union_no_init_err "expression"
+    | UnaryOp op -> transl_unary_op_expr loc op
+    | BinaryOp op -> transl_binary_op_expr loc op
+    | IntLit int_lit -> transl_int_lit_expr loc int_lit
+    | BoolLit bool_lit -> transl_bool_lit_expr loc bool_lit
+    | StringLit str_lit -> transl_str_lit_expr loc str_lit
+    | Call c -> transl_call_expr loc c
+    | DeclRef ref -> transl_decl_ref_expr loc ref
+    | DeclRefName i -> Node_translator.translate_name_ref i |> transl_decl_ref_expr loc
+    | This -> transl_this_expr loc
+    | New n -> transl_new_expr loc n
+    | Construct c -> transl_construct_expr loc c
+    | Member m -> transl_member_expr loc m
+    | MemberCall c -> transl_member_call_expr loc c
+    | NullPtrLit -> transl_null_ptr_lit_expr loc
+    | Delete d -> transl_delete_expr loc d
+    | Truncating t -> transl_trunc_expr loc t
+    | LValueToRValue l -> transl_lvalue_to_rvalue_expr loc l
+    | DerivedToBase e -> transl_derived_to_base_expr loc e
+    | OperatorCall o -> transl_operator_call_expr loc o
+    | Cleanups c -> transl_cleanups_expr c
+    | BindTemporary t -> transl_bind_temporary_expr t
+    | Constant c -> translate @@ E.Constant.expr_get c
+    | IntegralCast c -> transl_integral_cast loc c
+    | ConditionalOp op -> transl_conditional_op loc op
+    | ArraySubscript s -> transl_array_subscript loc s
+    | InitList il -> transl_initializer_list loc il
+    | IntArrayLit a -> transl_int_array_lit loc a
+    | Flat f -> transl_flat_expr f
+    | Undefined _ -> failwith "Undefined expression"
+    | _ -> Error.error loc "Unsupported expression."
+
+  and translate expr_node =
+    Node_translator.map ~f:translate_decomposed expr_node
+
+  and transl_unary_op_expr (loc : Ast.loc) (op : E.UnaryOp.t) : Ast.expr =
+    let open E.UnaryOp in
+    let operand = translate @@ operand_get op in
+    make_unary_op loc (kind_get op) operand
+
+  and transl_binary_op_expr (loc : Ast.loc) (op : E.BinaryOp.t) : Ast.expr =
+    let open E.BinaryOp in
+    let lhs = translate @@ lhs_get op in
+    let rhs = translate @@ rhs_get op in
+    make_binary_op loc (kind_get op) lhs rhs
+
+  (**
+    [transl_flat_expr f] translates the tree of a [FlatExpr] in one pass over its entries, which are
+    in pre-order, so every entry is followed by those of its operands.
+  *)
+  and transl_flat_expr (f : R.FlatExpr.t) : Ast.expr =
+    let open R.FlatExpr in
+    let entries = entries_get f in
+    let nb_entries = Capnp.Array.length entries in
+    let next_entry = ref 0 in
+    let rec transl_next () =
+      let i = !next_entry in
+      if i >= nb_entries then Error.error Ast.dummy_loc "Flat expression lacks an operand.";
+      next_entry := i + 1;
+      let entry = Capnp.Array.get entries i in
+      let open Entry in
+      let loc = loc_get entry |> Uint32.to_int |> Node_translator.translate_loc_ref in
+      match kind_get entry with
+      | Kind.UnaryOp ->
+          let operand = transl_next () in
+          make_unary_op loc (unary_op_get entry) operand
+      | Kind.BinaryOp ->
+          let lhs = transl_next () in
+          let rhs = transl_next () in
+          make_binary_op loc (binary_op_get entry) lhs rhs
+      | Kind.IntLit ->
+          big_int_of_uint64 (value_get entry)
+          |> make_spelled_int_lit loc (flag_get entry) (l_suffix_get entry) (base_get entry)
+      | Kind.BoolLit -> transl_bool_lit_expr loc (flag_get entry)
+      | Kind.DeclRef -> name_get entry |> Node_translator.translate_name_ref |> transl_decl_ref_expr loc
+      | Kind.This -> transl_this_expr loc
+      | Kind.NullPtrLit -> transl_null_ptr_lit_expr loc
+      | Kind.LValueToRValue -> Ast.CxxLValueToRValue (loc, transl_next ())
+      | Kind.ConditionalOp ->
+          let cond = transl_next () in
+          let th = transl_next () in
+          let el = transl_next () in
+          Ast.IfExpr (loc, cond, th, el)
+      | Kind.ArraySubscript ->
+          let lhs = transl_next () in
+          let rhs = transl_next () in
+          Ast.ReadArray (loc, lhs, rhs)
+      | Kind.Undefined _ -> Error.error loc "Unsupported flat expression entry."
     in
+    transl_next ()
 
+  and transl_int_lit_expr (loc : Ast.loc) (int_lit : E.IntLit.t) : Ast.expr =
     let open E.IntLit in
-    let l_suf =
-      match l_suffix_get int_lit with
-      | R.SufKind.LSuf -> Ast.LSuffix
-      | R.SufKind.LLSuf -> Ast.LLSuffix
-      | R.SufKind.NoSuf -> Ast.NoLSuffix
+    let low_bits = big_int_of_uint64 (low_bits_get int_lit) in
+    let high_bits = high_bits_get int_lit in
+    (* Only 128-bit literals have high bits, so most literals skip the shift. *)
+    let value =
+      if Stdint.Uint64.(compare high_bits zero) = 0 then low_bits
+      else Big_int.(or_big_int (shift_left_big_int (big_int_of_uint64 high_bits) 64) low_bits)
     in
-    let dec =
-      match base_get int_lit with
-      | R.NbBase.Decimal -> true
-      | _ -> false
+    make_int_lit_with_spelling loc int_lit value
+
+  and transl_int_array_lit (loc : Ast.loc) (a : E.IntArrayLit.t) : Ast.expr =
+    let open E.IntArrayLit in
+    let lit = lit_get a in
+    let to_list_element value =
+      (None, big_int_of_uint64 value |> make_int_lit_with_spelling loc lit)
     in
-    let u_suf = u_suffix_get int_lit in
-    let low_bits = big_int_of_uint64 (low_bits_get int_lit) in
-    let high_bits = big_int_of_uint64 (high_bits_get int_lit) in
-    let value = or_big_int (shift_left_big_int high_bits 64) low_bits in
-    Ast.IntLit (loc, value, dec, u_suf, l_suf)
+    Ast.InitializerList (loc, values_get a |> Capnp_util.arr_map to_list_element)
 
   and transl_bool_lit_expr (loc : Ast.loc) (bool_lit : bool) : Ast.expr =
     match bool_lit with true -> Ast.True loc | false -> Ast.False loc
@@ -159,9 +254,10 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
       | E.DeclRef r ->
           (* c-like function call, operator calls (even tho they can be class methods) *)
           r
+      | E.DeclRefName i -> Node_translator.translate_name_ref i
       | E.Member m ->
           (* C++ method call on explicit or implicit (this) object *)
-          E.Member.name_get m
+          member_name m
       | _ -> Error.error loc "Unsupported callee in function or method call."
     in
     (name, args)
@@ -216,10 +312,17 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
     let e = translate d in
     Ast.CxxDelete (loc, e)
 
+  (** The name of a member, from the name table when the exporter put it there. *)
+  and member_name (m : E.Member.t) : string =
+    let open E.Member in
+    match name_ref_get m |> Uint32.to_int with
+    | 0 -> name_get m
+    | i -> Node_translator.translate_name_ref (Uint32.of_int (i - 1))
+
   and transl_member_expr (loc : Ast.loc) (m : E.Member.t) : Ast.expr =
     let open E.Member in
     let base = translate @@ base_get m in
-    let field = name_get m in
+    let field = member_name m in
     let arrow = arrow_get m in
     (* let qual_name = qual_name_get m in *)
     (* could be useful in the future *)
@@ -233,6 +336,8 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
 
   and transl_lvalue_to_rvalue_expr (loc : Ast.loc) (e : R.Node.t) : Ast.expr =
     let e = translate e in
+    (* With -compact_exprs, the conversion has the location of its operand. *)
+    let loc = match loc with Ast.DummyLoc -> Ast.expr_loc e | _ -> loc in
     Ast.CxxLValueToRValue (loc, e)
 
   and transl_derived_to_base_expr (loc : Ast.loc) (e : E.Cast.t) :
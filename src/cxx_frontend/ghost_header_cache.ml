@@ -0,0 +1,66 @@
+(*
+   Results of parsing ghost #include annotations, e.g. [//@ #include "listex.gh"], shared by all translation
+   units that are translated by the same process and, if [VF_CXX_GHOST_HEADER_CACHE] names a directory,
+   by later processes as well.
+   An entry is keyed by everything the parse depends on: the options of the preprocessor, the location and
+   text of the annotation, and the headers that were active or included before it. It holds a digest of
+   every ghost header that was parsed, and is only reused while those digests match.
+*)
+
+(** Definition of a ghost macro, as in the macro tables of [Lexer]. *)
+type macro = Ast.loc0 * Lexer.Macro_param.t list option * (Ast.loc * Lexer.token) list
+
+type entry = {
+  digests : (string * Digest.t) list;  (** of the ghost headers that were parsed *)
+  headers : Sig.header_type list;
+  header_names : string list;
+  included_files : string list;  (** after the annotation *)
+  macros : (string * macro option) list;
+      (** ghost macros whose definition the annotation changed, or that it undefined if [None] *)
+  reports : Header_cache.report list;  (** in the order they were made *)
+}
+
+let table : (string, entry) Hashtbl.t = Hashtbl.create 16
+
+let cache_dir = Sys.getenv_opt "VF_CXX_GHOST_HEADER_CACHE"
+
+let is_valid (entry : entry) : bool =
+  entry.digests
+  |> List.for_all @@ fun (path, digest) ->
+     try Digest.equal (Digest.file path) digest with Sys_error _ -> false
+
+(**
+  [find key] returns the entry for [key] whose ghost headers did not change since it was added, if any.
+*)
+let find (key : string) : entry option =
+  match Hashtbl.find_opt table key with
+  | Some entry when is_valid entry -> Some entry
+  | _ -> (
+      match Option.bind cache_dir (fun dir -> Marshal_cache.read dir ".ghost" key) with
+      | Some (entry : entry) when is_valid entry ->
+          Hashtbl.replace table key entry;
+          Some entry
+      | _ -> None)
+
+(**
+  [add key entry] records [entry] as the result for [key].
+*)
+let add (key : string) (entry : entry) : unit =
+  Hashtbl.replace table key entry;
+  Option.iter (fun dir -> Marshal_cache.write dir ".ghost" key entry) cache_dir
+
+(* Modification times of the entry files read by [load]. *)
+let loaded : (string, float) Hashtbl.t = Hashtbl.create 16
+
+(**
+  [load ()] adds the entries that were written to [VF_CXX_GHOST_HEADER_CACHE] since the last call, e.g. by
+  runs forked from this process, to the in-memory table. See [Prelude_cache.load].
+*)
+let load () : unit =
+  cache_dir
+  |> Option.iter @@ fun dir ->
+     Marshal_cache.read_changed loaded dir ".ghost"
+     |> List.iter @@ fun (key, (entry : entry)) ->
+        if is_valid entry then Hashtbl.replace table key entry
+
+let clear () = Hashtbl.reset table
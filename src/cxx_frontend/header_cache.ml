@@ -0,0 +1,42 @@
+(*
+   Translations of the declarations of headers, shared by all translation units that are translated
+   by the same process, e.g. the files of a multi-file program or the runs of the IDE.
+   An entry is keyed by the path of the header and a key of the options its translation depends on.
+   It holds a digest of the contents of the header, of the macros of its context it used and of the
+   headers it includes, and the translation is only reused while that digest matches. There is one entry per key, so a header
+   that changed replaces its previous translation.
+*)
+
+(**
+  A report made while the declarations of a header were translated or a ghost include was parsed, see
+  [Ghost_header_cache], which is made again when they are reused.
+*)
+type report =
+  | Range of Lexer.range_kind * Ast.loc0
+  | Should_fail of string * Ast.loc0
+  | Macro_call of Ast.loc0 * Ast.loc0
+
+type entry = {
+  digest : Digest.t;
+  decls : Ast.decl list;
+  reports : report list;  (** in the order they were made *)
+}
+
+let table : (string * string, entry) Hashtbl.t = Hashtbl.create 16
+
+(**
+  [find ~options path digest] returns the entry of header [path] that was added for [options] and
+  [digest], if any.
+*)
+let find ~(options : string) (path : string) (digest : Digest.t) : entry option =
+  match Hashtbl.find_opt table (path, options) with
+  | Some entry when Digest.equal entry.digest digest -> Some entry
+  | _ -> None
+
+(**
+  [add ~options path entry] records [entry] as the translation of header [path] for [options].
+*)
+let add ~(options : string) (path : string) (entry : entry) : unit =
+  Hashtbl.replace table (path, options) entry
+
+let clear () = Hashtbl.reset table
@@ -0,0 +1,84 @@
+(*
+   Reading of files of unpacked Cap'n Proto messages, such as the files written by the exporter's
+   -output and -capture options, through a read-only mapping of the file. The generated reader is
+   instantiated with Capnp.BytesMessage, whose segments live on the OCaml heap, so every segment is
+   copied once from the mapping into a block of its exact size. Unlike Capnp_unix.IO, this does not
+   go through the buffer of a channel and the fragment buffer of the framing codec.
+*)
+
+type bigstring = (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+external blit_to_bytes : bigstring -> int -> Bytes.t -> int -> int -> unit
+  = "caml_cxx_blit_bigstring_to_bytes"
+  [@@noalloc]
+
+let map_file (path : string) : bigstring option =
+  let fd = Unix.openfile path [ Unix.O_RDONLY ] 0 in
+  Fun.protect ~finally:(fun () -> Unix.close fd) @@ fun () ->
+  if (Unix.fstat fd).Unix.st_size = 0 then None
+  else
+    Some
+      (Unix.map_file fd Bigarray.char Bigarray.c_layout false [| -1 |]
+      |> Bigarray.array1_of_genarray)
+
+let get_uint32_le (data : bigstring) (pos : int) : int =
+  let byte i = Char.code (Bigarray.Array1.get data (pos + i)) in
+  byte 0 lor (byte 1 lsl 8) lor (byte 2 lsl 16) lor (byte 3 lsl 24)
+
+(**
+  [frame_message ~truncated ~get_uint32 ~segment ~limit pos] decodes the message in the standard
+  stream framing that starts at [pos] and must end at or before [limit], where [get_uint32 p]
+  returns the little-endian integer at [p] and [segment p len] copies the segment of [len] bytes at
+  [p] out of the storage. Returns the message and the position right after it, and calls
+  [truncated] if the message does not end before [limit].
+*)
+let frame_message ~(truncated : unit -> unit) ~(get_uint32 : int -> int)
+    ~(segment : int -> int -> Bytes.t) ~(limit : int) (pos : int) :
+    Capnp.Message.ro Capnp.BytesMessage.Message.t * int =
+  if limit - pos < 8 then truncated ();
+  let segment_count = get_uint32 pos + 1 in
+  (* The segment table is padded to a whole number of words. *)
+  let table_size = (4 + (4 * segment_count) + 7) / 8 * 8 in
+  if limit - pos < table_size then truncated ();
+  let rec read_segments i segment_pos segments =
+    if i = segment_count then (List.rev segments, segment_pos)
+    else
+      let length = get_uint32 (pos + 4 + (4 * i)) * 8 in
+      if limit - segment_pos < length then truncated ();
+      let segment = segment segment_pos length in
+      read_segments (i + 1) (segment_pos + length) (segment :: segments)
+  in
+  let segments, next_pos = read_segments 0 (pos + table_size) [] in
+  let message =
+    Capnp.BytesMessage.Message.of_storage segments
+    |> Capnp.BytesMessage.Message.readonly
+  in
+  (message, next_pos)
+
+(** [bigstring_segment data pos len] copies [len] bytes at [pos] of [data] into a new block. *)
+let bigstring_segment (data : bigstring) (pos : int) (len : int) : Bytes.t =
+  let segment = Bytes.create len in
+  blit_to_bytes data pos segment 0 len;
+  segment
+
+(**
+  [read_messages path] returns the messages of file [path], which holds unpacked messages in the
+  standard stream framing. Fails if the file ends within a message.
+*)
+let read_messages (path : string) :
+    Capnp.Message.ro Capnp.BytesMessage.Message.t list =
+  match map_file path with
+  | None -> []
+  | Some data ->
+      let size = Bigarray.Array1.dim data in
+      let truncated () = failwith ("Truncated Cap'n Proto message in " ^ path) in
+      let rec read pos messages =
+        if pos = size then List.rev messages
+        else
+          let message, next_pos =
+            frame_message ~truncated ~get_uint32:(get_uint32_le data)
+              ~segment:(bigstring_segment data) ~limit:size pos
+          in
+          read next_pos (message :: messages)
+      in
+      read 0 []
@@ -0,0 +1,64 @@
+(*
+   Files that hold marshalled cache entries, see [Ghost_header_cache] and [Prelude_cache]. An entry is
+   stored in a directory, in a file named after the digest of its key, together with the key itself, so a
+   collision of digests is detected. An entry is only read by the executable that wrote it, since the
+   types of marshalled values are not checked.
+*)
+
+let magic =
+  lazy
+    ("VFMC"
+    ^ (try Digest.to_hex (Digest.file Sys.executable_name)
+       with Sys_error _ -> Sys.ocaml_version))
+
+let entry_path (dir : string) (suffix : string) (key : string) : string =
+  Filename.concat dir (Digest.to_hex (Digest.string key) ^ suffix)
+
+let read_file (path : string) : (string * 'a) option =
+  try
+    let ic = open_in_bin path in
+    Fun.protect ~finally:(fun () -> close_in ic) @@ fun () ->
+    let magic', key, value = Marshal.from_channel ic in
+    if magic' = Lazy.force magic then Some (key, value) else None
+  with Sys_error _ | End_of_file | Failure _ -> None
+
+(**
+  [read dir suffix key] returns the value stored for [key] in directory [dir] with file name suffix
+  [suffix], if any. The caller has to give the value the type it was written with.
+*)
+let read (dir : string) (suffix : string) (key : string) : 'a option =
+  match read_file (entry_path dir suffix key) with
+  | Some (key', value) when key' = key -> Some value
+  | _ -> None
+
+(**
+  [read_changed seen dir suffix] returns the keys and values of the entries in directory [dir] with file
+  name suffix [suffix] whose file was written since [seen] recorded its modification time, and records
+  it. See [read] for the types of the values.
+*)
+let read_changed (seen : (string, float) Hashtbl.t) (dir : string) (suffix : string) :
+    (string * 'a) list =
+  let files = try Array.to_list (Sys.readdir dir) with Sys_error _ -> [] in
+  files
+  |> List.filter (fun file -> Filename.check_suffix file suffix)
+  |> List.filter_map @@ fun file ->
+     let path = Filename.concat dir file in
+     match Unix.stat path with
+     | exception Unix.Unix_error _ -> None
+     | { Unix.st_mtime; _ } when Hashtbl.find_opt seen path = Some st_mtime -> None
+     | { Unix.st_mtime; _ } ->
+         Hashtbl.replace seen path st_mtime;
+         read_file path
+
+(**
+  [write dir suffix key value] stores [value] for [key] in directory [dir], see [read]. The value is
+  written to a temporary file first, so a concurrent reader never sees part of it. Errors are ignored.
+*)
+let write (dir : string) (suffix : string) (key : string) (value : 'a) : unit =
+  try
+    let tmp = Filename.temp_file ~temp_dir:dir "entry" ".tmp" in
+    let oc = open_out_bin tmp in
+    Fun.protect ~finally:(fun () -> close_out oc) (fun () ->
+        Marshal.to_channel oc (Lazy.force magic, key, value) []);
+    Sys.rename tmp (entry_path dir suffix key)
+  with Sys_error _ -> ()
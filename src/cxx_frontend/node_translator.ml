@@ -2,19 +2,61 @@ module R = Reader.R
 module N = R.Node
 module L = R.Loc
 module S = L.SrcPos
+module S32 = L.SrcPos32
 
 type 'a reader = 'a Reader.Stubs.reader_t
 
 module type Translator = sig
   val translate_loc : L.t -> Ast.loc
+  val translate_loc_ref : int -> Ast.loc
+  val with_location_table : L.t Capnp_util.capnp_arr -> (unit -> 'a) -> 'a
+  val with_name_table : string Capnp_util.capnp_arr -> (unit -> 'a) -> 'a
+  val translate_name_ref : Uint32.t -> string
+  val record_ref_name : R.RecordRef.t -> string
+  val with_type_table : R.Type.t Capnp_util.capnp_arr -> (unit -> 'a) -> 'a
+  val type_table_entry : Uint32.t -> R.Type.t
+  val slice_text : R.TextSlice.t -> string
   val decompose : N.t -> Ast.loc * 'a reader
   val map_expect_fail : f:(Ast.loc -> 'a reader -> 'b option) -> N.t -> 'b
   val map : f:(Ast.loc -> 'a reader -> 'b) -> N.t -> 'b
-  val map_annotation : R.Clause.t -> Ast.loc0 * string
+  val map_annotation : R.Clause.t -> Annotation_parser.raw_annotation
+
+  val map_tokens :
+    string ->
+    R.Token.t Capnp_util.capnp_arr ->
+    Annotation_parser.shipped_token array
 
   module Annotation_parser : Annotation_parser.Parser
 end
 
+(**
+  [map_shipped_tokens name_of text tokens] maps the tokens the exporter shipped for an annotation with
+  text [text], looking up their spellings with [name_of]. The tokens are dropped if one of them has an
+  unknown kind, so the text is lexed instead.
+*)
+let map_shipped_tokens (name_of : Uint32.t -> string) (text : string)
+    (tokens : R.Token.t Capnp_util.capnp_arr) :
+    Annotation_parser.shipped_token array =
+  let open R.Token in
+  let open Annotation_parser in
+  let map_token token =
+    let b = begin_get token |> Uint32.to_int in
+    let e = end_get token |> Uint32.to_int in
+    let name () = name_get token |> name_of in
+    match kind_get token with
+    | Kind.Word -> (Word_token, b, e, name ())
+    | Kind.Operator -> (Operator_token, b, e, name ())
+    | Kind.Punctuation -> (Punctuation_token, b, e, name ())
+    | Kind.Int -> (Int_token, b, e, String.sub text b (e - b))
+    | Kind.GhostStart -> (Ghost_start_token, b, e, name ())
+    | Kind.GhostEnd -> (Ghost_end_token, b, e, name ())
+    | Kind.Undefined _ -> raise Exit
+  in
+  try
+    Array.init (Capnp.Array.length tokens) (fun i ->
+        Capnp.Array.get tokens i |> map_token)
+  with Exit -> [||]
+
 module Make (Args : sig
   include Sig.CXX_TRANSLATOR_ARGS
 
@@ -22,12 +64,38 @@ module Make (Args : sig
 end) : Translator = struct
   module Annotation_parser = Annotation_parser.Make (Args)
 
+  let srcpos_cache = Srcpos_cache.create ~equal:Int.equal ~path_of:Args.path_of_int (-1)
+  let make_srcpos fd l c = Srcpos_cache.srcpos srcpos_cache fd l c
+
   let transl_srcpos srcpos =
     let l = S.l_get srcpos in
     let c = S.c_get srcpos in
     let fd = S.fd_get srcpos in
-    let file_name = Args.path_of_int fd in
-    (file_name, l, c)
+    make_srcpos fd l c
+
+  let transl_srcpos32 srcpos =
+    let l = S32.l_get srcpos |> Uint32.to_int in
+    let c = S32.c_get srcpos |> Uint32.to_int in
+    let fd = S32.fd_get srcpos |> Uint32.to_int in
+    make_srcpos fd l c
+
+  (*
+     Location table of the message whose nodes are being translated, see TU.locs.
+     Every entry is translated the first time it is referred to.
+  *)
+  let location_table : (L.t Capnp_util.capnp_arr * Ast.loc option array) option ref =
+    ref None
+
+  (**
+    [with_location_table locs f] calls [f] while locations that refer to a location table
+    are looked up in [locs].
+  *)
+  let with_location_table locs f =
+    let previous = !location_table in
+    (* File identifiers are only unique within one translation unit. *)
+    Srcpos_cache.reset srcpos_cache;
+    location_table := Some (locs, Array.make (Capnp.Array.length locs) None);
+    Util.do_finally f (fun () -> location_table := previous)
 
   let rec translate_loc loc =
     match L.get loc with
@@ -42,6 +110,16 @@ end) : Translator = struct
           else Ast.dummy_srcpos
         in
         Ast.Lexed (l_start, l_end)
+    | Lexed32 l ->
+        let l_start =
+          if L.Lexed32.has_start l then L.Lexed32.start_get l |> transl_srcpos32
+          else Ast.dummy_srcpos
+        in
+        let l_end =
+          if L.Lexed32.has_end l then L.Lexed32.end_get l |> transl_srcpos32
+          else Ast.dummy_srcpos
+        in
+        Ast.Lexed (l_start, l_end)
     | MacroExp l ->
         let l_call_site =
           if L.MacroExp.has_call_site l then
@@ -66,12 +144,81 @@ end) : Translator = struct
           else Ast.dummy_loc
         in
         Ast.MacroParamExpansion (l_param, l_arg_token)
+    | Ref i -> translate_loc_ref (Uint32.to_int i)
+
+  and translate_loc_ref i =
+    match !location_table with
+    | Some (locs, translated) when i < Array.length translated -> (
+        match translated.(i) with
+        | Some loc -> loc
+        | None ->
+            let loc = Capnp.Array.get locs i |> translate_loc in
+            translated.(i) <- Some loc;
+            loc)
+    | _ -> Error.error Ast.dummy_loc "Location refers to a missing location table entry."
+
+  (*
+     Name table of the message whose nodes are being translated, see TU.names.
+     Its names are copied once, when the table is entered.
+  *)
+  let name_table : string array ref = ref [||]
+
+  (**
+    [with_name_table names f] calls [f] while names that refer to a name table are looked up in
+    [names].
+  *)
+  let with_name_table names f =
+    let previous = !name_table in
+    name_table := Capnp_util.arr_to_array names;
+    Util.do_finally f (fun () -> name_table := previous)
+
+  let translate_name_ref i =
+    let i = Uint32.to_int i in
+    if i < Array.length !name_table then !name_table.(i)
+    else Error.error Ast.dummy_loc "Name refers to a missing name table entry."
+
+  let record_ref_name record_ref =
+    match R.RecordRef.get record_ref with
+    | Name name -> name
+    | NameRef i -> translate_name_ref i
+    | Undefined _ -> Error.union_no_init_err "record name"
+
+  (*
+     Type table of the message whose nodes are being translated, see TU.types.
+     Entries are translated at every use, with the location of the node that refers to them.
+  *)
+  let type_table : R.Type.t Capnp_util.capnp_arr option ref = ref None
+
+  (**
+    [with_type_table types f] calls [f] while types that refer to a type table are looked up in
+    [types].
+  *)
+  let with_type_table types f =
+    let previous = !type_table in
+    type_table := Some types;
+    Util.do_finally f (fun () -> type_table := previous)
+
+  let type_table_entry i =
+    let i = Uint32.to_int i in
+    match !type_table with
+    | Some types when i < Capnp.Array.length types -> Capnp.Array.get types i
+    | _ -> Error.error Ast.dummy_loc "Type refers to a missing type table entry."
+
+  let map_tokens text tokens = map_shipped_tokens translate_name_ref text tokens
+
+  (** [slice_text slice] returns the text that [slice] refers to in its source file. *)
+  let slice_text slice =
+    let open R.TextSlice in
+    Source_text.slice
+      (fd_get slice |> Uint32.to_int |> Args.path_of_int)
+      (offset_get slice |> Uint32.to_int)
+      (length_get slice |> Uint32.to_int)
 
   let map_annotation ann =
     let open R.Clause in
     let (Ast.Lexed a_loc) = loc_get ann |> translate_loc in
-    let a_text = text_get ann in
-    (a_loc, a_text)
+    let a_text = if has_slice ann then slice_get ann |> slice_text else text_get ann in
+    (a_loc, a_text, tokens_get ann |> map_tokens a_text)
 
   let decompose node =
     let loc =
@@ -0,0 +1,143 @@
+(*
+   Parsed prelude of C++ programs, i.e. the headers and declarations of [prelude_cxx.h] and of the headers
+   and ghost headers it includes, shared by all runs of the same process and, if [VF_CXX_PRELUDE_CACHE]
+   names a directory, by later processes as well. Parsing the prelude runs the exporter, so a small proof
+   would otherwise spend most of its startup on it.
+   An entry is keyed by the path of the prelude and the options it was parsed with. It holds a digest of
+   every file that was parsed and of the exporter, and is only reused while those digests match. A file is
+   only hashed again if its size or modification time changed, like the exporter's own cache does.
+   The prelude is still type-checked by every run, since that declares its symbols to the run's prover.
+*)
+
+(* A file an entry depends on, with its size and modification time when its digest was computed or last
+   found to match. *)
+type file_state = {
+  path : string;
+  size : int;
+  mutable mtime : float;
+  digest : Digest.t;
+}
+
+type entry = {
+  files : file_state list;
+  headers : Sig.header_type list;
+  decls : Ast.package list;
+  reports : Header_cache.report list;  (** in the order they were made *)
+}
+
+let table : (string, entry) Hashtbl.t = Hashtbl.create 1
+let cache_dir = Sys.getenv_opt "VF_CXX_PRELUDE_CACHE"
+
+(**
+  [file_state path] returns the state of file [path]. It is stated before it is hashed, so a change while it
+  is hashed makes its time differ.
+*)
+let file_state (path : string) : file_state =
+  let { Unix.st_size; st_mtime; _ } = Unix.stat path in
+  { path; size = st_size; mtime = st_mtime; digest = Digest.file path }
+
+(**
+  [unchanged file] checks that [file] holds the contents it had when its digest was computed. A file with
+  another size has changed, and one with another modification time is hashed again; if its contents are the
+  same, its new time is recorded so it is not hashed on the next lookup.
+*)
+let unchanged (file : file_state) : bool =
+  match Unix.stat file.path with
+  | { Unix.st_size; _ } when st_size <> file.size -> false
+  | { Unix.st_mtime; _ } when st_mtime = file.mtime -> true
+  | { Unix.st_mtime; _ } -> (
+      try
+        Digest.equal (Digest.file file.path) file.digest
+        && (file.mtime <- st_mtime;
+            true)
+      with Sys_error _ -> false)
+  | exception Unix.Unix_error _ -> false
+
+let is_valid (entry : entry) : bool = List.for_all unchanged entry.files
+
+let find (key : string) : entry option =
+  match Hashtbl.find_opt table key with
+  | Some entry when is_valid entry -> Some entry
+  | _ -> (
+      match
+        Option.bind cache_dir (fun dir -> Marshal_cache.read dir ".prelude" key)
+      with
+      | Some (entry : entry) when is_valid entry ->
+          Hashtbl.replace table key entry;
+          Some entry
+      | _ -> None)
+
+(**
+  [parse ~options ~report_range ~report_should_fail ~report_macro_call path parse_prelude] returns the
+  headers and declarations of the prelude at [path], parsed with [options]. They are parsed by
+  [parse_prelude], which has to report through the functions it is given, unless an entry is found, in which
+  case its reports are made again.
+*)
+let parse ~(options : string) ~report_range ~report_should_fail
+    ~report_macro_call (path : string)
+    (parse_prelude :
+      report_range:(Lexer.range_kind -> Ast.loc0 -> unit) ->
+      report_should_fail:(string -> Ast.loc0 -> unit) ->
+      report_macro_call:(Ast.loc0 -> Ast.loc0 -> unit) ->
+      Sig.header_type list * Ast.package list) :
+    Sig.header_type list * Ast.package list =
+  let report = function
+    | Header_cache.Range (kind, loc) -> report_range kind loc
+    | Should_fail (directive, loc) -> report_should_fail directive loc
+    | Macro_call (call, def) -> report_macro_call call def
+  in
+  let key = String.concat "\000" [ path; options ] in
+  match find key with
+  | Some { headers; decls; reports; _ } ->
+      List.iter report reports;
+      (headers, decls)
+  | None -> (
+      let reports = ref [] in
+      let record r =
+        reports := r :: !reports;
+        report r
+      in
+      let headers, decls =
+        parse_prelude
+          ~report_range:(fun kind loc -> record (Range (kind, loc)))
+          ~report_should_fail:(fun directive loc ->
+            record (Should_fail (directive, loc)))
+          ~report_macro_call:(fun call def -> record (Macro_call (call, def)))
+      in
+      let exporter =
+        Filename.concat (Filename.dirname Sys.executable_name) "vf-cxx-ast-exporter"
+      in
+      let files =
+        path :: exporter
+        :: List.map (fun (_, (_, _, header_path), _, _) -> header_path) headers
+      in
+      try
+        let entry =
+          {
+            files = List.map file_state files;
+            headers;
+            decls;
+            reports = List.rev !reports;
+          }
+        in
+        Hashtbl.replace table key entry;
+        Option.iter
+          (fun dir -> Marshal_cache.write dir ".prelude" key entry)
+          cache_dir;
+        (headers, decls)
+      with Sys_error _ | Unix.Unix_error _ -> (headers, decls))
+
+(* Modification times of the entry files read by [load]. *)
+let loaded : (string, float) Hashtbl.t = Hashtbl.create 1
+
+(**
+  [load ()] adds the entries that were written to [VF_CXX_PRELUDE_CACHE] since the last call, e.g. by runs
+  forked from this process, to the in-memory table, so that runs forked afterwards find them without
+  reading them.
+*)
+let load () : unit =
+  cache_dir
+  |> Option.iter @@ fun dir ->
+     Marshal_cache.read_changed loaded dir ".prelude"
+     |> List.iter @@ fun (key, (entry : entry)) ->
+        if is_valid entry then Hashtbl.replace table key entry
@@ -0,0 +1,102 @@
+(*
+   Reader side of the exporter's -shm transport. The translator creates a shared memory object with
+   a ring buffer and passes its name to the exporter, which copies every message into the ring and
+   writes an 8-byte notification to the pipe: the offset of the message in the ring and its size,
+   both in words. The reader blocks on the pipe as before, copies the segments of the message out of
+   the ring, and releases its space by publishing the number of ring bytes consumed so far in the
+   header of the object. Messages that do not fit in the ring follow their notification on the pipe.
+   See "Shared memory output" in ast_exporter/Readme.md. The object is a POSIX shared memory object
+   on Unix and a named file mapping on Windows, where it also avoids copying messages through the
+   much slower CRT pipe.
+*)
+
+type bigstring = Mapped_messages.bigstring
+
+external create_region : string -> int -> bigstring = "caml_cxx_shm_create"
+external unlink : string -> unit = "caml_cxx_shm_unlink"
+external unmap : bigstring -> unit = "caml_cxx_shm_unmap"
+
+external store_released : bigstring -> int -> unit
+  = "caml_cxx_shm_store_released"
+  [@@noalloc]
+
+(* Size of the header of the object, which precedes the ring. *)
+let header_size = 64
+
+(* Offset of a notification whose message follows on the pipe. *)
+let inline_offset = 0xffffffff
+
+type t = {
+  name : string;
+  region : bigstring;
+  capacity : int;  (** Size of the ring in bytes. *)
+  mutable released : int;  (** Bytes of the ring consumed so far, skips included. *)
+}
+
+(**
+  [size_opt ()] returns the size of the shared memory object in bytes, given in MiB by
+  [VF_CXX_EXPORT_SHM], or [None] if the transport is not used.
+*)
+let size_opt () : int option =
+  match Option.bind (Sys.getenv_opt "VF_CXX_EXPORT_SHM") int_of_string_opt with
+  | Some mib when mib > 0 -> Some (mib * 1024 * 1024)
+  | _ -> None
+
+let counter = ref 0
+
+(** [create size] creates a shared memory object of [size] bytes with a fresh name. *)
+let create (size : int) : t =
+  incr counter;
+  let name =
+    if Sys.win32 then Printf.sprintf "Local\\vf-cxx-%d-%d" (Unix.getpid ()) !counter
+    else Printf.sprintf "/vf-cxx-%d-%d" (Unix.getpid ()) !counter
+  in
+  let region = create_region name size in
+  { name; region; capacity = (size - header_size) / 8 * 8; released = 0 }
+
+(**
+  [close t] unmaps the object of [t]. It is also unlinked, in case the exporter did not get to it.
+*)
+let close (t : t) : unit =
+  unlink t.name;
+  unmap t.region
+
+let get_uint32_le (b : Bytes.t) (pos : int) : int =
+  Int32.to_int (Bytes.get_int32_le b pos) land 0xffffffff
+
+(**
+  [read_message t chan] reads the next notification from [chan] and returns its message, or [None]
+  if [chan] is at its end.
+*)
+let read_message (t : t) (chan : in_channel) :
+    Capnp.Message.ro Capnp.BytesMessage.Message.t option =
+  let truncated () =
+    failwith "Truncated Cap'n Proto message from the C++ AST exporter"
+  in
+  let notification = Bytes.create 8 in
+  match really_input chan notification 0 8 with
+  | exception End_of_file -> None
+  | () ->
+      let offset = get_uint32_le notification 0 in
+      let size = get_uint32_le notification 4 * 8 in
+      if offset = inline_offset then (
+        let data = Bytes.create size in
+        (try really_input chan data 0 size with End_of_file -> truncated ());
+        Mapped_messages.frame_message ~truncated ~get_uint32:(get_uint32_le data)
+          ~segment:(Bytes.sub data) ~limit:size 0
+        |> fst |> Option.some)
+      else
+        let start = offset * 8 in
+        if start + size > t.capacity then truncated ();
+        let pos = header_size + start in
+        let message, _ =
+          Mapped_messages.frame_message ~truncated
+            ~get_uint32:(Mapped_messages.get_uint32_le t.region)
+            ~segment:(Mapped_messages.bigstring_segment t.region)
+            ~limit:(pos + size) pos
+        in
+        (* The exporter skips the end of the ring when a message does not fit there. *)
+        let skipped = (start - (t.released mod t.capacity) + t.capacity) mod t.capacity in
+        t.released <- t.released + skipped + size;
+        store_released t.region t.released;
+        Some message
@@ -5,6 +5,11 @@ module type Cxx_Ast_Translator = sig
   (**
     [parse_cxx_file path] parses the given C++ file and produces a VeriFast package.
   *)
+  val transl_ser_result : Reader.R.SerResult.t -> header_type list * Ast.decl list
+  (**
+    [transl_ser_result result] translates a translation unit exported as a single {i SerResult}
+    message, e.g. by the exporter's [-output] option.
+  *)
 end
 
 type struct_member_decl =
@@ -23,4 +28,5 @@ module type CXX_TRANSLATOR_ARGS = sig
   val verbose: int
   val include_paths: string list
   val define_macros: string list
+  val focus: (string * int) option (* Only the function on the specified source line is verified *)
 end
\ No newline at end of file
@@ -0,0 +1,37 @@
+(*
+   Contents of the source files whose annotations the exporter refers to with [-annotation_slices] instead of
+   copying their text into the message. A file is read at its first slice after the file table of a message
+   was translated, see [Ast_translator.transl_files].
+*)
+
+let table : (string, string) Hashtbl.t = Hashtbl.create 16
+
+let contents (path : string) : string =
+  match Hashtbl.find_opt table path with
+  | Some text -> text
+  | None ->
+      let ic = open_in_bin path in
+      let text =
+        Fun.protect ~finally:(fun () -> close_in ic) @@ fun () ->
+        really_input_string ic (in_channel_length ic)
+      in
+      Hashtbl.replace table path text;
+      text
+
+(**
+  [slice path offset length] returns the [length] bytes at [offset] in the file at [path].
+*)
+let slice (path : string) (offset : int) (length : int) : string =
+  let text = contents path in
+  if offset < 0 || length < 0 || offset + length > String.length text then
+    failwith
+      (Printf.sprintf "Annotation text at offset %d of %s is outside the file; did the file change during verification?" offset path);
+  String.sub text offset length
+
+(**
+  [digests ()] returns the files that were read since the last [clear], with digests of the contents that were read.
+*)
+let digests () : (string * Digest.t) list =
+  Hashtbl.fold (fun path text digests -> (path, Digest.string text) :: digests) table []
+
+let clear () = Hashtbl.reset table
@@ -15,7 +15,9 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
     match S.get stmt_desc with
     | UnionNotInitialized -> Error.union_no_init_err "statement"
     | Decl decls -> transl_decl_stmt loc decls
-    | Ann a -> transl_stmt_ann loc a
+    | Ann a ->
+        let a = if S.has_ann_slice stmt_desc then S.ann_slice_get stmt_desc |> Node_translator.slice_text else a in
+        transl_stmt_ann loc a (S.ann_tokens_get stmt_desc)
     | Expr e -> transl_expr_stmt e
     | Return r -> transl_return_stmt loc r
     | If i -> transl_if_stmt loc i
@@ -71,9 +73,9 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
         decls
         |> Capnp_util.arr_map (Node_translator.map_expect_fail ~f:expect_var) )
 
-  and transl_stmt_ann (loc : Ast.loc) (text : string) : Ast.stmt =
+  and transl_stmt_ann (loc : Ast.loc) (text : string) tokens : Ast.stmt =
     let (Ast.Lexed l) = loc in
-    AP.parse_stmt (l, text)
+    AP.parse_stmt (l, text, Node_translator.map_tokens text tokens)
 
   and transl_compound_stmt (loc : Ast.loc) (c : S.Compound.t) : Ast.stmt =
     let open S.Compound in
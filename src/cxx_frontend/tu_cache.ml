@@ -0,0 +1,80 @@
+(*
+   Translations of whole translation units, reused when a translation unit is exported again with the same
+   result, e.g. by the runs of the IDE after an edit that did not change the exported program, or by the runs of
+   verifast -server. There is one entry per source file and key of the options its translation depends on.
+   It holds the files whose declarations the translation requested, in the order of the requests, and a digest
+   of the messages it received, see [Ast_translator.transl_on_demand]. The exporter produces the same messages for
+   the same program, so a translation unit whose messages, for the same requests, have the same digest reuses
+   the translation and makes its reports again. The entry also holds digests of the files the translation read
+   itself: the ghost headers it parsed and the files of the annotation slices it looked up, which the messages do
+   not hold. It is only reused while those files did not change.
+
+   Entries are kept in memory if [enabled] is set, as the IDE does, and in the directory [VF_CXX_TU_CACHE] if it
+   is set, which verifast -server sets for the runs it forks. Neither is used otherwise, so a single run does not
+   compute digests of its messages.
+*)
+
+type entry = {
+  requests : int list;  (** files whose declarations were requested, in order *)
+  digest : Digest.t;  (** of the messages that were received, in order *)
+  file_digests : (string * Digest.t) list;  (** of the files the translation read itself *)
+  headers : Sig.header_type list;
+  decls : Ast.decl list;
+  reports : Header_cache.report list;  (** in the order they were made *)
+}
+
+let enabled = ref false
+
+let cache_dir = Sys.getenv_opt "VF_CXX_TU_CACHE"
+
+(** [active ()] tells whether translations are cached. *)
+let active () : bool = !enabled || cache_dir <> None
+
+let table : (string, entry) Hashtbl.t = Hashtbl.create 4
+
+let key (path : string) (options : string) : string = path ^ "\000" ^ options
+
+let is_valid (entry : entry) : bool =
+  entry.file_digests
+  |> List.for_all @@ fun (path, digest) ->
+     try Digest.equal (Digest.file path) digest with Sys_error _ -> false
+
+(**
+  [find path options] returns the entry of source file [path] that was added for [options], if any and if the
+  files it read did not change since. Whether its messages match is up to the caller.
+*)
+let find (path : string) (options : string) : entry option =
+  let key = key path options in
+  match Hashtbl.find_opt table key with
+  | Some entry -> if is_valid entry then Some entry else None
+  | None -> (
+      match Option.bind cache_dir (fun dir -> Marshal_cache.read dir ".tu" key) with
+      | Some (entry : entry) when is_valid entry ->
+          if !enabled then Hashtbl.replace table key entry;
+          Some entry
+      | _ -> None)
+
+(**
+  [add path options entry] records [entry] as the translation of source file [path] for [options], in place of
+  the previous one.
+*)
+let add (path : string) (options : string) (entry : entry) : unit =
+  let key = key path options in
+  if !enabled then Hashtbl.replace table key entry;
+  Option.iter (fun dir -> Marshal_cache.write dir ".tu" key entry) cache_dir
+
+(* Modification times of the entry files read by [load]. *)
+let loaded : (string, float) Hashtbl.t = Hashtbl.create 16
+
+(**
+  [load ()] adds the entries that were written to [VF_CXX_TU_CACHE] since the last call, e.g. by runs forked
+  from this process, to the in-memory table, and enables it. See [Prelude_cache.load].
+*)
+let load () : unit =
+  cache_dir
+  |> Option.iter @@ fun dir ->
+     enabled := true;
+     Marshal_cache.read_changed loaded dir ".tu"
+     |> List.iter @@ fun (key, (entry : entry)) -> Hashtbl.replace table key entry
+
+let clear () = Hashtbl.reset table
@@ -15,13 +15,17 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
     | Pointer p -> transl_pointer_type loc p
     | Record r -> transl_record_type loc r
     | EnumType e -> transl_enum_type loc e
+    | EnumTypeRef e -> transl_enum_type loc (Node_translator.translate_name_ref e)
     | Elaborated e -> transl_elaborated_type e
     | Typedef t -> transl_typedef_type loc t
+    | TypedefRef t ->
+        transl_typedef_type loc (Node_translator.translate_name_ref t)
     | FixedWidth f -> transl_fixed_width_type loc f
     | LValueRef l -> transl_lvalue_ref_type loc l
     | SubstTemplateTypeParam s -> transl_subst_template_type_param loc s
     | ConstantArray ca -> transl_constant_array_type loc ca
     | IncompleteArray ia -> transl_incomplete_array loc ia
+    | Ref i -> Node_translator.type_table_entry i |> translate_decomposed loc
     | Undefined _ -> failwith "Undefined type."
     | _ -> Error.error loc "Unsupported type."
 
@@ -68,7 +72,7 @@ module Make (Node_translator : Node_translator.Translator) : Translator = struct
 
   and transl_record_type (loc : Ast.loc) (r : R.RecordRef.t) : Ast.type_expr =
     let open R.RecordRef in
-    let name = name_get r in
+    let name = Node_translator.record_ref_name r in
     match kind_get r with
     | R.RecordKind.(Struc | Class) ->
         Ast.StructTypeExpr (loc, Some name, None, [], [])
@@ -0,0 +1,51 @@
+(*
+   Translation of the source positions in the Cap'n Proto messages of the C++ AST exporter and the Rust
+   MIR exporter into [Ast.srcpos]es, shared by the readers of both. Nested nodes often start at the same
+   position, e.g. an expression and its first operand, and then share its translation. Positions in the
+   same file as the previous one share its path, so the path is only looked up or decoded when the file
+   changes.
+*)
+
+type 'file t = {
+  equal : 'file -> 'file -> bool;
+  path_of : 'file -> string;
+  mutable has_file : bool;  (** whether [file] and [path] are set *)
+  mutable file : 'file;
+  mutable path : string;
+  mutable l : int;
+  mutable c : int;
+  mutable srcpos : Ast.srcpos;
+}
+
+(**
+  [create ~equal ~path_of none] returns a cache of positions whose files are identified by values of
+  type ['file], compared with [equal], whose path is [path_of file]. [none] is any such value.
+*)
+let create ~(equal : 'file -> 'file -> bool) ~(path_of : 'file -> string) (none : 'file) : 'file t =
+  { equal; path_of; has_file = false; file = none; path = ""; l = 0; c = 0; srcpos = Ast.dummy_srcpos }
+
+(**
+  [reset t] forgets the last position, e.g. when file identifiers start to refer to other files.
+*)
+let reset (t : 'file t) : unit = t.has_file <- false
+
+(**
+  [srcpos t file l c] returns the position at line [l] and column [c] of [file].
+*)
+let srcpos (t : 'file t) (file : 'file) (l : int) (c : int) : Ast.srcpos =
+  if t.has_file && t.equal file t.file then begin
+    if l <> t.l || c <> t.c then begin
+      t.l <- l;
+      t.c <- c;
+      t.srcpos <- (t.path, l, c)
+    end;
+    t.srcpos
+  end else begin
+    t.has_file <- true;
+    t.file <- file;
+    t.path <- t.path_of file;
+    t.l <- l;
+    t.c <- c;
+    t.srcpos <- (t.path, l, c);
+    t.srcpos
+  end
@@ -5,10 +5,96 @@ open Ast
 
 let parsing_stopwatch = Stopwatch.create ()
 
+(* Time spent in the C++ frontend, and the part of it spent waiting for and
+   reading the messages of the AST exporter. *)
+let cxx_frontend_stopwatch = Stopwatch.create ()
+let cxx_read_stopwatch = Stopwatch.create ()
+(* The part of the C++ frontend spent lexing and parsing annotations. *)
+let cxx_annotation_stopwatch = Stopwatch.create ()
+(* CPU time of the C++ AST exporter processes, in seconds. *)
+let cxx_exporter_time = ref 0.0
+
+(* The verification of one function body: its time and the counters of [stats] it accounts for. *)
+type function_timing = {
+  fun_name: string;
+  seconds: float;
+  branches: int;
+  prover_assumes: int;
+  definitely_equal_queries: int;
+  other_prover_queries: int;
+}
+
+(* Latencies of prover calls in processor ticks, kept the way HDR histograms keep them: every power of two
+   is split into [latency_sub_buckets] buckets of equal width, so a bucket spans at most 1/16 of the
+   latencies it counts, whatever their magnitude. *)
+let latency_sub_bits = 4
+let latency_sub_buckets = 1 lsl latency_sub_bits
+
+type latency_histogram = {
+  latency_counts: int array;
+  mutable latency_count: int;
+  mutable latency_total: int;
+  mutable latency_max: int;
+}
+
+let latency_bucket ticks =
+  if ticks < latency_sub_buckets then max ticks 0 else
+  let rec log2 n e = if n <= 1 then e else log2 (n lsr 1) (e + 1) in
+  let e = log2 ticks 0 in
+  (e - latency_sub_bits + 1) * latency_sub_buckets + (ticks lsr (e - latency_sub_bits)) land (latency_sub_buckets - 1)
+
+(* The smallest latency counted by bucket [b]. *)
+let latency_bucket_start b =
+  if b < latency_sub_buckets then b else
+  (latency_sub_buckets + b mod latency_sub_buckets) lsl (b / latency_sub_buckets - 1)
+
+let create_latency_histogram () =
+  {latency_counts = Array.make (latency_bucket max_int + 1) 0; latency_count = 0; latency_total = 0; latency_max = 0}
+
+let record_latency h ticks =
+  let b = latency_bucket ticks in
+  h.latency_counts.(b) <- h.latency_counts.(b) + 1;
+  h.latency_count <- h.latency_count + 1;
+  h.latency_total <- h.latency_total + ticks;
+  if ticks > h.latency_max then h.latency_max <- ticks
+
+let add_latencies h h' =
+  Array.iteri (fun b count -> h.latency_counts.(b) <- h.latency_counts.(b) + count) h'.latency_counts;
+  h.latency_count <- h.latency_count + h'.latency_count;
+  h.latency_total <- h.latency_total + h'.latency_total;
+  h.latency_max <- max h.latency_max h'.latency_max
+
+(* The latency below which the given fraction of the calls fall, as the end of its bucket. *)
+let latency_percentile h fraction =
+  let rank = max 1 (int_of_float (ceil (fraction *. float_of_int h.latency_count))) in
+  let rec iter b seen =
+    let seen = seen + h.latency_counts.(b) in
+    if b + 1 = Array.length h.latency_counts then h.latency_max
+    else if seen >= rank then min h.latency_max (latency_bucket_start (b + 1) - 1)
+    else iter (b + 1) seen
+  in
+  iter 0 0
+
+(* Whether the prover is wrapped to record the latency of its calls, see [Prover_latency]. Set by -stats. *)
+let prover_latency = ref false
+
+let latency_percentiles = [("p50", 0.5); ("p90", 0.9); ("p99", 0.99); ("p99.9", 0.999)]
+
+(* The file to which -profile_locations writes the time charged to every source line, if given. While
+   set, the time of symbolic execution and of prover calls is charged to the statement being verified. *)
+let location_profile : string option ref = ref None
+
+type location_cost = {
+  mutable executions: int;
+  mutable ticks: int;  (* including the prover calls *)
+  mutable prover_ticks: int;
+}
+
 class stats =
   object (self)
     val startTime = Perf.time()
     val startTicks = Stopwatch.processor_ticks()
+    val startHwCounters = Stopwatch.read_hw_counters()
     val mutable successQualifier: string option = None
     val mutable stmtsParsedCount = 0
     val mutable openParsedCount = 0
@@ -23,7 +109,14 @@ class stats =
     val mutable proverOtherQueryCount = 0
     val mutable proverStats = ""
     val mutable overhead: <path: string; nonghost_lines: int; ghost_lines: int; mixed_lines: int> list = []
-    val mutable functionTimings: (string * float) list = []
+    val functionTimings: (string, function_timing) Hashtbl.t = Hashtbl.create 100
+    val mutable cachedFunctionCount = 0
+    val proverLatencies: (string * string, latency_histogram) Hashtbl.t = Hashtbl.create 16
+    val locationCosts: (loc0, location_cost) Hashtbl.t = Hashtbl.create 1000
+    val mutable currentLocation: loc0 option = None
+    val mutable currentLocationTicks = 0L
+    val mutable workerBusyTimes: float list = []
+    val mutable parallelWallTime = 0.0
     
     method tickLength = let t1 = Perf.time() in let ticks1 = Stopwatch.processor_ticks() in (t1 -. startTime) /. Int64.to_float (Int64.sub ticks1 startTicks)
 
@@ -38,7 +131,8 @@ class stats =
           None -> ""
         | Some qualifier -> Printf.sprintf " (%s)" qualifier
       in
-      Printf.sprintf "0 errors found (%d statements verified)%s" self#getStmtExec qualifierText
+      let cachedText = if cachedFunctionCount = 0 then "" else Printf.sprintf ", %d functions cached" cachedFunctionCount in
+      Printf.sprintf "0 errors found (%d statements verified%s)%s" self#getStmtExec cachedText qualifierText
 
     method stmtParsed = stmtsParsedCount <- stmtsParsedCount + 1
     method openParsed = openParsedCount <- openParsedCount + 1
@@ -58,15 +152,176 @@ class stats =
     method appendProverStats (text, tickCounts) =
       let tickLength = self#tickLength in
       proverStats <- proverStats ^ text ^ String.concat "" (List.map (fun (lbl, ticks) -> Printf.sprintf "%s: %.6fs\n" lbl (Int64.to_float ticks *. tickLength)) tickCounts)
+    (* Records that a call of the given kind, e.g. "query", to the given prover took [ticks] processor ticks. *)
+    method proverLatency prover call ticks =
+      record_latency (self#proverLatencyHistogram (prover, call)) ticks;
+      match currentLocation with
+        None -> ()
+      | Some l -> let c = self#locationCost l in c.prover_ticks <- c.prover_ticks + ticks
+    method private proverLatencyHistogram key =
+      match Hashtbl.find_opt proverLatencies key with
+        Some h -> h
+      | None -> let h = create_latency_histogram () in Hashtbl.replace proverLatencies key h; h
+    (* Adds the latencies recorded by a worker of -j. *)
+    method addProverLatencies (key, h) = add_latencies (self#proverLatencyHistogram key) h
+    method getProverLatencies =
+      Hashtbl.fold (fun key h hs -> (key, h)::hs) proverLatencies [] |> List.sort (fun (k1, _) (k2, _) -> compare k1 k2)
+    method private locationCost l =
+      match Hashtbl.find_opt locationCosts l with
+        Some c -> c
+      | None -> let c = {executions = 0; ticks = 0; prover_ticks = 0} in Hashtbl.replace locationCosts l c; c
+    (* Charges the time since the last call to the location it made current, and makes [l] current.
+       Returns the location that was current. *)
+    method resumeLocation l =
+      let now = Stopwatch.processor_ticks () in
+      begin match currentLocation with
+        None -> ()
+      | Some l0 -> let c = self#locationCost l0 in c.ticks <- c.ticks + Int64.to_int (Int64.sub now currentLocationTicks)
+      end;
+      let previous = currentLocation in
+      currentLocation <- l;
+      currentLocationTicks <- now;
+      previous
+    (* Like [resumeLocation], for the start of the verification of the statement at [l]. *)
+    method enterLocation l =
+      let c = self#locationCost l in
+      c.executions <- c.executions + 1;
+      self#resumeLocation (Some l)
+    method getLocationCosts = Hashtbl.fold (fun l c cs -> (l, c)::cs) locationCosts []
+    (* Adds the costs recorded by a worker of -j. *)
+    method addLocationCost (l, c') =
+      let c = self#locationCost l in
+      c.executions <- c.executions + c'.executions;
+      c.ticks <- c.ticks + c'.ticks;
+      c.prover_ticks <- c.prover_ticks + c'.prover_ticks
+    (* Prints the [n] statements that took the most time. *)
+    method printLocationProfile n =
+      let seconds ticks = float_of_int ticks *. self#tickLength in
+      let costs = List.sort (fun (_, c1) (_, c2) -> compare c2.ticks c1.ticks) self#getLocationCosts in
+      Printf.printf "Most expensive statements:\n  %10s %10s %10s  %s\n" "seconds" "prover" "executions" "location";
+      costs |> List.iteri begin fun i (((path, line, col), _), c) ->
+        if i < n then
+          Printf.printf "  %10.6f %10.6f %10d  %s:%d:%d\n" (seconds c.ticks) (seconds c.prover_ticks) c.executions path line col
+      end
+    (* Writes the time charged to every source line, as lines of tab-separated path, line, seconds,
+       prover seconds and statement executions. *)
+    method writeLocationProfile file =
+      let lines = Hashtbl.create 1000 in
+      self#getLocationCosts |> List.iter begin fun (((path, line, _), _), c) ->
+        match Hashtbl.find_opt lines (path, line) with
+          None -> Hashtbl.replace lines (path, line) {c with executions = c.executions}
+        | Some c0 ->
+          c0.executions <- c0.executions + c.executions;
+          c0.ticks <- c0.ticks + c.ticks;
+          c0.prover_ticks <- c0.prover_ticks + c.prover_ticks
+      end;
+      let lines = List.sort compare (Hashtbl.fold (fun (path, line) c ls -> (path, line, c.ticks, c.prover_ticks, c.executions)::ls) lines []) in
+      let seconds ticks = float_of_int ticks *. self#tickLength in
+      let oc = open_out file in
+      Fun.protect ~finally:(fun () -> close_out oc) begin fun () ->
+        lines |> List.iter begin fun (path, line, ticks, prover_ticks, executions) ->
+          Printf.fprintf oc "%s\t%d\t%.6f\t%.6f\t%d\n" path line (seconds ticks) (seconds prover_ticks) executions
+        end
+      end
     method overhead ~path ~nonGhostLineCount ~ghostLineCount ~mixedLineCount =
       let o = object method path = path method nonghost_lines = nonGhostLineCount method ghost_lines = ghostLineCount method mixed_lines = mixedLineCount end in
       overhead <- o::overhead
-    method recordFunctionTiming funName seconds = if seconds > 0.1 then functionTimings <- (funName, seconds)::functionTimings
+    (* The counters of symbolic execution and of prover calls, which the workers of -j add theirs to. *)
+    method getCounters = [execStepCount; branchCount; proverAssumeCount; definitelyEqualSameTermCount; definitelyEqualQueryCount; proverOtherQueryCount]
+    method addCounters counters =
+      match counters with
+        [execSteps; branches; assumes; sameTerms; queries; others] ->
+        execStepCount <- execStepCount + execSteps;
+        branchCount <- branchCount + branches;
+        proverAssumeCount <- proverAssumeCount + assumes;
+        definitelyEqualSameTermCount <- definitelyEqualSameTermCount + sameTerms;
+        definitelyEqualQueryCount <- definitelyEqualQueryCount + queries;
+        proverOtherQueryCount <- proverOtherQueryCount + others
+      | _ -> ()
+    (* The counters that [recordFunctionTiming] takes the difference of. *)
+    method functionCounters = (branchCount, proverAssumeCount, definitelyEqualQueryCount, proverOtherQueryCount)
+    method recordFunctionTiming funName seconds (branches0, assumes0, queries0, others0) =
+      self#addFunctionTiming {
+        fun_name = funName; seconds; branches = branchCount - branches0; prover_assumes = proverAssumeCount - assumes0;
+        definitely_equal_queries = definitelyEqualQueryCount - queries0; other_prover_queries = proverOtherQueryCount - others0
+      }
+    (* With -j, every process walks all functions but verifies only some of them, so the slowest timing of a function is
+       the one of the process that verified it. *)
+    method addFunctionTiming timing =
+      match Hashtbl.find_opt functionTimings timing.fun_name with
+        Some t when t.seconds >= timing.seconds -> ()
+      | _ -> Hashtbl.replace functionTimings timing.fun_name timing
+    method getFunctionTimingList = Hashtbl.fold (fun _ timing timings -> timing::timings) functionTimings []
+    method functionsCached count = cachedFunctionCount <- cachedFunctionCount + count
+    (* The CPU time each worker of -j spent verifying function bodies, and the wall time until the last one finished. *)
+    method workersFinished wallTime busyTimes = parallelWallTime <- wallTime; workerBusyTimes <- busyTimes
+    method getCachedFunctionCount = cachedFunctionCount
     method getFunctionTimings =
-      let compare (_, t1) (_, t2) = compare t1 t2 in
-      let timingsSorted = List.sort compare functionTimings in
-      let max_funName_length = List.fold_left (fun m (n, _) -> max m (String.length n)) 0 timingsSorted in
-      String.concat "" (List.map (fun (funName, seconds) -> Printf.sprintf "  %-*s: %6.2f seconds\n" max_funName_length funName seconds) timingsSorted)
+      let timings = List.filter (fun t -> t.seconds > 0.1) self#getFunctionTimingList in
+      let timingsSorted = List.sort (fun t1 t2 -> compare t1.seconds t2.seconds) timings in
+      let max_funName_length = List.fold_left (fun m t -> max m (String.length t.fun_name)) 0 timingsSorted in
+      String.concat "" (List.map (fun t -> Printf.sprintf "  %-*s: %6.2f seconds\n" max_funName_length t.fun_name t.seconds) timingsSorted)
+
+    (* The statistics of [printStats], and the timing of every function, as written by -stats_json. *)
+    method toJson =
+      let open Json in
+      let seconds ticks = F (Int64.to_float ticks *. self#tickLength) in
+      let cxx_frontend_ticks = Stopwatch.ticks cxx_frontend_stopwatch in
+      let cxx_read_ticks = Stopwatch.ticks cxx_read_stopwatch in
+      let cxx_annotation_ticks = Stopwatch.ticks cxx_annotation_stopwatch in
+      let hwCounters = Stopwatch.read_hw_counters() in
+      let hwCounter name count startCount =
+        if count >= 0L && startCount >= 0L then [name, I (Int64.to_int (Int64.sub count startCount))] else []
+      in
+      let timingsSorted = List.sort (fun t1 t2 -> compare t2.seconds t1.seconds) self#getFunctionTimingList in
+      O [
+        "statements_parsed", I stmtsParsedCount;
+        "statement_executions", I self#getStmtExec;
+        "execution_steps", I execStepCount;
+        "branches", I branchCount;
+        "prover_assumes", I proverAssumeCount;
+        "definitely_equal_same_term", I definitelyEqualSameTermCount;
+        "definitely_equal_queries", I definitelyEqualQueryCount;
+        "other_prover_queries", I proverOtherQueryCount;
+        "prover_stats", S proverStats;
+        "prover_latencies", A (self#getProverLatencies |> List.map begin fun ((prover, call), h) ->
+          O ([
+            "prover", S prover;
+            "call", S call;
+            "count", I h.latency_count;
+            "seconds", seconds (Int64.of_int h.latency_total)
+          ] @ List.map (fun (name, fraction) -> name, seconds (Int64.of_int (latency_percentile h fraction))) latency_percentiles
+            @ ["max", seconds (Int64.of_int h.latency_max)])
+        end);
+        "cached_functions", I cachedFunctionCount;
+        "phases", O ([
+          "parsing", seconds (Stopwatch.ticks parsing_stopwatch);
+          "total", F (Perf.time() -. startTime)
+        ] @ (if cxx_frontend_ticks = 0L then [] else [
+          "cxx_exporter", F !cxx_exporter_time;
+          "cxx_read", seconds cxx_read_ticks;
+          "cxx_translate", seconds (Int64.sub (Int64.sub cxx_frontend_ticks cxx_read_ticks) cxx_annotation_ticks);
+          "cxx_annotations", seconds cxx_annotation_ticks
+        ]));
+        "hw_counters", O (
+          hwCounter "cycles" hwCounters.Stopwatch.cycles startHwCounters.Stopwatch.cycles @
+          hwCounter "instructions" hwCounters.Stopwatch.instructions startHwCounters.Stopwatch.instructions @
+          hwCounter "cache_misses" hwCounters.Stopwatch.cache_misses startHwCounters.Stopwatch.cache_misses);
+        "workers", O [
+          "busy_times", A (List.map (fun t -> F t) workerBusyTimes);
+          "wall_time", F parallelWallTime
+        ];
+        "functions", A (timingsSorted |> List.map begin fun t ->
+          O [
+            "name", S t.fun_name;
+            "seconds", F t.seconds;
+            "branches", I t.branches;
+            "prover_assumes", I t.prover_assumes;
+            "definitely_equal_queries", I t.definitely_equal_queries;
+            "other_prover_queries", I t.other_prover_queries
+          ]
+        end)
+      ]
     
     method printStats =
       print_endline ("Syntactic annotation overhead statistics:");
@@ -90,7 +345,40 @@ class stats =
       print_endline ("Term equality tests -- total: " ^ string_of_int (definitelyEqualSameTermCount + definitelyEqualQueryCount));
       print_endline ("Other prover queries: " ^ string_of_int proverOtherQueryCount);
       print_endline ("Prover statistics:\n" ^ proverStats);
+      if Hashtbl.length proverLatencies > 0 then begin
+        let micros ticks = float_of_int ticks *. self#tickLength *. 1e6 in
+        Printf.printf "Prover call latencies (microseconds):\n  %-14s %-14s %10s %12s %10s" "prover" "call" "count" "total" "mean";
+        List.iter (fun (name, _) -> Printf.printf " %10s" name) latency_percentiles;
+        Printf.printf " %10s\n" "max";
+        self#getProverLatencies |> List.iter begin fun ((prover, call), h) ->
+          Printf.printf "  %-14s %-14s %10d %12.1f %10.1f" prover call h.latency_count (micros h.latency_total)
+            (micros h.latency_total /. float_of_int h.latency_count);
+          List.iter (fun (_, fraction) -> Printf.printf " %10.1f" (micros (latency_percentile h fraction))) latency_percentiles;
+          Printf.printf " %10.1f\n" (micros h.latency_max)
+        end
+      end;
       Printf.printf "Time spent parsing: %.6fs\n" (Int64.to_float (Stopwatch.ticks parsing_stopwatch) *. self#tickLength);
+      let cxx_frontend_ticks = Stopwatch.ticks cxx_frontend_stopwatch in
+      if cxx_frontend_ticks > 0L then begin
+        let cxx_read_ticks = Stopwatch.ticks cxx_read_stopwatch in
+        let cxx_annotation_ticks = Stopwatch.ticks cxx_annotation_stopwatch in
+        Printf.printf "Time spent in the C++ AST exporter: %.6fs\n" !cxx_exporter_time;
+        Printf.printf "Time spent reading C++ AST messages: %.6fs\n" (Int64.to_float cxx_read_ticks *. self#tickLength);
+        Printf.printf "Time spent translating the C++ AST: %.6fs\n" (Int64.to_float (Int64.sub (Int64.sub cxx_frontend_ticks cxx_read_ticks) cxx_annotation_ticks) *. self#tickLength);
+        Printf.printf "Time spent parsing C++ annotations: %.6fs\n" (Int64.to_float cxx_annotation_ticks *. self#tickLength)
+      end;
+      let hwCounters = Stopwatch.read_hw_counters() in
+      let printHwCounter name count startCount =
+        if count >= 0L && startCount >= 0L then Printf.printf "%s of the main thread: %Ld\n" name (Int64.sub count startCount)
+      in
+      printHwCounter "Processor cycles" hwCounters.Stopwatch.cycles startHwCounters.Stopwatch.cycles;
+      printHwCounter "Instructions" hwCounters.Stopwatch.instructions startHwCounters.Stopwatch.instructions;
+      printHwCounter "Cache misses" hwCounters.Stopwatch.cache_misses startHwCounters.Stopwatch.cache_misses;
+      if workerBusyTimes <> [] && parallelWallTime > 0.0 then begin
+        Printf.printf "Worker busy time: %s\n" (String.concat ", " (List.map (Printf.sprintf "%.3fs") workerBusyTimes));
+        Printf.printf "Parallel efficiency: %.1f%%\n"
+          (100.0 *. List.fold_left (+.) 0.0 workerBusyTimes /. (float_of_int (List.length workerBusyTimes) *. parallelWallTime))
+      end;
       print_endline ("Function timings (> 0.1s):\n" ^ self#getFunctionTimings);
       print_endline (Printf.sprintf "Total time: %.2f seconds" (Perf.time() -. startTime))
   end
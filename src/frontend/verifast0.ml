@@ -485,6 +485,12 @@ type options = {
   option_enforce_annotations : bool;
   option_report_skipped_stmts: bool; (* Report statements in functions or methods that have no contract. *)
   option_allow_ignore_ref_creation: bool;
+  option_jobs: int; (* Number of worker processes that verify function bodies; 1 verifies them in this process *)
+  option_branch_jobs: int; (* Number of processes that explore branches, this one included; 1 explores them in this process *)
+  option_branch_depth: int; (* Depth from which right branches are explored by forked processes *)
+  option_verification_cache: string option; (* Directory that records the function bodies that were verified *)
+  option_dump_smt_queries: string option; (* Directory to which the calls made to the prover are written, see Prover_trace *)
+  option_lazy_axioms: bool; (* Hold back the axioms of the prelude and the declarations until their symbols are used, see Lazy_axioms *)
 } (* ?options *)
 
 (* Region: verify_program_core: the toplevel function *)
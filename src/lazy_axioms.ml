@@ -0,0 +1,221 @@
+(* This file defines a prover that forwards every call to another prover,
+   except that it holds back the axioms of the prelude and of the
+   declarations of the program: the quantified axioms and facts that are
+   asserted before the first push. An axiom is asserted the first time a
+   term that mentions one of its symbols is asserted, assumed or queried,
+   so the axioms about fixpoints, inductives and functions that the
+   program never uses neither cost setup time nor widen the prover's
+   search. VeriFast uses it when given -lazy_axioms.
+
+   Every term carries the set of symbols it mentions. A symbol becomes
+   active when a term that mentions it reaches the prover; activating it
+   asserts the axioms held back for it, and in turn activates the symbols
+   of these axioms, since instances of an axiom may mention them. An
+   activation in a pushed frame is undone when the frame is popped, as is
+   the assertion of the axioms it caused.
+
+   Terms that the prover builds itself by evaluating fixpoint clauses do
+   not pass through this prover before they reach its context. Their
+   symbols are activated at the next call, and a query or assumption
+   during which they were built is repeated if its answer was
+   inconclusive and activating them asserted an axiom. Asynchronous
+   answers are not repeated. *)
+
+open Proverapi
+
+module IntSet = Set.Make (Int)
+
+type 'symbol symbol_node = {symbol_id: int; symbol_inner: 'symbol}
+type 'termnode term_node = {symbols: IntSet.t; term_inner: 'termnode}
+
+type ('typenode, 'termnode) axiom =
+  | Forall of string * 'termnode list * 'typenode list * 'termnode
+  | Fact of 'termnode
+
+type ('typenode, 'termnode) held_axiom = {
+  axiom: ('typenode, 'termnode) axiom;
+  axiom_symbols: IntSet.t;
+  mutable asserted: bool
+}
+
+let symbols_of ts = List.fold_left (fun acc t -> IntSet.union acc t.symbols) IntSet.empty ts
+
+class ['typenode, 'symbol, 'termnode] lazy_context (p : ('typenode, 'symbol, 'termnode) context) =
+  let last_id = ref 0 in
+  (* Axioms held back for every symbol they mention, by symbol id. *)
+  let held : (int, ('typenode, 'termnode) held_axiom list) Hashtbl.t = Hashtbl.create 1024 in
+  let active : (int, unit) Hashtbl.t = Hashtbl.create 1024 in
+  (* For every frame pushed on the prover, innermost first, the actions
+     that undo the activations made in it. *)
+  let frames : (unit -> unit) list ref list ref = ref [] in
+  (* Number of frames after every snapshot, by handle. *)
+  let snapshots : (int, int) Hashtbl.t = Hashtbl.create 16 in
+  let nb_asserted = ref 0 in
+  (* Symbols of the terms built by fixpoint clauses since the last call. *)
+  let clause_symbols = ref IntSet.empty in
+  let on_pop f =
+    match !frames with
+      [] -> ()
+    | frame::_ -> frame := f::!frame
+  in
+  let push_frame () = frames := ref [] :: !frames in
+  let pop_frame () =
+    match !frames with
+      [] -> ()
+    | frame::frames0 -> frames := frames0; List.iter (fun f -> f ()) !frame
+  in
+  let rec activate symbols =
+    symbols |> IntSet.iter begin fun id ->
+      if not (Hashtbl.mem active id) then begin
+        Hashtbl.replace active id ();
+        on_pop (fun () -> Hashtbl.remove active id);
+        match Hashtbl.find_opt held id with
+          None -> ()
+        | Some axioms -> List.iter assert_axiom axioms
+      end
+    end
+  and assert_axiom a =
+    if not a.asserted then begin
+      a.asserted <- true;
+      on_pop (fun () -> a.asserted <- false);
+      begin match a.axiom with
+        Forall (description, triggers, tps, body) -> p#assume_forall description triggers tps body
+      | Fact t -> p#assert_term t
+      end;
+      incr nb_asserted;
+      activate a.axiom_symbols
+    end
+  in
+  (* Asserts the axiom right away if it is not part of the prelude or
+     one of its symbols is active already; holds it back otherwise. *)
+  let hold axiom symbols =
+    let a = {axiom; axiom_symbols = symbols; asserted = false} in
+    if !frames <> [] || IntSet.is_empty symbols || IntSet.exists (Hashtbl.mem active) symbols then
+      assert_axiom a
+    else
+      symbols |> IntSet.iter begin fun id ->
+        Hashtbl.replace held id (a::Option.value ~default:[] (Hashtbl.find_opt held id))
+      end
+  in
+  (* Returns whether an axiom was asserted. *)
+  let activate_clause_symbols () =
+    let symbols = !clause_symbols in
+    clause_symbols := IntSet.empty;
+    let nb_asserted0 = !nb_asserted in
+    activate symbols;
+    !nb_asserted > nb_asserted0
+  in
+  let reach t = ignore (activate_clause_symbols ()); activate t.symbols in
+  let leaf term_inner = {symbols = IntSet.empty; term_inner} in
+  let map1 f a = {symbols = a.symbols; term_inner = f a.term_inner} in
+  let map2 f a b = {symbols = IntSet.union a.symbols b.symbols; term_inner = f a.term_inner b.term_inner} in
+  let map3 f a b c = {symbols = symbols_of [a; b; c]; term_inner = f a.term_inner b.term_inner c.term_inner} in
+object (self)
+  method set_verbosity v = p#set_verbosity v
+  method type_bool = p#type_bool
+  method type_int = p#type_int
+  method type_real = p#type_real
+  method type_inductive = p#type_inductive
+  method mk_boxed_int = map1 p#mk_boxed_int
+  method mk_unboxed_int = map1 p#mk_unboxed_int
+  method mk_boxed_real = map1 p#mk_boxed_real
+  method mk_unboxed_real = map1 p#mk_unboxed_real
+  method mk_boxed_bool = map1 p#mk_boxed_bool
+  method mk_unboxed_bool = map1 p#mk_unboxed_bool
+  method mk_symbol name domain range kind =
+    incr last_id;
+    {symbol_id = !last_id; symbol_inner = p#mk_symbol name domain range kind}
+  method set_fpclauses fc k cs =
+    (* Clauses are only evaluated for applications of the fixpoint to
+       constructors, so they are not held back. *)
+    p#set_fpclauses fc.symbol_inner k
+      (cs |> List.map begin fun (c, fbody) ->
+         (c.symbol_inner, fun fargs cargs ->
+            let t = fbody (List.map leaf fargs) (List.map leaf cargs) in
+            clause_symbols := IntSet.union t.symbols !clause_symbols;
+            t.term_inner)
+       end)
+  method mk_app s ts =
+    {symbols = IntSet.add s.symbol_id (symbols_of ts); term_inner = p#mk_app s.symbol_inner (List.map (fun t -> t.term_inner) ts)}
+  method mk_apps apps = Array.map (fun (s, ts) -> self#mk_app s ts) apps
+  method mk_true = leaf p#mk_true
+  method mk_false = leaf p#mk_false
+  method mk_and = map2 p#mk_and
+  method mk_or = map2 p#mk_or
+  method mk_not = map1 p#mk_not
+  method mk_ifthenelse = map3 p#mk_ifthenelse
+  method mk_iff = map2 p#mk_iff
+  method mk_implies = map2 p#mk_implies
+  method mk_eq = map2 p#mk_eq
+  method mk_intlit n = leaf (p#mk_intlit n)
+  method mk_intlit_of_string s = leaf (p#mk_intlit_of_string s)
+  method mk_add = map2 p#mk_add
+  method mk_sub = map2 p#mk_sub
+  method mk_mul = map2 p#mk_mul
+  method mk_div = map2 p#mk_div
+  method mk_mod = map2 p#mk_mod
+  method mk_lt = map2 p#mk_lt
+  method mk_le = map2 p#mk_le
+  method mk_reallit n = leaf (p#mk_reallit n)
+  method mk_reallit_of_num n = leaf (p#mk_reallit_of_num n)
+  method mk_real_add = map2 p#mk_real_add
+  method mk_real_sub = map2 p#mk_real_sub
+  method mk_real_mul = map2 p#mk_real_mul
+  method mk_real_lt = map2 p#mk_real_lt
+  method mk_real_le = map2 p#mk_real_le
+  method pprint t = p#pprint t.term_inner
+  method pprint_sort s = p#pprint_sort s
+  method pprint_sym s = p#pprint_sym s.symbol_inner
+  method push = ignore (activate_clause_symbols ()); p#push; push_frame ()
+  method pop = p#pop; pop_frame ()
+  method snapshot =
+    ignore (activate_clause_symbols ());
+    let h = p#snapshot in
+    push_frame ();
+    Hashtbl.replace snapshots h (List.length !frames);
+    h
+  method restore h =
+    p#restore h;
+    let nb_frames = Hashtbl.find snapshots h in
+    while List.length !frames >= nb_frames do pop_frame () done;
+    push_frame ()
+  method assert_term t =
+    ignore (activate_clause_symbols ());
+    if !frames = [] then hold (Fact t.term_inner) t.symbols else begin
+      activate t.symbols;
+      p#assert_term t.term_inner
+    end
+  method assume t =
+    reach t;
+    let rec iter r = if r = Unknown && activate_clause_symbols () then iter (p#assume t.term_inner) else r in
+    iter (p#assume t.term_inner)
+  method assume_all ts =
+    Array.iter reach ts;
+    let inners = Array.map (fun t -> t.term_inner) ts in
+    let rec iter r = if r = Unknown && activate_clause_symbols () then iter (p#assume_all inners) else r in
+    iter (p#assume_all inners)
+  method query t =
+    reach t;
+    let rec iter r = if not r && activate_clause_symbols () then iter (p#query t.term_inner) else r in
+    iter (p#query t.term_inner)
+  method assume_async t = reach t; p#assume_async t.term_inner
+  method query_async t = reach t; p#query_async t.term_inner
+  method stats = p#stats
+  method begin_formal = p#begin_formal
+  method end_formal = p#end_formal
+  method mk_bound i s = leaf (p#mk_bound i s)
+  method assume_forall description triggers tps body =
+    ignore (activate_clause_symbols ());
+    hold (Forall (description, List.map (fun t -> t.term_inner) triggers, tps, body.term_inner)) (symbols_of (body::triggers))
+  method simplify t =
+    (* The simplified term is equal to the given one, so the axioms
+       about it are those about the given term. *)
+    Option.map (fun t' -> {symbols = t.symbols; term_inner = t'}) (p#simplify t.term_inner)
+end
+
+(** [wrap p] returns a prover that forwards every call to [p] but holds back the axioms asserted before the first push
+    until a term that mentions one of their symbols is asserted, assumed or queried. *)
+let wrap (p : ('typenode, 'symbol, 'termnode) context)
+    : ('typenode, 'symbol symbol_node, 'termnode term_node) context =
+  (new lazy_context p
+   : ('typenode, 'symbol, 'termnode) lazy_context :> ('typenode, 'symbol symbol_node, 'termnode term_node) context)
@@ -41,6 +41,10 @@ let decompose_path s =
 let max_processes = ref 1
 let dots = ref false  (* Print only a dot for successfully terminated processes. *)
 let verbose = ref false
+let bench = ref false  (* Run C++ files through verifast -stats and summarize the time spent in the C++ frontend. *)
+let simplex_bench = ref false  (* Run all files through verifast -stats and summarize the time spent in Redux and its Simplex. *)
+let history_path = ref None  (* Durations of earlier runs, used to start the commands expected to take longest first. *)
+let cxx_exporter_daemon = ref false  (* Fork the C++ AST exporter runs of all verifast commands from one daemon. *)
 let main_filename = ref "standard input"
 let main_file = ref stdin
 
@@ -57,6 +61,18 @@ let () =
     | "-verbose"::args ->
       verbose := true;
       iter args
+    | "-bench"::args ->
+      bench := true;
+      iter args
+    | "-simplex_bench"::args ->
+      simplex_bench := true;
+      iter args
+    | "-history"::path::args ->
+      history_path := Some path;
+      iter args
+    | "-cxx_exporter_daemon"::args ->
+      cxx_exporter_daemon := true;
+      iter args
     | filename::args when String.length filename > 0 && filename.[0] <> '-' ->
       main_filename := filename;
       let file = try open_in filename with Sys_error s -> failwith (Printf.sprintf "Could not open file '%s': %s" filename s) in
@@ -64,7 +80,7 @@ let () =
       iter args
     | arg::args ->
       Printf.printf "Invalid argument: %s\n" arg;
-      print_endline "Usage: mysh [-cpus n] [-dots] [-verbose] [filename]";
+      print_endline "Usage: mysh [-cpus n] [-dots] [-verbose] [-bench] [-simplex_bench] [-history file] [-cxx_exporter_daemon] [filename]";
       exit 1
   in
   iter (List.tl (Array.to_list Sys.argv))
@@ -111,9 +127,50 @@ let semaphore initialValue =
   in
   acquire, release
 
+(* Like [semaphore], except that a released permission goes to the waiter with the highest priority,
+   and to the one that waited longest among those with the same priority. *)
+let priority_semaphore initialValue =
+  let count = ref initialValue in
+  let waiters = ref [] in
+  let mutex = Mutex.create () in
+  let acquire priority =
+    Mutex.lock mutex;
+    if !count > 0 then
+      decr count
+    else begin
+      let granted = ref false in
+      let cond = Condition.create () in
+      let rec insert waiters =
+        match waiters with
+          (priority', _, _ as waiter)::waiters when priority' >= priority -> waiter::insert waiters
+        | waiters -> (priority, granted, cond)::waiters
+      in
+      waiters := insert !waiters;
+      while not !granted do
+        Condition.wait cond mutex
+      done
+    end;
+    Mutex.unlock mutex
+  in
+  let release () =
+    Mutex.lock mutex;
+    begin match !waiters with
+      (_, granted, cond)::waiters' ->
+      waiters := waiters';
+      granted := true;
+      Condition.signal cond
+    | [] ->
+      incr count
+    end;
+    Mutex.unlock mutex
+  in
+  acquire, release
+
 let processes_started_counter = atomic_counter ()
 
-let acquire_run_permission, release_run_permission = semaphore !max_processes
+(* A process acquires a permission with the time it and the commands that have to wait for it are expected to take,
+   so that long chains of commands, e.g. heavy examples, are not started last. *)
+let acquire_run_permission, release_run_permission = priority_semaphore !max_processes
 
 let failed_processes_log: string list list ref = ref []
 let global_mutex = Mutex.create ()
@@ -219,10 +276,160 @@ type cmd =
 | LetCmd of loc * string * string list
 | BlockCmd of loc * bool (* parallel *) * cmd list
 
+(* The history file has a line "<seconds> <path>:<lineno>" for each command and block of the scripts. Entries are keyed by
+   script location, so editing a script only makes the scheduling less accurate until the next run updates the history. *)
+let string_of_loc (path, lineno) = Printf.sprintf "%s:%d" path lineno
+
+let history: (string, float) Hashtbl.t =
+  let history = Hashtbl.create 1000 in
+  begin match !history_path with
+    Some path when Sys.file_exists path ->
+    let file = open_in path in
+    begin try
+      while true do
+        let line = read_line_canon file in
+        match String.index_opt line ' ' with
+          Some space ->
+          begin match float_of_string_opt (String.sub line 0 space) with
+            Some duration -> Hashtbl.replace history (String.sub line (space + 1) (String.length line - space - 1)) duration
+          | None -> ()
+          end
+        | None -> ()
+      done
+    with End_of_file -> ()
+    end;
+    close_in file
+  | _ -> ()
+  end;
+  history
+
+(* Durations measured in this run, protected by [global_mutex]. A command that runs more than once, e.g. the lines of a
+   macro, gets the sum of its durations. *)
+let new_history: (string, float) Hashtbl.t = Hashtbl.create 1000
+
+let record_duration l duration =
+  let key = string_of_loc l in
+  Hashtbl.replace new_history key (duration +. Option.value ~default:0.0 (Hashtbl.find_opt new_history key))
+
+let save_history () =
+  match !history_path with
+    None -> ()
+  | Some path ->
+    Hashtbl.iter (fun key duration -> Hashtbl.replace history key duration) new_history;
+    let tmp_path = path ^ ".tmp" in
+    let file = open_out tmp_path in
+    Hashtbl.iter (fun key duration -> Printf.fprintf file "%f %s\n" duration key) history;
+    close_out file;
+    Sys.rename tmp_path path
+
+(* The expected duration of a command, or 0 if it has none yet. *)
+let expected_duration cmd =
+  match cmd with
+    LetCmd _ -> 0.0
+  | LineCmd (l, _) | BlockCmd (l, _, _) -> Option.value ~default:0.0 (Hashtbl.find_opt history (string_of_loc l))
+
 let startswith small big =
   String.length small <= String.length big &&
   String.sub big 0 (String.length small) = small
 
+type bench_result = {
+  bench_cmd: string;
+  bench_exporter: float; (* CPU time of the C++ AST exporter *)
+  bench_read: float; (* Time spent waiting for and reading the messages of the exporter *)
+  bench_transl: float; (* Time spent translating the C++ AST *)
+  bench_annotations: float; (* Time spent parsing the annotations of the C++ files *)
+  bench_verify: float; (* Everything else, mostly symbolic execution and SMT solving *)
+  bench_total: float
+}
+
+let bench_results: bench_result list ref = ref []
+
+type simplex_bench_result = {
+  simplex_bench_cmd: string;
+  simplex_bench_simplex: float; (* Time spent in Simplex *)
+  simplex_bench_prover: float; (* Time spent in Redux's query, assume, push, and pop, including Simplex *)
+  simplex_bench_total: float
+}
+
+let simplex_bench_results: simplex_bench_result list ref = ref []
+
+(* In benchmark mode, verifast commands on C++ files, or on all files for the Simplex benchmark, are run with -stats. *)
+let add_bench_flags line =
+  if startswith "verifast " line && (!simplex_bench || Str.string_match (Str.regexp {|.*\.cpp\b|}) line 0) then
+    "verifast -stats " ^ String.sub line 9 (String.length line - 9)
+  else
+    line
+
+(* Reads the timing that verifast -stats prints on the line that starts with [prefix]. *)
+let stats_timing output prefix =
+  output |> List.find_map begin fun line ->
+    if startswith prefix line && String.ends_with ~suffix:"s" line then
+      float_of_string_opt (String.sub line (String.length prefix) (String.length line - String.length prefix - 1))
+    else
+      None
+  end
+
+(* Reads the C++ frontend timings that verifast -stats prints. *)
+let parse_bench_result cmd total output =
+  let timing = stats_timing output in
+  match timing "Time spent in the C++ AST exporter: ", timing "Time spent reading C++ AST messages: ", timing "Time spent translating the C++ AST: " with
+    Some exporter, Some read, Some transl ->
+    let parsing = Option.value ~default:0.0 (timing "Time spent parsing: ") in
+    let annotations = Option.value ~default:0.0 (timing "Time spent parsing C++ annotations: ") in
+    Some {bench_cmd=cmd; bench_exporter=exporter; bench_read=read; bench_transl=transl; bench_annotations=annotations; bench_verify=total -. read -. transl -. annotations -. parsing; bench_total=total}
+  | _ -> None
+
+let print_bench_results () =
+  let results = List.sort (fun r1 r2 -> compare r1.bench_cmd r2.bench_cmd) !bench_results in
+  let print_row exporter read transl annotations verify total cmd =
+    Printf.printf "%10s %10s %10s %11s %10s %10s  %s\n" exporter read transl annotations verify total cmd
+  in
+  let print_result r =
+    let f t = Printf.sprintf "%.3f" t in
+    print_row (f r.bench_exporter) (f r.bench_read) (f r.bench_transl) (f r.bench_annotations) (f r.bench_verify) (f r.bench_total) r.bench_cmd
+  in
+  print_endline "C++ frontend benchmark (seconds):";
+  print_row "exporter" "read" "translate" "annotations" "verify" "total" "command";
+  List.iter print_result results;
+  let sum f = List.fold_left (fun t r -> t +. f r) 0.0 results in
+  print_result {
+    bench_cmd="(total)";
+    bench_exporter=sum (fun r -> r.bench_exporter);
+    bench_read=sum (fun r -> r.bench_read);
+    bench_transl=sum (fun r -> r.bench_transl);
+    bench_annotations=sum (fun r -> r.bench_annotations);
+    bench_verify=sum (fun r -> r.bench_verify);
+    bench_total=sum (fun r -> r.bench_total)
+  }
+
+(* Reads the Redux timings that verifast -stats prints. *)
+let parse_simplex_bench_result cmd total output =
+  let timing = stats_timing output in
+  match timing "Time spent in Simplex: ", timing "Time spent in query, assume, push, pop: " with
+    Some simplex, Some prover ->
+    Some {simplex_bench_cmd=cmd; simplex_bench_simplex=simplex; simplex_bench_prover=prover; simplex_bench_total=total}
+  | _ -> None
+
+let print_simplex_bench_results () =
+  let results = List.sort (fun r1 r2 -> compare r1.simplex_bench_cmd r2.simplex_bench_cmd) !simplex_bench_results in
+  let print_row simplex prover total cmd =
+    Printf.printf "%10s %10s %10s  %s\n" simplex prover total cmd
+  in
+  let print_result r =
+    let f t = Printf.sprintf "%.3f" t in
+    print_row (f r.simplex_bench_simplex) (f r.simplex_bench_prover) (f r.simplex_bench_total) r.simplex_bench_cmd
+  in
+  print_endline "Simplex benchmark (seconds):";
+  print_row "simplex" "prover" "total" "command";
+  List.iter print_result results;
+  let sum f = List.fold_left (fun t r -> t +. f r) 0.0 results in
+  print_result {
+    simplex_bench_cmd="(total)";
+    simplex_bench_simplex=sum (fun r -> r.simplex_bench_simplex);
+    simplex_bench_prover=sum (fun r -> r.simplex_bench_prover);
+    simplex_bench_total=sum (fun r -> r.simplex_bench_total)
+  }
+
 let error (path, lineno) msg =
   failwith (Printf.sprintf "mysh: %s: line %d: %s" path lineno msg)
 
@@ -268,7 +475,8 @@ let parse_file lines =
 
 let rootdir = Sys.getcwd ()
 
-let rec exec_cmds macros cwd parallel cmds =
+(* [tail] is the expected duration of the commands that can run only after [cmds] finished. *)
+let rec exec_cmds macros cwd tail parallel cmds =
   let macros = ref macros in
   let cwd = ref cwd in
   let cwdStack = ref [] in
@@ -305,10 +513,17 @@ let rec exec_cmds macros cwd parallel cmds =
     end else
       body ()
   in
-  let run_child_cmds parallel cmds =
+  let run_child_cmds l tail parallel cmds =
     let macros = !macros in
     let cwd = !cwd in
-    run_child (fun () -> exec_cmds macros cwd parallel cmds)
+    run_child begin fun () ->
+      let time0 = Unix.gettimeofday () in
+      exec_cmds macros cwd tail parallel cmds;
+      let time1 = Unix.gettimeofday () in
+      Mutex.lock global_mutex;
+      record_duration l (time1 -. time0);
+      Mutex.unlock global_mutex
+    end
   in
   let rec exec_cmds0 cmds =
   if parallel || !failed_processes_log = [] then
@@ -331,13 +546,14 @@ let rec exec_cmds macros cwd parallel cmds =
   match cmds with
     [] -> ()
   | cmd::cmds ->
+    let tail = if parallel then tail else List.fold_left (fun t cmd -> t +. expected_duration cmd) tail cmds in
     let rec exec_cmd cmd =
       if parallel || !failed_processes_log = [] then begin
       match cmd with
         LetCmd (l, macroName, lines) ->
         macros := (macroName, lines)::!macros
       | BlockCmd (l, parallel, cmds) ->
-        run_child_cmds parallel cmds
+        run_child_cmds l tail parallel cmds
       | LineCmd (l, line) ->
       let error msg = error l msg in
       let rec exec_line line =
@@ -373,51 +589,54 @@ let rec exec_cmds macros cwd parallel cmds =
         let lines = read_file_lines calleepath file in
         close_in file;
         let cmds = parse_file lines in
-        run_child_cmds false cmds
+        run_child_cmds l tail false cmds
       | [cmdName; args] when List.mem_assoc cmdName !macros ->
         List.iter (fun line -> exec_line (Printf.sprintf "%s %s" line args)) (List.assoc cmdName !macros)
       | _ ->
-        acquire_run_permission ();
-        let pid = processes_started_counter () in
-        if !verbose then do_print_line (Printf.sprintf "Starting process %d" pid);
-        let time0 = Unix.gettimeofday () in
         let cwd = getcwd () in
-        let line' = if cwd = "." then line else cwd ^ "$ " ^ line in
-        Mutex.lock global_mutex;
-        Sys.chdir (get_abs_path ".");
-        let negate_exit_status, line =
-          if line <> "" && line.[0] = '!' then
-            true, String.sub line 1 (String.length line - 1)
-          else
-            false, line
-        in
-        let expected_output, line =
-          let r = Str.regexp {|\[ "\$(\([^)]*\))" = \$'\([^']*\)' ]$|} in
-          if Str.string_match r line 0 then
-            let expected_output = Str.matched_group 2 line in
-            let line = Str.matched_group 1 line in
-            let expected_output = Str.global_replace (Str.regexp_string "\\n") "\n" expected_output in
-            Some expected_output, line
-          else
-            None, line
-        in
-        let cin = Unix.open_process_in (line ^ " 2>&1") in
-        Mutex.unlock global_mutex;
-        let current_alarm = ref None in
-        let rec produce_alarm i =
-          let runtime = i * 5 in
-          let alarm = create_alarm (time0 +. float_of_int runtime) begin fun () ->
-              Mutex.lock global_mutex;
-              print_endline (Printf.sprintf "SLOW: %s has been running for %ds" line' runtime);
-              produce_alarm (i + 1);
-              Mutex.unlock global_mutex
-            end
-          in
-          current_alarm := Some alarm
-        in
-        produce_alarm 1;
-        run_child
-          begin fun () ->
+        let abs_cwd = get_abs_path "." in
+        let priority = expected_duration cmd +. tail in
+        (* In a parallel block, the process waits for its permission in its own thread. *)
+        run_child begin fun () ->
+            acquire_run_permission priority;
+            let pid = processes_started_counter () in
+            if !verbose then do_print_line (Printf.sprintf "Starting process %d" pid);
+            let time0 = Unix.gettimeofday () in
+            let line' = if cwd = "." then line else cwd ^ "$ " ^ line in
+            Mutex.lock global_mutex;
+            Sys.chdir abs_cwd;
+            let negate_exit_status, line =
+              if line <> "" && line.[0] = '!' then
+                true, String.sub line 1 (String.length line - 1)
+              else
+                false, line
+            in
+            let expected_output, line =
+              let r = Str.regexp {|\[ "\$(\([^)]*\))" = \$'\([^']*\)' ]$|} in
+              if Str.string_match r line 0 then
+                let expected_output = Str.matched_group 2 line in
+                let line = Str.matched_group 1 line in
+                let expected_output = Str.global_replace (Str.regexp_string "\\n") "\n" expected_output in
+                Some expected_output, line
+              else
+                None, line
+            in
+            let line = if (!bench || !simplex_bench) && expected_output = None then add_bench_flags line else line in
+            let cin = Unix.open_process_in (line ^ " 2>&1") in
+            Mutex.unlock global_mutex;
+            let current_alarm = ref None in
+            let rec produce_alarm i =
+              let runtime = i * 5 in
+              let alarm = create_alarm (time0 +. float_of_int runtime) begin fun () ->
+                  Mutex.lock global_mutex;
+                  print_endline (Printf.sprintf "SLOW: %s has been running for %ds" line' runtime);
+                  produce_alarm (i + 1);
+                  Mutex.unlock global_mutex
+                end
+              in
+              current_alarm := Some alarm
+            in
+            produce_alarm 1;
             let output = ref [] in
             if !verbose then push output line';
             try
@@ -436,6 +655,7 @@ let rec exec_cmds macros cwd parallel cmds =
             let status = Unix.close_process_in cin in
             Mutex.lock global_mutex;
             let time1 = Unix.gettimeofday() in
+            record_duration l (time1 -. time0);
             if !verbose then print_endline (Printf.sprintf "[%d]%f seconds\n" pid (time1 -. time0));
             let Some alarm = !current_alarm in
             cancel_alarm alarm;
@@ -462,6 +682,16 @@ let rec exec_cmds macros cwd parallel cmds =
               print_endline msg;
               push failed_processes_log lines
             end else begin
+              if !bench then begin
+                match parse_bench_result line' (time1 -. time0) (List.rev !output) with
+                  Some result -> push bench_results result
+                | None -> ()
+              end;
+              if !simplex_bench then begin
+                match parse_simplex_bench_result line' (time1 -. time0) (List.rev !output) with
+                  Some result -> push simplex_bench_results result
+                | None -> ()
+              end;
               if !dots then
                 print_dot ()
               else
@@ -469,7 +699,7 @@ let rec exec_cmds macros cwd parallel cmds =
             end;
             Mutex.unlock global_mutex;
             release_run_permission ()
-          end
+        end
       in
       exec_line line
       end
@@ -480,13 +710,39 @@ let rec exec_cmds macros cwd parallel cmds =
   exec_cmds0 cmds;
   join_children ()
 
+(* Starts the exporter daemon next to this executable, which the verifast commands find through VF_CXX_EXPORT_DAEMON,
+   and stops it at exit. Nothing is started on Windows or if the exporter was not built. *)
+let start_cxx_exporter_daemon () =
+  let exporter = Filename.concat (Filename.dirname Sys.executable_name) "vf-cxx-ast-exporter" in
+  if Vfconfig.platform <> Windows && Sys.file_exists exporter then begin
+    let socket = Filename.concat (Filename.get_temp_dir_name ()) (Printf.sprintf "vf-cxx-exporter-%d.sock" (Unix.getpid ())) in
+    let devnull = Unix.openfile "/dev/null" [Unix.O_RDONLY] 0 in
+    let pid = Unix.create_process exporter [|exporter; "-listen=" ^ socket|] devnull Unix.stdout Unix.stderr in
+    Unix.close devnull;
+    at_exit begin fun () ->
+      (try Unix.kill pid Sys.sigterm with Unix.Unix_error _ -> ());
+      ignore (Unix.waitpid [] pid);
+      try Sys.remove socket with Sys_error _ -> ()
+    end;
+    (* verifast starts the exporter itself while it cannot connect to the daemon, so this only avoids that for the first commands. *)
+    let rec wait_for_socket n =
+      if n > 0 && not (Sys.file_exists socket) then begin Unix.sleepf 0.01; wait_for_socket (n - 1) end
+    in
+    wait_for_socket 500;
+    Unix.putenv "VF_CXX_EXPORT_DAEMON" socket
+  end
+
 let () =
   let time0 = Unix.gettimeofday() in
+  if !cxx_exporter_daemon then start_cxx_exporter_daemon ();
   let lines = read_file_lines !main_filename !main_file in
   let cmds = parse_file lines in
-  exec_cmds [] "." false cmds;
+  exec_cmds [] "." 0.0 false cmds;
   let time1 = Unix.gettimeofday() in
   Printf.printf "Total execution time: %f seconds\n" (time1 -. time0);
+  save_history ();
+  if !bench then print_bench_results ();
+  if !simplex_bench then print_simplex_bench_results ();
   List.rev !failed_processes_log |> List.iter begin fun lines ->
     print_newline ();
     List.iter print_endline lines
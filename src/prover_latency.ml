@@ -0,0 +1,98 @@
+(* This file defines a prover that forwards every call to another prover
+   and records the time taken by the calls that may search, i.e. the
+   assumptions, queries and assertions, and the pushes and pops, in the
+   latency histograms of the statistics, per prover and kind of call.
+   VeriFast uses it when given -stats, so that the statistics tell
+   whether a slow proof makes many cheap calls or a few expensive ones,
+   and when given -profile_locations, which also charges the time of
+   every call to the statement being verified.
+
+   The time of an asynchronous call is the time of the call plus the
+   time spent waiting for its answer. *)
+
+open Proverapi
+
+class ['typenode, 'symbol, 'termnode] latency_context (prover : string) (p : ('typenode, 'symbol, 'termnode) context) =
+  let timed call f =
+    let ticks0 = Stopwatch.processor_ticks () in
+    let result = f () in
+    !Stats.stats#proverLatency prover call (Int64.to_int (Int64.sub (Stopwatch.processor_ticks ()) ticks0));
+    result
+  in
+  let timed_async call f =
+    let ticks0 = Stopwatch.processor_ticks () in
+    let answer = f () in
+    let ticks = Int64.sub (Stopwatch.processor_ticks ()) ticks0 in
+    fun () ->
+      let ticks1 = Stopwatch.processor_ticks () in
+      let result = answer () in
+      !Stats.stats#proverLatency prover call (Int64.to_int (Int64.add ticks (Int64.sub (Stopwatch.processor_ticks ()) ticks1)));
+      result
+  in
+object
+  method set_verbosity v = p#set_verbosity v
+  method type_bool = p#type_bool
+  method type_int = p#type_int
+  method type_real = p#type_real
+  method type_inductive = p#type_inductive
+  method mk_boxed_int = p#mk_boxed_int
+  method mk_unboxed_int = p#mk_unboxed_int
+  method mk_boxed_real = p#mk_boxed_real
+  method mk_unboxed_real = p#mk_unboxed_real
+  method mk_boxed_bool = p#mk_boxed_bool
+  method mk_unboxed_bool = p#mk_unboxed_bool
+  method mk_symbol = p#mk_symbol
+  method set_fpclauses = p#set_fpclauses
+  method mk_app = p#mk_app
+  method mk_apps = p#mk_apps
+  method mk_true = p#mk_true
+  method mk_false = p#mk_false
+  method mk_and = p#mk_and
+  method mk_or = p#mk_or
+  method mk_not = p#mk_not
+  method mk_ifthenelse = p#mk_ifthenelse
+  method mk_iff = p#mk_iff
+  method mk_implies = p#mk_implies
+  method mk_eq = p#mk_eq
+  method mk_intlit = p#mk_intlit
+  method mk_intlit_of_string = p#mk_intlit_of_string
+  method mk_add = p#mk_add
+  method mk_sub = p#mk_sub
+  method mk_mul = p#mk_mul
+  method mk_div = p#mk_div
+  method mk_mod = p#mk_mod
+  method mk_lt = p#mk_lt
+  method mk_le = p#mk_le
+  method mk_reallit = p#mk_reallit
+  method mk_reallit_of_num = p#mk_reallit_of_num
+  method mk_real_add = p#mk_real_add
+  method mk_real_sub = p#mk_real_sub
+  method mk_real_mul = p#mk_real_mul
+  method mk_real_lt = p#mk_real_lt
+  method mk_real_le = p#mk_real_le
+  method pprint = p#pprint
+  method pprint_sort = p#pprint_sort
+  method pprint_sym = p#pprint_sym
+  method push = timed "push" (fun () -> p#push)
+  method pop = timed "pop" (fun () -> p#pop)
+  method snapshot = p#snapshot
+  method restore h = timed "restore" (fun () -> p#restore h)
+  method assert_term t = timed "assert_term" (fun () -> p#assert_term t)
+  method assume t = timed "assume" (fun () -> p#assume t)
+  method assume_all ts = timed "assume_all" (fun () -> p#assume_all ts)
+  method query t = timed "query" (fun () -> p#query t)
+  method assume_async t = timed_async "assume_async" (fun () -> p#assume_async t)
+  method query_async t = timed_async "query_async" (fun () -> p#query_async t)
+  method stats = p#stats
+  method begin_formal = p#begin_formal
+  method end_formal = p#end_formal
+  method mk_bound = p#mk_bound
+  method assume_forall description triggers tps body =
+    timed "assume_forall" (fun () -> p#assume_forall description triggers tps body)
+  method simplify = p#simplify
+end
+
+(** [wrap prover p] returns a prover that forwards every call to [p] and records the latencies of its
+    calls under the name [prover]. *)
+let wrap (prover : string) (p : ('typenode, 'symbol, 'termnode) context) : ('typenode, 'symbol, 'termnode) context =
+  (new latency_context prover p : ('typenode, 'symbol, 'termnode) latency_context :> ('typenode, 'symbol, 'termnode) context)
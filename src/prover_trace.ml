@@ -0,0 +1,374 @@
+(* This file defines a prover that forwards every call to another prover
+   following the prover API defined in proverapi.ml and records the
+   calls to a trace file, and a function that replays such a trace
+   against any prover. VeriFast writes a trace per run when given
+   -dump_smt_queries; vfreplay replays traces to compare provers, or
+   versions of a prover, on the queries of real programs without
+   running the frontend.
+
+   A trace is a sequence of marshalled events. Every symbol and term is
+   given an id by the event that creates it and is referred to by that
+   id in later events. The events of a function body are preceded by a
+   Segment event that names the function, so that a replay can be timed
+   per function. *)
+
+open Proverapi
+
+type sort = Bool | Int | Real | Inductive
+
+type op =
+  | BoxedInt | UnboxedInt | BoxedReal | UnboxedReal | BoxedBool | UnboxedBool
+  | True | False | And | Or | Not | IfThenElse | Iff | Implies | Eq
+  | Add | Sub | Mul | Div | Mod | Lt | Le
+  | RealAdd | RealSub | RealMul | RealLt | RealLe
+
+type term =
+  | Op of op * int list
+  | App of int * int list
+  | IntLit of int
+  | IntLitOfString of string
+  | RealLit of int
+  | RealLitOfNum of Num.num
+  | Bound of int * sort
+  | Param of int (* argument of a fixpoint clause: the arguments of the
+                    function come first, then those of the constructor *)
+
+type event =
+  | Symbol of int * string * sort list * sort * symbol_kind
+  | Term of int * term
+  | Fpclauses of int * int * (int * clause option) list
+    (* None if the clause could not be recorded, see set_fpclauses *)
+  | Push
+  | Pop
+  | Snapshot of int
+  | Restore of int
+  | Assert of int
+  | Assume of int * assume_result
+  | Query of int * bool
+  | AssumeForall of string * int list * sort list * int
+  | BeginFormal
+  | EndFormal
+  | Simplify of int * int option
+  | Segment of string
+and clause = {
+  events: event list; (* Term events that compute the body *)
+  body: int
+}
+
+type 'typenode sort_node = {sort: sort; sort_inner: 'typenode}
+type 'symbol symbol_node = {symbol_id: int; symbol_arity: int; symbol_inner: 'symbol}
+(* The inner term is None for the terms that are built from the
+   parameters of a fixpoint clause while it is recorded. *)
+type 'termnode term_node = {term_id: int; term_inner: 'termnode option}
+
+(* Called when VeriFast starts verifying a function; records a Segment
+   event if a trace is being written. *)
+let begin_segment_hook : (string -> unit) ref = ref (fun _ -> ())
+let begin_segment name = !begin_segment_hook name
+
+let inner t =
+  match t.term_inner with
+    Some t -> t
+  | None -> failwith "Prover_trace: a fixpoint clause parameter was used outside the clause"
+
+let inners ts =
+  List.fold_right
+    (fun t acc -> match t.term_inner, acc with Some x, Some xs -> Some (x::xs) | _ -> None)
+    ts (Some [])
+
+class ['typenode, 'symbol, 'termnode] recording_context (output : out_channel)
+        (p : ('typenode, 'symbol, 'termnode) context) =
+  let last_id = ref 0 in
+  let fresh_id () = incr last_id; !last_id in
+  (* While the body of a fixpoint clause is recorded, its events. *)
+  let clause_events : event list ref option ref = ref None in
+  (* While the prover evaluates a fixpoint clause, the terms it builds
+     are not recorded; a replay evaluates the recorded clause instead. *)
+  let evaluating_clause = ref 0 in
+  let record e =
+    match !clause_events with
+      Some es -> es := e::!es
+    | None -> output_value output e
+  in
+  let term t term_inner =
+    if !evaluating_clause > 0 then
+      {term_id = -1; term_inner}
+    else begin
+      let term_id = fresh_id () in
+      record (Term (term_id, t));
+      {term_id; term_inner}
+    end
+  in
+  let const o t = term (Op (o, [])) (Some t) in
+  let map1 o f a = term (Op (o, [a.term_id])) (Option.map f a.term_inner) in
+  let map2 o f a b =
+    term (Op (o, [a.term_id; b.term_id]))
+      (match a.term_inner, b.term_inner with Some x, Some y -> Some (f x y) | _ -> None)
+  in
+  let map3 o f a b c =
+    term (Op (o, [a.term_id; b.term_id; c.term_id]))
+      (match a.term_inner, b.term_inner, c.term_inner with Some x, Some y, Some z -> Some (f x y z) | _ -> None)
+  in
+  let sort_node sort sort_inner = {sort; sort_inner} in
+  let () =
+    begin_segment_hook := (fun name -> output_value output (Segment name); flush output);
+    at_exit (fun () -> close_out output)
+  in
+object (self)
+  method set_verbosity v = p#set_verbosity v
+  method type_bool = sort_node Bool p#type_bool
+  method type_int = sort_node Int p#type_int
+  method type_real = sort_node Real p#type_real
+  method type_inductive = sort_node Inductive p#type_inductive
+  method mk_boxed_int = map1 BoxedInt p#mk_boxed_int
+  method mk_unboxed_int = map1 UnboxedInt p#mk_unboxed_int
+  method mk_boxed_real = map1 BoxedReal p#mk_boxed_real
+  method mk_unboxed_real = map1 UnboxedReal p#mk_unboxed_real
+  method mk_boxed_bool = map1 BoxedBool p#mk_boxed_bool
+  method mk_unboxed_bool = map1 UnboxedBool p#mk_unboxed_bool
+  method mk_symbol name domain range kind =
+    let symbol_inner = p#mk_symbol name (List.map (fun s -> s.sort_inner) domain) range.sort_inner kind in
+    let symbol_id = fresh_id () in
+    (* Symbols are never part of a clause; a replay creates them once. *)
+    output_value output (Symbol (symbol_id, name, List.map (fun s -> s.sort) domain, range.sort, kind));
+    {symbol_id; symbol_arity = List.length domain; symbol_inner}
+  method set_fpclauses fc k cs =
+    (* The body of a clause is recorded by applying it to parameter
+       terms. A body that needs the terms of the prover cannot be
+       recorded; a replay then leaves its constructor without a clause. *)
+    let record_clause (c, fbody) =
+      let param i = term (Param i) None in
+      let n = fc.symbol_arity in
+      let events = ref [] in
+      let clause_events0 = !clause_events in
+      clause_events := Some events;
+      let body =
+        Fun.protect ~finally:(fun () -> clause_events := clause_events0) @@ fun () ->
+        try
+          let fargs = List.init n param in
+          let cargs = List.init c.symbol_arity (fun i -> param (n + i)) in
+          Some (fbody fargs cargs).term_id
+        with Failure _ -> None
+      in
+      (c.symbol_id, Option.map (fun body -> {events = List.rev !events; body}) body)
+    in
+    record (Fpclauses (fc.symbol_id, k, List.map record_clause cs));
+    let wrap = List.map (fun t -> {term_id = -1; term_inner = Some t}) in
+    p#set_fpclauses fc.symbol_inner k
+      (cs |> List.map begin fun (c, fbody) ->
+         (c.symbol_inner, fun fargs cargs ->
+            incr evaluating_clause;
+            Fun.protect ~finally:(fun () -> decr evaluating_clause) @@ fun () ->
+            inner (fbody (wrap fargs) (wrap cargs)))
+       end)
+  method mk_app s ts =
+    term (App (s.symbol_id, List.map (fun t -> t.term_id) ts)) (Option.map (p#mk_app s.symbol_inner) (inners ts))
+  method mk_apps apps = Array.map (fun (s, ts) -> self#mk_app s ts) apps
+  method mk_true = const True p#mk_true
+  method mk_false = const False p#mk_false
+  method mk_and = map2 And p#mk_and
+  method mk_or = map2 Or p#mk_or
+  method mk_not = map1 Not p#mk_not
+  method mk_ifthenelse = map3 IfThenElse p#mk_ifthenelse
+  method mk_iff = map2 Iff p#mk_iff
+  method mk_implies = map2 Implies p#mk_implies
+  method mk_eq = map2 Eq p#mk_eq
+  method mk_intlit n = term (IntLit n) (Some (p#mk_intlit n))
+  method mk_intlit_of_string s = term (IntLitOfString s) (Some (p#mk_intlit_of_string s))
+  method mk_add = map2 Add p#mk_add
+  method mk_sub = map2 Sub p#mk_sub
+  method mk_mul = map2 Mul p#mk_mul
+  method mk_div = map2 Div p#mk_div
+  method mk_mod = map2 Mod p#mk_mod
+  method mk_lt = map2 Lt p#mk_lt
+  method mk_le = map2 Le p#mk_le
+  method mk_reallit n = term (RealLit n) (Some (p#mk_reallit n))
+  method mk_reallit_of_num n = term (RealLitOfNum n) (Some (p#mk_reallit_of_num n))
+  method mk_real_add = map2 RealAdd p#mk_real_add
+  method mk_real_sub = map2 RealSub p#mk_real_sub
+  method mk_real_mul = map2 RealMul p#mk_real_mul
+  method mk_real_lt = map2 RealLt p#mk_real_lt
+  method mk_real_le = map2 RealLe p#mk_real_le
+  method pprint t = match t.term_inner with Some t -> p#pprint t | None -> "<clause parameter>"
+  method pprint_sort s = p#pprint_sort s.sort_inner
+  method pprint_sym s = p#pprint_sym s.symbol_inner
+  method push = record Push; p#push
+  method pop = record Pop; p#pop
+  method snapshot = let h = p#snapshot in record (Snapshot h); h
+  method restore h = record (Restore h); p#restore h
+  method assert_term t = record (Assert t.term_id); p#assert_term (inner t)
+  method assume t = let r = p#assume (inner t) in record (Assume (t.term_id, r)); r
+  (* Recorded as separate assumptions, so a replay makes the same calls
+     against provers that check every assumption. *)
+  method assume_all ts =
+    let rec iter i = if i = Array.length ts then Unknown else match self#assume ts.(i) with Unsat -> Unsat | Unknown -> iter (i + 1) in
+    iter 0
+  method query t = let r = p#query (inner t) in record (Query (t.term_id, r)); r
+  (* The answer is recorded with the event, so a trace is written with
+     the prover answering synchronously. *)
+  method assume_async t = let r = p#assume (inner t) in record (Assume (t.term_id, r)); fun () -> r
+  method query_async t = let r = p#query (inner t) in record (Query (t.term_id, r)); fun () -> r
+  method stats = p#stats
+  method begin_formal = record BeginFormal; p#begin_formal
+  method end_formal = record EndFormal; p#end_formal
+  method mk_bound i s = term (Bound (i, s.sort)) (Some (p#mk_bound i s.sort_inner))
+  method assume_forall description triggers tps body =
+    record (AssumeForall (description, List.map (fun t -> t.term_id) triggers, List.map (fun s -> s.sort) tps, body.term_id));
+    p#assume_forall description (List.map inner triggers) (List.map (fun s -> s.sort_inner) tps) (inner body)
+  method simplify t =
+    match Option.bind t.term_inner p#simplify with
+      None ->
+      if !evaluating_clause = 0 then record (Simplify (t.term_id, None));
+      None
+    | Some t' ->
+      if !evaluating_clause > 0 then Some {term_id = -1; term_inner = Some t'} else begin
+        let term_id = fresh_id () in
+        record (Simplify (t.term_id, Some term_id));
+        Some {term_id; term_inner = Some t'}
+      end
+end
+
+(** [record dir path p] returns a prover that forwards every call to [p] and writes a trace of the calls
+    to a new file in directory [dir], named after program [path]. *)
+let record dir path (p : ('typenode, 'symbol, 'termnode) context)
+    : ('typenode sort_node, 'symbol symbol_node, 'termnode term_node) context =
+  if not (Sys.file_exists dir) then Sys.mkdir dir 0o777;
+  let file = Filename.concat dir (Printf.sprintf "%s.%d.vftrace" (Filename.basename path) (Unix.getpid ())) in
+  (new recording_context (open_out_bin file) p
+   : ('typenode, 'symbol, 'termnode) recording_context :> ('typenode sort_node, 'symbol symbol_node, 'termnode term_node) context)
+
+let read_trace file : event list =
+  let input = open_in_bin file in
+  Fun.protect ~finally:(fun () -> close_in input) @@ fun () ->
+  let rec iter events =
+    match (input_value input : event) with
+      e -> iter (e::events)
+    | exception End_of_file -> List.rev events
+  in
+  iter []
+
+(** Time a replay spent on the events of a segment, and the number of
+    assumptions and queries among them that were answered differently
+    than when the trace was recorded. *)
+type segment_result = {
+  segment: string;
+  time: float;
+  checks: int;
+  disagreements: int
+}
+
+(** [replay p events] replays [events] against prover [p] and returns a result per segment, in order. The
+    events before the first segment form a segment named ["(declarations)"]. *)
+let replay (p : ('typenode, 'symbol, 'termnode) context) (events : event list) : segment_result list =
+  let symbols : (int, 'symbol) Hashtbl.t = Hashtbl.create 1000 in
+  let terms : (int, 'termnode) Hashtbl.t = Hashtbl.create 100000 in
+  let snapshots : (int, int) Hashtbl.t = Hashtbl.create 100 in
+  let subtypes : (int, InductiveSubtype.t) Hashtbl.t = Hashtbl.create 100 in
+  let subtype s =
+    let k = InductiveSubtype.to_int s in
+    match Hashtbl.find_opt subtypes k with
+      Some s -> s
+    | None -> let s = InductiveSubtype.alloc () in Hashtbl.add subtypes k s; s
+  in
+  let kind = function
+    Ctor (CtorByOrdinal (s, k)) -> Ctor (CtorByOrdinal (subtype s, k))
+  | Fixpoint (s, k) -> Fixpoint (subtype s, k)
+  | kind -> kind
+  in
+  let sort = function
+    Bool -> p#type_bool
+  | Int -> p#type_int
+  | Real -> p#type_real
+  | Inductive -> p#type_inductive
+  in
+  let eval lookup = function
+    Op (o, ts) ->
+    begin match o, List.map lookup ts with
+      BoxedInt, [t] -> p#mk_boxed_int t
+    | UnboxedInt, [t] -> p#mk_unboxed_int t
+    | BoxedReal, [t] -> p#mk_boxed_real t
+    | UnboxedReal, [t] -> p#mk_unboxed_real t
+    | BoxedBool, [t] -> p#mk_boxed_bool t
+    | UnboxedBool, [t] -> p#mk_unboxed_bool t
+    | True, [] -> p#mk_true
+    | False, [] -> p#mk_false
+    | And, [t1; t2] -> p#mk_and t1 t2
+    | Or, [t1; t2] -> p#mk_or t1 t2
+    | Not, [t] -> p#mk_not t
+    | IfThenElse, [t1; t2; t3] -> p#mk_ifthenelse t1 t2 t3
+    | Iff, [t1; t2] -> p#mk_iff t1 t2
+    | Implies, [t1; t2] -> p#mk_implies t1 t2
+    | Eq, [t1; t2] -> p#mk_eq t1 t2
+    | Add, [t1; t2] -> p#mk_add t1 t2
+    | Sub, [t1; t2] -> p#mk_sub t1 t2
+    | Mul, [t1; t2] -> p#mk_mul t1 t2
+    | Div, [t1; t2] -> p#mk_div t1 t2
+    | Mod, [t1; t2] -> p#mk_mod t1 t2
+    | Lt, [t1; t2] -> p#mk_lt t1 t2
+    | Le, [t1; t2] -> p#mk_le t1 t2
+    | RealAdd, [t1; t2] -> p#mk_real_add t1 t2
+    | RealSub, [t1; t2] -> p#mk_real_sub t1 t2
+    | RealMul, [t1; t2] -> p#mk_real_mul t1 t2
+    | RealLt, [t1; t2] -> p#mk_real_lt t1 t2
+    | RealLe, [t1; t2] -> p#mk_real_le t1 t2
+    | _ -> failwith "Prover_trace.replay: operator applied to the wrong number of terms"
+    end
+  | App (s, ts) -> p#mk_app (Hashtbl.find symbols s) (List.map lookup ts)
+  | IntLit n -> p#mk_intlit n
+  | IntLitOfString s -> p#mk_intlit_of_string s
+  | RealLit n -> p#mk_reallit n
+  | RealLitOfNum n -> p#mk_reallit_of_num n
+  | Bound (i, s) -> p#mk_bound i (sort s)
+  | Param _ -> failwith "Prover_trace.replay: clause parameter outside a clause"
+  in
+  let lookup id = Hashtbl.find terms id in
+  let clause {events; body} fargs cargs =
+    let params = Array.of_list (fargs @ cargs) in
+    let locals = Hashtbl.create 16 in
+    let lookup id = match Hashtbl.find_opt locals id with Some t -> t | None -> lookup id in
+    events |> List.iter (function
+        Term (id, Param i) -> Hashtbl.replace locals id params.(i)
+      | Term (id, t) -> Hashtbl.replace locals id (eval lookup t)
+      | _ -> ());
+    lookup body
+  in
+  let results = ref [] in
+  let segment = ref "(declarations)" in
+  let time0 = ref (Unix.gettimeofday ()) in
+  let checks = ref 0 in
+  let disagreements = ref 0 in
+  let end_segment () =
+    results := {segment = !segment; time = Unix.gettimeofday () -. !time0; checks = !checks; disagreements = !disagreements}::!results
+  in
+  let check agrees = incr checks; if not agrees then incr disagreements in
+  events |> List.iter begin function
+    Symbol (id, name, domain, range, k) ->
+    Hashtbl.replace symbols id (p#mk_symbol name (List.map sort domain) (sort range) (kind k))
+  | Term (id, t) -> Hashtbl.replace terms id (eval lookup t)
+  | Fpclauses (fc, k, cs) ->
+    let cs = cs |> List.filter_map (fun (c, cl) -> Option.map (fun cl -> (Hashtbl.find symbols c, clause cl)) cl) in
+    p#set_fpclauses (Hashtbl.find symbols fc) k cs
+  | Push -> p#push
+  | Pop -> p#pop
+  | Snapshot h -> Hashtbl.replace snapshots h p#snapshot
+  | Restore h -> p#restore (Hashtbl.find snapshots h)
+  | Assert t -> p#assert_term (lookup t)
+  | Assume (t, r) -> check (p#assume (lookup t) = r)
+  | Query (t, r) -> check (p#query (lookup t) = r)
+  | AssumeForall (description, triggers, tps, body) ->
+    p#assume_forall description (List.map lookup triggers) (List.map sort tps) (lookup body)
+  | BeginFormal -> p#begin_formal
+  | EndFormal -> p#end_formal
+  | Simplify (t, result) ->
+    let t = lookup t in
+    (* If this prover does not simplify the term, later events use the term itself. *)
+    Option.iter (fun id -> Hashtbl.replace terms id (Option.value (p#simplify t) ~default:t)) result
+  | Segment name ->
+    end_segment ();
+    segment := name;
+    time0 := Unix.gettimeofday ();
+    checks := 0;
+    disagreements := 0
+  end;
+  end_segment ();
+  List.rev !results
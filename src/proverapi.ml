@@ -63,6 +63,8 @@ class virtual ['typenode, 'symbol, 'termnode] context =
     method virtual mk_symbol: string -> 'typenode list -> 'typenode -> symbol_kind -> 'symbol
     method virtual set_fpclauses: 'symbol -> int -> ('symbol * ('termnode list -> 'termnode list -> 'termnode)) list -> unit
     method virtual mk_app: 'symbol -> 'termnode list -> 'termnode
+    (* Like [mk_app] for every application in turn. *)
+    method virtual mk_apps: ('symbol * 'termnode list) array -> 'termnode array
     method virtual mk_true: 'termnode
     method virtual mk_false: 'termnode
     method virtual mk_and: 'termnode -> 'termnode -> 'termnode
@@ -97,9 +99,18 @@ class virtual ['typenode, 'symbol, 'termnode] context =
     method virtual pprint_sym: 'symbol -> string
     method virtual push: unit
     method virtual pop: unit
+    (* Pushes a frame and returns a handle to the state it was pushed on. *)
+    method virtual snapshot: int
+    (* Pops the frames pushed since the given snapshot, including its own, and pushes a fresh one, so that the state is again the one of the snapshot. *)
+    method virtual restore: int -> unit
     method virtual assert_term: 'termnode -> unit
     method virtual assume: 'termnode -> assume_result
+    (* Like [assume] for every term in turn, stopping at the first Unsat, but a prover need only check the assumptions once, after the last one. *)
+    method virtual assume_all: 'termnode array -> assume_result
     method virtual query: 'termnode -> bool
+    (* Like [assume] and [query], but return a function that waits for the answer. A prover that runs in another process works on the term while this process does other work; other provers answer right away. The answer need not be awaited. *)
+    method virtual assume_async: 'termnode -> (unit -> assume_result)
+    method virtual query_async: 'termnode -> (unit -> bool)
     method virtual stats: string * (string * int64) list
     method virtual begin_formal: unit
     method virtual end_formal: unit
@@ -107,3 +118,17 @@ class virtual ['typenode, 'symbol, 'termnode] context =
     method virtual assume_forall: string (* description for diagnostic traces *) -> 'termnode list -> ('typenode) list -> 'termnode -> unit
     method virtual simplify: 'termnode -> 'termnode option
   end
+
+(* Adaptive prover selection. A prover that combines two provers adaptively
+   (see Combineprovers.Adaptive) sets [adaptive_selection]; VeriFast then sets
+   [prover_preference] before it verifies a function body, from the times the
+   provers took for it before, as recorded in the verification cache. With
+   [PreferNone], both provers answer every call and their times are added to
+   [prover_times]; VeriFast only asks for that when it can record the times.
+   Otherwise, e.g. without a verification cache, the first prover is
+   preferred, so the provers are combined as by Sequence. *)
+type prover_preference = PreferFirst | PreferSecond | PreferNone
+
+let adaptive_selection = ref false
+let prover_preference = ref PreferFirst
+let prover_times = ref (0.0, 0.0)
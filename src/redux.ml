@@ -803,6 +803,9 @@ and context () =
     val int_mod_symbol = new symbol Uninterp "%"
 
     val mutable numnodes: termnode NumMap.t = NumMap.empty (* Sorted *)
+    (* Application nodes by the ids of their symbol and of the values of their children when they were created; see get_node.
+       An entry is removed when the frame in which its node was created is popped. *)
+    val appnodes: (int * int list, termnode) Hashtbl.t = Hashtbl.create 4096
     val mutable ttrue = None
     val mutable tfalse = None
     val simplex = Simplex.new_simplex ()
@@ -829,7 +832,7 @@ and context () =
     val mutable simplex_assert_ge_count = 0
     val mutable simplex_assert_eq_count = 0
     val mutable simplex_assert_neq_count = 0
-    val mutable axioms: (string * int ref) list = []
+    val mutable axioms: (string * int ref * int ref) list = [] (* description, times triggered, match attempts *)
     val assumes_with_pending_splits = Array.make 30 0
     val mutable assumes_with_more_pending_splits = 0
     
@@ -850,12 +853,12 @@ and context () =
     method reportExportingConstant =
       simplex_assert_eq_count <- simplex_assert_eq_count + 1
     method stats =
-      let axiomTriggerCounts = axioms |> List.filter (fun (k, v) -> !v > 0) in
-      let maxAxiomNameLength = List.fold_left (fun n (k, v) -> max n (String.length k)) 0 axiomTriggerCounts in
+      let axiomTriggerCounts = axioms |> List.filter (fun (k, v, attempts) -> !attempts > 0) in
+      let maxAxiomNameLength = List.fold_left (fun n (k, v, attempts) -> max n (String.length k)) 0 axiomTriggerCounts in
       let axiomTriggerCounts =
         axiomTriggerCounts
-          |> List.sort (fun (k1, v1) (k2, v2) -> compare !v1 !v2)
-          |> List.map (fun (k, v) -> Printf.sprintf "    %-*s %5d\n" maxAxiomNameLength k !v)
+          |> List.sort (fun (k1, v1, attempts1) (k2, v2, attempts2) -> compare (!v1, !attempts1) (!v2, !attempts2))
+          |> List.map (fun (k, v, attempts) -> Printf.sprintf "    %-*s %5d %8d\n" maxAxiomNameLength k !v !attempts)
           |> String.concat ""
       in
       let assumesWithPendingSplits =
@@ -879,7 +882,7 @@ and context () =
           simplex_assert_neq_count = %d\n\
           max_truenode_childcount = %d\n\
           max_falsenode_childcount = %d\n\
-          axiom triggered counts:\n%s\n\
+          axiom triggered counts and match attempts:\n%s\n\
         "
         pendingSplitsInfo
         assume_core_count
@@ -1141,6 +1144,30 @@ and context () =
       if verbosity > 0 then begin let time1 = Perf.time() in trace_exiting "Redux.assume: %.6f seconds" (time1 -. time0) end;
       result
 
+    (* Performs the pending splits once, after the last term. *)
+    method assume_all (ts: (symbol, termnode) term array): assume_result =
+      let time0 = if verbosity > 0 then begin trace_entering "Redux.assume_all(%d terms)" (Array.length ts); Perf.time() end else 0.0 in
+      Stopwatch.start stopwatch;
+      self#register_pending_splits_count;
+      let rec iter i =
+        if unsat then Unsat3 else
+        if i = Array.length ts then Unknown3 else
+        match self#assume_with_implications ts.(i) with
+          Unsat3 -> Unsat3
+        | Valid3 | Unknown3 -> iter (i + 1)
+      in
+      let result =
+        match iter 0 with
+          Unsat3 -> Unsat
+        | _ -> if self#perform_pending_splits (fun _ -> false) then Unsat else Unknown
+      in
+      Stopwatch.stop stopwatch;
+      if verbosity > 0 then begin let time1 = Perf.time() in trace_exiting "Redux.assume_all: %.6f seconds" (time1 -. time0) end;
+      result
+
+    method assume_async t = let result = self#assume t in fun () -> result
+    method query_async t = let result = self#query t in fun () -> result
+
     method query (t: (symbol, termnode) term): bool =
       if verbosity > 0 then trace_entering "Redux.query(%s)" (self#pprint t);
       Stopwatch.start stopwatch;
@@ -1215,6 +1242,15 @@ and context () =
       popactionlist <- [];
       simplex#push
     
+    method snapshot =
+      self#push;
+      pushdepth
+
+    method restore depth =
+      if pushdepth < depth then failwith "Snapshot has been popped";
+      while pushdepth >= depth do self#pop done;
+      self#push
+
     method register_popaction action =
       popactionlist <- action::popactionlist
 
@@ -1397,6 +1433,9 @@ and context () =
           None
       in
       App (s, ts, termnode)
+
+    method mk_apps (apps: (symbol * (symbol, termnode) term list) array): (symbol, termnode) term array =
+      Array.map (fun (s, ts) -> self#mk_app s ts) apps
     
     method pprint (t: (symbol, termnode) term): string =
       match t with
@@ -1437,10 +1476,18 @@ and context () =
         | Some n -> n
         end
       | v::_ ->
+        (* Popular values, like small numbers and null, have many parents, so they are not scanned unless the node is not
+           found by its key. The children of a node change when their values are merged, so a hit is checked. *)
+        let key = (Oo.id s, List.map Oo.id vs) in
+        match Hashtbl.find_opt appnodes key with
+          Some n when n#matches [s] vs -> n
+        | _ ->
         begin
         match v#lookup_parent [s] vs with
           None ->
           let node = new termnode (self :> context) s vs in
+          Hashtbl.add appnodes key node;
+          self#register_popaction (fun () -> Hashtbl.remove appnodes key);
           node
         | Some n -> n
         end
@@ -1755,12 +1802,16 @@ and context () =
       if pats = [] then failwith (Printf.sprintf "Redux could not find suitable triggers for axiom %s" (self#pprint body));
       (* printff "Axiom (%s) %s asserted\n" (String.concat ", " (List.map self#pprint pats)) (self#pprint body); *)
       let triggeredCounter = ref 0 in
-      axioms <- (description, triggeredCounter)::axioms;
+      let attemptCounter = ref 0 in
+      axioms <- (description, triggeredCounter, attemptCounter)::axioms;
       pats |> List.iter (fun pat ->
         match pat with
           App (symb, args, _) ->
-          (* We ignore existing applications of this symbol for now. *)
+          (* We ignore existing applications of this symbol for now. The listener is registered with the
+             trigger's head symbol, so constructing a term only attempts the axioms whose trigger has the
+             term's symbol at its head. *)
           symb#add_apply_listener (self :> context) (fun term ->
+            incr attemptCounter;
             (* printff "Axiom %s: toplevel symbol listener triggered\n" (self#pprint body); *)
             let rec match_pats bound_env oldvals pats cont =
               match (oldvals, pats) with
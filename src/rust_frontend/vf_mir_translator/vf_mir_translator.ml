@@ -668,6 +668,9 @@ module Make (Args : VF_MIR_TRANSLATOR_ARGS) = struct
     let cpos = IntAux.Uint64.try_add cpos Stdint.Uint64.one in
     cpos
 
+  (* Every Loc embeds its file name, so consecutive positions in the same file share its path. *)
+  let srcpos_cache = Srcpos_cache.create ~equal:String.equal ~path_of:Fun.id ""
+
   let translate_loc (loc_cpn : LocRd.t) =
     let open LocRd in
     let file_cpn = file_get loc_cpn in
@@ -677,8 +680,7 @@ module Make (Args : VF_MIR_TRANSLATOR_ARGS) = struct
     let* col = translate_char_pos col_cpn in
     let* line = IntAux.Uint64.try_to_int line in
     let* col = IntAux.Uint64.try_to_int col in
-    let src_pos = (file, line, col) in
-    Ok src_pos
+    Ok (Srcpos_cache.srcpos srcpos_cache file line col)
 
   let translate_span_data (span_cpn : SpanDataRd.t) =
     let open SpanDataRd in
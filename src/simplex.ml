@@ -37,12 +37,17 @@ class ['tag] unknown (context: 'tag simplex) (name: string) (restricted: bool) (
 and ['tag] coeff (context: 'tag simplex) v =
   object (self)
     val mutable value: num = v
+    val mutable saved_frame = -1 (* The frame whose pop restores the value; see simplex#frame. *)
     
     method value = value
     method set_value_no_undo v = value <- v
     method set_value v =
-      let oldvalue = value in
-      context#register_popaction (fun () -> value <- oldvalue);
+      if saved_frame <> context#frame then begin
+        let oldvalue = value in
+        let old_saved_frame = saved_frame in
+        context#register_popaction (fun () -> value <- oldvalue; saved_frame <- old_saved_frame);
+        saved_frame <- context#frame
+      end;
       value <- v
     method add a = self#set_value (value +/ a)
     method divide_by a = self#set_value (value // a)
@@ -53,6 +58,7 @@ and ['tag] row context own c =
     val mutable constant: num = c
     val mutable terms: ('tag column * 'tag coeff) list = []
     val mutable closed: bool = false
+    val mutable saved_frame = -1 (* The frame whose pop restores the constant; see simplex#frame. *)
 
     method print =
       let print_term (coef, col) =
@@ -82,8 +88,12 @@ and ['tag] row context own c =
     method terms = terms
     method set_constant_no_undo v = constant <- v
     method set_constant v =
-      let oldconstant = constant in
-      context#register_popaction (fun () -> constant <- oldconstant);
+      if saved_frame <> context#frame then begin
+        let oldconstant = constant in
+        let old_saved_frame = saved_frame in
+        context#register_popaction (fun () -> constant <- oldconstant; saved_frame <- old_saved_frame);
+        saved_frame <- context#frame
+      end;
       constant <- v
     method add_row a r =
       self#set_constant (constant +/ (r#constant */ a));
@@ -199,6 +209,11 @@ and ['tag] simplex () =
     val mutable columns: 'tag column list = []
     val mutable popactions: (unit -> unit) list = []
     val mutable popstack = []
+    (* Identifies the current frame; every push starts a new one. Pivoting updates the same coefficients and constants many
+       times within a frame, but only their first update in a frame registers a pop action, since popping the frame only
+       needs the values it started with. *)
+    val mutable frame = 0
+    val mutable frameCounter = 0
     
     method unsat = unsat
     method set_unsat = unsat <- true
@@ -208,19 +223,23 @@ and ['tag] simplex () =
       const_listener <- fconsts
 
     method register_popaction f = popactions <- f::popactions
+    method frame = frame
     method push =
       assert (not unsat);
-      popstack <- (rows, columns, popactions)::popstack;
-      popactions <- []
+      popstack <- (rows, columns, popactions, frame)::popstack;
+      popactions <- [];
+      frameCounter <- frameCounter + 1;
+      frame <- frameCounter
     method pop =
       List.iter (fun f -> f()) popactions;
       match popstack with
         [] -> assert false
-      | (oldrows, oldcolumns, oldpopactions)::oldpopstack ->
+      | (oldrows, oldcolumns, oldpopactions, oldframe)::oldpopstack ->
         unsat <- false;
         rows <- oldrows;
         columns <- oldcolumns;
         popactions <- oldpopactions;
+        frame <- oldframe;
         popstack <- oldpopstack
 
     method get_unique_index () =
@@ -305,6 +305,20 @@ module type TERM = sig
 
   (* The features required for the term to be defined *)
   val features : t -> string list
+
+  (* [print_shared o t] prints [t] like [print], but binds every
+     application that occurs more than once in [t] with "let" and
+     prints it only once. *)
+  val print_shared : Format.formatter -> t -> unit
+
+  (* [output oc t] writes [t] to [oc] like [to_string] while traversing
+     it. *)
+  val output : out_channel -> t -> unit
+
+  (* [output_shared oc t] writes [t] with the bindings of
+     [print_shared] to [oc] while traversing it, without pretty-printing
+     boxes or intermediate strings. *)
+  val output_shared : out_channel -> t -> unit
 end
 
 module Term (S : SORT)
@@ -331,10 +345,30 @@ module Term (S : SORT)
     | App (f, _) -> Sy.get_range f
     | Forall _ -> S.bool
 
+  (* Applications are hash-consed, so that equal applications are
+     physically equal and [print_shared] finds the repeated subterms
+     of a term by physical identity. Arguments are hash-consed before
+     the applications they occur in, so comparing them physically is
+     enough. *)
+  (* Looks deeper than [Hashtbl.hash], since applications of the same
+     symbol often only differ in their later arguments. *)
+  let hash t = Hashtbl.hash_param 32 256 t
+
+  module Apps = Weak.Make (struct
+    type nonrec t = t
+    let equal t1 t2 =
+      match (t1, t2) with
+      | (App (f1, l1), App (f2, l2)) ->
+         f1 = f2 && List.compare_lengths l1 l2 = 0 && List.for_all2 (==) l1 l2
+      | _ -> false
+    let hash = hash
+  end)
+  let apps = Apps.create 4096
+
   let int i = Int i
   let real r = Real r
   let var v = Var v
-  let app f l = App (f, l)
+  let app f l = Apps.merge apps (App (f, l))
   let forall vars patterns t = Forall (vars, patterns, t)
 
   let rec print o = function
@@ -361,6 +395,77 @@ module Term (S : SORT)
           print t
           (print_list_space print) patterns
 
+  module Shared = Hashtbl.Make (struct
+    type nonrec t = t
+    let equal = (==)
+    let hash = hash
+  end)
+
+  (* The names bound by "let" in [print_shared]; the k-th shared subterm
+     of every term is bound to the k-th name. *)
+  let share_names : string list ref = ref []
+  let share_name k =
+    try List.nth !share_names k
+    with
+    | Failure _ ->
+       let name = Sy.to_string (Sy.fresh "share" [] S.bool) in
+       share_names := !share_names @ [name];
+       name
+
+  (* [shared_subterms t] returns the names of the applications that occur
+     more than once in [t], and those applications in post-order, so that
+     every binding only refers to earlier ones. Quantified terms are left
+     as they are, since their bodies refer to the bound variables. *)
+  let shared_subterms t =
+    let counts = Shared.create 64 in
+    let rec count t =
+      match t with
+      | App (_, (_ :: _ as l)) ->
+         let n = Option.value (Shared.find_opt counts t) ~default:0 in
+         Shared.replace counts t (n + 1);
+         if n = 0 then List.iter count l
+      | _ -> ()
+    in
+    count t;
+    let names = Shared.create 16 in
+    let bindings = ref [] in
+    let rec collect t =
+      match t with
+      | App (_, (_ :: _ as l)) when not (Shared.mem names t) ->
+         List.iter collect l;
+         if Shared.find counts t > 1 then begin
+           Shared.add names t (share_name (Shared.length names));
+           bindings := t :: !bindings
+         end
+      | _ -> ()
+    in
+    begin match t with
+    | App (_, l) -> List.iter collect l
+    | _ -> ()
+    end;
+    (names, List.rev !bindings)
+
+  let print_shared o t =
+    let names, bindings = shared_subterms t in
+    let rec print_named o t =
+      match Shared.find_opt names t with
+      | Some name -> print_string o name
+      | None -> print_app o t
+    and print_app o = function
+      | App (head, (_ :: _ as l)) ->
+         Format.fprintf o "@[<3>(%a@ %a)@]"
+            Sy.print head
+            (print_list_space print_named) l
+      | t -> print o t
+    in
+    List.iter
+      (fun t ->
+        Format.fprintf o "@[<3>(let@ @[<3>((%s@ %a))@]@ "
+          (Shared.find names t) print_app t)
+      bindings;
+    print_app o t;
+    List.iter (fun _ -> Format.fprintf o ")@]") bindings
+
   let rec to_string = function
     | Int i ->
        if Big_int.sign_big_int i >= 0 then
@@ -385,6 +490,60 @@ module Term (S : SORT)
            (to_string t)
            (String.concat " " (List.map to_string patterns))
 
+  let output_list output_elem oc = function
+    | [] -> ()
+    | x :: l ->
+       output_elem oc x;
+       List.iter (fun x -> output_char oc ' '; output_elem oc x) l
+
+  let rec output oc = function
+    | App (head, (_ :: _ as l)) ->
+       output_char oc '(';
+       output_string oc (Sy.to_string head);
+       output_char oc ' ';
+       output_list output oc l;
+       output_char oc ')'
+    | Forall (vars, patterns, t) ->
+       output_string oc "(forall (";
+       output_list (fun oc v -> output_string oc (V.to_string_with_type v)) oc vars;
+       output_string oc ") ";
+       if patterns = [] then output oc t
+       else begin
+         output_string oc "(! ";
+         output oc t;
+         output_string oc " :pattern (";
+         output_list output oc patterns;
+         output_string oc "))"
+       end;
+       output_char oc ')'
+    | t -> output_string oc (to_string t)
+
+  let output_shared oc t =
+    let names, bindings = shared_subterms t in
+    let rec output_named oc t =
+      match Shared.find_opt names t with
+      | Some name -> output_string oc name
+      | None -> output_app oc t
+    and output_app oc = function
+      | App (head, (_ :: _ as l)) ->
+         output_char oc '(';
+         output_string oc (Sy.to_string head);
+         output_char oc ' ';
+         output_list output_named oc l;
+         output_char oc ')'
+      | t -> output oc t
+    in
+    List.iter
+      (fun t ->
+        output_string oc "(let ((";
+        output_string oc (Shared.find names t);
+        output_char oc ' ';
+        output_app oc t;
+        output_string oc ")) ")
+      bindings;
+    output_app oc t;
+    List.iter (fun _ -> output_char oc ')') bindings
+
   let rec features = function
     | Int _ -> ["LIA"]
     | Real _ -> ["LRA"]
@@ -452,9 +611,16 @@ module type STATEMENT = sig
   val push : t
   val pop : int -> t
   val comment : string -> t
+  (* [term_comment label t] is the comment "label: t", of which [t] is only
+     rendered when the comment is printed or written. *)
+  val term_comment : string -> term -> t
   val check_sat : t
 
   val features : t -> string list
+
+  (* [output oc st] writes [st] to [oc] like [print], but streams its
+     terms, see [TERM.output_shared]. *)
+  val output : out_channel -> t -> unit
 end
 
 module Statement
@@ -478,6 +644,7 @@ module Statement
     | Push
     | Pop of int
     | Comment of string
+    | TermComment of string * term
     | CheckSat
 
   let set_logic s = SetLogic s
@@ -489,6 +656,7 @@ module Statement
     if i <= 0 then raise (Invalid_argument "Smtlib.Statement.pop")
     else Pop i
   let comment s = Comment s
+  let term_comment label t = TermComment (label, t)
   let check_sat = CheckSat
 
   let print o : t -> unit = function
@@ -503,13 +671,15 @@ module Statement
           S.print (Sy.get_range f)
     | Assert t ->
        Format.fprintf o "@[<3>(assert@ %a)@]"
-          T.print t
+          T.print_shared t
     | Push ->
        print_string o "(push)"
     | Pop i ->
        Format.fprintf o "@[<3>(pop@ %d)@]" i
     | Comment s ->
        Format.fprintf o "; %s" s
+    | TermComment (label, t) ->
+       Format.fprintf o "; %s: %s" label (T.to_string t)
     | CheckSat -> print_string o "(check-sat)"
 
   let to_string = function
@@ -530,10 +700,29 @@ module Statement
        Printf.sprintf "(pop %d)" i
     | Comment s ->
        Printf.sprintf "; %s\n" s
+    | TermComment (label, t) ->
+       Printf.sprintf "; %s: %s\n" label (T.to_string t)
     | CheckSat -> "(check-sat)"
 
+  let output oc = function
+    | Assert t ->
+       output_string oc "(assert ";
+       T.output_shared oc t;
+       output_char oc ')'
+    | TermComment (label, t) ->
+       output_string oc "; ";
+       output_string oc label;
+       output_string oc ": ";
+       T.output oc t
+    | SortDecl s ->
+       Printf.fprintf oc "(declare-sort %s 0)" (S.to_string s)
+    | Comment s ->
+       output_string oc "; ";
+       output_string oc s
+    | st -> output_string oc (to_string st)
+
   let features = function
-    | SetLogic _ | Comment _ | CheckSat -> []
+    | SetLogic _ | Comment _ | TermComment _ | CheckSat -> []
     | Push | Pop _ -> ["I"]
     | Assert t -> T.features t
     | SortDecl s -> S.features s
@@ -552,4 +741,6 @@ let sassert t = St.sassert t
 let push = St.push
 let pop = St.pop
 let comment = St.comment
+let term_comment = St.term_comment
+let output_statement = St.output
 let check_sat = St.check_sat
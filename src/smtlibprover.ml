@@ -15,13 +15,17 @@ open Proverapi
 (* This code is largely inspired from the modules for the Z3 prover. *)
 
 class smtlib_context input_fun output (features : string list) =
-  let statements : Smtlib.statement list ref = ref [] in
-  let dump_fmt = Format.formatter_of_out_channel output in
+  (* Statements are written to the buffer of the output channel as their
+     terms are traversed, so a statement is never rendered in memory as a
+     whole, and the buffer is sent whenever it fills up, so the prover
+     starts parsing a large query before it is complete. The buffer is
+     flushed when the prover has to answer a check-sat command. *)
   let add_statement st =
-    Format.fprintf dump_fmt "%a@\n" Smtlib.print_statement st;
-    flush output;
-    statements := st :: !statements
+    Smtlib.output_statement output st;
+    output_char output '\n';
+    if st == Smtlib.check_sat then flush output
   in
+  let () = at_exit (fun () -> flush output) in
   let has_features l =
     List.for_all (fun f -> List.mem f features) l
   in
@@ -68,13 +72,40 @@ class smtlib_context input_fun output (features : string list) =
      until we add an assertion or pop the stack. We do that to avoid
      asking the prover the same question several times. *)
   let last_prover_answer = ref None in
+  (* Answers to check-sat commands that were sent but not read yet, oldest first; see [check_async].
+     The prover answers in order, so they are read before any later answer. *)
+  let pending_answers : assume_result option ref Queue.t = Queue.create () in
+  let read_pending_answer () = Queue.pop pending_answers := Some (input_fun ()) in
+  let read_pending_answers () =
+    while not (Queue.is_empty pending_answers) do
+      read_pending_answer ()
+    done
+  in
+  (* An unread answer is at most 8 bytes, so the answers left unread stay below the 4096 bytes that
+     a pipe holds at least. The prover then never blocks writing an answer while VeriFast blocks
+     sending it statements, and the oldest answer can be read without waiting for later ones, since
+     its check-sat command was flushed. *)
+  let max_pending_answers = 256 in
   let check () =
     match !last_prover_answer with
     | None ->
        add_statement Smtlib.check_sat;
+       read_pending_answers ();
        input_fun ()
     | Some ans -> ans
   in
+  let check_async () =
+    match !last_prover_answer with
+    | None ->
+       add_statement Smtlib.check_sat;
+       let answer = ref None in
+       Queue.push answer pending_answers;
+       if Queue.length pending_answers > max_pending_answers then read_pending_answer ();
+       fun () ->
+         if !answer = None then read_pending_answers ();
+         Option.get !answer
+    | Some ans -> fun () -> ans
+  in
   let add_assert t =
     (* Only add an assertion if the prover has the required features to understand it *)
     if has_features (Smtlib.T.features t) then
@@ -112,8 +143,9 @@ class smtlib_context input_fun output (features : string list) =
   let unboxed_real = declare_fun "unbox_real" [ inductive_type ] real_type in
   let () = assume_is_inverse unboxed_real boxed_real real_type in
   let () = assume_is_inverse boxed_real unboxed_real inductive_type in
-  object
+  object (self)
     val mutable verbosity = 0
+    val mutable pushlevel = 0
     method features = features
     method set_verbosity v = verbosity <- v
     method type_bool = bool_type
@@ -199,6 +231,7 @@ class smtlib_context input_fun output (features : string list) =
         cs
 
     method mk_app = Smtlib.app
+    method mk_apps apps = Array.map (fun (s, ts) -> Smtlib.app s ts) apps
     method mk_true = ttrue
     method mk_false = tfalse
     method mk_and = Smtlib.tand
@@ -238,18 +271,52 @@ class smtlib_context input_fun output (features : string list) =
     method pprint_sym = Smtlib.Sym.to_string
     method query t =
       add_statement
-        (Smtlib.comment (Printf.sprintf "Query: %s" (Smtlib.T.to_string t)));
+        (Smtlib.term_comment "Query" t);
       query t
     method assume t =
       add_statement
-        (Smtlib.comment (Printf.sprintf "Assume: %s" (Smtlib.T.to_string t)));
+        (Smtlib.term_comment "Assume" t);
       assert_term t
+    method assume_all ts =
+      ts |> Array.iter begin fun t ->
+        add_statement
+          (Smtlib.term_comment "Assume" t);
+        add_assert t
+      end;
+      check ()
     method assert_term t =
       add_statement
-        (Smtlib.comment (Printf.sprintf "Assert: %s" (Smtlib.T.to_string t)));
+        (Smtlib.term_comment "Assert" t);
       add_assert t
-    method push = add_statement (Smtlib.push)
-    method pop = last_prover_answer := None; add_statement (Smtlib.pop 1)
+    method assume_async t =
+      add_statement
+        (Smtlib.term_comment "Assume" t);
+      add_assert t;
+      check_async ()
+    method query_async t =
+      add_statement
+        (Smtlib.term_comment "Query" t);
+      if has_features (Smtlib.T.features t) then
+        begin
+          add_statement Smtlib.push;
+          add_assert (Smtlib.tnot t);
+          let answer = check_async () in
+          last_prover_answer := None;
+          add_statement (Smtlib.pop 1);
+          fun () -> answer () = Unsat
+        end
+      else fun () -> false
+    method push = pushlevel <- pushlevel + 1; add_statement (Smtlib.push)
+    method pop = pushlevel <- pushlevel - 1; last_prover_answer := None; add_statement (Smtlib.pop 1)
+    method snapshot =
+      self#push;
+      pushlevel
+    method restore level =
+      if pushlevel < level then failwith "Snapshot has been popped";
+      last_prover_answer := None;
+      add_statement (Smtlib.pop (pushlevel - level + 1));
+      pushlevel <- level - 1;
+      self#push
     method perform_pending_splits (cont: Smtlib.term list -> bool) = cont []
     method stats: string * (string * int64) list = "(no statistiques for SMTlib)", []
     method begin_formal = ()
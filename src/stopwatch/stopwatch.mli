@@ -1,8 +1,11 @@
 external getpid: unit -> int32 = "caml_stopwatch_getpid"
 
-(** Locks this process to processor 1.
-  * This potentially improves the accuracy of timing results on multicore systems.
-  * This module uses the RDTSC (read timestamp counter) instruction; these counters might not run in lockstep on the different processors of a system. *)
+(** Whether the processor has an invariant time stamp counter, which runs at a constant rate and in lockstep on all processors. *)
+external invariant_tsc: unit -> bool = "caml_stopwatch_invariant_tsc"
+
+(** Locks this process to processor 1, if that is needed for consistent ticks.
+  * Ticks are read with the RDTSC (read timestamp counter) instruction only if the TSC is invariant, and from the monotonic clock otherwise,
+  * so on Unix this does nothing; on Windows, the process is only pinned if the TSC is not invariant. *)
 external lock_process_to_processor_1: unit -> unit = "caml_lock_process_to_processor_1"
 
 external processor_ticks: unit -> int64 = "caml_stopwatch_processor_ticks"
@@ -13,4 +16,30 @@ type t
 external create: unit -> t = "caml_stopwatch_create"
 external start: t -> unit = "caml_stopwatch_start"
 external stop: t -> unit = "caml_stopwatch_stop"
-external ticks: t -> int64 = "caml_stopwatch_ticks"
\ No newline at end of file
+external ticks: t -> int64 = "caml_stopwatch_ticks"
+
+(** CPU time of the calling thread in nanoseconds. Unlike processor ticks, it only advances while the thread runs, on whichever processor. *)
+external thread_cpu_time: unit -> int64 = "caml_stopwatch_thread_cpu_time"
+
+(** Stopwatches that measure the CPU time of the thread that starts and stops them, e.g. the busy time of a worker.
+  * Unlike [t], which measures elapsed ticks, they are not affected by other threads or processes sharing the processor.
+  * A stopwatch is meant to be used by one thread: start and stop it on the same thread, and give each worker its own. *)
+type thread_stopwatch
+
+val create_thread: unit -> thread_stopwatch
+val start_thread: thread_stopwatch -> unit
+val stop_thread: thread_stopwatch -> unit
+
+(** The CPU time measured so far, in seconds. *)
+val thread_seconds: thread_stopwatch -> float
+
+(** Hardware event counts of the calling thread since its first call of [read_hw_counters], counted in user space through
+  * perf_event_open on Linux. A count is -1 if the event is not available, e.g. on other systems, in virtual machines without a
+  * virtual PMU, or if perf_event_paranoid does not allow it. *)
+type hw_counters = {
+  cycles: int64;
+  instructions: int64;
+  cache_misses: int64
+}
+
+external read_hw_counters: unit -> hw_counters = "caml_stopwatch_read_hw_counters"
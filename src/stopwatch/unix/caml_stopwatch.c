@@ -1,34 +1,63 @@
 #define _GNU_SOURCE
 #include <sched.h>
-#if __aarch64__
-    #include <time.h>
-#else
+#include <string.h>
+#include <time.h>
+#if !__aarch64__
+    #include <cpuid.h>
     #include <x86intrin.h>
 #endif
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+#endif
 #include <caml/mlvalues.h>
 #include <caml/alloc.h>
+#include <caml/memory.h>
+#include <stdint.h>
 #include <unistd.h>
 
 value caml_stopwatch_getpid() {
     return caml_copy_int32(getpid());
 }
 
-value caml_lock_process_to_processor_1() {
-#ifdef __linux__ // MacOS does not support thread affinity; see http://developer.apple.com/library/mac/#releasenotes/Performance/RN-AffinityAPI/
-    cpu_set_t mask;
-    CPU_ZERO(&mask);
-    CPU_SET(0, &mask);
-    pid_t pid = 0;
-    sched_setaffinity(pid, sizeof(cpu_set_t), &mask);
+/* Whether the time stamp counter runs at a constant rate, in lockstep on all processors (CPUID leaf 0x80000007, EDX bit 8). */
+static int has_invariant_tsc() {
+#if __aarch64__
+    return 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
 #endif
+}
+
+/* 1 if the ticks are read from the time stamp counter, 0 if from the monotonic clock, -1 if not decided yet. */
+static int use_tsc = -1;
+
+value caml_stopwatch_invariant_tsc() {
+    return Val_bool(has_invariant_tsc());
+}
+
+/* Pinning is not needed: ticks come from an invariant TSC or from the monotonic clock, which agree across processors. */
+value caml_lock_process_to_processor_1() {
     return Val_unit;
 }
 
 static unsigned long long get_processor_ticks() {
-#if __aarch64__
+#if !__aarch64__
+    if (use_tsc < 0)
+        use_tsc = has_invariant_tsc();
+    if (use_tsc)
+        return __rdtsc();
+#endif
+#ifdef __APPLE__
     return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
 #else
-    return __rdtsc();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 #endif
 }
 
@@ -67,4 +96,60 @@ value caml_stopwatch_stop(value stopwatch) {
 value caml_stopwatch_ticks(value stopwatch) {
     struct stopwatch *s = (void *)stopwatch;
     return caml_copy_int64(s->counter);
-}
\ No newline at end of file
+}
+
+/* CPU time of the calling thread in nanoseconds, which does not advance while the thread is descheduled or waits. */
+value caml_stopwatch_thread_cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return caml_copy_int64((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* Hardware event counters of the calling thread: cycles, instructions and cache misses. */
+#define NB_HW_COUNTERS 3
+
+#ifdef __linux__
+
+/* The counters of each thread are opened on its first read; -2 if not opened yet, -1 if unavailable. */
+static __thread int hw_counter_fds[NB_HW_COUNTERS] = { -2, -2, -2 };
+
+static int open_hw_counter(unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    /* Unprivileged processes may only count user-space events under the default perf_event_paranoid. */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0 /* calling thread */, -1 /* any processor */, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static int64_t read_hw_counter(int i) {
+    static const unsigned long long configs[NB_HW_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+    };
+    if (hw_counter_fds[i] == -2)
+        hw_counter_fds[i] = open_hw_counter(configs[i]);
+    uint64_t count;
+    if (hw_counter_fds[i] < 0 || read(hw_counter_fds[i], &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return (int64_t)count;
+}
+
+#else
+
+static int64_t read_hw_counter(int i) {
+    return -1;
+}
+
+#endif
+
+value caml_stopwatch_read_hw_counters() {
+    CAMLparam0();
+    CAMLlocal1(result);
+    result = caml_alloc_tuple(NB_HW_COUNTERS);
+    for (int i = 0; i < NB_HW_COUNTERS; i++)
+        Store_field(result, i, caml_copy_int64(read_hw_counter(i)));
+    CAMLreturn(result);
+}
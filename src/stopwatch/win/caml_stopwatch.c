@@ -2,14 +2,32 @@
 #include <intrin.h>
 #include <caml/mlvalues.h>
 #include <caml/alloc.h>
+#include <caml/memory.h>
 
 value caml_stopwatch_getpid() {
     return caml_copy_int32(GetCurrentProcessId());
 }
 
+/* Whether the time stamp counter runs at a constant rate, in lockstep on all processors (CPUID leaf 0x80000007, EDX bit 8). */
+static int has_invariant_tsc() {
+    int info[4];
+    __cpuid(info, 0x80000000);
+    if ((unsigned int)info[0] < 0x80000007)
+        return 0;
+    __cpuid(info, 0x80000007);
+    return (info[3] >> 8) & 1;
+}
+
+value caml_stopwatch_invariant_tsc() {
+    return Val_bool(has_invariant_tsc());
+}
+
+/* Only a TSC that is not invariant needs the process to stay on one processor. */
 value caml_lock_process_to_processor_1() {
-    HANDLE currentProcess = GetCurrentProcess();
-    SetProcessAffinityMask(currentProcess, 1);
+    if (!has_invariant_tsc()) {
+        HANDLE currentProcess = GetCurrentProcess();
+        SetProcessAffinityMask(currentProcess, 1);
+    }
     return Val_unit;
 }
 
@@ -51,4 +69,23 @@ value caml_stopwatch_stop(value stopwatch) {
 value caml_stopwatch_ticks(value stopwatch) {
     struct stopwatch *s = (void *)stopwatch;
     return caml_copy_int64(s->counter);
-}
\ No newline at end of file
+}
+
+/* CPU time of the calling thread in nanoseconds: its kernel and user time, which GetThreadTimes reports in units of 100 ns. */
+value caml_stopwatch_thread_cpu_time() {
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    unsigned __int64 k = ((unsigned __int64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    unsigned __int64 u = ((unsigned __int64)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return caml_copy_int64((k + u) * 100);
+}
+
+/* Hardware event counters are not available on Windows. */
+value caml_stopwatch_read_hw_counters() {
+    CAMLparam0();
+    CAMLlocal1(result);
+    result = caml_alloc_tuple(3);
+    for (int i = 0; i < 3; i++)
+        Store_field(result, i, caml_copy_int64(-1));
+    CAMLreturn(result);
+}
@@ -63,6 +63,17 @@ let read_file_lines path =
     ) (fun () -> close_in file)
   else raise (FileNotFound path)
 
+let (version, version_long) =
+  let version_file_name = Filename.concat (Filename.dirname Sys.executable_name) "VERSION" in
+  if Sys.file_exists version_file_name then
+    let ch = open_in version_file_name in
+    let version = input_line ch in
+    let version_long = input_line ch in
+    close_in ch;
+    (Some version, Some version_long)
+  else
+    (None, None)
+
 module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   include VerifyExpr(VerifyProgramArgs)
@@ -172,7 +183,24 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           assume_not_null lval_ref_params
         | _ -> cont ()
 
+  (* With -profile_locations, the time until the statement at [l] continues with the next one, and the time
+     spent exploring its other branches when that returns, are charged to [l]. *)
+  let profile_stmt l tcont verify =
+    let previous = !stats#enterLocation l in
+    let result = verify begin fun sizemap tenv ghostenv h env ->
+      let result = tcont sizemap tenv ghostenv h env in
+      ignore (!stats#resumeLocation (Some l));
+      result
+    end in
+    ignore (!stats#resumeLocation previous);
+    result
+
   let rec verify_stmt (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env s tcont return_cont econt =
+    if !Stats.location_profile <> None && not (is_transparent_stmt s) then
+      profile_stmt (root_caller_token (stmt_loc s)) tcont (fun tcont -> verify_stmt_core (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env s tcont return_cont econt)
+    else
+      verify_stmt_core (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env s tcont return_cont econt
+  and verify_stmt_core (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env s tcont return_cont econt =
     let l = stmt_loc s in
     if not (is_transparent_stmt s) then begin !stats#stmtExec l; reportStmtExec l end;
     let break_label () = if pure then "#ghostBreak" else "#break" in
@@ -1830,16 +1858,11 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           static_error l "All lower bounds must be less than all upper bounds" None;
         ) upper_bounds_terms;
       ) lower_bound_terms;
-      let rec assume_bounds lower upper cont =
-        match lower with
-         [] -> begin 
-               match upper with 
-                 [] -> cont ()
-               | first :: rest -> assume (ctxt#mk_lt boxLevelTerm first) (fun () -> assume_bounds [] rest cont)
-               end
-          | first :: rest -> assume (ctxt#mk_lt first boxLevelTerm) (fun () -> assume_bounds rest upper cont)
+      let bounds =
+        List.map (fun lower -> ctxt#mk_lt lower boxLevelTerm) lower_bound_terms @
+        List.map (fun upper -> ctxt#mk_lt boxLevelTerm upper) upper_bounds_terms
       in
-      assume_bounds lower_bound_terms upper_bounds_terms $. fun () ->
+      assume_all bounds $. fun () ->
       let h = (action_permission_chunks amap) @ h in
       with_context PushSubcontext $. fun () ->
       consume_asn rules [] h env ghostenv boxArgMapWithThis inv true real_unit $. fun _ h _ boxVarMap _ ->
@@ -3532,12 +3555,145 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       Some {cfds} -> cfds
     | None -> static_error lm ("No class was found: "^cn) None
   
+  (** Directory of the entries of the verification cache, see [with_verification_cache], or [None] if the
+      cache is not used. Should-fail directives, focus, and breakpoints change what verifying a body means,
+      so the cache is not used with them. *)
+  let verification_cache_dir =
+    match options.option_verification_cache with
+      Some dir when focus = None && breakpoint = None && targetPath = None && !shouldFailLocs = [] ->
+      let rec mkdir_p dir =
+        if not (Sys.file_exists dir) then begin
+          mkdir_p (Filename.dirname dir);
+          try Sys.mkdir dir 0o777 with Sys_error _ -> ()
+        end
+      in
+      mkdir_p dir;
+      Some dir
+    | _ -> None
+
+  (** With an adaptive prover, the file of the verification cache that records the times the combined provers
+      took to verify function [funName] when neither was preferred, or [None] if the cache is not used. Entries
+      are keyed by the program and the function's name, so they survive changes to the function. *)
+  let prover_times_entry funName =
+    match verification_cache_dir with
+      Some dir when !Proverapi.adaptive_selection ->
+      let dir = Filename.concat dir "prover_times" in
+      if not (Sys.file_exists dir) then (try Sys.mkdir dir 0o777 with Sys_error _ -> ());
+      Some (Filename.concat dir (Digest.to_hex (Digest.string (path ^ "\000" ^ funName))))
+    | _ -> None
+
+  (** [with_prover_preference funName body] calls [body] with the prover that verified [funName] faster
+      before preferred, or with both provers timed if there is no record yet, and then records their times.
+      Without a verification cache, no times can be recorded, so the first prover stays preferred, see
+      [Proverapi.prover_preference], rather than having both provers answer every call for nothing. *)
+  let with_prover_preference funName body =
+    match prover_times_entry funName with
+      None -> body ()
+    | Some entry ->
+      let recorded =
+        try
+          let ch = open_in_bin entry in
+          Fun.protect ~finally:(fun () -> close_in ch) (fun () -> Some (input_value ch: float * float))
+        with Sys_error _ | End_of_file | Failure _ -> None
+      in
+      match recorded with
+        Some (t1, t2) ->
+        Proverapi.prover_preference := if t1 <= t2 then Proverapi.PreferFirst else Proverapi.PreferSecond;
+        Fun.protect ~finally:(fun () -> Proverapi.prover_preference := Proverapi.PreferFirst) body
+      | None ->
+        Proverapi.prover_preference := Proverapi.PreferNone;
+        Proverapi.prover_times := (0.0, 0.0);
+        let result = Fun.protect ~finally:(fun () -> Proverapi.prover_preference := Proverapi.PreferFirst) body in
+        begin try
+          let tmp = Printf.sprintf "%s.%d.tmp" entry (Unix.getpid ()) in
+          let ch = open_out_bin tmp in
+          output_value ch !Proverapi.prover_times;
+          close_out ch;
+          Sys.rename tmp entry
+        with Sys_error _ -> ()
+        end;
+        result
+
   let record_fun_timing l funName body =
+    Prover_trace.begin_segment (string_of_loc l ^ ": " ^ funName);
     let time0 = Perf.time() in
-    let result = body () in
-    !stats#recordFunctionTiming (string_of_loc l ^ ": " ^ funName) (Perf.time() -. time0);
+    let counters0 = !stats#functionCounters in
+    let result = with_prover_preference funName body in
+    !stats#recordFunctionTiming (string_of_loc l ^ ": " ^ funName) (Perf.time() -. time0) counters0;
     result
-  
+
+  (** Digest of the version of VeriFast, of the headers and declarations of the program, without the bodies
+      of its functions other than fixpoints, and of the options it is verified with, or [None] if the program
+      cannot be digested. The definitions of fixpoints are part of what the other bodies are verified against.
+      Without a VERSION file, the executable itself stands for the version. Options that only change what is
+      reported or how the work is spread over processes are left out. *)
+  let program_digest = lazy begin
+    let strip_body = function
+      Func (l, k, tparams, rt, g, ps, nonghost_callers_only, functype_opt, contract, terminates, Some _, virt, overrides) when k <> Fixpoint ->
+      Func (l, k, tparams, rt, g, ps, nonghost_callers_only, functype_opt, contract, terminates, None, virt, overrides)
+    | d -> d
+    in
+    let ps = ps |> List.map (function PackageDecl (l, pn, ilist, ds) -> PackageDecl (l, pn, ilist, List.map strip_body ds)) in
+    let options = {options with option_verbose = 0; option_verbose_flags = []; option_jobs = 1; option_branch_jobs = 1; option_branch_depth = 0; option_verification_cache = None; option_dump_smt_queries = None} in
+    try
+      let version = match version_long with Some version -> version | None -> Digest.file Sys.executable_name in
+      Some (Digest.string (Marshal.to_string (version, headers, ps, options) []))
+    with Invalid_argument _ | Sys_error _ -> None
+  end
+
+  (** [with_verification_cache d verify] calls [verify], which verifies function declaration [d]. If the
+      verification cache has an entry for [d] in the current program, the body of [d] is not verified again
+      and the statements it executed are reported from the entry instead. Otherwise, an entry is added
+      once the body has been verified. *)
+  let with_verification_cache d verify =
+    let entry =
+      match verification_cache_dir, Lazy.force program_digest with
+        Some dir, Some digest ->
+        begin try Some (Filename.concat dir (Digest.to_hex (Digest.string (digest ^ Marshal.to_string d [])))) with Invalid_argument _ -> None end
+      | _ -> None
+    in
+    match entry with
+      None -> verify ()
+    | Some entry ->
+      let body_verifier0 = !body_verifier in
+      let reportStmtExec00 = !reportStmtExec0 in
+      let restore () = body_verifier := body_verifier0; reportStmtExec0 := reportStmtExec00 in
+      let cached =
+        try
+          let ch = open_in_bin entry in
+          Fun.protect ~finally:(fun () -> close_in ch) (fun () -> Some (input_value ch: loc0 list))
+        with Sys_error _ | End_of_file | Failure _ -> None
+      in
+      begin match cached with
+        Some stmts_executed ->
+        (* The IDE compares the paths of the locations it is given with the path of the program physically. *)
+        let canonical ((p, line, col) as pos) = if p = path then (path, line, col) else pos in
+        let stmts_executed = stmts_executed |> List.map (fun (pos1, pos2) -> (canonical pos1, canonical pos2)) in
+        body_verifier := begin fun l _ ->
+          body_verifier0 l begin fun () ->
+            !stats#functionsCached 1;
+            stmts_executed |> List.iter (fun l -> !stats#stmtExec (Lexed l); reportStmtExec00 l)
+          end
+        end
+      | None ->
+        body_verifier := begin fun l verify_body ->
+          body_verifier0 l begin fun () ->
+            let stmts_executed = ref [] in
+            reportStmtExec0 := (fun l -> stmts_executed := l::!stmts_executed; reportStmtExec00 l);
+            verify_body ();
+            reportStmtExec0 := reportStmtExec00;
+            try
+              let tmp = Printf.sprintf "%s.%d.tmp" entry (Unix.getpid ()) in
+              let ch = open_out_bin tmp in
+              output_value ch !stmts_executed;
+              close_out ch;
+              Sys.rename tmp entry
+            with Sys_error _ -> ()
+          end
+        end
+      end;
+      Fun.protect ~finally:restore verify
+
   let rec verify_exceptional_return (pn,ilist) l h ghostenv env exceptp excep handlers =
     if not (is_unchecked_exception_type exceptp) then
       match handlers with
@@ -3775,10 +3931,12 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           gs
       in
       verify_funcs (pn,ilist) boxes gs lems ds
-    | Func (l, k, _, _, g, _, _, functype_opt, _, _, Some _, is_virtual, _)::ds when k <> Fixpoint ->
+    | (Func (l, k, _, _, g, _, _, functype_opt, _, _, Some _, is_virtual, _) as d)::ds when k <> Fixpoint ->
+      if cancellationRequested () then raise VerificationCancelled;
       let g = full_name pn g in
       let gs', lems' =
       record_fun_timing l g begin fun () ->
+      with_verification_cache d @@ fun () ->
       let FuncInfo ([], fterm, l, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, _, Some (Some (ss, closeBraceLoc)), is_virtual, overrides) = (List.assoc g funcmap)in
       let tparams = [] in
       let env = [] in
@@ -3921,6 +4079,92 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         verify_funcs' boxes gs lems rest
     | [] -> verify_classes boxes lems classmap
   
+  (** Verifies the function bodies of the program on [options.option_jobs]
+      forked worker processes, before the bodies are verified in this process.
+      Each worker walks all declarations, like this process does, but verifies only
+      every [jobs]-th body; the walk does not depend on which bodies are verified, so
+      the same body gets the same index in every process. A worker stops at its first
+      failure and reports the indices of the bodies it verified, together with its
+      statistics and the counters of the bodies it verified. This process then verifies
+      only the remaining bodies, which include the failed one, so errors are reported
+      exactly as without workers. The statistics the prover itself reports are not
+      collected from the workers.
+      Should-fail directives, focus, breakpoints, and manifests need all bodies to
+      be verified in one process, so the workers are not used for them. *)
+  let verify_bodies_in_parallel () =
+    let jobs = options.option_jobs in
+    if jobs > 1 && Sys.os_type = "Unix" && focus = None && breakpoint = None && targetPath = None &&
+       !shouldFailLocs = [] && not options.option_emit_manifest then begin
+      let start_worker k =
+        let (fd_in, fd_out) = Unix.pipe ~cloexec:true () in
+        flush_all ();
+        match Unix.fork () with
+          0 ->
+          Unix.close fd_in;
+          let devnull = Unix.openfile "/dev/null" [Unix.O_WRONLY] 0 in
+          Unix.dup2 devnull Unix.stdout;
+          let verified = ref [] in
+          let stmts_executed = ref [] in
+          reportStmtExec0 := (fun l -> stmts_executed := l::!stmts_executed);
+          let index = ref 0 in
+          let busy = Stopwatch.create_thread () in
+          let counters = ref (List.map (fun _ -> 0) !stats#getCounters) in
+          body_verifier := begin fun _ verify ->
+            let i = !index in
+            incr index;
+            if i mod jobs = k then begin
+              let counters0 = !stats#getCounters in
+              Stopwatch.start_thread busy;
+              Fun.protect verify ~finally:begin fun () ->
+                Stopwatch.stop_thread busy;
+                counters := List.map2 (+) !counters (List.map2 (-) !stats#getCounters counters0)
+              end;
+              verified := i::!verified
+            end
+          end;
+          begin try verify_funcs' [] gs0 lems0 ps with _ -> () end;
+          let ch = Unix.out_channel_of_descr fd_out in
+          output_value ch (!verified, !stmts_executed, !stats#getStmtExecLocs, !stats#getFunctionTimingList, !stats#getCachedFunctionCount, Stopwatch.thread_seconds busy, !stats#getProverLatencies, !stats#getLocationCosts, !counters);
+          close_out ch;
+          Unix._exit 0
+        | pid ->
+          Unix.close fd_out;
+          (pid, fd_in)
+      in
+      let time0 = Unix.gettimeofday () in
+      let workers = List.init jobs start_worker in
+      let verified = Hashtbl.create 100 in
+      let busy_times = workers |> List.map begin fun (pid, fd_in) ->
+        let ch = Unix.in_channel_of_descr fd_in in
+        let busy_time =
+          try
+            let ((is, stmts_executed, stmt_locs, timings, cached, busy_time, latencies, location_costs, counters): int list * loc0 list * loc list * Stats.function_timing list * int * float * ((string * string) * Stats.latency_histogram) list * (loc0 * Stats.location_cost) list * int list) = input_value ch in
+            is |> List.iter (fun i -> Hashtbl.replace verified i ());
+            stmts_executed |> List.iter !reportStmtExec0;
+            stmt_locs |> List.iter (fun l -> !stats#stmtExec l);
+            timings |> List.iter !stats#addFunctionTiming;
+            !stats#functionsCached cached;
+            latencies |> List.iter !stats#addProverLatencies;
+            location_costs |> List.iter !stats#addLocationCost;
+            !stats#addCounters counters;
+            busy_time
+          with End_of_file | Failure _ -> 0.0
+        in
+        close_in ch;
+        ignore (Unix.waitpid [] pid);
+        busy_time
+      end in
+      !stats#workersFinished (Unix.gettimeofday () -. time0) busy_times;
+      let index = ref 0 in
+      body_verifier := begin fun _ verify ->
+        let i = !index in
+        incr index;
+        if not (Hashtbl.mem verified i) then verify ()
+      end
+    end
+
+  let () = verify_bodies_in_parallel ()
+
   let () = verify_funcs' [] gs0 lems0 ps
   
   let result = 
@@ -4022,6 +4266,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
             let verbose = options.option_verbose
             let include_paths = if Filename.check_suffix path ".h" then [] else include_paths
             let define_macros = define_macros
+            let focus = focus
           end
         ) 
         in
@@ -4256,17 +4501,6 @@ let prover_descriptions indent =
     |> List.map (fun (name, (description, f)) -> indent ^ name ^ ": " ^ description ^ "\n")
     |> String.concat ""
 
-let (version, version_long) =
-  let version_file_name = Filename.concat (Filename.dirname Sys.executable_name) "VERSION" in
-  if Sys.file_exists version_file_name then
-    let ch = open_in version_file_name in
-    let version = input_line ch in
-    let version_long = input_line ch in
-    close_in ch;
-    (Some version, Some version_long)
-  else
-    (None, None)
-
 let string_of_string_opt = function None -> "" | Some s -> " " ^ s
 
 let banner () =
@@ -4303,7 +4537,14 @@ let verify_program (* ?verify_program *)
     (object
        method run: 'typenode 'symbol 'termnode. ('typenode, 'symbol, 'termnode) Proverapi.context -> Stats.stats =
          fun ctxt -> clear_stats ();
-                     verify_program_core ~emitter_callback:emitter_callback ctxt options path callbacks breakpoint focus targetPath;
+                     let ctxt = if !Stats.prover_latency || !Stats.location_profile <> None then Prover_latency.wrap prover ctxt else ctxt in
+                     let verify ctxt = verify_program_core ~emitter_callback:emitter_callback ctxt options path callbacks breakpoint focus targetPath in
+                     (* A trace records the calls that reach the prover. *)
+                     let verify ctxt = if options.option_lazy_axioms then verify (Lazy_axioms.wrap ctxt) else verify ctxt in
+                     begin match options.option_dump_smt_queries with
+                       None -> verify ctxt
+                     | Some dir -> verify (Prover_trace.record dir path ctxt)
+                     end;
                      !stats
      end)
 
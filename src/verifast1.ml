@@ -27,6 +27,9 @@ let max (x: int) (y: int) = max x y
 
 exception NoSuchPredicate of string
 
+(** Raised between the verification of two functions once [cancellationRequested] returns [true]. *)
+exception VerificationCancelled
+
 type callbacks = {
   reportRange: range_kind -> loc0 -> unit;
   reportUseSite: decl_kind -> loc0 -> loc0 -> unit;
@@ -34,9 +37,10 @@ type callbacks = {
   reportStmt: loc0 -> unit;
   reportStmtExec: loc0 -> unit;
   reportDirective: string -> loc0 -> bool;
+  cancellationRequested: unit -> bool; (* Polled before every function body is verified. *)
 }
 
-let noop_callbacks = {reportRange = (fun _ _ -> ()); reportUseSite = (fun _ _ _ -> ()); reportExecutionForest = (fun _ -> ()); reportStmt = (fun _ -> ()); reportStmtExec = (fun _ -> ()); reportDirective = (fun _ _ -> false)}
+let noop_callbacks = {reportRange = (fun _ _ -> ()); reportUseSite = (fun _ _ _ -> ()); reportExecutionForest = (fun _ -> ()); reportStmt = (fun _ -> ()); reportStmtExec = (fun _ -> ()); reportDirective = (fun _ _ -> false); cancellationRequested = (fun () -> false)}
 
 module type VERIFY_PROGRAM_ARGS = sig
   val emitter_callback: string -> string -> package list -> unit
@@ -123,7 +127,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
 
   let assume_left_to_right_evaluation = assume_left_to_right_evaluation || language <> CLang || dialect = Some Rust
 
-  let {reportRange; reportUseSite; reportExecutionForest; reportStmt; reportStmtExec; reportDirective} = callbacks
+  let {reportRange; reportUseSite; reportExecutionForest; reportStmt; reportStmtExec; reportDirective; cancellationRequested} = callbacks
 
   let item_path_separator = if language = Java then "." else "::"
 
@@ -143,7 +147,9 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     reportUseSite dk (root_caller_token ld) (lexed_loc lu)
 
   let reportStmt l = reportStmt (root_caller_token l)
-  let reportStmtExec l = reportStmtExec (root_caller_token l)
+  (* Executed statements reported by this process, unless they are collected for another process instead. *)
+  let reportStmtExec0 = ref reportStmtExec
+  let reportStmtExec l = !reportStmtExec0 (root_caller_token l)
 
   let data_model =
     match language with
@@ -1450,6 +1456,8 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                   | Some Cxx -> 
                     let open Cxx_frontend in
                     "prelude_cxx.h", fun report_macro_call path report_range report_should_fail verbose include_paths define_macros enforce_annotations data_model -> 
+                      let options = Marshal.to_string (include_paths, define_macros, enforce_annotations, data_model) [] in
+                      Prelude_cache.parse ~options ~report_range ~report_should_fail ~report_macro_call path @@ fun ~report_range ~report_should_fail ~report_macro_call ->
                       let module Translator = Ast_translator.Make(
                         struct 
                           let enforce_annotations = enforce_annotations
@@ -1462,6 +1470,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                           let verbose = verbose
                           let include_paths = include_paths
                           let define_macros = define_macros
+                          let focus = None
                         end
                       )
                       in
@@ -7882,6 +7891,23 @@ let check_if_list_is_defined () =
     ctxt#pop;
     result
   
+  (* Like [assume] for every term in turn, but hands the terms to the prover in a single call. *)
+  let assume_all ts cont =
+    match ts with
+      [] -> cont ()
+    | [t] -> assume t cont
+    | _ ->
+    List.iter (fun t -> !stats#proverAssume; push_context (Assuming t)) ts;
+    ctxt#push;
+    let result =
+      match ctxt#assume_all (Array.of_list ts) with
+        Unknown -> cont()
+      | Unsat -> major_success ()
+    in
+    List.iter (fun _ -> pop_context()) ts;
+    ctxt#pop;
+    result
+  
   let assume_opt t cont =
     match t with
       None -> cont ()
@@ -0,0 +1,21 @@
+module R = Redux
+module Sp = Smtlibprover
+module P = Proverapi
+module C = Combineprovers
+
+let _ =
+  Verifast.register_prover "Redux|ext_z3"
+    "(experimental) race Redux against Z3 running as an external prover; Z3 is only awaited when Redux does not find the answer."
+    (
+      fun client ->
+      let redux_ctxt =
+        (new R.context ():
+           R.context :> (unit, R.symbol, (R.symbol, R.termnode) R.term) P.context)
+      in
+      let z3_ctxt =
+        Sp.external_smtlib_ctxt
+          "z3 -in -smt2 smt.auto_config=false smt.mbqi=false auto_config=false model=false type_check=true well_sorted_check=true"
+          ["z3"; "I"; "Q"; "NDT"; "LIA"; "LRA"]
+      in
+      client#run (C.combine redux_ctxt z3_ctxt C.Race)
+    )
@@ -19,3 +19,19 @@ let _ =
       in
       client#run (C.combine redux_ctxt z3_ctxt C.Sequence)
     )
+
+let _ =
+  Verifast.register_prover "Redux/Z3v4.5"
+    "(experimental) verify every function with whichever of Redux and Z3v4.5 verified it faster before, as recorded in the -verification_cache, and time both otherwise; without -verification_cache, Redux answers first and Z3v4.5 only when Redux fails, as with Redux+Z3v4.5."
+    (
+      fun client ->
+      let redux_ctxt =
+        (new R.context ():
+           R.context :> (unit, R.symbol, (R.symbol, R.termnode) R.term) P.context)
+      in
+      let z3_ctxt =
+        (new Z.z3_context ():
+           Z.z3_context :> (Zn.sort, Zn.func_decl, Zn.ast) P.context)
+      in
+      client#run (C.combine redux_ctxt z3_ctxt C.Adaptive)
+    )
@@ -142,9 +142,14 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       if line = line0 && path = path0 then
         assert_false h env l "Breakpoint reached." None
 
+  (** [!body_verifier l verify] verifies the body of the function, method, or
+      constructor at [l] by calling [verify]. Replaced while the bodies are
+      distributed over worker processes; see [verify_bodies_in_parallel]. *)
+  let body_verifier: (loc -> (unit -> unit) -> unit) ref = ref (fun _ verify -> verify ())
+
   let check_focus l1 l2 cont =
     match focus with
-      None -> cont ()
+      None -> !body_verifier l1 cont
     | Some (path, line) ->
       let ((path1, line1, _), _) = root_caller_token l1 in
       let ((_, line2, _), _) = root_caller_token l2 in
@@ -58,12 +58,20 @@ module HashedLine = struct
 end
 module LineHashtbl = Hashtbl.Make(HashedLine)
 
-let _ =
-  let verify ?(emitter_callback = fun _ _ _ -> ()) (print_stats : bool) (options : options) (prover : string) (path : string) (emitHighlightedSourceFiles : bool) (dumpPerLineStmtExecCounts : bool) allowDeadCode json expectedJsonResult applyQuickFix mergeOptionsFromSourceFile breakpoint focus targetPath =
+let main (argv : string array) =
+  let verify ?(emitter_callback = fun _ _ _ -> ()) ?stats_json (print_stats : bool) (options : options) (prover : string) (path : string) (emitHighlightedSourceFiles : bool) (dumpPerLineStmtExecCounts : bool) allowDeadCode json expectedJsonResult applyQuickFix mergeOptionsFromSourceFile breakpoint focus targetPath =
     let exit l =
       Java_frontend_bridge.unload();
       exit l
     in
+    (* Written when the process exits, so the statistics of a failed run are written as well. *)
+    stats_json |> Option.iter begin fun file ->
+      at_exit begin fun () ->
+        let ch = open_out file in
+        output_string ch (string_of_json !Stats.stats#toJson);
+        close_out ch
+      end
+    end;
     let reportExecutionForest, get_execution_forest_json =
       if not json then
         (fun _ -> ()), (fun _ -> Null)
@@ -266,17 +274,37 @@ let _ =
         | _ ->
           false
       in
-      let callbacks = {Verifast1.reportRange=range_callback; reportStmt; reportStmtExec; reportDirective; reportUseSite; reportExecutionForest} in
+      (* A client that starts a new run before this one finishes sends SIGUSR1, so this run stops before the next
+         function body instead of being killed, and the verification cache keeps the bodies verified so far.
+         Not available on Windows. *)
+      let cancelled = ref false in
+      begin try Sys.set_signal Sys.sigusr1 (Sys.Signal_handle (fun _ -> cancelled := true)) with Invalid_argument _ -> () end;
+      let cancellationRequested () = !cancelled in
+      let callbacks = {Verifast1.reportRange=range_callback; reportStmt; reportStmtExec; reportDirective; reportUseSite; reportExecutionForest; cancellationRequested} in
       let prover, options = 
         if mergeOptionsFromSourceFile then
           merge_options_from_source_file prover options path
         else
           prover, options
       in
+      (* Workers are forked processes, so they cannot share a prover that runs in a separate process. *)
+      let options =
+        if List.mem (String.lowercase_ascii prover) ["redux"; "z3v4.5"] then options else {options with option_jobs = 1; option_branch_jobs = 1}
+      in
+      (* Entries hold the results of one prover. *)
+      let options =
+        {options with option_verification_cache = Option.map (fun dir -> Filename.concat dir (String.lowercase_ascii prover)) options.option_verification_cache}
+      in
+      (* A trace holds all calls of the run, so they are made by this process, also for cached functions. *)
+      let options =
+        if options.option_dump_smt_queries = None then options else
+        {options with option_jobs = 1; option_branch_jobs = 1; option_verification_cache = None}
+      in
       let stats = verify_program ~emitter_callback:emitter_callback prover options path callbacks breakpoint focus targetPath in
       reportDeadCode ();
       dumpPerLineStmtExecCounts ();
       if print_stats then stats#printStats;
+      !Stats.location_profile |> Option.iter (fun file -> stats#printLocationProfile 20; stats#writeLocationProfile file);
       let msg = stats#get_success_message in
       if json then
         exit_with_json_result (A [S "success"; S msg])
@@ -303,6 +331,12 @@ let _ =
         print_endline details;
         exit 1
       end
+    | Verifast1.VerificationCancelled ->
+      if json then
+        exit_with_json_result (A [S "Cancelled"])
+      else begin
+        print_endline "Verification cancelled."; exit 1
+      end
     | StaticError (l, msg, url) ->
       begin match applyQuickFix with
         None -> ()
@@ -446,6 +480,7 @@ let _ =
       verify (fun _ _ -> ())
   in
   let stats = ref false in
+  let stats_json = ref None in
   let json = ref false in
   let expected_json_result_file = ref None in
   let apply_quick_fix = ref None in
@@ -466,6 +501,12 @@ let _ =
   let dumpPerLineStmtExecCounts = ref false in
   let allowDeadCode = ref false in
   let allowIgnoreRefCreation = ref false in
+  let jobs = ref 1 in
+  let branchJobs = ref 1 in
+  let branchDepth = ref 4 in
+  let verificationCache = ref None in
+  let dumpSmtQueries = ref None in
+  let lazyAxioms = ref false in
   let readOptionsFromSourceFile = ref false in
   let exports: string list ref = ref [] in
   let outputSExpressions : string option ref = ref None in
@@ -510,7 +551,9 @@ let _ =
    * new option should be hidden.
    *)
   let cla = cla @
-            [ "-stats", Set stats, " "
+            [ "-stats", Unit (fun () -> stats := true; Stats.prover_latency := true), " "
+            ; "-stats_json", String (fun file -> stats_json := Some file; Stats.prover_latency := true), "Write the statistics of -stats, the timing, branches and prover queries of every function, the latency histograms of the prover calls, and the phase times, including those of the C++ frontend, to the specified file as JSON"
+            ; "-profile_locations", String (fun file -> Stats.location_profile := Some file), "Charge the time of symbolic execution and of prover calls to the statement being verified, print the 20 most expensive statements, and write the time charged to every source line to the specified file, as tab-separated path, line, seconds, prover seconds and statement executions."
             ; "-read_options_from_source_file", Set readOptionsFromSourceFile, "Retrieve disable_overflow_check, prover, target settings from first line of .c/.java file; syntax: //verifast_options{disable_overflow_check prover:z3v4.5 target:32bit}"
             ; "-json", Set json, "Report result as JSON"
             ; "-expect_json_result", String (fun file -> json := true; expected_json_result_file := Some file), "Expect JSON result from file"
@@ -526,6 +569,15 @@ let _ =
             ; "-break_at_node", String (fun path -> targetPath := Some (path |> String.split_on_char ',' |> List.map int_of_string)), "Break when symbolic execution reaches the specified node in the execution tree."
             ; "-allow_should_fail", Set allowShouldFail, "Allow '//~' annotations that specify the line should fail."
             ; "-allow_ignore_ref_creation", Set allowIgnoreRefCreation, "Allow //~ignore_ref_creation directives."
+            ; "-verification_cache", String (fun dir -> verificationCache := Some dir), "Skip the functions whose bodies were verified before, with the same declarations and options, as recorded in the specified directory."
+            ; "-j", Set_int jobs, "Verify function bodies on the specified number of worker processes (Unix only; Redux and Z3v4.5 provers only). With -stats, the prover statistics only cover the bodies verified by this process."
+            ; "-branch_jobs", Set_int branchJobs, "Explore branches of symbolic execution on up to the specified number of processes, by forking a process for the right branch of a branch below the depth given by -branch_depth (Unix only; Redux and Z3v4.5 provers only)."
+            ; "-branch_depth", Set_int branchDepth, "Depth of the branches from which -branch_jobs forks processes (default: 4)."
+            ; "-z3_check_assumptions", Unit (fun () -> Z3v4dot5prover.check_assumptions := true), "With prover Z3v4.5, answer queries by checking assumptions instead of by pushing and popping."
+            ; "-dump_smt_queries", String (fun dir -> dumpSmtQueries := Some dir; Z3v4dot5prover.log_dir := Some dir), "Write the calls made to the prover to a trace file in the specified directory, for replay with vfreplay, and, with prover Z3v4.5, a Z3 log. Implies -j 1 and -branch_jobs 1, and disables -verification_cache."
+            ; "-lazy_axioms", Set lazyAxioms, "Assert the axioms of the prelude and of the declarations only once a term that mentions one of their symbols is assumed or queried."
+            ; "-server", String (fun _ -> raise (Bad "-server must be the only option")), "Verify the command lines sent by clients to the specified Unix socket, each in a process forked from this one, which keeps the parsed C++ preludes and ghost headers of earlier runs (Unix only)."
+            ; "-client", String (fun _ -> raise (Bad "-client must be the first option")), "Have the verifast server on the specified Unix socket verify the rest of the command line, and exit with its result."
             ; "-emit_vfmanifest", Set emitManifest, " "
             ; "-check_vfmanifest", Set checkManifest, " "
             ; "-emit_dll_vfmanifest", Set emitDllManifest, " "
@@ -588,6 +640,12 @@ let _ =
           option_use_java_frontend = !useJavaFrontend;
           option_enforce_annotations = !enforceAnnotations;
           option_report_skipped_stmts = false;
+          option_jobs = !jobs;
+          option_branch_jobs = !branchJobs;
+          option_branch_depth = !branchDepth;
+          option_verification_cache = !verificationCache;
+          option_dump_smt_queries = !dumpSmtQueries;
+          option_lazy_axioms = !lazyAxioms;
         } in
         if not !json then print_endline filename;
         let emitter_callback (path : string) (dir : string) (packages : package list) =
@@ -608,7 +666,7 @@ let _ =
                 SExpressionEmitter.emit target_file packages
               | None             -> ()
         in
-        verify ~emitter_callback:emitter_callback !stats options !prover filename !emitHighlightedSourceFiles !dumpPerLineStmtExecCounts !allowDeadCode !json !expected_json_result_file !apply_quick_fix !readOptionsFromSourceFile !breakpoint !focus !targetPath;
+        verify ~emitter_callback:emitter_callback ?stats_json:!stats_json !stats options !prover filename !emitHighlightedSourceFiles !dumpPerLineStmtExecCounts !allowDeadCode !json !expected_json_result_file !apply_quick_fix !readOptionsFromSourceFile !breakpoint !focus !targetPath;
         allModules := ((Filename.chop_extension filename) ^ ".vfmanifest")::!allModules
       end
     else if Filename.check_suffix filename ".o" then
@@ -634,7 +692,7 @@ let _ =
     Verifast.banner ()
     ^ "\nUsage: verifast [options] {sourcefile|objectfile}\n"
   in
-  if Array.length Sys.argv = 1
+  if Array.length argv = 1
   then usage cla usage_string
   else begin
     let all_files_are_dotrs_files = ref true in
@@ -645,7 +703,15 @@ let _ =
       if !verbose = -1 then Printf.printf "%10.6fs: done with file %s\n\n" (Perf.time()) filename;
       result
     in
-    parse cla process_file usage_string;
+    (* The C++ AST exporter for the next C++ source file runs while the current one is verified. *)
+    Cxx_frontend.Exporter_prefetch.set_upcoming
+      (List.tl (Array.to_list argv) |> List.filter (fun arg -> Filename.check_suffix arg ".cpp"));
+    begin try
+      parse_argv ~current:(ref 0) argv cla process_file usage_string
+    with
+      Bad msg -> prerr_string msg; exit 2
+    | Help msg -> print_string msg; exit 0
+    end;
     if not !compileOnly && not !all_files_are_dotrs_files then
       begin
         try
@@ -669,3 +735,9 @@ let _ =
           | CompilationError msg -> print_endline ("error: " ^ msg); exit 1
       end
   end
+
+let () =
+  match Array.to_list Sys.argv with
+    [_; "-server"; socket] -> Vfserver.serve main socket
+  | _::"-client"::socket::args -> Vfserver.request socket args
+  | _ -> main Sys.argv
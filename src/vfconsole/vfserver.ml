@@ -0,0 +1,178 @@
+(*
+   verifast -server <socket> verifies the command lines that clients send to a Unix socket, each in a
+   process forked from the server. A run thereby skips starting VeriFast and loading its provers and
+   libraries, and finds the C++ preludes and ghost #include annotations that earlier runs parsed in
+   memory, and reuses the translation of a C++ program whose export did not change since an earlier run:
+   the server points VF_CXX_PRELUDE_CACHE, VF_CXX_GHOST_HEADER_CACHE and VF_CXX_TU_CACHE to a directory of
+   its own unless they are set, and loads the entries that runs write there before it forks the next run.
+   C++ runs use the exporter daemon at VF_CXX_EXPORT_DAEMON, which the server starts next to this
+   executable unless it is set, so the exporter is not started for every run either.
+
+   Every run still type-checks its program and prelude and asserts their axioms on a fresh prover:
+   the checked environment refers to the terms of the prover it was built with, and a prover context
+   shared by runs would carry over the declarations of earlier programs.
+
+   A client connects once per run, sends the working directory and the command line, without the
+   name of the executable, separated by NUL characters, and shuts down its side of the connection for
+   writing. The server sends back the stdout and stderr of the run, followed by a NUL character and
+   the exit code of the run in decimal, and closes the connection. verifast -client <socket> is such a
+   client. Only available on Unix.
+*)
+
+let cache_vars = ["VF_CXX_PRELUDE_CACHE"; "VF_CXX_GHOST_HEADER_CACHE"; "VF_CXX_TU_CACHE"]
+
+let is_set var = match Sys.getenv_opt var with Some "" | None -> false | Some _ -> true
+
+(* The caches read their directory when they are initialized, so the server sets the ones that are not
+   set and starts itself again. *)
+let ensure_cache_dirs () =
+  let unset = List.filter (fun var -> not (is_set var)) cache_vars in
+  if unset <> [] then begin
+    let dir = Filename.concat (Filename.get_temp_dir_name ()) (Printf.sprintf "vf-server-cache-%d" (Unix.getpid ())) in
+    begin try Unix.mkdir dir 0o700 with Unix.Unix_error (Unix.EEXIST, _, _) -> () end;
+    List.iter (fun var -> Unix.putenv var dir) unset;
+    Unix.execv Sys.executable_name Sys.argv
+  end
+
+(* Runs [f] at exit of the server, but not at exit of the processes forked from it. *)
+let at_server_exit f =
+  let server = Unix.getpid () in
+  at_exit (fun () -> if Unix.getpid () = server then f ())
+
+(* Starts the exporter daemon next to this executable, as mysh -cxx_exporter_daemon does, unless one is
+   given by VF_CXX_EXPORT_DAEMON or the exporter was not built. *)
+let start_cxx_exporter_daemon () =
+  let exporter = Filename.concat (Filename.dirname Sys.executable_name) "vf-cxx-ast-exporter" in
+  if not (is_set "VF_CXX_EXPORT_DAEMON") && Sys.file_exists exporter then begin
+    let socket = Filename.concat (Filename.get_temp_dir_name ()) (Printf.sprintf "vf-cxx-exporter-%d.sock" (Unix.getpid ())) in
+    let devnull = Unix.openfile "/dev/null" [Unix.O_RDONLY] 0 in
+    let pid = Unix.create_process exporter [|exporter; "-listen=" ^ socket|] devnull Unix.stdout Unix.stderr in
+    Unix.close devnull;
+    at_server_exit begin fun () ->
+      (try Unix.kill pid Sys.sigterm with Unix.Unix_error _ -> ());
+      (try ignore (Unix.waitpid [] pid) with Unix.Unix_error _ -> ());
+      try Sys.remove socket with Sys_error _ -> ()
+    end;
+    (* Runs start the exporter themselves while they cannot connect to the daemon. *)
+    Unix.putenv "VF_CXX_EXPORT_DAEMON" socket
+  end
+
+let read_all fd =
+  let buffer = Buffer.create 1024 in
+  let chunk = Bytes.create 65536 in
+  let rec iter () =
+    let n = Unix.read fd chunk 0 (Bytes.length chunk) in
+    if n > 0 then begin Buffer.add_subbytes buffer chunk 0 n; iter () end
+  in
+  iter ();
+  Buffer.contents buffer
+
+let write_all fd text =
+  let rec iter offset =
+    if offset < String.length text then
+      iter (offset + Unix.write_substring fd text offset (String.length text - offset))
+  in
+  iter 0
+
+(* Runs the request on [conn] in a child of this process, whose stdout and stderr are the connection,
+   and sends its exit code. *)
+let handle_request (main : string array -> unit) (conn : Unix.file_descr) =
+  match String.split_on_char '\000' (read_all conn) with
+    [] | [""] -> ()
+  | cwd::args ->
+    let status =
+      match Unix.fork () with
+        0 ->
+        let devnull = Unix.openfile "/dev/null" [Unix.O_RDONLY] 0 in
+        Unix.dup2 devnull Unix.stdin;
+        Unix.dup2 conn Unix.stdout;
+        Unix.dup2 conn Unix.stderr;
+        Unix.close devnull;
+        Unix.close conn;
+        Sys.chdir cwd;
+        main (Array.of_list ("verifast"::args));
+        exit 0
+      | pid ->
+        snd (Unix.waitpid [] pid)
+    in
+    let code = match status with Unix.WEXITED code -> code | Unix.WSIGNALED _ | Unix.WSTOPPED _ -> 255 in
+    write_all conn (Printf.sprintf "\000%d" code)
+
+(**
+  [serve main socket] listens on [socket] and, for every client, runs [main] on the command line it sends,
+  see above. Does not return.
+*)
+let serve (main : string array -> unit) (socket : string) : unit =
+  ensure_cache_dirs ();
+  start_cxx_exporter_daemon ();
+  (try Sys.remove socket with Sys_error _ -> ());
+  let sock = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+  Unix.bind sock (Unix.ADDR_UNIX socket);
+  Unix.listen sock 16;
+  at_server_exit (fun () -> try Sys.remove socket with Sys_error _ -> ());
+  Sys.set_signal Sys.sigterm (Sys.Signal_handle (fun _ -> exit 0));
+  Sys.set_signal Sys.sigint (Sys.Signal_handle (fun _ -> exit 0));
+  Sys.set_signal Sys.sigpipe Sys.Signal_ignore;
+  Printf.printf "%s\nListening on %s\n%!" (Verifast.banner ()) socket;
+  let rec reap () =
+    match Unix.waitpid [Unix.WNOHANG] (-1) with
+      (0, _) -> ()
+    | _ -> reap ()
+    | exception Unix.Unix_error _ -> ()
+  in
+  while true do
+    match Unix.accept ~cloexec:true sock with
+      exception Unix.Unix_error (Unix.EINTR, _, _) -> ()
+    | (conn, _) ->
+      reap ();
+      Cxx_frontend.Prelude_cache.load ();
+      Cxx_frontend.Ghost_header_cache.load ();
+      Cxx_frontend.Tu_cache.load ();
+      begin match Unix.fork () with
+        0 ->
+        Unix.close sock;
+        Sys.set_signal Sys.sigpipe Sys.Signal_default;
+        begin try handle_request main conn with Unix.Unix_error _ -> () end;
+        Unix._exit 0
+      | _ ->
+        Unix.close conn
+      end
+  done
+
+(**
+  [request socket args] has the server on [socket] verify command line [args] in the current directory,
+  copies the output of the run to stdout, and exits with the exit code of the run.
+*)
+let request (socket : string) (args : string list) : unit =
+  let sock = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+  begin try Unix.connect sock (Unix.ADDR_UNIX socket) with Unix.Unix_error (error, _, _) ->
+    prerr_endline (Printf.sprintf "Could not connect to the verifast server at %s: %s" socket (Unix.error_message error));
+    exit 1
+  end;
+  write_all sock (String.concat "\000" (Sys.getcwd ()::args));
+  Unix.shutdown sock Unix.SHUTDOWN_SEND;
+  let code = Buffer.create 4 in
+  let in_code = ref false in
+  let chunk = Bytes.create 65536 in
+  let rec iter () =
+    let n = Unix.read sock chunk 0 (Bytes.length chunk) in
+    if n > 0 then begin
+      if !in_code then
+        Buffer.add_subbytes code chunk 0 n
+      else begin
+        match Bytes.index_from_opt chunk 0 '\000' with
+          Some i when i < n ->
+          output stdout chunk 0 i;
+          Buffer.add_subbytes code chunk (i + 1) (n - i - 1);
+          in_code := true
+        | _ ->
+          output stdout chunk 0 n
+      end;
+      flush stdout;
+      iter ()
+    end
+  in
+  iter ();
+  match int_of_string_opt (Buffer.contents code) with
+    Some status when !in_code -> exit status
+  | _ -> prerr_endline "The verifast server closed the connection before the run ended."; exit 1
@@ -130,8 +130,27 @@ let register_recent_file path =
 type layout = FourThree | Widescreen
 
 let include_paths: string list ref = ref []
+
+(* Verification cache of this session, see option_verification_cache. When only some function bodies changed
+   since the previous run, the other bodies are not verified again. It is removed when vfide exits. *)
+let session_verification_cache = lazy begin
+  let dir = Filename.concat (Filename.get_temp_dir_name ()) (Printf.sprintf "vfide-%d-verification-cache" (Unix.getpid ())) in
+  let rec remove path =
+    if Sys.is_directory path then begin
+      Array.iter (fun name -> remove (Filename.concat path name)) (Sys.readdir path);
+      Sys.rmdir path
+    end else
+      Sys.remove path
+  in
+  at_exit (fun () -> try remove dir with Sys_error _ -> ());
+  dir
+end
 let define_macros: string list ref = ref []
 
+(* A C++ program that is verified again reuses its translation if the exporter's output did not change,
+   e.g. after an edit of a comment outside annotations. See Cxx_frontend.Tu_cache. *)
+let () = Cxx_frontend.Tu_cache.enabled := true
+
 let () = Unix.putenv "LANG" "en_US" (* This works around a problem that causes vfide to become unusable in the Chinese locale. *)
 
 let () =
@@ -1003,10 +1022,14 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
     in
     set_current_tab (Some tab)
   end;
+  (* The contents of the file that saving the buffer writes. *)
+  let file_text tab =
+    let text = (tab#buffer: SourceView.source_buffer)#get_text () in
+    utf8_to_file (convert_eol !(tab#eol) text)
+  in
   let store tab thePath =
     let chan = open_out_bin thePath in
-    let text = (tab#buffer: SourceView.source_buffer)#get_text () in
-    output_string chan (utf8_to_file (convert_eol !(tab#eol) text));
+    output_string chan (file_text tab);
     flush chan;
     (* let mtime = out_channel_last_modification_time chan in *)
     close_out chan;
@@ -1421,8 +1444,39 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
       ) !buffers
     end
   in
+  (* The last verification of the whole program that succeeded: its settings, a digest of every file it read,
+     and its message. Verifying again while none of these changed shows its results again, which are still on
+     display. It is forgotten when a buffer changes. *)
+  let lastVerification : (string * (string * Digest.t) list * string) option ref = ref None in
+  (* Once the buffers have been idle for a moment after an edit, a C++ program in the first buffer is exported
+     ahead of its verification, with the unsaved buffers in place of their files; the export is used if the buffers
+     are saved unchanged when the program is verified. See Exporter_prefetch.speculate. *)
+  let speculationTimeout = ref None in
+  let speculateExport () =
+    speculationTimeout := None;
+    begin match !buffers with
+      tab::_ ->
+      begin match !(tab#path) with
+        Some (path, _) when Filename.check_suffix path ".cpp" || Filename.check_suffix path ".hpp" ->
+        let overlays =
+          !buffers |> List.filter_map begin fun tab' ->
+            match !(tab'#path) with
+              Some (path', _) when tab'#buffer#modified -> Some (path', file_text tab')
+            | _ -> None
+          end
+        in
+        if overlays <> [] then
+          ignore (Cxx_frontend.Exporter_prefetch.speculate path overlays)
+      | _ -> ()
+      end
+    | [] -> ()
+    end;
+    false
+  in
   bufferChangeListener := (fun tab ->
-    ()
+    lastVerification := None;
+    Option.iter Glib.Timeout.remove !speculationTimeout;
+    speculationTimeout := Some (Glib.Timeout.add ~ms:500 ~callback:speculateExport)
   );
   ignore $. root#event#connect#delete ~callback:(fun _ ->
     let rec iter tabs =
@@ -1655,7 +1709,11 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
         Some (path, insert_line + 1)
     end
   in
-  let verifyProgram runToCursor focus targetPath () =
+  let verificationSettings () =
+    try Some (Marshal.to_string (prover, !vfbindings, !useJavaFrontend, !include_paths, !define_macros) []) with Invalid_argument _ -> None
+  in
+  let verifyProgram0 runToCursor focus targetPath () =
+    lastVerification := None;
     msg := Some("Verifying...");
     updateMessageEntry(false);
     clearTrace();
@@ -1700,6 +1758,12 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
                 option_safe_mode = false;
                 option_header_whitelist = [];
                 option_report_skipped_stmts = false;
+                option_jobs = 1;
+                option_branch_jobs = 1;
+                option_branch_depth = 0;
+                option_verification_cache = None;
+                option_dump_smt_queries = None;
+                option_lazy_axioms = false;
               }
               in
               let reportExecutionForest =
@@ -1731,8 +1795,14 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
                   "allow_dead_code" -> true
                 | _ -> false
               in
+              let readFiles = Hashtbl.create 16 in
+              let reportRange kind (((path', _, _), _) as l) =
+                Hashtbl.replace readFiles path' ();
+                reportRange kind l
+              in
               let prover, options = merge_options_from_source_file prover options path in
-              let stats = verify_program prover options path {reportRange; reportUseSite; reportStmt; reportStmtExec; reportExecutionForest; reportDirective} breakpoint focus targetPath in
+              let options = {options with option_verification_cache = Some (Filename.concat (Lazy.force session_verification_cache) (String.lowercase_ascii prover))} in
+              let stats = verify_program prover options path {reportRange; reportUseSite; reportStmt; reportStmtExec; reportExecutionForest; reportDirective; cancellationRequested = (fun () -> false)} breakpoint focus targetPath in
               begin
                 let _, tab = get_tab_for_path path in
                 let column = tab#stmtExecCountsColumn in
@@ -1748,7 +1818,14 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
                 else
                   (msg := Some(stats#get_success_message); true)
               in
-              updateMessageEntry(success)
+              updateMessageEntry(success);
+              begin match verificationSettings (), !msg with
+                Some settings, Some msg when success && not focus ->
+                Hashtbl.replace readFiles path ();
+                let digests = Hashtbl.fold (fun path () digests -> try (path, Digest.file path)::digests with Sys_error _ -> digests) readFiles [] in
+                lastVerification := Some (settings, digests, msg)
+              | _ -> ()
+              end
             with
               PreprocessorDivergence (l, emsg) ->
               handleStaticError (Lexed l) ("Preprocessing error" ^ (if emsg = "" then "." else ": " ^ emsg)) None
@@ -1801,6 +1878,19 @@ let show_ide initialPath prover codeFont traceFont vfbindings layout javaFronten
           end
       end
   in
+  let verifyProgram runToCursor focus targetPath () =
+    let unchanged =
+      match !lastVerification, verificationSettings (), !msg with
+        Some (settings0, digests, msg0), Some settings, Some msg when not runToCursor && not focus && targetPath = None && settings = settings0 && msg = msg0 ->
+        not (List.exists (fun tab -> tab#buffer#modified) !buffers) &&
+        digests |> List.for_all (fun (path, digest) -> try Digest.equal (Digest.file path) digest with Sys_error _ -> false)
+      | _ -> false
+    in
+    if unchanged then
+      updateMessageEntry(true)
+    else
+      verifyProgram0 runToCursor focus targetPath ()
+  in
   let runShapeAnalyser () =
     (* TODO: after running the shape analyser, the undo history
      * has the step "clear buffer" and "put contents", but that should
@@ -0,0 +1,64 @@
+(*
+  Replays the traces written by verifast -dump_smt_queries against one or more provers and reports the time
+  each prover took, in total and, with -per_function, per function. A check is an assumption or query whose
+  answer was recorded; the number of checks a prover answered differently than the prover that wrote the
+  trace is reported next to its time.
+*)
+open Prover_trace
+
+let provers = ref []
+let per_function = ref false
+let files = ref []
+
+(** [replay_with prover events] replays [events] against a fresh context of registered prover [prover]. *)
+let replay_with prover events =
+  let results = ref [] in
+  ignore
+    (Verifast.lookup_prover prover
+       (object
+         method run: 'typenode 'symbol 'termnode. ('typenode, 'symbol, 'termnode) Proverapi.context -> Stats.stats =
+           fun ctxt -> results := replay ctxt events; new Stats.stats
+       end));
+  !results
+
+let () =
+  Register_provers.register_provers ();
+  Arg.parse
+    [
+      ("-prover", String (fun prover -> provers := !provers @ [prover]), "<prover> Replay against the specified prover; may be given more than once (default: Redux and Z3v4.5)");
+      ("-per_function", Set per_function, " Report the time of every function, not just the total");
+    ]
+    (fun path -> files := !files @ [path])
+    ("Usage: vfreplay [-prover p]... [-per_function] trace...\nTimes are in milliseconds.\n" ^ Verifast.list_provers ());
+  let provers = if !provers = [] then ["Redux"; "Z3v4.5"] else !provers in
+  !files |> List.iter begin fun file ->
+    let events = read_trace file in
+    let results =
+      provers |> List.map begin fun prover ->
+        match replay_with prover events with
+          results -> Ok results
+        | exception e -> Error (Printexc.to_string e)
+      end
+    in
+    Printf.printf "%s\n" file;
+    provers |> List.iter (fun prover -> Printf.printf "%20s" prover);
+    print_newline ();
+    let row segment times =
+      times |> List.iter (fun (time, disagreements) ->
+        Printf.printf "%12.3f %7s" (time *. 1000.0) (if disagreements = 0 then "" else Printf.sprintf "(%d)" disagreements));
+      Printf.printf "  %s\n" segment
+    in
+    match List.find_map (function Error e -> Some e | Ok _ -> None) results with
+      Some e ->
+      List.iter2 (fun prover -> function Error e -> Printf.printf "%s failed: %s\n" prover e | Ok _ -> ()) provers results
+    | None ->
+      let results = List.map (fun r -> Array.of_list (Result.get_ok r)) results in
+      let first = List.hd results in
+      if !per_function then
+        first |> Array.iteri begin fun i {segment; _} ->
+          row segment (results |> List.map (fun rs -> (rs.(i).time, rs.(i).disagreements)))
+        end;
+      let checks = Array.fold_left (fun n r -> n + r.checks) 0 first in
+      row (Printf.sprintf "total of %d functions and %d checks" (Array.length first - 1) checks)
+        (results |> List.map (Array.fold_left (fun (time, disagreements) r -> (time +. r.time, disagreements + r.disagreements)) (0.0, 0)))
+  end
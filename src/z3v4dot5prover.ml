@@ -77,7 +77,22 @@ module Z3 = struct
 
 end
 
+(* If set, each context writes a log of the calls made to Z3 to a new file in this directory; the z3 executable
+   replays such a log when given it as its input file. *)
+let log_dir: string option ref = ref None
+
+(* If set, a query is answered by checking the negation of the queried term as an assumption, instead of
+   asserting it between a push and a pop, so that the solver keeps what it learned from the assertions. *)
+let check_assumptions = ref false
+
 class z3_context () =
+  let () =
+    !log_dir |> Option.iter begin fun dir ->
+      if not (Sys.file_exists dir) then Sys.mkdir dir 0o777;
+      let path = Filename.concat dir (Printf.sprintf "z3.%d.log" (Unix.getpid ())) in
+      if not (Z3native.open_log path) then failwith ("Could not open Z3 log " ^ path)
+    end
+  in
   let () = Z3native.global_param_set "smt.auto_config" "false" in
   let () = Z3native.global_param_set "smt.mbqi" "false" in
   let cfg = Z3native.mk_config () in
@@ -107,18 +122,40 @@ class z3_context () =
   let get_ctor_tag () = let k = !ctor_counter in ctor_counter := k + 1; k in
   let mk_unary_app f t = Z3.mk_app ctxt f [| t |] in
   let solver = Z3native.mk_simple_solver ctxt in
+  (* Answers to the queries since the last change to the assertions, by the id of the queried term; the
+     term is kept so that its id is not reused. *)
+  let query_results : (int, Z3native.ast * bool) Hashtbl.t = Hashtbl.create 64 in
+  let cached_query_count = ref 0 in
+  let invalidate_query_results () = if Hashtbl.length query_results > 0 then Hashtbl.reset query_results in
+  let solver_assert t =
+    invalidate_query_results ();
+    Z3native.solver_assert ctxt solver t
+  in
   let assert_term t =
-    Z3native.solver_assert ctxt solver t;
+    solver_assert t;
     match Z3enums.lbool_of_int (Z3native.solver_check ctxt solver) with
       Z3enums.L_FALSE -> Unsat
     | Z3enums.L_UNDEF -> Unknown
     | Z3enums.L_TRUE -> Unknown
   in
   let query t =
-    Z3native.solver_push ctxt solver;
-    let result = assert_term (Z3native.mk_not ctxt t) = Unsat in
-    Z3native.solver_pop ctxt solver 1;
-    result
+    let id = Z3native.get_ast_id ctxt t in
+    match Hashtbl.find_opt query_results id with
+      Some (t', result) when Z3native.is_eq_ast ctxt t t' -> incr cached_query_count; result
+    | _ ->
+      let result =
+        if !check_assumptions then
+          Z3enums.lbool_of_int (Z3native.solver_check_assumptions ctxt solver 1 [Z3native.mk_not ctxt t]) = Z3enums.L_FALSE
+        else begin
+          Z3native.solver_push ctxt solver;
+          Z3native.solver_assert ctxt solver (Z3native.mk_not ctxt t);
+          let result = Z3enums.lbool_of_int (Z3native.solver_check ctxt solver) = Z3enums.L_FALSE in
+          Z3native.solver_pop ctxt solver 1;
+          result
+        end
+      in
+      Hashtbl.replace query_results id (t, result);
+      result
   in
   let assume_is_inverse f1 f2 dom2 =
     let name = Z3native.mk_int_symbol ctxt 0 in
@@ -126,7 +163,7 @@ class z3_context () =
     let app1 = Z3.mk_app ctxt f2 [| x |] in
     let app2 = Z3.mk_app ctxt f1 [| app1 |] in
     let pat = Z3.mk_pattern ctxt [| app1 |] in
-    Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] [| dom2 |] [| name |] (Z3native.mk_eq ctxt app2 x))
+    solver_assert (Z3.mk_forall ctxt 0 [| pat |] [| dom2 |] [| name |] (Z3native.mk_eq ctxt app2 x))
   in
   let boxed_int = Z3.mk_func_decl ctxt (Z3native.mk_string_symbol ctxt "(intbox)") [| int_type |] inductive_type in
   let unboxed_int = Z3.mk_func_decl ctxt (Z3native.mk_string_symbol ctxt "(int)") [| inductive_type |] int_type in
@@ -139,7 +176,7 @@ class z3_context () =
   let unboxed_real = Z3.mk_func_decl ctxt (Z3native.mk_string_symbol ctxt "(real)") [| inductive_type |] real_type in
   let () = assume_is_inverse unboxed_real boxed_real real_type in
   let () = assume_is_inverse boxed_real unboxed_real inductive_type in
-  object
+  object (self)
     val mutable verbosity = 0
     val mutable pushlevel = 0
     method set_verbosity v = verbosity <- v
@@ -165,14 +202,14 @@ class z3_context () =
             let xs = Array.init (Array.length tps) (fun j -> Z3native.mk_bound ctxt j tps.(j)) in
             let app = Z3.mk_app ctxt c xs in
             if domain = [] then
-              Z3native.solver_assert ctxt solver (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag)
+              solver_assert (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag)
             else
             begin
               let names = Array.init (Array.length tps) (Z3native.mk_int_symbol ctxt) in
               let pat = Z3.mk_pattern ctxt [| app |] in
               (* disjointness axiom *)
               (* (forall (x1 ... xn) (PAT (C x1 ... xn)) (EQ (tag (C x1 ... xn)) Ctag)) *)
-              Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag));
+              solver_assert (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app tag_func app) tag));
             end
           end;
           for i = 0 to Array.length tps - 1 do
@@ -183,7 +220,7 @@ class z3_context () =
             let pat = Z3.mk_pattern ctxt [| app |] in
             (* injectiveness axiom *)
             (* (forall (x1 ... x2) (PAT (C x1 ... xn)) (EQ (finv (C x1 ... xn)) xi)) *)
-            Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app finv app) (xs.(i))))
+            solver_assert (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt (mk_unary_app finv app) (xs.(i))))
           done
         | Fixpoint (_, j) -> ()
         | Uninterp -> ()
@@ -208,16 +245,18 @@ class z3_context () =
            let pat = Z3.mk_pattern ctxt [| fapp |] in
            let body = fbody (Array.to_list fargs) (Array.to_list cargs) in
            if l = 0 then
-             Z3native.solver_assert ctxt solver (Z3native.mk_eq ctxt fapp body)
+             solver_assert (Z3native.mk_eq ctxt fapp body)
            else
              (* (FORALL (x1 ... y1 ... ym ... xn) (PAT (f x1 ... (C y1 ... ym) ... xn)) (EQ (f x1 ... (C y1 ... ym) ... xn) body)) *)
-             Z3native.solver_assert ctxt solver (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt fapp body))
+             solver_assert (Z3.mk_forall ctxt 0 [| pat |] tps names (Z3native.mk_eq ctxt fapp body))
         )
         cs
 
     method mk_app s ts =
       if verbosity >= 100 then printff "Z3#mk_app %s [%s]\n" (Z3native.func_decl_to_string ctxt s) (String.concat "; " (List.map (Z3native.ast_to_string ctxt) ts));
-      Z3.mk_app ctxt s (Array.of_list ts)
+      Z3native.mk_app ctxt s (List.length ts) ts
+    (* The Z3 API has no call that builds several applications. *)
+    method mk_apps apps = Array.map (fun (s, ts) -> self#mk_app s ts) apps
     method mk_true = ttrue
     method mk_false = tfalse
     method mk_and t1 t2 = Z3native.mk_and ctxt 2 [t1; t2]
@@ -254,7 +293,7 @@ class z3_context () =
     method pprint_sort (s : Z3native.sort) = Z3native.ast_to_string ctxt s
     method pprint_sym (s : Z3native.func_decl) = Z3native.ast_to_string ctxt s
     method assert_term t =
-      Z3native.solver_assert ctxt solver t
+      solver_assert t
     method query t =
       (* printf "Z3prover.query (%s)... " (Z3native.ast_to_string ctxt t); *)
       let t0 = if verbosity >= 1 then Perf.time() else 0.0 in
@@ -267,6 +306,18 @@ class z3_context () =
       let result = assert_term t in
       if verbosity >= 1 then begin let t1 = Perf.time() in Printf.printf "%10.6fs: Z3 assume %s: %.6f seconds\n" t0 (Z3native.ast_to_string ctxt t) (t1-. t0) end;
       result
+    method assume_all ts =
+      let t0 = if verbosity >= 1 then Perf.time() else 0.0 in
+      Array.iter solver_assert ts;
+      let result =
+        match Z3enums.lbool_of_int (Z3native.solver_check ctxt solver) with
+          Z3enums.L_FALSE -> Unsat
+        | Z3enums.L_UNDEF | Z3enums.L_TRUE -> Unknown
+      in
+      if verbosity >= 1 then begin let t1 = Perf.time() in Printf.printf "%10.6fs: Z3 assume %d terms: %.6f seconds\n" t0 (Array.length ts) (t1 -. t0) end;
+      result
+    method assume_async t = let result = self#assume t in fun () -> result
+    method query_async t = let result = self#query t in fun () -> result
     method push =
       if verbosity >= 10 then Printf.printf "Pushing from level %d to %d\n" pushlevel (pushlevel + 1);
       pushlevel <- pushlevel + 1;
@@ -274,15 +325,25 @@ class z3_context () =
     method pop =
       if verbosity >= 10 then Printf.printf "Popping from level %d to %d\n" pushlevel (pushlevel - 1);
       pushlevel <- pushlevel - 1;
+      invalidate_query_results ();
       Z3native.solver_pop ctxt solver 1
+    method snapshot =
+      self#push;
+      pushlevel
+    method restore level =
+      if pushlevel < level then failwith "Snapshot has been popped";
+      invalidate_query_results ();
+      Z3native.solver_pop ctxt solver (pushlevel - level + 1);
+      pushlevel <- level - 1;
+      self#push
     method perform_pending_splits (cont: Z3native.ast list -> bool) = cont []
-    method stats: string * (string * int64) list = "(no statistics for Z3)", []
+    method stats: string * (string * int64) list = Printf.sprintf "Z3 queries answered from the cache: %d\n" !cached_query_count, []
     method begin_formal = ()
     method end_formal = ()
     method mk_bound (i: int) (tp: Z3native.sort) = Z3native.mk_bound ctxt i tp
     method assume_forall (description: string) (triggers: Z3native.ast list) (tps: Z3native.sort list) (body: Z3native.ast): unit = 
       if List.length tps = 0 then
-        Z3native.solver_assert ctxt solver body
+        solver_assert body
       else
         let pats = (
           match triggers with
@@ -291,6 +352,6 @@ class z3_context () =
         ) in
         let quant = (Z3.mk_forall ctxt 0 pats (Array.of_list tps) (Array.init (List.length tps) (Z3native.mk_int_symbol ctxt)) (body)) in
         (* printf "%s\n" (string_of_sexpr (simplify (parse_sexpr (Z3native.ast_to_string ctxt quant)))); *)
-        Z3native.solver_assert ctxt solver quant
+        solver_assert quant
    method simplify (t: Z3native.ast): Z3native.ast option = Some(Z3native.simplify ctxt t)
   end
@@ -0,0 +1,3 @@
+#pragma once
+
+int add_one(int x);
@@ -0,0 +1,5 @@
+#pragma once
+
+int add_one(int x);
+
+int counter_reset();
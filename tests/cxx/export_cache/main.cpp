@@ -0,0 +1,8 @@
+// run.mysh exports this file twice with -cache_dir, and once more after replacing counter.h by
+// counter_extended.h, whose declaration must then appear in the output.
+#include "counter.h"
+
+int add_one(int x)
+{
+  return x + 1;
+}
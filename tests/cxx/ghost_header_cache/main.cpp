@@ -0,0 +1,10 @@
+// run.mysh verifies this file with VF_CXX_GHOST_HEADER_CACHE set, with each of the ghost headers in this
+// directory as bump.gh in turn.
+//@ #include "bump.gh"
+
+int add_one(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == bump(x);
+{
+  return x + 1;
+}
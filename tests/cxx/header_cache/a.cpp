@@ -0,0 +1,12 @@
+// run.mysh verifies this file and b.cpp in one process, so the header cache must not reuse the translation
+// of limit.h made for one file, where __VF_CXX_CLANG_FRONTEND__LIMIT has another definition, for the other.
+#define __VF_CXX_CLANG_FRONTEND__LIMIT 10
+#include "limit.h"
+
+void check_limit()
+//@ requires true;
+//@ ensures true;
+{
+  int x = LIMIT;
+  //@ assert x == 10;
+}
@@ -0,0 +1,11 @@
+// See a.cpp.
+#define __VF_CXX_CLANG_FRONTEND__LIMIT 20
+#include "limit.h"
+
+void check_limit()
+//@ requires true;
+//@ ensures true;
+{
+  int x = LIMIT;
+  //@ assert x == 20;
+}
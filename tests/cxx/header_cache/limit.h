@@ -0,0 +1,4 @@
+#pragma once
+
+// The value of LIMIT depends on the includer, which may do so since the macro is whitelisted.
+enum limits { LIMIT = __VF_CXX_CLANG_FRONTEND__LIMIT };
@@ -0,0 +1,58 @@
+// run.mysh exports this file and then small.cpp in one exporter process, whose message for small.cpp is
+// built in the segments of the message for this file. None of the names below may show up in it.
+
+int stale_marker_0(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 0;
+{
+  return x + 0;
+}
+
+int stale_marker_1(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 1;
+{
+  return x + 1;
+}
+
+int stale_marker_2(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 2;
+{
+  return x + 2;
+}
+
+int stale_marker_3(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 3;
+{
+  return x + 3;
+}
+
+int stale_marker_4(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 4;
+{
+  return x + 4;
+}
+
+int stale_marker_5(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 5;
+{
+  return x + 5;
+}
+
+int stale_marker_6(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 6;
+{
+  return x + 6;
+}
+
+int stale_marker_7(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 7;
+{
+  return x + 7;
+}
@@ -0,0 +1,7 @@
+// See big.cpp.
+int small_only(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 1;
+{
+  return x + 1;
+}
@@ -0,0 +1,7 @@
+// Only verifies while marker.h is appended to the prelude, see plain.cpp.
+int marker()
+//@ requires true;
+//@ ensures result == prelude_marker();
+{
+  return 42;
+}
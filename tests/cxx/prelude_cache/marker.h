@@ -0,0 +1,2 @@
+
+//@ fixpoint int prelude_marker() { return 42; }
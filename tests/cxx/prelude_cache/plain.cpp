@@ -0,0 +1,8 @@
+// run.mysh verifies this file and marker.cpp with VF_CXX_PRELUDE_CACHE set and a bin directory whose
+// prelude_cxx.h is a copy, to which it appends marker.h and from which it removes it again.
+int add_one(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 1;
+{
+  return x + 1;
+}
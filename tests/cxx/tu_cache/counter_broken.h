@@ -0,0 +1,5 @@
+#pragma once
+
+int add_one(int x);
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 2;
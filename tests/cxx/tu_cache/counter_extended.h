@@ -0,0 +1,9 @@
+#pragma once
+
+struct counter {
+  int value;
+};
+
+int add_one(int x);
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 1;
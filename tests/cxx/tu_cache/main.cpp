@@ -0,0 +1,18 @@
+// run.mysh verifies this file with VF_CXX_TU_CACHE set, as verifast -server does, with each of the
+// headers in this directory as counter.h in turn.
+#include "counter.h"
+
+int add_one(int x)
+//@ requires 0 <= x && x < 1000;
+//@ ensures result == x + 1;
+{
+  return x + 1;
+}
+
+int add_two(int x)
+//@ requires 0 <= x && x < 100;
+//@ ensures result == x + 2;
+{
+  int y = add_one(x);
+  return add_one(y);
+}
@@ -0,0 +1,62 @@
+// Fails in one function among several branching ones. Verified with -j or
+// -branch_jobs, it must report the same error as when verified sequentially.
+
+int max(int x, int y)
+    //@ requires true;
+    //@ ensures result == (x < y ? y : x);
+{
+    if (x < y) return y; else return x;
+}
+
+int clamp(int x, int lo, int hi)
+    //@ requires lo <= hi;
+    //@ ensures lo <= result && result <= hi;
+{
+    if (x < lo) return lo;
+    if (x > hi) return hi;
+    return x;
+}
+
+int sign(int x)
+    //@ requires true;
+    //@ ensures result == -1 || result == 0 || result == 1;
+{
+    if (x < 0) return -1;
+    if (x > 0) return 1;
+    return 0;
+}
+
+int abs_positive(int x)
+    //@ requires -1000 < x && x < 1000;
+    //@ ensures 0 < result;
+{
+    if (x < 0) return -x;
+    if (x > 0) return x;
+    return x; // Fails: the result is 0.
+}
+
+int median(int x, int y, int z)
+    //@ requires true;
+    //@ ensures result == x || result == y || result == z;
+{
+    if (x < y) {
+        if (y < z) return y;
+        if (x < z) return z;
+        return x;
+    } else {
+        if (x < z) return x;
+        if (y < z) return z;
+        return y;
+    }
+}
+
+int count_positive(int x, int y, int z)
+    //@ requires true;
+    //@ ensures 0 <= result && result <= 3;
+{
+    int n = 0;
+    if (0 < x) n++;
+    if (0 < y) n++;
+    if (0 < z) n++;
+    return n;
+}
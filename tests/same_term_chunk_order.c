@@ -0,0 +1,20 @@
+// Two fractions of the same field that the verifier does not know hold the
+// same value. A chunk whose address is the very term that is looked up or
+// consumed is used before a chunk that comes earlier in the heap and whose
+// address is only provably equal.
+
+struct cell {
+    int value;
+};
+
+void read_through_alias(struct cell *c, struct cell *d)
+    //@ requires [1/2]c->value |-> ?v &*& [1/2]d->value |-> ?w &*& c == d;
+    //@ ensures [1/2]c->value |-> v &*& [1/2]d->value |-> w;
+{
+    int x = c->value;
+    //@ assert x == v;
+    //@ assert [1/2]c->value |-> ?y;
+    //@ assert y == v;
+    int z = d->value;
+    //@ assert z == w;
+}
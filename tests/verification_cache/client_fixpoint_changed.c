@@ -0,0 +1,26 @@
+// run.mysh verifies this file, and then client_fixpoint_changed.c and client_contract_changed.c, in place of
+// each other. They differ from it in one line, so that their other declarations keep their locations.
+
+//@ fixpoint int next(int x) { return x + 2; }
+
+int incr(int x)
+    //@ requires 0 <= x && x < 1000;
+    //@ ensures result == next(x);
+{
+    return x + 1;
+}
+
+int twice(int x)
+    //@ requires 0 <= x && x < 1000;
+    //@ ensures result == x + x;
+{
+    return x + x;
+}
+
+int four_times(int x)
+    //@ requires 0 <= x && x < 100;
+    //@ ensures result == 4 * x;
+{
+    int y = twice(x);
+    return twice(y);
+}